@@ -0,0 +1,1256 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * mpbench - userspace load generator for the mpool ioctl interface.
+ *
+ * Usage: mpbench [-m mpool] [-o file] jobfile...
+ *
+ * Jobs are described by fio-like job files: a [section] per job, each with
+ * key=value lines.  Keys set in a [global] section are the defaults for
+ * the jobs which follow it.  Blank lines and lines starting with '#' or
+ * ';' are ignored.  Sizes accept a k, m or g suffix (powers of 1024).
+ *
+ *   workload=   mb_write    MPIOC_MB_WRITE, mblocks are committed and
+ *                           deleted once mbsize bytes have been written
+ *               mb_read     MPIOC_MB_READ of a committed mblock
+ *               mlog_write  MPIOC_MLOG_WRITE, the mlog is erased when full
+ *               mlog_read   MPIOC_MLOG_READ of a filled mlog
+ *               vma_scan    memcpy() out of an mcache map of vma_mblocks
+ *                           mblocks (MPIOC_VMA_CREATE + mmap)
+ *               kbench      MPIOC_TEST_BENCH, see kbench=
+ *   mpool=      mpool name, /dev/mpool/<name> is opened
+ *   threads=    number of threads, each with its own objects (1)
+ *   ops=        operations per thread, 0 for runtime bound (0)
+ *   runtime=    seconds, 0 for ops bound (10)
+ *   iosz=       bytes per operation, page aligned (4k)
+ *   random=     1 for random offsets, 0 for sequential (0)
+ *   mclass=     capacity or staging (capacity)
+ *   mbsize=     mblock fill size, 0 for the allocated capacity (0)
+ *   mlogcap=    mlog capacity (16m)
+ *   vma_mblocks= mblocks per mcache map (4)
+ *   purge=      1 to purge the mcache map after each pass (0)
+ *   kbench=     mb_alloc, mb_write, mb_read, mlog_append, mdc_append,
+ *               smap, obj_lookup, mlog_open or mlog_seek, run in the
+ *               kernel on threads threads
+ *   sync=       kbench mlog and MDC appends are synchronous (0)
+ *   async=      kbench mlog and batched MDC appends are asynchronous (0)
+ *   batch=      kbench MDC appends are batches of 8 records (0)
+ *   bgcompact=  kbench MDC appends run alongside background compactions (0)
+ *
+ * Only the ioctl or memcpy() under test is timed, object setup and the
+ * commit/erase/purge work between passes is not.  A thread stops on its
+ * first error.  Results are written as JSON to stdout, or to -o file.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include <mpool_ioctl.h>
+
+#define MPB_MERR_ERRNO_MASK     (0x000000007ffffffful)
+
+/* mi_op values, as MPOOL_OP_READ and MPOOL_OP_WRITE in src/mpool.h */
+#define MPB_OP_READ             0
+#define MPB_OP_WRITE            1
+
+#define MPB_NAMESZ              64
+#define MPB_JOBS_MAX            64
+#define MPB_THREADS_MAX         256
+#define MPB_VMA_MBLOCKS_MAX     64
+
+/* Latency histogram, 8 linear sub-buckets per power of two */
+#define MPB_HSUB_SHIFT          3
+#define MPB_HSUB                (1u << MPB_HSUB_SHIFT)
+#define MPB_HBKT                ((64 - MPB_HSUB_SHIFT + 1) * MPB_HSUB)
+
+static const unsigned int mpb_pctv[] = { 500, 900, 990, 999 };
+static const char        *mpb_pctnamev[] = { "p50", "p90", "p99", "p99.9" };
+
+struct mpb_thr;
+
+/**
+ * struct mpb_wl - userspace workload
+ * @wl_name:     workload= value
+ * @wl_setup:    create the thread's objects
+ * @wl_op:       perform one operation, return its latency in *latp
+ * @wl_teardown: delete the thread's objects
+ */
+struct mpb_wl {
+	const char *wl_name;
+	int       (*wl_setup)(struct mpb_thr *thr);
+	int       (*wl_op)(struct mpb_thr *thr, uint64_t *latp);
+	void      (*wl_teardown)(struct mpb_thr *thr);
+};
+
+struct mpb_job {
+	char                    jb_name[MPB_NAMESZ];
+	char                    jb_mpool[MPOOL_NAMESZ_MAX];
+	const struct mpb_wl    *jb_wl;
+	uint32_t                jb_kbench;
+	uint32_t                jb_threads;
+	uint64_t                jb_ops;
+	uint64_t                jb_runtime;
+	uint64_t                jb_iosz;
+	uint64_t                jb_mbsize;
+	uint64_t                jb_mlogcap;
+	uint32_t                jb_vma_mblocks;
+	uint8_t                 jb_mclass;
+	bool                    jb_random;
+	bool                    jb_purge;
+	bool                    jb_sync;
+	bool                    jb_async;
+	bool                    jb_batch;
+	bool                    jb_bgcompact;
+};
+
+struct mpb_result {
+	uint64_t    rs_usecs;
+	uint64_t    rs_done;
+	uint64_t    rs_errors;
+	uint64_t    rs_lat_min;
+	uint64_t    rs_lat_avg;
+	uint64_t    rs_lat_max;
+	uint64_t    rs_lat_pct[MPIOC_BENCH_PCT_MAX];
+	int         rs_err;
+};
+
+/**
+ * struct mpb_thr - per-thread state
+ * @th_objv:   objids of the thread's mblocks or mlog
+ * @th_objc:   number of valid th_objv[] entries
+ * @th_len:    bytes written to each object
+ * @th_off:    next sequential offset
+ * @th_map:    mcache map
+ * @th_maplen:
+ * @th_mapoff: mmap offset of the mcache map
+ * @th_bktsz:  mcache map bucket size
+ */
+struct mpb_thr {
+	pthread_t               th_tid;
+	const struct mpb_job   *th_job;
+	pthread_barrier_t      *th_barrier;
+	int                     th_fd;
+	int                     th_err;
+	uint64_t                th_rand;
+
+	char                   *th_buf;
+	uint64_t                th_objv[MPB_VMA_MBLOCKS_MAX];
+	uint32_t                th_objc;
+	uint64_t                th_len;
+	uint64_t                th_cap;
+	uint64_t                th_wrsz;
+	uint64_t                th_off;
+	bool                    th_open;
+	char                   *th_map;
+	size_t                  th_maplen;
+	int64_t                 th_mapoff;
+	uint64_t                th_bktsz;
+
+	uint64_t                th_start;
+	uint64_t                th_end;
+	uint64_t                th_done;
+	uint64_t                th_latsum;
+	uint64_t                th_latmin;
+	uint64_t                th_latmax;
+	uint64_t                th_histv[MPB_HBKT];
+};
+
+static const char *progname;
+static long        pagesz;
+
+static void eprint(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void eprint(const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "%s: ", progname);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+static inline uint64_t mpb_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+static inline uint64_t mpb_rand(struct mpb_thr *thr)
+{
+	uint64_t x = thr->th_rand;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+
+	return thr->th_rand = x;
+}
+
+static inline unsigned int mpb_bkt(uint64_t ns)
+{
+	unsigned int msb;
+
+	if (ns < MPB_HSUB)
+		return ns;
+
+	msb = 63 - __builtin_clzll(ns);
+
+	return (msb - MPB_HSUB_SHIFT + 1) * MPB_HSUB +
+		((ns >> (msb - MPB_HSUB_SHIFT)) & (MPB_HSUB - 1));
+}
+
+static uint64_t mpb_bkt2ns(unsigned int bkt)
+{
+	unsigned int shift;
+
+	if (bkt < MPB_HSUB)
+		return bkt;
+
+	shift = bkt / MPB_HSUB - 1;
+
+	return ((uint64_t)(MPB_HSUB + bkt % MPB_HSUB + 1) << shift) - 1;
+}
+
+/*
+ * Issue an mpool ioctl, return 0 or an errno.  Failures of the command
+ * itself are reported in the parameter block's struct mpioc_cmn.
+ */
+static int mpb_ioctl(int fd, unsigned long cmd, void *arg)
+{
+	struct mpioc_cmn *cmn = arg;
+
+	cmn->mc_err = 0;
+
+	if (ioctl(fd, cmd, arg))
+		return errno;
+
+	return cmn->mc_err ? (int)(cmn->mc_err & MPB_MERR_ERRNO_MASK) : 0;
+}
+
+/* Time the ioctl (cmd, arg) */
+static int mpb_ioctl_timed(int fd, unsigned long cmd, void *arg, uint64_t *latp)
+{
+	uint64_t    t0;
+	int         rc;
+
+	t0 = mpb_now();
+	rc = mpb_ioctl(fd, cmd, arg);
+	*latp = mpb_now() - t0;
+
+	return rc;
+}
+
+static int mpb_mb_alloc(struct mpb_thr *thr, uint64_t *objidp)
+{
+	struct mpioc_mblock mb = { .mb_mclassp = thr->th_job->jb_mclass };
+	int                 rc;
+
+	rc = mpb_ioctl(thr->th_fd, MPIOC_MB_ALLOC, &mb);
+	if (rc)
+		return rc;
+
+	*objidp = mb.mb_objid;
+	thr->th_cap = mb.mb_props.mbx_props.mpr_alloc_cap;
+	thr->th_wrsz = mb.mb_props.mbx_props.mpr_optimal_wrsz;
+
+	return 0;
+}
+
+static int mpb_mb_id(struct mpb_thr *thr, unsigned long cmd, uint64_t objid)
+{
+	struct mpioc_mblock_id mi = { .mi_objid = objid };
+
+	return mpb_ioctl(thr->th_fd, cmd, &mi);
+}
+
+static int mpb_mb_write(struct mpb_thr *thr, uint64_t objid, size_t len, uint64_t *latp)
+{
+	struct mpioc_mblock_rw  mbrw = { .mb_objid = objid, .mb_iov_cnt = 1 };
+	struct iovec            iov = { .iov_base = thr->th_buf, .iov_len = len };
+	uint64_t                lat;
+
+	mbrw.mb_iov = &iov;
+
+	return mpb_ioctl_timed(thr->th_fd, MPIOC_MB_WRITE, &mbrw, latp ?: &lat);
+}
+
+/*
+ * Allocate an mblock, write mbsize bytes (or its capacity) to it in optimal
+ * write size units and commit it.
+ */
+static int mpb_mb_fill(struct mpb_thr *thr, uint64_t *objidp)
+{
+	uint64_t    objid, len, wlen;
+	int         rc;
+
+	rc = mpb_mb_alloc(thr, &objid);
+	if (rc)
+		return rc;
+
+	len = thr->th_job->jb_mbsize ?: thr->th_cap;
+	if (len > thr->th_cap)
+		len = thr->th_cap;
+
+	wlen = thr->th_job->jb_iosz;
+	if (thr->th_wrsz && wlen % thr->th_wrsz)
+		wlen = thr->th_wrsz;
+
+	len -= len % wlen;
+	if (len < thr->th_job->jb_iosz) {
+		mpb_mb_id(thr, MPIOC_MB_ABORT, objid);
+		return EINVAL;
+	}
+
+	for (thr->th_len = 0; thr->th_len < len; thr->th_len += wlen) {
+		rc = mpb_mb_write(thr, objid, wlen, NULL);
+		if (rc)
+			break;
+	}
+
+	if (!rc)
+		rc = mpb_mb_id(thr, MPIOC_MB_COMMIT, objid);
+
+	if (rc) {
+		mpb_mb_id(thr, MPIOC_MB_ABORT, objid);
+		return rc;
+	}
+
+	*objidp = objid;
+
+	return 0;
+}
+
+/* Return the offset of the next iosz operation within an object of len bytes */
+static uint64_t mpb_next_off(struct mpb_thr *thr, uint64_t len)
+{
+	uint64_t iosz = thr->th_job->jb_iosz;
+	uint64_t off;
+
+	if (thr->th_job->jb_random)
+		return (mpb_rand(thr) % (len / iosz)) * iosz;
+
+	if (thr->th_off + iosz > len)
+		thr->th_off = 0;
+
+	off = thr->th_off;
+	thr->th_off += iosz;
+
+	return off;
+}
+
+static int mpb_mb_write_op(struct mpb_thr *thr, uint64_t *latp)
+{
+	uint64_t    iosz = thr->th_job->jb_iosz;
+	uint64_t    limit;
+	int         rc;
+
+	if (!thr->th_objc) {
+		rc = mpb_mb_alloc(thr, &thr->th_objv[0]);
+		if (rc)
+			return rc;
+
+		if (iosz > thr->th_cap || (thr->th_wrsz && iosz % thr->th_wrsz)) {
+			eprint("%s: iosz must be a multiple of %" PRIu64 " and at most %" PRIu64 "\n",
+			       thr->th_job->jb_name, thr->th_wrsz, thr->th_cap);
+			mpb_mb_id(thr, MPIOC_MB_ABORT, thr->th_objv[0]);
+			return EINVAL;
+		}
+
+		thr->th_objc = 1;
+		thr->th_len = 0;
+	}
+
+	rc = mpb_mb_write(thr, thr->th_objv[0], iosz, latp);
+	if (rc)
+		return rc;
+
+	thr->th_len += iosz;
+
+	limit = thr->th_job->jb_mbsize ?: thr->th_cap;
+	if (limit > thr->th_cap)
+		limit = thr->th_cap;
+
+	if (thr->th_len + iosz > limit) {
+		thr->th_objc = 0;
+
+		rc = mpb_mb_id(thr, MPIOC_MB_COMMIT, thr->th_objv[0]);
+		if (!rc)
+			rc = mpb_mb_id(thr, MPIOC_MB_DELETE, thr->th_objv[0]);
+		else
+			mpb_mb_id(thr, MPIOC_MB_ABORT, thr->th_objv[0]);
+	}
+
+	return rc;
+}
+
+static void mpb_mb_write_teardown(struct mpb_thr *thr)
+{
+	if (thr->th_objc)
+		mpb_mb_id(thr, MPIOC_MB_ABORT, thr->th_objv[0]);
+}
+
+static int mpb_mb_read_setup(struct mpb_thr *thr)
+{
+	int rc;
+
+	rc = mpb_mb_fill(thr, &thr->th_objv[0]);
+	if (!rc)
+		thr->th_objc = 1;
+
+	return rc;
+}
+
+static int mpb_mb_read_op(struct mpb_thr *thr, uint64_t *latp)
+{
+	struct mpioc_mblock_rw  mbrw = { .mb_objid = thr->th_objv[0], .mb_iov_cnt = 1 };
+	struct iovec            iov = { .iov_base = thr->th_buf, .iov_len = thr->th_job->jb_iosz };
+
+	mbrw.mb_iov = &iov;
+	mbrw.mb_offset = mpb_next_off(thr, thr->th_len);
+
+	return mpb_ioctl_timed(thr->th_fd, MPIOC_MB_READ, &mbrw, latp);
+}
+
+static void mpb_mb_teardown(struct mpb_thr *thr)
+{
+	uint32_t i;
+
+	for (i = 0; i < thr->th_objc; ++i)
+		mpb_mb_id(thr, MPIOC_MB_DELETE, thr->th_objv[i]);
+}
+
+static int mpb_mlog_id(struct mpb_thr *thr, unsigned long cmd)
+{
+	struct mpioc_mlog_id mi = { .mi_objid = thr->th_objv[0] };
+
+	return mpb_ioctl(thr->th_fd, cmd, &mi);
+}
+
+static int mpb_mlog_io(struct mpb_thr *thr, uint8_t op, int64_t off, uint64_t *latp)
+{
+	struct mpioc_mlog_io    mi = { .mi_objid = thr->th_objv[0], .mi_iovc = 1 };
+	struct iovec            iov = { .iov_base = thr->th_buf, .iov_len = thr->th_job->jb_iosz };
+	uint64_t                lat;
+
+	mi.mi_op = op;
+	mi.mi_off = off;
+	mi.mi_iov = &iov;
+
+	return mpb_ioctl_timed(thr->th_fd, op ? MPIOC_MLOG_WRITE : MPIOC_MLOG_READ, &mi,
+			       latp ?: &lat);
+}
+
+static int mpb_mlog_write_setup(struct mpb_thr *thr)
+{
+	struct mpioc_mlog   ml = { .ml_mclassp = thr->th_job->jb_mclass };
+	int                 rc;
+
+	ml.ml_cap.lcp_captgt = thr->th_job->jb_mlogcap;
+
+	rc = mpb_ioctl(thr->th_fd, MPIOC_MLOG_ALLOC, &ml);
+	if (rc)
+		return rc;
+
+	thr->th_objv[0] = ml.ml_objid;
+	thr->th_cap = ml.ml_props.lpx_props.lpr_alloc_cap;
+
+	rc = mpb_mlog_id(thr, MPIOC_MLOG_COMMIT);
+	if (rc) {
+		mpb_mlog_id(thr, MPIOC_MLOG_ABORT);
+		return rc;
+	}
+
+	thr->th_objc = 1;
+
+	if (thr->th_job->jb_iosz > thr->th_cap) {
+		eprint("%s: iosz exceeds the mlog capacity %" PRIu64 "\n",
+		       thr->th_job->jb_name, thr->th_cap);
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+static int mpb_mlog_write_op(struct mpb_thr *thr, uint64_t *latp)
+{
+	uint64_t    iosz = thr->th_job->jb_iosz;
+	int         rc;
+
+	if (thr->th_off + iosz > thr->th_cap) {
+		rc = mpb_mlog_id(thr, MPIOC_MLOG_ERASE);
+		if (rc)
+			return rc;
+
+		thr->th_off = 0;
+	}
+
+	rc = mpb_mlog_io(thr, MPB_OP_WRITE, thr->th_off, latp);
+	if (!rc)
+		thr->th_off += iosz;
+
+	return rc;
+}
+
+static int mpb_mlog_read_setup(struct mpb_thr *thr)
+{
+	uint64_t    iosz = thr->th_job->jb_iosz;
+	int         rc;
+
+	rc = mpb_mlog_write_setup(thr);
+	if (rc)
+		return rc;
+
+	for (thr->th_len = 0; thr->th_len + iosz <= thr->th_cap; thr->th_len += iosz) {
+		rc = mpb_mlog_io(thr, MPB_OP_WRITE, thr->th_len, NULL);
+		if (rc)
+			break;
+	}
+
+	return rc;
+}
+
+static int mpb_mlog_read_op(struct mpb_thr *thr, uint64_t *latp)
+{
+	return mpb_mlog_io(thr, MPB_OP_READ, mpb_next_off(thr, thr->th_len), latp);
+}
+
+static void mpb_mlog_teardown(struct mpb_thr *thr)
+{
+	if (thr->th_objc)
+		mpb_mlog_id(thr, MPIOC_MLOG_DELETE);
+}
+
+static int mpb_vma_setup(struct mpb_thr *thr)
+{
+	struct mpioc_vma    vma = { .im_advice = MPC_VMA_WARM };
+	void               *addr;
+	int                 rc = 0;
+
+	while (thr->th_objc < thr->th_job->jb_vma_mblocks) {
+		rc = mpb_mb_fill(thr, &thr->th_objv[thr->th_objc]);
+		if (rc)
+			return rc;
+
+		thr->th_objc++;
+	}
+
+	vma.im_mbidc = thr->th_objc;
+	vma.im_mbidv = thr->th_objv;
+
+	rc = mpb_ioctl(thr->th_fd, MPIOC_VMA_CREATE, &vma);
+	if (rc)
+		return rc;
+
+	thr->th_mapoff = vma.im_offset;
+	thr->th_bktsz = vma.im_bktsz;
+	thr->th_maplen = vma.im_bktsz * thr->th_objc;
+
+	addr = mmap(NULL, thr->th_maplen, PROT_READ, MAP_SHARED, thr->th_fd, thr->th_mapoff);
+	if (addr == MAP_FAILED) {
+		rc = errno;
+		mpb_ioctl(thr->th_fd, MPIOC_VMA_DESTROY, &vma);
+		return rc;
+	}
+
+	thr->th_map = addr;
+	thr->th_open = true;
+
+	return 0;
+}
+
+/* Each mblock occupies one th_bktsz bucket of the map, of which th_len bytes are valid */
+static int mpb_vma_op(struct mpb_thr *thr, uint64_t *latp)
+{
+	uint64_t    iosz = thr->th_job->jb_iosz;
+	uint64_t    per = thr->th_len / iosz;
+	uint64_t    n, t0;
+	char       *src;
+
+	if (thr->th_job->jb_random) {
+		n = mpb_rand(thr) % (per * thr->th_objc);
+	} else {
+		if (thr->th_off >= per * thr->th_objc) {
+			thr->th_off = 0;
+
+			if (thr->th_job->jb_purge) {
+				struct mpioc_vma vma = { .im_offset = thr->th_mapoff };
+				int              rc;
+
+				rc = mpb_ioctl(thr->th_fd, MPIOC_VMA_PURGE, &vma);
+				if (rc)
+					return rc;
+			}
+		}
+
+		n = thr->th_off++;
+	}
+
+	src = thr->th_map + (n / per) * thr->th_bktsz + (n % per) * iosz;
+
+	t0 = mpb_now();
+	memcpy(thr->th_buf, src, iosz);
+	*latp = mpb_now() - t0;
+
+	return 0;
+}
+
+static void mpb_vma_teardown(struct mpb_thr *thr)
+{
+	if (thr->th_open) {
+		struct mpioc_vma vma = { .im_offset = thr->th_mapoff };
+
+		munmap(thr->th_map, thr->th_maplen);
+		mpb_ioctl(thr->th_fd, MPIOC_VMA_DESTROY, &vma);
+	}
+
+	mpb_mb_teardown(thr);
+}
+
+static const struct mpb_wl mpb_wlv[] = {
+	{ "mb_write",   NULL, mpb_mb_write_op, mpb_mb_write_teardown },
+	{ "mb_read",    mpb_mb_read_setup, mpb_mb_read_op, mpb_mb_teardown },
+	{ "mlog_write", mpb_mlog_write_setup, mpb_mlog_write_op, mpb_mlog_teardown },
+	{ "mlog_read",  mpb_mlog_read_setup, mpb_mlog_read_op, mpb_mlog_teardown },
+	{ "vma_scan",   mpb_vma_setup, mpb_vma_op, mpb_vma_teardown },
+	{ "kbench",     NULL, NULL, NULL },
+};
+
+static const char *mpb_kbenchv[] = {
+	[MPIOC_BENCH_MB_ALLOC]    = "mb_alloc",
+	[MPIOC_BENCH_MB_WRITE]    = "mb_write",
+	[MPIOC_BENCH_MB_READ]     = "mb_read",
+	[MPIOC_BENCH_MLOG_APPEND] = "mlog_append",
+	[MPIOC_BENCH_MDC_APPEND]  = "mdc_append",
+	[MPIOC_BENCH_SMAP]        = "smap",
+	[MPIOC_BENCH_OBJ_LOOKUP]  = "obj_lookup",
+	[MPIOC_BENCH_MLOG_OPEN]   = "mlog_open",
+	[MPIOC_BENCH_MLOG_SEEK]   = "mlog_seek",
+};
+
+static void *mpb_thr_main(void *arg)
+{
+	struct mpb_thr         *thr = arg;
+	const struct mpb_job   *job = thr->th_job;
+	const struct mpb_wl    *wl = job->jb_wl;
+	uint64_t                deadline, lat;
+	int                     rc = 0;
+
+	thr->th_latmin = UINT64_MAX;
+
+	if (posix_memalign((void **)&thr->th_buf, pagesz, job->jb_iosz))
+		rc = ENOMEM;
+	else
+		memset(thr->th_buf, 0xa5, job->jb_iosz);
+
+	if (!rc && wl->wl_setup)
+		rc = wl->wl_setup(thr);
+
+	thr->th_err = rc;
+
+	pthread_barrier_wait(thr->th_barrier);
+
+	thr->th_start = mpb_now();
+	deadline = job->jb_runtime ? thr->th_start + job->jb_runtime * 1000000000ul : UINT64_MAX;
+
+	while (!rc && (!job->jb_ops || thr->th_done < job->jb_ops)) {
+		rc = wl->wl_op(thr, &lat);
+		if (rc)
+			break;
+
+		++thr->th_done;
+		++thr->th_histv[mpb_bkt(lat)];
+		thr->th_latsum += lat;
+		if (lat < thr->th_latmin)
+			thr->th_latmin = lat;
+		if (lat > thr->th_latmax)
+			thr->th_latmax = lat;
+
+		if ((thr->th_done & 15) == 0 && mpb_now() >= deadline)
+			break;
+	}
+
+	thr->th_end = mpb_now();
+
+	if (rc && !thr->th_err)
+		thr->th_err = rc;
+
+	if (wl->wl_teardown)
+		wl->wl_teardown(thr);
+
+	free(thr->th_buf);
+
+	return NULL;
+}
+
+static int mpb_open(const struct mpb_job *job)
+{
+	char    path[PATH_MAX];
+	int     fd;
+
+	snprintf(path, sizeof(path), "/dev/%s/%s", MPC_DEV_SUBDIR, job->jb_mpool);
+
+	fd = open(path, O_RDWR);
+	if (fd == -1) {
+		int err = errno;
+
+		eprint("%s: unable to open %s: %s\n", job->jb_name, path, strerror(err));
+		errno = err;
+	}
+
+	return fd;
+}
+
+static void mpb_merge(struct mpb_thr *thrv, uint32_t thrc, struct mpb_result *res)
+{
+	static uint64_t histv[MPB_HBKT];
+
+	uint64_t    start = UINT64_MAX, end = 0, latsum = 0, cum, target;
+	uint32_t    i;
+	unsigned    b, p;
+
+	memset(histv, 0, sizeof(histv));
+	res->rs_lat_min = UINT64_MAX;
+
+	for (i = 0; i < thrc; ++i) {
+		struct mpb_thr *thr = thrv + i;
+
+		res->rs_done += thr->th_done;
+		latsum += thr->th_latsum;
+		if (thr->th_latmin < res->rs_lat_min)
+			res->rs_lat_min = thr->th_latmin;
+		if (thr->th_latmax > res->rs_lat_max)
+			res->rs_lat_max = thr->th_latmax;
+		if (thr->th_start < start)
+			start = thr->th_start;
+		if (thr->th_end > end)
+			end = thr->th_end;
+		if (thr->th_err) {
+			res->rs_errors++;
+			if (!res->rs_err)
+				res->rs_err = thr->th_err;
+		}
+
+		for (b = 0; b < MPB_HBKT; ++b)
+			histv[b] += thr->th_histv[b];
+	}
+
+	res->rs_usecs = end > start ? (end - start) / 1000 : 0;
+
+	if (!res->rs_done) {
+		res->rs_lat_min = 0;
+		return;
+	}
+
+	res->rs_lat_avg = latsum / res->rs_done;
+
+	for (cum = 0, b = 0, p = 0; p < MPIOC_BENCH_PCT_MAX; ++p) {
+		target = (res->rs_done * mpb_pctv[p] + 999) / 1000;
+
+		while (b < MPB_HBKT && cum + histv[b] < target)
+			cum += histv[b++];
+
+		res->rs_lat_pct[p] = mpb_bkt2ns(b);
+		if (res->rs_lat_pct[p] > res->rs_lat_max)
+			res->rs_lat_pct[p] = res->rs_lat_max;
+	}
+}
+
+static int mpb_run_kbench(const struct mpb_job *job, int fd, struct mpb_result *res)
+{
+	struct mpioc_bench  bn = { .bn_workload = job->jb_kbench };
+	struct mpioc_test   test = { .mpt_cmd = MPIOC_TEST_BENCH };
+	int                 rc;
+
+	bn.bn_threads = job->jb_threads;
+	bn.bn_ops = job->jb_ops ?: 100000;
+	bn.bn_iosz = job->jb_iosz;
+	bn.bn_mclassp = job->jb_mclass;
+	bn.bn_flags = (job->jb_sync ? MPIOC_BENCH_F_SYNC : 0) |
+		(job->jb_async ? MPIOC_BENCH_F_ASYNC : 0) |
+		(job->jb_batch ? MPIOC_BENCH_F_BATCH : 0) |
+		(job->jb_bgcompact ? MPIOC_BENCH_F_BGCOMPACT : 0);
+
+	test.mpt_uval[0] = (uintptr_t)&bn;
+
+	rc = mpb_ioctl(fd, MPIOC_TEST, &test);
+	if (rc)
+		return rc;
+
+	res->rs_usecs = bn.bn_usecs;
+	res->rs_done = bn.bn_done;
+	res->rs_errors = bn.bn_errors;
+	res->rs_lat_min = bn.bn_lat_min;
+	res->rs_lat_avg = bn.bn_lat_avg;
+	res->rs_lat_max = bn.bn_lat_max;
+	memcpy(res->rs_lat_pct, bn.bn_lat_pct, sizeof(res->rs_lat_pct));
+
+	return 0;
+}
+
+static int mpb_run(const struct mpb_job *job, struct mpb_result *res)
+{
+	pthread_barrier_t   barrier;
+	struct mpb_thr     *thrv;
+	uint32_t            i, started;
+	int                 fd, rc = 0;
+
+	memset(res, 0, sizeof(*res));
+
+	fd = mpb_open(job);
+	if (fd == -1)
+		return errno;
+
+	if (!job->jb_wl->wl_op) {
+		rc = mpb_run_kbench(job, fd, res);
+		close(fd);
+		return rc;
+	}
+
+	thrv = calloc(job->jb_threads, sizeof(*thrv));
+	if (!thrv) {
+		close(fd);
+		return ENOMEM;
+	}
+
+	pthread_barrier_init(&barrier, NULL, job->jb_threads);
+
+	for (started = 0; started < job->jb_threads; ++started) {
+		struct mpb_thr *thr = thrv + started;
+
+		thr->th_job = job;
+		thr->th_barrier = &barrier;
+		thr->th_fd = fd;
+		thr->th_rand = 0x9e3779b97f4a7c15ul * (started + 1);
+
+		rc = pthread_create(&thr->th_tid, NULL, mpb_thr_main, thr);
+		if (rc)
+			break;
+	}
+
+	/* The barrier cannot be satisfied if not all threads were started */
+	if (rc) {
+		eprint("%s: pthread_create: %s\n", job->jb_name, strerror(rc));
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < started; ++i)
+		pthread_join(thrv[i].th_tid, NULL);
+
+	pthread_barrier_destroy(&barrier);
+
+	mpb_merge(thrv, job->jb_threads, res);
+
+	free(thrv);
+	close(fd);
+
+	return 0;
+}
+
+static int mpb_parse_u64(const char *str, uint64_t *valp, bool sizes)
+{
+	unsigned long long  val;
+	char               *end;
+
+	errno = 0;
+	val = strtoull(str, &end, 0);
+	if (errno || end == str)
+		return EINVAL;
+
+	if (sizes && *end) {
+		switch (tolower(*end++)) {
+		case 'g':
+			val <<= 10;
+			/* fallthrough */
+		case 'm':
+			val <<= 10;
+			/* fallthrough */
+		case 'k':
+			val <<= 10;
+			break;
+
+		default:
+			return EINVAL;
+		}
+	}
+
+	if (*end)
+		return EINVAL;
+
+	*valp = val;
+
+	return 0;
+}
+
+static int mpb_parse_kv(struct mpb_job *job, const char *key, const char *val)
+{
+	uint64_t    u64;
+	size_t      i;
+
+	if (!strcmp(key, "workload")) {
+		for (i = 0; i < sizeof(mpb_wlv) / sizeof(mpb_wlv[0]); ++i) {
+			if (!strcmp(val, mpb_wlv[i].wl_name)) {
+				job->jb_wl = &mpb_wlv[i];
+				return 0;
+			}
+		}
+		return EINVAL;
+	}
+
+	if (!strcmp(key, "kbench")) {
+		for (i = 0; i < sizeof(mpb_kbenchv) / sizeof(mpb_kbenchv[0]); ++i) {
+			if (mpb_kbenchv[i] && !strcmp(val, mpb_kbenchv[i])) {
+				job->jb_kbench = i;
+				return 0;
+			}
+		}
+		return EINVAL;
+	}
+
+	if (!strcmp(key, "mpool")) {
+		if (strlen(val) >= sizeof(job->jb_mpool))
+			return ENAMETOOLONG;
+		strcpy(job->jb_mpool, val);
+		return 0;
+	}
+
+	if (!strcmp(key, "mclass")) {
+		if (!strcmp(val, "capacity"))
+			job->jb_mclass = MP_MED_CAPACITY;
+		else if (!strcmp(val, "staging"))
+			job->jb_mclass = MP_MED_STAGING;
+		else
+			return EINVAL;
+		return 0;
+	}
+
+	if (mpb_parse_u64(val, &u64, true))
+		return EINVAL;
+
+	if (!strcmp(key, "threads"))
+		job->jb_threads = u64;
+	else if (!strcmp(key, "ops"))
+		job->jb_ops = u64;
+	else if (!strcmp(key, "runtime"))
+		job->jb_runtime = u64;
+	else if (!strcmp(key, "iosz"))
+		job->jb_iosz = u64;
+	else if (!strcmp(key, "mbsize"))
+		job->jb_mbsize = u64;
+	else if (!strcmp(key, "mlogcap"))
+		job->jb_mlogcap = u64;
+	else if (!strcmp(key, "vma_mblocks"))
+		job->jb_vma_mblocks = u64;
+	else if (!strcmp(key, "random"))
+		job->jb_random = !!u64;
+	else if (!strcmp(key, "purge"))
+		job->jb_purge = !!u64;
+	else if (!strcmp(key, "sync"))
+		job->jb_sync = !!u64;
+	else if (!strcmp(key, "async"))
+		job->jb_async = !!u64;
+	else if (!strcmp(key, "batch"))
+		job->jb_batch = !!u64;
+	else if (!strcmp(key, "bgcompact"))
+		job->jb_bgcompact = !!u64;
+	else
+		return ENOENT;
+
+	return 0;
+}
+
+static int mpb_job_check(const struct mpb_job *job)
+{
+	const char *msg = NULL;
+
+	if (!job->jb_wl)
+		msg = "no workload";
+	else if (!job->jb_mpool[0])
+		msg = "no mpool";
+	else if (job->jb_threads < 1 || job->jb_threads > MPB_THREADS_MAX)
+		msg = "invalid threads";
+	else if (!job->jb_ops && !job->jb_runtime && job->jb_wl->wl_op)
+		msg = "one of ops or runtime is required";
+	else if (!job->jb_iosz || (job->jb_wl->wl_op && job->jb_iosz % pagesz))
+		msg = "iosz must be a multiple of the page size";
+	else if (job->jb_vma_mblocks < 1 || job->jb_vma_mblocks > MPB_VMA_MBLOCKS_MAX)
+		msg = "invalid vma_mblocks";
+	else if (!job->jb_wl->wl_op && !job->jb_kbench)
+		msg = "no kbench";
+
+	if (msg)
+		eprint("job %s: %s\n", job->jb_name, msg);
+
+	return msg ? EINVAL : 0;
+}
+
+/* Parse a job file, appending its jobs to jobv[] */
+static int mpb_parse_file(const char *path, struct mpb_job *dflt, struct mpb_job *jobv, int *jobcp)
+{
+	struct mpb_job *job = NULL;
+	char            line[512];
+	int             lineno = 0, rc = 0;
+	FILE           *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		eprint("unable to open %s: %s\n", path, strerror(errno));
+		return errno;
+	}
+
+	while (!rc && fgets(line, sizeof(line), fp)) {
+		char   *key, *val, *end;
+
+		++lineno;
+
+		key = line;
+		while (isspace(*key))
+			++key;
+
+		end = key + strlen(key);
+		while (end > key && isspace(end[-1]))
+			*--end = '\0';
+
+		if (!*key || *key == '#' || *key == ';')
+			continue;
+
+		if (*key == '[') {
+			if (end[-1] != ']' || end - key < 3 || end - key - 2 >= MPB_NAMESZ) {
+				rc = EINVAL;
+				break;
+			}
+
+			end[-1] = '\0';
+			++key;
+
+			if (!strcmp(key, "global")) {
+				job = dflt;
+				continue;
+			}
+
+			if (*jobcp >= MPB_JOBS_MAX) {
+				rc = E2BIG;
+				break;
+			}
+
+			job = jobv + (*jobcp)++;
+			*job = *dflt;
+			strcpy(job->jb_name, key);
+			continue;
+		}
+
+		val = strchr(key, '=');
+		if (!val || !job) {
+			rc = EINVAL;
+			break;
+		}
+
+		for (end = val; end > key && isspace(end[-1]); --end)
+			;
+		*end = '\0';
+
+		for (++val; isspace(*val); ++val)
+			;
+
+		rc = mpb_parse_kv(job, key, val);
+	}
+
+	if (rc)
+		eprint("%s:%d: %s\n", path, lineno,
+		       rc == ENOENT ? "unknown key" : "invalid line");
+
+	fclose(fp);
+
+	return rc;
+}
+
+/* Print s as a JSON string, quoted and escaped */
+static void mpb_json_str(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+
+	for (; *s; ++s) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\')
+			fprintf(fp, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(fp, "\\u%04x", c);
+		else
+			fputc(c, fp);
+	}
+
+	fputc('"', fp);
+}
+
+static void mpb_json_job(FILE *fp, const struct mpb_job *job, const struct mpb_result *res,
+			 bool last)
+{
+	double  secs = res->rs_usecs / 1000000.0;
+	double  iops = secs > 0 ? res->rs_done / secs : 0;
+	size_t  i;
+
+	fprintf(fp, "    {\n");
+	fprintf(fp, "      \"name\": ");
+	mpb_json_str(fp, job->jb_name);
+	fprintf(fp, ",\n");
+	fprintf(fp, "      \"workload\": \"%s\",\n", job->jb_wl->wl_name);
+	if (!job->jb_wl->wl_op)
+		fprintf(fp, "      \"kbench\": \"%s\",\n", mpb_kbenchv[job->jb_kbench]);
+	fprintf(fp, "      \"threads\": %u,\n", job->jb_threads);
+	fprintf(fp, "      \"iosz\": %" PRIu64 ",\n", job->jb_iosz);
+	fprintf(fp, "      \"random\": %s,\n", job->jb_random ? "true" : "false");
+	fprintf(fp, "      \"usecs\": %" PRIu64 ",\n", res->rs_usecs);
+	fprintf(fp, "      \"ops\": %" PRIu64 ",\n", res->rs_done);
+	fprintf(fp, "      \"errors\": %" PRIu64 ",\n", res->rs_errors);
+	if (res->rs_err) {
+		fprintf(fp, "      \"error\": ");
+		mpb_json_str(fp, strerror(res->rs_err));
+		fprintf(fp, ",\n");
+	}
+	fprintf(fp, "      \"iops\": %.1f,\n", iops);
+	fprintf(fp, "      \"bw_bytes\": %.0f,\n", iops * job->jb_iosz);
+	fprintf(fp, "      \"lat_ns\": {\n");
+	fprintf(fp, "        \"min\": %" PRIu64 ",\n", res->rs_lat_min);
+	fprintf(fp, "        \"avg\": %" PRIu64 ",\n", res->rs_lat_avg);
+	fprintf(fp, "        \"max\": %" PRIu64 ",\n", res->rs_lat_max);
+
+	for (i = 0; i < MPIOC_BENCH_PCT_MAX; ++i)
+		fprintf(fp, "        \"%s\": %" PRIu64 "%s\n", mpb_pctnamev[i], res->rs_lat_pct[i],
+			i + 1 < MPIOC_BENCH_PCT_MAX ? "," : "");
+
+	fprintf(fp, "      }\n");
+	fprintf(fp, "    }%s\n", last ? "" : ",");
+}
+
+static void usage(void)
+{
+	printf("usage: %s [-m mpool] [-o file] jobfile...\n", progname);
+	printf("-m mpool  run all jobs on the given mpool\n");
+	printf("-o file   write the JSON results to file\n");
+}
+
+int main(int argc, char **argv)
+{
+	static struct mpb_job   jobv[MPB_JOBS_MAX];
+	static struct mpb_job   dflt;
+
+	struct mpb_result   res;
+	const char         *mpool = NULL, *outfile = NULL;
+	FILE               *fp = stdout;
+	int                 jobc = 0, failed = 0;
+	int                 c, i, rc;
+
+	progname = strrchr(argv[0], '/');
+	progname = progname ? progname + 1 : argv[0];
+	pagesz = sysconf(_SC_PAGESIZE);
+
+	while ((c = getopt(argc, argv, "hm:o:")) != -1) {
+		switch (c) {
+		case 'm':
+			mpool = optarg;
+			break;
+
+		case 'o':
+			outfile = optarg;
+			break;
+
+		case 'h':
+			usage();
+			return 0;
+
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	if (mpool && strlen(mpool) >= sizeof(dflt.jb_mpool)) {
+		eprint("mpool name too long\n");
+		return EXIT_FAILURE;
+	}
+
+	dflt.jb_threads = 1;
+	dflt.jb_runtime = 10;
+	dflt.jb_iosz = 4096;
+	dflt.jb_mlogcap = 16 << 20;
+	dflt.jb_vma_mblocks = 4;
+	dflt.jb_mclass = MP_MED_CAPACITY;
+
+	for (i = optind; i < argc; ++i) {
+		if (mpb_parse_file(argv[i], &dflt, jobv, &jobc))
+			return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < jobc; ++i) {
+		if (mpool)
+			strcpy(jobv[i].jb_mpool, mpool);
+
+		if (mpb_job_check(jobv + i))
+			return EXIT_FAILURE;
+	}
+
+	if (outfile) {
+		fp = fopen(outfile, "w");
+		if (!fp) {
+			eprint("unable to open %s: %s\n", outfile, strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "  \"version\": 1,\n");
+	fprintf(fp, "  \"pagesz\": %ld,\n", pagesz);
+	fprintf(fp, "  \"jobs\": [\n");
+
+	for (i = 0; i < jobc; ++i) {
+		rc = mpb_run(jobv + i, &res);
+		if (rc) {
+			res.rs_err = rc;
+			res.rs_errors++;
+		}
+
+		if (res.rs_err) {
+			eprint("job %s: %s\n", jobv[i].jb_name, strerror(res.rs_err));
+			++failed;
+		}
+
+		mpb_json_job(fp, jobv + i, &res, i + 1 == jobc);
+		fflush(fp);
+	}
+
+	fprintf(fp, "  ]\n");
+	fprintf(fp, "}\n");
+
+	if (fp != stdout)
+		fclose(fp);
+
+	return failed ? EXIT_FAILURE : 0;
+}
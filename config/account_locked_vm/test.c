@@ -0,0 +1,12 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include "../test.h"
+#include <linux/mm.h>
+
+int test(void)
+{
+     return account_locked_vm(current->mm, 0, true);
+}
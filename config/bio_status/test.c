@@ -0,0 +1,16 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include "../test.h"
+#include <linux/bio.h>
+
+int test(void)
+{
+    struct bio bio = { };
+
+    bio.bi_status = BLK_STS_OK;
+
+    return blk_status_to_errno(bio.bi_status);
+}
@@ -0,0 +1,20 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include "../test.h"
+#include <linux/blkdev.h>
+
+int
+test(void)
+{
+    struct request_queue *q = (void *)1;
+    struct bio *bio = (void *)1;
+    blk_qc_t qc;
+
+    bio->bi_opf |= REQ_HIPRI;
+    qc = submit_bio(bio);
+
+    return blk_poll(q, qc, true) + test_bit(QUEUE_FLAG_POLL, &q->queue_flags);
+}
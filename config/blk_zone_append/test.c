@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include "../test.h"
+#include <linux/blkdev.h>
+
+static int test_cb(struct blk_zone *zone, unsigned int idx, void *data)
+{
+    return zone->capacity < zone->len;
+}
+
+int
+test(void)
+{
+    struct block_device *bdev = (void *)1;
+
+    blkdev_report_zones(bdev, 0, 1, test_cb, NULL);
+    queue_max_zone_append_sectors(bdev_get_queue(bdev));
+
+    return blkdev_zone_mgmt(bdev, REQ_OP_ZONE_RESET, 0, 0, GFP_NOIO) + REQ_OP_ZONE_APPEND;
+}
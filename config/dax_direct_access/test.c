@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include "../test.h"
+#include <linux/blkdev.h>
+#include <linux/dax.h>
+#include <linux/pfn_t.h>
+
+int
+test(void)
+{
+    struct block_device *bdev = (void *)1;
+    struct dax_device *dax;
+    pgoff_t pgoff;
+    void *kaddr;
+    pfn_t pfn;
+    int id;
+
+    dax = fs_dax_get_by_bdev(bdev);
+    bdev_dax_pgoff(bdev, 0, PAGE_SIZE, &pgoff);
+
+    id = dax_read_lock();
+    dax_direct_access(dax, pgoff, 1, &kaddr, &pfn);
+    memcpy_flushcache(kaddr, &id, sizeof(id));
+    dax_read_unlock(id);
+
+    put_dax(dax);
+
+    return 0;
+}
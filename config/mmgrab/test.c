@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include "../test.h"
+#include <linux/sched/mm.h>
+
+int test(void)
+{
+     mmgrab(current->mm);
+
+     return 0;
+}
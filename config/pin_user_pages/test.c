@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include "../test.h"
+#include <linux/mm.h>
+
+int test(void)
+{
+     unpin_user_pages(NULL, 0);
+
+     return pin_user_pages_fast(0, 0, FOLL_WRITE | FOLL_LONGTERM, NULL);
+}
@@ -7,10 +7,12 @@
 #include <linux/ktime.h>
 #include <linux/gfp.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
 #include <linux/debugfs.h>
 
 #include "evc.h"
 #include "mpool_printk.h"
+#include "mpool_ioctl.h"
 
 static struct {
 	spinlock_t      lock;
@@ -21,32 +23,83 @@ static struct {
 } evc_root;
 
 
-void evc_count(struct evc *evc)
+/**
+ * evc_count_slow() - Count an event at a call site without per-CPU odometers
+ * @evc:
+ *
+ * The first event links the call site into the list of call sites to report
+ * and tries to switch it over to per-CPU odometers, so that call sites which
+ * fire frequently don't bounce a shared cacheline between CPUs.  ev() may be
+ * called in atomic context, hence the atomic allocation.  If it fails, the
+ * call site simply keeps on counting in evc_odometer.
+ */
+void evc_count_slow(struct evc *evc)
 {
+	u64 __percpu   *pcpu;
+
 	if (likely(atomic64_inc_return(&evc->evc_odometer) != 1u))
 		return;
 
+	pcpu = alloc_percpu_gfp(u64, GFP_ATOMIC | __GFP_NOWARN);
+
 	spin_lock(&evc_root.lock);
 	if (!evc->evc_next) {
 		evc->evc_next = evc_root.head;
 		evc_root.head = evc;
 	}
 	spin_unlock(&evc_root.lock);
+
+	smp_store_release(&evc->evc_pcpu, pcpu);
+}
+
+/**
+ * evc_read() - Return the number of events counted at a call site
+ * @evc:
+ */
+static u64 evc_read(struct evc *evc)
+{
+	u64 __percpu   *pcpu = smp_load_acquire(&evc->evc_pcpu);
+	u64             sum;
+	int             cpu;
+
+	sum = atomic64_read(&evc->evc_odometer);
+
+	if (pcpu) {
+		for_each_possible_cpu(cpu)
+			sum += READ_ONCE(*per_cpu_ptr(pcpu, cpu));
+	}
+
+	return sum;
+}
+
+static struct evc *evc_head(void)
+{
+	struct evc *evc;
+
+	spin_lock(&evc_root.lock);
+	evc = evc_root.head;
+	spin_unlock(&evc_root.lock);
+
+	return evc;
+}
+
+static const char *evc_basename(struct evc *evc)
+{
+	const char *file = strrchr(evc->evc_file, '/');
+
+	return file ? file + 1 : evc->evc_file;
 }
 
 
 static ssize_t mpool_debug_emit(char *evstr, ssize_t len)
 {
 	char       *pos;
-	const char *file;
 	struct evc *evc;
 	int         cc;
 
 	pos = evstr;
 
-	spin_lock(&evc_root.lock);
-	evc = evc_root.head;
-	spin_unlock(&evc_root.lock);
+	evc = evc_head();
 	if (!evc)
 		return scnprintf(pos, len, "%s", "No Events\n");
 
@@ -54,11 +107,8 @@ static ssize_t mpool_debug_emit(char *evstr, ssize_t len)
 
 	for (pos += cc, len -= cc; evc && len > 1;
 	     evc = evc->evc_next, pos += cc, len -= cc) {
-		file = strrchr(evc->evc_file, '/');
-		file = file ? file + 1 : evc->evc_file;
-
-		cc = scnprintf(pos, len, "%14s %6d %12lu  %s\n", file, evc->evc_line,
-			      (ulong)atomic64_read(&evc->evc_odometer), evc->evc_func);
+		cc = scnprintf(pos, len, "%14s %6d %12lu  %s\n", evc_basename(evc), evc->evc_line,
+			      (ulong)evc_read(evc), evc->evc_func);
 		if (cc == len - 1)
 			pos[cc++] = '\n';
 	}
@@ -107,6 +157,72 @@ static const struct file_operations mpool_debug_fops = {
 	.read    = mpool_debug_read,
 };
 
+/**
+ * struct evc_snap - Snapshot of all the call sites for "events.bin"
+ * @es_len:  length in bytes of es_recv[]
+ * @es_recv: one record per call site
+ */
+struct evc_snap {
+	size_t                  es_len;
+	struct mpool_evc_rec    es_recv[];
+};
+
+static int mpool_debug_bin_open(struct inode *inode, struct file *file)
+{
+	struct evc_snap    *snap;
+	struct evc         *head, *evc;
+	size_t              n = 0;
+
+	/* Call sites are only ever prepended, so the list from head is stable. */
+	head = evc_head();
+
+	for (evc = head; evc; evc = evc->evc_next)
+		++n;
+
+	snap = kvzalloc(sizeof(*snap) + n * sizeof(snap->es_recv[0]), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+
+	for (evc = head, n = 0; evc; evc = evc->evc_next, ++n) {
+		struct mpool_evc_rec *rec = snap->es_recv + n;
+
+		rec->er_count = evc_read(evc);
+		rec->er_line = evc->evc_line;
+		strlcpy(rec->er_file, evc_basename(evc), sizeof(rec->er_file));
+		strlcpy(rec->er_func, evc->evc_func, sizeof(rec->er_func));
+	}
+
+	snap->es_len = n * sizeof(snap->es_recv[0]);
+	file->private_data = snap;
+
+	return 0;
+}
+
+static int mpool_debug_bin_release(struct inode *inode, struct file *file)
+{
+	kvfree(file->private_data);
+	return 0;
+}
+
+static ssize_t
+mpool_debug_bin_read(struct file *file, char __user *buf, size_t nbytes, loff_t *ppos)
+{
+	struct evc_snap *snap = file->private_data;
+
+	return simple_read_from_buffer(buf, nbytes, ppos, snap->es_recv, snap->es_len);
+}
+
+static const struct file_operations mpool_debug_bin_fops = {
+	.owner   = THIS_MODULE,
+	.open    = mpool_debug_bin_open,
+	.release = mpool_debug_bin_release,
+	.read    = mpool_debug_bin_read,
+};
+
+struct dentry *evc_debugfs_root(void)
+{
+	return evc_root.debug_root;
+}
 
 void evc_init(void)
 {
@@ -126,17 +242,21 @@ void evc_init(void)
 		evc_root.debug_root = NULL;
 		return;
 	}
+
+	d = debugfs_create_file("events.bin", 0444, evc_root.debug_root, NULL,
+				&mpool_debug_bin_fops);
+	if (IS_ERR_OR_NULL(d)) {
+		debugfs_remove_recursive(evc_root.debug_root);
+		evc_root.debug_root = NULL;
+	}
 }
 
 void evc_fini(void)
 {
 	const char *modname = "mpool";
-	const char *file;
 	struct evc *evc;
 
-	spin_lock(&evc_root.lock);
-	evc = evc_root.head;
-	spin_unlock(&evc_root.lock);
+	evc = evc_head();
 
 	debugfs_remove_recursive(evc_root.debug_root);
 
@@ -146,12 +266,10 @@ void evc_fini(void)
 	pr_info("\n%s: %14s %6s %12s  %s\n", modname, "FILE", "LINE", "ODOMETER", "FUNC");
 
 	while (evc) {
-		file = strrchr(evc->evc_file, '/');
-		file = file ? file + 1 : evc->evc_file;
-
-		pr_info("%s: %14s %6d %12lu  %s\n", modname, file, evc->evc_line,
-			(ulong)atomic64_read(&evc->evc_odometer), evc->evc_func);
+		pr_info("%s: %14s %6d %12lu  %s\n", modname, evc_basename(evc), evc->evc_line,
+			(ulong)evc_read(evc), evc->evc_func);
 
+		free_percpu(xchg(&evc->evc_pcpu, NULL));
 		evc = evc->evc_next;
 	}
 }
@@ -8,20 +8,35 @@
 
 #include <linux/atomic.h>
 #include <linux/cache.h>
+#include <linux/compiler.h>
+#include <linux/percpu.h>
 
+struct dentry;
+
+/**
+ * struct evc - ev() call site event counter
+ * @evc_pcpu:     per-CPU odometers, allocated on the first event
+ * @evc_odometer: events counted before (or without) evc_pcpu
+ * @evc_next:     next call site with a non-zero count
+ * @evc_file:
+ * @evc_func:
+ * @evc_line:
+ */
 struct evc {
-	atomic64_t  evc_odometer;
-	struct evc *evc_next;
-	const char *evc_file;
-	const char *evc_func;
-	int         evc_line;
-} ____cacheline_aligned;
+	u64 __percpu   *evc_pcpu;
+	atomic64_t      evc_odometer;
+	struct evc     *evc_next;
+	const char     *evc_file;
+	const char     *evc_func;
+	int             evc_line;
+};
 
 #define _evc_section       __section(mpool_evc)
 
 #define ev(_expr)						\
 	({							\
 		static struct evc _evc _evc_section = {		\
+			.evc_pcpu = NULL,			\
 			.evc_odometer = ATOMIC_INIT(0),		\
 			.evc_next = NULL,			\
 			.evc_file = __FILE__,			\
@@ -33,8 +48,24 @@ struct evc {
 		unlikely(_tmp) ? (evc_count(&_evc), _tmp) : _tmp;	\
 	})
 
-void evc_count(struct evc *evc);
+void evc_count_slow(struct evc *evc);
+
+static inline void evc_count(struct evc *evc)
+{
+	u64 __percpu *pcpu = READ_ONCE(evc->evc_pcpu);
+
+	if (likely(pcpu))
+		this_cpu_inc(*pcpu);
+	else
+		evc_count_slow(evc);
+}
+
 void evc_init(void);
 void evc_fini(void);
 
+/**
+ * evc_debugfs_root() - Return the mpool debugfs directory, NULL if none
+ */
+struct dentry *evc_debugfs_root(void);
+
 #endif /* MPOOL_EVC_H */
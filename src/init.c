@@ -8,6 +8,9 @@
 #include "mpool_config.h"
 #include "mpool_defs.h"
 
+#define CREATE_TRACE_POINTS
+#include "mpool_trace.h"
+
 /*
  * Init functions
  */
@@ -23,10 +26,15 @@ struct omf_sb_descriptor SBCLEAR;
  * Slab caches to optimize the allocation/deallocation of
  * high-count objects.
  */
-struct kmem_cache  *pmd_obj_erase_work_cache __read_mostly;
-struct kmem_cache  *pmd_layout_priv_cache __read_mostly;
-struct kmem_cache  *pmd_layout_cache __read_mostly;
-struct kmem_cache  *smap_zone_cache __read_mostly;
+struct kmem_cache          *pmd_obj_erase_work_cache __read_mostly;
+static struct kmem_cache   *pmd_layout_priv_cache __read_mostly;
+static struct kmem_cache   *pmd_layout_cache __read_mostly;
+static struct kmem_cache   *smap_zone_cache __read_mostly;
+
+/* Per-cpu magazines in front of the layout and smap zone slab caches. */
+struct objcache            pmd_layout_oc;
+struct objcache            pmd_layout_priv_oc;
+struct objcache            smap_zone_oc;
 
 unsigned int mpc_rsvd_bios_max __read_mostly = 16;
 
@@ -53,9 +61,14 @@ int mpcore_init(void)
 	/* Prepare the empty sb struct */
 	sbutil_mdc0_clear(&SBCLEAR);
 
-	/* Initialize the slab caches. */
+	pmd_obj_locks_init();
+
+	/*
+	 * Initialize the slab caches.  pmd_layout_cache holds the mblock
+	 * layouts, which are not cache line aligned to keep them small.
+	 */
 	pmd_layout_cache = kmem_cache_create("mpool_pmd_layout", sizeof(struct pmd_layout),
-					     0, SLAB_HWCACHE_ALIGN | SLAB_POISON, NULL);
+					     0, SLAB_POISON, NULL);
 
 	if (!pmd_layout_cache) {
 		err = merr(ENOMEM);
@@ -100,6 +113,23 @@ int mpcore_init(void)
 		return -merr_errno(ENOMEM);
 	}
 
+	err = objcache_init(&pmd_layout_oc, pmd_layout_cache, sizeof(struct pmd_layout),
+			    "pmd_layout");
+	if (!err)
+		err = objcache_init(&pmd_layout_priv_oc, pmd_layout_priv_cache,
+				    sizeof(struct pmd_layout) + sizeof(union pmd_layout_priv),
+				    "pmd_layout_mlog");
+	if (!err)
+		err = objcache_init(&smap_zone_oc, smap_zone_cache, sizeof(struct smap_zone),
+				    "smap_zone");
+	if (err) {
+		mp_pr_err("objcache init failed", err);
+		mpcore_fini();
+		return -merr_errno(err);
+	}
+
+	objcache_debugfs_init(evc_debugfs_root());
+
 	mpc_rsvd_bios_max = clamp_t(uint, mpc_rsvd_bios_max, 1, 1024);
 
 #if HAVE_BIOSET_INIT
@@ -125,6 +155,14 @@ int mpcore_init(void)
 
 void mpcore_fini(void)
 {
+	/* Wait for RCU deferred pmd layout frees */
+	rcu_barrier();
+
+	objcache_debugfs_fini();
+	objcache_fini(&smap_zone_oc);
+	objcache_fini(&pmd_layout_priv_oc);
+	objcache_fini(&pmd_layout_oc);
+
 	kmem_cache_destroy(pmd_obj_erase_work_cache);
 	kmem_cache_destroy(pmd_layout_priv_cache);
 	kmem_cache_destroy(pmd_layout_cache);
@@ -138,6 +176,8 @@ void mpcore_fini(void)
 	if (mpool_tfm)
 		crypto_free_shash(mpool_tfm);
 
+	mblock_zip_fini();
+
 #if HAVE_BIOSET_INIT
 	bioset_exit(&mpool_bioset);
 #else
@@ -14,13 +14,15 @@
 #include <linux/bio.h>
 
 #include "mpool_config.h"
+#include "objcache.h"
 
 extern struct crypto_shash *mpool_tfm;
 
 extern struct kmem_cache *pmd_obj_erase_work_cache;
-extern struct kmem_cache *pmd_layout_priv_cache;
-extern struct kmem_cache *pmd_layout_cache;
-extern struct kmem_cache *smap_zone_cache;
+
+extern struct objcache pmd_layout_oc;
+extern struct objcache pmd_layout_priv_oc;
+extern struct objcache smap_zone_oc;
 
 extern unsigned int mpc_rsvd_bios_max;
 
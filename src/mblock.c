@@ -14,8 +14,83 @@
  */
 
 #include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/gfp.h>
+#include <linux/crypto.h>
 
 #include "mpool_defs.h"
+#include "mpool_trace.h"
+
+/**
+ * struct mblock_wcbuf - write-combining buffer of an uncommitted mblock
+ * @wc_len:   bytes buffered, always a multiple of PAGE_SIZE
+ * @wc_pagec: buffer capacity in pages, i.e., the optimal write size
+ * @wc_iov:   one page per element, allocated on first use
+ *
+ * Protected by pmd_obj_wrlock().  The buffered data logically follows
+ * eld_mblen, and eld_mblen stays a multiple of the optimal write size
+ * until the final flush at commit.
+ */
+struct mblock_wcbuf {
+	u32                 wc_len;
+	int                 wc_pagec;
+	struct mblock_zip  *wc_zip;
+	struct kvec         wc_iov[];
+};
+
+/*
+ * MBLOCK_ZCHUNK:   uncompressed bytes per chunk of a compressed mblock
+ * MBLOCK_ZLEN_MAX: max uncompressed length of a compressed mblock
+ * MBLOCK_ZALGO:    crypto API compression algorithm of compressed mblocks
+ */
+#define MBLOCK_ZCHUNK           max_t(u32, 64u << 10, PAGE_SIZE)
+#define MBLOCK_ZLEN_MAX         ((u32)(U32_MAX & PAGE_MASK))
+#define MBLOCK_ZALGO            "lz4"
+
+/**
+ * struct mblock_zip - compression state of an uncommitted compressed mblock
+ * @mz_tfm:    compressor, each tfm has a single compression workspace
+ * @mz_len:    uncompressed bytes staged in mz_ubuf
+ * @mz_ubuf:   MBLOCK_ZCHUNK bytes, data of the chunk being filled
+ * @mz_cbuf:   MBLOCK_ZCHUNK bytes, compressor output
+ * @mz_iov:    one element per page of MBLOCK_ZCHUNK
+ * @mz_clenv:  stored length of each chunk written out so far
+ * @mz_chunkc: number of chunks written out
+ * @mz_chunkm: capacity of mz_clenv[]
+ *
+ * Hangs off the write-combining buffer, which the compressed chunks are
+ * appended to.  Protected by pmd_obj_wrlock().
+ */
+struct mblock_zip {
+	struct crypto_comp *mz_tfm;
+	u32                 mz_len;
+	void               *mz_ubuf;
+	void               *mz_cbuf;
+	struct kvec        *mz_iov;
+	u32                *mz_clenv;
+	u32                 mz_chunkc;
+	u32                 mz_chunkm;
+};
+
+/**
+ * struct mblock_zidx - chunk index of a committed compressed mblock
+ * @zi_chunksz: uncompressed bytes per chunk
+ * @zi_chunkc:  number of chunks
+ * @zi_offv:    byte offset of each chunk on media
+ * @zi_lenv:    stored length of each chunk, see struct mblock_zfoot_omf
+ *
+ * Read from the trailer of the mblock on first read, immutable once
+ * published in eld_zidx.
+ */
+struct mblock_zidx {
+	u32     zi_chunksz;
+	u32     zi_chunkc;
+	u32    *zi_offv;
+	u32     zi_lenv[];
+};
+
+/* Decompressor shared by all readers, see mblock_ztfm_get() */
+static struct crypto_comp *mblock_ztfm;
 
 /**
  * mblock2layout() - convert opaque mblock handle to pmd_layout
@@ -48,6 +123,48 @@ static u32 mblock_optimal_iosz_get(struct mpool_descriptor *mp, struct pmd_layou
 	return pd->pdi_optiosz;
 }
 
+/*
+ * Uncommitted mblocks are discarded on recovery, so their data need only
+ * be durable by the time the commit record is logged.  With mp_mbfuadefer
+ * writes skip FUA and mblock_commit() flushes the drive cache instead.
+ */
+static inline bool mblock_fua(struct mpool_descriptor *mp, struct mpool_dev_info *pd)
+{
+	return pd->pdi_fua && !mp->pds_params.mp_mbfuadefer;
+}
+
+/*
+ * eld_wcbuf shares storage with eld_zidx.  A compressed mblock releases its
+ * write-combining buffer ahead of commit (see mblock_zip_seal()), and its
+ * chunk index is loaded only once it is committed.
+ */
+static inline struct mblock_wcbuf *mblock_wcbuf(struct pmd_layout *layout)
+{
+	if (pmd_layout_zip(layout) && (layout->eld_state & PMD_LYT_COMMITTED))
+		return NULL;
+
+	return layout->eld_wcbuf;
+}
+
+static inline u32 mblock_wclen(struct pmd_layout *layout)
+{
+	struct mblock_wcbuf *wc = mblock_wcbuf(layout);
+
+	return wc ? wc->wc_len : 0;
+}
+
+/*
+ * Length of the data written to an mblock as seen by clients, i.e., the
+ * uncompressed length of a compressed mblock.
+ */
+static inline u32 mblock_wlen(struct pmd_layout *layout)
+{
+	if (pmd_layout_zip(layout))
+		return layout->eld_zlen;
+
+	return layout->eld_mblen + mblock_wclen(layout);
+}
+
 /**
  * layout2mblock() - convert pmd_layout to opaque mblock_descriptor
  *
@@ -74,7 +191,7 @@ mblock_getprops_cmn(
 
 	prop->mpr_objid = layout->eld_objid;
 	prop->mpr_alloc_cap = pmd_layout_cap_get(mp, layout);
-	prop->mpr_write_len = layout->eld_mblen;
+	prop->mpr_write_len = mblock_wlen(layout);
 	prop->mpr_optimal_wrsz = mblock_optimal_iosz_get(mp, layout);
 	prop->mpr_mclassp = pd->pdi_mclass;
 	prop->mpr_iscommitted = layout->eld_state & PMD_LYT_COMMITTED;
@@ -185,6 +302,39 @@ mblock_find_get(
 	return 0;
 }
 
+merr_t
+mblock_find_getv(
+	struct mpool_descriptor    *mp,
+	const u64                  *objidv,
+	u32                         objidc,
+	struct mblock_descriptor  **mbhv,
+	u64                        *wlenv)
+{
+	struct pmd_layout **layoutv;
+	merr_t              err;
+	u32                 i;
+
+	for (i = 0; i < objidc; i++) {
+		if (ev(!mblock_objid(objidv[i])))
+			return merr(EINVAL);
+	}
+
+	/* An mblock handle is its layout, mbhv[] holds the layouts meanwhile */
+	layoutv = (struct pmd_layout **)mbhv;
+
+	err = pmd_obj_find_getv(mp, objidv, objidc, layoutv);
+	if (err)
+		return err;
+
+	/* The write length of a committed mblock is stable, no need to lock */
+	for (i = 0; i < objidc; i++) {
+		wlenv[i] = mblock_wlen(layoutv[i]);
+		mbhv[i] = layout2mblock(layoutv[i]);
+	}
+
+	return 0;
+}
+
 void mblock_put(struct mpool_descriptor *mp, struct mblock_descriptor *mbh)
 {
 	struct pmd_layout *layout;
@@ -209,259 +359,1485 @@ do {									\
 	}								\
 } while (0)
 
-merr_t mblock_commit(struct mpool_descriptor *mp, struct mblock_descriptor *mbh)
-{
-	struct pmd_layout     *layout;
-	merr_t                 err;
-	struct mpool_dev_info *pd;
-
-	layout = mblock2layout(mbh);
-	if (ev(!layout)) {
-		mp_pr_layout_not_found(mp, mbh);
-		return merr(EINVAL);
-	}
-
-	pd = pmd_layout_pd_get(mp, layout);
-	if (!pd->pdi_fua) {
-		err = pd_dev_flush(pd);
-		if (ev(err))
-			return err;
-	}
-
-	/* Commit will fail with EBUSY if aborting flag set. */
-	err = pmd_obj_commit(mp, layout);
-	if (ev(err)) {
-		mp_pr_rl("mpool %s, committing mblock 0x%lx failed",
-			 err, mp->pds_name, (ulong)layout->eld_objid);
-		return err;
-	}
+/**
+ * struct mblock_ckey - mblock cache key
+ * @mck_objid: mblock objid
+ * @mck_pgidx: page index within the mblock
+ */
+struct mblock_ckey {
+	u64 mck_objid;
+	u64 mck_pgidx;
+};
 
-	return 0;
+/**
+ * struct mblock_cent - mblock cache entry, one page of a committed mblock
+ * @mce_hnode: mbc_htab linkage
+ * @mce_key:
+ * @mce_lru:   mbc_lru linkage, empty once the entry is removed
+ * @mce_rcu:   entries are freed after an RCU grace period
+ * @mce_buf:   page of mblock data
+ * @mce_ref:   hit since the last eviction scan
+ */
+struct mblock_cent {
+	struct rhash_head   mce_hnode;
+	struct mblock_ckey  mce_key;
+	struct list_head    mce_lru;
+	struct rcu_head     mce_rcu;
+	void               *mce_buf;
+	bool                mce_ref;
+};
+
+static const struct rhashtable_params mblock_cache_params = {
+	.key_len             = sizeof(struct mblock_ckey),
+	.key_offset          = offsetof(struct mblock_cent, mce_key),
+	.head_offset         = offsetof(struct mblock_cent, mce_hnode),
+	.automatic_shrinking = true,
+};
+
+static void mblock_cent_free(struct mblock_cent *ent)
+{
+	free_page((unsigned long)ent->mce_buf);
+	kfree(ent);
 }
 
-merr_t mblock_abort(struct mpool_descriptor *mp, struct mblock_descriptor *mbh)
+static void mblock_cent_free_rcu(struct rcu_head *rh)
 {
-	struct pmd_layout  *layout;
-	merr_t              err;
-
-	layout = mblock2layout(mbh);
-	if (ev(!layout)) {
-		mp_pr_layout_not_found(mp, mbh);
-		return merr(EINVAL);
-	}
-
-	err = pmd_obj_abort(mp, layout);
-	if (ev(err)) {
-		mp_pr_err("mpool %s, aborting mblock 0x%lx failed",
-			  err, mp->pds_name, (ulong)layout->eld_objid);
-		return err;
-	}
-
-	return 0;
+	mblock_cent_free(container_of(rh, struct mblock_cent, mce_rcu));
 }
 
-merr_t mblock_delete(struct mpool_descriptor *mp, struct mblock_descriptor *mbh)
+/* Caller must hold mbc_lock. */
+static void mblock_cent_remove(struct mblock_cache *mbc, struct mblock_cent *ent)
 {
-	struct pmd_layout *layout;
+	rhashtable_remove_fast(&mbc->mbc_htab, &ent->mce_hnode, mblock_cache_params);
+	list_del_init(&ent->mce_lru);
+	--mbc->mbc_pages;
 
-	layout = mblock2layout(mbh);
-	if (ev(!layout)) {
-		mp_pr_layout_not_found(mp, mbh);
-		return merr(EINVAL);
-	}
+	call_rcu(&ent->mce_rcu, mblock_cent_free_rcu);
+}
 
-	return pmd_obj_delete(mp, layout);
+static bool mblock_cache_enabled(struct mpool_descriptor *mp, struct pmd_layout *layout)
+{
+	return mp->pds_params.mp_mbcachesz && layout->eld_mblen <= MPOOL_MBCACHE_OBJMAX;
 }
 
 /**
- * mblock_rw_argcheck()
- *
- * @mp:      - Mpool descriptor
- * @layout:  - Layout of the mblock
- * @iov:     - iovec array
- * @iovcnt:  - iovec count
- * @boff:    - Byte offset into the layout.  Must be equal to layout->eld_mblen
- *             for write
- * @rw:      - MPOOL_OP_READ or MPOOL_OP_WRITE
- * @len:     - number of bytes in iov list
- *
- * Validate mblock_write() and mblock_read()
- *
- * Returns: 0 if successful, merr_t otherwise
+ * mblock_cache_read() - Serve a read of a committed mblock from the cache
+ * @mp:
+ * @layout:
+ * @iov:    one page per element
+ * @iovcnt:
+ * @boff:
  *
- * Note: be aware that there are checks in this function that prevent illegal
- * arguments in lower level functions (lower level functions should assert the
- * requirements but not otherwise check them)
+ * Return: true if every page was found in the cache.  On a miss the
+ * content of iov is undefined.
  */
-static merr_t
-mblock_rw_argcheck(
+static bool
+mblock_cache_read(
 	struct mpool_descriptor    *mp,
 	struct pmd_layout          *layout,
-	loff_t                      boff,
-	int                         rw,
-	size_t                      len)
+	const struct kvec          *iov,
+	int                         iovcnt,
+	loff_t                      boff)
 {
-	u64    opt_iosz;
-	u32    mblock_cap;
-	merr_t err;
+	struct mblock_cache *mbc = &mp->pds_mbcache;
+	struct mblock_cent  *ent;
+	struct mblock_ckey   key;
+	int                  i;
 
-	mblock_cap = pmd_layout_cap_get(mp, layout);
-	opt_iosz = mblock_optimal_iosz_get(mp, layout);
+	if (!mblock_cache_enabled(mp, layout) || !READ_ONCE(mbc->mbc_pages))
+		return false;
 
-	if (rw == MPOOL_OP_READ) {
-		/* boff must be a multiple of the OS page size */
-		if (!PAGE_ALIGNED(boff)) {
-			err = merr(EINVAL);
-			mp_pr_err("mpool %s, read offset 0x%lx is not multiple of OS page size",
-				  err, mp->pds_name, (ulong) boff);
-			return err;
-		}
+	key.mck_objid = layout->eld_objid;
+	key.mck_pgidx = boff >> PAGE_SHIFT;
 
-		/* Check that boff is not past end of mblock capacity. */
-		if (mblock_cap <= boff) {
-			err = merr(EINVAL);
-			mp_pr_err("mpool %s, read offset 0x%lx >= mblock capacity 0x%x",
-				  err, mp->pds_name, (ulong)boff, mblock_cap);
-			return err;
-		}
+	rcu_read_lock();
+	for (i = 0; i < iovcnt; ++i, ++key.mck_pgidx) {
+		ent = rhashtable_lookup_fast(&mbc->mbc_htab, &key, mblock_cache_params);
+		if (!ent)
+			break;
 
-		/*
-		 * Check that the request does not extend past the data
-		 * written.  Don't record an error if this appears to
-		 * be an mcache readahead request.
-		 *
-		 * TODO: Use (len != MCACHE_RA_PAGES_MAX)
-		 */
-		if (ev(boff + len > layout->eld_mblen))
-			return merr(EINVAL);
-	} else {
-		/* Write boff required to match eld_mblen */
-		if (boff != layout->eld_mblen) {
-			err = merr(EINVAL);
-			mp_pr_err("mpool %s write boff (%ld) != eld_mblen (%d)",
-				  err, mp->pds_name, (ulong)boff, layout->eld_mblen);
-			return err;
-		}
+		if (!READ_ONCE(ent->mce_ref))
+			WRITE_ONCE(ent->mce_ref, true);
 
-		/* Writes must be optimal iosz aligned */
-		if (boff % opt_iosz) {
-			err = merr(EINVAL);
-			mp_pr_err("mpool %s, write not optimal iosz aligned, offset 0x%lx",
-				  err, mp->pds_name, (ulong)boff);
-			return err;
-		}
+		memcpy(iov[i].iov_base, ent->mce_buf, PAGE_SIZE);
+	}
+	rcu_read_unlock();
 
-		/* Check for write past end of allocated space (!) */
-		if ((len + boff) > mblock_cap) {
-			err = merr(EINVAL);
-			mp_pr_err("(write): len %lu + boff %lu > mblock_cap %lu",
-				  err, (ulong)len, (ulong)boff, (ulong)mblock_cap);
-			return err;
+	return i == iovcnt;
+}
+
+/* Drop unreferenced entries from the head of mbc_lru until under max. */
+static void mblock_cache_evict(struct mblock_cache *mbc, u64 max)
+{
+	struct mblock_cent *ent;
+
+	while (mbc->mbc_pages > max) {
+		ent = list_first_entry(&mbc->mbc_lru, typeof(*ent), mce_lru);
+
+		if (ent->mce_ref) {
+			WRITE_ONCE(ent->mce_ref, false);
+			list_move_tail(&ent->mce_lru, &mbc->mbc_lru);
+			continue;
 		}
-	}
 
-	return 0;
+		mblock_cent_remove(mbc, ent);
+	}
 }
 
-merr_t
-mblock_write(
+/**
+ * mblock_cache_fill() - Add the pages just read from a committed mblock
+ * @mp:
+ * @layout:
+ * @iov:    one page per element
+ * @iovcnt:
+ * @boff:
+ *
+ * Best effort, pages that can't be allocated are simply not cached.
+ */
+static void
+mblock_cache_fill(
 	struct mpool_descriptor    *mp,
-	struct mblock_descriptor   *mbh,
+	struct pmd_layout          *layout,
 	const struct kvec          *iov,
 	int                         iovcnt,
-	size_t                      len)
+	loff_t                      boff)
 {
-	struct pmd_layout *layout;
+	struct mblock_cache *mbc = &mp->pds_mbcache;
+	struct mblock_cent  *ent;
+	u64                  max;
+	int                  rc;
+	int                  i;
+
+	if (!mblock_cache_enabled(mp, layout))
+		return;
+
+	max = mp->pds_params.mp_mbcachesz << (20 - PAGE_SHIFT);
+
+	for (i = 0; i < iovcnt; ++i) {
+		ent = kmalloc(sizeof(*ent), GFP_KERNEL | __GFP_NOWARN);
+		if (!ent)
+			return;
+
+		ent->mce_buf = (void *)__get_free_page(GFP_KERNEL | __GFP_NOWARN);
+		if (!ent->mce_buf) {
+			kfree(ent);
+			return;
+		}
 
-	merr_t err;
-	loff_t boff;
-	u8     state;
+		memcpy(ent->mce_buf, iov[i].iov_base, PAGE_SIZE);
+		ent->mce_key.mck_objid = layout->eld_objid;
+		ent->mce_key.mck_pgidx = (boff >> PAGE_SHIFT) + i;
+		ent->mce_ref = false;
+
+		spin_lock(&mbc->mbc_lock);
+		rc = rhashtable_lookup_insert_fast(&mbc->mbc_htab, &ent->mce_hnode,
+						   mblock_cache_params);
+		if (!rc) {
+			list_add_tail(&ent->mce_lru, &mbc->mbc_lru);
+			++mbc->mbc_pages;
+			mblock_cache_evict(mbc, max);
+		}
+		spin_unlock(&mbc->mbc_lock);
 
-	layout = mblock2layout(mbh);
-	if (ev(!layout)) {
-		mp_pr_layout_not_found(mp, mbh);
-		return merr(EINVAL);
+		if (rc)
+			mblock_cent_free(ent);
 	}
+}
 
-	err = mblock_rw_argcheck(mp, layout, layout->eld_mblen, MPOOL_OP_WRITE, len);
-	if (ev(err)) {
-		mp_pr_debug("mblock write argcheck failed ", err);
-		return err;
+/**
+ * mblock_cache_inval() - Drop all cached pages of a deleted mblock
+ * @mp:
+ * @objid:
+ * @mblen:  mblock length
+ *
+ * Called once the delete succeeded, at which point nothing can hold a ref
+ * on the mblock to refill the cache.
+ */
+static void mblock_cache_inval(struct mpool_descriptor *mp, u64 objid, u32 mblen)
+{
+	struct mblock_cache *mbc = &mp->pds_mbcache;
+	struct mblock_cent  *ent;
+	struct mblock_ckey   key;
+	u64                  pgc;
+
+	if (!READ_ONCE(mbc->mbc_pages) || mblen > MPOOL_MBCACHE_OBJMAX)
+		return;
+
+	key.mck_objid = objid;
+	pgc = PAGE_ALIGN(mblen) >> PAGE_SHIFT;
+
+	spin_lock(&mbc->mbc_lock);
+	for (key.mck_pgidx = 0; key.mck_pgidx < pgc; ++key.mck_pgidx) {
+		ent = rhashtable_lookup_fast(&mbc->mbc_htab, &key, mblock_cache_params);
+		if (ent && !list_empty(&ent->mce_lru))
+			mblock_cent_remove(mbc, ent);
 	}
+	spin_unlock(&mbc->mbc_lock);
+}
 
-	if (len == 0)
-		return 0;
+merr_t mblock_cache_init(struct mpool_descriptor *mp)
+{
+	struct mblock_cache *mbc = &mp->pds_mbcache;
+	int                  rc;
 
-	boff = layout->eld_mblen;
+	rc = rhashtable_init(&mbc->mbc_htab, &mblock_cache_params);
+	if (ev(rc))
+		return merr(rc);
 
-	assert(PAGE_ALIGNED(len));
-	assert(iovcnt == (len >> PAGE_SHIFT));
-	assert(PAGE_ALIGNED(boff));
+	spin_lock_init(&mbc->mbc_lock);
+	INIT_LIST_HEAD(&mbc->mbc_lru);
+	mbc->mbc_pages = 0;
 
-	pmd_obj_wrlock(layout);
-	state = layout->eld_state;
-	if (!(state & PMD_LYT_COMMITTED)) {
-		struct mpool_dev_info *pd = pmd_layout_pd_get(mp, layout);
-		int                    flags = 0;
+	return 0;
+}
 
-		if (pd->pdi_fua)
-			flags = REQ_FUA;
+void mblock_cache_fini(struct mpool_descriptor *mp)
+{
+	struct mblock_cache *mbc = &mp->pds_mbcache;
+	struct mblock_cent  *ent, *next;
 
-		err = pmd_layout_rw(mp, layout, iov, iovcnt, boff, flags, MPOOL_OP_WRITE);
-		if (!err)
-			layout->eld_mblen += len;
-	}
-	pmd_obj_wrunlock(layout);
+	/* No more lookups at this point, and pending frees don't touch mbc. */
+	list_for_each_entry_safe(ent, next, &mbc->mbc_lru, mce_lru)
+		mblock_cent_free(ent);
+
+	INIT_LIST_HEAD(&mbc->mbc_lru);
+	mbc->mbc_pages = 0;
 
-	return (!(state & PMD_LYT_COMMITTED)) ? err : merr(EALREADY);
+	rhashtable_destroy(&mbc->mbc_htab);
 }
 
-merr_t
-mblock_read(
-	struct mpool_descriptor    *mp,
-	struct mblock_descriptor   *mbh,
-	const struct kvec          *iov,
-	int                         iovcnt,
-	loff_t                      boff,
-	size_t                      len)
+static void mblock_zip_free(struct mblock_zip *zc)
 {
-	struct pmd_layout *layout;
+	if (!zc)
+		return;
+
+	if (zc->mz_tfm)
+		crypto_free_comp(zc->mz_tfm);
+	if (zc->mz_ubuf)
+		free_pages_exact(zc->mz_ubuf, MBLOCK_ZCHUNK);
+	if (zc->mz_cbuf)
+		free_pages_exact(zc->mz_cbuf, MBLOCK_ZCHUNK);
+
+	kfree(zc->mz_iov);
+	kfree(zc->mz_clenv);
+	kfree(zc);
+}
 
-	merr_t err;
-	u8     state;
+static void mblock_wcbuf_free(struct pmd_layout *layout)
+{
+	struct mblock_wcbuf *wc = mblock_wcbuf(layout);
+	int                  i;
 
-	assert(mp);
+	if (!wc)
+		return;
 
-	layout = mblock2layout(mbh);
-	if (ev(!layout)) {
-		mp_pr_layout_not_found(mp, mbh);
-		return merr(EINVAL);
+	for (i = 0; i < wc->wc_pagec; ++i) {
+		if (wc->wc_iov[i].iov_base)
+			free_page((unsigned long)wc->wc_iov[i].iov_base);
 	}
 
-	err = mblock_rw_argcheck(mp, layout, boff, MPOOL_OP_READ, len);
-	if (ev(err)) {
-		mp_pr_debug("mblock read argcheck failed ", err);
+	mblock_zip_free(wc->wc_zip);
+
+	layout->eld_wcbuf = NULL;
+	kfree(wc);
+}
+
+void mblock_layout_release(struct pmd_layout *layout)
+{
+	if (pmd_layout_zip(layout) && (layout->eld_state & PMD_LYT_COMMITTED)) {
+		kvfree(layout->eld_zidx);
+		layout->eld_zidx = NULL;
+		return;
+	}
+
+	mblock_wcbuf_free(layout);
+}
+
+/**
+ * mblock_wcbuf_flush() - Write out the buffered data of a write-combining mblock
+ * @mp:
+ * @layout:
+ * @flags:  REQ_* flags for the write
+ *
+ * Caller must hold pmd_obj_wrlock().
+ */
+static merr_t mblock_wcbuf_flush(struct mpool_descriptor *mp, struct pmd_layout *layout, int flags)
+{
+	struct mblock_wcbuf *wc = layout->eld_wcbuf;
+	merr_t               err;
+
+	if (!wc || !wc->wc_len)
+		return 0;
+
+	err = pmd_layout_rw(mp, layout, wc->wc_iov, wc->wc_len >> PAGE_SHIFT,
+			    layout->eld_mblen, flags, MPOOL_OP_WRITE);
+	if (ev(err))
+		return err;
+
+	layout->eld_mblen += wc->wc_len;
+	wc->wc_len = 0;
+
+	return 0;
+}
+
+/**
+ * mblock_wcbuf_write() - Append iov to a write-combining mblock
+ * @mp:
+ * @layout:
+ * @iov:    one page per element
+ * @iovcnt:
+ * @flags:  REQ_* flags for the writes
+ *
+ * Whole optimal write size units are written directly from iov while the
+ * buffer is empty, the remainder is copied to the buffer which is written
+ * out as soon as it fills.  Caller must hold pmd_obj_wrlock().
+ */
+static merr_t
+mblock_wcbuf_write(
+	struct mpool_descriptor    *mp,
+	struct pmd_layout          *layout,
+	const struct kvec          *iov,
+	int                         iovcnt,
+	int                         flags)
+{
+	struct mblock_wcbuf *wc = layout->eld_wcbuf;
+	merr_t               err;
+	int                  i = 0;
+	int                  n;
+	int                  idx;
+
+	while (i < iovcnt) {
+		idx = wc->wc_len >> PAGE_SHIFT;
+
+		/* Still full from a failed flush */
+		if (idx == wc->wc_pagec) {
+			err = mblock_wcbuf_flush(mp, layout, flags);
+			if (err)
+				return err;
+			continue;
+		}
+
+		if (idx == 0 && iovcnt - i >= wc->wc_pagec) {
+			n = rounddown(iovcnt - i, wc->wc_pagec);
+
+			err = pmd_layout_rw(mp, layout, iov + i, n, layout->eld_mblen,
+					    flags, MPOOL_OP_WRITE);
+			if (ev(err))
+				return err;
+
+			layout->eld_mblen += n << PAGE_SHIFT;
+			i += n;
+			continue;
+		}
+
+		if (!wc->wc_iov[idx].iov_base) {
+			wc->wc_iov[idx].iov_base = (void *)__get_free_page(GFP_KERNEL);
+			if (!wc->wc_iov[idx].iov_base)
+				return merr(ENOMEM);
+
+			wc->wc_iov[idx].iov_len = PAGE_SIZE;
+		}
+
+		memcpy(wc->wc_iov[idx].iov_base, iov[i].iov_base, PAGE_SIZE);
+		wc->wc_len += PAGE_SIZE;
+		++i;
+
+		if (idx + 1 == wc->wc_pagec) {
+			err = mblock_wcbuf_flush(mp, layout, flags);
+			if (err)
+				return err;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * mblock_zip_chunk() - Compress the staged chunk of a compressed mblock and
+ *	append it to the write-combining buffer
+ * @mp:
+ * @layout:
+ * @flags:  REQ_* flags for the writes
+ *
+ * Chunks that don't compress by at least a page are stored as is.  Room
+ * is left for the chunk index.  Caller must hold pmd_obj_wrlock().
+ */
+static merr_t mblock_zip_chunk(struct mpool_descriptor *mp, struct pmd_layout *layout, int flags)
+{
+	struct mblock_wcbuf *wc = layout->eld_wcbuf;
+	struct mblock_zip   *zc = wc->wc_zip;
+	unsigned int         clen;
+	merr_t               err;
+	void                *src;
+	u32                 *clenv;
+	u64                  end;
+	int                  pagec, i;
+
+	src = zc->mz_ubuf;
+	clen = zc->mz_len;
+
+	if (!crypto_comp_compress(zc->mz_tfm, zc->mz_ubuf, zc->mz_len, zc->mz_cbuf, &clen) &&
+	    PAGE_ALIGN(clen) < zc->mz_len) {
+		memset(zc->mz_cbuf + clen, 0, PAGE_ALIGN(clen) - clen);
+		src = zc->mz_cbuf;
+	} else {
+		clen = zc->mz_len;
+	}
+
+	end = (u64)layout->eld_mblen + wc->wc_len + PAGE_ALIGN(clen);
+	if (end + OMF_MBLOCK_ZTRAIL_LEN(zc->mz_chunkc + 1) > pmd_layout_cap_get(mp, layout))
+		return merr(ENOSPC);
+
+	if (zc->mz_chunkc == zc->mz_chunkm) {
+		clenv = krealloc(zc->mz_clenv, 2 * zc->mz_chunkm * sizeof(*clenv), GFP_KERNEL);
+		if (!clenv)
+			return merr(ENOMEM);
+
+		zc->mz_clenv = clenv;
+		zc->mz_chunkm *= 2;
+	}
+
+	pagec = PAGE_ALIGN(clen) >> PAGE_SHIFT;
+
+	for (i = 0; i < pagec; ++i)
+		zc->mz_iov[i].iov_base = src + (i << PAGE_SHIFT);
+
+	err = mblock_wcbuf_write(mp, layout, zc->mz_iov, pagec, flags);
+	if (err)
+		return err;
+
+	zc->mz_clenv[zc->mz_chunkc++] = clen;
+	zc->mz_len = 0;
+
+	return 0;
+}
+
+/**
+ * mblock_zip_write() - Append iov to a compressed mblock
+ * @mp:
+ * @layout:
+ * @iov:    one page per element
+ * @iovcnt:
+ * @flags:  REQ_* flags for the writes
+ *
+ * Caller must hold pmd_obj_wrlock().
+ */
+static merr_t
+mblock_zip_write(
+	struct mpool_descriptor    *mp,
+	struct pmd_layout          *layout,
+	const struct kvec          *iov,
+	int                         iovcnt,
+	int                         flags)
+{
+	struct mblock_zip *zc = layout->eld_wcbuf->wc_zip;
+	merr_t             err;
+	int                i;
+
+	for (i = 0; i < iovcnt; ++i) {
+		/* Still full from a failed write */
+		if (zc->mz_len == MBLOCK_ZCHUNK) {
+			err = mblock_zip_chunk(mp, layout, flags);
+			if (err)
+				return err;
+		}
+
+		memcpy(zc->mz_ubuf + zc->mz_len, iov[i].iov_base, PAGE_SIZE);
+		zc->mz_len += PAGE_SIZE;
+		layout->eld_zlen += PAGE_SIZE;
+	}
+
+	if (zc->mz_len == MBLOCK_ZCHUNK)
+		return mblock_zip_chunk(mp, layout, flags);
+
+	return 0;
+}
+
+/**
+ * mblock_zip_seal() - Write out the last chunk and the chunk index of a
+ *	compressed mblock
+ * @mp:
+ * @layout:
+ * @flags:  REQ_* flags for the writes
+ *
+ * The write-combining buffer is released once everything is written, as
+ * eld_wcbuf makes way for eld_zidx at commit.  Caller must hold
+ * pmd_obj_wrlock().
+ */
+static merr_t mblock_zip_seal(struct mpool_descriptor *mp, struct pmd_layout *layout, int flags)
+{
+	struct mblock_wcbuf *wc = layout->eld_wcbuf;
+	struct mblock_zip   *zc = wc->wc_zip;
+	struct kvec         *iov;
+	merr_t               err;
+	char                *buf;
+	size_t               tlen;
+	int                  pagec, i;
+
+	if (zc->mz_len > 0) {
+		err = mblock_zip_chunk(mp, layout, flags);
+		if (err)
+			return err;
+	}
+
+	tlen = OMF_MBLOCK_ZTRAIL_LEN(zc->mz_chunkc);
+	if ((u64)layout->eld_mblen + wc->wc_len + tlen > pmd_layout_cap_get(mp, layout))
+		return merr(ENOSPC);
+
+	pagec = tlen >> PAGE_SHIFT;
+
+	buf = alloc_pages_exact(tlen, GFP_KERNEL);
+	iov = kmalloc_array(pagec, sizeof(*iov), GFP_KERNEL);
+	if (!buf || !iov) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	err = omf_mblock_ztrail_pack_htole(buf, MBLOCK_ZCHUNK, layout->eld_zlen,
+					   zc->mz_clenv, zc->mz_chunkc);
+	if (ev(err))
+		goto errout;
+
+	for (i = 0; i < pagec; ++i) {
+		iov[i].iov_base = buf + (i << PAGE_SHIFT);
+		iov[i].iov_len = PAGE_SIZE;
+	}
+
+	err = mblock_wcbuf_write(mp, layout, iov, pagec, flags);
+	if (!err)
+		err = mblock_wcbuf_flush(mp, layout, flags);
+	if (!err)
+		mblock_wcbuf_free(layout);
+
+errout:
+	kfree(iov);
+	if (buf)
+		free_pages_exact(buf, tlen);
+
+	return err;
+}
+
+/*
+ * Write out the buffered data of a write-combining mblock ahead of commit,
+ * including the chunk index of a compressed mblock.
+ */
+static merr_t mblock_wcbuf_sync(struct mpool_descriptor *mp, struct pmd_layout *layout)
+{
+	struct mpool_dev_info *pd;
+	merr_t                 err = 0;
+	int                    flags = 0;
+
+	if (!layout->eld_wcbuf)
+		return 0;
+
+	pd = pmd_layout_pd_get(mp, layout);
+	if (mblock_fua(mp, pd))
+		flags = REQ_FUA;
+
+	pmd_obj_wrlock(layout);
+	if (!(layout->eld_state & PMD_LYT_COMMITTED) && layout->eld_wcbuf) {
+		if (pmd_layout_zip(layout))
+			err = mblock_zip_seal(mp, layout, flags);
+		else
+			err = mblock_wcbuf_flush(mp, layout, flags);
+	}
+	pmd_obj_wrunlock(layout);
+
+	return err;
+}
+
+/*
+ * A committed mblock can't be written, so release its buffer.  A compressed
+ * mblock already released it in mblock_zip_seal().
+ */
+static void mblock_wcbuf_put(struct pmd_layout *layout)
+{
+	if (pmd_layout_zip(layout) || !layout->eld_wcbuf)
+		return;
+
+	pmd_obj_wrlock(layout);
+	mblock_wcbuf_free(layout);
+	pmd_obj_wrunlock(layout);
+}
+
+merr_t mblock_commit(struct mpool_descriptor *mp, struct mblock_descriptor *mbh)
+{
+	struct pmd_layout     *layout;
+	merr_t                 err;
+	struct mpool_dev_info *pd;
+
+	layout = mblock2layout(mbh);
+	if (ev(!layout)) {
+		mp_pr_layout_not_found(mp, mbh);
+		return merr(EINVAL);
+	}
+
+	err = mblock_wcbuf_sync(mp, layout);
+	if (ev(err))
+		return err;
+
+	pd = pmd_layout_pd_get(mp, layout);
+	if (!mblock_fua(mp, pd)) {
+		err = pd_dev_flush(pd);
+		if (ev(err))
+			return err;
+	}
+
+	/* Commit will fail with EBUSY if aborting flag set. */
+	err = pmd_obj_commit(mp, layout);
+	if (ev(err)) {
+		mp_pr_rl("mpool %s, committing mblock 0x%lx failed",
+			 err, mp->pds_name, (ulong)layout->eld_objid);
+		return err;
+	}
+
+	mblock_wcbuf_put(layout);
+
+	return 0;
+}
+
+merr_t
+mblock_commitv(
+	struct mpool_descriptor    *mp,
+	struct mblock_descriptor  **mbhv,
+	int                         mbhc,
+	merr_t                     *errv)
+{
+	DECLARE_BITMAP(flushed, MPOOL_DRIVES_MAX);
+	merr_t                  flusherr[MPOOL_DRIVES_MAX];
+	struct pmd_layout     **layoutv;
+	struct mpool_dev_info  *pd;
+	merr_t                  err;
+	int                     i;
+	u16                     pdh;
+
+	if (mbhc < 1)
+		return merr(EINVAL);
+
+	layoutv = kmalloc_array(mbhc, sizeof(*layoutv), GFP_KERNEL);
+	if (!layoutv)
+		return merr(ENOMEM);
+
+	bitmap_zero(flushed, MPOOL_DRIVES_MAX);
+
+	/* Flush each drive's write cache only once for the entire batch. */
+	for (i = 0; i < mbhc; ++i) {
+		layoutv[i] = NULL;
+		if (errv[i])
+			continue;
+
+		layoutv[i] = mblock2layout(mbhv[i]);
+		if (ev(!layoutv[i])) {
+			mp_pr_layout_not_found(mp, mbhv[i]);
+			errv[i] = merr(EINVAL);
+			continue;
+		}
+
+		errv[i] = mblock_wcbuf_sync(mp, layoutv[i]);
+		if (ev(errv[i]))
+			continue;
+
+		pd = pmd_layout_pd_get(mp, layoutv[i]);
+		if (mblock_fua(mp, pd))
+			continue;
+
+		pdh = layoutv[i]->eld_ld.ol_pdh;
+		if (!test_and_set_bit(pdh, flushed))
+			flusherr[pdh] = pd_dev_flush(pd);
+
+		errv[i] = flusherr[pdh];
+	}
+
+	err = pmd_obj_commitv(mp, layoutv, mbhc, errv);
+	if (!ev(err)) {
+		for (i = 0; i < mbhc; ++i) {
+			if (layoutv[i] && errv[i])
+				mp_pr_rl("mpool %s, committing mblock 0x%lx failed",
+					 errv[i], mp->pds_name, (ulong)layoutv[i]->eld_objid);
+			else if (layoutv[i])
+				mblock_wcbuf_put(layoutv[i]);
+		}
+	}
+
+	kfree(layoutv);
+
+	return err;
+}
+
+merr_t mblock_abort(struct mpool_descriptor *mp, struct mblock_descriptor *mbh)
+{
+	struct pmd_layout  *layout;
+	merr_t              err;
+
+	layout = mblock2layout(mbh);
+	if (ev(!layout)) {
+		mp_pr_layout_not_found(mp, mbh);
+		return merr(EINVAL);
+	}
+
+	err = pmd_obj_abort(mp, layout);
+	if (ev(err)) {
+		mp_pr_err("mpool %s, aborting mblock 0x%lx failed",
+			  err, mp->pds_name, (ulong)layout->eld_objid);
+		return err;
+	}
+
+	return 0;
+}
+
+merr_t mblock_delete(struct mpool_descriptor *mp, struct mblock_descriptor *mbh)
+{
+	struct pmd_layout *layout;
+	merr_t             err;
+	u64                objid;
+	u32                mblen;
+
+	layout = mblock2layout(mbh);
+	if (ev(!layout)) {
+		mp_pr_layout_not_found(mp, mbh);
+		return merr(EINVAL);
+	}
+
+	objid = layout->eld_objid;
+	mblen = layout->eld_mblen;
+
+	err = pmd_obj_delete(mp, layout);
+	if (!err)
+		mblock_cache_inval(mp, objid, mblen);
+
+	return err;
+}
+
+merr_t
+mblock_deletev(
+	struct mpool_descriptor    *mp,
+	struct mblock_descriptor  **mbhv,
+	int                         mbhc,
+	merr_t                     *errv)
+{
+	struct pmd_layout **layoutv;
+	merr_t              err;
+	u64                *objidv;
+	u32                *mblenv;
+	int                 i;
+
+	if (mbhc < 1)
+		return merr(EINVAL);
+
+	/* The objids and lengths are kept for cache invalidation. */
+	layoutv = kmalloc_array(mbhc, sizeof(*layoutv) + sizeof(*objidv) + sizeof(*mblenv),
+				GFP_KERNEL);
+	if (!layoutv)
+		return merr(ENOMEM);
+
+	objidv = (u64 *)(layoutv + mbhc);
+	mblenv = (u32 *)(objidv + mbhc);
+
+	for (i = 0; i < mbhc; ++i) {
+		layoutv[i] = NULL;
+		if (errv[i])
+			continue;
+
+		layoutv[i] = mblock2layout(mbhv[i]);
+		if (ev(!layoutv[i])) {
+			mp_pr_layout_not_found(mp, mbhv[i]);
+			errv[i] = merr(EINVAL);
+			continue;
+		}
+
+		objidv[i] = layoutv[i]->eld_objid;
+		mblenv[i] = layoutv[i]->eld_mblen;
+	}
+
+	err = pmd_obj_deletev(mp, layoutv, mbhc, errv);
+
+	for (i = 0; i < mbhc && !err; ++i) {
+		if (layoutv[i] && !errv[i])
+			mblock_cache_inval(mp, objidv[i], mblenv[i]);
+	}
+
+	kfree(layoutv);
+
+	return err;
+}
+
+/**
+ * mblock_rw_argcheck()
+ *
+ * @mp:      - Mpool descriptor
+ * @layout:  - Layout of the mblock
+ * @iov:     - iovec array
+ * @iovcnt:  - iovec count
+ * @boff:    - Byte offset into the layout.  Must be equal to layout->eld_mblen
+ *             plus any write-combined data for write
+ * @rw:      - MPOOL_OP_READ or MPOOL_OP_WRITE
+ * @len:     - number of bytes in iov list
+ *
+ * Validate mblock_write() and mblock_read()
+ *
+ * Returns: 0 if successful, merr_t otherwise
+ *
+ * Note: be aware that there are checks in this function that prevent illegal
+ * arguments in lower level functions (lower level functions should assert the
+ * requirements but not otherwise check them)
+ */
+static merr_t
+mblock_rw_argcheck(
+	struct mpool_descriptor    *mp,
+	struct pmd_layout          *layout,
+	loff_t                      boff,
+	int                         rw,
+	size_t                      len)
+{
+	u64    opt_iosz;
+	u32    mblock_cap;
+	merr_t err;
+
+	mblock_cap = pmd_layout_cap_get(mp, layout);
+	opt_iosz = mblock_optimal_iosz_get(mp, layout);
+
+	/*
+	 * Offsets and lengths of a compressed mblock are those of the
+	 * uncompressed data, which may well exceed the mblock capacity.
+	 */
+	if (pmd_layout_zip(layout)) {
+		if (!PAGE_ALIGNED(boff))
+			return merr(EINVAL);
+
+		if (rw == MPOOL_OP_READ)
+			return (boff + len > layout->eld_zlen) ? merr(EINVAL) : 0;
+
+		if (boff != layout->eld_zlen || boff + len > MBLOCK_ZLEN_MAX)
+			return merr(EINVAL);
+
+		return 0;
+	}
+
+	if (rw == MPOOL_OP_READ) {
+		/* boff must be a multiple of the OS page size */
+		if (!PAGE_ALIGNED(boff)) {
+			err = merr(EINVAL);
+			mp_pr_err("mpool %s, read offset 0x%lx is not multiple of OS page size",
+				  err, mp->pds_name, (ulong) boff);
+			return err;
+		}
+
+		/* Check that boff is not past end of mblock capacity. */
+		if (mblock_cap <= boff) {
+			err = merr(EINVAL);
+			mp_pr_err("mpool %s, read offset 0x%lx >= mblock capacity 0x%x",
+				  err, mp->pds_name, (ulong)boff, mblock_cap);
+			return err;
+		}
+
+		/*
+		 * Check that the request does not extend past the data
+		 * written.  Don't record an error if this appears to
+		 * be an mcache readahead request.
+		 *
+		 * TODO: Use (len != MCACHE_RA_PAGES_MAX)
+		 */
+		if (ev(boff + len > layout->eld_mblen))
+			return merr(EINVAL);
+	} else {
+		/* Write boff required to match eld_mblen */
+		if (boff != layout->eld_mblen + mblock_wclen(layout)) {
+			err = merr(EINVAL);
+			mp_pr_err("mpool %s write boff (%ld) != eld_mblen (%d)",
+				  err, mp->pds_name, (ulong)boff, layout->eld_mblen);
+			return err;
+		}
+
+		/*
+		 * Writes must be optimal iosz aligned, the write-combining
+		 * buffer takes care of that in the write-combining case.
+		 */
+		if (mblock_wcbuf(layout) ? !PAGE_ALIGNED(boff) : (boff % opt_iosz)) {
+			err = merr(EINVAL);
+			mp_pr_err("mpool %s, write not optimal iosz aligned, offset 0x%lx",
+				  err, mp->pds_name, (ulong)boff);
+			return err;
+		}
+
+		/* Check for write past end of allocated space (!) */
+		if ((len + boff) > mblock_cap) {
+			err = merr(EINVAL);
+			mp_pr_err("(write): len %lu + boff %lu > mblock_cap %lu",
+				  err, (ulong)len, (ulong)boff, (ulong)mblock_cap);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+merr_t
+mblock_write(
+	struct mpool_descriptor    *mp,
+	struct mblock_descriptor   *mbh,
+	const struct kvec          *iov,
+	int                         iovcnt,
+	size_t                      len)
+{
+	struct pmd_layout *layout;
+
+	merr_t err;
+	loff_t boff;
+	u64    tstart;
+	u8     state;
+
+	layout = mblock2layout(mbh);
+	if (ev(!layout)) {
+		mp_pr_layout_not_found(mp, mbh);
+		return merr(EINVAL);
+	}
+
+	tstart = trace_mpool_mblock_write_enabled() ? ktime_get_ns() : 0;
+
+	/*
+	 * The layout lock is taken ahead of the argument check, as the
+	 * logical write offset of a write-combining mblock includes the
+	 * buffered data.
+	 */
+	pmd_obj_wrlock(layout);
+	boff = mblock_wlen(layout);
+
+	err = mblock_rw_argcheck(mp, layout, boff, MPOOL_OP_WRITE, len);
+	if (ev(err) || len == 0) {
+		pmd_obj_wrunlock(layout);
+		if (err)
+			mp_pr_debug("mblock write argcheck failed ", err);
+		return err;
+	}
+
+	assert(PAGE_ALIGNED(len));
+	assert(iovcnt == (len >> PAGE_SHIFT));
+	assert(PAGE_ALIGNED(boff));
+
+	state = layout->eld_state;
+	if (!(state & PMD_LYT_COMMITTED)) {
+		struct mpool_dev_info *pd = pmd_layout_pd_get(mp, layout);
+		int                    flags = 0;
+
+		if (mblock_fua(mp, pd))
+			flags = REQ_FUA;
+
+		if (pmd_layout_zip(layout)) {
+			/* Sealed by a failed commit */
+			err = layout->eld_wcbuf ? mblock_zip_write(mp, layout, iov, iovcnt, flags) :
+				merr(EINVAL);
+		} else if (layout->eld_wcbuf) {
+			err = mblock_wcbuf_write(mp, layout, iov, iovcnt, flags);
+		} else {
+			err = pmd_layout_rw(mp, layout, iov, iovcnt, boff, flags, MPOOL_OP_WRITE);
+			if (!err)
+				layout->eld_mblen += len;
+		}
+	}
+	pmd_obj_wrunlock(layout);
+
+	if (state & PMD_LYT_COMMITTED)
+		err = merr(EALREADY);
+
+	if (tstart)
+		trace_mpool_mblock_write(mp, layout->eld_objid, layout->eld_ld.ol_pdh, boff, len,
+					 ktime_get_ns() - tstart, err);
+
+	return err;
+}
+
+/*
+ * MBLOCK_COPY_IOSZ: size of the buffer mblock_copy() stages data in, rounded
+ *                   up to the destination's optimal write size
+ */
+#define MBLOCK_COPY_IOSZ        (256u << 10)
+
+merr_t
+mblock_copy(
+	struct mpool_descriptor        *mp,
+	struct mblock_descriptor       *mbh,
+	const struct mblock_copy_src   *srcv,
+	int                             srcc,
+	u64                            *copiedp)
+{
+	struct mblock_props     props;
+	struct kvec            *iov;
+	void                   *buf;
+
+	size_t  bufsz, fill, len;
+	u64     off, end;
+	merr_t  err;
+	int     i, j;
+
+	*copiedp = 0;
+
+	err = mblock_get_props(mp, mbh, &props);
+	if (ev(err))
 		return err;
+
+	if (props.mpr_iscommitted)
+		return merr(EALREADY);
+
+	for (i = 0; i < srcc; i++) {
+		if (!PAGE_ALIGNED(srcv[i].mcs_off) || !PAGE_ALIGNED(srcv[i].mcs_len))
+			return merr(EINVAL);
 	}
 
-	if (len == 0)
-		return 0;
+	/*
+	 * There is no block layer interface to device copy offload (e.g.,
+	 * NVMe simple copy), so the data is staged in a kernel buffer.
+	 */
+	bufsz = roundup(MBLOCK_COPY_IOSZ, props.mpr_optimal_wrsz);
+
+	buf = alloc_pages_exact(bufsz, GFP_KERNEL);
+	if (!buf)
+		return merr(ENOMEM);
+
+	iov = kmalloc_array(bufsz >> PAGE_SHIFT, sizeof(*iov), GFP_KERNEL);
+	if (!iov) {
+		free_pages_exact(buf, bufsz);
+		return merr(ENOMEM);
+	}
+
+	for (j = 0; j < (bufsz >> PAGE_SHIFT); j++) {
+		iov[j].iov_base = buf + (j << PAGE_SHIFT);
+		iov[j].iov_len = PAGE_SIZE;
+	}
+
+	fill = 0;
+
+	for (i = 0; i < srcc && !err; i++) {
+		off = srcv[i].mcs_off;
+		end = off + srcv[i].mcs_len;
+
+		while (off < end) {
+			len = min_t(u64, end - off, bufsz - fill);
+
+			err = mblock_read(mp, srcv[i].mcs_mbh, iov + (fill >> PAGE_SHIFT),
+					  len >> PAGE_SHIFT, off, len);
+			if (ev(err))
+				break;
+
+			fill += len;
+			off += len;
+
+			if (fill < bufsz)
+				continue;
+
+			err = mblock_write(mp, mbh, iov, fill >> PAGE_SHIFT, fill);
+			if (ev(err))
+				break;
+
+			*copiedp += fill;
+			fill = 0;
+		}
+	}
+
+	if (!err && fill > 0) {
+		err = mblock_write(mp, mbh, iov, fill >> PAGE_SHIFT, fill);
+		if (!ev(err))
+			*copiedp += fill;
+	}
+
+	kfree(iov);
+	free_pages_exact(buf, bufsz);
+
+	return err;
+}
+
+/*
+ * LZ4 decompression doesn't use the workspace of the tfm, so readers share
+ * a single tfm, allocated on first use.
+ */
+static struct crypto_comp *mblock_ztfm_get(void)
+{
+	struct crypto_comp *tfm;
+
+	tfm = smp_load_acquire(&mblock_ztfm);
+	if (tfm)
+		return tfm;
+
+	tfm = crypto_alloc_comp(MBLOCK_ZALGO, 0, 0);
+	if (IS_ERR(tfm))
+		return NULL;
+
+	if (cmpxchg_release(&mblock_ztfm, NULL, tfm)) {
+		crypto_free_comp(tfm);
+		tfm = smp_load_acquire(&mblock_ztfm);
+	}
+
+	return tfm;
+}
+
+void mblock_zip_fini(void)
+{
+	if (mblock_ztfm)
+		crypto_free_comp(mblock_ztfm);
+	mblock_ztfm = NULL;
+}
+
+/**
+ * mblock_zidx_read() - Read the chunk index of a compressed mblock
+ * @mp:
+ * @layout:
+ * @zip:    output
+ *
+ * Caller must hold pmd_obj_rdlock().
+ */
+static merr_t
+mblock_zidx_read(
+	struct mpool_descriptor    *mp,
+	struct pmd_layout          *layout,
+	struct mblock_zidx        **zip)
+{
+	struct mblock_zidx *zi = NULL;
+	struct kvec        *iov = NULL;
+	char               *buf;
+	merr_t              err;
+	size_t              tlen = PAGE_SIZE;
+	u32                 chunksz, zlen, chunkc, ulen, off, i;
+	int                 pagec;
+
+	if (layout->eld_mblen < PAGE_SIZE)
+		return merr(EINVAL);
+
+	buf = alloc_pages_exact(tlen, GFP_KERNEL);
+	if (!buf)
+		return merr(ENOMEM);
+
+	iov = kmalloc(sizeof(*iov), GFP_KERNEL);
+	if (!iov) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	iov->iov_base = buf;
+	iov->iov_len = PAGE_SIZE;
+
+	err = pmd_layout_rw(mp, layout, iov, 1, layout->eld_mblen - PAGE_SIZE, 0, MPOOL_OP_READ);
+	if (ev(err))
+		goto errout;
+
+	err = omf_mblock_zfoot_unpack_letoh(buf, &chunksz, &zlen, &chunkc);
+	if (ev(err))
+		goto errout;
+
+	if (zlen != layout->eld_zlen || OMF_MBLOCK_ZTRAIL_LEN(chunkc) > layout->eld_mblen) {
+		err = merr(EINVAL);
+		goto errout;
+	}
+
+	/* Read the rest of the trailer, if any */
+	if (OMF_MBLOCK_ZTRAIL_LEN(chunkc) > tlen) {
+		kfree(iov);
+		free_pages_exact(buf, tlen);
+		iov = NULL;
+
+		tlen = OMF_MBLOCK_ZTRAIL_LEN(chunkc);
+		pagec = tlen >> PAGE_SHIFT;
+
+		buf = alloc_pages_exact(tlen, GFP_KERNEL);
+		iov = kmalloc_array(pagec, sizeof(*iov), GFP_KERNEL);
+		if (!buf || !iov) {
+			err = merr(ENOMEM);
+			goto errout;
+		}
+
+		for (i = 0; i < pagec; ++i) {
+			iov[i].iov_base = buf + (i << PAGE_SHIFT);
+			iov[i].iov_len = PAGE_SIZE;
+		}
+
+		err = pmd_layout_rw(mp, layout, iov, pagec, layout->eld_mblen - tlen,
+				    0, MPOOL_OP_READ);
+		if (ev(err))
+			goto errout;
+	}
+
+	zi = kvmalloc(sizeof(*zi) + 2 * chunkc * sizeof(u32), GFP_KERNEL);
+	if (!zi) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	zi->zi_chunksz = chunksz;
+	zi->zi_chunkc = chunkc;
+	zi->zi_offv = zi->zi_lenv + chunkc;
+
+	err = omf_mblock_ztrail_unpack_letoh(buf, chunkc, zi->zi_lenv);
+	if (ev(err))
+		goto errout;
+
+	for (i = 0, off = 0; i < chunkc; ++i) {
+		ulen = min_t(u32, chunksz, zlen - i * chunksz);
+
+		if (zi->zi_lenv[i] == 0 || zi->zi_lenv[i] > ulen ||
+		    off + PAGE_ALIGN(zi->zi_lenv[i]) + tlen > layout->eld_mblen) {
+			err = merr(EINVAL);
+			goto errout;
+		}
+
+		zi->zi_offv[i] = off;
+		off += PAGE_ALIGN(zi->zi_lenv[i]);
+	}
+
+	*zip = zi;
+	zi = NULL;
+
+errout:
+	kvfree(zi);
+	kfree(iov);
+	if (buf)
+		free_pages_exact(buf, tlen);
+
+	return err;
+}
+
+/**
+ * mblock_zip_read() - Read from a committed compressed mblock
+ * @mp:
+ * @layout:
+ * @iov:    one page per element
+ * @iovcnt:
+ * @boff:   offset in the uncompressed data
+ *
+ * Pages of chunks stored as is are read directly into iov, the other
+ * chunks are read whole and decompressed.  Caller must hold
+ * pmd_obj_rdlock().
+ */
+static merr_t
+mblock_zip_read(
+	struct mpool_descriptor    *mp,
+	struct pmd_layout          *layout,
+	const struct kvec          *iov,
+	int                         iovcnt,
+	loff_t                      boff)
+{
+	struct crypto_comp *tfm = NULL;
+	struct mblock_zidx *zi;
+	struct kvec        *ciov = NULL;
+	unsigned int        dlen;
+	merr_t              err = 0;
+	char               *cbuf = NULL, *ubuf = NULL;
+	u64                 pos, cpos;
+	u32                 c, chunksz, clen, ulen;
+	int                 i, j, n;
+
+	zi = smp_load_acquire(&layout->eld_zidx);
+	if (!zi) {
+		err = mblock_zidx_read(mp, layout, &zi);
+		if (err) {
+			mp_pr_err("mpool %s, reading chunk index of compressed mblock 0x%lx failed",
+				  err, mp->pds_name, (ulong)layout->eld_objid);
+			return err;
+		}
+
+		if (cmpxchg_release(&layout->eld_zidx, NULL, zi)) {
+			kvfree(zi);
+			zi = smp_load_acquire(&layout->eld_zidx);
+		}
+	}
+
+	chunksz = zi->zi_chunksz;
+
+	for (i = 0; i < iovcnt; ) {
+		pos = boff + ((u64)i << PAGE_SHIFT);
+		c = pos >> ilog2(chunksz);
+		cpos = (u64)c * chunksz;
+		ulen = min_t(u64, chunksz, layout->eld_zlen - cpos);
+		clen = zi->zi_lenv[c];
+
+		if (clen == ulen) {
+			n = min_t(u64, iovcnt - i, (cpos + ulen - pos) >> PAGE_SHIFT);
+
+			err = pmd_layout_rw(mp, layout, iov + i, n, zi->zi_offv[c] + (pos - cpos),
+					    0, MPOOL_OP_READ);
+			if (ev(err))
+				break;
+
+			i += n;
+			continue;
+		}
+
+		if (!cbuf) {
+			tfm = mblock_ztfm_get();
+			if (!tfm) {
+				err = merr(EOPNOTSUPP);
+				break;
+			}
+
+			cbuf = alloc_pages_exact(chunksz, GFP_KERNEL);
+			ubuf = alloc_pages_exact(chunksz, GFP_KERNEL);
+			ciov = kmalloc_array(chunksz >> PAGE_SHIFT, sizeof(*ciov), GFP_KERNEL);
+			if (!cbuf || !ubuf || !ciov) {
+				err = merr(ENOMEM);
+				break;
+			}
+
+			for (j = 0; j < (chunksz >> PAGE_SHIFT); ++j) {
+				ciov[j].iov_base = cbuf + (j << PAGE_SHIFT);
+				ciov[j].iov_len = PAGE_SIZE;
+			}
+		}
+
+		err = pmd_layout_rw(mp, layout, ciov, PAGE_ALIGN(clen) >> PAGE_SHIFT,
+				    zi->zi_offv[c], 0, MPOOL_OP_READ);
+		if (ev(err))
+			break;
+
+		dlen = ulen;
+		if (crypto_comp_decompress(tfm, cbuf, clen, ubuf, &dlen) || dlen != ulen) {
+			err = merr(EIO);
+			mp_pr_err("mpool %s, decompressing chunk %u of mblock 0x%lx failed",
+				  err, mp->pds_name, c, (ulong)layout->eld_objid);
+			break;
+		}
+
+		for (; i < iovcnt && pos < cpos + ulen; ++i, pos += PAGE_SIZE)
+			memcpy(iov[i].iov_base, ubuf + (pos - cpos), PAGE_SIZE);
+	}
+
+	kfree(ciov);
+	if (ubuf)
+		free_pages_exact(ubuf, chunksz);
+	if (cbuf)
+		free_pages_exact(cbuf, chunksz);
+
+	return err;
+}
+
+merr_t
+mblock_read(
+	struct mpool_descriptor    *mp,
+	struct mblock_descriptor   *mbh,
+	const struct kvec          *iov,
+	int                         iovcnt,
+	loff_t                      boff,
+	size_t                      len)
+{
+	struct pmd_layout *layout;
+
+	merr_t err;
+	u64    tstart;
+	u8     state;
+
+	assert(mp);
+
+	layout = mblock2layout(mbh);
+	if (ev(!layout)) {
+		mp_pr_layout_not_found(mp, mbh);
+		return merr(EINVAL);
+	}
+
+	tstart = trace_mpool_mblock_read_enabled() ? ktime_get_ns() : 0;
+
+	/*
+	 * Read lock the mblock layout; mblock reads can proceed concurrently;
+	 * Mblock writes are serialized but concurrent with reads.  The
+	 * arguments are checked under the lock as tiering may move the
+	 * mblock to a drive with another zone size.
+	 */
+	pmd_obj_rdlock(layout);
+	err = mblock_rw_argcheck(mp, layout, boff, MPOOL_OP_READ, len);
+	if (ev(err) || len == 0) {
+		pmd_obj_rdunlock(layout);
+		if (err)
+			mp_pr_debug("mblock read argcheck failed ", err);
+		return err;
+	}
 
 	assert(PAGE_ALIGNED(len));
 	assert(PAGE_ALIGNED(boff));
 	assert(iovcnt == (len >> PAGE_SHIFT));
 
+	state = layout->eld_state;
+	if ((state & PMD_LYT_COMMITTED) && pmd_layout_zip(layout)) {
+		err = mblock_zip_read(mp, layout, iov, iovcnt, boff);
+	} else if ((state & PMD_LYT_COMMITTED) &&
+		   !mblock_cache_read(mp, layout, iov, iovcnt, boff)) {
+		err = pmd_layout_rw(mp, layout, iov, iovcnt, boff, 0, MPOOL_OP_READ);
+		if (!err)
+			mblock_cache_fill(mp, layout, iov, iovcnt, boff);
+	}
+	if ((state & PMD_LYT_COMMITTED) && mp->pds_params.mp_tierperiod)
+		pmd_obj_heat(layout);
+	pmd_obj_rdunlock(layout);
+
+	if (!(state & PMD_LYT_COMMITTED))
+		err = merr(EAGAIN);
+
+	if (tstart)
+		trace_mpool_mblock_read(mp, layout->eld_objid, layout->eld_ld.ol_pdh, boff, len,
+					ktime_get_ns() - tstart, err);
+
+	return err;
+}
+
+merr_t
+mblock_read_async(
+	struct mpool_descriptor    *mp,
+	struct mblock_descriptor   *mbh,
+	const struct kvec          *iov,
+	int                         iovcnt,
+	loff_t                      boff,
+	size_t                      len,
+	struct pd_io_ctx           *ctx)
+{
+	struct pmd_layout *layout;
+
+	merr_t err;
+	bool   zip;
+	u8     state;
+
+	assert(mp);
+
+	layout = mblock2layout(mbh);
+	if (ev(!layout)) {
+		mp_pr_layout_not_found(mp, mbh);
+		return merr(EINVAL);
+	}
+
 	/*
-	 * Read lock the mblock layout; mblock reads can proceed concurrently;
-	 * Mblock writes are serialized but concurrent with reads
+	 * A committed mblock is immutable, so there's no need to hold
+	 * the layout lock across the I/O.  The caller's reference keeps
+	 * the layout from being freed until the read completes.  The read
+	 * is submitted under the lock though, see pmd_layout_rw_async().
 	 */
 	pmd_obj_rdlock(layout);
+	err = mblock_rw_argcheck(mp, layout, boff, MPOOL_OP_READ, len);
+	if (ev(err)) {
+		pmd_obj_rdunlock(layout);
+		mp_pr_debug("mblock read argcheck failed ", err);
+		return err;
+	}
+
+	assert(PAGE_ALIGNED(len));
+	assert(PAGE_ALIGNED(boff));
+	assert(iovcnt == (len >> PAGE_SHIFT));
+
+	/* Compressed mblocks are read and decompressed synchronously */
 	state = layout->eld_state;
-	if (state & PMD_LYT_COMMITTED)
-		err = pmd_layout_rw(mp, layout, iov, iovcnt, boff, 0, MPOOL_OP_READ);
+	zip = pmd_layout_zip(layout);
+	if (state & PMD_LYT_COMMITTED) {
+		if (zip)
+			err = mblock_zip_read(mp, layout, iov, iovcnt, boff);
+		else
+			err = pmd_layout_rw_async(mp, layout, iov, iovcnt, boff, 0,
+						  MPOOL_OP_READ, ctx);
+		if (mp->pds_params.mp_tierperiod)
+			pmd_obj_heat(layout);
+	}
 	pmd_obj_rdunlock(layout);
 
-	return (state & PMD_LYT_COMMITTED) ? err : merr(EAGAIN);
+	if (!(state & PMD_LYT_COMMITTED))
+		return merr(EAGAIN);
+
+	if (zip) {
+		ctx->pic_done(ctx, err);
+		return 0;
+	}
+
+	return err;
 }
 
 merr_t
@@ -501,12 +1877,113 @@ mblock_get_props_ex(
 
 	pmd_obj_rdlock(layout);
 	prop->mbx_zonecnt = layout->eld_ld.ol_zcnt;
+	prop->mbx_compressed = pmd_layout_zip(layout);
+	prop->mbx_phys_len = layout->eld_mblen + mblock_wclen(layout);
 	mblock_getprops_cmn(mp, layout, &prop->mbx_props);
 	pmd_obj_rdunlock(layout);
 
 	return 0;
 }
 
+merr_t mblock_wcombine(struct mpool_descriptor *mp, struct mblock_descriptor *mbh)
+{
+	struct mblock_wcbuf *wc;
+	struct pmd_layout   *layout;
+	merr_t               err = 0;
+	int                  pagec;
+
+	layout = mblock2layout(mbh);
+	if (ev(!layout)) {
+		mp_pr_layout_not_found(mp, mbh);
+		return merr(EINVAL);
+	}
+
+	pagec = max_t(int, mblock_optimal_iosz_get(mp, layout) >> PAGE_SHIFT, 1);
+
+	wc = kzalloc(sizeof(*wc) + pagec * sizeof(wc->wc_iov[0]), GFP_KERNEL);
+	if (ev(!wc))
+		return merr(ENOMEM);
+
+	wc->wc_pagec = pagec;
+
+	pmd_obj_wrlock(layout);
+	if (layout->eld_state & PMD_LYT_COMMITTED)
+		err = merr(EALREADY);
+	else if (layout->eld_mblen > 0)
+		err = merr(EINVAL);
+	else if (!layout->eld_wcbuf)
+		swap(layout->eld_wcbuf, wc);
+	pmd_obj_wrunlock(layout);
+
+	kfree(wc);
+
+	return err;
+}
+
+merr_t mblock_compress(struct mpool_descriptor *mp, struct mblock_descriptor *mbh)
+{
+	struct pmd_layout  *layout;
+	struct mblock_zip  *zc;
+	merr_t              err;
+	int                 pagec, i;
+
+	layout = mblock2layout(mbh);
+	if (ev(!layout)) {
+		mp_pr_layout_not_found(mp, mbh);
+		return merr(EINVAL);
+	}
+
+	/* The compressed chunks are appended through the write-combining buffer */
+	err = mblock_wcombine(mp, mbh);
+	if (err)
+		return err;
+
+	pagec = MBLOCK_ZCHUNK >> PAGE_SHIFT;
+
+	zc = kzalloc(sizeof(*zc), GFP_KERNEL);
+	if (ev(!zc))
+		return merr(ENOMEM);
+
+	zc->mz_tfm = crypto_alloc_comp(MBLOCK_ZALGO, 0, 0);
+	if (IS_ERR(zc->mz_tfm)) {
+		zc->mz_tfm = NULL;
+		err = merr(EOPNOTSUPP);
+		mp_pr_err("mpool %s, %s compression not available", err, mp->pds_name, MBLOCK_ZALGO);
+		goto errout;
+	}
+
+	zc->mz_chunkm = 16;
+	zc->mz_ubuf = alloc_pages_exact(MBLOCK_ZCHUNK, GFP_KERNEL);
+	zc->mz_cbuf = alloc_pages_exact(MBLOCK_ZCHUNK, GFP_KERNEL);
+	zc->mz_iov = kmalloc_array(pagec, sizeof(*zc->mz_iov), GFP_KERNEL);
+	zc->mz_clenv = kmalloc_array(zc->mz_chunkm, sizeof(*zc->mz_clenv), GFP_KERNEL);
+	if (!zc->mz_ubuf || !zc->mz_cbuf || !zc->mz_iov || !zc->mz_clenv) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	for (i = 0; i < pagec; ++i)
+		zc->mz_iov[i].iov_len = PAGE_SIZE;
+
+	pmd_obj_wrlock(layout);
+	if (layout->eld_state & PMD_LYT_COMMITTED) {
+		err = merr(EALREADY);
+	} else if (layout->eld_mblen > 0 || mblock_wclen(layout) > 0 ||
+		   !layout->eld_wcbuf) {
+		err = merr(EINVAL);
+	} else if (!pmd_layout_zip(layout)) {
+		layout->eld_wcbuf->wc_zip = zc;
+		layout->eld_flags |= PMD_MB_ZIP;
+		zc = NULL;
+	}
+	pmd_obj_wrunlock(layout);
+
+errout:
+	mblock_zip_free(zc);
+
+	return err;
+}
+
 bool mblock_objid(u64 objid)
 {
 	return objid && (pmd_objid_type(objid) == OMF_OBJ_MBLOCK);
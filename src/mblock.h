@@ -20,6 +20,8 @@
 struct mpool_descriptor;
 struct mblock_descriptor;
 struct mpool_obj_layout;
+struct pmd_layout;
+struct pd_io_ctx;
 
 /*
  * mblock API functions
@@ -95,6 +97,27 @@ mblock_find_get(
 	struct mblock_props        *prop,
 	struct mblock_descriptor  **mbh);
 
+/**
+ * mblock_find_getv() - Get handles for committed mblocks
+ * @mp:
+ * @objidv: mblock IDs
+ * @objidc: number of mblock IDs
+ * @mbhv:   output, one handle per mblock ID
+ * @wlenv:  output, the write length of each mblock
+ *
+ * Bulk version of mblock_find_get(mp, objid, 1, ...), see pmd_obj_find_getv().
+ * If successful, the caller holds a ref on each mblock.
+ *
+ * Return: %0 if successful, merr_t otherwise, in which case no ref is held
+ */
+merr_t
+mblock_find_getv(
+	struct mpool_descriptor    *mp,
+	const u64                  *objidv,
+	u32                         objidc,
+	struct mblock_descriptor  **mbhv,
+	u64                        *wlenv);
+
 /**
  * mblock_put() - Put (release) a ref on an mblock
  * @mp:
@@ -120,6 +143,26 @@ void mblock_put(struct mpool_descriptor *mp, struct mblock_descriptor *mbh);
  */
 merr_t mblock_commit(struct mpool_descriptor *mp, struct mblock_descriptor *mbh);
 
+/**
+ * mblock_commitv() - Commit a batch of mblocks
+ * @mp:
+ * @mbhv:   mblocks to commit
+ * @mbhc:   number of elements in mbhv[] and errv[]
+ * @errv:   (in/out) per-mblock status, as for mblock_commit()
+ *
+ * The create records for the entire batch are acknowledged together,
+ * and each drive's write cache is flushed at most once.  Mblocks whose
+ * errv[] element is non-zero on entry are skipped.
+ *
+ * Return: %0 if the batch was processed, merr_t otherwise...
+ */
+merr_t
+mblock_commitv(
+	struct mpool_descriptor    *mp,
+	struct mblock_descriptor  **mbhv,
+	int                         mbhc,
+	merr_t                     *errv);
+
 /**
  * mblock_abort() -
  * @mp:
@@ -143,6 +186,25 @@ merr_t mblock_abort(struct mpool_descriptor *mp, struct mblock_descriptor *mbh);
  */
 merr_t mblock_delete(struct mpool_descriptor *mp, struct mblock_descriptor *mbh);
 
+/**
+ * mblock_deletev() - Delete a batch of committed mblocks
+ * @mp:
+ * @mbhv:   mblocks to delete
+ * @mbhc:   number of elements in mbhv[] and errv[]
+ * @errv:   (in/out) per-mblock status, as for mblock_delete()
+ *
+ * Mblocks whose errv[] element is non-zero on entry are skipped.  Each
+ * mbhv[] element whose errv[] status is zero is invalid after call.
+ *
+ * Return: %0 if the batch was processed, merr_t otherwise...
+ */
+merr_t
+mblock_deletev(
+	struct mpool_descriptor    *mp,
+	struct mblock_descriptor  **mbhv,
+	int                         mbhc,
+	merr_t                     *errv);
+
 /**
  * mblock_write() -
  * @mp:
@@ -155,6 +217,9 @@ merr_t mblock_delete(struct mpool_descriptor *mp, struct mblock_descriptor *mbh)
  * until they are full.  If a caller needs to issue more than one write call
  * to the same mblock, all but the last write call must be optimal write size aligned.
  * The mpr_optimal_wrsz field in struct mblock_props gives the optimal write size.
+ * Write-combining mblocks (see mblock_wcombine()) only require page aligned
+ * writes.  If a write to a write-combining mblock fails the mblock should be
+ * aborted, as part of the data may have been accepted.
  *
  * Return: %0 if success, merr_t otherwise...
  */
@@ -166,6 +231,41 @@ mblock_write(
 	int                         iovcnt,
 	size_t                      len);
 
+/**
+ * struct mblock_copy_src - a source range of mblock_copy()
+ * @mcs_mbh: committed mblock
+ * @mcs_off: byte offset in the mblock, page aligned
+ * @mcs_len: bytes to copy, page aligned
+ */
+struct mblock_copy_src {
+	struct mblock_descriptor   *mcs_mbh;
+	u64                         mcs_off;
+	u64                         mcs_len;
+};
+
+/**
+ * mblock_copy() -
+ * @mp:
+ * @mbh:     uncommitted destination mblock
+ * @srcv:    source ranges, copied in order
+ * @srcc:    number of source ranges
+ * @copiedp: (output) bytes appended to the destination
+ *
+ * Append ranges of committed mblocks to an uncommitted mblock without the
+ * data leaving the kernel.  The ranges are coalesced into optimal write size
+ * writes, so the destination can be written again afterwards if the bytes
+ * copied are a multiple of the optimal write size.
+ *
+ * Return: %0 if successful, merr_t otherwise...
+ */
+merr_t
+mblock_copy(
+	struct mpool_descriptor        *mp,
+	struct mblock_descriptor       *mbh,
+	const struct mblock_copy_src   *srcv,
+	int                             srcc,
+	u64                            *copiedp);
+
 /**
  * mblock_read() -
  * @mp:
@@ -192,6 +292,32 @@ mblock_read(
 	loff_t                      boff,
 	size_t                      len);
 
+/**
+ * mblock_read_async() - asynchronous variant of mblock_read()
+ * @mp:
+ * @mbh:
+ * @iov:
+ * @iovcnt:
+ * @boff:
+ * @len:
+ * @ctx:    pd I/O completion context
+ *
+ * Same argument requirements as mblock_read().  The caller must hold
+ * a reference on mbh until ctx->pic_done() is called.
+ *
+ * Return: 0 if the read was submitted, in which case ctx->pic_done()
+ * reports its status.  Otherwise merr_t and ctx->pic_done() is not called.
+ */
+merr_t
+mblock_read_async(
+	struct mpool_descriptor    *mp,
+	struct mblock_descriptor   *mbh,
+	const struct kvec          *iov,
+	int                         iovcnt,
+	loff_t                      boff,
+	size_t                      len,
+	struct pd_io_ctx           *ctx);
+
 /**
  * mblock_get_props() -
  * @mp:
@@ -227,4 +353,67 @@ mblock_get_props_ex(
 
 bool mblock_objid(u64 objid);
 
+/**
+ * mblock_wcombine() - Enable write-combining for an uncommitted mblock
+ * @mp:
+ * @mbh:
+ *
+ * From now on mblock_write() copies appends into a per-mblock buffer of
+ * the optimal write size, and the buffer is written out each time it
+ * fills and at commit.  Writes then need only be page aligned.  Must be
+ * called before the first write.
+ *
+ * Return: %0 if successful, merr_t otherwise...
+ * EALREADY if the mblock is committed, EINVAL if it has already been written
+ */
+merr_t mblock_wcombine(struct mpool_descriptor *mp, struct mblock_descriptor *mbh);
+
+/**
+ * mblock_compress() - Compress the data of an uncommitted mblock
+ * @mp:
+ * @mbh:
+ *
+ * Enables write-combining (see mblock_wcombine()), then compresses the data
+ * written in fixed size chunks with LZ4 through the crypto API.  The chunk
+ * index is written at the end of the mblock at commit.  mblock_read() and
+ * the mpr_write_len of the mblock deal in uncompressed data, which may exceed
+ * the mblock capacity.  mblock_write() fails with ENOSPC once the compressed
+ * data fills the mblock.  Must be called before the first write.
+ *
+ * Return: %0 if successful, merr_t otherwise...
+ * EALREADY if the mblock is committed, EINVAL if it has already been written,
+ * EOPNOTSUPP if the kernel has no LZ4 support
+ */
+merr_t mblock_compress(struct mpool_descriptor *mp, struct mblock_descriptor *mbh);
+
+/**
+ * mblock_zip_fini() - Release the decompressor shared by compressed mblock reads
+ */
+void mblock_zip_fini(void);
+
+/**
+ * mblock_layout_release() - Free the mblock private data of a layout
+ * @layout:
+ *
+ * Frees the write-combining buffer of an uncommitted mblock, any buffered
+ * data is discarded, or the chunk index of a compressed mblock.
+ */
+void mblock_layout_release(struct pmd_layout *layout);
+
+/**
+ * mblock_cache_init() - Initialize an mpool's committed mblock page cache
+ * @mp:
+ *
+ * mblock_read() caches the pages of committed mblocks of up to
+ * MPOOL_MBCACHE_OBJMAX bytes, bounded by mp_mbcachesz, and mblock_delete()
+ * invalidates them.
+ */
+merr_t mblock_cache_init(struct mpool_descriptor *mp);
+
+/**
+ * mblock_cache_fini() - Free all pages of an mpool's mblock page cache
+ * @mp:
+ */
+void mblock_cache_fini(struct mpool_descriptor *mp);
+
 #endif /* MPOOL_MBLOCK_H */
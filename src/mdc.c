@@ -5,6 +5,7 @@
 
 #include <linux/slab.h>
 #include <linux/string.h>
+#include <linux/uio.h>
 
 #include "mpool_printk.h"
 #include "assert.h"
@@ -24,6 +25,18 @@
 #define OP_COMMIT      0
 #define OP_DELETE      1
 
+/**
+ * struct mdc_crec - record appended during a background compaction
+ * @cr_link: mdc_crecl linkage
+ * @cr_len:  record length
+ * @cr_data: record data
+ */
+struct mdc_crec {
+	struct list_head    cr_link;
+	size_t              cr_len;
+	char                cr_data[];
+};
+
 /**
  * mdc_acquire() - Validate mdc handle and acquire mdc_lock
  *
@@ -72,6 +85,106 @@ static inline void mdc_invalidate(struct mp_mdc *mdc)
 	mdc->mdc_magic = MPC_NO_MAGIC;
 }
 
+/**
+ * mdc_crec_free() - Free a list of replay records
+ * @head: list of struct mdc_crec
+ */
+static void mdc_crec_free(struct list_head *head)
+{
+	struct mdc_crec *crec, *next;
+
+	list_for_each_entry_safe(crec, next, head, cr_link) {
+		list_del(&crec->cr_link);
+		kfree(crec);
+	}
+}
+
+/**
+ * mdc_crec_prepare() - Copy records for replay before appending them
+ * @mdc:  MDC handle, mdc_lock held
+ * @recv: records about to be appended to the active mlog
+ * @recc: number of records
+ * @head: (output) list of copies
+ *
+ * Nothing is copied unless a background compaction is in progress.  The
+ * copies are made before the append so that a record never reaches the
+ * active mlog without also being replayed to the compaction target.
+ *
+ * Return: EAGAIN if the replay buffer would exceed MDC_CREPLAY_MAX.
+ */
+static merr_t
+mdc_crec_prepare(struct mp_mdc *mdc, const struct kvec *recv, int recc, struct list_head *head)
+{
+	struct mdc_crec    *crec;
+	size_t              total = 0;
+	int                 i;
+
+	INIT_LIST_HEAD(head);
+
+	if (!mdc->mdc_clogh)
+		return 0;
+
+	for (i = 0; i < recc; ++i)
+		total += recv[i].iov_len;
+
+	if (mdc->mdc_crecsz + total > MDC_CREPLAY_MAX)
+		return merr(EAGAIN);
+
+	for (i = 0; i < recc; ++i) {
+		crec = kmalloc(sizeof(*crec) + recv[i].iov_len, GFP_KERNEL);
+		if (!crec) {
+			mdc_crec_free(head);
+			return merr(ENOMEM);
+		}
+
+		crec->cr_len = recv[i].iov_len;
+		memcpy(crec->cr_data, recv[i].iov_base, crec->cr_len);
+		list_add_tail(&crec->cr_link, head);
+	}
+
+	return 0;
+}
+
+/**
+ * mdc_crec_commit() - Queue the copies of the records that were appended
+ * @mdc:  MDC handle, mdc_lock held
+ * @head: list from mdc_crec_prepare()
+ * @cnt:  number of records appended to the active mlog
+ */
+static void mdc_crec_commit(struct mp_mdc *mdc, struct list_head *head, int cnt)
+{
+	struct mdc_crec *crec, *next;
+
+	list_for_each_entry_safe(crec, next, head, cr_link) {
+		if (cnt-- <= 0)
+			break;
+
+		list_move_tail(&crec->cr_link, &mdc->mdc_crecl);
+		mdc->mdc_crecsz += crec->cr_len;
+	}
+
+	mdc_crec_free(head);
+}
+
+/**
+ * mdc_crec_replay() - Replay buffered records to the compaction target
+ * @mdc: MDC handle, mdc_lock held
+ */
+static merr_t mdc_crec_replay(struct mp_mdc *mdc)
+{
+	struct mdc_crec    *crec;
+	merr_t              err;
+
+	list_for_each_entry(crec, &mdc->mdc_crecl, cr_link) {
+		err = mlog_append_data(mdc->mdc_mp, mdc->mdc_clogh, crec->cr_data,
+				       crec->cr_len, 0);
+		if (ev(err))
+			return err;
+	}
+
+	return 0;
+}
+
 /**
  * mdc_get_mpname() - Get mpool name from mpool descriptor
  *
@@ -276,6 +389,7 @@ mp_mdc_open(struct mpool_descriptor *mp, u64 logid1, u64 logid2, u8 flags, struc
 		mdc->mdc_valid = 1;
 		mdc->mdc_magic = MPC_MDC_MAGIC;
 		mdc->mdc_flags = flags;
+		INIT_LIST_HEAD(&mdc->mdc_crecl);
 		mutex_init(&mdc->mdc_lock);
 
 		*mdc_out = mdc;
@@ -308,6 +422,11 @@ uint64_t mp_mdc_cstart(struct mp_mdc *mdc)
 	if (ev(err))
 		return err;
 
+	if (mdc->mdc_clogh) {
+		mdc_release(mdc, rw);
+		return merr(EBUSY);
+	}
+
 	mp = mdc->mdc_mp;
 
 	if (mdc->mdc_alogh == mdc->mdc_logh1)
@@ -353,7 +472,23 @@ uint64_t mp_mdc_cend(struct mp_mdc *mdc)
 
 	mp = mdc->mdc_mp;
 
-	if (mdc->mdc_alogh == mdc->mdc_logh1) {
+	if (mdc->mdc_clogh) {
+		/*
+		 * Background compaction: the active mlog is still the source,
+		 * bring the target up to date before switching over to it.
+		 */
+		tgth = mdc->mdc_clogh;
+		srch = mdc->mdc_alogh;
+
+		err = mdc_crec_replay(mdc);
+		if (!err) {
+			mdc->mdc_alogh = tgth;
+			mdc->mdc_clogh = NULL;
+		}
+
+		mdc_crec_free(&mdc->mdc_crecl);
+		mdc->mdc_crecsz = 0;
+	} else if (mdc->mdc_alogh == mdc->mdc_logh1) {
 		tgth = mdc->mdc_logh1;
 		srch = mdc->mdc_logh2;
 	} else {
@@ -361,7 +496,8 @@ uint64_t mp_mdc_cend(struct mp_mdc *mdc)
 		srch = mdc->mdc_logh1;
 	}
 
-	err = mlog_append_cend(mp, tgth);
+	if (!err)
+		err = mlog_append_cend(mp, tgth);
 	if (!ev(err)) {
 		err = mlog_gen(mp, tgth, &gentgt);
 		if (!ev(err)) {
@@ -386,6 +522,76 @@ uint64_t mp_mdc_cend(struct mp_mdc *mdc)
 	return err;
 }
 
+uint64_t mp_mdc_cstart_bg(struct mp_mdc *mdc)
+{
+	struct mlog_descriptor     *tgth;
+
+	merr_t err;
+	bool   rw = false;
+
+	if (!mdc)
+		return merr(EINVAL);
+
+	if (mdc->mdc_flags & MDC_OF_SKIP_SER)
+		return merr(EINVAL);
+
+	err = mdc_acquire(mdc, rw);
+	if (ev(err))
+		return err;
+
+	if (mdc->mdc_clogh) {
+		mdc_release(mdc, rw);
+		return merr(EBUSY);
+	}
+
+	if (mdc->mdc_alogh == mdc->mdc_logh1)
+		tgth = mdc->mdc_logh2;
+	else
+		tgth = mdc->mdc_logh1;
+
+	/*
+	 * If we crash before cend the target is left without a cend marker,
+	 * and mp_mdc_open() picks the source, which holds every record
+	 * appended in the meantime.
+	 */
+	err = mlog_append_cstart(mdc->mdc_mp, tgth);
+	if (!err) {
+		mdc->mdc_crecsz = 0;
+		WRITE_ONCE(mdc->mdc_clogh, tgth);
+	} else {
+		mp_pr_err("mpool %s, mdc %p background cstart failed, mlog %p",
+			  err, mdc->mdc_mpname, mdc, tgth);
+	}
+
+	mdc_release(mdc, rw);
+
+	return err;
+}
+
+uint64_t mp_mdc_append_compact(struct mp_mdc *mdc, void *data, ssize_t len, bool sync)
+{
+	struct mlog_descriptor *tgth;
+	merr_t                  err;
+
+	if (!mdc || !data)
+		return merr(EINVAL);
+
+	if (mdc->mdc_magic != MPC_MDC_MAGIC || !mdc->mdc_valid)
+		return merr(EINVAL);
+
+	/* Only the compacting thread sets and clears mdc_clogh */
+	tgth = READ_ONCE(mdc->mdc_clogh);
+	if (!tgth)
+		return merr(EINVAL);
+
+	err = mlog_append_data(mdc->mdc_mp, tgth, data, (u64)len, sync);
+	if (err)
+		mp_pr_rl("mpool %s, mdc %p compact append failed, mlog %p, len %lu sync %d",
+			 err, mdc->mdc_mpname, mdc, tgth, len, sync);
+
+	return err;
+}
+
 uint64_t mp_mdc_close(struct mp_mdc *mdc)
 {
 	struct mpool_descriptor   *mp;
@@ -421,6 +627,7 @@ uint64_t mp_mdc_close(struct mp_mdc *mdc)
 
 	mdc_put(mp, mdc->mdc_logh1, mdc->mdc_logh2);
 
+	mdc_crec_free(&mdc->mdc_crecl);
 	mdc_invalidate(mdc);
 	mdc_release(mdc, false);
 
@@ -475,6 +682,9 @@ uint64_t mp_mdc_read(struct mp_mdc *mdc, void *data, size_t len, size_t *rdlen)
 
 uint64_t mp_mdc_append(struct mp_mdc *mdc, void *data, ssize_t len, bool sync)
 {
+	struct list_head    crecl;
+	struct kvec         iov;
+
 	merr_t err;
 	bool   rw = true;
 
@@ -485,7 +695,14 @@ uint64_t mp_mdc_append(struct mp_mdc *mdc, void *data, ssize_t len, bool sync)
 	if (ev(err))
 		return err;
 
-	err = mlog_append_data(mdc->mdc_mp, mdc->mdc_alogh, data, (u64)len, sync);
+	iov.iov_base = data;
+	iov.iov_len = len;
+
+	err = mdc_crec_prepare(mdc, &iov, 1, &crecl);
+	if (!ev(err)) {
+		err = mlog_append_data(mdc->mdc_mp, mdc->mdc_alogh, data, (u64)len, sync);
+		mdc_crec_commit(mdc, &crecl, err ? 0 : 1);
+	}
 	if (err)
 		mp_pr_rl("mpool %s, mdc %p append failed, mlog %p, len %lu sync %d",
 			  err, mdc->mdc_mpname, mdc, mdc->mdc_alogh, len, sync);
@@ -494,3 +711,61 @@ uint64_t mp_mdc_append(struct mp_mdc *mdc, void *data, ssize_t len, bool sync)
 
 	return err;
 }
+
+uint64_t mp_mdc_appendv(struct mp_mdc *mdc, const struct kvec *recv, int recc, int sync,
+			int *appendedp)
+{
+	struct list_head    crecl;
+
+	merr_t err;
+	bool   rw = true;
+	int    appended = 0;
+
+	if (!mdc || (recc > 0 && !recv))
+		return merr(EINVAL);
+
+	if (appendedp)
+		*appendedp = 0;
+
+	err = mdc_acquire(mdc, rw);
+	if (ev(err))
+		return err;
+
+	err = mdc_crec_prepare(mdc, recv, recc, &crecl);
+	if (!ev(err)) {
+		err = mlog_append_recv(mdc->mdc_mp, mdc->mdc_alogh, recv, recc, sync, &appended);
+		mdc_crec_commit(mdc, &crecl, appended);
+
+		if (appendedp)
+			*appendedp = appended;
+	}
+	if (err)
+		mp_pr_rl("mpool %s, mdc %p appendv failed, mlog %p, recc %d sync %d",
+			 err, mdc->mdc_mpname, mdc, mdc->mdc_alogh, recc, sync);
+
+	mdc_release(mdc, rw);
+
+	return err;
+}
+
+uint64_t mp_mdc_sync(struct mp_mdc *mdc)
+{
+	merr_t err;
+	bool   rw = true;
+
+	if (!mdc)
+		return merr(EINVAL);
+
+	err = mdc_acquire(mdc, rw);
+	if (ev(err))
+		return err;
+
+	err = mlog_flush(mdc->mdc_mp, mdc->mdc_alogh);
+	if (err)
+		mp_pr_rl("mpool %s, mdc %p sync failed, mlog %p",
+			 err, mdc->mdc_mpname, mdc, mdc->mdc_alogh);
+
+	mdc_release(mdc, rw);
+
+	return err;
+}
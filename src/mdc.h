@@ -7,14 +7,19 @@
 #define MPOOL_MDC_PRIV_H
 
 #include <linux/mutex.h>
+#include <linux/list.h>
 
 #include "merr.h"
 
 #define MPC_MDC_MAGIC           0xFEEDFEED
 #define MPC_NO_MAGIC            0xFADEFADE
 
+/* Max bytes of appends buffered for replay during a background compaction */
+#define MDC_CREPLAY_MAX         (4u << 20)
+
 struct mpool_descriptor;
 struct mlog_descriptor;
+struct kvec;
 
 /**
  * struct mp_mdc: MDC handle
@@ -29,6 +34,9 @@ struct mlog_descriptor;
  * @mdc_valid:  is the handle valid?
  * @mdc_magic:  MDC handle magic
  * @mdc_flags:	MDC flags
+ * @mdc_clogh:  compaction target mlog, set only during background compaction
+ * @mdc_crecl:  records appended to the active mlog since mp_mdc_cstart_bg()
+ * @mdc_crecsz: total bytes buffered on mdc_crecl
  *
  * Ordering:
  *     mdc handle lock (mdc_lock)
@@ -46,6 +54,9 @@ struct mp_mdc {
 	int                         mdc_valid;
 	int                         mdc_magic;
 	u8                          mdc_flags;
+	struct mlog_descriptor     *mdc_clogh;
+	struct list_head            mdc_crecl;
+	size_t                      mdc_crecsz;
 };
 
 /* MDC (Metadata Container) APIs */
@@ -96,6 +107,28 @@ uint64_t mp_mdc_read(struct mp_mdc *mdc, void *data, size_t len, size_t *rdlen);
  */
 uint64_t mp_mdc_append(struct mp_mdc *mdc, void *data, ssize_t len, bool sync);
 
+/**
+ * mp_mdc_appendv() - append a batch of records to MDC
+ * @mdc:       MDC handle
+ * @recv:      one kvec per record
+ * @recc:      number of records
+ * @sync:      MLOG_APPEND_NOSYNC, MLOG_APPEND_SYNC or MLOG_APPEND_ASYNC
+ * @appendedp: (output) number of records appended, may be NULL
+ *
+ * All records are packed into the active mlog under a single acquisition
+ * of the MDC and mlog locks.  With MLOG_APPEND_ASYNC the records are
+ * written to media in the background, and mp_mdc_sync() waits for them
+ * and reports any error.
+ */
+uint64_t mp_mdc_appendv(struct mp_mdc *mdc, const struct kvec *recv, int recc, int sync,
+			int *appendedp);
+
+/**
+ * mp_mdc_sync() - Flush records appended to MDC without sync
+ * @mdc:      MDC handle
+ */
+uint64_t mp_mdc_sync(struct mp_mdc *mdc);
+
 /**
  * mp_mdc_cstart() - Initiate MDC compaction
  * @mdc:      MDC handle
@@ -110,7 +143,39 @@ uint64_t mp_mdc_cstart(struct mp_mdc *mdc);
  * @mdc:      MDC handle
  *
  * Append a compaction end marker to the active mlog
+ *
+ * If compaction was started by mp_mdc_cstart_bg(), the records appended
+ * since then are first replayed to the compaction target, which then
+ * becomes the active mlog.
  */
 uint64_t mp_mdc_cend(struct mp_mdc *mdc);
 
+/**
+ * mp_mdc_cstart_bg() - Initiate background MDC compaction
+ * @mdc:      MDC handle
+ *
+ * Append a compaction start marker to the inactive (empty) mlog without
+ * swapping the active mlog.  The caller streams the compacted image to
+ * it via mp_mdc_append_compact() while mp_mdc_append() and mp_mdc_appendv()
+ * keep going to the active mlog.  Those records are also buffered, up to
+ * MDC_CREPLAY_MAX bytes, for replay by mp_mdc_cend().  Appends are failed
+ * with EAGAIN once the replay buffer is full.
+ *
+ * Not supported on MDCs opened with MDC_OF_SKIP_SER.
+ */
+uint64_t mp_mdc_cstart_bg(struct mp_mdc *mdc);
+
+/**
+ * mp_mdc_append_compact() - Append a compacted record to the target mlog
+ * @mdc:      MDC handle
+ * @data:     record buffer
+ * @len:      record length
+ * @sync:     flush record to media
+ *
+ * Only valid between mp_mdc_cstart_bg() and mp_mdc_cend(), and only from
+ * the thread driving the compaction.  Does not serialize with appends to
+ * the active mlog.
+ */
+uint64_t mp_mdc_append_compact(struct mp_mdc *mdc, void *data, ssize_t len, bool sync);
+
 #endif /* MPOOL_MDC_PRIV_H */
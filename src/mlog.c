@@ -5,84 +5,51 @@
 
 #include <linux/mm.h>
 #include <linux/log2.h>
+#include <linux/completion.h>
 #include <linux/blk_types.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
 #include <asm/page.h>
 
 #include "mpool_defs.h"
-
-#define mlpriv2layout(_ptr) \
-	((struct pmd_layout *)((char *)(_ptr) - offsetof(struct pmd_layout, eld_priv)))
-
-/* "open mlog" rbtree operations... */
-#define oml_layout_lock(_mp)        mutex_lock(&(_mp)->pds_oml_lock)
-#define oml_layout_unlock(_mp)      mutex_unlock(&(_mp)->pds_oml_lock)
-
-static struct pmd_layout_mlpriv *oml_layout_find(struct mpool_descriptor *mp, u64 key)
+#include "mpool_trace.h"
+
+/* "open mlog" hash table operations... */
+static const struct rhashtable_params oml_htab_params = {
+	.key_len             = sizeof(u64),
+	.key_offset          = offsetof(struct pmd_layout, eld_objid),
+	.head_offset         = offsetof(struct pmd_layout, eld_priv) +
+			       offsetof(struct pmd_layout_mlpriv, mlp_nodeoml),
+	.automatic_shrinking = true,
+};
+
+static merr_t oml_layout_insert(struct mpool_descriptor *mp, struct pmd_layout *layout)
 {
-	struct pmd_layout_mlpriv   *this;
-	struct pmd_layout          *layout;
-	struct rb_node             *node;
+	int rc;
 
-	node = mp->pds_oml_root.rb_node;
-	while (node) {
-		this = rb_entry(node, typeof(*this), mlp_nodeoml);
-		layout = mlpriv2layout(this);
-
-		if (key < layout->eld_objid)
-			node = node->rb_left;
-		else if (key > layout->eld_objid)
-			node = node->rb_right;
-		else
-			return this;
-	}
+	rc = rhashtable_lookup_insert_fast(&mp->pds_oml, &layout->eld_nodeoml, oml_htab_params);
 
-	return NULL;
+	return rc ? merr(rc) : 0;
 }
 
-static struct pmd_layout_mlpriv *
-oml_layout_insert(struct mpool_descriptor *mp, struct pmd_layout_mlpriv *item)
+static void oml_layout_remove(struct mpool_descriptor *mp, struct pmd_layout *layout)
 {
-	struct pmd_layout_mlpriv   *this;
-	struct pmd_layout          *layout;
-	struct rb_node            **pos, *parent;
-	struct rb_root             *root;
-	u64                         key;
-
-	root = &mp->pds_oml_root;
-	pos = &root->rb_node;
-	parent = NULL;
-
-	key = mlpriv2layout(item)->eld_objid;
-
-	while (*pos) {
-		this = rb_entry(*pos, typeof(*this), mlp_nodeoml);
-		layout = mlpriv2layout(this);
+	/* -ENOENT if the mlog was not open */
+	(void)rhashtable_remove_fast(&mp->pds_oml, &layout->eld_nodeoml, oml_htab_params);
+}
 
-		parent = *pos;
-		if (key < layout->eld_objid)
-			pos = &(*pos)->rb_left;
-		else if (key > layout->eld_objid)
-			pos = &(*pos)->rb_right;
-		else
-			return this;
-	}
+merr_t mlog_oml_init(struct mpool_descriptor *mp)
+{
+	int rc;
 
-	/* Add new node and rebalance tree. */
-	rb_link_node(&item->mlp_nodeoml, parent, pos);
-	rb_insert_color(&item->mlp_nodeoml, root);
+	rc = rhashtable_init(&mp->pds_oml, &oml_htab_params);
 
-	return NULL;
+	return rc ? merr(rc) : 0;
 }
 
-static struct pmd_layout_mlpriv *oml_layout_remove(struct mpool_descriptor *mp, u64 key)
+void mlog_oml_fini(struct mpool_descriptor *mp)
 {
-	struct pmd_layout_mlpriv *found;
-
-	found = oml_layout_find(mp, key);
-	if (found)
-		rb_erase(&found->mlp_nodeoml, &mp->pds_oml_root);
-
-	return found;
+	rhashtable_destroy(&mp->pds_oml);
 }
 
 /**
@@ -134,6 +101,66 @@ bool mlog_objid(u64 objid)
 	return objid && pmd_objid_type(objid) == OMF_OBJ_MLOG;
 }
 
+static const char * const mlog_lat_namev[MLOG_LAT_MAX] = {
+	[MLOG_LAT_APPEND]        = "append",
+	[MLOG_LAT_APPEND_LOCK]   = "append_lock",
+	[MLOG_LAT_APPEND_COPY]   = "append_copy",
+	[MLOG_LAT_FLUSH]         = "flush",
+	[MLOG_LAT_FLUSH_LOCK]    = "flush_lock",
+	[MLOG_LAT_FLUSH_HDRPACK] = "flush_hdrpack",
+	[MLOG_LAT_FLUSH_IO]      = "flush_io",
+	[MLOG_LAT_READ]          = "read",
+	[MLOG_LAT_READ_LOCK]     = "read_lock",
+	[MLOG_LAT_READ_IO]       = "read_io",
+	[MLOG_LAT_ERASE]         = "erase",
+	[MLOG_LAT_ERASE_LOCK]    = "erase_lock",
+	[MLOG_LAT_ERASE_IO]      = "erase_io",
+};
+
+const char *mlog_lat_name(enum mlog_lat_op op)
+{
+	return op < MLOG_LAT_MAX ? mlog_lat_namev[op] : NULL;
+}
+
+/**
+ * mlog_lat_add() - Account the time elapsed since start to a histogram
+ * @mp:    mpool descriptor
+ * @op:    enum mlog_lat_op
+ * @start: ktime_get_ns() at the start of the operation
+ */
+static void mlog_lat_add(struct mpool_descriptor *mp, enum mlog_lat_op op, u64 start)
+{
+	u64 ns = ktime_get_ns() - start;
+	int bkt = 0;
+
+	if (ns >= (1ul << MLOG_LAT_SHIFT))
+		bkt = min_t(int, ilog2(ns) - MLOG_LAT_SHIFT + 1, MLOG_LAT_BKTC - 1);
+
+	this_cpu_inc(mp->pds_mllat->mll_bktv[op][bkt]);
+}
+
+void mlog_lat_get(struct mpool_descriptor *mp, enum mlog_lat_op op, u64 *bktv)
+{
+	int cpu, i;
+
+	memset(bktv, 0, MLOG_LAT_BKTC * sizeof(*bktv));
+
+	for_each_possible_cpu(cpu) {
+		struct mlog_lat *lat = per_cpu_ptr(mp->pds_mllat, cpu);
+
+		for (i = 0; i < MLOG_LAT_BKTC; i++)
+			bktv[i] += READ_ONCE(lat->mll_bktv[op][i]);
+	}
+}
+
+void mlog_lat_reset(struct mpool_descriptor *mp)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(mp->pds_mllat, cpu), 0, sizeof(struct mlog_lat));
+}
+
 /**
  * mlog_getprops_cmn() - Retrieve basic mlog properties from layout.
  * @mp:
@@ -305,6 +332,45 @@ mlog_find_get(
 	return 0;
 }
 
+/**
+ * mlog_find_getv() -
+ *
+ * Get handles and capacities for existing mlogs, see pmd_obj_find_getv().
+ *
+ * Returns: 0 if successful, merr_t otherwise, in which case no ref is held
+ */
+merr_t
+mlog_find_getv(
+	struct mpool_descriptor    *mp,
+	const u64                  *objidv,
+	u32                         objidc,
+	struct mlog_descriptor    **mlhv,
+	u64                        *capv)
+{
+	struct pmd_layout **layoutv;
+	merr_t              err;
+	u32                 i;
+
+	for (i = 0; i < objidc; i++) {
+		if (!mlog_objid(objidv[i]))
+			return merr(EINVAL);
+	}
+
+	/* An mlog handle is its layout, mlhv[] holds the layouts meanwhile */
+	layoutv = (struct pmd_layout **)mlhv;
+
+	err = pmd_obj_find_getv(mp, objidv, objidc, layoutv);
+	if (err)
+		return err;
+
+	for (i = 0; i < objidc; i++) {
+		capv[i] = pmd_layout_cap_get(mp, layoutv[i]);
+		mlhv[i] = layout2mlog(layoutv[i]);
+	}
+
+	return 0;
+}
+
 /**
  * mlog_put()
  *
@@ -373,6 +439,125 @@ merr_t mlog_abort(struct mpool_descriptor *mp, struct mlog_descriptor *mlh)
 	return pmd_obj_abort(mp, layout);
 }
 
+static u64 mlog_bufpool_max(struct mlog_bufpool *mbp)
+{
+	return mbp->mbp_mp->pds_params.mp_mlbufsz << (20 - PAGE_SHIFT);
+}
+
+/**
+ * mlog_bufpool_full() - Whether the pool has no room for optional pages
+ * @mbp:
+ */
+static bool mlog_bufpool_full(struct mlog_bufpool *mbp)
+{
+	return READ_ONCE(mbp->mbp_lent) >= mlog_bufpool_max(mbp);
+}
+
+/**
+ * mlog_buf_get() - Lend a log page, idle pages first
+ * @mbp:
+ * @zero: true if the page must be zeroed
+ *
+ * Returns: a page aligned log page, NULL if out of memory
+ */
+static char *mlog_buf_get(struct mlog_bufpool *mbp, bool zero)
+{
+	char   *buf;
+
+	spin_lock(&mbp->mbp_lock);
+	buf = mbp->mbp_free;
+	if (buf) {
+		mbp->mbp_free = *(void **)buf;
+		--mbp->mbp_cnt;
+		++mbp->mbp_hits;
+		++mbp->mbp_lent;
+	}
+	spin_unlock(&mbp->mbp_lock);
+
+	if (buf) {
+		if (zero)
+			clear_page(buf);
+
+		return buf;
+	}
+
+	buf = (char *)__get_free_page(zero ? GFP_KERNEL | __GFP_ZERO : GFP_KERNEL);
+	if (!buf)
+		return NULL;
+
+	spin_lock(&mbp->mbp_lock);
+	++mbp->mbp_misses;
+	++mbp->mbp_lent;
+	spin_unlock(&mbp->mbp_lock);
+
+	return buf;
+}
+
+/**
+ * mlog_buf_put() - Give back a log page lent by mlog_buf_get()
+ * @mbp:
+ * @buf:
+ */
+static void mlog_buf_put(struct mlog_bufpool *mbp, char *buf)
+{
+	bool    keep;
+
+	spin_lock(&mbp->mbp_lock);
+	--mbp->mbp_lent;
+
+	keep = mbp->mbp_lent + mbp->mbp_cnt < mlog_bufpool_max(mbp);
+	if (keep) {
+		*(void **)buf = mbp->mbp_free;
+		mbp->mbp_free = buf;
+		++mbp->mbp_cnt;
+	}
+	spin_unlock(&mbp->mbp_lock);
+
+	if (!keep)
+		free_page((unsigned long)buf);
+}
+
+void mlog_bufpool_init(struct mpool_descriptor *mp)
+{
+	struct mlog_bufpool *mbp = &mp->pds_mlbufs;
+
+	spin_lock_init(&mbp->mbp_lock);
+	mbp->mbp_free = NULL;
+	mbp->mbp_cnt  = 0;
+	mbp->mbp_lent = 0;
+	mbp->mbp_mp   = mp;
+}
+
+void mlog_bufpool_fini(struct mpool_descriptor *mp)
+{
+	struct mlog_bufpool    *mbp = &mp->pds_mlbufs;
+	char                   *buf;
+
+	WARN_ONCE(mbp->mbp_lent, "mpool %s, %llu mlog buffers still lent",
+		  mp->pds_name, mbp->mbp_lent);
+
+	while ((buf = mbp->mbp_free)) {
+		mbp->mbp_free = *(void **)buf;
+		free_page((unsigned long)buf);
+	}
+	mbp->mbp_cnt = 0;
+}
+
+void mlog_bufpool_stats_get(struct mpool_descriptor *mp, struct mlog_bufpool_stats *stats)
+{
+	struct mlog_bufpool *mbp = &mp->pds_mlbufs;
+
+	spin_lock(&mbp->mbp_lock);
+	stats->mbs_idle     = mbp->mbp_cnt;
+	stats->mbs_lent     = mbp->mbp_lent;
+	stats->mbs_hits     = mbp->mbp_hits;
+	stats->mbs_misses   = mbp->mbp_misses;
+	stats->mbs_reclaims = mbp->mbp_reclaims;
+	spin_unlock(&mbp->mbp_lock);
+
+	stats->mbs_max = mlog_bufpool_max(mbp);
+}
+
 /**
  * mlog_free_abuf() - Free log pages in the append buffer, range:[start, end].
  *
@@ -386,7 +571,7 @@ static void mlog_free_abuf(struct mlog_stat *lstat, int start, int end)
 
 	for (i = start; i <= end; i++) {
 		if (lstat->lst_abuf[i]) {
-			free_page((unsigned long)lstat->lst_abuf[i]);
+			mlog_buf_put(lstat->lst_bufs, lstat->lst_abuf[i]);
 			lstat->lst_abuf[i] = NULL;
 		}
 	}
@@ -405,12 +590,302 @@ static void mlog_free_rbuf(struct mlog_stat *lstat, int start, int end)
 
 	for (i = start; i <= end; i++) {
 		if (lstat->lst_rbuf[i]) {
-			free_page((unsigned long)lstat->lst_rbuf[i]);
+			mlog_buf_put(lstat->lst_bufs, lstat->lst_rbuf[i]);
 			lstat->lst_rbuf[i] = NULL;
 		}
 	}
 }
 
+/*
+ * MLOG_RA_DEPTH: number of read buffers read ahead of a sequential reader
+ */
+#define MLOG_RA_DEPTH   3
+
+/**
+ * struct mlog_ra_set - asynchronous read of one read buffer
+ * @mrs_ctx:    pd I/O completion context
+ * @mrs_done:   signaled when the read completes
+ * @mrs_err:    read status
+ * @mrs_busy:   true while a read is in flight
+ * @mrs_soff:   LB offset of the 1st log block read
+ * @mrs_nsecs:  number of sectors read
+ * @mrs_iovcnt: number of log pages read
+ * @mrs_iov:    iovec for the read
+ * @mrs_buf:    log pages, exchanged with lst_rbuf pages on a hit
+ */
+struct mlog_ra_set {
+	struct pd_io_ctx    mrs_ctx;
+	struct completion   mrs_done;
+	merr_t              mrs_err;
+	bool                mrs_busy;
+	off_t               mrs_soff;
+	u16                 mrs_nsecs;
+	u16                 mrs_iovcnt;
+	struct kvec        *mrs_iov;
+	char               *mrs_buf[];
+};
+
+/**
+ * struct mlog_readahead - read buffers read ahead of a sequential reader
+ * @mra_head: index in mra_setv of the set the reader consumes next
+ * @mra_cnt:  number of sets started, from mra_head onwards (circularly)
+ * @mra_next: LB offset following the last set started
+ * @mra_setv: read sets, allocated on demand
+ *
+ * A read buffer refill that consumes a full buffer perfectly predicts the
+ * next refills of a sequential reader.  So, whenever the read buffer is
+ * filled with a full 1 MiB, up to MLOG_RA_DEPTH of the following 1 MiB
+ * chunks are read asynchronously while the reader parses lst_rbuf.  This
+ * keeps several reads queued on the media for sequential scans such as
+ * mlog_read_and_validate() and MDC replay during mpool activation, so that
+ * they run at device bandwidth rather than at one read latency per MiB.
+ * Protected by the same lock as lst_rbuf.
+ */
+struct mlog_readahead {
+	u16                 mra_head;
+	u16                 mra_cnt;
+	off_t               mra_next;
+	struct mlog_ra_set *mra_setv[MLOG_RA_DEPTH];
+};
+
+static void mlog_ra_done(struct pd_io_ctx *ctx, merr_t err)
+{
+	struct mlog_ra_set *rs = container_of(ctx, struct mlog_ra_set, mrs_ctx);
+
+	rs->mrs_err = err;
+	complete(&rs->mrs_done);
+}
+
+static void mlog_ra_wait(struct mlog_ra_set *rs)
+{
+	if (rs->mrs_busy) {
+		wait_for_completion(&rs->mrs_done);
+		rs->mrs_busy = false;
+	}
+}
+
+/**
+ * mlog_ra_free() - Wait for and discard any readahead
+ *
+ * @lstat: mlog_stat
+ */
+static void mlog_ra_free(struct mlog_stat *lstat)
+{
+	struct mlog_readahead  *ra = lstat->lst_ra;
+	struct mlog_ra_set     *rs;
+	int                     i, j;
+
+	if (!ra)
+		return;
+
+	for (j = 0; j < MLOG_RA_DEPTH; j++) {
+		rs = ra->mra_setv[j];
+		if (!rs)
+			continue;
+
+		mlog_ra_wait(rs);
+
+		for (i = 0; i < MLOG_NLPGMB(lstat); i++) {
+			if (rs->mrs_buf[i])
+				mlog_buf_put(lstat->lst_bufs, rs->mrs_buf[i]);
+		}
+
+		kfree(rs->mrs_iov);
+		kfree(rs);
+	}
+
+	kfree(ra);
+	lstat->lst_ra = NULL;
+}
+
+/**
+ * mlog_ra_start() - Start reading the given range into a readahead set
+ *
+ * @mp:       mpool descriptor
+ * @layout:   layout descriptor
+ * @idx:      index of the set in mra_setv
+ * @soff:     start LB offset, page aligned
+ * @nsec:     number of sectors to read, at most 1 MiB
+ * @skip_ser: client guarantees serialization
+ *
+ * Returns: true if the read was started
+ */
+static bool
+mlog_ra_start(
+	struct mpool_descriptor    *mp,
+	struct pmd_layout          *layout,
+	u16                         idx,
+	off_t                       soff,
+	u16                         nsec,
+	bool                        skip_ser)
+{
+	struct mlog_stat       *lstat = &layout->eld_lstat;
+	struct mlog_ra_set     *rs = lstat->lst_ra->mra_setv[idx];
+
+	merr_t err;
+	u16    sectsz;
+	u16    nseclpg;
+	u16    iovcnt;
+	u16    i;
+
+	mlog_extract_fsetparms(lstat, &sectsz, NULL, NULL, &nseclpg);
+
+	if (!rs) {
+		rs = kzalloc(sizeof(*rs) + MLOG_NLPGMB(lstat) * sizeof(rs->mrs_buf[0]),
+			     GFP_KERNEL);
+		if (!rs)
+			return false;
+
+		rs->mrs_iov = kcalloc(MLOG_NLPGMB(lstat), sizeof(*rs->mrs_iov), GFP_KERNEL);
+		if (!rs->mrs_iov) {
+			kfree(rs);
+			return false;
+		}
+
+		rs->mrs_ctx.pic_done = mlog_ra_done;
+		init_completion(&rs->mrs_done);
+		lstat->lst_ra->mra_setv[idx] = rs;
+	}
+
+	assert(!rs->mrs_busy);
+
+	iovcnt = (nsec + nseclpg - 1) / nseclpg;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (!rs->mrs_buf[i]) {
+			rs->mrs_buf[i] = mlog_buf_get(lstat->lst_bufs, false);
+			if (!rs->mrs_buf[i])
+				return false;
+		}
+
+		rs->mrs_iov[i].iov_base = rs->mrs_buf[i];
+		rs->mrs_iov[i].iov_len  = MLOG_LPGSZ(lstat);
+	}
+
+	/* Partial last log page */
+	if (nsec % nseclpg)
+		rs->mrs_iov[iovcnt - 1].iov_len = (nsec % nseclpg) * sectsz;
+
+	rs->mrs_soff   = soff;
+	rs->mrs_nsecs  = nsec;
+	rs->mrs_iovcnt = iovcnt;
+	rs->mrs_err    = 0;
+	reinit_completion(&rs->mrs_done);
+
+	if (skip_ser)
+		pmd_obj_wrlock(layout);
+
+	err = pmd_layout_rw_async(mp, layout, rs->mrs_iov, iovcnt, soff * sectsz, 0,
+				  MPOOL_OP_READ, &rs->mrs_ctx);
+	if (!ev(err))
+		rs->mrs_busy = true;
+
+	if (skip_ser)
+		pmd_obj_wrunlock(layout);
+
+	return !err;
+}
+
+/**
+ * mlog_ra_fill() - Read ahead as many read buffers as allowed from soff
+ *
+ * @mp:       mpool descriptor
+ * @layout:   layout descriptor
+ * @soff:     LB offset following the read buffer, page aligned
+ * @eoff:     LB offset at which to stop
+ * @skip_ser: client guarantees serialization
+ *
+ * Readahead is opportunistic, so failures are not reported.
+ */
+static void
+mlog_ra_fill(
+	struct mpool_descriptor    *mp,
+	struct pmd_layout          *layout,
+	off_t                       soff,
+	off_t                       eoff,
+	bool                        skip_ser)
+{
+	struct mlog_stat       *lstat = &layout->eld_lstat;
+	struct mlog_readahead  *ra = lstat->lst_ra;
+	u16                     maxsec, nsec, idx;
+
+	if (!ra) {
+		ra = kzalloc(sizeof(*ra), GFP_KERNEL);
+		if (!ra)
+			return;
+
+		lstat->lst_ra = ra;
+	}
+
+	if (!ra->mra_cnt)
+		ra->mra_next = soff;
+
+	maxsec = MLOG_NSECMB(lstat);
+
+	/*
+	 * Stop after a partial set, it can only be the end of the stream.
+	 * Readahead pages are optional, they aren't lent past the pool bound.
+	 */
+	while (ra->mra_cnt < MLOG_RA_DEPTH && ra->mra_next < eoff &&
+	       ra->mra_next == soff + ra->mra_cnt * maxsec &&
+	       !mlog_bufpool_full(lstat->lst_bufs)) {
+		nsec = min_t(off_t, maxsec, eoff - ra->mra_next);
+		idx  = (ra->mra_head + ra->mra_cnt) % MLOG_RA_DEPTH;
+
+		if (!mlog_ra_start(mp, layout, idx, ra->mra_next, nsec, skip_ser))
+			break;
+
+		ra->mra_next += nsec;
+		++ra->mra_cnt;
+	}
+
+	if (!ra->mra_cnt)
+		mlog_ra_free(lstat);
+}
+
+/**
+ * mlog_ra_hit() - Consume the next readahead set if it holds the given range
+ *
+ * @lstat: mlog_stat
+ * @soff:  start LB offset, page aligned
+ * @nsec:  number of sectors
+ *
+ * On a hit the readahead pages are exchanged with the read buffer pages,
+ * to be reused by the next readahead.  A miss discards all readahead.
+ *
+ * Returns: true on a hit
+ */
+static bool mlog_ra_hit(struct mlog_stat *lstat, off_t soff, u16 nsec)
+{
+	struct mlog_readahead  *ra = lstat->lst_ra;
+	struct mlog_ra_set     *rs;
+	int                     i;
+
+	if (!ra)
+		return false;
+
+	if (!ra->mra_cnt) {
+		mlog_ra_free(lstat);
+		return false;
+	}
+
+	rs = ra->mra_setv[ra->mra_head];
+	mlog_ra_wait(rs);
+
+	if (rs->mrs_soff != soff || rs->mrs_nsecs != nsec || ev(rs->mrs_err)) {
+		mlog_ra_free(lstat);
+		return false;
+	}
+
+	for (i = 0; i < rs->mrs_iovcnt; i++)
+		swap(lstat->lst_rbuf[i], rs->mrs_buf[i]);
+
+	ra->mra_head = (ra->mra_head + 1) % MLOG_RA_DEPTH;
+	--ra->mra_cnt;
+
+	return true;
+}
+
 /**
  * mlog_init_fsetparms() - Initialize frequently used mlog & flush set
  * parameters.
@@ -471,6 +946,94 @@ mlog_extract_fsetparms(struct mlog_stat *lstat, u16 *sectsz, u32 *totsec, u16 *n
 		*nseclpg = MLOG_NSECLPG(lstat);
 }
 
+/**
+ * struct mlog_aflush - append buffer set being flushed in the background
+ *
+ * @maf_ctx:    pd I/O completion context
+ * @maf_done:   completed when the flush I/O completes
+ * @maf_err:    flush I/O status, sticky until the mlog is closed or erased
+ * @maf_busy:   true while a flush is in flight
+ * @maf_iovcnt: number of log pages being flushed
+ * @maf_iov:    iovec for the flush
+ * @maf_buf:    log pages being flushed, detached from lst_abuf
+ *
+ * When an append fills the append buffer, its log pages are handed over to
+ * the background flush and appending resumes in a fresh set of pages, rather
+ * than waiting for the 1 MiB write with the layout lock held.  The last log
+ * page is copied into the new set as its last log block may be carried over
+ * into the next CFS.  Only one flush is in flight at a time: every flush,
+ * and every read from media, first waits for the previous one, which keeps
+ * the writes of any rewritten log block ordered.  Protected by the same lock
+ * as lst_abuf.
+ */
+struct mlog_aflush {
+	struct pd_io_ctx    maf_ctx;
+	struct completion   maf_done;
+	merr_t              maf_err;
+	bool                maf_busy;
+	u16                 maf_iovcnt;
+	struct kvec        *maf_iov;
+	char               *maf_buf[];
+};
+
+static void mlog_af_done(struct pd_io_ctx *ctx, merr_t err)
+{
+	struct mlog_aflush *af = container_of(ctx, struct mlog_aflush, maf_ctx);
+
+	af->maf_err = err;
+	complete(&af->maf_done);
+}
+
+/**
+ * mlog_af_wait() - Wait for the background flush, if any, to complete
+ *
+ * @lstat: mlog_stat
+ *
+ * Returns: the status of the last background flush.  Once one fails, the
+ * log blocks already appended after it can't be made durable, so the error
+ * is reported by all subsequent flushes.
+ */
+static merr_t mlog_af_wait(struct mlog_stat *lstat)
+{
+	struct mlog_aflush *af = lstat->lst_af;
+	u16                 i;
+
+	if (!af)
+		return 0;
+
+	if (af->maf_busy) {
+		wait_for_completion(&af->maf_done);
+		af->maf_busy = false;
+
+		for (i = 0; i < af->maf_iovcnt; i++) {
+			mlog_buf_put(lstat->lst_bufs, af->maf_buf[i]);
+			af->maf_buf[i] = NULL;
+		}
+		af->maf_iovcnt = 0;
+	}
+
+	return af->maf_err;
+}
+
+/**
+ * mlog_af_free() - Wait for and free the background flush state
+ *
+ * @lstat: mlog_stat
+ */
+static void mlog_af_free(struct mlog_stat *lstat)
+{
+	struct mlog_aflush *af = lstat->lst_af;
+
+	if (!af)
+		return;
+
+	mlog_af_wait(lstat);
+
+	kfree(af->maf_iov);
+	kfree(af);
+	lstat->lst_af = NULL;
+}
+
 /**
  * mlog_stat_free()
  *
@@ -483,9 +1046,14 @@ static void mlog_stat_free(struct pmd_layout *layout)
 	if (ev(!lstat->lst_abuf))
 		return;
 
+	mlog_ra_free(lstat);
+	mlog_af_free(lstat);
 	mlog_free_rbuf(lstat, 0, MLOG_NLPGMB(lstat) - 1);
 	mlog_free_abuf(lstat, 0, MLOG_NLPGMB(lstat) - 1);
 
+	kvfree(lstat->lst_ridx);
+	lstat->lst_ridx = NULL;
+
 	kfree(lstat->lst_abuf);
 	lstat->lst_abuf = NULL;
 }
@@ -508,9 +1076,7 @@ merr_t mlog_delete(struct mpool_descriptor *mp, struct mlog_descriptor *mlh)
 
 	/* Remove from open list and discard buffered log data */
 	pmd_obj_wrlock(layout);
-	oml_layout_lock(mp);
-	oml_layout_remove(mp, layout->eld_objid);
-	oml_layout_unlock(mp);
+	oml_layout_remove(mp, layout);
 
 	mlog_stat_free(layout);
 	pmd_obj_wrunlock(layout);
@@ -518,6 +1084,40 @@ merr_t mlog_delete(struct mpool_descriptor *mp, struct mlog_descriptor *mlh)
 	return pmd_obj_delete(mp, layout);
 }
 
+static u32 mlog_ridx_span(struct mlog_stat *lstat)
+{
+	return max_t(u32, MLOG_RIDX_SPAN / MLOG_SECSZ(lstat), 1);
+}
+
+/**
+ * mlog_ridx_add() - Account a complete data record
+ * @lstat:
+ * @soff:  LB offset of the log block where the record starts
+ * @roff:  offset of the record descriptor in that log block
+ *
+ * Records must be added in log order.
+ */
+static void mlog_ridx_add(struct mlog_stat *lstat, off_t soff, u16 roff)
+{
+	struct mlog_ridx_ent   *ent = NULL;
+
+	if (lstat->lst_ridx) {
+		if (lstat->lst_ridxcnt > 0)
+			ent = &lstat->lst_ridx[lstat->lst_ridxcnt - 1];
+
+		if ((!ent || soff >= ent->mre_soff + mlog_ridx_span(lstat)) &&
+		    lstat->lst_ridxcnt < lstat->lst_ridxmax) {
+			ent = &lstat->lst_ridx[lstat->lst_ridxcnt++];
+
+			ent->mre_recno = lstat->lst_recnum;
+			ent->mre_soff  = soff;
+			ent->mre_roff  = roff;
+		}
+	}
+
+	++lstat->lst_recnum;
+}
+
 /**
  * mlog_logrecs_validate()
  *
@@ -606,6 +1206,10 @@ mlog_logrecs_validate(
 				return err;
 			}
 			*midrec = 0;
+
+			/* A partial record at the end of the last log block is dropped */
+			lstat->lst_ridxpend.mre_roff = 0;
+			mlog_ridx_add(lstat, lstat->lst_wsoff, recoff);
 		} else if (lrd.olr_rtype == OMF_LOGREC_DATAFIRST) {
 			if (*midrec && recnum) {
 				/* See comment for DATAFULL */
@@ -615,6 +1219,9 @@ mlog_logrecs_validate(
 				return err;
 			}
 			*midrec = 1;
+
+			lstat->lst_ridxpend.mre_soff = lstat->lst_wsoff;
+			lstat->lst_ridxpend.mre_roff = recoff;
 		} else if (lrd.olr_rtype == OMF_LOGREC_DATAMID) {
 			if (!*midrec) {
 				/* Must occur mid data record. */
@@ -632,6 +1239,11 @@ mlog_logrecs_validate(
 				return err;
 			}
 			*midrec = 0;
+
+			if (lstat->lst_ridxpend.mre_roff)
+				mlog_ridx_add(lstat, lstat->lst_ridxpend.mre_soff,
+					      lstat->lst_ridxpend.mre_roff);
+			lstat->lst_ridxpend.mre_roff = 0;
 		} else {
 			err = merr(ENODATA);
 			mp_pr_err("unknown record type %d %lu", err, lrd.olr_rtype, (ulong)recnum);
@@ -686,6 +1298,10 @@ static void mlog_stat_init_common(struct pmd_layout *layout, struct mlog_stat *l
 	lstat->lst_wsoff   = 0;
 	lstat->lst_cstart  = 0;
 	lstat->lst_cend    = 0;
+	lstat->lst_recnum  = 0;
+	lstat->lst_ridxcnt = 0;
+
+	lstat->lst_ridxpend.mre_roff = 0;
 
 	lri = &lstat->lst_citr;
 	mlog_read_iter_init(layout, lstat, lri);
@@ -804,8 +1420,20 @@ static merr_t mlog_stat_init(struct mpool_descriptor *mp, struct mlog_descriptor
 	}
 
 	lstat->lst_rbuf = lstat->lst_abuf + mfp.mfp_nlpgmb;
+	lstat->lst_bufs = &mp->pds_mlbufs;
 	lstat->lst_mfp  = mfp;
 	lstat->lst_csem = csem;
+	lstat->lst_ra   = NULL;
+	lstat->lst_af   = NULL;
+
+	lstat->lst_ridx    = NULL;
+	lstat->lst_ridxmax = 0;
+
+	mutex_init(&lstat->lst_gclock);
+	lstat->lst_gcseq   = 0;
+	lstat->lst_gcdone  = 0;
+	lstat->lst_gcerrlo = 0;
+	lstat->lst_gcerr   = 0;
 
 	return 0;
 }
@@ -884,7 +1512,7 @@ mlog_setup_buf(struct mlog_stat *lstat, struct kvec **riov, u16 iovcnt, u32 l_io
 		 * No need to zero the read buffer as we never read more than
 		 * what's needed and do not consume beyond what's read.
 		 */
-		buf = (char *)__get_free_page(GFP_KERNEL);
+		buf = mlog_buf_get(lstat->lst_bufs, false);
 		if (!buf) {
 			mlog_free_rbuf(lstat, 0, i - 1);
 			if (alloc_iov) {
@@ -953,6 +1581,15 @@ mlog_logpage_validate(
 	for (lbidx = 0; lbidx < nseclpg; lbidx++) {
 		struct omf_logblock_header lbh;
 
+		/*
+		 * Past LEOL the rest of the page is usually discarded.  An
+		 * erased sector can't carry this mlog's magic, so it can't
+		 * raise fsetidmax, hence skip all the remaining sectors at
+		 * once rather than unpacking their headers one by one.
+		 */
+		if (*leol_found && omf_logblock_erased_le(rbuf, (nseclpg - lbidx) * sectsz))
+			break;
+
 		memset(&lbh, 0, sizeof(lbh));
 
 		(void)omf_logblock_header_unpack_letoh(&lbh, rbuf);
@@ -995,6 +1632,14 @@ mlog_logpage_validate(
 
 		*fsetidmax = lbh.olh_cfsetid;
 
+		err = omf_logblock_cksum_check_le(rbuf, sectsz);
+		if (err) {
+			mp_pr_err("mlog 0x%lx, log pg idx %u, sector idx %u, checksum mismatch",
+				  err, (ulong)layout->eld_objid, rbidx, lbidx);
+
+			return err;
+		}
+
 		/* Validate the log block at lbidx. */
 		err = mlog_logrecs_validate(mlh, lstat, midrec, rbidx, lbidx);
 		if (err) {
@@ -1087,10 +1732,14 @@ mlog_populate_abuf(
  *
  * Caller must hold the write lock on the layout
  *
+ * If the read buffer is filled with a full 1 MiB and @eoff lies beyond it,
+ * the subsequent range up to @eoff is read ahead asynchronously.
+ *
  * @mp:       mpool descriptor
  * @layout:   layout descriptor
  * @nsec:     number of sectors to populate
  * @soff:     start sector/LB offset
+ * @eoff:     end LB offset (exclusive) of the readable range
  * @skip_ser: client guarantees serialization
  */
 static merr_t
@@ -1099,6 +1748,7 @@ mlog_populate_rbuf(
 	struct pmd_layout          *layout,
 	u16                        *nsec,
 	off_t                      *soff,
+	off_t                       eoff,
 	bool                        skip_ser)
 {
 	struct mlog_stat   *lstat = &layout->eld_lstat;
@@ -1106,6 +1756,7 @@ mlog_populate_rbuf(
 
 	merr_t err;
 	off_t  off;
+	u64    tio;
 	u32    l_iolen;
 	u16    maxsec;
 	u16    sectsz;
@@ -1124,6 +1775,15 @@ mlog_populate_rbuf(
 	iovcnt  = (*nsec + nseclpg - 1) / nseclpg;
 	l_iolen = MLOG_LPGSZ(lstat);
 
+	/*
+	 * Log blocks being flushed in the background must reach the media
+	 * before being read back.  An error is reported by the next flush.
+	 */
+	(void)mlog_af_wait(lstat);
+
+	if (mlog_ra_hit(lstat, *soff, *nsec))
+		goto readahead;
+
 	err = mlog_setup_buf(lstat, &iov, iovcnt, l_iolen, MPOOL_OP_READ);
 	if (err) {
 		mp_pr_err("mpool %s, mlog 0x%lx setup failed, iovcnt: %u, last iolen: %u",
@@ -1135,7 +1795,9 @@ mlog_populate_rbuf(
 	off = *soff * sectsz;
 	assert(IS_ALIGNED(off, MLOG_LPGSZ(lstat)));
 
+	tio = ktime_get_ns();
 	err = mlog_rw(mp, layout2mlog(layout), iov, iovcnt, off, MPOOL_OP_READ, skip_ser);
+	mlog_lat_add(mp, MLOG_LAT_READ_IO, tio);
 	if (err) {
 		mp_pr_err("mpool %s, mlog 0x%lx populate rbuf, IO failed iovcnt: %u, off: 0x%lx",
 			  err, mp->pds_name, (ulong)layout->eld_objid, iovcnt, off);
@@ -1146,6 +1808,9 @@ mlog_populate_rbuf(
 		return err;
 	}
 
+	kfree(iov);
+
+readahead:
 	/*
 	 * If there're any unused buffers beyond iovcnt, free it. This is
 	 * likely to happen when there're multiple threads reading from
@@ -1153,7 +1818,10 @@ mlog_populate_rbuf(
 	 */
 	mlog_free_rbuf(lstat, iovcnt, MLOG_NLPGMB(lstat) - 1);
 
-	kfree(iov);
+	if (*nsec == maxsec && *soff + maxsec < eoff)
+		mlog_ra_fill(mp, layout, *soff + maxsec, eoff, skip_ser);
+	else
+		mlog_ra_free(lstat);
 
 	return 0;
 }
@@ -1210,7 +1878,7 @@ mlog_read_and_validate(struct mpool_descriptor *mp, struct pmd_layout *layout, b
 		nseclpg = MLOG_NSECLPG(lstat);
 		nsecs   = min_t(u32, maxsec, remsec);
 
-		err = mlog_populate_rbuf(mp, layout, &nsecs, &rsoff, skip_ser);
+		err = mlog_populate_rbuf(mp, layout, &nsecs, &rsoff, MLOG_TOTSEC(lstat), skip_ser);
 		if (err) {
 			mp_pr_err("mpool %s, mlog 0x%lx validate failed, nsecs: %u, rsoff: 0x%lx",
 				  err, mp->pds_name, (ulong)layout->eld_objid, nsecs, rsoff);
@@ -1308,6 +1976,8 @@ merr_t mlog_open(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, u8 fl
 	bool    lempty = false;
 	bool    csem   = false;
 	bool    skip_ser = false;
+	bool    gcommit = false;
+	bool    ridx = false;
 
 	lstat = NULL;
 	*gen = 0;
@@ -1315,9 +1985,7 @@ merr_t mlog_open(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, u8 fl
 	if (!layout)
 		return merr(EINVAL);
 
-	pmd_obj_wrlock(layout);
-
-	flags &= MLOG_OF_SKIP_SER | MLOG_OF_COMPACT_SEM;
+	flags &= MLOG_OF_SKIP_SER | MLOG_OF_COMPACT_SEM | MLOG_OF_GROUP_COMMIT | MLOG_OF_RECIDX;
 
 	if (flags & MLOG_OF_COMPACT_SEM)
 		csem = true;
@@ -1325,6 +1993,21 @@ merr_t mlog_open(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, u8 fl
 	if (flags & MLOG_OF_SKIP_SER)
 		skip_ser = true;
 
+	if (flags & MLOG_OF_GROUP_COMMIT)
+		gcommit = true;
+
+	if (flags & MLOG_OF_RECIDX)
+		ridx = true;
+
+	if (skip_ser && gcommit) {
+		err = merr(EINVAL);
+		mp_pr_err("mpool %s, mlog 0x%lx, group commit requires serialization",
+			  err, mp->pds_name, (ulong)layout->eld_objid);
+		return err;
+	}
+
+	pmd_obj_wrlock(layout);
+
 	lstat = &layout->eld_lstat;
 
 	if (lstat->lst_abuf) {
@@ -1345,6 +2028,21 @@ merr_t mlog_open(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, u8 fl
 			mp_pr_err("mpool %s, re-opening of mlog 0x%lx, inconsistent ser %u %u",
 				  err, mp->pds_name, (ulong)layout->eld_objid, skip_ser,
 				  layout->eld_flags & MLOG_OF_SKIP_SER);
+		} else if (gcommit != !!(layout->eld_flags & MLOG_OF_GROUP_COMMIT)) {
+			pmd_obj_wrunlock(layout);
+
+			/* Re-open has inconsistent group commit flag */
+			err = merr(EINVAL);
+			mp_pr_err("mpool %s, re-opening of mlog 0x%lx, inconsistent gcommit %u %u",
+				  err, mp->pds_name, (ulong)layout->eld_objid, gcommit,
+				  layout->eld_flags & MLOG_OF_GROUP_COMMIT);
+		} else if (ridx && !lstat->lst_ridx) {
+			pmd_obj_wrunlock(layout);
+
+			/* The record index can only be built at first open */
+			err = merr(EINVAL);
+			mp_pr_err("mpool %s, re-opening of mlog 0x%lx, no record index",
+				  err, mp->pds_name, (ulong)layout->eld_objid);
 		} else {
 			*gen = layout->eld_gen;
 			pmd_obj_wrunlock(layout);
@@ -1365,6 +2063,11 @@ merr_t mlog_open(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, u8 fl
 	if (skip_ser)
 		layout->eld_flags |= MLOG_OF_SKIP_SER;
 
+	if (gcommit)
+		layout->eld_flags |= MLOG_OF_GROUP_COMMIT;
+	else
+		layout->eld_flags &= ~MLOG_OF_GROUP_COMMIT;
+
 	err = mlog_stat_init(mp, mlh, csem);
 	if (err) {
 		*gen = 0;
@@ -1375,6 +2078,22 @@ merr_t mlog_open(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, u8 fl
 		return err;
 	}
 
+	if (ridx) {
+		lstat->lst_ridxmax = MLOG_TOTSEC(lstat) / mlog_ridx_span(lstat) + 1;
+		lstat->lst_ridx = kvcalloc(lstat->lst_ridxmax, sizeof(*lstat->lst_ridx),
+					   GFP_KERNEL);
+		if (!lstat->lst_ridx) {
+			*gen = 0;
+			mlog_stat_free(layout);
+			pmd_obj_wrunlock(layout);
+
+			err = merr(ENOMEM);
+			mp_pr_err("mpool %s, mlog 0x%lx, allocating record index failed %u",
+				  err, mp->pds_name, (ulong)layout->eld_objid, lstat->lst_ridxmax);
+			return err;
+		}
+	}
+
 	lempty = true;
 
 	err = mlog_read_and_validate(mp, layout, &lempty);
@@ -1406,12 +2125,17 @@ merr_t mlog_open(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, u8 fl
 		}
 	}
 
-	*gen = layout->eld_gen;
+	err = oml_layout_insert(mp, layout);
+	if (err) {
+		mlog_stat_free(layout);
+		pmd_obj_wrunlock(layout);
+
+		mp_pr_err("mpool %s, mlog 0x%lx, adding to open mlogs failed",
+			  err, mp->pds_name, (ulong)layout->eld_objid);
+		return err;
+	}
 
-	/* TODO: Verify that the insert succeeded... */
-	oml_layout_lock(mp);
-	oml_layout_insert(mp, &layout->eld_mlpriv);
-	oml_layout_unlock(mp);
+	*gen = layout->eld_gen;
 
 	pmd_obj_wrunlock(layout);
 
@@ -1436,7 +2160,7 @@ mlog_alloc_abufpg(struct mpool_descriptor *mp, struct pmd_layout *layout, u16 ab
 
 	assert(MLOG_LPGSZ(lstat) == PAGE_SIZE);
 
-	abuf = (char *)get_zeroed_page(GFP_KERNEL);
+	abuf = mlog_buf_get(lstat->lst_bufs, true);
 	if (!abuf)
 		return merr(ENOMEM);
 
@@ -1451,7 +2175,10 @@ mlog_alloc_abufpg(struct mpool_descriptor *mp, struct pmd_layout *layout, u16 ab
 		u16    aoff;
 		u16    sectsz;
 
-		/* This path is taken *only* for the first append following an mlog_open(). */
+		/*
+		 * This path is taken *only* for the first append following an
+		 * mlog_open() or the reclaim of the append buffer by a flush.
+		 */
 		sectsz = MLOG_SECSZ(lstat);
 		wsoff  = lstat->lst_wsoff;
 		aoff   = lstat->lst_aoff;
@@ -1491,14 +2218,19 @@ mlog_alloc_abufpg(struct mpool_descriptor *mp, struct pmd_layout *layout, u16 ab
  * mlog_logblocks_hdrpack() - Called prior to CFS flush to pack log
  * block header in all log blocks in the append buffer.
  *
+ * @mp:     mpool descriptor
  * @layout: object layout
+ *
+ * Log blocks are also checksummed here if the mpool is configured for it,
+ * after the header is packed so that the checksum covers it.
  */
-static merr_t mlog_logblocks_hdrpack(struct pmd_layout *layout)
+static merr_t mlog_logblocks_hdrpack(struct mpool_descriptor *mp, struct pmd_layout *layout)
 {
 	struct omf_logblock_header lbh;
 	struct mlog_stat          *lstat = &layout->eld_lstat;
 
 	merr_t err;
+	bool   cksum;
 	off_t  lpgoff;
 	u32    pfsetid;
 	u32    cfsetid;
@@ -1514,6 +2246,7 @@ static merr_t mlog_logblocks_hdrpack(struct pmd_layout *layout)
 	abidx   = lstat->lst_abidx;
 	pfsetid = lstat->lst_pfsetid;
 	cfsetid = lstat->lst_cfsetid;
+	cksum   = mp->pds_params.mp_mlcksum;
 
 	lbh.olh_vers = OMF_LOGBLOCK_VERS;
 
@@ -1542,6 +2275,16 @@ static merr_t mlog_logblocks_hdrpack(struct pmd_layout *layout)
 				return err;
 			}
 
+			if (cksum) {
+				err = omf_logblock_cksum_set_le(&lstat->lst_abuf[idx][lpgoff], sectsz);
+				if (err) {
+					mp_pr_err("mlog checksum failed, log pg idx %u, sector %u",
+						  err, idx, sec);
+
+					return err;
+				}
+			}
+
 			/* If there's more than one sector to flush, pfsetid is set to cfsetid. */
 			pfsetid = cfsetid;
 		}
@@ -1596,9 +2339,107 @@ static merr_t mlog_flush_abuf(struct mpool_descriptor *mp, struct pmd_layout *la
 		return err;
 	}
 
-	kfree(iov);
+	kfree(iov);
+
+	return 0;
+}
+
+/**
+ * mlog_flush_abuf_async() - Start flushing the append buffer in the background
+ *
+ * @mp:       mpool descriptor
+ * @layout:   layout descriptor
+ * @skip_ser: client guarantees serialization
+ *
+ * The log pages are detached from lst_abuf, except for the last one which is
+ * replaced by a copy, so that the flush post handlers can proceed as if the
+ * flush succeeded.  Falls back to a synchronous flush if the background flush
+ * state can't be set up.  The caller must have waited for the previous
+ * background flush.
+ */
+static merr_t
+mlog_flush_abuf_async(struct mpool_descriptor *mp, struct pmd_layout *layout, bool skip_ser)
+{
+	struct mlog_stat   *lstat = &layout->eld_lstat;
+	struct mlog_aflush *af = lstat->lst_af;
+
+	merr_t err;
+	char  *copy;
+	off_t  off;
+	u16    abidx;
+	u16    sectsz;
+	u16    i;
+
+	if (!af) {
+		af = kzalloc(sizeof(*af) + MLOG_NLPGMB(lstat) * sizeof(af->maf_buf[0]),
+			     GFP_KERNEL);
+		if (!af)
+			return mlog_flush_abuf(mp, layout, skip_ser);
+
+		af->maf_iov = kcalloc(MLOG_NLPGMB(lstat), sizeof(*af->maf_iov), GFP_KERNEL);
+		if (!af->maf_iov) {
+			kfree(af);
+			return mlog_flush_abuf(mp, layout, skip_ser);
+		}
+
+		af->maf_ctx.pic_done = mlog_af_done;
+		init_completion(&af->maf_done);
+		lstat->lst_af = af;
+	}
+
+	assert(!af->maf_busy);
+
+	copy = mlog_buf_get(lstat->lst_bufs, false);
+	if (!copy)
+		return mlog_flush_abuf(mp, layout, skip_ser);
+
+	sectsz = MLOG_SECSZ(lstat);
+	abidx  = lstat->lst_abidx;
+
+	for (i = 0; i <= abidx; i++) {
+		af->maf_buf[i] = lstat->lst_abuf[i];
+		af->maf_iov[i].iov_base = af->maf_buf[i];
+		af->maf_iov[i].iov_len  = MLOG_LPGSZ(lstat);
+		lstat->lst_abuf[i] = NULL;
+	}
+
+	memcpy(copy, af->maf_buf[abidx], MLOG_LPGSZ(lstat));
+	lstat->lst_abuf[abidx] = copy;
+
+	off = lstat->lst_asoff * sectsz;
+
+	assert((IS_ALIGNED(off, MLOG_LPGSZ(lstat))) ||
+		(IS_SECPGA(lstat) && IS_ALIGNED(off, MLOG_SECSZ(lstat))));
+
+	af->maf_iovcnt = abidx + 1;
+	af->maf_err    = 0;
+	reinit_completion(&af->maf_done);
+
+	if (skip_ser)
+		pmd_obj_wrlock(layout);
+
+	err = pmd_layout_rw_async(mp, layout, af->maf_iov, abidx + 1, off, REQ_FUA,
+				  MPOOL_OP_WRITE, &af->maf_ctx);
+	if (!ev(err))
+		af->maf_busy = true;
+
+	if (skip_ser)
+		pmd_obj_wrunlock(layout);
+
+	if (err) {
+		mp_pr_err("mpool %s, mlog 0x%lx flush append buf, IO failed iovcnt %u, off 0x%lx",
+			  err, mp->pds_name, (ulong)layout->eld_objid, abidx + 1, off);
+
+		/* Reattach the log pages for the failed flush post handling */
+		for (i = 0; i <= abidx; i++) {
+			lstat->lst_abuf[i] = af->maf_buf[i];
+			af->maf_buf[i] = NULL;
+		}
+		af->maf_iovcnt = 0;
+		mlog_buf_put(lstat->lst_bufs, copy);
+	}
 
-	return 0;
+	return err;
 }
 
 /**
@@ -1783,10 +2624,15 @@ exit2:
  *
  * @mp:       mpool descriptor
  * @layout:   layout descriptor
+ * @async:    don't wait for the CFS to be on media
  * @skip_ser: client guarantees serialization
+ *
+ * An async flush is only waited for by the next flush, which then reports
+ * its failure.
  */
 static merr_t
-mlog_logblocks_flush(struct mpool_descriptor *mp, struct pmd_layout *layout, bool skip_ser)
+mlog_logblocks_flush(struct mpool_descriptor *mp, struct pmd_layout *layout, bool async,
+		     bool skip_ser)
 {
 	struct mlog_stat *lstat = &layout->eld_lstat;
 
@@ -1795,17 +2641,36 @@ mlog_logblocks_flush(struct mpool_descriptor *mp, struct pmd_layout *layout, boo
 	int    start;
 	int    end;
 	u16    abidx;
+	u64    tstart, tphase;
+	off_t  off;
 
 	abidx = lstat->lst_abidx;
+	off = lstat->lst_asoff * MLOG_SECSZ(lstat);
+	tstart = ktime_get_ns();
 
-	/* Pack log block header in all the log blocks. */
-	err = mlog_logblocks_hdrpack(layout);
-	if (ev(err)) {
-		mp_pr_err("mpool %s, mlog 0x%lx packing header failed",
+	err = mlog_af_wait(lstat);
+	if (ev(err))
+		mp_pr_err("mpool %s, mlog 0x%lx background log block flush failed",
 			  err, mp->pds_name, (ulong)layout->eld_objid);
 
-	} else {
-		err = mlog_flush_abuf(mp, layout, skip_ser);
+	/* Pack log block header in all the log blocks. */
+	if (!err) {
+		tphase = ktime_get_ns();
+		err = mlog_logblocks_hdrpack(mp, layout);
+		mlog_lat_add(mp, MLOG_LAT_FLUSH_HDRPACK, tphase);
+		if (ev(err))
+			mp_pr_err("mpool %s, mlog 0x%lx packing header failed",
+				  err, mp->pds_name, (ulong)layout->eld_objid);
+	}
+
+	if (!err) {
+		if (async) {
+			err = mlog_flush_abuf_async(mp, layout, skip_ser);
+		} else {
+			tphase = ktime_get_ns();
+			err = mlog_flush_abuf(mp, layout, skip_ser);
+			mlog_lat_add(mp, MLOG_LAT_FLUSH_IO, tphase);
+		}
 		if (ev(err))
 			mp_pr_err("mpool %s, mlog 0x%lx log block flush failed",
 				  err, mp->pds_name, (ulong)layout->eld_objid);
@@ -1835,6 +2700,28 @@ mlog_logblocks_flush(struct mpool_descriptor *mp, struct pmd_layout *layout, boo
 	else
 		mlog_flush_posthdlr(mp, layout, fsucc);
 
+	/*
+	 * If the next append starts a new log page, the append buffer holds
+	 * nothing worth keeping: give it back to the pool and leave lstat as
+	 * after mlog_open().  The next append borrows a page again.
+	 */
+	if (fsucc && !async && lstat->lst_asoff == lstat->lst_wsoff &&
+	    lstat->lst_aoff == OMF_LOGBLOCK_HDR_PACKLEN) {
+		mlog_free_abuf(lstat, 0, 0);
+		lstat->lst_asoff = -1;
+
+		spin_lock(&lstat->lst_bufs->mbp_lock);
+		++lstat->lst_bufs->mbp_reclaims;
+		spin_unlock(&lstat->lst_bufs->mbp_lock);
+	}
+
+	mlog_lat_add(mp, MLOG_LAT_FLUSH, tstart);
+
+	if (trace_mpool_mlog_flush_enabled())
+		trace_mpool_mlog_flush(mp, layout->eld_objid, layout->eld_ld.ol_pdh, off,
+				       (abidx + 1) * MLOG_LPGSZ(lstat), async,
+				       ktime_get_ns() - tstart, err);
+
 	return err;
 }
 
@@ -1873,21 +2760,24 @@ merr_t mlog_close(struct mpool_descriptor *mp, struct mlog_descriptor *mlh)
 
 	/* Flush log if potentially dirty and remove layout from open list */
 	if (lstat->lst_abdirty) {
-		err = mlog_logblocks_flush(mp, layout, skip_ser);
+		err = mlog_logblocks_flush(mp, layout, false, skip_ser);
 		lstat->lst_abdirty = false;
 		if (ev(err))
 			mp_pr_err("mpool %s, mlog 0x%lx close, log block flush failed",
 				  err, mp->pds_name, (ulong)layout->eld_objid);
+	} else {
+		err = mlog_af_wait(lstat);
+		if (ev(err))
+			mp_pr_err("mpool %s, mlog 0x%lx close, background log block flush failed",
+				  err, mp->pds_name, (ulong)layout->eld_objid);
 	}
 
-	oml_layout_lock(mp);
-	oml_layout_remove(mp, layout->eld_objid);
-	oml_layout_unlock(mp);
+	oml_layout_remove(mp, layout);
 
 	mlog_stat_free(layout);
 
 	/* Reset Mlog flags */
-	layout->eld_flags &= (~MLOG_OF_SKIP_SER);
+	layout->eld_flags &= ~(MLOG_OF_SKIP_SER | MLOG_OF_GROUP_COMMIT);
 
 	pmd_obj_wrunlock(layout);
 
@@ -2003,12 +2893,15 @@ merr_t mlog_erase(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, u64
 	struct pmd_layout  *layout = mlog2layout(mlh);
 	struct mlog_stat   *lstat = NULL;
 	u64                 newgen = 0;
+	u64                 start, tio;
 	merr_t              err = 0;
 
 	if (!layout)
 		return merr(EINVAL);
 
+	start = ktime_get_ns();
 	pmd_obj_wrlock(layout);
+	mlog_lat_add(mp, MLOG_LAT_ERASE_LOCK, start);
 
 	/* Must be committed to log erase start/end markers */
 	if (!(layout->eld_state & PMD_LYT_COMMITTED)) {
@@ -2032,7 +2925,12 @@ merr_t mlog_erase(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, u64
 		return err;
 	}
 
+	/* The erase must not race with a background append buffer flush */
+	mlog_af_free(&layout->eld_lstat);
+
+	tio = ktime_get_ns();
 	err = pmd_layout_erase(mp, layout);
+	mlog_lat_add(mp, MLOG_LAT_ERASE_IO, tio);
 	if (err) {
 		/*
 		 * Log the failure as a debugging message, but ignore the
@@ -2047,17 +2945,228 @@ merr_t mlog_erase(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, u64
 	lstat = &layout->eld_lstat;
 	if (lstat->lst_abuf) {
 		/* Log is open so need to update lstat info */
+		mlog_ra_free(lstat);
 		mlog_free_abuf(lstat, 0, lstat->lst_abidx);
 		mlog_free_rbuf(lstat, 0, MLOG_NLPGMB(lstat) - 1);
 
 		mlog_stat_init_common(layout, lstat);
+
+		/* Group commit failures don't outlive the data they lost */
+		lstat->lst_gcerr = 0;
 	}
 
 	pmd_obj_wrunlock(layout);
 
+	mlog_lat_add(mp, MLOG_LAT_ERASE, start);
+
 	return err;
 }
 
+/**
+ * struct mlog_spare - an mlog queued for erase or held in the spare pool
+ * @ms_link:   msp_listv linkage
+ * @ms_work:   erase work, runs on the MPOOL_WQ_ERASE workqueue
+ * @ms_mp:
+ * @ms_layout: mlog layout; the entry holds a reference on it
+ * @ms_mingen: mingen argument of mlog_erase()
+ * @ms_spare:  true to pool the mlog once erased
+ * @ms_flags:  flags the mlog was open with when queued, to reopen it with
+ */
+struct mlog_spare {
+	struct list_head            ms_link;
+	struct work_struct          ms_work;
+	struct mpool_descriptor    *ms_mp;
+	struct pmd_layout          *ms_layout;
+	u64                         ms_mingen;
+	bool                        ms_spare;
+	u8                          ms_flags;
+};
+
+/* The flags an open mlog was opened with, 0 if it isn't open */
+static u8 mlog_open_flags(struct pmd_layout *layout)
+{
+	struct mlog_stat   *lstat = &layout->eld_lstat;
+	u8                  flags = 0;
+
+	pmd_obj_rdlock(layout);
+	if (lstat->lst_abuf) {
+		flags = layout->eld_flags & (MLOG_OF_SKIP_SER | MLOG_OF_GROUP_COMMIT);
+		if (lstat->lst_csem)
+			flags |= MLOG_OF_COMPACT_SEM;
+		if (lstat->lst_ridx)
+			flags |= MLOG_OF_RECIDX;
+	}
+	pmd_obj_rdunlock(layout);
+
+	return flags;
+}
+
+static void mlog_erase_work(struct work_struct *work)
+{
+	struct mpool_descriptor    *mp;
+	struct mlog_descriptor     *mlh;
+	struct mlog_spares         *msp;
+	struct mlog_spare          *ms;
+	enum mp_media_classp        mclass;
+	u64                         gen;
+	merr_t                      err;
+
+	ms = container_of(work, struct mlog_spare, ms_work);
+	mp = ms->ms_mp;
+	msp = &mp->pds_mlspares;
+	mlh = layout2mlog(ms->ms_layout);
+
+	err = mlog_erase(mp, mlh, ms->ms_mingen);
+	if (!err && ms->ms_spare)
+		err = mlog_open(mp, mlh, ms->ms_flags, &gen);
+
+	if (!err && ms->ms_spare) {
+		mclass = mp->pds_pdv[ms->ms_layout->eld_ld.ol_pdh].pdi_mclass;
+
+		spin_lock(&msp->msp_lock);
+		list_add_tail(&ms->ms_link, &msp->msp_listv[mclass]);
+		msp->msp_cntv[mclass]++;
+		spin_unlock(&msp->msp_lock);
+	} else {
+		if (err)
+			mp_pr_err("mpool %s, background erase of mlog 0x%lx failed",
+				  err, mp->pds_name, (ulong)ms->ms_layout->eld_objid);
+
+		spin_lock(&msp->msp_lock);
+		ms->ms_layout->eld_mlpriv.mlp_eraseq = false;
+		spin_unlock(&msp->msp_lock);
+
+		pmd_obj_put(mp, ms->ms_layout);
+		kfree(ms);
+	}
+
+	if (atomic_dec_and_test(&msp->msp_pending))
+		wake_up_all(&msp->msp_wq);
+}
+
+merr_t
+mlog_erase_async(
+	struct mpool_descriptor    *mp,
+	struct mlog_descriptor     *mlh,
+	u64                         mingen,
+	bool                        spare)
+{
+	struct pmd_layout  *layout = mlog2layout(mlh);
+	struct mlog_spares *msp = &mp->pds_mlspares;
+	struct mlog_spare  *ms;
+	bool                queued;
+
+	if (!layout)
+		return merr(EINVAL);
+
+	if (!(READ_ONCE(layout->eld_state) & PMD_LYT_COMMITTED))
+		return merr(EINVAL);
+
+	ms = kmalloc(sizeof(*ms), GFP_KERNEL);
+	if (!ms)
+		return merr(ENOMEM);
+
+	spin_lock(&msp->msp_lock);
+	queued = layout->eld_mlpriv.mlp_eraseq;
+	layout->eld_mlpriv.mlp_eraseq = true;
+	spin_unlock(&msp->msp_lock);
+
+	if (queued) {
+		kfree(ms);
+		return merr(EBUSY);
+	}
+
+	kref_get(&layout->eld_ref);
+
+	INIT_WORK(&ms->ms_work, mlog_erase_work);
+	ms->ms_mp = mp;
+	ms->ms_layout = layout;
+	ms->ms_mingen = mingen;
+	ms->ms_spare = spare;
+	ms->ms_flags = mlog_open_flags(layout);
+
+	atomic_inc(&mp->pds_mlspares.msp_pending);
+	mpool_queue_work(mp, MPOOL_WQ_ERASE, &ms->ms_work);
+
+	return 0;
+}
+
+merr_t
+mlog_spare_get(
+	struct mpool_descriptor    *mp,
+	enum mp_media_classp        mclassp,
+	struct mlog_descriptor    **mlh)
+{
+	struct mlog_spares *msp = &mp->pds_mlspares;
+	struct mlog_spare  *ms;
+
+	*mlh = NULL;
+
+	if (mclassp >= MP_MED_NUMBER)
+		return merr(EINVAL);
+
+	spin_lock(&msp->msp_lock);
+	ms = list_first_entry_or_null(&msp->msp_listv[mclassp], struct mlog_spare, ms_link);
+	if (ms) {
+		list_del(&ms->ms_link);
+		msp->msp_cntv[mclassp]--;
+		ms->ms_layout->eld_mlpriv.mlp_eraseq = false;
+	}
+	spin_unlock(&msp->msp_lock);
+
+	if (!ms)
+		return merr(ENOENT);
+
+	/* The pool's reference passes to the caller */
+	*mlh = layout2mlog(ms->ms_layout);
+	kfree(ms);
+
+	return 0;
+}
+
+u32 mlog_spare_cnt(struct mpool_descriptor *mp, enum mp_media_classp mclassp)
+{
+	if (mclassp >= MP_MED_NUMBER)
+		return 0;
+
+	return READ_ONCE(mp->pds_mlspares.msp_cntv[mclassp]);
+}
+
+void mlog_spares_init(struct mpool_descriptor *mp)
+{
+	struct mlog_spares *msp = &mp->pds_mlspares;
+	int                 i;
+
+	spin_lock_init(&msp->msp_lock);
+	for (i = 0; i < MP_MED_NUMBER; i++)
+		INIT_LIST_HEAD(&msp->msp_listv[i]);
+	atomic_set(&msp->msp_pending, 0);
+	init_waitqueue_head(&msp->msp_wq);
+}
+
+void mlog_spares_fini(struct mpool_descriptor *mp)
+{
+	struct mlog_spares *msp = &mp->pds_mlspares;
+	struct mlog_spare  *ms, *next;
+	LIST_HEAD(list);
+	int                 i;
+
+	wait_event(msp->msp_wq, atomic_read(&msp->msp_pending) == 0);
+
+	spin_lock(&msp->msp_lock);
+	for (i = 0; i < MP_MED_NUMBER; i++) {
+		list_splice_tail_init(&msp->msp_listv[i], &list);
+		msp->msp_cntv[i] = 0;
+	}
+	spin_unlock(&msp->msp_lock);
+
+	list_for_each_entry_safe(ms, next, &list, ms_link) {
+		ms->ms_layout->eld_mlpriv.mlp_eraseq = false;
+		pmd_obj_put(mp, ms->ms_layout);
+		kfree(ms);
+	}
+}
+
 /**
  * mlog_update_append_idx()
  *
@@ -2176,7 +3285,7 @@ mlog_append_marker(
 	if (mlog_append_dmax(mp, layout) == -1) {
 		/* Mlog is already full, flush whatever we can */
 		if (lstat->lst_abdirty) {
-			(void)mlog_logblocks_flush(mp, layout, skip_ser);
+			(void)mlog_logblocks_flush(mp, layout, false, skip_ser);
 			lstat->lst_abdirty = false;
 		}
 
@@ -2201,7 +3310,7 @@ mlog_append_marker(
 	err = omf_logrec_desc_pack_htole(&lrd, &abuf[lpgoff + aoff]);
 	if (!err) {
 		lstat->lst_aoff = aoff + OMF_LOGREC_DESC_PACKLEN;
-		err = mlog_logblocks_flush(mp, layout, skip_ser);
+		err = mlog_logblocks_flush(mp, layout, false, skip_ser);
 		lstat->lst_abdirty = false;
 		if (err)
 			mp_pr_err("mpool %s, mlog 0x%lx log block flush failed",
@@ -2405,6 +3514,9 @@ mlog_append_data_internal(
 	u16        asidx;
 	u16        nseclpg;
 	int        cpidx;
+	u64        tcopy;
+	off_t      recsoff = -1;
+	u16        recroff = 0;
 
 	mlog_extract_fsetparms(lstat, &sectsz, &datasec, NULL, &nseclpg);
 
@@ -2438,6 +3550,11 @@ mlog_append_data_internal(
 
 		assert(abuf != NULL);
 
+		if (recsoff < 0) {
+			recsoff = lstat->lst_wsoff;
+			recroff = aoff;
+		}
+
 		rlenmax = min((u64)(sectsz - aoff - OMF_LOGREC_DESC_PACKLEN),
 			      (u64)OMF_LOGREC_DESC_RLENMAX);
 
@@ -2468,7 +3585,9 @@ mlog_append_data_internal(
 
 		aoff = aoff + OMF_LOGREC_DESC_PACKLEN;
 		if (lrd.olr_rlen) {
+			tcopy = ktime_get_ns();
 			memcpy_from_iov(iov, &abuf[lpgoff + aoff], lrd.olr_rlen, &cpidx);
+			mlog_lat_add(mp, MLOG_LAT_APPEND_COPY, tcopy);
 			aoff   = aoff + lrd.olr_rlen;
 			bufoff = bufoff + lrd.olr_rlen;
 		}
@@ -2481,8 +3600,9 @@ mlog_append_data_internal(
 		if ((sync && buflen == bufoff) ||
 			(abidx == MLOG_NLPGMB(lstat) - 1 && asidx == nseclpg - 1 &&
 			 sectsz - aoff < OMF_LOGREC_DESC_PACKLEN)) {
+			bool async = !(sync && buflen == bufoff);
 
-			err = mlog_logblocks_flush(mp, layout, skip_ser);
+			err = mlog_logblocks_flush(mp, layout, async, skip_ser);
 			lstat->lst_abdirty = false;
 			if (err) {
 				mp_pr_err("mpool %s, mlog 0x%lx, log block flush failed",
@@ -2491,106 +3611,390 @@ mlog_append_data_internal(
 			}
 		}
 
-		assert(err == 0);
-		if (bufoff == buflen)
-			break;
-	}
+		assert(err == 0);
+		if (bufoff == buflen)
+			break;
+	}
+
+	if (!err)
+		mlog_ridx_add(lstat, recsoff, recroff);
+
+	return err;
+}
+
+/**
+ * mlog_gcsync() - Wait for a group commit append to be on media
+ *
+ * @mp:     mpool descriptor
+ * @layout: layout descriptor
+ * @seq:    lst_gcseq assigned to the append
+ *
+ * The first writer to get lst_gclock becomes the leader and flushes
+ * everything appended so far, including the appends of the writers queued
+ * up behind it on lst_gclock, which then find their append already flushed.
+ * Writers appending while the leader flushes queue up on lst_gclock, which
+ * is what forms the next group.
+ *
+ * A failed flush fails all the appends past the last successful one until
+ * the mlog is erased or closed, as later flushes can't make them durable.
+ */
+static merr_t mlog_gcsync(struct mpool_descriptor *mp, struct pmd_layout *layout, u64 seq)
+{
+	struct mlog_stat   *lstat = &layout->eld_lstat;
+
+	merr_t err = 0;
+	u64    target;
+
+	mutex_lock(&lstat->lst_gclock);
+	pmd_obj_wrlock(layout);
+
+	if (lstat->lst_gcerr && seq > lstat->lst_gcerrlo) {
+		err = lstat->lst_gcerr;
+		goto unlock;
+	}
+
+	if (seq <= lstat->lst_gcdone)
+		goto unlock;
+
+	target = lstat->lst_gcseq;
+
+	if (!lstat->lst_abuf) {
+		err = merr(ENOENT);
+	} else if (lstat->lst_abdirty) {
+		err = mlog_logblocks_flush(mp, layout, false, false);
+		lstat->lst_abdirty = false;
+	} else {
+		err = mlog_af_wait(lstat);
+	}
+
+	if (ev(err)) {
+		mp_pr_err("mpool %s, mlog 0x%lx group commit flush failed",
+			  err, mp->pds_name, (ulong)layout->eld_objid);
+
+		lstat->lst_gcerrlo = lstat->lst_gcdone;
+		lstat->lst_gcerr   = err;
+	}
+
+	lstat->lst_gcdone = target;
+
+unlock:
+	pmd_obj_wrunlock(layout);
+	mutex_unlock(&lstat->lst_gclock);
+
+	return err;
+}
+
+/**
+ * mlog_append_check() - Check that a record of buflen bytes can be appended
+ *
+ * @mp:       mpool descriptor
+ * @layout:   layout descriptor, write locked unless skip_ser
+ * @buflen:   length of the record
+ * @skip_ser: client guarantees serialization
+ *
+ * Flushes whatever it can if the mlog is full.
+ */
+static merr_t
+mlog_append_check(struct mpool_descriptor *mp, struct pmd_layout *layout, u64 buflen,
+		  bool skip_ser)
+{
+	struct mlog_stat   *lstat = &layout->eld_lstat;
+
+	merr_t err = 0;
+	s64    dmax;
+
+	if (!lstat->lst_abuf) {
+		err = merr(ENOENT);
+		mp_pr_err("mpool %s, mlog 0x%lx, inconsistency: no mlog status",
+			  err, mp->pds_name, (ulong)layout->eld_objid);
+	} else if (lstat->lst_csem && !lstat->lst_cstart) {
+		err = merr(EINVAL);
+		mp_pr_err("mpool %s, mlog 0x%lx, inconsistent state %u %u", err, mp->pds_name,
+			  (ulong)layout->eld_objid, lstat->lst_csem, lstat->lst_cstart);
+	} else {
+		dmax = mlog_append_dmax(mp, layout);
+		if (dmax < 0 || buflen > dmax) {
+			err = merr(EFBIG);
+			mp_pr_debug("mpool %s, mlog 0x%lx mlog full %ld",
+				    err, mp->pds_name, (ulong)layout->eld_objid, (long)dmax);
+
+			/* Flush whatever we can. */
+			if (lstat->lst_abdirty) {
+				(void)mlog_logblocks_flush(mp, layout, false, skip_ser);
+				lstat->lst_abdirty = false;
+			}
+		}
+	}
+
+	return err;
+}
+
+/**
+ * mlog_append_datav():
+ */
+static merr_t
+mlog_append_datav(
+	struct mpool_descriptor *mp,
+	struct mlog_descriptor  *mlh,
+	struct kvec             *iov,
+	u64                      buflen,
+	int                      sync)
+{
+	struct pmd_layout  *layout = mlog2layout(mlh);
+	struct mlog_stat   *lstat;
+
+	merr_t err   = 0;
+	u64    seq   = 0;
+	u64    start;
+	bool   skip_ser  = false;
+	bool   gcommit   = false;
+
+	if (!layout)
+		return merr(EINVAL);
+
+	start = ktime_get_ns();
+
+	if (layout->eld_flags & MLOG_OF_SKIP_SER)
+		skip_ser = true;
+
+	/* Sync appends share flushes, see mlog_gcsync() */
+	if (sync && (layout->eld_flags & MLOG_OF_GROUP_COMMIT)) {
+		gcommit = true;
+		sync = 0;
+	}
+
+	if (!skip_ser) {
+		pmd_obj_wrlock(layout);
+		mlog_lat_add(mp, MLOG_LAT_APPEND_LOCK, start);
+	}
+
+	lstat = &layout->eld_lstat;
+
+	err = mlog_append_check(mp, layout, buflen, skip_ser);
+	if (ev(err)) {
+		if (!skip_ser)
+			pmd_obj_wrunlock(layout);
+		return err;
+	}
+
+	err = mlog_append_data_internal(mp, mlh, iov, buflen, sync, skip_ser);
+	if (ev(err)) {
+		mp_pr_err("mpool %s, mlog 0x%lx append failed",
+			  err, mp->pds_name, (ulong)layout->eld_objid);
+
+		/* Flush whatever we can. */
+		if (lstat->lst_abdirty) {
+			(void)mlog_logblocks_flush(mp, layout, false, skip_ser);
+			lstat->lst_abdirty = false;
+		}
+	} else if (gcommit) {
+		seq = ++lstat->lst_gcseq;
+	}
+
+	if (!skip_ser)
+		pmd_obj_wrunlock(layout);
+
+	if (seq)
+		err = mlog_gcsync(mp, layout, seq);
+
+	mlog_lat_add(mp, MLOG_LAT_APPEND, start);
+
+	if (trace_mpool_mlog_append_enabled())
+		trace_mpool_mlog_append(mp, layout->eld_objid, layout->eld_ld.ol_pdh, buflen,
+					sync || gcommit, ktime_get_ns() - start, err);
+
+	return err;
+}
+
+/**
+ * mlog_append_data()
+ */
+merr_t
+mlog_append_data(
+	struct mpool_descriptor *mp,
+	struct mlog_descriptor  *mlh,
+	char                    *buf,
+	u64                      buflen,
+	int                      sync)
+{
+	struct kvec iov;
+
+	iov.iov_base = buf;
+	iov.iov_len  = buflen;
 
-	return err;
+	return mlog_append_datav(mp, mlh, &iov, buflen, sync);
 }
 
 /**
- * mlog_append_datav():
+ * mlog_append_recv() - Append a batch of data records
+ *
+ * @mp:        mpool descriptor
+ * @mlh:       mlog descriptor
+ * @recv:      one kvec per record
+ * @recc:      number of records
+ * @sync:      MLOG_APPEND_NOSYNC, MLOG_APPEND_SYNC or MLOG_APPEND_ASYNC
+ * @appendedp: (output) number of records appended (may be NULL)
+ *
+ * The records are packed back to back into the CFS under a single
+ * acquisition of the layout lock.  For MLOG_APPEND_SYNC only the last
+ * record waits for the CFS to be flushed, and for MLOG_APPEND_ASYNC the
+ * CFS is written in the background and the outcome is reported by the
+ * next flush (e.g., mlog_flush()).
+ *
+ * On failure the first *appendedp records have been appended, and for
+ * MLOG_APPEND_SYNC they have been flushed as best as possible.
  */
-static merr_t
-mlog_append_datav(
+merr_t
+mlog_append_recv(
 	struct mpool_descriptor *mp,
 	struct mlog_descriptor  *mlh,
-	struct kvec             *iov,
-	u64                      buflen,
-	int                      sync)
+	const struct kvec       *recv,
+	int                      recc,
+	int                      sync,
+	int                     *appendedp)
 {
 	struct pmd_layout  *layout = mlog2layout(mlh);
 	struct mlog_stat   *lstat;
 
 	merr_t err   = 0;
-	s64    dmax  = 0;
+	u64    seq   = 0;
+	u64    total = 0;
+	u64    start;
 	bool   skip_ser  = false;
+	bool   gcommit   = false;
+	int    i;
 
-	if (!layout)
+	if (appendedp)
+		*appendedp = 0;
+
+	if (!layout || recc < 0 || (recc > 0 && !recv))
+		return merr(EINVAL);
+
+	if (sync != MLOG_APPEND_NOSYNC && sync != MLOG_APPEND_SYNC && sync != MLOG_APPEND_ASYNC)
 		return merr(EINVAL);
 
+	start = ktime_get_ns();
+
 	if (layout->eld_flags & MLOG_OF_SKIP_SER)
 		skip_ser = true;
 
-	if (!skip_ser)
+	/* Sync appends share flushes, see mlog_gcsync() */
+	if (sync == MLOG_APPEND_SYNC && (layout->eld_flags & MLOG_OF_GROUP_COMMIT)) {
+		gcommit = true;
+		sync = MLOG_APPEND_NOSYNC;
+	}
+
+	if (!skip_ser) {
 		pmd_obj_wrlock(layout);
+		mlog_lat_add(mp, MLOG_LAT_APPEND_LOCK, start);
+	}
 
 	lstat = &layout->eld_lstat;
-	if (!lstat->lst_abuf) {
-		err = merr(ENOENT);
-		mp_pr_err("mpool %s, mlog 0x%lx, inconsistency: no mlog status",
-			  err, mp->pds_name, (ulong)layout->eld_objid);
-	} else if (lstat->lst_csem && !lstat->lst_cstart) {
-		err = merr(EINVAL);
-		mp_pr_err("mpool %s, mlog 0x%lx, inconsistent state %u %u", err, mp->pds_name,
-			  (ulong)layout->eld_objid, lstat->lst_csem, lstat->lst_cstart);
-	} else {
-		dmax = mlog_append_dmax(mp, layout);
-		if (dmax < 0 || buflen > dmax) {
-			err = merr(EFBIG);
-			mp_pr_debug("mpool %s, mlog 0x%lx mlog full %ld",
-				    err, mp->pds_name, (ulong)layout->eld_objid, (long)dmax);
+
+	for (i = 0; i < recc; ++i) {
+		struct kvec iov = recv[i];  /* consumed by mlog_append_data_internal() */
+		bool        last = (i == recc - 1);
+
+		err = mlog_append_check(mp, layout, iov.iov_len, skip_ser);
+		if (ev(err))
+			break;
+
+		err = mlog_append_data_internal(mp, mlh, &iov, iov.iov_len,
+						last && sync == MLOG_APPEND_SYNC, skip_ser);
+		if (ev(err)) {
+			mp_pr_err("mpool %s, mlog 0x%lx append %d of %d failed",
+				  err, mp->pds_name, (ulong)layout->eld_objid, i, recc);
 
 			/* Flush whatever we can. */
 			if (lstat->lst_abdirty) {
-				(void)mlog_logblocks_flush(mp, layout, skip_ser);
+				(void)mlog_logblocks_flush(mp, layout, false, skip_ser);
 				lstat->lst_abdirty = false;
 			}
+			break;
 		}
-	}
 
-	if (ev(err)) {
-		if (!skip_ser)
-			pmd_obj_wrunlock(layout);
-		return err;
+		total += recv[i].iov_len;
 	}
 
-	err = mlog_append_data_internal(mp, mlh, iov, buflen, sync, skip_ser);
-	if (ev(err)) {
-		mp_pr_err("mpool %s, mlog 0x%lx append failed",
-			  err, mp->pds_name, (ulong)layout->eld_objid);
+	if (appendedp)
+		*appendedp = i;
 
-		/* Flush whatever we can. */
-		if (lstat->lst_abdirty) {
-			(void)mlog_logblocks_flush(mp, layout, skip_ser);
+	if (!err) {
+		if (sync == MLOG_APPEND_ASYNC && lstat->lst_abdirty) {
+			err = mlog_logblocks_flush(mp, layout, true, skip_ser);
 			lstat->lst_abdirty = false;
+			if (ev(err))
+				mp_pr_err("mpool %s, mlog 0x%lx async flush failed",
+					  err, mp->pds_name, (ulong)layout->eld_objid);
+		} else if (gcommit && recc > 0) {
+			seq = ++lstat->lst_gcseq;
 		}
 	}
 
 	if (!skip_ser)
 		pmd_obj_wrunlock(layout);
 
+	if (seq)
+		err = mlog_gcsync(mp, layout, seq);
+
+	mlog_lat_add(mp, MLOG_LAT_APPEND, start);
+
+	if (trace_mpool_mlog_append_enabled())
+		trace_mpool_mlog_append(mp, layout->eld_objid, layout->eld_ld.ol_pdh, total,
+					sync != MLOG_APPEND_NOSYNC || gcommit,
+					ktime_get_ns() - start, err);
+
 	return err;
 }
 
 /**
- * mlog_append_data()
+ * mlog_flush()
+ *
+ * Flush the current CFS if it holds records appended without sync, and wait
+ * for any CFS being flushed in the background.
  */
-merr_t
-mlog_append_data(
-	struct mpool_descriptor *mp,
-	struct mlog_descriptor  *mlh,
-	char                    *buf,
-	u64                      buflen,
-	int                      sync)
+merr_t mlog_flush(struct mpool_descriptor *mp, struct mlog_descriptor *mlh)
 {
-	struct kvec iov;
+	struct pmd_layout  *layout = mlog2layout(mlh);
+	struct mlog_stat   *lstat;
 
-	iov.iov_base = buf;
-	iov.iov_len  = buflen;
+	merr_t err = 0;
+	u64    start;
+	bool   skip_ser = false;
 
-	return mlog_append_datav(mp, mlh, &iov, buflen, sync);
+	if (!layout)
+		return merr(EINVAL);
+
+	if (layout->eld_flags & MLOG_OF_SKIP_SER)
+		skip_ser = true;
+
+	if (!skip_ser) {
+		start = ktime_get_ns();
+		pmd_obj_wrlock(layout);
+		mlog_lat_add(mp, MLOG_LAT_FLUSH_LOCK, start);
+	}
+
+	lstat = &layout->eld_lstat;
+	if (!lstat->lst_abuf) {
+		err = merr(ENOENT);
+	} else if (lstat->lst_abdirty) {
+		err = mlog_logblocks_flush(mp, layout, false, skip_ser);
+		lstat->lst_abdirty = false;
+		if (ev(err))
+			mp_pr_err("mpool %s, mlog 0x%lx flush failed",
+				  err, mp->pds_name, (ulong)layout->eld_objid);
+	} else {
+		/* Nothing left to flush but what's in the background */
+		err = mlog_af_wait(lstat);
+		if (ev(err))
+			mp_pr_err("mpool %s, mlog 0x%lx background flush failed",
+				  err, mp->pds_name, (ulong)layout->eld_objid);
+	}
+
+	if (!skip_ser)
+		pmd_obj_wrunlock(layout);
+
+	return err;
 }
 
 /**
@@ -2641,7 +4045,7 @@ mlog_logblocks_load_media(struct mpool_descriptor *mp, struct mlog_read_iter *lr
 	struct pmd_layout  *layout = lri->lri_layout;
 	struct mlog_stat   *lstat = &layout->eld_lstat;
 
-	off_t  rsoff;
+	off_t  rsoff, eoff;
 	int    remsec;
 	u16    maxsec, nsecs, sectsz;
 	merr_t err;
@@ -2668,6 +4072,7 @@ mlog_logblocks_load_media(struct mpool_descriptor *mp, struct mlog_read_iter *lr
 	lri->lri_rbidx = 0;
 	lri->lri_sidx  = 0;
 
+	eoff    = remsec;
 	rsoff   = lri->lri_soff;
 	remsec -= rsoff;
 	assert(remsec > 0);
@@ -2676,7 +4081,7 @@ mlog_logblocks_load_media(struct mpool_descriptor *mp, struct mlog_read_iter *lr
 	if (layout->eld_flags & MLOG_OF_SKIP_SER)
 		skip_ser = true;
 
-	err = mlog_populate_rbuf(mp, lri->lri_layout, &nsecs, &rsoff, skip_ser);
+	err = mlog_populate_rbuf(mp, lri->lri_layout, &nsecs, &rsoff, eoff, skip_ser);
 	if (err) {
 		mp_pr_err("mpool %s, objid 0x%lx, mlog read failed, nsecs: %u, rsoff: 0x%lx",
 			  err, mp->pds_name, (ulong)lri->lri_layout->eld_objid, nsecs, rsoff);
@@ -2894,6 +4299,21 @@ out:
 	return err;
 }
 
+/**
+ * mlog_rbuf_release() - Give back the read buffer of a reader at end of log
+ * @lstat: mlog_stat
+ *
+ * A log is typically read once, up to its end, then only appended to.
+ */
+static void mlog_rbuf_release(struct mlog_stat *lstat)
+{
+	mlog_ra_free(lstat);
+	mlog_free_rbuf(lstat, 0, MLOG_NLPGMB(lstat) - 1);
+
+	lstat->lst_rsoff  = -1;
+	lstat->lst_rseoff = -1;
+}
+
 /**
  * mlog_read_data_next_impl()
  * @mp:
@@ -2926,6 +4346,7 @@ mlog_read_data_next_impl(
 	bool    recfirst = false;
 	char   *inbuf = NULL;
 	u32     sectsz = 0;
+	u64     start;
 	bool    skip_ser = false;
 	merr_t  err = 0;
 
@@ -2938,12 +4359,16 @@ mlog_read_data_next_impl(
 
 	if (layout->eld_flags & MLOG_OF_SKIP_SER)
 		skip_ser = true;
+	start = ktime_get_ns();
+
 	/*
 	 * Need write lock because loading log block to read updates lstat.
 	 * Currently have no use case requiring support for concurrent readers.
 	 */
-	if (!skip_ser)
+	if (!skip_ser) {
 		pmd_obj_wrlock(layout);
+		mlog_lat_add(mp, MLOG_LAT_READ_LOCK, start);
+	}
 
 	lstat = &layout->eld_lstat;
 	if (lstat->lst_abuf) {
@@ -2981,6 +4406,8 @@ mlog_read_data_next_impl(
 	}
 
 	if (err) {
+		if (merr_errno(err) == ENOMSG)
+			mlog_rbuf_release(lstat);
 		if (!skip_ser)
 			pmd_obj_wrunlock(layout);
 		if (merr_errno(err) == ENOMSG) {
@@ -3000,6 +4427,7 @@ mlog_read_data_next_impl(
 		err = mlog_logblock_load(mp, lri, &inbuf, &recfirst);
 		if (err) {
 			if (merr_errno(err) == ENOMSG) {
+				mlog_rbuf_release(lstat);
 				if (!skip_ser)
 					pmd_obj_wrunlock(layout);
 				err = 0;
@@ -3125,6 +4553,8 @@ mlog_read_data_next_impl(
 	if (!skip_ser)
 		pmd_obj_wrunlock(layout);
 
+	mlog_lat_add(mp, MLOG_LAT_READ, start);
+
 	return err;
 }
 
@@ -3156,6 +4586,107 @@ mlog_read_data_next(
 	return mlog_read_data_next_impl(mp, mlh, false, buf, buflen, rdlen);
 }
 
+/**
+ * mlog_ridx_find() - Find the closest indexed record at or before recno
+ * @layout: mlog layout, locked by the caller
+ * @recno:
+ * @ent:    (output)
+ */
+static merr_t mlog_ridx_find(struct pmd_layout *layout, u64 recno, struct mlog_ridx_ent *ent)
+{
+	struct mlog_stat   *lstat = &layout->eld_lstat;
+	u32                 lo, hi, mid;
+
+	if (!lstat->lst_abuf)
+		return merr(ENOENT);
+
+	if (!lstat->lst_ridx)
+		return merr(EOPNOTSUPP);
+
+	if (recno > lstat->lst_recnum)
+		return merr(ERANGE);
+
+	lo = 0;
+	hi = lstat->lst_ridxcnt;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if (lstat->lst_ridx[mid].mre_recno <= recno)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo > 0) {
+		*ent = lstat->lst_ridx[lo - 1];
+	} else {
+		/* Empty log: a zero record offset is the start of the first log block */
+		ent->mre_recno = 0;
+		ent->mre_soff  = 0;
+		ent->mre_roff  = 0;
+	}
+
+	return 0;
+}
+
+merr_t
+mlog_ridx_lookup(
+	struct mpool_descriptor    *mp,
+	struct mlog_descriptor     *mlh,
+	u64                         recno,
+	struct mlog_ridx_ent       *ent)
+{
+	struct pmd_layout  *layout = mlog2layout(mlh);
+	merr_t              err;
+
+	if (!layout || !ent)
+		return merr(EINVAL);
+
+	pmd_obj_rdlock(layout);
+	err = mlog_ridx_find(layout, recno, ent);
+	pmd_obj_rdunlock(layout);
+
+	return err;
+}
+
+merr_t mlog_read_data_seek(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, u64 recno)
+{
+	struct pmd_layout      *layout = mlog2layout(mlh);
+	struct mlog_read_iter  *lri;
+	struct mlog_ridx_ent    ent;
+	u64                     skip, rdlen;
+	merr_t                  err;
+
+	if (!layout)
+		return merr(EINVAL);
+
+	pmd_obj_wrlock(layout);
+
+	err = mlog_ridx_find(layout, recno, &ent);
+	if (!err) {
+		lri = &layout->eld_lstat.lst_citr;
+
+		mlog_read_iter_init(layout, &layout->eld_lstat, lri);
+		lri->lri_soff = ent.mre_soff;
+		lri->lri_roff = ent.mre_roff;
+	}
+
+	pmd_obj_wrunlock(layout);
+
+	if (err)
+		return err;
+
+	/* Records up to recno all start within MLOG_RIDX_SPAN of the entry */
+	for (skip = recno - ent.mre_recno; skip > 0; skip--) {
+		err = mlog_read_data_next_impl(mp, mlh, true, NULL, U64_MAX, &rdlen);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
 /**
  * mlog_get_props()
  *
@@ -3211,39 +4742,195 @@ mlog_get_props_ex(
 	return 0;
 }
 
+/*
+ * MLOG_CLOSEALL_BATCH: open mlogs collected by one walk of pds_oml
+ */
+#define MLOG_CLOSEALL_BATCH     32
+
 /**
  * mlogutil_closeall() -
  *
  * Close all open user (non-mdc) mlogs in mpool and release resources;
  * this is an mpool deactivation utility and not part of the mlog user API.
+ *
+ * Releasing an mlog may wait for its in-flight I/O, so the open mlogs are
+ * collected in batches under RCU and released outside of it.
  */
 void mlogutil_closeall(struct mpool_descriptor *mp)
 {
-	struct pmd_layout_mlpriv   *this, *tmp;
+	struct pmd_layout          *batch[MLOG_CLOSEALL_BATCH];
+	struct rhashtable_iter      iter;
 	struct pmd_layout          *layout;
+	int                         cnt, i;
 
-	oml_layout_lock(mp);
+	do {
+		cnt = 0;
 
-	rbtree_postorder_for_each_entry_safe(
-		this, tmp, &mp->pds_oml_root, mlp_nodeoml) {
+		rhashtable_walk_enter(&mp->pds_oml, &iter);
+		rhashtable_walk_start(&iter);
 
-		layout = mlpriv2layout(this);
+		while (cnt < MLOG_CLOSEALL_BATCH) {
+			layout = rhashtable_walk_next(&iter);
+			if (IS_ERR(layout)) {
+				if (PTR_ERR(layout) == -EAGAIN)
+					continue;
+				break;
+			}
 
-		if (pmd_objid_type(layout->eld_objid) != OMF_OBJ_MLOG) {
-			mp_pr_warn("mpool %s, non-mlog object 0x%lx in open mlog layout tree",
-				   mp->pds_name, (ulong)layout->eld_objid);
-			continue;
+			if (!layout)
+				break;
+
+			if (pmd_objid_type(layout->eld_objid) != OMF_OBJ_MLOG) {
+				mp_pr_warn("mpool %s, non-mlog object 0x%lx in open mlog table",
+					   mp->pds_name, (ulong)layout->eld_objid);
+				continue;
+			}
+
+			if (!pmd_objid_isuser(layout->eld_objid))
+				continue;
+
+			batch[cnt++] = layout;
 		}
 
-		if (!pmd_objid_isuser(layout->eld_objid))
-			continue;
+		rhashtable_walk_stop(&iter);
+		rhashtable_walk_exit(&iter);
 
-		/* Remove layout from open list and discard log data. */
-		rb_erase(&this->mlp_nodeoml, &mp->pds_oml_root);
-		mlog_stat_free(layout);
+		/* Remove layouts from the open table and discard log data. */
+		for (i = 0; i < cnt; i++) {
+			oml_layout_remove(mp, batch[i]);
+			mlog_stat_free(batch[i]);
+		}
+	} while (cnt == MLOG_CLOSEALL_BATCH);
+}
+
+/**
+ * struct mlog_flushall_work - flush of the open mlogs of one drive
+ * @fw_work:
+ * @fw_mp:
+ * @fw_pdh:  drive whose mlogs are flushed
+ * @fw_cnt:  (output) mlogs flushed
+ * @fw_err:  (output) first flush error
+ */
+struct mlog_flushall_work {
+	struct work_struct          fw_work;
+	struct mpool_descriptor    *fw_mp;
+	u16                         fw_pdh;
+	uint                        fw_cnt;
+	merr_t                      fw_err;
+};
+
+static void mlogutil_flushall_worker(struct work_struct *work)
+{
+	struct pmd_layout          *batch[MLOG_CLOSEALL_BATCH];
+	struct mlog_flushall_work  *fw;
+	struct mpool_descriptor    *mp;
+	struct rhashtable_iter      iter;
+	struct pmd_layout          *layout;
+	merr_t                      err;
+	int                         cnt, i;
+
+	fw = container_of(work, typeof(*fw), fw_work);
+	mp = fw->fw_mp;
+
+	rhashtable_walk_enter(&mp->pds_oml, &iter);
+
+	do {
+		cnt = 0;
+
+		rhashtable_walk_start(&iter);
+
+		while (cnt < MLOG_CLOSEALL_BATCH) {
+			layout = rhashtable_walk_next(&iter);
+			if (IS_ERR(layout)) {
+				if (PTR_ERR(layout) == -EAGAIN)
+					continue;
+				break;
+			}
+
+			if (!layout)
+				break;
+
+			/*
+			 * MDC mlogs (slot 0) are opened without serialization
+			 * and are flushed by pmd_mdc_flushall() instead.
+			 */
+			if (layout->eld_ld.ol_pdh != fw->fw_pdh ||
+			    pmd_objid_type(layout->eld_objid) != OMF_OBJ_MLOG ||
+			    objid_slot(layout->eld_objid) == 0)
+				continue;
+
+			if (kref_get_unless_zero(&layout->eld_ref))
+				batch[cnt++] = layout;
+		}
+
+		rhashtable_walk_stop(&iter);
+
+		for (i = 0; i < cnt; i++) {
+			err = mlog_flush(mp, layout2mlog(batch[i]));
+			if (!err)
+				fw->fw_cnt++;
+			else if (merr_errno(err) != ENOENT && !fw->fw_err)
+				fw->fw_err = err;
+
+			pmd_obj_put(mp, batch[i]);
+		}
+	} while (cnt == MLOG_CLOSEALL_BATCH);
+
+	rhashtable_walk_exit(&iter);
+}
+
+/**
+ * mlogutil_flushall() -
+ *
+ * Flush the append buffers of all open client mlogs in mpool with one job
+ * per drive on the MPOOL_WQ_FLUSH workqueue, and the MDCs meanwhile from
+ * the caller; this is an mpool deactivation utility which lets the
+ * subsequent serial closes find nothing to write.
+ */
+void mlogutil_flushall(struct mpool_descriptor *mp)
+{
+	struct mlog_flushall_work  *fwv;
+	uint                        cnt = 0;
+	u16                         pdh, pdvcnt;
+
+	pdvcnt = mp->pds_pdvcnt;
+
+	fwv = kcalloc(pdvcnt, sizeof(*fwv), GFP_KERNEL);
+	if (!fwv) {
+		struct mlog_flushall_work fw = { .fw_mp = mp };
+
+		/* Flush inline, one drive at a time */
+		for (pdh = 0; pdh < pdvcnt; pdh++) {
+			fw.fw_pdh = pdh;
+			mlogutil_flushall_worker(&fw.fw_work);
+		}
+
+		pmd_mdc_flushall(mp);
+
+		return;
+	}
+
+	for (pdh = 0; pdh < pdvcnt; pdh++) {
+		fwv[pdh].fw_mp = mp;
+		fwv[pdh].fw_pdh = pdh;
+		INIT_WORK(&fwv[pdh].fw_work, mlogutil_flushall_worker);
+		mpool_queue_work(mp, MPOOL_WQ_FLUSH, &fwv[pdh].fw_work);
+	}
+
+	pmd_mdc_flushall(mp);
+
+	for (pdh = 0; pdh < pdvcnt; pdh++) {
+		flush_work(&fwv[pdh].fw_work);
+
+		cnt += fwv[pdh].fw_cnt;
+		if (fwv[pdh].fw_err)
+			mp_pr_err("mpool %s, pd %s, flushing open mlogs failed",
+				  fwv[pdh].fw_err, mp->pds_name, mp->pds_pdv[pdh].pdi_name);
 	}
 
-	oml_layout_unlock(mp);
+	kfree(fwv);
+
+	mp_pr_debug("mpool %s, flushed %u open mlogs", 0, mp->pds_name, cnt);
 }
 
 void mlog_precompact_alsz(struct mpool_descriptor *mp, struct mlog_descriptor *mlh)
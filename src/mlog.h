@@ -32,6 +32,59 @@ struct mlog_fsetparms {
 	u16    mfp_nseclpg;
 };
 
+struct mlog_readahead;
+struct mlog_aflush;
+struct mlog_bufpool;
+
+/**
+ * enum mlog_lat_op - mlog operations and phases with a latency histogram
+ * @MLOG_LAT_APPEND:        mlog_append_datav() end to end
+ * @MLOG_LAT_APPEND_LOCK:   waiting for the layout lock to append
+ * @MLOG_LAT_APPEND_COPY:   copying the records into the append buffer
+ * @MLOG_LAT_FLUSH:         mlog_logblocks_flush() end to end
+ * @MLOG_LAT_FLUSH_LOCK:    waiting for the layout lock in mlog_flush()
+ * @MLOG_LAT_FLUSH_HDRPACK: packing the log block headers
+ * @MLOG_LAT_FLUSH_IO:      writing the append buffer, synchronous flushes only
+ * @MLOG_LAT_READ:          mlog_read_data_next() end to end
+ * @MLOG_LAT_READ_LOCK:     waiting for the layout lock to read
+ * @MLOG_LAT_READ_IO:       reading a buffer not found in the readahead sets
+ * @MLOG_LAT_ERASE:         mlog_erase() end to end
+ * @MLOG_LAT_ERASE_LOCK:    waiting for the layout lock to erase
+ * @MLOG_LAT_ERASE_IO:      discarding the mlog's zones
+ */
+enum mlog_lat_op {
+	MLOG_LAT_APPEND,
+	MLOG_LAT_APPEND_LOCK,
+	MLOG_LAT_APPEND_COPY,
+	MLOG_LAT_FLUSH,
+	MLOG_LAT_FLUSH_LOCK,
+	MLOG_LAT_FLUSH_HDRPACK,
+	MLOG_LAT_FLUSH_IO,
+	MLOG_LAT_READ,
+	MLOG_LAT_READ_LOCK,
+	MLOG_LAT_READ_IO,
+	MLOG_LAT_ERASE,
+	MLOG_LAT_ERASE_LOCK,
+	MLOG_LAT_ERASE_IO,
+	MLOG_LAT_MAX
+};
+
+/*
+ * Bucket 0 counts latencies below 2^MLOG_LAT_SHIFT ns, bucket i > 0 counts
+ * latencies in [2^(MLOG_LAT_SHIFT + i - 1), 2^(MLOG_LAT_SHIFT + i)) ns and
+ * the last bucket counts everything above (about 4s).
+ */
+#define MLOG_LAT_SHIFT  10
+#define MLOG_LAT_BKTC   24
+
+/**
+ * struct mlog_lat - per-CPU mlog latency histograms of an mpool
+ * @mll_bktv: bucket counts, indexed by enum mlog_lat_op
+ */
+struct mlog_lat {
+	u64    mll_bktv[MLOG_LAT_MAX][MLOG_LAT_BKTC];
+};
+
 /*
  * struct mlog_read_iter -
  *
@@ -53,6 +106,25 @@ struct mlog_read_iter {
 	u8                  lri_valid;
 };
 
+/*
+ * MLOG_RIDX_SPAN: log bytes between two entries of the record index.  A seek
+ * reads at most this much of the log past the entry, well within the 1 MiB
+ * read buffer, so it costs a single device read.
+ */
+#define MLOG_RIDX_SPAN      (256 * 1024)
+
+/**
+ * struct mlog_ridx_ent - record index entry
+ * @mre_recno: data record number
+ * @mre_soff:  LB offset of the log block where the record starts
+ * @mre_roff:  offset of the record descriptor in that log block
+ */
+struct mlog_ridx_ent {
+	u64     mre_recno;
+	u32     mre_soff;
+	u16     mre_roff;
+};
+
 /**
  * struct mlog_stat - mlog open status (referenced by associated
  * struct pmd_layout)
@@ -61,6 +133,7 @@ struct mlog_read_iter {
  * @lst_mfp:     Mlog flush set parameters
  * @lst_abuf:    Append buffer, max 1 MiB size
  * @lst_rbuf:    Read buffer, max 1 MiB size - immutable
+ * @lst_bufs:    Pool lending the pages of lst_abuf, lst_rbuf, lst_ra and lst_af
  * @lst_rsoff:   LB offset of the 1st log block in lst_rbuf
  * @lst_rseoff:  LB offset of the last log block in lst_rbuf
  * @lst_asoff:   LB offset of the 1st log block in CFS
@@ -74,12 +147,34 @@ struct mlog_read_iter {
  * @lst_csem:    enforce compaction semantics if true
  * @lst_cstart:  valid compaction start marker in log?
  * @lst_cend:    valid compaction end marker in log?
+ * @lst_ra:      Read buffer readahead state, allocated on demand
+ * @lst_af:      Append buffer set being flushed in the background, allocated
+ *               on demand
+ * @lst_gclock:  Group commit leader lock, see mlog_gcsync()
+ * @lst_gcseq:   Number of group commit appends, protected by pmd_obj_*lock()
+ * @lst_gcdone:  lst_gcseq as of the last group commit flush
+ * @lst_gcerrlo: lst_gcdone as of the first failed group commit flush
+ * @lst_gcerr:   Status of the first failed group commit flush, sticky for
+ *               appends past lst_gcerrlo until the mlog is erased or closed
+ * @lst_recnum:  Number of complete data records in the log
+ * @lst_ridx:    Record index, NULL unless opened with MLOG_OF_RECIDX
+ * @lst_ridxcnt: Number of valid entries in lst_ridx
+ * @lst_ridxmax: Capacity of lst_ridx
+ * @lst_ridxpend: Start of the data record being validated at open, if its
+ *               mre_roff is not 0
+ *
+ * lst_gcdone is protected by lst_gclock, lst_gcerr* by both lst_gclock and
+ * pmd_obj_wrlock(), so that mlog_erase() can clear them.
+ *
+ * The record index holds the start of the first record beginning at least
+ * MLOG_RIDX_SPAN past the previous entry, in record number order.
  */
 struct mlog_stat {
 	struct mlog_read_iter  lst_citr;
 	struct mlog_fsetparms  lst_mfp;
 	char  **lst_abuf;
 	char  **lst_rbuf;
+	struct mlog_bufpool    *lst_bufs;
 	off_t   lst_rsoff;
 	off_t   lst_rseoff;
 	off_t   lst_asoff;
@@ -93,6 +188,21 @@ struct mlog_stat {
 	u8      lst_csem;
 	u8      lst_cstart;
 	u8      lst_cend;
+
+	struct mlog_readahead *lst_ra;
+	struct mlog_aflush    *lst_af;
+
+	struct mutex            lst_gclock;
+	u64                     lst_gcseq;
+	u64                     lst_gcdone;
+	u64                     lst_gcerrlo;
+	merr_t                  lst_gcerr;
+
+	u64                     lst_recnum;
+	struct mlog_ridx_ent   *lst_ridx;
+	u32                     lst_ridxcnt;
+	u32                     lst_ridxmax;
+	struct mlog_ridx_ent    lst_ridxpend;
 };
 
 #define MLOG_TOTSEC(lstat)  ((lstat)->lst_mfp.mfp_totsec)
@@ -152,6 +262,14 @@ mlog_find_get(
 	struct mlog_props          *prop,
 	struct mlog_descriptor    **mlh);
 
+merr_t
+mlog_find_getv(
+	struct mpool_descriptor    *mp,
+	const u64                  *objidv,
+	u32                         objidc,
+	struct mlog_descriptor    **mlhv,
+	u64                        *capv);
+
 void mlog_put(struct mpool_descriptor *mp, struct mlog_descriptor *layout);
 
 void mlog_lookup_rootids(u64 *id1, u64 *id2);
@@ -186,6 +304,57 @@ merr_t mlog_empty(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, bool
 
 merr_t mlog_erase(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, u64 mingen);
 
+/**
+ * mlog_erase_async() - Erase an mlog in the background
+ * @mp:
+ * @mlh:
+ * @mingen: as for mlog_erase()
+ * @spare:  true to open the mlog once erased and add it to the spare pool
+ *
+ * Takes its own reference on @mlh, which is dropped when the erase fails
+ * or, for a spare, when the mlog is taken out of the pool.  The caller must
+ * not append to @mlh after this call.  A spare is reopened with the flags
+ * @mlh was open with at the time of this call.
+ *
+ * Returns: 0 if the erase is queued, merr_t otherwise; -EBUSY if @mlh is
+ * already queued or in the spare pool
+ */
+merr_t
+mlog_erase_async(
+	struct mpool_descriptor    *mp,
+	struct mlog_descriptor     *mlh,
+	u64                         mingen,
+	bool                        spare);
+
+/**
+ * mlog_spare_get() - Take an erased, open mlog out of the spare pool
+ * @mp:
+ * @mclassp: media class of the mlog
+ * @mlh:     (output) mlog handle, the caller must release it via mlog_put()
+ *
+ * Returns: 0 if successful, merr_t otherwise; -ENOENT if the pool is empty
+ */
+merr_t
+mlog_spare_get(
+	struct mpool_descriptor    *mp,
+	enum mp_media_classp        mclassp,
+	struct mlog_descriptor    **mlh);
+
+/**
+ * mlog_spare_cnt() - Number of spare mlogs of a media class ready for use
+ * @mp:
+ * @mclassp:
+ */
+u32 mlog_spare_cnt(struct mpool_descriptor *mp, enum mp_media_classp mclassp);
+
+void mlog_spares_init(struct mpool_descriptor *mp);
+
+/**
+ * mlog_spares_fini() - Wait for queued erases and empty the spare pool
+ * @mp:
+ */
+void mlog_spares_fini(struct mpool_descriptor *mp);
+
 merr_t mlog_append_cstart(struct mpool_descriptor *mp, struct mlog_descriptor *mlh);
 
 merr_t mlog_append_cend(struct mpool_descriptor *mp, struct mlog_descriptor *mlh);
@@ -198,8 +367,79 @@ mlog_append_data(
 	u64                         buflen,
 	int                         sync);
 
+/*
+ * Durability requested of the records appended by mlog_append_recv():
+ * @MLOG_APPEND_NOSYNC: records reach media when the CFS fills or on the next flush
+ * @MLOG_APPEND_SYNC:   return once the records are on media
+ * @MLOG_APPEND_ASYNC:  start writing the records to media but do not wait
+ */
+enum mlog_append_sync {
+	MLOG_APPEND_NOSYNC = 0,
+	MLOG_APPEND_SYNC   = 1,
+	MLOG_APPEND_ASYNC  = 2,
+};
+
+/**
+ * mlog_append_recv() - Append a batch of data records
+ * @mp:
+ * @mlh:
+ * @recv:      one kvec per record
+ * @recc:      number of records
+ * @sync:      enum mlog_append_sync
+ * @appendedp: (output) number of records appended, may be NULL
+ *
+ * Returns: 0 if successful, merr_t otherwise
+ */
+merr_t
+mlog_append_recv(
+	struct mpool_descriptor    *mp,
+	struct mlog_descriptor     *mlh,
+	const struct kvec          *recv,
+	int                         recc,
+	int                         sync,
+	int                        *appendedp);
+
+/**
+ * mlog_flush() - Flush any records appended without sync to media
+ * @mp:
+ * @mlh:
+ *
+ * Returns: 0 if successful, merr_t otherwise
+ */
+merr_t mlog_flush(struct mpool_descriptor *mp, struct mlog_descriptor *mlh);
+
 merr_t mlog_read_data_init(struct mpool_descriptor *mp, struct mlog_descriptor *mlh);
 
+/**
+ * mlog_read_data_seek() - Position the read iterator at a data record
+ * @mp:
+ * @mlh:   mlog opened with MLOG_OF_RECIDX
+ * @recno: data record number, counted from 0 at the start of the log
+ *
+ * The next mlog_read_data_next() returns record @recno, or end of log if
+ * @recno is the number of records in the log.
+ *
+ * Returns: 0 if successful, merr_t otherwise; -ERANGE if @recno is past
+ * the end of the log
+ */
+merr_t mlog_read_data_seek(struct mpool_descriptor *mp, struct mlog_descriptor *mlh, u64 recno);
+
+/**
+ * mlog_ridx_lookup() - Find the closest indexed record at or before a record
+ * @mp:
+ * @mlh:    mlog opened with MLOG_OF_RECIDX
+ * @recno:  data record number
+ * @ent:    (output) index entry
+ *
+ * Returns: 0 if successful, merr_t otherwise
+ */
+merr_t
+mlog_ridx_lookup(
+	struct mpool_descriptor    *mp,
+	struct mlog_descriptor     *mlh,
+	u64                         recno,
+	struct mlog_ridx_ent       *ent);
+
 /**
  * mlog_read_data_next()
  * @mp:
@@ -243,6 +483,68 @@ mlog_rw_raw(
 
 bool mlog_objid(u64 objid);
 
+/**
+ * mlog_lat_name() - Return the name of a latency histogram
+ * @op: enum mlog_lat_op
+ */
+const char *mlog_lat_name(enum mlog_lat_op op);
+
+/**
+ * mlog_lat_get() - Sum a latency histogram over all CPUs
+ * @mp:   mpool descriptor
+ * @op:   enum mlog_lat_op
+ * @bktv: (output) MLOG_LAT_BKTC bucket counts
+ */
+void mlog_lat_get(struct mpool_descriptor *mp, enum mlog_lat_op op, u64 *bktv);
+
+/**
+ * mlog_lat_reset() - Clear all the latency histograms of an mpool
+ * @mp: mpool descriptor
+ *
+ * Updates racing with the reset may survive it.
+ */
+void mlog_lat_reset(struct mpool_descriptor *mp);
+
+/**
+ * struct mlog_bufpool_stats - mlog buffer pool statistics, in pages
+ * @mbs_idle:     pages kept idle in the pool
+ * @mbs_lent:     pages held by open mlogs
+ * @mbs_max:      bound of idle plus lent pages
+ * @mbs_hits:     pages lent from the idle pages
+ * @mbs_misses:   pages lent from the page allocator
+ * @mbs_reclaims: append buffers given back after a flush
+ */
+struct mlog_bufpool_stats {
+	u64    mbs_idle;
+	u64    mbs_lent;
+	u64    mbs_max;
+	u64    mbs_hits;
+	u64    mbs_misses;
+	u64    mbs_reclaims;
+};
+
+void mlog_bufpool_init(struct mpool_descriptor *mp);
+
+/**
+ * mlog_bufpool_fini() - Free the idle pages of the mlog buffer pool
+ * @mp:
+ *
+ * All mlogs must be closed.
+ */
+void mlog_bufpool_fini(struct mpool_descriptor *mp);
+
+void mlog_bufpool_stats_get(struct mpool_descriptor *mp, struct mlog_bufpool_stats *stats);
+
+/**
+ * mlog_oml_init() - Initialize the table of open mlogs
+ * @mp:
+ */
+merr_t mlog_oml_init(struct mpool_descriptor *mp);
+
+void mlog_oml_fini(struct mpool_descriptor *mp);
+
 void mlogutil_closeall(struct mpool_descriptor *mp);
 
+void mlogutil_flushall(struct mpool_descriptor *mp);
+
 #endif /* MPOOL_MLOG_H */
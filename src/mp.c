@@ -12,6 +12,9 @@
 
 #include <linux/string.h>
 #include <linux/sort.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
 
 #include "mpool_defs.h"
 
@@ -127,6 +130,126 @@ mpool_mdc0_sb2obj(
 	return 0;
 }
 
+/**
+ * struct mpool_dev_job - superblock I/O on one drive
+ * @dj_work:   work item, not used for the first drive which runs inline
+ * @dj_fn:     job function, NULL to skip this drive
+ * @dj_mp:
+ * @dj_pd:
+ * @dj_sbmdc0: MDC0 info to write in a new superblock, if any
+ * @dj_sb:     superblock read from or to write to dj_pd
+ * @dj_ver:    on-media superblock version
+ * @dj_force:
+ * @dj_err:    result of dj_fn
+ *
+ * sb_read() and the sb_write_*() functions issue several synchronous reads
+ * and synchronous, flushed writes to a drive. Running them concurrently on
+ * all the drives makes create, activate and rename wait for the slowest
+ * drive instead of the sum of all of them.
+ */
+struct mpool_dev_job {
+	struct work_struct          dj_work;
+	merr_t                    (*dj_fn)(struct mpool_dev_job *job);
+	struct mpool_descriptor    *dj_mp;
+	struct mpool_dev_info      *dj_pd;
+	struct omf_sb_descriptor   *dj_sbmdc0;
+	struct omf_sb_descriptor    dj_sb;
+	u16                         dj_ver;
+	bool                        dj_force;
+	merr_t                      dj_err;
+};
+
+static void mpool_dev_job_worker(struct work_struct *work)
+{
+	struct mpool_dev_job *job = container_of(work, struct mpool_dev_job, dj_work);
+
+	job->dj_err = job->dj_fn(job);
+}
+
+/**
+ * mpool_dev_jobs_run() - run the jobs of all the drives concurrently
+ * @jobv:
+ * @jobc:
+ *
+ * Return: the error of the first failed job, in drive order
+ */
+static merr_t mpool_dev_jobs_run(struct mpool_dev_job *jobv, int jobc)
+{
+	struct mpool_dev_job   *inl = NULL;
+	int                     i;
+
+	for (i = 0; i < jobc; i++) {
+		jobv[i].dj_err = 0;
+
+		if (!jobv[i].dj_fn)
+			continue;
+
+		if (!inl) {
+			inl = &jobv[i];
+			continue;
+		}
+
+		INIT_WORK(&jobv[i].dj_work, mpool_dev_job_worker);
+		queue_work(system_unbound_wq, &jobv[i].dj_work);
+	}
+
+	if (inl)
+		inl->dj_err = inl->dj_fn(inl);
+
+	for (i = 0; i < jobc; i++) {
+		if (jobv[i].dj_fn && &jobv[i] != inl)
+			flush_work(&jobv[i].dj_work);
+	}
+
+	for (i = 0; i < jobc; i++) {
+		if (jobv[i].dj_err)
+			return jobv[i].dj_err;
+	}
+
+	return 0;
+}
+
+static merr_t mpool_dev_sbread_job(struct mpool_dev_job *job)
+{
+	return sb_read(job->dj_pd, &job->dj_sb, &job->dj_ver, job->dj_force);
+}
+
+static merr_t mpool_dev_sbupdate_job(struct mpool_dev_job *job)
+{
+	return sb_write_update(job->dj_pd, &job->dj_sb);
+}
+
+/**
+ * mpool_dev_sbread_all() - read the superblocks of all the drives
+ * @pdv:
+ * @pdvcnt:
+ * @force:
+ *
+ * Return: a vector of pdvcnt jobs holding the superblocks and the per-drive
+ * read status, which the caller must kfree(), or NULL if out of memory
+ */
+static struct mpool_dev_job *
+mpool_dev_sbread_all(struct mpool_dev_info *pdv, int pdvcnt, bool force)
+{
+	struct mpool_dev_job   *jobv;
+	int                     i;
+
+	jobv = kcalloc(pdvcnt, sizeof(*jobv), GFP_KERNEL);
+	if (!jobv)
+		return NULL;
+
+	for (i = 0; i < pdvcnt; i++) {
+		jobv[i].dj_fn    = mpool_dev_sbread_job;
+		jobv[i].dj_pd    = &pdv[i];
+		jobv[i].dj_force = force;
+		jobv[i].dj_ver   = OMF_SB_DESC_UNDEF;
+	}
+
+	(void)mpool_dev_jobs_run(jobv, pdvcnt);
+
+	return jobv;
+}
+
 static merr_t
 mpool_dev_sbwrite(
 	struct mpool_descriptor    *mp,
@@ -268,12 +391,18 @@ static merr_t mpool_mdc0_alloc(struct mpool_descriptor *mp, struct omf_sb_descri
 	return 0;
 }
 
+static merr_t mpool_dev_sbwrite_job(struct mpool_dev_job *job)
+{
+	return mpool_dev_sbwrite(job->dj_mp, job->dj_pd, job->dj_sbmdc0);
+}
+
 static merr_t
 mpool_dev_sbwrite_newpool(struct mpool_descriptor *mp, struct omf_sb_descriptor *sbmdc0)
 {
+	struct mpool_dev_job   *jobv;
+	struct mpool_dev_info  *pd = NULL;
 	merr_t                  err;
 	u64                     pdh = 0;
-	struct mpool_dev_info  *pd = NULL;
 
 	/* Alloc mdc0 and generate mdc0 info for superblocks */
 	err = mpool_mdc0_alloc(mp, sbmdc0);
@@ -282,20 +411,35 @@ mpool_dev_sbwrite_newpool(struct mpool_descriptor *mp, struct omf_sb_descriptor
 		return err;
 	}
 
+	jobv = kcalloc(mp->pds_pdvcnt, sizeof(*jobv), GFP_KERNEL);
+	if (!jobv)
+		return merr(ENOMEM);
+
 	for (pdh = 0; pdh < mp->pds_pdvcnt; pdh++) {
 		pd = &mp->pds_pdv[pdh];
 
+		jobv[pdh].dj_fn = mpool_dev_sbwrite_job;
+		jobv[pdh].dj_mp = mp;
+		jobv[pdh].dj_pd = pd;
+
 		if (pd->pdi_mclass == mp->pds_mdparm.md_mclass)
-			err = mpool_dev_sbwrite(mp, pd, sbmdc0);
-		else
-			err = mpool_dev_sbwrite(mp, pd, NULL);
-		if (err) {
-			mp_pr_err("%s: sb write %s failed, %d %d", err, mp->pds_name,
+			jobv[pdh].dj_sbmdc0 = sbmdc0;
+	}
+
+	err = mpool_dev_jobs_run(jobv, mp->pds_pdvcnt);
+
+	for (pdh = 0; pdh < mp->pds_pdvcnt; pdh++) {
+		pd = &mp->pds_pdv[pdh];
+
+		if (jobv[pdh].dj_err) {
+			mp_pr_err("%s: sb write %s failed, %d %d", jobv[pdh].dj_err, mp->pds_name,
 				  pd->pdi_name, pd->pdi_mclass, mp->pds_mdparm.md_mclass);
 			break;
 		}
 	}
 
+	kfree(jobv);
+
 	return err;
 }
 
@@ -328,11 +472,12 @@ mpool_desc_pdmc_add(
 
 	/*
 	 * Devices that do not support updatable sectors can't be included
-	 * in an mpool. Do not check if in the context of an unavailable PD
-	 * during activate, because it is impossible to determine the PD
-	 * properties.
+	 * in an mpool, except zoned devices which then hold mblocks only.
+	 * Do not check if in the context of an unavailable PD during
+	 * activate, because it is impossible to determine the PD properties.
 	 */
-	if ((omf_devparm == NULL) && !(pd->pdi_cmdopt & PD_CMD_SECTOR_UPDATABLE)) {
+	if ((omf_devparm == NULL) && !(pd->pdi_cmdopt & PD_CMD_SECTOR_UPDATABLE) &&
+	    pd->pdi_devtype != PD_DEV_TYPE_ZONE) {
 		err = merr(EINVAL);
 		mp_pr_err("%s: device %s sectors not updatable", err, mp->pds_name, pd->pdi_name);
 		return err;
@@ -392,6 +537,133 @@ static merr_t mpool_dev_check_new(struct mpool_descriptor *mp, struct mpool_dev_
 	return 0;
 }
 
+/**
+ * struct mpool_wq_info - per-mpool workqueue name and max_active bounds
+ * @wqi_name:
+ * @wqi_maxactive: used if mp_wqmaxactive is 0, 0 for the workqueue default
+ * @wqi_minactive: lowest max_active the queue's work can make progress with
+ *
+ * The PCO workqueue runs pmd_pco_schedule(), which queues up to
+ * MPOOL_PCO_JOBS_MAX - 1 compaction jobs on the same queue and waits for
+ * them, while pmd_mdc_provision() may be queued too.
+ */
+static const struct mpool_wq_info {
+	const char *wqi_name;
+	uint        wqi_maxactive;
+	uint        wqi_minactive;
+} mpool_wq_infov[MPOOL_WQ_MAX] = {
+	[MPOOL_WQ_LOAD]  = { "mpool_load",  0, 0 },
+	[MPOOL_WQ_ERASE] = { "mpool_erase", 0, 0 },
+	[MPOOL_WQ_PCO]   = { "mpool_pco",   0, MPOOL_PCO_JOBS_MAX + 1 },
+	[MPOOL_WQ_MOVE]  = { "mpool_move",  0, 0 },
+	[MPOOL_WQ_FLUSH] = { "mpool_flush", 0, 0 },
+	[MPOOL_WQ_USAGE] = { "mpool_usage", 1, 0 },
+	[MPOOL_WQ_RA]    = { "mpool_ra",   16, 0 },
+};
+
+/**
+ * mpool_wq_alloc() - create per-mpool workqueues per the mp_wq* params
+ * @mp:
+ * @mask: bitmask (1 << enum mpool_wq_type) of the workqueues to create
+ */
+static merr_t mpool_wq_alloc(struct mpool_descriptor *mp, u32 mask)
+{
+	struct mpcore_params   *params = &mp->pds_params;
+	uint                    flags, maxactive;
+	int                     i, node;
+
+	node = (int)params->mp_wqnode;
+
+	mp->pds_wqcpu = WORK_CPU_UNBOUND;
+	if (params->mp_wqnode != MPOOL_WQ_NODE_ANY && node >= 0 && node < nr_node_ids &&
+	    node_online(node) && !cpumask_empty(cpumask_of_node(node)))
+		mp->pds_wqcpu = cpumask_first(cpumask_of_node(node));
+
+	for (i = 0; i < MPOOL_WQ_MAX; i++) {
+		if (!(mask & (1u << i)))
+			continue;
+
+		maxactive = min_t(u64, params->mp_wqmaxactive, WQ_MAX_ACTIVE);
+		if (!maxactive)
+			maxactive = mpool_wq_infov[i].wqi_maxactive;
+		if (maxactive)
+			maxactive = max(maxactive, mpool_wq_infov[i].wqi_minactive);
+
+		flags = (params->mp_wqpercpu & (1u << i)) ? 0 : WQ_UNBOUND;
+		if (params->mp_wqhipri & (1u << i))
+			flags |= WQ_HIGHPRI;
+
+		mp->pds_wqv[i] = alloc_workqueue("%s", flags, maxactive, mpool_wq_infov[i].wqi_name);
+		if (!mp->pds_wqv[i]) {
+			merr_t err = merr(ENOMEM);
+
+			mp_pr_err("mpool %s, alloc %s workqueue failed",
+				  err, mp->pds_name, mpool_wq_infov[i].wqi_name);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Destroy the per-mpool workqueues, draining them first.  The erase
+ * workqueue goes last as work on the others may queue erases.
+ */
+static void mpool_wq_free(struct mpool_descriptor *mp)
+{
+	int i;
+
+	for (i = MPOOL_WQ_MAX - 1; i >= 0; i--) {
+		if (i == MPOOL_WQ_ERASE || !mp->pds_wqv[i])
+			continue;
+
+		destroy_workqueue(mp->pds_wqv[i]);
+		mp->pds_wqv[i] = NULL;
+	}
+
+	if (mp->pds_wqv[MPOOL_WQ_ERASE]) {
+		destroy_workqueue(mp->pds_wqv[MPOOL_WQ_ERASE]);
+		mp->pds_wqv[MPOOL_WQ_ERASE] = NULL;
+	}
+}
+
+struct workqueue_struct *mpool_wq(struct mpool_descriptor *mp, enum mpool_wq_type type)
+{
+	return mp->pds_wqv[type];
+}
+
+/* Cpu the work is queued on, the node of pds_wqcpu for unbound workqueues */
+static inline int mpool_wq_cpu(struct mpool_descriptor *mp, enum mpool_wq_type type)
+{
+	if (mp->pds_params.mp_wqpercpu & (1u << type))
+		return WORK_CPU_UNBOUND;
+
+	return mp->pds_wqcpu;
+}
+
+bool mpool_queue_work(struct mpool_descriptor *mp, enum mpool_wq_type type,
+		      struct work_struct *work)
+{
+	return queue_work_on(mpool_wq_cpu(mp, type), mp->pds_wqv[type], work);
+}
+
+bool mpool_queue_dwork(struct mpool_descriptor *mp, enum mpool_wq_type type,
+		       struct delayed_work *dwork, unsigned long delay)
+{
+	return queue_delayed_work_on(mpool_wq_cpu(mp, type), mp->pds_wqv[type], dwork, delay);
+}
+
+bool mpool_queue_work_node(struct mpool_descriptor *mp, enum mpool_wq_type type,
+			   int node, struct work_struct *work)
+{
+#if HAVE_QUEUE_WORK_NODE
+	if (!(mp->pds_params.mp_wqpercpu & (1u << type)))
+		return queue_work_node(node, mp->pds_wqv[type], work);
+#endif
+	return mpool_queue_work(mp, type, work);
+}
+
 /**
  * mpool_desc_init_newpool() -
  * @mp:
@@ -415,6 +687,14 @@ static merr_t mpool_desc_init_newpool(struct mpool_descriptor *mp, u32 flags)
 			return err;
 	}
 
+	/* The MDCs are mlogs, which can't be placed on a zoned device. */
+	if (!(mp->pds_pdv[pdh].pdi_cmdopt & PD_CMD_SECTOR_UPDATABLE)) {
+		err = merr(EINVAL);
+		mp_pr_err("mpool %s, drive %s can't hold the mpool metadata",
+			  err, mp->pds_name, mp->pds_pdv[pdh].pdi_name);
+		return err;
+	}
+
 	/*
 	 * Add drive in its media class. That may create the class
 	 * if first drive of the class.
@@ -575,16 +855,10 @@ mpool_create(
 
 	mutex_lock(&mpool_s_lock);
 
-	/*
-	 * Allocate the per-mpool workqueue.
-	 * TODO: Make this per-driver
-	 */
-	mp->pds_erase_wq = alloc_workqueue("mperasewq", WQ_HIGHPRI, 0);
-	if (!mp->pds_erase_wq) {
-		err = merr(ENOMEM);
-		mp_pr_err("mpool %s, alloc per-mpool wq failed", err, mpname);
+	/* Only the erase pipeline runs asynchronously while creating */
+	err = mpool_wq_alloc(mp, 1u << MPOOL_WQ_ERASE);
+	if (err)
 		goto errout;
-	}
 
 	/*
 	 * Set the devices parameters from the ones placed by the discovery
@@ -713,8 +987,7 @@ mpool_create(
 
 errout:
 
-	if (mp->pds_erase_wq)
-		destroy_workqueue(mp->pds_erase_wq);
+	mpool_wq_free(mp);
 
 	if (active)
 		pmd_mpool_deactivate(mp);
@@ -759,15 +1032,21 @@ mpool_desc_init_sb(
 {
 	struct omf_sb_descriptor   *sb = NULL;
 	struct mpool_dev_info      *pd = NULL;
+	struct mpool_dev_job       *jobv;
 
 	merr_t err;
 	u16    omf_ver = OMF_SB_DESC_UNDEF;
 	u8     pdh = 0;
 	bool   mdc0found = false;
+	bool   update = false;
 	bool   force = ((flags & (1 << MP_FLAGS_FORCE)) != 0);
 
-	sb = kzalloc(sizeof(*sb), GFP_KERNEL);
-	if (!sb) {
+	/*
+	 * Read the superblocks of all the drives at once; init and validate
+	 * pool drive info from device parameters stored in the super blocks.
+	 */
+	jobv = mpool_dev_sbread_all(mp->pds_pdv, mp->pds_pdvcnt, force);
+	if (!jobv) {
 		err = merr(ENOMEM);
 		mp_pr_err("sb desc alloc failed %lu", err, (ulong)sizeof(*sb));
 		return err;
@@ -780,15 +1059,16 @@ mpool_desc_init_sb(
 		int    i;
 
 		pd = &mp->pds_pdv[pdh];
+		sb = &jobv[pdh].dj_sb;
+		omf_ver = jobv[pdh].dj_ver;
 
-		/*
-		 * Read superblock; init and validate pool drive info
-		 * from device parameters stored in the super block.
-		 */
-		err = sb_read(pd, sb, &omf_ver, force);
+		/* Only the drives whose sb needs to be overwritten run a job below. */
+		jobv[pdh].dj_fn = NULL;
+
+		err = jobv[pdh].dj_err;
 		if (ev(err)) {
 			mp_pr_err("sb read from %s failed", err, pd->pdi_name);
-			kfree(sb);
+			kfree(jobv);
 			return err;
 		}
 
@@ -807,7 +1087,7 @@ mpool_desc_init_sb(
 				err = merr(EBUSY);
 				mp_pr_err("%s: mpool already activated, id %s, pd name %s",
 					  err, sb->osb_name, uuid_str, pd->pdi_name);
-				kfree(sb);
+				kfree(jobv);
 				return err;
 			}
 			mpool_uuid_copy(&mp->pds_poolid, &sb->osb_poolid);
@@ -825,7 +1105,7 @@ mpool_desc_init_sb(
 				err = merr(EINVAL);
 				mp_pr_err("%s: pd %s, mpool id %s different from prior id %s",
 					  err, mp->pds_name, pd->pdi_name, uuid_str1, uuid_str2);
-				kfree(sb);
+				kfree(jobv);
 				return err;
 			}
 		}
@@ -853,7 +1133,7 @@ mpool_desc_init_sb(
 				err = merr(EINVAL);
 				mp_pr_err("%s: pd %s, invalid sb MDC0",
 					  err, mp->pds_name, pd->pdi_name);
-				kfree(sb);
+				kfree(jobv);
 				return err;
 			}
 
@@ -879,7 +1159,7 @@ mpool_desc_init_sb(
 				err = merr(EINVAL);
 				mp_pr_err("%s: pd %s, duplicate devices, uuid %s",
 					  err, mp->pds_name, pd->pdi_name, uuid_str);
-				kfree(sb);
+				kfree(jobv);
 				return err;
 			}
 		}
@@ -887,7 +1167,7 @@ mpool_desc_init_sb(
 		if (omf_ver > OMF_SB_DESC_VER_LAST) {
 			err = merr(EOPNOTSUPP);
 			mp_pr_err("%s: unsupported sb version %d", err, mp->pds_name, omf_ver);
-			kfree(sb);
+			kfree(jobv);
 			return err;
 		} else if (!force && (omf_ver < OMF_SB_DESC_VER_LAST || resize)) {
 			if ((flags & (1 << MP_FLAGS_PERMIT_META_CONV)) == 0) {
@@ -910,22 +1190,17 @@ mpool_desc_init_sb(
 					  err, mp->pds_name,
 					  buf1, omfu_mdcver_comment(mdcver) ?: "",
 					  buf2, omfu_mdcver_comment(omfu_mdcver_cur()));
-				kfree(sb);
-				return err;
-			}
-
-			/* We need to overwrite the old version superblock on the device */
-			err = sb_write_update(pd, sb);
-			if (err) {
-				mp_pr_err("%s: pd %s, failed to convert or overwrite mpool sb",
-					  err, mp->pds_name, pd->pdi_name);
-				kfree(sb);
+				kfree(jobv);
 				return err;
 			}
 
-			if (!resize)
-				mp_pr_info("%s: pd %s, Convert mpool sb, oldv %d newv %d",
-					   mp->pds_name, pd->pdi_name, omf_ver, sb->osb_vers);
+			/*
+			 * We need to overwrite the old version superblock on
+			 * the device, which is done below for all such drives
+			 * at once.
+			 */
+			jobv[pdh].dj_fn = mpool_dev_sbupdate_job;
+			update = true;
 		}
 
 		mpool_uuid_copy(&pd->pdi_devid, &sb->osb_parm.odp_devid);
@@ -936,7 +1211,7 @@ mpool_desc_init_sb(
 			mp_pr_err("%s: pd %s, adding drive in a media class failed",
 				  err, mp->pds_name, pd->pdi_name);
 
-			kfree(sb);
+			kfree(jobv);
 			return err;
 		}
 
@@ -953,13 +1228,33 @@ mpool_desc_init_sb(
 	if (!mdc0found) {
 		err = merr(EINVAL);
 		mp_pr_err("%s: MDC0 not found", err, mp->pds_name);
-		kfree(sb);
+		kfree(jobv);
 		return err;
 	}
 
-	kfree(sb);
+	err = update ? mpool_dev_jobs_run(jobv, mp->pds_pdvcnt) : 0;
 
-	return 0;
+	for (pdh = 0; update && pdh < mp->pds_pdvcnt; pdh++) {
+		pd = &mp->pds_pdv[pdh];
+		sb = &jobv[pdh].dj_sb;
+
+		if (!jobv[pdh].dj_fn)
+			continue;
+
+		if (jobv[pdh].dj_err) {
+			mp_pr_err("%s: pd %s, failed to convert or overwrite mpool sb",
+				  jobv[pdh].dj_err, mp->pds_name, pd->pdi_name);
+			break;
+		}
+
+		if (jobv[pdh].dj_ver < OMF_SB_DESC_VER_LAST)
+			mp_pr_info("%s: pd %s, Convert mpool sb, oldv %d newv %d",
+				   mp->pds_name, pd->pdi_name, jobv[pdh].dj_ver, sb->osb_vers);
+	}
+
+	kfree(jobv);
+
+	return err;
 }
 
 static int comp_func(const void *c1, const void *c2)
@@ -1084,17 +1379,9 @@ mpool_activate(
 
 	mutex_lock(&mpool_s_lock);
 
-	mp->pds_workq = alloc_workqueue("mpoolwq", WQ_UNBOUND, 0);
-	if (!mp->pds_workq) {
-		err = merr(ENOMEM);
-		mp_pr_err("alloc mpoolwq failed, first drive path %s", err, dpaths[0]);
-		goto errout;
-	}
-
-	mp->pds_erase_wq = alloc_workqueue("mperasewq", WQ_HIGHPRI, 0);
-	if (!mp->pds_erase_wq) {
-		err = merr(ENOMEM);
-		mp_pr_err("alloc mperasewq failed, first drive path %s", err, dpaths[0]);
+	err = mpool_wq_alloc(mp, (1u << MPOOL_WQ_MAX) - 1);
+	if (err) {
+		mp_pr_err("alloc workqueues failed, first drive path %s", err, dpaths[0]);
 		goto errout;
 	}
 
@@ -1108,6 +1395,9 @@ mpool_activate(
 	/* Set mp.pdvcnt so dpaths will get closed in cleanup if activate fails. */
 	mp->pds_pdvcnt = dcnt;
 
+	for (i = 0; i < dcnt; i++)
+		pd_dev_poll_set(&mp->pds_pdv[i].pdi_parm, mp->pds_params.mp_pollioc);
+
 	/* Init mpool descriptor from superblocks on drives */
 	err = mpool_desc_init_sb(mp, sbmdc0, flags, mc_resize, NULL);
 	if (ev(err)) {
@@ -1236,13 +1526,14 @@ mpool_activate(
 
 	/* Start the background thread doing pre-compaction of MDC1/255 */
 	pmd_precompact_start(mp);
+	pmd_tier_start(mp);
+	pmd_defrag_start(mp);
 
 errout:
 	if (ev(err)) {
-		if (mp->pds_workq)
-			destroy_workqueue(mp->pds_workq);
-		if (mp->pds_erase_wq)
-			destroy_workqueue(mp->pds_erase_wq);
+		if (active)
+			pmd_mpool_load_stop(mp);
+		mpool_wq_free(mp);
 
 		if (active)
 			pmd_mpool_deactivate(mp);
@@ -1272,20 +1563,54 @@ errout:
 	return err;
 }
 
+void mpool_rebal_stats_get(struct mpool_descriptor *mp, struct mpool_rebal_stats *stats)
+{
+	pmd_rebal_stats_get(mp, stats);
+}
+
 merr_t mpool_deactivate(struct mpool_descriptor *mp)
 {
+	char    mpname[MPOOL_NAMESZ_MAX];
+	u64     tstart, tstop, tflush, tdrain, tend;
+
+	tstart = ktime_get_ns();
+
+	pmd_rebal_stop(mp);
+	pmd_defrag_stop(mp);
+	pmd_tier_stop(mp);
+	mlog_spares_fini(mp);
 	pmd_precompact_stop(mp);
+	pmd_mpool_load_stop(mp);
 	smap_wait_usage_done(mp);
 
+	tstop = ktime_get_ns();
+
+	/*
+	 * Flush the open mlogs of all drives in parallel, and the MDCs
+	 * meanwhile, so that closing them one at a time below writes nothing.
+	 */
+	mlogutil_flushall(mp);
+
+	tflush = ktime_get_ns();
+
 	mutex_lock(&mpool_s_lock);
-	destroy_workqueue(mp->pds_workq);
-	destroy_workqueue(mp->pds_erase_wq);
+	mpool_wq_free(mp);
+
+	tdrain = ktime_get_ns();
 
 	pmd_mpool_deactivate(mp);
 
+	strlcpy(mpname, mp->pds_name, sizeof(mpname));
 	mpool_desc_free(mp);
 	mutex_unlock(&mpool_s_lock);
 
+	tend = ktime_get_ns();
+
+	mp_pr_info("mpool %s, deactivated in %llu ms: stop %llu, flush %llu, drain %llu, close %llu",
+		   mpname, div_u64(tend - tstart, NSEC_PER_MSEC),
+		   div_u64(tstop - tstart, NSEC_PER_MSEC), div_u64(tflush - tstop, NSEC_PER_MSEC),
+		   div_u64(tdrain - tflush, NSEC_PER_MSEC), div_u64(tend - tdrain, NSEC_PER_MSEC));
+
 	return 0;
 }
 
@@ -1388,12 +1713,14 @@ mpool_rename(
 	struct omf_sb_descriptor   *sb;
 	struct mpool_descriptor    *mp;
 	struct mpool_dev_info      *pd = NULL;
+	struct mpool_dev_job       *jobv = NULL;
 	merr_t                      err = 0;
 
 	u16    omf_ver = OMF_SB_DESC_UNDEF;
 	u8     pdh;
 	int    dup;
 	int    doff;
+	bool   update = false;
 	bool   force = ((flags & (1 << MP_FLAGS_FORCE)) != 0);
 
 	if (!mp_newname || dcnt == 0)
@@ -1419,18 +1746,10 @@ mpool_rename(
 		return err;
 	}
 
-	sb = kzalloc(sizeof(*sb), GFP_KERNEL);
-	if (!sb) {
-		err = merr(ENOMEM);
-		mp_pr_err("alloc sb %zu failed", err, sizeof(*sb));
-		return err;
-	}
-
 	mp = mpool_desc_alloc();
 	if (!mp) {
 		err = merr(ENOMEM);
 		mp_pr_err("alloc mpool desc failed", err);
-		kfree(sb);
 		return err;
 	}
 
@@ -1449,14 +1768,25 @@ mpool_rename(
 	 */
 	mp->pds_pdvcnt = dcnt;
 
+	/*
+	 * Read the superblocks of all the drives at once; init and validate
+	 * pool drive info from device parameters stored in the super blocks.
+	 */
+	jobv = mpool_dev_sbread_all(mp->pds_pdv, mp->pds_pdvcnt, force);
+	if (!jobv) {
+		err = merr(ENOMEM);
+		mp_pr_err("alloc sb %zu failed", err, sizeof(*sb));
+		goto errout;
+	}
+
 	for (pdh = 0; pdh < mp->pds_pdvcnt; pdh++) {
 		pd = &mp->pds_pdv[pdh];
+		sb = &jobv[pdh].dj_sb;
+		omf_ver = jobv[pdh].dj_ver;
 
-		/*
-		 * Read superblock; init and validate pool drive info
-		 * from device parameters stored in the super block.
-		 */
-		err = sb_read(pd, sb, &omf_ver, force);
+		jobv[pdh].dj_fn = NULL;
+
+		err = jobv[pdh].dj_err;
 		if (ev(err)) {
 			mp_pr_err("pd %s, sb read failed", err, pd->pdi_name);
 			goto errout;
@@ -1475,19 +1805,27 @@ mpool_rename(
 
 		strlcpy(sb->osb_name, mp_newname, sizeof(sb->osb_name));
 
-		err = sb_write_update(pd, sb);
-		if (err) {
+		jobv[pdh].dj_fn = mpool_dev_sbupdate_job;
+		update = true;
+	}
+
+	/* Rewrite the superblocks of all the drives being renamed at once. */
+	if (update)
+		err = mpool_dev_jobs_run(jobv, mp->pds_pdvcnt);
+
+	for (pdh = 0; update && pdh < mp->pds_pdvcnt; pdh++) {
+		pd = &mp->pds_pdv[pdh];
+
+		if (jobv[pdh].dj_err)
 			mp_pr_err("Failed to rename mpool %s on device %s",
-				  err, mp->pds_name, pd->pdi_name);
-			goto errout;
-		}
+				  jobv[pdh].dj_err, mp->pds_name, pd->pdi_name);
 	}
 
 errout:
 	mutex_unlock(&mpool_s_lock);
 
 	mpool_desc_free(mp);
-	kfree(sb);
+	kfree(jobv);
 
 	return err;
 }
@@ -1537,6 +1875,8 @@ merr_t mpool_drive_add(struct mpool_descriptor *mp, char *dpath, struct pd_prop
 		return err;
 	}
 
+	pd_dev_poll_set(&pd->pdi_parm, mp->pds_params.mp_pollioc);
+
 	/* Confirm drive meets all criteria for adding to this mpool */
 	err = mpool_dev_check_new(mp, pd);
 	if (ev(err)) {
@@ -1614,6 +1954,10 @@ merr_t mpool_drive_add(struct mpool_descriptor *mp, char *dpath, struct pd_prop
 	up_write(&mp->pds_pdvlock);
 	PMD_MDC0_COMPACTUNLOCK(mp);
 
+	/* Move existing mblocks to the new drive in the background */
+	if (!err)
+		pmd_rebal_start(mp, mp->pds_pdvcnt - 1);
+
 errout:
 	if (err) {
 		/*
@@ -1947,14 +2291,33 @@ static struct mpool_descriptor *mpool_desc_alloc(void)
 	if (!mp)
 		return NULL;
 
-	init_rwsem(&mp->pds_pdvlock);
+	mp->pds_mllat = alloc_percpu(struct mlog_lat);
+	if (!mp->pds_mllat) {
+		kfree(mp);
+		return NULL;
+	}
+
+	if (mblock_cache_init(mp)) {
+		free_percpu(mp->pds_mllat);
+		kfree(mp);
+		return NULL;
+	}
+
+	if (mlog_oml_init(mp)) {
+		mblock_cache_fini(mp);
+		free_percpu(mp->pds_mllat);
+		kfree(mp);
+		return NULL;
+	}
 
-	mutex_init(&mp->pds_oml_lock);
-	mp->pds_oml_root = RB_ROOT;
+	init_rwsem(&mp->pds_pdvlock);
 
 	mp->pds_mdparm.md_mclass = MP_MED_INVALID;
 
 	mpcore_params_defaults(&mp->pds_params);
+	pmd_erase_init(mp);
+	mlog_spares_init(mp);
+	mlog_bufpool_init(mp);
 
 	for (i = 0; i < MP_MED_NUMBER; i++)
 		mp->pds_mc[i].mc_pdmc = -1;
@@ -1986,6 +2349,10 @@ static void mpool_desc_free(struct mpool_descriptor *mp)
 			pd_dev_close(&mp->pds_pdv[i].pdi_parm);
 	}
 
+	mblock_cache_fini(mp);
+	mlog_oml_fini(mp);
+	mlog_bufpool_fini(mp);
+	free_percpu(mp->pds_mllat);
 	kfree(mp);
 }
 
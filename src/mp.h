@@ -7,6 +7,7 @@
 #define MPOOL_MP_H
 
 #include <linux/rbtree.h>
+#include <linux/rhashtable.h>
 
 #include "mpool.h"
 
@@ -19,10 +20,10 @@
  * + pmd_s_lock
  * + mp.mda.mdi_slotv[x].(unc)obj[objid].rwlock (per object per mdc);
  *   normally obtained by calling pmd_obj_*lock(layout)
- * + mp.omlock
  * + mp.spcap_lock
  * + mp.mda.mdi_slotvlock
  * + mp.mda.mdi_slotv[x].uqlock (one per mdc)
+ * + mp.mda.mdi_slotv[x].gclock (one per mdc)
  * + mp.mda.mdi_slotv[x].compactlock (one per mdc)
  * + mp.mda.mdi_slotv[x].uncolock (one per mdc)
  * + mp.mda.mdi_slotv[x].colock (one per mdc)
@@ -30,6 +31,7 @@
  * + mp.pds_pdvlock
  * + mp.pdv[d].zmlock[z] (one per drive smap allocation zone)
  * + mp.pdv[d].ds.sda_dalock (one per drive)
+ * + mp.pdv[d].zcache[c].szc_lock (one per drive per cpu)
  *   <eol>
  *
  * NOTE: Every user object (mlog or mblock) is associated with exactly one
@@ -44,10 +46,17 @@
 
 /**
  * struct rmbkt - region map bucket
+ * @pdi_rmlock: protects all fields
+ * @pdi_rmroot: free extents of the region, struct smap_zone
+ * @pdi_rmfree: free zones in pdi_rmroot, read without the lock for placement
+ * @pdi_rmwear: zones freed back to the region since activation, used as a
+ *              proxy for how many times its zones were erased
  */
 struct rmbkt {
 	struct mutex    pdi_rmlock;
 	struct rb_root  pdi_rmroot;
+	u64             pdi_rmfree;
+	u64             pdi_rmwear;
 } ____cacheline_aligned;
 
 /**
@@ -59,6 +68,7 @@ struct rmbkt {
  * @pdi_rmap:     per allocation zone space maps rbtree array, node:
  *                struct u64_to_u64_rb
  * @pdi_rmlock:   lock protects per zone space maps
+ * @pdi_zcache:   per-cpu caches of free single zones carved from the rmaps
  * @pdi_name:     device name (only the last path name component)
  *
  * Pool drive state, status, and params
@@ -80,6 +90,7 @@ struct mpool_dev_info {
 	struct pd_dev_parm      pdi_parm;
 	struct smap_dev_alloc   pdi_ds;
 	struct rmbkt           *pdi_rmbktv;
+	struct smap_zcache __percpu *pdi_zcache;
 	struct mpool_uuid       pdi_devid;
 	char                    pdi_name[PD_NAMESZ_MAX];
 };
@@ -125,24 +136,178 @@ struct mpdesc_mdparm {
  * struct pre_compact_ctrl - used to start/stop/control precompaction
  * @pco_dwork:
  * @pco_mp:
- * @pco_nmtoc: next MDC to compact
-
- * Each time pmd_precompact_cb() runs it will consider the next MDC
- * for compaction.
+ * @pco_mdcwork: creates a set of MDCs, see pmd_mdc_provision()
+ * @pco_mdcbusy: set while pco_mdcwork is queued or running
+ * @pco_mdcused: MDC space in use at the previous run, in bytes
+ * @pco_mdcrate: average growth of the MDC space in use per run, in bytes
+ *
+ * Each time pmd_precompact() runs it ranks all the MDCs that need
+ * compaction and compacts the top ones in parallel, see pmd_pco_schedule().
+ * It also forecasts the MDC space needed and creates new MDCs in the
+ * background ahead of demand, see pmd_mdc_needed().
  */
 struct pre_compact_ctrl {
 	struct delayed_work	 pco_dwork;
 	struct mpool_descriptor *pco_mp;
-	atomic_t		 pco_nmtoc;
+	struct work_struct       pco_mdcwork;
+	atomic_t                 pco_mdcbusy;
+	u64                      pco_mdcused;
+	u64                      pco_mdcrate;
+};
+
+/**
+ * struct pmd_tier_ctrl - used to start/stop/control mblock tiering
+ * @ptc_dwork:   periodic tiering pass, see pmd_tier()
+ * @ptc_mp:
+ * @ptc_rdepoch: selects the ptc_rdcnt[] slot charged by new async mblock reads
+ * @ptc_rdcnt:   async mblock reads in flight, per epoch
+ * @ptc_rdwq:    woken when a ptc_rdcnt[] slot drains
+ * @ptc_movelock: serializes the passes moving mblocks (tiering and defrag)
+ *
+ * Async mblock reads do not hold the layout lock across the I/O, so the
+ * zones an mblock moved away from are released only once every async read
+ * started before the move has completed, see pmd_tier_rdsync().
+ */
+struct pmd_tier_ctrl {
+	struct delayed_work         ptc_dwork;
+	struct mpool_descriptor    *ptc_mp;
+	struct mutex                ptc_movelock;
+	u32                         ptc_rdepoch;
+	atomic_t                    ptc_rdcnt[2];
+	wait_queue_head_t           ptc_rdwq;
+};
+
+/**
+ * struct pmd_defrag_ctrl - used to start/stop free space defragmentation
+ * @pdc_dwork: periodic defrag pass, see pmd_defrag()
+ * @pdc_mp:
+ */
+struct pmd_defrag_ctrl {
+	struct delayed_work         pdc_dwork;
+	struct mpool_descriptor    *pdc_mp;
+};
+
+/**
+ * struct pmd_rebal_ctrl - used to start/stop/report mblock rebalancing
+ * @prc_dwork:  rebalance step, see pmd_rebal()
+ * @prc_mp:
+ * @prc_pass:   state of the running rebalance, NULL if none
+ * @prc_lock:   protects the fields below
+ * @prc_active: true while a rebalance is running
+ * @prc_pdh:    drive mblocks are moved to
+ * @prc_target: bytes to move for the media classes to be equally full
+ * @prc_moved:  bytes moved so far
+ * @prc_start:  ktime_get_ns() at the start of the rebalance
+ * @prc_end:    ktime_get_ns() at its end, 0 while running
+ * @prc_logpct: progress last logged, in % of prc_target
+ */
+struct pmd_rebal_ctrl {
+	struct delayed_work         prc_dwork;
+	struct mpool_descriptor    *prc_mp;
+	struct pmd_rebal_pass      *prc_pass;
+	spinlock_t                  prc_lock;
+	bool                        prc_active;
+	u16                         prc_pdh;
+	u64                         prc_target;
+	u64                         prc_moved;
+	u64                         prc_start;
+	u64                         prc_end;
+	uint                        prc_logpct;
+};
+
+/**
+ * struct pmd_erase_ctrl - erase pipeline for deleted and aborted objects
+ * @pec_lock:  protects pec_list
+ * @pec_list:  list of struct pmd_obj_erase_work pending erase
+ * @pec_work:  batch erase work, runs on the MPOOL_WQ_ERASE workqueue
+ * @pec_mp:
+ * @pec_batch: scratch array used by pec_work to sort a batch
+ * @pec_tstart: start of the current mp_eraserate period, in jiffies
+ * @pec_tbytes: bytes erased in the current mp_eraserate period
+ *
+ * Layouts are erased in batches of up to PMD_ERASE_BATCH_MAX, sorted by
+ * drive and zone so that adjacent zone ranges are erased by a single
+ * discard.  Their space is released to the smap only once the discard
+ * completes.  pec_tstart and pec_tbytes are only used by pec_work.
+ */
+struct pmd_erase_ctrl {
+	spinlock_t                  pec_lock;
+	struct list_head            pec_list;
+	struct work_struct          pec_work;
+	struct mpool_descriptor    *pec_mp;
+	struct pmd_obj_erase_work  *pec_batch[PMD_ERASE_BATCH_MAX];
+	ulong                       pec_tstart;
+	u64                         pec_tbytes;
+};
+
+/**
+ * struct mblock_cache - cache of committed mblock pages
+ * @mbc_htab:  (objid, page index) to struct mblock_cent, RCU lookups
+ * @mbc_lock:  protects mbc_lru, mbc_pages and updates of mbc_htab
+ * @mbc_lru:   cached pages in insertion order, second-chance eviction
+ * @mbc_pages: number of cached pages
+ *
+ * A committed mblock is immutable, so its cached pages remain valid until
+ * the mblock is deleted.
+ */
+struct mblock_cache {
+	struct rhashtable           mbc_htab;
+	spinlock_t                  mbc_lock;
+	struct list_head            mbc_lru;
+	u64                         mbc_pages;
+};
+
+/**
+ * struct mlog_spares - pool of erased, open mlogs per media class
+ * @msp_lock:    protects msp_listv and msp_cntv
+ * @msp_listv:   per media class list of struct mlog_spare ready for use
+ * @msp_cntv:    number of entries on each msp_listv list
+ * @msp_pending: number of erases queued on MPOOL_WQ_ERASE and not yet pooled
+ * @msp_wq:      waited on for msp_pending to drain at deactivate
+ *
+ * A log retired by its user is erased and reopened in the background, so
+ * that taking a replacement out of the pool never waits on the media.
+ */
+struct mlog_spares {
+	spinlock_t                  msp_lock;
+	struct list_head            msp_listv[MP_MED_NUMBER];
+	u32                         msp_cntv[MP_MED_NUMBER];
+	atomic_t                    msp_pending;
+	wait_queue_head_t           msp_wq;
+};
+
+/**
+ * struct mlog_bufpool - log pages shared by the open mlogs of an mpool
+ * @mbp_lock:   protects all the fields below but mbp_mp
+ * @mbp_free:   idle pages, chained through their first word
+ * @mbp_cnt:    number of pages on mbp_free
+ * @mbp_lent:   number of pages held by open mlogs
+ * @mbp_hits:   pages lent from mbp_free
+ * @mbp_misses: pages lent from the page allocator
+ * @mbp_reclaims: append buffers returned by idle mlogs after a flush
+ * @mbp_mp:
+ *
+ * Lent plus idle pages are bounded by mp_mlbufsz.  Append buffers and read
+ * buffers are always lent, past the bound pages given back are freed rather
+ * than kept idle and no readahead is started.
+ */
+struct mlog_bufpool {
+	spinlock_t                  mbp_lock;
+	void                       *mbp_free;
+	u64                         mbp_cnt;
+	u64                         mbp_lent;
+	u64                         mbp_hits;
+	u64                         mbp_misses;
+	u64                         mbp_reclaims;
+	struct mpool_descriptor    *mbp_mp;
 };
 
 /**
  * struct mpool_descriptor - Media pool descriptor
  * @pds_pdvlock:  drive membership/state lock
  * @pds_pdv:      per drive info array
- * @pds_omlock:   open mlog index lock
- * @pds_oml:      rbtree of open mlog layouts. indexed by objid
- *                node type: objid_to_layout_rb
+ * @pds_oml:      rhashtable of open mlog layouts, keyed by eld_objid and
+ *                linked through eld_nodeoml
  * @pds_poolid:   UUID of pool
  * @pds_mdparm:   mclass id of mclass used for mdc layouts
  * @pds_cfg:      mpool config
@@ -151,7 +316,16 @@ struct pre_compact_ctrl {
  * @pds_uctxt     used by user-space mlogs to indicate the context
  * @pds_node:     for linking this object into an rbtree
  * @pds_params:   Per mpool parameters
- * @pds_workq:    Workqueue per mpool.
+ * @pds_wqv:      per-mpool workqueues, indexed by enum mpool_wq_type
+ * @pds_wqcpu:    cpu whose node runs work queued on the unbound workqueues,
+ *                WORK_CPU_UNBOUND for any
+ * @pds_erase:    object erase pipeline
+ * @pds_tier:     mblock tiering between media classes
+ * @pds_defrag:   free space defragmentation
+ * @pds_rebal:    mblock rebalancing after a drive add
+ * @pds_mlspares: pre-erased spare mlogs
+ * @pds_mlbufs:   log pages lent to open mlogs
+ * @pds_mbcache:  committed mblock page cache, sized by mp_mbcachesz
  * @pds_sbmdc0:   Used to store in RAM the MDC0 metadata. Loaded at activate
  *                time, changed when MDC0 is compacted.
  * @pds_mda:      metadata container array (this thing is huge!)
@@ -159,7 +333,7 @@ struct pre_compact_ctrl {
  * LOCKING:
  *    poolid, ospagesz, mdparm: constant; no locking required
  *    mda: protected by internal locks as documented in pmd module
- *    oml: protected by omlock
+ *    oml: rhashtable, internally locked
  *    pdv: see note
  *    pds_mc: protected by pds_pdvlock
  *	Update of pds_mc[].mc_sparams.mc_spzone must also be enclosed
@@ -185,22 +359,30 @@ struct mpool_descriptor {
 	struct mpool_dev_info       pds_pdv[MPOOL_DRIVES_MAX];
 
 	____cacheline_aligned
-	struct mutex                pds_oml_lock;
-	struct rb_root              pds_oml_root;
+	struct rhashtable           pds_oml;
 
 	/* Read-mostly fields... */
 	____cacheline_aligned
 	u16                         pds_pdvcnt;
 	struct mpdesc_mdparm        pds_mdparm;
-	struct workqueue_struct    *pds_workq;
-	struct workqueue_struct    *pds_erase_wq;
-	struct workqueue_struct    *pds_precompact_wq;
+	struct workqueue_struct    *pds_wqv[MPOOL_WQ_MAX];
+	int                         pds_wqcpu;
 
 	struct media_class          pds_mc[MP_MED_NUMBER];
 	struct mpcore_params        pds_params;
 	struct omf_sb_descriptor    pds_sbmdc0;
 	struct pre_compact_ctrl     pds_pco;
+	struct pmd_tier_ctrl        pds_tier;
+	struct pmd_defrag_ctrl      pds_defrag;
+	struct pmd_rebal_ctrl       pds_rebal;
+	struct pmd_erase_ctrl       pds_erase;
+	struct mlog_spares          pds_mlspares;
+	struct mlog_bufpool         pds_mlbufs;
 	struct smap_usage_work      pds_smap_usage_work;
+	struct mlog_lat __percpu   *pds_mllat;
+
+	____cacheline_aligned
+	struct mblock_cache         pds_mbcache;
 
 	/* Rarey used fields... */
 	struct mpool_config         pds_cfg;
@@ -15,14 +15,34 @@ void mpcore_params_defaults(struct mpcore_params *params)
 	params->mp_mdcncap         = 0;
 	params->mp_smaprgnc        = MPOOL_SMAP_RGNCNT_DEFAULT;
 	params->mp_smapalign       = MPOOL_SMAP_ZONEALIGN_DEFAULT;
+	params->mp_smappolicy      = MPOOL_SMAP_POLICY_DEFAULT;
 	params->mp_spare           = MPOOL_SPARES_DEFAULT;
 	params->mp_pcopctfull	   = MPOOL_PCO_PCTFULL;
 	params->mp_pcopctgarbage   = MPOOL_PCO_PCTGARBAGE;
 	params->mp_pconbnoalloc    = MPOOL_PCO_NBNOALLOC;
+	params->mp_pcobudget       = MPOOL_PCO_BUDGET;
 	params->mp_pcoperiod       = MPOOL_PCO_PERIOD;
 	params->mp_pcofillbias     = MPOOL_PCO_FILLBIAS;
 	params->mp_crtmdcpctfull   = MPOOL_CREATE_MDC_PCTFULL;
 	params->mp_crtmdcpctgrbg   = MPOOL_CREATE_MDC_PCTGRBG;
+	params->mp_crtmdcahead     = MPOOL_PCO_MDCAHEAD;
 	params->mp_mpusageperiod   = MPOOL_PD_USAGE_PERIOD;
 	params->mp_objloadjobs     = MPOOL_OBJ_LOAD_JOBS_DEFAULT;
+	params->mp_mbfuadefer      = MPOOL_MB_FUADEFER_DEFAULT;
+	params->mp_mbcachesz       = MPOOL_MBCACHE_SZ_DEFAULT;
+	params->mp_mlcksum         = MPOOL_ML_CKSUM_DEFAULT;
+	params->mp_tierperiod      = MPOOL_TIER_PERIOD_DEFAULT;
+	params->mp_tierbudget      = MPOOL_TIER_BUDGET_DEFAULT;
+	params->mp_tierheat        = MPOOL_TIER_HEAT_DEFAULT;
+	params->mp_defragperiod    = MPOOL_DEFRAG_PERIOD_DEFAULT;
+	params->mp_defragbudget    = MPOOL_DEFRAG_BUDGET_DEFAULT;
+	params->mp_defragpct       = MPOOL_DEFRAG_PCT_DEFAULT;
+	params->mp_rebalrate       = MPOOL_REBAL_RATE_DEFAULT;
+	params->mp_wqhipri         = MPOOL_WQ_HIPRI_DEFAULT;
+	params->mp_wqpercpu        = MPOOL_WQ_PERCPU_DEFAULT;
+	params->mp_wqmaxactive     = MPOOL_WQ_MAXACTIVE_DEFAULT;
+	params->mp_wqnode          = MPOOL_WQ_NODE_ANY;
+	params->mp_pollioc         = MPOOL_PD_POLLIOC_DEFAULT;
+	params->mp_mlbufsz         = MPOOL_MLBUF_SZ_DEFAULT;
+	params->mp_eraserate       = MPOOL_ERASE_RATE_DEFAULT;
 }
@@ -23,6 +23,7 @@
  * Space map alignment in number of zones.
  */
 #define MPOOL_SMAP_ZONEALIGN_DEFAULT    1
+#define MPOOL_SMAP_POLICY_DEFAULT       0
 
 /*
  * Number of concurent jobs for loading user MDC 1~N
@@ -34,10 +35,74 @@
  */
 #define MPOOL_PCO_PCTFULL               70
 #define MPOOL_PCO_PCTGARBAGE            20
-#define MPOOL_PCO_NBNOALLOC              2
+#define MPOOL_PCO_NBNOALLOC              4
+#define MPOOL_PCO_BUDGET               128
+#define MPOOL_PCO_JOBS_MAX               8
 #define MPOOL_PCO_PERIOD                 5
 #define MPOOL_PCO_FILLBIAS	      1000
+#define MPOOL_PCO_MDCAHEAD              12
 #define MPOOL_PD_USAGE_PERIOD        60000
+#define MPOOL_MB_FUADEFER_DEFAULT        0
+#define MPOOL_ML_CKSUM_DEFAULT           0
+
+/*
+ * Committed mblock page cache size in MiB (0 disables it), and the
+ * largest mblock whose pages are cached.
+ */
+#define MPOOL_MBCACHE_SZ_DEFAULT         0
+#define MPOOL_MBCACHE_OBJMAX       (1u << 20)
+/*
+ * Mblock tiering: period in seconds (0 disables it), MiB moved per pass,
+ * heat at which a capacity class mblock is promoted, and % fill of the
+ * staging class above which cold mblocks are demoted.
+ */
+#define MPOOL_TIER_PERIOD_DEFAULT        0
+#define MPOOL_TIER_BUDGET_DEFAULT      256
+#define MPOOL_TIER_HEAT_DEFAULT          8
+#define MPOOL_TIER_PCTFULL              80
+
+/*
+ * Free space defragmentation: period in seconds (0 disables it), MiB moved
+ * per pass, and min % of a rgn's free zones outside its largest free extent
+ * for the rgn to be defragmented.
+ */
+#define MPOOL_DEFRAG_PERIOD_DEFAULT      0
+#define MPOOL_DEFRAG_BUDGET_DEFAULT    256
+#define MPOOL_DEFRAG_PCT_DEFAULT        50
+
+/*
+ * Mblocks moved to a newly added drive, in MiB/s (0 disables it).
+ */
+#define MPOOL_REBAL_RATE_DEFAULT         0
+
+/*
+ * Space of deleted and aborted objects erased, in MiB/s (0 for no limit).
+ */
+#define MPOOL_ERASE_RATE_DEFAULT         0
+
+/*
+ * Per-mpool workqueues (enum mpool_wq_type): those created WQ_HIGHPRI,
+ * those bound to the cpu work is queued from, their max_active (0 for a
+ * default suited to each), and the NUMA node running the unbound ones
+ * (MPOOL_WQ_NODE_ANY for any).
+ */
+#define MPOOL_WQ_HIPRI_DEFAULT \
+	((1u << MPOOL_WQ_ERASE) | (1u << MPOOL_WQ_FLUSH) | (1u << MPOOL_WQ_RA))
+#define MPOOL_WQ_PERCPU_DEFAULT         (1u << MPOOL_WQ_ERASE)
+#define MPOOL_WQ_MAXACTIVE_DEFAULT       0
+#define MPOOL_WQ_NODE_ANY               U64_MAX
+
+/*
+ * Bitmask of the pd I/O classes whose synchronous I/Os are completed by
+ * polling (0 disables it), see enum pd_ioclass.
+ */
+#define MPOOL_PD_POLLIOC_DEFAULT         0
+
+/*
+ * Log pages lent to open mlogs or kept idle for them, in MiB.
+ */
+#define MPOOL_MLBUF_SZ_DEFAULT          64
+
 #define MPOOL_CREATE_MDC_PCTFULL  (MPOOL_PCO_PCTFULL - MPOOL_PCO_PCTGARBAGE)
 #define MPOOL_CREATE_MDC_PCTGRBG   MPOOL_PCO_PCTGARBAGE
 
@@ -50,8 +115,47 @@
  * @mp_mdcnnum: Number of MDCs, *ONLY* for testing purpose
  * @mp_smaprgnc:
  * @mp_smapalign:
+ * @mp_smappolicy: enum smap_rgn_policy, how allocations pick a drive rgn
  * @mp_spare:
  * @mp_objloadjobs: number of concurrent MDC loading jobs
+ * @mp_mbfuadefer: if set, mblock writes don't use FUA and mblock commit
+ *	flushes the drive write cache instead
+ * @mp_mbcachesz: In MiB. Max size of the committed mblock page cache,
+ *	0 disables it
+ * @mp_mlcksum: if set, mlog log blocks (hence all MDC records) are written
+ *	with a CRC32C that is verified when the mlog is read back
+ * @mp_tierperiod: In seconds. Period of the background pass which moves
+ *	hot mblocks to the staging class and cold ones back to the capacity
+ *	class, 0 disables it
+ * @mp_tierbudget: In MiB. Max mblock data moved by one tiering pass.
+ * @mp_tierheat: number of reads, halved at every tiering pass, at which
+ *	a capacity class mblock is promoted
+ * @mp_defragperiod: In seconds. Period of the background pass which moves
+ *	the smallest mblocks out of the most fragmented rgn of each drive,
+ *	0 disables it
+ * @mp_defragbudget: In MiB. Max mblock data moved by one defrag pass.
+ * @mp_defragpct: % (0-100) of a rgn's free zones not in its largest free
+ *	extent from which the rgn is defragmented
+ * @mp_wqhipri: bitmask (1 << enum mpool_wq_type) of the per-mpool
+ *	workqueues created WQ_HIGHPRI
+ * @mp_wqpercpu: bitmask (1 << enum mpool_wq_type) of the per-mpool
+ *	workqueues bound to the cpu work is queued from, the others are
+ *	unbound
+ * @mp_wqmaxactive: max_active of the per-mpool workqueues, 0 for a
+ *	default suited to each, raised to what the PCO workqueue needs to
+ *	avoid deadlock
+ * @mp_wqnode: NUMA node running the work queued on the unbound per-mpool
+ *	workqueues, MPOOL_WQ_NODE_ANY for any
+ * @mp_rebalrate: In MiB/s. Rate at which committed mblocks are moved to a
+ *	drive added to the mpool until the media classes are equally full,
+ *	0 disables it
+ * @mp_pollioc: bitmask (1 << enum pd_ioclass) of the I/O classes whose
+ *	synchronous single bio I/Os are submitted polled, on drives with
+ *	poll queues
+ * @mp_mlbufsz: In MiB. Bound of the mlog buffer pool, past which pages
+ *	returned by mlogs are freed and mlog readahead is not started
+ * @mp_eraserate: In MiB/s. Rate at which the space of deleted and aborted
+ *	objects is erased by the erase pipeline, 0 for no limit
  *
  * The below parameters starting with "pco" are used for the pre-compaction
  * of MDC1/255
@@ -59,8 +163,12 @@
  *	before a pre-compaction is attempted.
  * @mp_pcopctgarbage:  % (0-100) of garbage in MDCi active mlog that must be
  *	reached	before a pre-compaction is attempted.
- * @mp_pconbnoalloc: Number of MDCs from which no object is allocated from.
+ * @mp_pconbnoalloc: Max number of MDCs compacted in parallel by the
+ *	background pre compaction. No object is allocated from those MDCs
+ *	while they are being compacted.
  *	If 0, that disable the background pre compaction.
+ * @mp_pcobudget: In MiB. Max live metadata rewritten by one run of the
+ *	background pre compaction. The top ranked MDC is always compacted.
  * @mp_pcoperiod: In seconds. Period at which a background thread check if
  *	a MDC needs compaction.
  * @mp_pcofillbias: If the next mpool MDC has less objects than
@@ -73,6 +181,9 @@
  *      with crtmdcpctgrbg percent is used as a trigger to create new MDCs
  * @mp_crtmdcpctgrbg: percent garbage threshold in combination with
  *      @crtmdcpctfull percent is used as a trigger to create new MDCs
+ * @mp_crtmdcahead: number of pre-compaction periods of MDC space growth
+ *      anticipated when checking @crtmdcpctfull, so that new MDCs are
+ *      created before they are needed. 0 disables the forecast.
  * @mp_mpusageperiod: period at which a background thread check mpool space
  * usage, in milliseconds
  */
@@ -82,15 +193,35 @@ struct mpcore_params {
 	u64    mp_mdcncap;
 	u64    mp_smaprgnc;
 	u64    mp_smapalign;
+	u64    mp_smappolicy;
 	u64    mp_spare;
 	u64    mp_objloadjobs;
+	u64    mp_mbfuadefer;
+	u64    mp_mbcachesz;
+	u64    mp_mlcksum;
+	u64    mp_tierperiod;
+	u64    mp_tierbudget;
+	u64    mp_tierheat;
+	u64    mp_defragperiod;
+	u64    mp_defragbudget;
+	u64    mp_defragpct;
+	u64    mp_rebalrate;
+	u64    mp_wqhipri;
+	u64    mp_wqpercpu;
+	u64    mp_wqmaxactive;
+	u64    mp_wqnode;
+	u64    mp_pollioc;
+	u64    mp_mlbufsz;
+	u64    mp_eraserate;
 	u64    mp_pcopctfull;
 	u64    mp_pcopctgarbage;
 	u64    mp_pconbnoalloc;
+	u64    mp_pcobudget;
 	u64    mp_pcoperiod;
 	u64    mp_pcofillbias;
 	u64    mp_crtmdcpctfull;
 	u64    mp_crtmdcpctgrbg;
+	u64    mp_crtmdcahead;
 	u64    mp_mpusageperiod;
 };
 
@@ -11,6 +11,9 @@
 #include <linux/idr.h>
 #include <linux/fs.h>
 #include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/sched.h>
+#include <linux/cpuset.h>
 #include <linux/blkdev.h>
 #include <linux/vmalloc.h>
 #include <linux/memcontrol.h>
@@ -19,6 +22,7 @@
 #include <linux/mm_inline.h>
 #include <linux/version.h>
 #include <linux/kref.h>
+#include <linux/rcupdate.h>
 
 #include <linux/backing-dev.h>
 #include <linux/spinlock.h>
@@ -29,6 +33,8 @@
 #include <linux/ctype.h>
 #include <linux/uio.h>
 #include <linux/prefetch.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
 
 #include "mpool_ioctl.h"
 
@@ -36,18 +42,38 @@
 #include "mpool_printk.h"
 #include "assert.h"
 #include "mlog.h"
+#include "pd.h"
 #include "evc.h"
 
 #include "mpool_config.h"
 #include "mpctl.h"
 #include "mpctl_sys.h"
 #include "mpctl_reap.h"
+#include "mpctl_ring.h"
+#include "mpctl_bench.h"
 #include "init.h"
+#include "mpool_trace.h"
 
 #if HAVE_MMAP_LOCK
 #include <linux/mmap_lock.h>
 #endif
 
+#if HAVE_MMGRAB
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#else
+#define mmgrab(_mm)         atomic_inc(&(_mm)->mm_count)
+#endif
+
+#if !HAVE_PIN_USER_PAGES
+#ifndef FOLL_LONGTERM
+#define FOLL_LONGTERM       0
+#endif
+#define pin_user_pages_fast(_addr, _n, _flags, _pagev) \
+	get_user_pages_fast((_addr), (_n), (_flags) & FOLL_WRITE, (_pagev))
+#define unpin_user_page(_page)  put_page(_page)
+#endif
+
 #ifndef lru_to_page
 #define lru_to_page(_head)  (list_entry((_head)->prev, struct page, lru))
 #endif
@@ -69,6 +95,12 @@ typedef int vm_fault_t;
  */
 #define MPC_RA_IOV_MAX      (8)
 
+/*
+ * MPC_FAULT_AROUND_PAGES - Size and alignment (in pages) of the cluster
+ * read in by a fault on an uncached page.
+ */
+#define MPC_FAULT_AROUND_PAGES  (16)
+
 #define NODEV               MKDEV(0, 0)    /* Non-existent device */
 
 
@@ -76,8 +108,8 @@ struct mpc_mpool;
 
 /* mpc pseudo-driver instance data (i.e., all globals live here). */
 struct mpc_softstate {
-	struct mutex        ss_lock;        /* Protects ss_unitmap */
-	struct idr          ss_unitmap;     /* minor-to-unit map */
+	struct mutex        ss_lock;        /* Serializes ss_unitmap updates */
+	struct idr          ss_unitmap;     /* minor-to-unit map, RCU lookups */
 
 	____cacheline_aligned
 	struct semaphore    ss_op_sema;     /* Serialize mgmt. ops */
@@ -109,9 +141,27 @@ struct mpc_rgnmap {
 	atomic_t        rm_rgncnt;
 } ____cacheline_aligned;
 
-/* There is one unit object for each device object created by the driver. */
+/*
+ * Per-node count of xvm page faults which found their page on the faulting
+ * CPU's node (ns_local) vs. on some other node (ns_remote).  Each node's
+ * counters are mostly updated by the CPUs of that node.
+ */
+struct mpc_numa_stat {
+	atomic64_t      ns_local;
+	atomic64_t      ns_remote;
+} ____cacheline_aligned;
+
+struct mpc_regbuf;
+
+/*
+ * There is one unit object for each device object created by the driver.
+ * Units are looked up in ss_unitmap under RCU and freed after a grace
+ * period, hence un_ref and the fields tested by mpc_unit_lookup_by_name()
+ * may be read by lookups racing with mpc_unit_release().
+ */
 struct mpc_unit {
 	struct kref                 un_ref;
+	struct rcu_head             un_rcu;
 	int                         un_open_cnt;    /* Unit open count */
 	struct semaphore            un_open_lock;   /* Protects un_open_* */
 	bool                        un_open_excl;   /* Unit exclusively open */
@@ -124,9 +174,16 @@ struct mpc_unit {
 	struct mpc_mpool           *un_mpool;
 	struct address_space       *un_mapping;
 	struct mpc_reap            *un_ds_reap;
+	struct mpc_ring            *un_ring;
+	spinlock_t                  un_buflock;     /* Protects un_bufv[] */
+	struct mpc_regbuf          *un_bufv[MPIOC_BUF_MAX];
 	struct device              *un_device;
 	struct backing_dev_info    *un_saved_bdi;
 	struct mpc_attr            *un_attr;
+	struct mpc_attr            *un_mllat;
+	struct mpc_numa_stat       *un_numa;        /* Indexed by node ID */
+	struct mpc_budget           un_budget;
+	atomic64_t                  un_xvmstats[MPC_XS_MAX];
 	uint                        un_rawio;       /* log2(max_mblock_size) */
 	u64                         un_ds_oidv[2];
 	u32                         un_ra_pages_max;
@@ -148,7 +205,7 @@ struct mpc_mpool {
 };
 
 /*
- * Arguments required to initiate an asynchronous call to mblock_read()
+ * Arguments required to initiate an asynchronous call to mpc_xvm_read()
  * and which must also be preserved across that call.
  *
  * Note: We could make things more efficient by changing a_pagev[]
@@ -157,7 +214,7 @@ struct mpc_mpool {
  */
 struct readpage_args {
 	void                       *a_xvm;
-	struct mblock_descriptor   *a_mbdesc;
+	struct mpc_mbinfo          *a_mbinfo;
 	u64                         a_mboffset;
 	int                         a_pagec;
 	struct page                *a_pagev[];
@@ -170,6 +227,18 @@ struct readpage_work {
 
 static void mpc_xvm_put(struct mpc_xvm *xvm);
 
+static void mpc_xvm_ra_fault(struct vm_area_struct *vma, pgoff_t index);
+
+static void mpc_xvm_huge_fill(struct vm_area_struct *vma, pgoff_t index);
+
+static merr_t
+mpc_xvm_read(
+	struct mpc_xvm     *xvm,
+	struct mpc_mbinfo  *mbinfo,
+	struct kvec        *iov,
+	int                 iovcnt,
+	off_t               offset);
+
 static merr_t mpc_cf_journal(struct mpc_unit *unit);
 
 static merr_t
@@ -181,6 +250,7 @@ mpc_physio(
 	off_t                       offset,
 	enum mp_obj_type            objtype,
 	int                         rw,
+	struct mpc_regbuf          *rb,
 	void                       *stkbuf,
 	size_t                      stkbufsz);
 
@@ -207,7 +277,7 @@ static const struct mpc_uinfo mpc_uinfo_mpool = {
 static struct mpc_softstate     mpc_softstate;
 
 static struct workqueue_struct *mpc_wq_trunc __read_mostly;
-static struct workqueue_struct *mpc_wq_rav[4] __read_mostly;
+
 static struct mpc_reap *mpc_reap __read_mostly;
 
 static size_t mpc_xvm_cachesz[2] __read_mostly;
@@ -236,7 +306,7 @@ unsigned int mpc_xvm_size_max __read_mostly = 30;
 module_param(mpc_xvm_size_max, uint, 0444);
 MODULE_PARM_DESC(mpc_xvm_size_max, " max extended VMA size log2");
 
-static unsigned int mpc_rwsz_max __read_mostly = 32;
+unsigned int mpc_rwsz_max __read_mostly = 32;
 module_param(mpc_rwsz_max, uint, 0444);
 MODULE_PARM_DESC(mpc_rwsz_max, " max mblock/mlog r/w size (mB)");
 
@@ -251,6 +321,82 @@ unsigned int mpc_chunker_size __read_mostly = 128;
 module_param(mpc_chunker_size, uint, 0644);
 MODULE_PARM_DESC(mpc_chunker_size, "Chunking size (in KiB) for device I/O");
 
+unsigned int mpc_pd_qdepth __read_mostly = 128;
+module_param(mpc_pd_qdepth, uint, 0444);
+MODULE_PARM_DESC(mpc_pd_qdepth, "Max I/Os in flight per device, 0 to disable I/O classes");
+
+unsigned int mpc_pd_dax __read_mostly;
+module_param(mpc_pd_dax, uint, 0444);
+MODULE_PARM_DESC(mpc_pd_dax, "Write to DAX capable NVDIMM devices with CPU stores");
+
+static unsigned int mpc_mb_fuadefer __read_mostly;
+module_param(mpc_mb_fuadefer, uint, 0644);
+MODULE_PARM_DESC(mpc_mb_fuadefer, "Flush at mblock commit instead of FUA writes (applies at activate)");
+
+static unsigned int mpc_mbcache_size __read_mostly;
+module_param(mpc_mbcache_size, uint, 0644);
+MODULE_PARM_DESC(mpc_mbcache_size, "Per-mpool mblock read cache size (MiB, applies at activate)");
+
+static unsigned int mpc_mlog_cksum __read_mostly;
+module_param(mpc_mlog_cksum, uint, 0644);
+MODULE_PARM_DESC(mpc_mlog_cksum, "Checksum mlog and MDC log blocks with CRC32C (applies at activate)");
+
+static unsigned int mpc_tier_period __read_mostly = MPOOL_TIER_PERIOD_DEFAULT;
+module_param(mpc_tier_period, uint, 0644);
+MODULE_PARM_DESC(mpc_tier_period, "Mblock tiering period (sec, 0 disables, applies at activate)");
+
+static unsigned int mpc_tier_budget __read_mostly = MPOOL_TIER_BUDGET_DEFAULT;
+module_param(mpc_tier_budget, uint, 0644);
+MODULE_PARM_DESC(mpc_tier_budget, "Max mblock data moved per tiering pass (MiB, applies at activate)");
+
+static unsigned int mpc_tier_heat __read_mostly = MPOOL_TIER_HEAT_DEFAULT;
+module_param(mpc_tier_heat, uint, 0644);
+MODULE_PARM_DESC(mpc_tier_heat, "Decayed read count at which mblocks are promoted (applies at activate)");
+
+static unsigned int mpc_defrag_period __read_mostly = MPOOL_DEFRAG_PERIOD_DEFAULT;
+module_param(mpc_defrag_period, uint, 0644);
+MODULE_PARM_DESC(mpc_defrag_period, "Free space defrag period (sec, 0 disables, applies at activate)");
+
+static unsigned int mpc_defrag_budget __read_mostly = MPOOL_DEFRAG_BUDGET_DEFAULT;
+module_param(mpc_defrag_budget, uint, 0644);
+MODULE_PARM_DESC(mpc_defrag_budget, "Max mblock data moved per defrag pass (MiB, applies at activate)");
+
+static unsigned int mpc_defrag_pct __read_mostly = MPOOL_DEFRAG_PCT_DEFAULT;
+module_param(mpc_defrag_pct, uint, 0644);
+MODULE_PARM_DESC(mpc_defrag_pct, "% of a region's free space fragmented to defrag it (applies at activate)");
+
+static unsigned int mpc_rebal_rate __read_mostly = MPOOL_REBAL_RATE_DEFAULT;
+module_param(mpc_rebal_rate, uint, 0644);
+MODULE_PARM_DESC(mpc_rebal_rate, "Mblocks moved to an added drive (MiB/s, 0 disables, applies at activate)");
+
+static unsigned int mpc_erase_rate __read_mostly = MPOOL_ERASE_RATE_DEFAULT;
+module_param(mpc_erase_rate, uint, 0644);
+MODULE_PARM_DESC(mpc_erase_rate, "Space of deleted objects erased (MiB/s, 0 for no limit, applies at activate)");
+
+static unsigned int mpc_wq_hipri __read_mostly = MPOOL_WQ_HIPRI_DEFAULT;
+module_param(mpc_wq_hipri, uint, 0644);
+MODULE_PARM_DESC(mpc_wq_hipri, "Bitmask of per-mpool workqueues that are WQ_HIGHPRI (applies at activate)");
+
+static unsigned int mpc_wq_percpu __read_mostly = MPOOL_WQ_PERCPU_DEFAULT;
+module_param(mpc_wq_percpu, uint, 0644);
+MODULE_PARM_DESC(mpc_wq_percpu, "Bitmask of per-mpool workqueues that are per-cpu (applies at activate)");
+
+static unsigned int mpc_wq_maxactive __read_mostly = MPOOL_WQ_MAXACTIVE_DEFAULT;
+module_param(mpc_wq_maxactive, uint, 0644);
+MODULE_PARM_DESC(mpc_wq_maxactive, "max_active of the per-mpool workqueues (0 for default, applies at activate)");
+
+static int mpc_wq_node __read_mostly = -1;
+module_param(mpc_wq_node, int, 0644);
+MODULE_PARM_DESC(mpc_wq_node, "NUMA node for unbound per-mpool work (-1 for any, applies at activate)");
+
+static unsigned int mpc_mlog_bufsz __read_mostly = MPOOL_MLBUF_SZ_DEFAULT;
+module_param(mpc_mlog_bufsz, uint, 0644);
+MODULE_PARM_DESC(mpc_mlog_bufsz, "Per-mpool mlog buffer pool size (MiB, applies at activate)");
+
+static unsigned int mpc_pd_pollioc __read_mostly = MPOOL_PD_POLLIOC_DEFAULT;
+module_param(mpc_pd_pollioc, uint, 0644);
+MODULE_PARM_DESC(mpc_pd_pollioc, "I/O classes completed by polling, 1 logsync, 2 meta, 4 read (applies at activate)");
+
 static struct mpc_softstate *mpc_cdev2ss(struct cdev *cdev)
 {
 	if (ev(!cdev || cdev->owner != THIS_MODULE)) {
@@ -425,6 +571,24 @@ static void mpool_to_mpcore_params(struct mpool_params *params, struct mpcore_pa
 
 	if (mdcnum != 0)
 		mpc_params->mp_mdcnum = mdcnum;
+
+	mpc_params->mp_mbfuadefer = !!mpc_mb_fuadefer;
+	mpc_params->mp_mbcachesz = mpc_mbcache_size;
+	mpc_params->mp_mlcksum = !!mpc_mlog_cksum;
+	mpc_params->mp_tierperiod = mpc_tier_period;
+	mpc_params->mp_tierbudget = mpc_tier_budget;
+	mpc_params->mp_tierheat = max_t(uint, mpc_tier_heat, 1);
+	mpc_params->mp_defragperiod = mpc_defrag_period;
+	mpc_params->mp_defragbudget = mpc_defrag_budget;
+	mpc_params->mp_defragpct = min_t(uint, mpc_defrag_pct, 100);
+	mpc_params->mp_rebalrate = mpc_rebal_rate;
+	mpc_params->mp_wqhipri = mpc_wq_hipri;
+	mpc_params->mp_wqpercpu = mpc_wq_percpu;
+	mpc_params->mp_wqmaxactive = min_t(uint, mpc_wq_maxactive, WQ_MAX_ACTIVE);
+	mpc_params->mp_wqnode = mpc_wq_node < 0 ? MPOOL_WQ_NODE_ANY : mpc_wq_node;
+	mpc_params->mp_pollioc = mpc_pd_pollioc & PD_IOC_POLLMASK;
+	mpc_params->mp_mlbufsz = mpc_mlog_bufsz;
+	mpc_params->mp_eraserate = mpc_erase_rate;
 }
 
 struct mpc_reap *dev_to_reap(struct device *dev)
@@ -432,7 +596,7 @@ struct mpc_reap *dev_to_reap(struct device *dev)
 	return dev_to_unit(dev)->un_ds_reap;
 }
 
-#define MPC_MPOOL_PARAMS_CNT     7
+#define MPC_MPOOL_PARAMS_CNT     14
 
 static ssize_t mpc_uid_show(struct device *dev, struct device_attribute *da, char *buf)
 {
@@ -475,6 +639,116 @@ static ssize_t mpc_type_show(struct device *dev, struct device_attribute *da, ch
 	return scnprintf(buf, PAGE_SIZE, "%s\n", uuid_str);
 }
 
+static ssize_t mpc_numa_show(struct device *dev, struct device_attribute *da, char *buf)
+{
+	struct mpc_numa_stat   *stat = dev_to_unit(dev)->un_numa;
+	ssize_t                 cc = 0;
+	int                     nid;
+
+	for_each_online_node(nid)
+		cc += scnprintf(buf + cc, PAGE_SIZE - cc, "node%d local %lld remote %lld\n", nid,
+				atomic64_read(&stat[nid].ns_local),
+				atomic64_read(&stat[nid].ns_remote));
+
+	return cc;
+}
+
+static ssize_t mpc_budget_show(struct device *dev, struct device_attribute *da, char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "%lld\n",
+			 atomic64_read(&dev_to_unit(dev)->un_budget.bg_pages) >> (20 - PAGE_SHIFT));
+}
+
+static ssize_t mpc_budget_limit_store(const char *buf, size_t count, ulong *limitp)
+{
+	ulong   val;
+	int     rc;
+
+	/* Limits are given in MiB, zero for none. */
+	rc = kstrtoul(buf, 10, &val);
+	if (rc || val > (ULONG_MAX >> 20))
+		return -EINVAL;
+
+	WRITE_ONCE(*limitp, val << (20 - PAGE_SHIFT));
+
+	return count;
+}
+
+static ssize_t mpc_budget_soft_show(struct device *dev, struct device_attribute *da, char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "%lu\n",
+			 dev_to_unit(dev)->un_budget.bg_soft >> (20 - PAGE_SHIFT));
+}
+
+static ssize_t
+mpc_budget_soft_store(struct device *dev, struct device_attribute *da, const char *buf,
+		      size_t count)
+{
+	return mpc_budget_limit_store(buf, count, &dev_to_unit(dev)->un_budget.bg_soft);
+}
+
+static ssize_t mpc_budget_hard_show(struct device *dev, struct device_attribute *da, char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "%lu\n",
+			 dev_to_unit(dev)->un_budget.bg_hard >> (20 - PAGE_SHIFT));
+}
+
+static ssize_t
+mpc_budget_hard_store(struct device *dev, struct device_attribute *da, const char *buf,
+		      size_t count)
+{
+	return mpc_budget_limit_store(buf, count, &dev_to_unit(dev)->un_budget.bg_hard);
+}
+
+static const char * const mpc_xvm_stat_names[MPC_XS_MAX] = {
+	[MPC_XS_FAULTS]       = "faults",
+	[MPC_XS_MAJFAULTS]    = "majfaults",
+	[MPC_XS_REFAULTS]     = "refaults",
+	[MPC_XS_FA_PAGES]     = "fa_pages",
+	[MPC_XS_FA_USED]      = "fa_used",
+	[MPC_XS_RA_PAGES]     = "ra_pages",
+	[MPC_XS_RA_USED]      = "ra_used",
+	[MPC_XS_EVICT_REAP]   = "evict_reap",
+	[MPC_XS_EVICT_KERNEL] = "evict_kernel",
+};
+
+static ssize_t mpc_xvm_stats_show(struct device *dev, struct device_attribute *da, char *buf)
+{
+	struct mpc_unit    *unit = dev_to_unit(dev);
+	ssize_t             cc = 0;
+	int                 i;
+
+	for (i = 0; i < MPC_XS_MAX; ++i)
+		cc += scnprintf(buf + cc, PAGE_SIZE - cc, "%s %lld\n", mpc_xvm_stat_names[i],
+				atomic64_read(&unit->un_xvmstats[i]));
+
+	return cc;
+}
+
+static ssize_t mpc_mlog_bufs_show(struct device *dev, struct device_attribute *da, char *buf)
+{
+	struct mlog_bufpool_stats   stats;
+
+	mlog_bufpool_stats_get(dev_to_unit(dev)->un_mpool->mp_desc, &stats);
+
+	return scnprintf(buf, PAGE_SIZE,
+			 "idle %llu\nlent %llu\nmax %llu\nhits %llu\nmisses %llu\nreclaims %llu\n",
+			 stats.mbs_idle, stats.mbs_lent, stats.mbs_max, stats.mbs_hits,
+			 stats.mbs_misses, stats.mbs_reclaims);
+}
+
+static ssize_t mpc_rebalance_show(struct device *dev, struct device_attribute *da, char *buf)
+{
+	struct mpool_rebal_stats    stats;
+
+	mpool_rebal_stats_get(dev_to_unit(dev)->un_mpool->mp_desc, &stats);
+
+	return scnprintf(buf, PAGE_SIZE,
+			 "active %u\npd %s\ntarget_mb %llu\nmoved_mb %llu\nelapsed_s %llu\neta_s %llu\n",
+			 stats.mrs_active, stats.mrs_pdname, stats.mrs_target >> 20,
+			 stats.mrs_moved >> 20, stats.mrs_elapsed, stats.mrs_eta);
+}
+
 static void mpc_mpool_params_add(struct device_attribute *dattr)
 {
 	MPC_ATTR_RO(dattr++, uid);
@@ -483,9 +757,78 @@ static void mpc_mpool_params_add(struct device_attribute *dattr)
 	MPC_ATTR_RO(dattr++, ra);
 	MPC_ATTR_RO(dattr++, label);
 	MPC_ATTR_RO(dattr++, vma);
+	MPC_ATTR_RO(dattr++, numa);
+	MPC_ATTR_RO(dattr++, budget);
+	MPC_ATTR_RW(dattr++, budget_soft);
+	MPC_ATTR_RW(dattr++, budget_hard);
+	MPC_ATTR_RO(dattr++, xvm_stats);
+	MPC_ATTR_RO(dattr++, mlog_bufs);
+	MPC_ATTR_RO(dattr++, rebalance);
 	MPC_ATTR_RO(dattr,   type);
 }
 
+static ssize_t mpc_mlog_lat_show(struct device *dev, struct device_attribute *da, char *buf)
+{
+	struct mpc_unit    *unit = dev_to_unit(dev);
+	u64                 bktv[MLOG_LAT_BKTC];
+
+	mlog_lat_get(unit->un_mpool->mp_desc, da - unit->un_mllat->a_dattr, bktv);
+
+	return mpc_attr_hist_show(buf, bktv, MLOG_LAT_BKTC, MLOG_LAT_SHIFT);
+}
+
+static ssize_t
+mpc_mlog_lat_reset_store(struct device *dev, struct device_attribute *da, const char *buf,
+			 size_t count)
+{
+	mlog_lat_reset(dev_to_unit(dev)->un_mpool->mp_desc);
+
+	return count;
+}
+
+/**
+ * mpc_mlog_lat_register() - Create the per-mpool "mlog_latency" sysfs group
+ * @unit:
+ *
+ * One read-only histogram file per enum mlog_lat_op, plus a write-only
+ * "reset" file which clears all of them.
+ */
+static merr_t mpc_mlog_lat_register(struct mpc_unit *unit)
+{
+	struct mpc_attr            *attr;
+	struct device_attribute    *dattr;
+	int                         rc, i;
+
+	attr = mpc_attr_create(unit->un_device, "mlog_latency", MLOG_LAT_MAX + 1);
+	if (ev(!attr))
+		return merr(ENOMEM);
+
+	dattr = attr->a_dattr;
+
+	for (i = 0; i < MLOG_LAT_MAX; i++, dattr++) {
+		dattr->attr.name = mlog_lat_name(i);
+		dattr->attr.mode = 0444;
+		dattr->show = mpc_mlog_lat_show;
+		dattr->store = NULL;
+	}
+
+	dattr->attr.name = "reset";
+	dattr->attr.mode = 0200;
+	dattr->show = NULL;
+	dattr->store = mpc_mlog_lat_reset_store;
+
+	unit->un_mllat = attr;
+
+	rc = mpc_attr_group_create(attr);
+	if (ev(rc)) {
+		unit->un_mllat = NULL;
+		mpc_attr_destroy(attr);
+		return merr(rc);
+	}
+
+	return 0;
+}
+
 static merr_t mpc_params_register(struct mpc_unit *unit, int cnt)
 {
 	struct mpc_attr            *attr;
@@ -514,11 +857,20 @@ static merr_t mpc_params_register(struct mpc_unit *unit, int cnt)
 
 	unit->un_attr = attr;
 
+	if (mpc_unit_ismpooldev(unit))
+		return mpc_mlog_lat_register(unit);
+
 	return 0;
 }
 
 static void mpc_params_unregister(struct mpc_unit *unit)
 {
+	if (unit->un_mllat) {
+		mpc_attr_group_destroy(unit->un_mllat);
+		mpc_attr_destroy(unit->un_mllat);
+		unit->un_mllat = NULL;
+	}
+
 	mpc_attr_group_destroy(unit->un_attr);
 	mpc_attr_destroy(unit->un_attr);
 	unit->un_attr = NULL;
@@ -628,6 +980,12 @@ static merr_t mpc_unit_create(const char *name, struct mpc_mpool *mpool, struct
 	if (!unit)
 		return merr(ENOMEM);
 
+	unit->un_numa = kcalloc(nr_node_ids, sizeof(*unit->un_numa), GFP_KERNEL);
+	if (!unit->un_numa) {
+		kfree(unit);
+		return merr(ENOMEM);
+	}
+
 	strcpy(unit->un_name, name);
 
 	sema_init(&unit->un_open_lock, 1);
@@ -636,16 +994,21 @@ static merr_t mpc_unit_create(const char *name, struct mpc_mpool *mpool, struct
 	unit->un_devno = NODEV;
 	kref_init(&unit->un_ref);
 	unit->un_mpool = mpool;
+	spin_lock_init(&unit->un_buflock);
 
 	mutex_init(&unit->un_rgnmap.rm_lock);
 	idr_init(&unit->un_rgnmap.rm_root);
 	atomic_set(&unit->un_rgnmap.rm_rgncnt, 0);
 
+	INIT_LIST_HEAD(&unit->un_budget.bg_list);
+	atomic64_set(&unit->un_budget.bg_pages, 0);
+
 	mutex_lock(&ss->ss_lock);
 	minor = idr_alloc(&ss->ss_unitmap, NULL, 0, -1, GFP_KERNEL);
 	mutex_unlock(&ss->ss_lock);
 
 	if (minor < 0) {
+		kfree(unit->un_numa);
 		kfree(unit);
 		return merr(minor);
 	}
@@ -673,18 +1036,19 @@ static void mpc_unit_release(struct kref *refp)
 	idr_remove(&ss->ss_unitmap, MINOR(unit->un_devno));
 	mutex_unlock(&ss->ss_lock);
 
-	if (unit->un_mpool)
-		mpc_mpool_put(unit->un_mpool);
-
 	if (unit->un_attr)
 		mpc_params_unregister(unit);
 
+	if (unit->un_mpool)
+		mpc_mpool_put(unit->un_mpool);
+
 	if (unit->un_device)
 		device_destroy(ss->ss_class, unit->un_devno);
 
 	idr_destroy(&unit->un_rgnmap.rm_root);
 
-	kfree(unit);
+	kfree(unit->un_numa);
+	kfree_rcu(unit, un_rcu);
 }
 
 static void mpc_unit_put(struct mpc_unit *unit)
@@ -699,22 +1063,21 @@ static void mpc_unit_put(struct mpc_unit *unit)
  * @unitp:  unit ptr
  *
  * Returns a referenced ptr to the unit (via *unitp) if found,
- * otherwise it sets *unitp to NULL.
+ * otherwise it sets *unitp to NULL.  A unit whose last reference
+ * is being dropped is not found.
  */
 static void mpc_unit_lookup(int minor, struct mpc_unit **unitp)
 {
 	struct mpc_softstate   *ss = &mpc_softstate;
 	struct mpc_unit        *unit;
 
-	*unitp = NULL;
-
-	mutex_lock(&ss->ss_lock);
+	rcu_read_lock();
 	unit = idr_find(&ss->ss_unitmap, minor);
-	if (unit) {
-		kref_get(&unit->un_ref);
-		*unitp = unit;
-	}
-	mutex_unlock(&ss->ss_lock);
+	if (unit && !kref_get_unless_zero(&unit->un_ref))
+		unit = NULL;
+	rcu_read_unlock();
+
+	*unitp = unit;
 }
 
 /**
@@ -745,7 +1108,8 @@ static int mpc_unit_lookup_by_name_itercb(int minor, void *item, void *arg)
 		return ITERCB_NEXT;
 
 	if (strcmp(unit->un_name, name) == 0) {
-		kref_get(&unit->un_ref);
+		if (!kref_get_unless_zero(&unit->un_ref))
+			return ITERCB_NEXT;
 		argv[2] = unit;
 		return ITERCB_DONE;
 	}
@@ -769,9 +1133,9 @@ mpc_unit_lookup_by_name(struct mpc_unit *parent, const char *name, struct mpc_un
 	struct mpc_softstate *ss = &mpc_softstate;
 	void   *argv[] = { parent, (void *)name, NULL };
 
-	mutex_lock(&ss->ss_lock);
+	rcu_read_lock();
 	idr_for_each(&ss->ss_unitmap, mpc_unit_lookup_by_name_itercb, argv);
-	mutex_unlock(&ss->ss_lock);
+	rcu_read_unlock();
 
 	*unitp = argv[2];
 }
@@ -882,11 +1246,6 @@ errout:
 	return err;
 }
 
-static struct workqueue_struct *mpc_rgn2wq(uint rgn)
-{
-	return mpc_wq_rav[rgn % ARRAY_SIZE(mpc_wq_rav)];
-}
-
 static int mpc_rgnmap_isorphan(int rgn, void *item, void *data)
 {
 	struct mpc_xvm *xvm = item;
@@ -973,6 +1332,8 @@ again:
 	xvm->xvm_magic = 0xbadcafe;
 	xvm->xvm_rgn = -1;
 
+	kvfree(xvm->xvm_evictmap);
+	kvfree(xvm->xvm_mbidv);
 	kmem_cache_free(xvm->xvm_cache, xvm);
 
 	atomic_dec(&rm->rm_rgncnt);
@@ -1008,10 +1369,14 @@ static void mpc_xvm_release(struct kref *kref)
 	 * before we drop our mblock references.
 	 */
 	if (atomic_add_return(WQ_MAX_ACTIVE, &xvm->xvm_rabusy) > WQ_MAX_ACTIVE)
-		flush_workqueue(mpc_rgn2wq(xvm->xvm_rgn));
+		flush_workqueue(mpool_wq(xvm->xvm_mpdesc, MPOOL_WQ_RA));
 
-	for (i = 0; i < xvm->xvm_mbinfoc; ++i)
-		mblock_put(xvm->xvm_mpdesc, xvm->xvm_mbinfov[i].mbdesc);
+	for (i = 0; i < xvm->xvm_mbinfoc; ++i) {
+		if (xvm->xvm_mlog)
+			mlog_put(xvm->xvm_mpdesc, xvm->xvm_mbinfov[i].mldesc);
+		else if (xvm->xvm_mbinfov[i].mbdesc)
+			mblock_put(xvm->xvm_mpdesc, xvm->xvm_mbinfov[i].mbdesc);
+	}
 
 	INIT_WORK(&xvm->xvm_work, mpc_xvm_free_cb);
 	queue_work(mpc_wq_trunc, &xvm->xvm_work);
@@ -1036,27 +1401,209 @@ static void mpc_vm_close(struct vm_area_struct *vma)
 	mpc_xvm_put(vma->vm_private_data);
 }
 
+static void mpc_xvm_stat_add(struct mpc_xvm *xvm, enum mpc_xvm_stat stat, long n)
+{
+	atomic64_add(n, &xvm->xvm_stats[stat]);
+	atomic64_add(n, &xvm->xvm_ustats[stat]);
+}
+
+/*
+ * Pages read speculatively are tagged until first faulted on, PG_checked
+ * for pages read around a major fault and MPC_PAGE_RA in page_private()
+ * for pages read by readahead.  page_private() otherwise holds the xvm
+ * pointer, whose low bits are clear.  Pages mapped by fault-around without
+ * a fault of their own are not seen, hence not counted as used.
+ */
+#define MPC_PAGE_RA_BIT     0
+#define MPC_PAGE_RA         (1ul << MPC_PAGE_RA_BIT)
+
+static inline struct mpc_xvm *mpc_page_xvm(struct page *page)
+{
+	return (void *)(page_private(page) & ~MPC_PAGE_RA);
+}
+
+static void mpc_xvm_page_used(struct mpc_xvm *xvm, struct page *page)
+{
+	if (test_bit(PG_checked, &page->flags) && test_and_clear_bit(PG_checked, &page->flags))
+		mpc_xvm_stat_add(xvm, MPC_XS_FA_USED, 1);
+
+	if ((page_private(page) & MPC_PAGE_RA) &&
+	    test_and_clear_bit(MPC_PAGE_RA_BIT, &page->private))
+		mpc_xvm_stat_add(xvm, MPC_XS_RA_USED, 1);
+}
+
+/**
+ * mpc_page_alloc() - Allocate a page cache page on the current CPU's node
+ * @gfp:
+ *
+ * Faults and the readahead they trigger allocate from the faulting CPU's
+ * node (or the nearest node with memory), unless the task has a memory
+ * policy or its cpuset spreads page cache pages, both of which we honor.
+ */
+static struct page *mpc_page_alloc(gfp_t gfp)
+{
+#ifdef CONFIG_NUMA
+	if (!current->mempolicy && !cpuset_do_page_mem_spread())
+		return alloc_pages_node(numa_mem_id(), gfp, 0);
+#endif
+	return __page_cache_alloc(gfp);
+}
+
+/**
+ * mpc_readrun() - Read a run of contiguous, locked pages of an mblock
+ * @xvm:
+ * @mbinfo: mblock the run lies within
+ * @index:  page index of the first page
+ * @pagev:  pages, which have been added to the page cache
+ * @pagec:  number of pages
+ *
+ * Unlocks and drops the caller's reference on each page.
+ */
+static int
+mpc_readrun(
+	struct mpc_xvm     *xvm,
+	struct mpc_mbinfo  *mbinfo,
+	pgoff_t             index,
+	struct page       **pagev,
+	int                 pagec)
+{
+	struct kvec iov[MPC_FAULT_AROUND_PAGES];
+
+	off_t   offset;
+	merr_t  err;
+	int     i;
+
+	offset  = index << PAGE_SHIFT;
+	offset %= (1ul << mpc_xvm_size_max);
+	offset %= xvm->xvm_bktsz;
+
+	for (i = 0; i < pagec; ++i) {
+		iov[i].iov_base = page_address(pagev[i]);
+		iov[i].iov_len = PAGE_SIZE;
+	}
+
+	err = mpc_xvm_read(xvm, mbinfo, iov, pagec, offset);
+	if (!ev(err))
+		mpc_xvm_nrpages_add(xvm, pagec);
+
+	for (i = 0; i < pagec; ++i) {
+		struct page *page = pagev[i];
+
+		if (!err) {
+			SetPagePrivate(page);
+			set_page_private(page, (ulong)xvm);
+			SetPageUptodate(page);
+		}
+
+		unlock_page(page);
+		put_page(page);
+	}
+
+	return -merr_errno(err);
+}
+
+/**
+ * mpc_alloc_and_readpage() - Read in an uncached page and its neighbours
+ * @vma:
+ * @offset: page index of the faulting page
+ * @gfp:
+ *
+ * Reads the MPC_FAULT_AROUND_PAGES aligned cluster around the faulting
+ * page, clipped to its mblock, so that the neighbours of a random lookup
+ * are resident for the fault-around handler to map.  Neighbours already
+ * cached split the cluster into runs, each of which is read with a single
+ * I/O.  Only failures on the faulting page are reported.
+ */
 static int mpc_alloc_and_readpage(struct vm_area_struct *vma, pgoff_t offset, gfp_t gfp)
 {
-	struct file            *file;
-	struct page            *page;
+	struct page            *pagev[MPC_FAULT_AROUND_PAGES];
+	struct mpc_xvm         *xvm = vma->vm_private_data;
 	struct address_space   *mapping;
-	int                     rc;
+	struct mpc_mbinfo      *mbinfo;
 
-	page = __page_cache_alloc(gfp | __GFP_NOWARN);
-	if (ev(!page))
-		return -ENOMEM;
+	pgoff_t lo, hi, mbpg, start, idx;
+	off_t   mboff;
+	uint    mbnum;
+	int     pagec, rc, err;
 
-	file    = vma->vm_file;
-	mapping = file->f_mapping;
+	mapping = vma->vm_file->f_mapping;
 
-	rc = add_to_page_cache_lru(page, mapping, offset, gfp & GFP_KERNEL);
-	if (rc == 0)
-		rc = mpc_readpage_impl(page, vma->vm_private_data);
-	else if (rc == -EEXIST)
-		rc = 0;
+	mboff  = offset << PAGE_SHIFT;
+	mboff %= (1ul << mpc_xvm_size_max);
 
-	put_page(page);
+	mbnum = mboff / xvm->xvm_bktsz;
+	if (ev(mbnum >= xvm->xvm_mbinfoc))
+		return -EINVAL;
+
+	mbinfo = xvm->xvm_mbinfov + mbnum;
+	mboff %= xvm->xvm_bktsz;
+
+	if (ev(mboff >= mbinfo->mblen))
+		return -EINVAL;
+
+	mbpg = offset - (mboff >> PAGE_SHIFT);
+	lo = max_t(pgoff_t, round_down(offset, MPC_FAULT_AROUND_PAGES), mbpg);
+	hi = min_t(pgoff_t, round_down(offset, MPC_FAULT_AROUND_PAGES) + MPC_FAULT_AROUND_PAGES,
+		   mbpg + (mbinfo->mblen >> PAGE_SHIFT));
+
+	pagec = 0;
+	start = lo;
+	rc = 0;
+
+	for (idx = lo; idx < hi; ++idx) {
+		struct page *page = NULL;
+
+		if (idx != offset) {
+			page = find_get_page(mapping, idx);
+			if (page) {
+				put_page(page);
+				page = NULL;
+			} else {
+				page = mpc_page_alloc(gfp | __GFP_NORETRY | __GFP_NOWARN);
+				if (page && add_to_page_cache_lru(page, mapping, idx, gfp & GFP_KERNEL)) {
+					put_page(page);
+					page = NULL;
+				}
+
+				if (page) {
+					SetPageChecked(page);
+					mpc_xvm_stat_add(xvm, MPC_XS_FA_PAGES, 1);
+				}
+			}
+		} else {
+			page = mpc_page_alloc(gfp | __GFP_NOWARN);
+			if (ev(!page)) {
+				rc = -ENOMEM;
+			} else {
+				err = add_to_page_cache_lru(page, mapping, idx, gfp & GFP_KERNEL);
+				if (err) {
+					put_page(page);
+					page = NULL;
+					rc = (err == -EEXIST) ? 0 : err;
+				}
+			}
+		}
+
+		if (page) {
+			if (pagec == 0)
+				start = idx;
+			pagev[pagec++] = page;
+			continue;
+		}
+
+		if (pagec > 0) {
+			err = mpc_readrun(xvm, mbinfo, start, pagev, pagec);
+			if (offset >= start && offset < start + pagec)
+				rc = err;
+			pagec = 0;
+		}
+	}
+
+	if (pagec > 0) {
+		err = mpc_readrun(xvm, mbinfo, start, pagev, pagec);
+		if (offset >= start && offset < start + pagec)
+			rc = err;
+	}
 
 	return rc;
 }
@@ -1119,6 +1666,36 @@ static int mpc_handle_page_error(struct page *page, struct vm_area_struct *vma)
 	return rc;
 }
 
+/**
+ * mpc_numa_count() - Account a faulted page as node local or remote
+ * @unit:
+ * @page:
+ */
+static void mpc_numa_count(struct mpc_unit *unit, struct page *page)
+{
+	int nid = numa_node_id();
+
+	if (page_to_nid(page) == nid)
+		atomic64_inc(&unit->un_numa[nid].ns_local);
+	else
+		atomic64_inc(&unit->un_numa[nid].ns_remote);
+}
+
+static void mpc_xvm_fault_stats(struct mpc_xvm *xvm, struct page *page, bool major)
+{
+	mpc_xvm_stat_add(xvm, MPC_XS_FAULTS, 1);
+
+	if (major) {
+		mpc_xvm_stat_add(xvm, MPC_XS_MAJFAULTS, 1);
+
+		if (xvm->xvm_evictmap &&
+		    test_and_clear_bit(page->index - mpc_xvm_pgoff(xvm), xvm->xvm_evictmap))
+			mpc_xvm_stat_add(xvm, MPC_XS_REFAULTS, 1);
+	}
+
+	mpc_xvm_page_used(xvm, page);
+}
+
 static vm_fault_t mpc_vm_fault_impl(struct vm_area_struct *vma, struct vm_fault *vmf)
 {
 	struct address_space   *mapping;
@@ -1127,6 +1704,9 @@ static vm_fault_t mpc_vm_fault_impl(struct vm_area_struct *vma, struct vm_fault
 	pgoff_t                 offset;
 	loff_t                  size;
 	struct page            *page;
+	u64                     tstart;
+
+	tstart = trace_mpool_xvm_fault_enabled() ? ktime_get_ns() : 0;
 
 	mapping = vma->vm_file->f_mapping;
 	inode   = mapping->host;
@@ -1137,6 +1717,9 @@ static vm_fault_t mpc_vm_fault_impl(struct vm_area_struct *vma, struct vm_fault
 	if (ev(offset >= (size >> PAGE_SHIFT)))
 		return VM_FAULT_SIGBUS;
 
+	if (((struct mpc_xvm *)vma->vm_private_data)->xvm_huge)
+		mpc_xvm_huge_fill(vma, offset);
+
 retry_find:
 	page = find_get_page(mapping, offset);
 	if (!page) {
@@ -1181,8 +1764,19 @@ retry_find:
 	/* Page is locked with a ref. */
 	vmf->page = page;
 
+	mpc_xvm_fault_stats(vma->vm_private_data, page, vmfrc == VM_FAULT_MAJOR);
+
 	mpc_reap_xvm_touch(vma->vm_private_data, page->index);
 
+	mpc_numa_count(vma->vm_file->private_data, page);
+
+	mpc_xvm_ra_fault(vma, offset);
+
+	if (tstart)
+		trace_mpool_xvm_fault(((struct mpc_xvm *)vma->vm_private_data)->xvm_rgn, offset,
+				      vmfrc == VM_FAULT_MAJOR, ktime_get_ns() - tstart,
+				      vmfrc | VM_FAULT_LOCKED);
+
 	return vmfrc | VM_FAULT_LOCKED;
 }
 
@@ -1205,8 +1799,96 @@ static vm_fault_t mpc_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
  * MPCTL address-space operations.
  */
 
-static int mpc_readpage_impl(struct page *page, struct mpc_xvm *xvm)
-{
+/**
+ * mpc_xvm_resolve() - Look up the mblock of a bucket of a lazy xvm
+ * @xvm:    xvm ptr
+ * @mbinfo: object within the xvm
+ *
+ * Until then mbinfo->mblen is the bucket size, it is trimmed to the mblock
+ * write length before mbinfo->mbdesc is published.  Concurrent faults may
+ * both look the mblock up, the loser drops its ref.
+ */
+static merr_t mpc_xvm_resolve(struct mpc_xvm *xvm, struct mpc_mbinfo *mbinfo)
+{
+	struct mblock_descriptor   *mbdesc;
+	u64                         objid, wlen;
+	merr_t                      err;
+
+	objid = xvm->xvm_mbidv[mbinfo - xvm->xvm_mbinfov];
+
+	err = mblock_find_getv(xvm->xvm_mpdesc, &objid, 1, &mbdesc, &wlen);
+	if (err)
+		return err;
+
+	wlen = ALIGN(wlen, PAGE_SIZE);
+	if (ev(wlen > xvm->xvm_bktsz)) {
+		mblock_put(xvm->xvm_mpdesc, mbdesc);
+		return merr(E2BIG);
+	}
+
+	/* Committed mblocks are immutable, the loser stores the same length */
+	WRITE_ONCE(mbinfo->mblen, wlen);
+
+	if (cmpxchg_release(&mbinfo->mbdesc, NULL, mbdesc))
+		mblock_put(xvm->xvm_mpdesc, mbdesc);
+
+	return 0;
+}
+
+/**
+ * mpc_xvm_read() - Read whole pages from the given object of an xvm
+ * @xvm:    xvm ptr
+ * @mbinfo: object within the xvm
+ * @iov:    one page per element
+ * @iovcnt: number of pages
+ * @offset: page aligned offset within the object
+ *
+ * mlog maps are served raw, the log pages are framed by userspace.
+ *
+ * Reads of a lazy xvm may have been sized by the bucket size before the
+ * bucket's mblock was resolved.  They are trimmed to the mblock write
+ * length, and the pages past it are zero filled.
+ */
+static merr_t
+mpc_xvm_read(
+	struct mpc_xvm     *xvm,
+	struct mpc_mbinfo  *mbinfo,
+	struct kvec        *iov,
+	int                 iovcnt,
+	off_t               offset)
+{
+	struct mblock_descriptor   *mbdesc;
+	merr_t                      err;
+	u32                         mblen;
+	int                         pagec, i;
+
+	if (xvm->xvm_mlog)
+		return mlog_rw_raw(xvm->xvm_mpdesc, mbinfo->mldesc, iov, iovcnt,
+				   offset, MPOOL_OP_READ);
+
+	mbdesc = smp_load_acquire(&mbinfo->mbdesc);
+	if (unlikely(!mbdesc)) {
+		err = mpc_xvm_resolve(xvm, mbinfo);
+		if (err)
+			return err;
+
+		mbdesc = smp_load_acquire(&mbinfo->mbdesc);
+	}
+
+	mblen = READ_ONCE(mbinfo->mblen);
+	if (ev(offset >= mblen))
+		return merr(EINVAL);
+
+	pagec = min_t(u64, iovcnt, (mblen - offset) >> PAGE_SHIFT);
+	for (i = pagec; i < iovcnt; ++i)
+		memset(iov[i].iov_base, 0, PAGE_SIZE);
+
+	return mblock_read(xvm->xvm_mpdesc, mbdesc, iov, pagec,
+			   offset, pagec << PAGE_SHIFT);
+}
+
+static int mpc_readpage_impl(struct page *page, struct mpc_xvm *xvm)
+{
 	struct mpc_mbinfo  *mbinfo;
 	struct kvec         iov[1];
 	off_t               offset;
@@ -1233,15 +1915,13 @@ static int mpc_readpage_impl(struct page *page, struct mpc_xvm *xvm)
 	iov[0].iov_base = page_address(page);
 	iov[0].iov_len = PAGE_SIZE;
 
-	err = mblock_read(xvm->xvm_mpdesc, mbinfo->mbdesc, iov, 1, offset, PAGE_SIZE);
+	err = mpc_xvm_read(xvm, mbinfo, iov, 1, offset);
 	if (ev(err)) {
 		unlock_page(page);
 		return -merr_errno(err);
 	}
 
-	if (xvm->xvm_hcpagesp)
-		atomic64_inc(xvm->xvm_hcpagesp);
-	atomic64_inc(&xvm->xvm_nrpages);
+	mpc_xvm_nrpages_add(xvm, 1);
 
 	SetPagePrivate(page);
 	set_page_private(page, (ulong)xvm);
@@ -1301,21 +1981,19 @@ static void mpc_readpages_cb(struct work_struct *work)
 		iov[i].iov_len = PAGE_SIZE;
 	}
 
-	err = mblock_read(xvm->xvm_mpdesc, args->a_mbdesc, iov,
-			  pagec, args->a_mboffset, pagec << PAGE_SHIFT);
+	err = mpc_xvm_read(xvm, args->a_mbinfo, iov, pagec, args->a_mboffset);
 	if (ev(err))
 		goto errout;
 
-	if (xvm->xvm_hcpagesp)
-		atomic64_add(pagec, xvm->xvm_hcpagesp);
-	atomic64_add(pagec, &xvm->xvm_nrpages);
+	mpc_xvm_nrpages_add(xvm, pagec);
+	mpc_xvm_stat_add(xvm, MPC_XS_RA_PAGES, pagec);
 	atomic_dec(&xvm->xvm_rabusy);
 
 	for (i = 0; i < pagec; ++i) {
 		struct page *page = args->a_pagev[i];
 
 		SetPagePrivate(page);
-		set_page_private(page, (ulong)xvm);
+		set_page_private(page, (ulong)xvm | MPC_PAGE_RA);
 		SetPageUptodate(page);
 
 		unlock_page(page);
@@ -1333,6 +2011,22 @@ errout:
 	}
 }
 
+/**
+ * mpc_ra_queue() - Queue a readahead request on the node of its pages
+ * @mp:
+ * @work: w_work from struct readpage_work
+ *
+ * If the mpool readahead workqueue is unbound, this runs the request in a
+ * worker local to the pages it reads into rather than wherever a worker
+ * happens to be free.
+ */
+static void mpc_ra_queue(struct mpool_descriptor *mp, struct work_struct *work)
+{
+	struct readpage_work *w = container_of(work, struct readpage_work, w_work);
+
+	mpool_queue_work_node(mp, MPOOL_WQ_RA, page_to_nid(w->w_args.a_pagev[0]), work);
+}
+
 static int
 mpc_readpages(
 	struct file            *file,
@@ -1340,7 +2034,7 @@ mpc_readpages(
 	struct list_head       *pages,
 	uint                    nr_pages)
 {
-	struct workqueue_struct    *wq;
+	struct mpool_descriptor    *mp;
 	struct readpage_work       *w;
 	struct work_struct         *work;
 	struct mpc_mbinfo          *mbinfo;
@@ -1348,10 +2042,12 @@ mpc_readpages(
 	struct mpc_xvm             *xvm;
 	struct page                *page;
 
-	off_t   offset, mbend;
-	uint    mbnum, iovmax, i;
+	off_t   offset, mbbase, mbend;
+	uint    mbnum, mbstart, iovmax, i;
 	uint    ra_pages_max;
+	uint    queued = 0;
 	ulong   index;
+	pgoff_t start;
 	gfp_t   gfp;
 	u32     key;
 	int     rc;
@@ -1365,6 +2061,7 @@ mpc_readpages(
 	page   = lru_to_page(pages);
 	offset = page->index << PAGE_SHIFT;
 	index  = page->index;
+	start  = page->index;
 	work   = NULL;
 	w      = NULL;
 
@@ -1390,12 +2087,14 @@ mpc_readpages(
 		return 0;
 
 	mbinfo = xvm->xvm_mbinfov + mbnum;
+	mbstart = mbnum;
 
-	mbend = mbnum * xvm->xvm_bktsz + mbinfo->mblen;
+	mbbase = mbnum * xvm->xvm_bktsz;
+	mbend = mbbase + mbinfo->mblen;
 	iovmax = MPC_RA_IOV_MAX;
 
 	gfp = mapping_gfp_mask(mapping) & GFP_KERNEL;
-	wq = mpc_rgn2wq(xvm->xvm_rgn);
+	mp = xvm->xvm_mpdesc;
 
 	if (mpc_reap_xvm_duress(xvm))
 		nr_pages = min_t(uint, nr_pages, 8);
@@ -1407,13 +2106,36 @@ mpc_readpages(
 		offset  = page->index << PAGE_SHIFT;
 		offset %= (1ul << mpc_xvm_size_max);
 
-		/* Don't read past the end of the mblock. */
-		if (offset >= mbend)
-			break;
+		/*
+		 * Switch mblocks whenever a page falls outside the current
+		 * one, in either direction as strided readahead may walk the
+		 * xvm backwards.  The pages in the unused tail of a bucket
+		 * cannot be read.
+		 */
+		if (offset < mbbase || offset >= mbend) {
+			if (work) {
+				mpc_ra_queue(mp, work);
+				work = NULL;
+			}
+
+			mbnum = offset / xvm->xvm_bktsz;
+			if (mbnum >= xvm->xvm_mbinfoc)
+				break;
+
+			mbinfo = xvm->xvm_mbinfov + mbnum;
+			mbbase = mbnum * xvm->xvm_bktsz;
+			mbend = mbbase + mbinfo->mblen;
+
+			if (offset >= mbend) {
+				list_del(&page->lru);
+				put_page(page);
+				continue;
+			}
+		}
 
 		/* mblock reads must be logically contiguous. */
 		if (page->index != index && work) {
-			queue_work(wq, work);
+			mpc_ra_queue(mp, work);
 			work = NULL;
 		}
 
@@ -1425,7 +2147,7 @@ mpc_readpages(
 		rc = add_to_page_cache_lru(page, mapping, page->index, gfp);
 		if (rc) {
 			if (work) {
-				queue_work(wq, work);
+				mpc_ra_queue(mp, work);
 				work = NULL;
 			}
 			put_page(page);
@@ -1436,7 +2158,7 @@ mpc_readpages(
 			w = page_address(page);
 			INIT_WORK(&w->w_work, mpc_readpages_cb);
 			w->w_args.a_xvm = xvm;
-			w->w_args.a_mbdesc = mbinfo->mbdesc;
+			w->w_args.a_mbinfo = mbinfo;
 			w->w_args.a_mboffset = offset % xvm->xvm_bktsz;
 			w->w_args.a_pagec = 0;
 			work = &w->w_work;
@@ -1446,23 +2168,259 @@ mpc_readpages(
 		}
 
 		w->w_args.a_pagev[w->w_args.a_pagec++] = page;
+		++queued;
 
 		/*
 		 * Restrict batch size to the number of struct kvecs
 		 * that will fit into a page (minus our header).
 		 */
 		if (w->w_args.a_pagec >= iovmax) {
-			queue_work(wq, work);
+			mpc_ra_queue(mp, work);
 			work = NULL;
 		}
 	}
 
 	if (work)
-		queue_work(wq, work);
+		mpc_ra_queue(mp, work);
+
+	trace_mpool_xvm_readahead(xvm->xvm_rgn, mbstart, start, nr_pages, queued);
 
 	return 0;
 }
 
+/*
+ * MPC_RA_WIN_MIN - Initial readahead window (in pages) of a fault stream
+ */
+#define MPC_RA_WIN_MIN      (8)
+
+/**
+ * mpc_xvm_ra_nextpg() - Return the page which follows index in an xvm
+ * @xvm:
+ * @index: page index within the address map
+ *
+ * The page after the last page of an mblock is the first page of the next
+ * mblock, as the xvm is scanned as the concatenation of its mblocks.
+ *
+ * Return: ULONG_MAX past the end of the last mblock.
+ */
+static pgoff_t mpc_xvm_ra_nextpg(struct mpc_xvm *xvm, pgoff_t index)
+{
+	off_t   offset;
+	uint    mbnum;
+
+	offset  = (index + 1) << PAGE_SHIFT;
+	offset %= (1ul << mpc_xvm_size_max);
+
+	mbnum = offset / xvm->xvm_bktsz;
+	if (mbnum >= xvm->xvm_mbinfoc)
+		return ULONG_MAX;
+
+	if (offset % xvm->xvm_bktsz < xvm->xvm_mbinfov[mbnum].mblen)
+		return index + 1;
+
+	if (++mbnum >= xvm->xvm_mbinfoc)
+		return ULONG_MAX;
+
+	return mpc_xvm_pgoff(xvm) + ((mbnum * xvm->xvm_bktsz) >> PAGE_SHIFT);
+}
+
+/**
+ * mpc_xvm_ra_issue() - Prefetch pages of an xvm through mpc_readpages()
+ * @file:
+ * @xvm:
+ * @index:  first page to prefetch
+ * @stride: distance between pages, 1 to follow mpc_xvm_ra_nextpg()
+ * @count:  number of pages
+ *
+ * Pages already in the page cache are skipped.  Pages are handed to
+ * mpc_readpages() in batches of at most the unit's readahead limit.
+ *
+ * Return: the page which follows the last page considered
+ */
+static pgoff_t
+mpc_xvm_ra_issue(struct file *file, struct mpc_xvm *xvm, pgoff_t index, long stride, uint count)
+{
+	struct address_space   *mapping = file->f_mapping;
+	struct mpc_unit        *unit = file->private_data;
+	struct page            *page = NULL;
+	LIST_HEAD(pages);
+
+	pgoff_t end;
+	uint    nr_pages;
+	uint    batch;
+	gfp_t   gfp;
+
+	batch = unit->un_ra_pages_max;
+	if (batch < 1)
+		return index;
+
+	end = mpc_xvm_pgoff(xvm) + mpc_xvm_pglen(xvm);
+	gfp = mapping_gfp_mask(mapping) | __GFP_NORETRY | __GFP_NOWARN;
+
+	do {
+		nr_pages = 0;
+
+		while (count > 0 && nr_pages < batch &&
+		       index >= mpc_xvm_pgoff(xvm) && index < end) {
+			page = find_get_page(mapping, index);
+			if (page) {
+				put_page(page);
+			} else {
+				page = mpc_page_alloc(gfp);
+				if (!page)
+					break;
+
+				page->index = index;
+				list_add(&page->lru, &pages);
+				++nr_pages;
+			}
+
+			index = (stride == 1) ? mpc_xvm_ra_nextpg(xvm, index) : index + stride;
+			--count;
+		}
+
+		if (nr_pages > 0) {
+			mpc_readpages(file, mapping, &pages, nr_pages);
+			put_pages_list(&pages);
+		}
+	} while (nr_pages > 0 && page);
+
+	return index;
+}
+
+/**
+ * mpc_xvm_huge_fill() - Read in the PMD-sized extent around a page
+ * @vma:
+ * @index: faulting page
+ *
+ * Buckets of a huge xvm are PMD aligned, so the extent never spans two
+ * mblocks, but it may run past the end of the mblock.
+ */
+static void mpc_xvm_huge_fill(struct vm_area_struct *vma, pgoff_t index)
+{
+	struct mpc_xvm     *xvm = vma->vm_private_data;
+	struct page        *page;
+
+	off_t   offset;
+	uint    mbnum, count;
+	pgoff_t start;
+
+	page = find_get_page(vma->vm_file->f_mapping, index);
+	if (page) {
+		put_page(page);
+		return;
+	}
+
+	start = round_down(index, PMD_SIZE >> PAGE_SHIFT);
+
+	offset  = start << PAGE_SHIFT;
+	offset %= (1ul << mpc_xvm_size_max);
+
+	mbnum = offset / xvm->xvm_bktsz;
+	if (mbnum >= xvm->xvm_mbinfoc)
+		return;
+
+	offset %= xvm->xvm_bktsz;
+	if (offset >= xvm->xvm_mbinfov[mbnum].mblen)
+		return;
+
+	count = min_t(size_t, PMD_SIZE, xvm->xvm_mbinfov[mbnum].mblen - offset) >> PAGE_SHIFT;
+
+	mpc_xvm_ra_issue(vma->vm_file, xvm, start, 1, count);
+}
+
+/**
+ * mpc_xvm_ra_fault() - Readahead on a page fault
+ * @vma:
+ * @index: faulting page
+ *
+ * Classifies the faults within each xvm as sequential (each mblock
+ * running into the next), strided or random.  Sequential streams are
+ * prefetched asynchronously in a window which doubles each time the
+ * stream gets within half a window of the end of what was prefetched,
+ * strided streams prefetch the next window of strides, and random access
+ * collapses the window.  The window is capped by the unit's readahead
+ * limit, or by MPC_RA_WIN_MIN while the reaper is under duress.
+ */
+static void mpc_xvm_ra_fault(struct vm_area_struct *vma, pgoff_t index)
+{
+	struct mpc_xvm     *xvm = vma->vm_private_data;
+	struct mpc_xvm_ra  *ra = &xvm->xvm_ra;
+	struct mpc_unit    *unit = vma->vm_file->private_data;
+
+	pgoff_t start = 0;
+	long    delta, stride = 0;
+	uint    winmax, count = 0;
+
+	winmax = unit->un_ra_pages_max;
+	if (winmax < 1)
+		return;
+
+	if (mpc_reap_xvm_duress(xvm))
+		winmax = min_t(uint, winmax, MPC_RA_WIN_MIN);
+
+	spin_lock(&ra->ra_lock);
+
+	delta = index - ra->ra_prev;
+	if (delta == 0) {
+		spin_unlock(&ra->ra_lock);
+		return;
+	}
+
+	/*
+	 * A sequential scan which doesn't touch every page skips forward,
+	 * so anything ahead within the window keeps the stream going.
+	 */
+	if (index == mpc_xvm_ra_nextpg(xvm, ra->ra_prev) ||
+	    (ra->ra_stride == 1 && delta > 0 && delta <= ra->ra_win))
+		delta = 1;
+
+	if (delta == 1 || delta == ra->ra_stride) {
+		++ra->ra_hits;
+	} else {
+		ra->ra_hits = 0;
+		ra->ra_win /= 2;
+		ra->ra_next = 0;
+	}
+
+	ra->ra_prev = index;
+	ra->ra_stride = delta;
+
+	if (ra->ra_hits > 0) {
+		if (ra->ra_win < MPC_RA_WIN_MIN)
+			ra->ra_win = MPC_RA_WIN_MIN;
+		ra->ra_win = min_t(uint, ra->ra_win, winmax);
+
+		if (delta != 1) {
+			start = index + delta;
+			stride = delta;
+			count = ra->ra_win;
+		} else if (ra->ra_next <= index + ra->ra_win / 2) {
+			start = max_t(pgoff_t, ra->ra_next, index + 1);
+			stride = 1;
+			count = ra->ra_win;
+
+			/* Claim the window before dropping the lock. */
+			ra->ra_next = ULONG_MAX;
+			ra->ra_win = min_t(uint, ra->ra_win * 2, winmax);
+		}
+	}
+
+	spin_unlock(&ra->ra_lock);
+
+	if (!count)
+		return;
+
+	start = mpc_xvm_ra_issue(vma->vm_file, xvm, start, stride, count);
+
+	if (stride == 1) {
+		spin_lock(&ra->ra_lock);
+		if (ra->ra_next == ULONG_MAX)
+			ra->ra_next = start;
+		spin_unlock(&ra->ra_lock);
+	}
+}
+
 /**
  * mpc_releasepage() - Linux VM calls the release page when pages are released.
  * @page:
@@ -1479,18 +2437,25 @@ static int mpc_releasepage(struct page *page, gfp_t gfp)
 	if (ev(!PagePrivate(page)))
 		return 0;
 
-	xvm = (void *)page_private(page);
+	xvm = mpc_page_xvm(page);
 	if (ev(!xvm))
 		return 0;
 
 	ClearPagePrivate(page);
 	set_page_private(page, 0);
+	ClearPageChecked(page);
 
 	assert((u32)(uintptr_t)xvm == xvm->xvm_magic);
 
-	if (xvm->xvm_hcpagesp)
-		atomic64_dec(xvm->xvm_hcpagesp);
-	atomic64_dec(&xvm->xvm_nrpages);
+	mpc_xvm_nrpages_add(xvm, -1);
+
+	if (atomic_read(&xvm->xvm_evicting))
+		mpc_xvm_stat_add(xvm, MPC_XS_EVICT_REAP, 1);
+	else
+		mpc_xvm_stat_add(xvm, MPC_XS_EVICT_KERNEL, 1);
+
+	if (xvm->xvm_evictmap)
+		set_bit(page->index - mpc_xvm_pgoff(xvm), xvm->xvm_evictmap);
 
 	return 1;
 }
@@ -1617,6 +2582,203 @@ static void mpc_bdi_teardown(void)
 #endif
 }
 
+/**
+ * struct mpc_regbuf - user buffer registered with MPIOC_BUF_REG
+ * @rb_ref:   held by the unit's un_bufv[] and by each I/O using the buffer
+ * @rb_mm:    mm of the registering process, the only one that may use it
+ * @rb_addr:  user address of the buffer
+ * @rb_len:   length of the buffer in bytes
+ * @rb_pagev: user pages pinned by mpc_regbuf_pin()
+ * @rb_iov:   rb_pagev[] mapped into kernel space, one page per element
+ */
+struct mpc_regbuf {
+	struct kref         rb_ref;
+	struct mm_struct   *rb_mm;
+	ulong               rb_addr;
+	size_t              rb_len;
+	struct page       **rb_pagev;
+	struct kvec         rb_iov[];
+};
+
+#define MPC_REGBUF_LEN_MAX      (1ul << 30)
+
+#if !HAVE_ACCOUNT_LOCKED_VM
+static int account_locked_vm(struct mm_struct *mm, ulong pages, bool inc)
+{
+	ulong   limit;
+	int     rc = 0;
+
+	down_write(&mm->mmap_sem);
+	if (inc) {
+		limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+		if (mm->locked_vm + pages > limit && !capable(CAP_IPC_LOCK))
+			rc = -ENOMEM;
+		else
+			mm->locked_vm += pages;
+	} else {
+		mm->locked_vm -= min_t(ulong, pages, mm->locked_vm);
+	}
+	up_write(&mm->mmap_sem);
+
+	return rc;
+}
+#endif
+
+/**
+ * mpc_regbuf_pin() - Pin and map a registered buffer's pages
+ * @rb:
+ *
+ * The pages are pinned long term and writable, so that the buffer can be
+ * read into, and are charged to the registering process' locked_vm.
+ */
+static merr_t mpc_regbuf_pin(struct mpc_regbuf *rb)
+{
+	size_t  pagec = rb->rb_len >> PAGE_SHIFT;
+	size_t  i;
+	int     rc;
+
+	rc = account_locked_vm(rb->rb_mm, pagec, true);
+	if (rc)
+		return merr(rc);
+
+	for (i = 0; i < pagec; i += rc) {
+		rc = pin_user_pages_fast(rb->rb_addr + (i << PAGE_SHIFT), pagec - i,
+					 FOLL_WRITE | FOLL_LONGTERM, &rb->rb_pagev[i]);
+		if (rc <= 0)
+			break;
+	}
+
+	if (i < pagec) {
+		while (i-- > 0)
+			unpin_user_page(rb->rb_pagev[i]);
+		account_locked_vm(rb->rb_mm, pagec, false);
+
+		return merr(rc < 0 ? rc : EFAULT);
+	}
+
+	for (i = 0; i < pagec; ++i) {
+		rb->rb_iov[i].iov_base = kmap(rb->rb_pagev[i]);
+		rb->rb_iov[i].iov_len = PAGE_SIZE;
+	}
+
+	return 0;
+}
+
+static void mpc_regbuf_unpin(struct mpc_regbuf *rb)
+{
+	size_t  pagec = rb->rb_len >> PAGE_SHIFT;
+	size_t  i;
+
+	for (i = 0; i < pagec; ++i) {
+		kunmap(rb->rb_pagev[i]);
+		unpin_user_page(rb->rb_pagev[i]);
+	}
+
+	account_locked_vm(rb->rb_mm, pagec, false);
+}
+
+static void mpc_regbuf_release(struct kref *refp)
+{
+	struct mpc_regbuf *rb = container_of(refp, struct mpc_regbuf, rb_ref);
+
+	mpc_regbuf_unpin(rb);
+	mmdrop(rb->rb_mm);
+	kvfree(rb->rb_pagev);
+	kvfree(rb);
+}
+
+static void mpc_regbuf_put(struct mpc_regbuf *rb)
+{
+	kref_put(&rb->rb_ref, mpc_regbuf_release);
+}
+
+/**
+ * mpc_regbuf_get() - Get a ref on a buffer registered by the current process
+ * @unit:
+ * @id:   buffer ID returned by MPIOC_BUF_REG
+ */
+static struct mpc_regbuf *mpc_regbuf_get(struct mpc_unit *unit, u32 id)
+{
+	struct mpc_regbuf *rb;
+
+	if (id < 1 || id > MPIOC_BUF_MAX)
+		return NULL;
+
+	spin_lock(&unit->un_buflock);
+	rb = unit->un_bufv[id - 1];
+	if (rb && rb->rb_mm == current->mm)
+		kref_get(&rb->rb_ref);
+	else
+		rb = NULL;
+	spin_unlock(&unit->un_buflock);
+
+	return rb;
+}
+
+/* Unregister all buffers, in-flight I/Os hold their own refs. */
+static void mpc_regbuf_flush(struct mpc_unit *unit)
+{
+	struct mpc_regbuf *rb;
+	int                i;
+
+	for (i = 0; i < MPIOC_BUF_MAX; ++i) {
+		spin_lock(&unit->un_buflock);
+		rb = unit->un_bufv[i];
+		unit->un_bufv[i] = NULL;
+		spin_unlock(&unit->un_buflock);
+
+		if (rb)
+			mpc_regbuf_put(rb);
+	}
+}
+
+/**
+ * mpc_regbuf_map() - Translate user segments to a registered buffer's kvecs
+ * @rb:
+ * @uiov:  user segments, each must lie within rb
+ * @uioc:  count of elements in uiov[]
+ * @iov:   scratch space for one kvec per page, unused if uioc is 1
+ * @iovp:  (output) kvecs describing uiov[]
+ *
+ * A single segment maps directly onto rb_iov[], so the common case needs
+ * no copying and no allocation.
+ */
+static merr_t
+mpc_regbuf_map(
+	struct mpc_regbuf          *rb,
+	const struct iovec         *uiov,
+	int                         uioc,
+	struct kvec                *iov,
+	const struct kvec         **iovp)
+{
+	size_t  len, pagec;
+	ulong   addr, pgidx;
+	int     i;
+
+	for (i = 0, pagec = 0; i < uioc; ++i) {
+		addr = (ulong)uiov[i].iov_base;
+		len = uiov[i].iov_len;
+
+		if (!PAGE_ALIGNED(addr) || !PAGE_ALIGNED(len) || addr < rb->rb_addr ||
+		    len > rb->rb_len || addr - rb->rb_addr > rb->rb_len - len)
+			return merr(EINVAL);
+
+		pgidx = (addr - rb->rb_addr) >> PAGE_SHIFT;
+
+		if (uioc == 1) {
+			*iovp = rb->rb_iov + pgidx;
+			return 0;
+		}
+
+		memcpy(iov + pagec, rb->rb_iov + pgidx, (len >> PAGE_SHIFT) * sizeof(*iov));
+		pagec += len >> PAGE_SHIFT;
+	}
+
+	*iovp = iov;
+
+	return 0;
+}
+
 /*
  * MPCTL file operations.
  */
@@ -1684,6 +2846,7 @@ static int mpc_open(struct inode *ip, struct file *fp)
 
 	unit->un_mapping = fp->f_mapping;
 	unit->un_ds_reap = mpc_reap;
+	mpc_reap_budget_add(mpc_reap, &unit->un_budget);
 
 	inode_lock(ip);
 	i_size_write(ip, 1ul << 63);
@@ -1731,8 +2894,14 @@ static int mpc_release(struct inode *ip, struct file *fp)
 		goto errout;
 
 	if (mpc_unit_ismpooldev(unit)) {
+		mpc_ring_destroy(unit->un_ring);
+		unit->un_ring = NULL;
+
+		mpc_regbuf_flush(unit);
+
 		mpc_rgnmap_flush(&unit->un_rgnmap);
 
+		mpc_reap_budget_remove(unit->un_ds_reap, &unit->un_budget);
 		unit->un_ds_reap = NULL;
 		unit->un_mapping = NULL;
 
@@ -1749,6 +2918,38 @@ errout:
 	return 0;
 }
 
+/**
+ * mpc_get_unmapped_area() - Place huge xvm maps at PMD-aligned addresses
+ *
+ * Aligning the virtual address with the map offset modulo the PMD size is
+ * what allows the PMD-sized extents of a huge xvm to line up with the page
+ * tables.
+ */
+static ulong
+mpc_get_unmapped_area(struct file *fp, ulong addr, ulong len, ulong pgoff, ulong flags)
+{
+	struct mpc_unit    *unit = fp->private_data;
+	struct mpc_xvm     *xvm;
+
+	loff_t  off = (loff_t)pgoff << PAGE_SHIFT;
+	ulong   ret;
+	bool    huge;
+
+	rcu_read_lock();
+	xvm = idr_find(&unit->un_rgnmap.rm_root, off >> mpc_xvm_size_max);
+	huge = xvm && xvm->xvm_huge;
+	rcu_read_unlock();
+
+	if (!huge || (flags & MAP_FIXED) || len < PMD_SIZE || len + PMD_SIZE < len)
+		return current->mm->get_unmapped_area(fp, addr, len, pgoff, flags);
+
+	ret = current->mm->get_unmapped_area(fp, 0, len + PMD_SIZE, pgoff, flags);
+	if (IS_ERR_VALUE(ret))
+		return current->mm->get_unmapped_area(fp, addr, len, pgoff, flags);
+
+	return ret + ((off - ret) & (PMD_SIZE - 1));
+}
+
 static int mpc_mmap(struct file *fp, struct vm_area_struct *vma)
 {
 	struct mpc_unit    *unit = fp->private_data;
@@ -1765,9 +2966,14 @@ static int mpc_mmap(struct file *fp, struct vm_area_struct *vma)
 	if ((off >> mpc_xvm_size_max) != ((off + len) >> mpc_xvm_size_max))
 		return -EINVAL;
 
-	/* Acquire a reference on the region map for this region. */
 	key = off >> mpc_xvm_size_max;
 
+	/* Region zero is never allocated to an xvm, it maps the ring. */
+	if (key == 0)
+		return mpc_ring_mmap(unit->un_ring, vma);
+
+	/* Acquire a reference on the region map for this region. */
+
 	xvm = mpc_xvm_lookup(&unit->un_rgnmap, key);
 	if (!xvm)
 		return -EINVAL;
@@ -2420,17 +3626,25 @@ mp_deactivate_impl(struct mpc_unit *ctl, struct mpioc_mpool *mp, bool locked)
 	/*
 	 * In order to be determined idle, a unit shall not be open
 	 * and shall have a ref count of exactly two (the birth ref
-	 * and the lookup ref from above).
+	 * and the lookup ref from above).  Lookups don't take ss_lock,
+	 * so unpublish the unit and wait for those in progress to have
+	 * taken their ref before checking, and publish it again if busy.
 	 */
 	mutex_lock(&ss->ss_lock);
+	idr_replace(&ss->ss_unitmap, NULL, MINOR(unit->un_devno));
+	mutex_unlock(&ss->ss_lock);
+
+	synchronize_rcu();
+
+	err = 0;
 	if (unit->un_open_cnt > 0 || kref_read(&unit->un_ref) != 2) {
 		err = merr(EBUSY);
 		mp_pr_err("%s: busy, cannot deactivate", err, unit->un_name);
-	} else {
-		idr_replace(&ss->ss_unitmap, NULL, MINOR(unit->un_devno));
-		err = 0;
+
+		mutex_lock(&ss->ss_lock);
+		idr_replace(&ss->ss_unitmap, unit, MINOR(unit->un_devno));
+		mutex_unlock(&ss->ss_lock);
 	}
-	mutex_unlock(&ss->ss_lock);
 
 	if (!err)
 		mpc_unit_put(unit); /* drop birth ref */
@@ -2787,6 +4001,18 @@ static merr_t mpioc_mb_alloc(struct mpc_unit *unit, struct mpioc_mblock *mb)
 	if (ev(err))
 		return err;
 
+	if (mb->mb_flags & (MBLOCK_AF_WCOMBINE | MBLOCK_AF_COMPRESS)) {
+		if (mb->mb_flags & MBLOCK_AF_COMPRESS)
+			err = mblock_compress(mpool, mblock);
+		else
+			err = mblock_wcombine(mpool, mblock);
+		if (ev(err)) {
+			if (mblock_abort(mpool, mblock))
+				mblock_put(mpool, mblock);
+			return err;
+		}
+	}
+
 	mblock_get_props_ex(mpool, mblock, &mb->mb_props);
 	mblock_put(mpool, mblock);
 
@@ -2890,6 +4116,92 @@ static merr_t mpioc_mb_abcomdel(struct mpc_unit *unit, uint cmd, struct mpioc_mb
 	return err;
 }
 
+/**
+ * mpioc_mb_comdelv() - Commit or delete a batch of mblocks.
+ * @unit:   mpool or dataset unit ptr
+ * @cmd     MPIOC_MB_COMMITV or MPIOC_MB_DELETEV
+ * @mv:     mblock batch parameter block
+ *
+ * All the records for the batch are logged before any of them are waited
+ * upon, so they are acknowledged together by as few MDC flushes as possible.
+ *
+ * Return:  Returns 0 if the batch was processed, in which case the status
+ * of each mblock is returned in mv_errv[].  Otherwise merr_t.
+ */
+static merr_t mpioc_mb_comdelv(struct mpc_unit *unit, uint cmd, struct mpioc_mblock_idv *mv)
+{
+	struct mblock_descriptor  **mbhv;
+	struct mpool_descriptor    *mpool;
+
+	int64_t    *uerrv;
+	u64        *idv;
+	merr_t     *errv;
+	int         which, idc, i;
+	merr_t      err;
+
+	if (!unit || !mv || !unit->un_mpool)
+		return merr(EINVAL);
+
+	idc = mv->mv_idc;
+	if (idc < 1 || idc > MPIOC_MBIDV_MAX)
+		return merr(EINVAL);
+
+	idv = kmalloc_array(idc, sizeof(*idv) + sizeof(*errv) + sizeof(*mbhv), GFP_KERNEL);
+	if (!idv)
+		return merr(ENOMEM);
+
+	errv = (merr_t *)(idv + idc);
+	mbhv = (struct mblock_descriptor **)(errv + idc);
+	uerrv = (int64_t *)idv;
+
+	if (copy_from_user(idv, mv->mv_idv, idc * sizeof(*idv))) {
+		err = merr(EFAULT);
+		goto errout;
+	}
+
+	which = (cmd == MPIOC_MB_DELETEV) ? 1 : -1;
+	mpool = unit->un_mpool->mp_desc;
+
+	for (i = 0; i < idc; ++i) {
+		mbhv[i] = NULL;
+
+		errv[i] = merr(EINVAL);
+		if (mblock_objid(idv[i]))
+			errv[i] = mblock_find_get(mpool, idv[i], which, NULL, &mbhv[i]);
+		if (ev(errv[i]))
+			mbhv[i] = NULL;
+	}
+
+	if (cmd == MPIOC_MB_COMMITV)
+		err = mblock_commitv(mpool, mbhv, idc, errv);
+	else
+		err = mblock_deletev(mpool, mbhv, idc, errv);
+
+	for (i = 0; i < idc; ++i) {
+		if (!mbhv[i])
+			continue;
+
+		/* A successful delete consumes the ref acquired by find_get */
+		if (err || cmd == MPIOC_MB_COMMITV || errv[i])
+			mblock_put(mpool, mbhv[i]);
+	}
+
+	if (ev(err))
+		goto errout;
+
+	/* Reuse idv[] to return the status of each element. */
+	for (i = 0; i < idc; ++i)
+		uerrv[i] = errv[i] ? merr_to_user(errv[i], mv->mv_cmn.mc_merr_base) : 0;
+
+	if (copy_to_user(mv->mv_errv, uerrv, idc * sizeof(*uerrv)))
+		err = merr(EFAULT);
+
+errout:
+	kfree(idv);
+
+	return err;
+}
+
 /**
  * mpioc_mb_rw() - read/write mblock ioctl handler
  * @unit:   dataset unit ptr
@@ -2902,6 +4214,7 @@ mpioc_mb_rw(struct mpc_unit *unit, uint cmd, struct mpioc_mblock_rw *mbrw,
 {
 	struct mblock_descriptor   *mblock;
 	struct mpool_descriptor    *mpool;
+	struct mpc_regbuf          *rb = NULL;
 	struct iovec               *kiov;
 
 	bool    xfree = false;
@@ -2923,12 +4236,20 @@ mpioc_mb_rw(struct mpc_unit *unit, uint cmd, struct mpioc_mblock_rw *mbrw,
 	if (mbrw->mb_iov_cnt > MPIOC_KIOV_MAX)
 		return merr(EINVAL);
 
+	if (mbrw->mb_bufid) {
+		rb = mpc_regbuf_get(unit, mbrw->mb_bufid);
+		if (!rb)
+			return merr(ENOENT);
+	}
+
 	kiovsz = mbrw->mb_iov_cnt * sizeof(*kiov);
 
 	if (kiovsz > stkbufsz) {
 		kiov = kmalloc(kiovsz, GFP_KERNEL);
-		if (!kiov)
-			return merr(ENOMEM);
+		if (!kiov) {
+			err = merr(ENOMEM);
+			goto errout;
+		}
 
 		xfree = true;
 	} else {
@@ -2949,7 +4270,7 @@ mpioc_mb_rw(struct mpc_unit *unit, uint cmd, struct mpioc_mblock_rw *mbrw,
 	} else {
 		err = mpc_physio(mpool, mblock, kiov, mbrw->mb_iov_cnt, mbrw->mb_offset,
 				 MP_OBJ_MBLOCK, (cmd == MPIOC_MB_READ) ? READ : WRITE,
-				 stkbuf, stkbufsz);
+				 rb, stkbuf, stkbufsz);
 	}
 
 	mblock_put(mpool, mblock);
@@ -2957,6 +4278,310 @@ mpioc_mb_rw(struct mpc_unit *unit, uint cmd, struct mpioc_mblock_rw *mbrw,
 errout:
 	if (xfree)
 		kfree(kiov);
+	if (rb)
+		mpc_regbuf_put(rb);
+
+	return err;
+}
+
+/**
+ * struct mpc_rwv_req - per-element state of an mblock read/write batch
+ * @rr_ctx:     pd I/O completion context, pic_arg points to the batch
+ * @rr_mbdesc:  mblock handle, NULL if the lookup failed
+ * @rr_pagesv:  pinned user pages
+ * @rr_iov:     kernel mappings of rr_pagesv[]
+ * @rr_pagesc:  count of pinned pages (zero if not pinned)
+ * @rr_err:     element status
+ */
+struct mpc_rwv_req {
+	struct pd_io_ctx            rr_ctx;
+	struct mblock_descriptor   *rr_mbdesc;
+	struct page               **rr_pagesv;
+	struct kvec                *rr_iov;
+	int                         rr_pagesc;
+	merr_t                      rr_err;
+};
+
+/**
+ * struct mpc_rwv_batch - completion tracking for an mblock read/write batch
+ * @rb_pending: count of reads in flight, plus one for the submitter
+ * @rb_done:    signalled when rb_pending drops to zero
+ */
+struct mpc_rwv_batch {
+	atomic_t            rb_pending;
+	struct completion   rb_done;
+};
+
+static void mpc_rwv_done(struct pd_io_ctx *ctx, merr_t err)
+{
+	struct mpc_rwv_req     *req = container_of(ctx, struct mpc_rwv_req, rr_ctx);
+	struct mpc_rwv_batch   *batch = ctx->pic_arg;
+
+	req->rr_err = err;
+
+	if (atomic_dec_and_test(&batch->rb_pending))
+		complete(&batch->rb_done);
+}
+
+/**
+ * mpioc_mb_rwv() - batched read/write mblock ioctl handler
+ * @unit:   dataset unit ptr
+ * @cmd:    MPIOC_MB_READV or MPIOC_MB_WRITEV
+ * @mbv:    mblock batch parameter block
+ *
+ * Pins the user buffers of all the batch elements up front.  Reads are
+ * then submitted asynchronously so that they all proceed concurrently,
+ * and we wait only once for the entire batch.  Writes are issued in
+ * order, as successive writes to the same mblock must be serialized.
+ *
+ * Return:  Returns 0 if the batch was processed, in which case the status
+ * of each element is returned in its me_err field.  Otherwise merr_t.
+ */
+static noinline merr_t
+mpioc_mb_rwv(struct mpc_unit *unit, uint cmd, struct mpioc_mblock_rwv *mbv)
+{
+	struct mpioc_mblock_rwv_ent    *entv;
+	struct mpool_descriptor        *mpool;
+	struct mpc_rwv_batch            batch;
+	struct mpc_rwv_req             *reqv;
+	struct iovec                   *kiov, *uiov;
+	struct page                   **pagesv;
+	struct kvec                    *iov;
+	void                           *pagesbuf;
+
+	size_t  entvsz, pagesvsz, length, tot_len;
+	int     which, rw, entc, iovc, pagesc, i;
+	merr_t  err;
+
+	if (!unit || !mbv || !unit->un_mpool)
+		return merr(EINVAL);
+
+	entc = mbv->mv_entc;
+	if (entc < 1 || entc > MPIOC_MBRWV_MAX)
+		return merr(EINVAL);
+
+	entvsz = entc * sizeof(*entv);
+
+	entv = kmalloc(entvsz + entc * sizeof(*reqv), GFP_KERNEL);
+	if (!entv)
+		return merr(ENOMEM);
+
+	reqv = (void *)((char *)entv + entvsz);
+	kiov = NULL;
+
+	if (copy_from_user(entv, mbv->mv_entv, entvsz)) {
+		err = merr(EFAULT);
+		goto errout;
+	}
+
+	iovc = 0;
+	for (i = 0; i < entc; ++i) {
+		if (!mblock_objid(entv[i].me_objid) || entv[i].me_iov_cnt < 1) {
+			err = merr(EINVAL);
+			goto errout;
+		}
+
+		iovc += entv[i].me_iov_cnt;
+	}
+
+	if (iovc > MPIOC_KIOV_MAX) {
+		err = merr(EINVAL);
+		goto errout;
+	}
+
+	kiov = kmalloc(iovc * sizeof(*kiov), GFP_KERNEL);
+	if (!kiov) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	tot_len = 0;
+	for (i = 0, uiov = kiov; i < entc; uiov += entv[i++].me_iov_cnt) {
+		if (copy_from_user(uiov, entv[i].me_iov, entv[i].me_iov_cnt * sizeof(*uiov))) {
+			err = merr(EFAULT);
+			goto errout;
+		}
+
+		length = iov_length(uiov, entv[i].me_iov_cnt);
+
+		if (length < PAGE_SIZE || !IS_ALIGNED(length, PAGE_SIZE) ||
+		    length > (mpc_rwsz_max << 20)) {
+			err = merr(EINVAL);
+			goto errout;
+		}
+
+		tot_len += length;
+	}
+
+	/* Bound the entire batch as if it were a single mpc_physio() request. */
+	if (tot_len > (mpc_rwsz_max << 20)) {
+		err = merr(EINVAL);
+		goto errout;
+	}
+
+	pagesc = tot_len >> PAGE_SHIFT;
+	pagesvsz = (sizeof(*pagesv) + sizeof(*iov)) * pagesc;
+
+	pagesbuf = mpc_physio_alloc(pagesvsz, NULL, 0);
+	if (!pagesbuf) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	pagesv = pagesbuf;
+	iov = (struct kvec *)(pagesv + pagesc);
+
+	which = (cmd == MPIOC_MB_READV) ? 1 : -1;
+	rw = (cmd == MPIOC_MB_READV) ? READ : WRITE;
+	mpool = unit->un_mpool->mp_desc;
+
+	atomic_set(&batch.rb_pending, 1);
+	init_completion(&batch.rb_done);
+
+	for (i = 0, uiov = kiov; i < entc; uiov += entv[i++].me_iov_cnt) {
+		struct mpc_rwv_req *req = reqv + i;
+
+		length = iov_length(uiov, entv[i].me_iov_cnt);
+
+		req->rr_ctx.pic_done = mpc_rwv_done;
+		req->rr_ctx.pic_arg = &batch;
+		req->rr_mbdesc = NULL;
+		req->rr_pagesv = pagesv;
+		req->rr_iov = iov;
+		req->rr_pagesc = 0;
+		req->rr_err = 0;
+
+		pagesv += length >> PAGE_SHIFT;
+		iov += length >> PAGE_SHIFT;
+
+		err = mblock_find_get(mpool, entv[i].me_objid, which, NULL, &req->rr_mbdesc);
+		if (err) {
+			req->rr_mbdesc = NULL;
+			req->rr_err = err;
+			continue;
+		}
+
+		err = mpc_physio_pin(uiov, entv[i].me_iov_cnt, length, rw,
+				     req->rr_pagesv, req->rr_iov);
+		if (err) {
+			req->rr_err = err;
+			continue;
+		}
+
+		req->rr_pagesc = length >> PAGE_SHIFT;
+
+		if (rw == WRITE) {
+			req->rr_err = mblock_write(mpool, req->rr_mbdesc, req->rr_iov,
+						   req->rr_pagesc, length);
+			continue;
+		}
+
+		atomic_inc(&batch.rb_pending);
+
+		err = mblock_read_async(mpool, req->rr_mbdesc, req->rr_iov, req->rr_pagesc,
+					entv[i].me_offset, length, &req->rr_ctx);
+		if (err) {
+			atomic_dec(&batch.rb_pending);
+			req->rr_err = err;
+		}
+	}
+
+	/* Wait for all in-flight reads to complete. */
+	if (!atomic_dec_and_test(&batch.rb_pending))
+		wait_for_completion(&batch.rb_done);
+
+	for (i = 0; i < entc; ++i) {
+		struct mpc_rwv_req *req = reqv + i;
+
+		if (req->rr_pagesc > 0)
+			mpc_physio_unpin(req->rr_pagesv, req->rr_pagesc);
+
+		if (req->rr_mbdesc)
+			mblock_put(mpool, req->rr_mbdesc);
+
+		entv[i].me_err = 0;
+		if (ev(req->rr_err))
+			entv[i].me_err = merr_to_user(req->rr_err, mbv->mv_cmn.mc_merr_base);
+	}
+
+	mpc_physio_free(pagesbuf, pagesvsz, 0);
+
+	err = 0;
+	if (copy_to_user(mbv->mv_entv, entv, entvsz))
+		err = merr(EFAULT);
+
+errout:
+	kfree(kiov);
+	kfree(entv);
+
+	return err;
+}
+
+/**
+ * mpioc_mb_copy() - copy ranges of committed mblocks to an mblock
+ * @unit:   mpool unit ptr
+ * @mbc:    mblock copy parameter block
+ */
+static merr_t mpioc_mb_copy(struct mpc_unit *unit, struct mpioc_mblock_copy *mbc)
+{
+	struct mpioc_mblock_copy_ent   *entv;
+	struct mblock_copy_src         *srcv;
+	struct mblock_descriptor       *mblock;
+	struct mpool_descriptor        *mpool;
+
+	size_t  entvsz;
+	merr_t  err;
+	int     entc, i;
+
+	if (!unit || !mbc || !unit->un_mpool)
+		return merr(EINVAL);
+
+	mbc->mc_len = 0;
+
+	entc = mbc->mc_entc;
+	if (entc < 1 || entc > MPIOC_MBCOPY_MAX || !mblock_objid(mbc->mc_objid))
+		return merr(EINVAL);
+
+	entvsz = entc * sizeof(*entv);
+
+	entv = kmalloc(entvsz + entc * sizeof(*srcv), GFP_KERNEL);
+	if (!entv)
+		return merr(ENOMEM);
+
+	srcv = (void *)((char *)entv + entvsz);
+
+	if (copy_from_user(entv, mbc->mc_entv, entvsz)) {
+		kfree(entv);
+		return merr(EFAULT);
+	}
+
+	mpool = unit->un_mpool->mp_desc;
+
+	err = mblock_find_get(mpool, mbc->mc_objid, -1, NULL, &mblock);
+	if (ev(err)) {
+		kfree(entv);
+		return err;
+	}
+
+	for (i = 0; i < entc; ++i) {
+		srcv[i].mcs_off = entv[i].mce_offset;
+		srcv[i].mcs_len = entv[i].mce_len;
+
+		err = merr(EINVAL);
+		if (entv[i].mce_offset >= 0 && mblock_objid(entv[i].mce_objid))
+			err = mblock_find_get(mpool, entv[i].mce_objid, 1, NULL, &srcv[i].mcs_mbh);
+		if (ev(err))
+			break;
+	}
+
+	if (!err)
+		err = mblock_copy(mpool, mblock, srcv, entc, &mbc->mc_len);
+
+	while (i-- > 0)
+		mblock_put(mpool, srcv[i].mcs_mbh);
+
+	mblock_put(mpool, mblock);
+	kfree(entv);
 
 	return err;
 }
@@ -3059,6 +4684,18 @@ static merr_t mpioc_mlog_abcomdel(struct mpc_unit *unit, uint cmd, struct mpioc_
 	return err;
 }
 
+/**
+ * mpioc_mlog_rw() - read/write log pages of an mlog
+ * @unit:     mpool unit ptr
+ * @mi:       mlog I/O parameter block
+ * @stkbuf:   caller provided scratch space
+ * @stkbufsz: size of stkbuf
+ *
+ * Log records are formatted into log pages by the user library, so this is
+ * raw page I/O: the user pages are pinned by mpc_physio() and handed to the
+ * device as is, without being copied.  The kernel mlog append path, which
+ * does copy records into lst_abuf, is only used by in-kernel clients (MDCs).
+ */
 static noinline merr_t
 mpioc_mlog_rw(struct mpc_unit *unit, struct mpioc_mlog_io *mi, void *stkbuf, size_t stkbufsz)
 {
@@ -3105,7 +4742,7 @@ mpioc_mlog_rw(struct mpc_unit *unit, struct mpioc_mlog_io *mi, void *stkbuf, siz
 		err = merr(EFAULT);
 	} else {
 		err = mpc_physio(mpool, mlog, kiov, mi->mi_iovc, mi->mi_off, MP_OBJ_MLOG,
-				 (mi->mi_op == MPOOL_OP_READ) ? READ : WRITE, stkbuf, stkbufsz);
+				 (mi->mi_op == MPOOL_OP_READ) ? READ : WRITE, NULL, stkbuf, stkbufsz);
 	}
 
 	mlog_put(mpool, mlog);
@@ -3133,6 +4770,12 @@ static merr_t mpioc_mlog_erase(struct mpc_unit *unit, struct mpioc_mlog_id *mi)
 	if (err)
 		return err;
 
+	if (mi->mi_flags & MPC_MLOG_F_SPARE) {
+		err = mlog_erase_async(mpool, mlog, mi->mi_gen, true);
+		mlog_put(mpool, mlog);
+		return err;
+	}
+
 	err = mlog_erase(mpool, mlog, mi->mi_gen);
 	if (!err) {
 		mlog_get_props_ex(mpool, mlog, &props);
@@ -3146,65 +4789,146 @@ static merr_t mpioc_mlog_erase(struct mpc_unit *unit, struct mpioc_mlog_id *mi)
 }
 
 /**
- * mpioc_xvm_create() - create an extended VMA map (AKA mcache map)
+ * mpioc_mlog_seek() - look up a data record in an mlog's record index
  * @unit:
- * @arg:
+ * @mk:
  */
-static merr_t mpioc_xvm_create(struct mpc_unit *unit, struct mpioc_vma *ioc)
+static merr_t mpioc_mlog_seek(struct mpc_unit *unit, struct mpioc_mlog_seek *mk)
 {
-	struct mpool_descriptor    *mpdesc;
-	struct mpc_rgnmap          *rm;
-	struct mpc_mbinfo          *mbinfov;
-	struct kmem_cache          *cache;
-	struct mpc_xvm             *xvm;
-
-	u64     *mbidv;
-	size_t  largest, sz;
-	uint    mbidc, mult;
-	merr_t  err;
-	int     rc, i;
+	struct mpool_descriptor    *mpool;
+	struct mlog_descriptor     *mlog;
+	struct mlog_props_ex        props;
+	struct mlog_ridx_ent        ent;
+	merr_t                      err;
 
-	if (ev(!unit || !unit->un_mapping || !ioc))
+	if (!unit || !unit->un_mpool || !mk || !mlog_objid(mk->mk_objid))
 		return merr(EINVAL);
 
-	if (ioc->im_mbidc < 1)
-		return merr(EINVAL);
+	mpool = unit->un_mpool->mp_desc;
 
-	if (ioc->im_advice > MPC_VMA_PINNED)
-		return merr(EINVAL);
+	err = mlog_find_get(mpool, mk->mk_objid, 1, NULL, &mlog);
+	if (err)
+		return err;
 
-	mult = 1;
-	if (ioc->im_advice == MPC_VMA_WARM)
-		mult = 10;
-	else if (ioc->im_advice == MPC_VMA_HOT)
-		mult = 100;
+	err = mlog_ridx_lookup(mpool, mlog, mk->mk_recno, &ent);
+	if (!err) {
+		mlog_get_props_ex(mpool, mlog, &props);
 
-	mpdesc = unit->un_mpool->mp_desc;
-	mbidc = ioc->im_mbidc;
+		mk->mk_lboff  = (u64)ent.mre_soff << props.lpx_secshift;
+		mk->mk_idxrec = ent.mre_recno;
+		mk->mk_roff   = ent.mre_roff;
+	}
 
-	sz = sizeof(*xvm) + sizeof(*mbinfov) * mbidc;
-	if (sz > mpc_xvm_cachesz[1])
-		return merr(EINVAL);
-	else if (sz > mpc_xvm_cachesz[0])
-		cache = mpc_xvm_cache[1];
-	else
-		cache = mpc_xvm_cache[0];
+	mlog_put(mpool, mlog);
+
+	return err;
+}
+
+/**
+ * mpioc_mlog_spare_get() - take an erased mlog out of the spare pool
+ * @unit:
+ * @mi:
+ */
+static merr_t mpioc_mlog_spare_get(struct mpc_unit *unit, struct mpioc_mlog_id *mi)
+{
+	struct mpool_descriptor    *mpool;
+	struct mlog_descriptor     *mlog;
+	struct mlog_props_ex        props;
+	merr_t                      err;
+
+	if (!unit || !unit->un_mpool || !mi)
+		return merr(EINVAL);
+
+	mpool = unit->un_mpool->mp_desc;
+
+	err = mlog_spare_get(mpool, mi->mi_mclassp, &mlog);
+	mi->mi_sparec = mlog_spare_cnt(mpool, mi->mi_mclassp);
+	if (err)
+		return err;
+
+	mlog_get_props_ex(mpool, mlog, &props);
+	mi->mi_objid = props.lpx_props.lpr_objid;
+	mi->mi_gen   = props.lpx_props.lpr_gen;
+	mi->mi_state = props.lpx_state;
+
+	mlog_put(mpool, mlog);
+
+	return 0;
+}
+
+/**
+ * mpioc_xvm_create() - create an extended VMA map (AKA mcache map)
+ * @unit:
+ * @arg:
+ */
+static merr_t mpioc_xvm_create(struct mpc_unit *unit, struct mpioc_vma *ioc)
+{
+	struct mpool_descriptor    *mpdesc;
+	struct mpc_rgnmap          *rm;
+	struct mpc_mbinfo          *mbinfov;
+	struct kmem_cache          *cache;
+	struct mpc_xvm             *xvm;
+
+	u64     *mbidv, *lenv;
+	void   **descv;
+	size_t  largest, sz;
+	uint    mbidc, mult;
+	bool    lazy;
+	merr_t  err;
+	int     rc, i;
+
+	if (ev(!unit || !unit->un_mapping || !ioc))
+		return merr(EINVAL);
+
+	if (ioc->im_mbidc < 1)
+		return merr(EINVAL);
+
+	if (ioc->im_advice > MPC_VMA_PINNED)
+		return merr(EINVAL);
+
+	if (ioc->im_flags & ~(MPC_VMA_F_MLOG | MPC_VMA_F_HUGE | MPC_VMA_F_LAZY))
+		return merr(EINVAL);
+
+	/* mpc_mbinfo.mblen is only 32 bits wide. */
+	lazy = ioc->im_flags & MPC_VMA_F_LAZY;
+	if (lazy && ((ioc->im_flags & MPC_VMA_F_MLOG) || ioc->im_bktsz < PAGE_SIZE ||
+		     ioc->im_bktsz > min_t(u64, 1ul << 31, 1ul << mpc_xvm_size_max)))
+		return merr(EINVAL);
+
+	mult = 1;
+	if (ioc->im_advice == MPC_VMA_WARM)
+		mult = 10;
+	else if (ioc->im_advice == MPC_VMA_HOT)
+		mult = 100;
+
+	mpdesc = unit->un_mpool->mp_desc;
+	mbidc = ioc->im_mbidc;
+
+	sz = sizeof(*xvm) + sizeof(*mbinfov) * mbidc;
+	if (sz > mpc_xvm_cachesz[1])
+		return merr(EINVAL);
+	else if (sz > mpc_xvm_cachesz[0])
+		cache = mpc_xvm_cache[1];
+	else
+		cache = mpc_xvm_cache[0];
 
 	sz = mbidc * sizeof(mbidv[0]);
 
-	mbidv = kmalloc(sz, GFP_KERNEL);
+	/* Eager maps also need room for the handles and lengths looked up */
+	mbidv = kvmalloc_array(mbidc, lazy ? sizeof(*mbidv) :
+			       sizeof(*mbidv) + sizeof(*descv) + sizeof(*lenv), GFP_KERNEL);
 	if (!mbidv)
 		return merr(ENOMEM);
 
 	rc = copy_from_user(mbidv, ioc->im_mbidv, sz);
 	if (rc) {
-		kfree(mbidv);
+		kvfree(mbidv);
 		return merr(EFAULT);
 	}
 
 	xvm = kmem_cache_zalloc(cache, GFP_KERNEL);
 	if (!xvm) {
-		kfree(mbidv);
+		kvfree(mbidv);
 		return merr(ENOMEM);
 	}
 
@@ -3214,7 +4938,11 @@ static merr_t mpioc_xvm_create(struct mpc_unit *unit, struct mpioc_vma *ioc)
 
 	xvm->xvm_mapping = unit->un_mapping;
 	xvm->xvm_rgnmap = &unit->un_rgnmap;
+	xvm->xvm_budget = &unit->un_budget;
+	xvm->xvm_ustats = unit->un_xvmstats;
 	xvm->xvm_advice = ioc->im_advice;
+	xvm->xvm_mlog = ioc->im_flags & MPC_VMA_F_MLOG;
+	xvm->xvm_huge = ioc->im_flags & MPC_VMA_F_HUGE;
 	kref_init(&xvm->xvm_ref);
 	xvm->xvm_cache = cache;
 	atomic_set(&xvm->xvm_opened, 0);
@@ -3224,36 +4952,76 @@ static merr_t mpioc_xvm_create(struct mpc_unit *unit, struct mpioc_vma *ioc)
 	atomic_set(&xvm->xvm_reapref, 1);
 	atomic64_set(&xvm->xvm_nrpages, 0);
 	atomic_set(&xvm->xvm_rabusy, 0);
+	spin_lock_init(&xvm->xvm_ra.ra_lock);
 
 	largest = 0;
 	err = 0;
 
 	mbinfov = xvm->xvm_mbinfov;
 
-	for (i = 0; i < mbidc; ++i) {
-		struct mpc_mbinfo *mbinfo = mbinfov + i;
-		struct mblock_props props;
+	if (lazy) {
+		/* mpc_xvm_resolve() trims mblen and takes the mblock refs */
+		largest = ALIGN(ioc->im_bktsz, PAGE_SIZE);
+		xvm->xvm_mbidv = mbidv;
+		mbidv = NULL;
+	} else {
+		descv = (void **)(mbidv + mbidc);
+		lenv = (u64 *)(descv + mbidc);
 
-		err = mblock_find_get(mpdesc, mbidv[i], 1, &props, &mbinfo->mbdesc);
+		if (xvm->xvm_mlog)
+			err = mlog_find_getv(mpdesc, mbidv, mbidc,
+					     (struct mlog_descriptor **)descv, lenv);
+		else
+			err = mblock_find_getv(mpdesc, mbidv, mbidc,
+					       (struct mblock_descriptor **)descv, lenv);
 		if (err) {
-			mbidc = i;
+			mbidc = 0;
 			goto errout;
 		}
+	}
+
+	for (i = 0; i < mbidc; ++i) {
+		struct mpc_mbinfo *mbinfo = mbinfov + i;
+
+		if (lazy) {
+			mbinfo->mblen = largest;
+		} else if (xvm->xvm_mlog) {
+			mbinfo->mldesc = descv[i];
+
+			/* mpc_mbinfo.mblen is only 32 bits wide. */
+			if (lenv[i] > U32_MAX) {
+				err = merr(E2BIG);
+				continue;
+			}
+
+			mbinfo->mblen = ALIGN_DOWN(lenv[i], PAGE_SIZE);
+		} else {
+			mbinfo->mbdesc = descv[i];
+			mbinfo->mblen = ALIGN(lenv[i], PAGE_SIZE);
+		}
 
-		mbinfo->mblen = ALIGN(props.mpr_write_len, PAGE_SIZE);
 		mbinfo->mbmult = mult;
 		atomic64_set(&mbinfo->mbatime, 0);
 
 		largest = max_t(size_t, largest, mbinfo->mblen);
 	}
 
+	if (err)
+		goto errout;
+
 	xvm->xvm_bktsz = roundup_pow_of_two(largest);
+	if (xvm->xvm_huge)
+		xvm->xvm_bktsz = max_t(size_t, xvm->xvm_bktsz, PMD_SIZE);
 
 	if (xvm->xvm_bktsz * mbidc > (1ul << mpc_xvm_size_max)) {
 		err = merr(E2BIG);
 		goto errout;
 	}
 
+	/* Refaults are not counted if the map is too large for a bitmap. */
+	xvm->xvm_evictmap = kvzalloc(BITS_TO_LONGS(mpc_xvm_pglen(xvm)) * sizeof(long),
+				     GFP_KERNEL | __GFP_NOWARN);
+
 	rm = &unit->un_rgnmap;
 
 	mutex_lock(&rm->rm_lock);
@@ -3277,12 +5045,18 @@ static merr_t mpioc_xvm_create(struct mpc_unit *unit, struct mpioc_vma *ioc)
 
 errout:
 	if (err) {
-		for (i = 0; i < mbidc; ++i)
-			mblock_put(mpdesc, mbinfov[i].mbdesc);
+		for (i = 0; i < mbidc; ++i) {
+			if (xvm->xvm_mlog)
+				mlog_put(mpdesc, mbinfov[i].mldesc);
+			else if (mbinfov[i].mbdesc)
+				mblock_put(mpdesc, mbinfov[i].mbdesc);
+		}
+		kvfree(xvm->xvm_evictmap);
+		kvfree(xvm->xvm_mbidv);
 		kmem_cache_free(cache, xvm);
 	}
 
-	kfree(mbidv);
+	kvfree(mbidv);
 
 	return err;
 }
@@ -3361,7 +5135,235 @@ static merr_t mpioc_xvm_vrss(struct mpc_unit *unit, struct mpioc_vma *ioc)
 	return 0;
 }
 
-static merr_t mpioc_test(struct mpc_unit *unit, struct mpioc_test *test)
+/**
+ * mpioc_xvm_stats() - get the statistics of an extended VMA
+ * @unit:
+ * @ioc:
+ */
+static merr_t mpioc_xvm_stats(struct mpc_unit *unit, struct mpioc_vma_stats *ioc)
+{
+	struct mpc_xvm *xvm;
+	u64            *statv;
+	u64             rgn;
+	int             i;
+
+	if (ev(!unit || !ioc))
+		return merr(EINVAL);
+
+	BUILD_BUG_ON(sizeof(ioc->is_stats) != MPC_XS_MAX * sizeof(*statv));
+
+	rgn = ioc->is_offset >> mpc_xvm_size_max;
+
+	xvm = mpc_xvm_lookup(&unit->un_rgnmap, rgn);
+	if (!xvm)
+		return merr(ENOENT);
+
+	statv = (u64 *)&ioc->is_stats;
+
+	for (i = 0; i < MPC_XS_MAX; ++i)
+		statv[i] = atomic64_read(&xvm->xvm_stats[i]);
+
+	mpc_xvm_put(xvm);
+
+	return 0;
+}
+
+/**
+ * mpioc_ring_setup() - create the unit's submission/completion ring
+ * @unit:   mpool unit ptr
+ * @ring:   ring parameter block
+ *
+ * A unit has at most one ring, which lives until the final close of
+ * the unit.  It is mapped via mmap() at the returned offset (region 0
+ * of the unit's address space, which is never assigned to an xvm).
+ */
+static merr_t mpioc_ring_setup(struct mpc_unit *unit, struct mpioc_ring *ring)
+{
+	struct mpc_ring    *rg;
+	merr_t              err;
+
+	if (ev(!unit || !unit->un_mpool || !unit->un_mapping || !ring))
+		return merr(EINVAL);
+
+	down(&unit->un_open_lock);
+	if (unit->un_ring) {
+		up(&unit->un_open_lock);
+		return merr(EEXIST);
+	}
+
+	err = mpc_ring_create(unit->un_mpool->mp_desc, ring->rg_entries, &rg);
+	if (!err) {
+		ring->rg_mmap_off = 0;
+		ring->rg_mmap_len = mpc_ring_size(rg);
+		unit->un_ring = rg;
+	}
+	up(&unit->un_open_lock);
+
+	return err;
+}
+
+static merr_t mpioc_ring_enter(struct mpc_unit *unit, struct mpioc_ring *ring)
+{
+	if (ev(!unit || !ring))
+		return merr(EINVAL);
+
+	if (!unit->un_ring)
+		return merr(ENXIO);
+
+	return mpc_ring_enter(unit->un_ring, &ring->rg_submit, ring->rg_wait);
+}
+
+/**
+ * mpioc_buf_reg() - Pin a user buffer for use by mblock reads and writes
+ * @unit:   mpool unit ptr
+ * @buf:    buffer parameter block
+ *
+ * MPIOC_BUF_REG ioctl handler.  The buffer is charged to the caller's
+ * locked_vm until it is unregistered or the unit is closed, and so counts
+ * against RLIMIT_MEMLOCK unless the caller has CAP_IPC_LOCK.
+ *
+ * Return:  Returns 0 if successful, errno via merr_t otherwise...
+ */
+static merr_t mpioc_buf_reg(struct mpc_unit *unit, struct mpioc_buf *buf)
+{
+	struct mpc_regbuf  *rb;
+	size_t              pagec;
+	merr_t              err;
+	int                 i;
+
+	if (ev(!unit || !unit->un_mpool || !buf))
+		return merr(EINVAL);
+
+	if (!PAGE_ALIGNED(buf->bf_addr) || !PAGE_ALIGNED(buf->bf_len) ||
+	    buf->bf_len == 0 || buf->bf_len > MPC_REGBUF_LEN_MAX)
+		return merr(EINVAL);
+
+	pagec = buf->bf_len >> PAGE_SHIFT;
+
+	rb = kvzalloc(sizeof(*rb) + pagec * sizeof(rb->rb_iov[0]), GFP_KERNEL);
+	if (!rb)
+		return merr(ENOMEM);
+
+	rb->rb_pagev = kvmalloc_array(pagec, sizeof(*rb->rb_pagev), GFP_KERNEL);
+	if (!rb->rb_pagev) {
+		kvfree(rb);
+		return merr(ENOMEM);
+	}
+
+	rb->rb_mm = current->mm;
+	rb->rb_addr = buf->bf_addr;
+	rb->rb_len = buf->bf_len;
+
+	err = mpc_regbuf_pin(rb);
+	if (ev(err)) {
+		kvfree(rb->rb_pagev);
+		kvfree(rb);
+		return err;
+	}
+
+	kref_init(&rb->rb_ref);
+	mmgrab(rb->rb_mm);
+
+	spin_lock(&unit->un_buflock);
+	for (i = 0; i < MPIOC_BUF_MAX; ++i) {
+		if (!unit->un_bufv[i]) {
+			unit->un_bufv[i] = rb;
+			break;
+		}
+	}
+	spin_unlock(&unit->un_buflock);
+
+	if (i >= MPIOC_BUF_MAX) {
+		mpc_regbuf_put(rb);
+		return merr(ENOSPC);
+	}
+
+	buf->bf_id = i + 1;
+
+	return 0;
+}
+
+/**
+ * mpioc_buf_unreg() - Unregister a buffer registered by MPIOC_BUF_REG
+ * @unit:   mpool unit ptr
+ * @buf:    buffer parameter block
+ *
+ * The buffer is unpinned once in-flight I/Os to it complete.
+ *
+ * Return:  Returns 0 if successful, errno via merr_t otherwise...
+ */
+static merr_t mpioc_buf_unreg(struct mpc_unit *unit, struct mpioc_buf *buf)
+{
+	struct mpc_regbuf  *rb;
+	u32                 id;
+
+	if (ev(!unit || !buf))
+		return merr(EINVAL);
+
+	id = buf->bf_id;
+	if (id < 1 || id > MPIOC_BUF_MAX)
+		return merr(EINVAL);
+
+	spin_lock(&unit->un_buflock);
+	rb = unit->un_bufv[id - 1];
+	if (rb && rb->rb_mm == current->mm)
+		unit->un_bufv[id - 1] = NULL;
+	else
+		rb = NULL;
+	spin_unlock(&unit->un_buflock);
+
+	if (!rb)
+		return merr(ENOENT);
+
+	mpc_regbuf_put(rb);
+
+	return 0;
+}
+
+/**
+ * mpioc_test_bench() - run an in-kernel benchmark
+ * @unit: mpool unit ptr
+ * @test: mpt_uval[0] is the user address of a struct mpioc_bench
+ *
+ * The results are copied out even if the run was cut short by a signal.
+ */
+static merr_t mpioc_test_bench(struct mpc_unit *unit, struct mpioc_test *test)
+{
+	struct mpioc_bench  bn;
+	void __user        *ubn;
+	merr_t              err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return merr(EPERM);
+
+	if (!unit->un_mpool)
+		return merr(EINVAL);
+
+	ubn = (void __user *)(ulong)test->mpt_uval[0];
+
+	if (copy_from_user(&bn, ubn, sizeof(bn)))
+		return merr(EFAULT);
+
+	err = mpc_bench_run(unit->un_mpool->mp_desc, &bn);
+	if (ev(err))
+		return err;
+
+	if (copy_to_user(ubn, &bn, sizeof(bn)))
+		return merr(EFAULT);
+
+	return 0;
+}
+
+/**
+ * mpioc_test() - MPIOC_TEST subcommands
+ * @unit:   mpool unit ptr
+ * @test:
+ * @rdonly: true if the unit was opened read-only
+ *
+ * MPIOC_TEST is allowed on read-only opens for the sake of the self-tests,
+ * the benchmarks modify the mpool and hence need a writable open.
+ */
+static merr_t mpioc_test(struct mpc_unit *unit, struct mpioc_test *test, bool rdonly)
 {
 	merr_t err = 0;
 
@@ -3369,11 +5371,20 @@ static merr_t mpioc_test(struct mpc_unit *unit, struct mpioc_test *test)
 		return merr(EINVAL);
 
 	switch (test->mpt_cmd) {
-	case 0:
+	case MPIOC_TEST_MERR:
 		test->mpt_sval[1] = merr((int)test->mpt_sval[0]);
 		err = test->mpt_sval[1];
 		break;
 
+	case MPIOC_TEST_BENCH:
+		if (rdonly) {
+			err = merr(EINVAL);
+			break;
+		}
+
+		err = mpioc_test_bench(unit, test);
+		break;
+
 	default:
 		err = merr(EINVAL);
 		break;
@@ -3382,6 +5393,82 @@ static merr_t mpioc_test(struct mpc_unit *unit, struct mpioc_test *test)
 	return err;
 }
 
+/*
+ * Per-command ioctl attributes, indexed by _IOC_NR(cmd):
+ * MPC_IOC_RDONLY: the command is allowed on a read-only open
+ * MPC_IOC_STKBUF: the handler gets the remainder of the on-stack argbuf
+ *
+ * Commands without an entry whose ic_cmd matches are rejected with ENOTTY
+ * before they reach the dispatch switch in mpc_ioctl(), so every command
+ * handled there must have an entry here, even one with no flags.
+ */
+#define MPC_IOC_RDONLY      0x01
+#define MPC_IOC_STKBUF      0x02
+
+struct mpc_ioc_info {
+	uint    ic_cmd;
+	uint    ic_flags;
+};
+
+#define MPC_IOC(_cmd, _flags)   [_IOC_NR(_cmd)] = { .ic_cmd = (_cmd), .ic_flags = (_flags) }
+
+static const struct mpc_ioc_info mpc_ioc_infov[] = {
+	MPC_IOC(MPIOC_MP_CREATE,        0),
+	MPC_IOC(MPIOC_MP_DESTROY,       0),
+	MPC_IOC(MPIOC_MP_ACTIVATE,      0),
+	MPC_IOC(MPIOC_MP_DEACTIVATE,    0),
+	MPC_IOC(MPIOC_MP_RENAME,        0),
+	MPC_IOC(MPIOC_PARAMS_GET,       0),
+	MPC_IOC(MPIOC_PARAMS_SET,       0),
+	MPC_IOC(MPIOC_MP_MCLASS_GET,    MPC_IOC_RDONLY),
+	MPC_IOC(MPIOC_DRV_ADD,          0),
+	MPC_IOC(MPIOC_PROP_GET,         MPC_IOC_RDONLY),
+	MPC_IOC(MPIOC_DEVPROPS_GET,     MPC_IOC_RDONLY),
+	MPC_IOC(MPIOC_MLOG_ALLOC,       0),
+	MPC_IOC(MPIOC_MLOG_COMMIT,      0),
+	MPC_IOC(MPIOC_MLOG_ABORT,       0),
+	MPC_IOC(MPIOC_MLOG_DELETE,      0),
+	MPC_IOC(MPIOC_MLOG_FIND,        MPC_IOC_RDONLY),
+	MPC_IOC(MPIOC_MLOG_READ,        MPC_IOC_RDONLY | MPC_IOC_STKBUF),
+	MPC_IOC(MPIOC_MLOG_WRITE,       MPC_IOC_STKBUF),
+	MPC_IOC(MPIOC_MLOG_PROPS,       MPC_IOC_RDONLY),
+	MPC_IOC(MPIOC_MLOG_ERASE,       0),
+	MPC_IOC(MPIOC_MLOG_SPARE_GET,   0),
+	MPC_IOC(MPIOC_MLOG_SEEK,        MPC_IOC_RDONLY),
+	MPC_IOC(MPIOC_MB_ALLOC,         0),
+	MPC_IOC(MPIOC_MB_ABORT,         0),
+	MPC_IOC(MPIOC_MB_COMMIT,        0),
+	MPC_IOC(MPIOC_MB_DELETE,        0),
+	MPC_IOC(MPIOC_MB_FIND,          MPC_IOC_RDONLY),
+	MPC_IOC(MPIOC_MB_COMMITV,       0),
+	MPC_IOC(MPIOC_MB_DELETEV,       0),
+	MPC_IOC(MPIOC_MB_READ,          MPC_IOC_RDONLY | MPC_IOC_STKBUF),
+	MPC_IOC(MPIOC_MB_WRITE,         MPC_IOC_STKBUF),
+	MPC_IOC(MPIOC_MB_READV,         MPC_IOC_RDONLY),
+	MPC_IOC(MPIOC_MB_WRITEV,        0),
+	MPC_IOC(MPIOC_MB_COPY,          0),
+	MPC_IOC(MPIOC_VMA_CREATE,       0),
+	MPC_IOC(MPIOC_VMA_DESTROY,      0),
+	MPC_IOC(MPIOC_VMA_PURGE,        0),
+	MPC_IOC(MPIOC_VMA_VRSS,         0),
+	MPC_IOC(MPIOC_VMA_STATS,        0),
+	MPC_IOC(MPIOC_RING_SETUP,       0),
+	MPC_IOC(MPIOC_RING_ENTER,       0),
+	MPC_IOC(MPIOC_BUF_REG,          MPC_IOC_RDONLY),
+	MPC_IOC(MPIOC_BUF_UNREG,        MPC_IOC_RDONLY),
+	MPC_IOC(MPIOC_TEST,             MPC_IOC_RDONLY),
+};
+
+static inline const struct mpc_ioc_info *mpc_ioc_info_get(uint cmd)
+{
+	uint nr = _IOC_NR(cmd);
+
+	if (nr < ARRAY_SIZE(mpc_ioc_infov) && mpc_ioc_infov[nr].ic_cmd == cmd)
+		return &mpc_ioc_infov[nr];
+
+	return NULL;
+}
+
 /**
  * mpc_ioctl() - mpc driver ioctl entry point
  * @fp:     file pointer
@@ -3401,35 +5488,32 @@ static merr_t mpioc_test(struct mpc_unit *unit, struct mpioc_test *test)
 static long mpc_ioctl(struct file *fp, unsigned int cmd, unsigned long arg)
 {
 	char argbuf[256] __aligned(16);
+	const struct mpc_ioc_info *info;
 	struct mpc_unit *unit;
 
 	size_t  argbufsz, stkbufsz;
 	void   *argp, *stkbuf;
 	merr_t  err;
 	ulong   iosz;
+	uint    flags;
 	int     rc;
 
 	if (_IOC_TYPE(cmd) != MPIOC_MAGIC)
 		return -ENOTTY;
 
-	if ((fp->f_flags & O_ACCMODE) == O_RDONLY) {
-		switch (cmd) {
-		case MPIOC_PROP_GET:
-		case MPIOC_DEVPROPS_GET:
-		case MPIOC_MB_FIND:
-		case MPIOC_MB_READ:
-		case MPIOC_MP_MCLASS_GET:
-		case MPIOC_MLOG_FIND:
-		case MPIOC_MLOG_READ:
-		case MPIOC_MLOG_PROPS:
-		case MPIOC_TEST:
-			break;
-
-		default:
-			return -EINVAL;
-		}
+	info = mpc_ioc_info_get(cmd);
+	if (!info) {
+		mp_pr_rl("invalid command %x: dir=%u type=%c nr=%u size=%u",
+			 merr(ENOTTY), cmd, _IOC_DIR(cmd), _IOC_TYPE(cmd), _IOC_NR(cmd),
+			 _IOC_SIZE(cmd));
+		return -ENOTTY;
 	}
 
+	flags = info->ic_flags;
+
+	if ((fp->f_flags & O_ACCMODE) == O_RDONLY && !(flags & MPC_IOC_RDONLY))
+		return -EINVAL;
+
 	unit = fp->private_data;
 	argbufsz = sizeof(argbuf);
 	iosz = _IOC_SIZE(cmd);
@@ -3473,6 +5557,15 @@ static long mpc_ioctl(struct file *fp, unsigned int cmd, unsigned long arg)
 		}
 	}
 
+	stkbuf = NULL;
+	stkbufsz = 0;
+
+	if (flags & MPC_IOC_STKBUF) {
+		assert(roundup(iosz, 16) < argbufsz);
+		stkbufsz = argbufsz - roundup(iosz, 16);
+		stkbuf = argbuf + roundup(iosz, 16);
+	}
+
 	switch (cmd) {
 	case MPIOC_MP_CREATE:
 	case MPIOC_MP_ACTIVATE:
@@ -3523,15 +5616,25 @@ static long mpc_ioctl(struct file *fp, unsigned int cmd, unsigned long arg)
 		err = mpioc_mb_abcomdel(unit, cmd, argp);
 		break;
 
+	case MPIOC_MB_COMMITV:
+	case MPIOC_MB_DELETEV:
+		err = mpioc_mb_comdelv(unit, cmd, argp);
+		break;
+
 	case MPIOC_MB_READ:
 	case MPIOC_MB_WRITE:
-		assert(roundup(iosz, 16) < argbufsz);
-		stkbufsz = argbufsz - roundup(iosz, 16);
-		stkbuf = argbuf + roundup(iosz, 16);
-
 		err = mpioc_mb_rw(unit, cmd, argp, stkbuf, stkbufsz);
 		break;
 
+	case MPIOC_MB_READV:
+	case MPIOC_MB_WRITEV:
+		err = mpioc_mb_rwv(unit, cmd, argp);
+		break;
+
+	case MPIOC_MB_COPY:
+		err = mpioc_mb_copy(unit, argp);
+		break;
+
 	case MPIOC_MLOG_ALLOC:
 		err = mpioc_mlog_alloc(unit, argp);
 		break;
@@ -3549,10 +5652,6 @@ static long mpc_ioctl(struct file *fp, unsigned int cmd, unsigned long arg)
 
 	case MPIOC_MLOG_READ:
 	case MPIOC_MLOG_WRITE:
-		assert(roundup(iosz, 16) < argbufsz);
-		stkbufsz = argbufsz - roundup(iosz, 16);
-		stkbuf = argbuf + roundup(iosz, 16);
-
 		err = mpioc_mlog_rw(unit, argp, stkbuf, stkbufsz);
 		break;
 
@@ -3560,6 +5659,14 @@ static long mpc_ioctl(struct file *fp, unsigned int cmd, unsigned long arg)
 		err = mpioc_mlog_erase(unit, argp);
 		break;
 
+	case MPIOC_MLOG_SPARE_GET:
+		err = mpioc_mlog_spare_get(unit, argp);
+		break;
+
+	case MPIOC_MLOG_SEEK:
+		err = mpioc_mlog_seek(unit, argp);
+		break;
+
 	case MPIOC_VMA_CREATE:
 		err = mpioc_xvm_create(unit, argp);
 		break;
@@ -3576,14 +5683,35 @@ static long mpc_ioctl(struct file *fp, unsigned int cmd, unsigned long arg)
 		err = mpioc_xvm_vrss(unit, argp);
 		break;
 
+	case MPIOC_VMA_STATS:
+		err = mpioc_xvm_stats(unit, argp);
+		break;
+
+	case MPIOC_RING_SETUP:
+		err = mpioc_ring_setup(unit, argp);
+		break;
+
+	case MPIOC_RING_ENTER:
+		err = mpioc_ring_enter(unit, argp);
+		break;
+
+	case MPIOC_BUF_REG:
+		err = mpioc_buf_reg(unit, argp);
+		break;
+
+	case MPIOC_BUF_UNREG:
+		err = mpioc_buf_unreg(unit, argp);
+		break;
+
 	case MPIOC_TEST:
-		err = mpioc_test(unit, argp);
+		err = mpioc_test(unit, argp, (fp->f_flags & O_ACCMODE) == O_RDONLY);
 		break;
 
 	default:
+		/* mpc_ioc_infov[] has an entry without a case above. */
 		err = merr(ENOTTY);
-		mp_pr_rl("invalid command %x: dir=%u type=%c nr=%u size=%u",
-			 err, cmd, _IOC_DIR(cmd), _IOC_TYPE(cmd), _IOC_NR(cmd), _IOC_SIZE(cmd));
+		mp_pr_rl("unhandled command %x: nr=%u", err, cmd, _IOC_NR(cmd));
+		assert(0);
 		break;
 	}
 
@@ -3619,6 +5747,14 @@ struct vcache {
 
 static struct vcache mpc_physio_vcache;
 
+/*
+ * Each CPU caches one free buffer of MPC_PHYSIO_PCPU_SZ bytes for the
+ * page and kvec arrays of small and medium requests.
+ */
+#define MPC_PHYSIO_PCPU_SZ      (PAGE_SIZE * 2)
+
+static DEFINE_PER_CPU(void *, mpc_physio_pcpu);
+
 static void *mpc_vcache_alloc(struct vcache *vc, size_t sz)
 {
 	void *p;
@@ -3670,95 +5806,38 @@ static void mpc_vcache_fini(struct vcache *vc)
 }
 
 /**
- * mpc_physio() - Generic raw device mblock read/write routine.
- * @mpd:      mpool descriptor
- * @desc:     mblock or mlog descriptor
- * @uiov:     vector of iovecs that describe user-space segments
- * @uioc:     count of elements in uiov[]
- * @offset:   offset into the mblock at which to start reading
- * @objtype:  mblock or mlog
- * @rw:       READ or WRITE in regards to the media.
- * @stkbuf:   caller provided scratch space
- * @stkbufsz: size of stkbuf
- *
- * This function creates an array of iovec objects each of which
- * map a portion of the user request into kernel space so that
- * mpool can directly access the user data.  Note that this is
- * a zero-copy operation.
+ * mpc_physio_pin() - Pin and map user-space segments into kernel space
+ * @uiov:    vector of iovecs that describe user-space segments
+ * @uioc:    count of elements in uiov[]
+ * @length:  total length of uiov[], must be page aligned
+ * @rw:      READ or WRITE in regards to the media.
+ * @pagesv:  (output) array of length/PAGE_SIZE page pointers
+ * @iov:     (output) array of length/PAGE_SIZE kvecs
  *
- * Requires that each user-space segment be page aligned and of an
- * integral number of pages.
- *
- * See http://www.makelinux.net/ldd3/chp-15-sect-3 for more detail.
+ * On success, each page in pagesv[] is pinned and kmapped by the
+ * corresponding kvec in iov[], and must be released by calling
+ * mpc_physio_unpin().  On failure, nothing remains pinned.
  */
-static merr_t
-mpc_physio(
-	struct mpool_descriptor    *mpd,
-	void                       *desc,
-	struct iovec               *uiov,
-	int                         uioc,
-	off_t                       offset,
-	enum mp_obj_type            objtype,
-	int                         rw,
-	void                       *stkbuf,
-	size_t                      stkbufsz)
+merr_t
+mpc_physio_pin(
+	struct iovec       *uiov,
+	int                 uioc,
+	size_t              length,
+	int                 rw,
+	struct page       **pagesv,
+	struct kvec        *iov)
 {
-	struct kvec        *iov_base, *iov;
 	struct iov_iter     iter;
-	struct page       **pagesv;
 
-	size_t  pagesvsz, pgbase, length;
+	size_t  pgbase;
 	int     pagesc, niov, i;
 	ssize_t cc;
 	merr_t  err;
 
-	iov = NULL;
+	pagesc = length / PAGE_SIZE;
 	niov = 0;
 	err = 0;
 
-	length = iov_length(uiov, uioc);
-
-	if (length < PAGE_SIZE || !IS_ALIGNED(length, PAGE_SIZE))
-		return merr(EINVAL);
-
-	if (length > (mpc_rwsz_max << 20))
-		return merr(EINVAL);
-
-	/*
-	 * Allocate an array of page pointers for iov_iter_get_pages()
-	 * and an array of iovecs for mblock_read() and mblock_write().
-	 *
-	 * Note: the only way we can calculate the number of required
-	 * iovecs in advance is to assume that we need one per page.
-	 */
-	pagesc = length / PAGE_SIZE;
-	pagesvsz = (sizeof(*pagesv) + sizeof(*iov)) * pagesc;
-
-	/*
-	 * pagesvsz may be big, and it will not be used as the iovec_list
-	 * for the block stack - pd will chunk it up to the underlying
-	 * devices (with another iovec list per pd).
-	 */
-	if (pagesvsz > stkbufsz) {
-		pagesv = NULL;
-
-		if (pagesvsz <= PAGE_SIZE * 2)
-			pagesv = kmalloc(pagesvsz, GFP_NOIO);
-
-		while (!pagesv) {
-			pagesv = mpc_vcache_alloc(&mpc_physio_vcache, pagesvsz);
-			if (!pagesv)
-				usleep_range(750, 1250);
-		}
-	} else {
-		pagesv = stkbuf;
-	}
-
-	if (!pagesv)
-		return merr(ENOMEM);
-
-	iov_base = (struct kvec *)((char *)pagesv + (sizeof(*pagesv) * pagesc));
-
 #if HAVE_IOV_ITER_INIT_DIRECTION
 	iov_iter_init(&iter, rw, uiov, uioc, length);
 #else
@@ -3810,52 +5889,240 @@ mpc_physio(
 	}
 
 	/* Build an array of iovecs for mpool so that it can directly access the user data. */
-	for (i = 0, iov = iov_base; i < pagesc; ++i, ++iov, ++niov) {
-		iov->iov_len = PAGE_SIZE;
-		iov->iov_base = kmap(pagesv[i]);
+	for (i = 0; i < pagesc; ++i, ++niov) {
+		iov[i].iov_len = PAGE_SIZE;
+		iov[i].iov_base = kmap(pagesv[i]);
 
-		if (!iov->iov_base) {
+		if (!iov[i].iov_base) {
 			err = merr(EINVAL);
 			pagesc = i + 1;
 			goto errout;
 		}
 	}
 
+	return 0;
+
+errout:
+	for (i = 0; i < pagesc; ++i) {
+		if (i < niov)
+			kunmap(pagesv[i]);
+		put_page(pagesv[i]);
+	}
+
+	return err;
+}
+
+/**
+ * mpc_physio_unpin() - Release the pages pinned by mpc_physio_pin()
+ * @pagesv:  array of page pointers
+ * @pagesc:  count of elements in pagesv[]
+ */
+void mpc_physio_unpin(struct page **pagesv, int pagesc)
+{
+	int i;
+
+	for (i = 0; i < pagesc; ++i) {
+		kunmap(pagesv[i]);
+		put_page(pagesv[i]);
+	}
+}
+
+/**
+ * mpc_physio_alloc() - Allocate page and kvec arrays for mpc_physio_pin()
+ * @pagesvsz: size in bytes of the required arrays
+ * @stkbuf:   caller provided scratch space
+ * @stkbufsz: size of stkbuf
+ *
+ * Must be released with mpc_physio_free().
+ */
+void *mpc_physio_alloc(size_t pagesvsz, void *stkbuf, size_t stkbufsz)
+{
+	void *pagesv;
+
+	/*
+	 * pagesvsz may be big, and it will not be used as the iovec_list
+	 * for the block stack - pd will chunk it up to the underlying
+	 * devices (with another iovec list per pd).
+	 */
+	if (pagesvsz <= stkbufsz)
+		return stkbuf;
+
+	pagesv = NULL;
+
+	if (pagesvsz <= MPC_PHYSIO_PCPU_SZ) {
+		pagesv = this_cpu_xchg(mpc_physio_pcpu, NULL);
+		if (!pagesv)
+			pagesv = kmalloc(MPC_PHYSIO_PCPU_SZ, GFP_NOIO);
+	}
+
+	while (!pagesv) {
+		pagesv = mpc_vcache_alloc(&mpc_physio_vcache, pagesvsz);
+		if (!pagesv)
+			usleep_range(750, 1250);
+	}
+
+	return pagesv;
+}
+
+void mpc_physio_free(void *pagesv, size_t pagesvsz, size_t stkbufsz)
+{
+	if (pagesvsz > stkbufsz) {
+		if (pagesvsz > MPC_PHYSIO_PCPU_SZ)
+			mpc_vcache_free(&mpc_physio_vcache, pagesv);
+		else if (this_cpu_cmpxchg(mpc_physio_pcpu, NULL, pagesv))
+			kfree(pagesv);
+	}
+}
+
+static void mpc_physio_pcpu_fini(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(mpc_physio_pcpu, cpu));
+		per_cpu(mpc_physio_pcpu, cpu) = NULL;
+	}
+}
+
+static merr_t
+mpc_physio_rw(
+	struct mpool_descriptor    *mpd,
+	void                       *desc,
+	const struct kvec          *iov,
+	int                         pagesc,
+	off_t                       offset,
+	enum mp_obj_type            objtype,
+	int                         rw)
+{
+	merr_t err;
+
 	switch (objtype) {
 	case MP_OBJ_MBLOCK:
 		if (rw == WRITE) {
-			err = mblock_write(mpd, desc, iov_base, niov, pagesc << PAGE_SHIFT);
+			err = mblock_write(mpd, desc, iov, pagesc, pagesc << PAGE_SHIFT);
 			ev(err);
 		} else {
-			err = mblock_read(mpd, desc, iov_base, niov, offset, pagesc << PAGE_SHIFT);
+			err = mblock_read(mpd, desc, iov, pagesc, offset, pagesc << PAGE_SHIFT);
 			ev(err);
 		}
 		break;
 
 	case MP_OBJ_MLOG:
-		err = mlog_rw_raw(mpd, desc, iov_base, niov, offset, rw);
+		err = mlog_rw_raw(mpd, desc, iov, pagesc, offset, rw);
 		ev(err);
 		break;
 
 	default:
 		err = merr(EINVAL);
-		goto errout;
+		break;
 	}
 
-errout:
-	for (i = 0, iov = iov_base; i < pagesc; ++i, ++iov) {
-		if (i < niov)
-			kunmap(pagesv[i]);
-		put_page(pagesv[i]);
-	}
+	return err;
+}
 
-	if (pagesvsz > stkbufsz) {
-		if (pagesvsz > PAGE_SIZE * 2)
-			mpc_vcache_free(&mpc_physio_vcache, pagesv);
-		else
-			kfree(pagesv);
+/**
+ * mpc_physio() - Generic raw device mblock read/write routine.
+ * @mpd:      mpool descriptor
+ * @desc:     mblock or mlog descriptor
+ * @uiov:     vector of iovecs that describe user-space segments
+ * @uioc:     count of elements in uiov[]
+ * @offset:   offset into the mblock at which to start reading
+ * @objtype:  mblock or mlog
+ * @rw:       READ or WRITE in regards to the media.
+ * @rb:       registered buffer containing uiov[], or NULL
+ * @stkbuf:   caller provided scratch space
+ * @stkbufsz: size of stkbuf
+ *
+ * This function creates an array of iovec objects each of which
+ * map a portion of the user request into kernel space so that
+ * mpool can directly access the user data.  Note that this is
+ * a zero-copy operation.
+ *
+ * Requires that each user-space segment be page aligned and of an
+ * integral number of pages.
+ *
+ * See http://www.makelinux.net/ldd3/chp-15-sect-3 for more detail.
+ */
+static merr_t
+mpc_physio(
+	struct mpool_descriptor    *mpd,
+	void                       *desc,
+	struct iovec               *uiov,
+	int                         uioc,
+	off_t                       offset,
+	enum mp_obj_type            objtype,
+	int                         rw,
+	struct mpc_regbuf          *rb,
+	void                       *stkbuf,
+	size_t                      stkbufsz)
+{
+	struct kvec        *iov_base;
+	struct page       **pagesv;
+
+	size_t  pagesvsz, length;
+	int     pagesc;
+	merr_t  err;
+
+	length = iov_length(uiov, uioc);
+
+	if (length < PAGE_SIZE || !IS_ALIGNED(length, PAGE_SIZE))
+		return merr(EINVAL);
+
+	if (length > (mpc_rwsz_max << 20))
+		return merr(EINVAL);
+
+	pagesc = length / PAGE_SIZE;
+
+	/* The pages of a registered buffer are already pinned and mapped. */
+	if (rb) {
+		const struct kvec  *riov;
+
+		iov_base = NULL;
+		pagesvsz = 0;
+
+		if (uioc > 1) {
+			pagesvsz = sizeof(*iov_base) * pagesc;
+			iov_base = mpc_physio_alloc(pagesvsz, stkbuf, stkbufsz);
+			if (!iov_base)
+				return merr(ENOMEM);
+		}
+
+		err = mpc_regbuf_map(rb, uiov, uioc, iov_base, &riov);
+		if (!err)
+			err = mpc_physio_rw(mpd, desc, riov, pagesc, offset, objtype, rw);
+
+		if (iov_base)
+			mpc_physio_free(iov_base, pagesvsz, stkbufsz);
+
+		return err;
 	}
 
+	/*
+	 * Allocate an array of page pointers for iov_iter_get_pages()
+	 * and an array of iovecs for mblock_read() and mblock_write().
+	 *
+	 * Note: the only way we can calculate the number of required
+	 * iovecs in advance is to assume that we need one per page.
+	 */
+	pagesvsz = (sizeof(*pagesv) + sizeof(*iov_base)) * pagesc;
+
+	pagesv = mpc_physio_alloc(pagesvsz, stkbuf, stkbufsz);
+	if (!pagesv)
+		return merr(ENOMEM);
+
+	iov_base = (struct kvec *)((char *)pagesv + (sizeof(*pagesv) * pagesc));
+
+	err = mpc_physio_pin(uiov, uioc, length, rw, pagesv, iov_base);
+	if (err)
+		goto errout;
+
+	err = mpc_physio_rw(mpd, desc, iov_base, pagesc, offset, objtype, rw);
+
+	mpc_physio_unpin(pagesv, pagesc);
+
+errout:
+	mpc_physio_free(pagesv, pagesvsz, stkbufsz);
+
 	return err;
 }
 
@@ -3942,16 +6209,13 @@ static void mpc_exit_impl(void)
 		ss->ss_inited = false;
 	}
 
-	for (i = 0; i < ARRAY_SIZE(mpc_wq_rav); ++i) {
-		destroy_workqueue(mpc_wq_rav[i]);
-		mpc_wq_rav[i] = NULL;
-	}
-
+	mpc_ring_fini();
 	mpc_reap_destroy(mpc_reap);
 	destroy_workqueue(mpc_wq_trunc);
 	kmem_cache_destroy(mpc_xvm_cache[1]);
 	kmem_cache_destroy(mpc_xvm_cache[0]);
 	mpc_vcache_fini(&mpc_physio_vcache);
+	mpc_physio_pcpu_fini();
 
 	mpc_bdi_teardown();
 	evc_fini();
@@ -3987,6 +6251,7 @@ static __init int mpc_init(void)
 	mpc_rwconc_max = clamp_t(ulong, mpc_rwconc_max, 1, 32);
 
 	mpc_chunker_size = clamp_t(uint, mpc_chunker_size, 128, 1024);
+	mpc_pd_qdepth = min_t(uint, mpc_pd_qdepth, 4096);
 
 	/* Must be same as mpc_physio() pagesvsz calculation. */
 	sz = (mpc_rwsz_max << 20) / PAGE_SIZE;
@@ -4033,18 +6298,10 @@ static __init int mpc_init(void)
 		goto errout;
 	}
 
-	for (i = 0; i < ARRAY_SIZE(mpc_wq_rav); ++i) {
-		int     maxactive = 16;
-		char    name[16];
-
-		snprintf(name, sizeof(name), "mpc_wq_ra%d", i);
-
-		mpc_wq_rav[i] = alloc_workqueue(name, 0, maxactive);
-		if (!mpc_wq_rav[i]) {
-			errmsg = "mpctl ra workqueue alloc failed";
-			err = merr(ENOMEM);
-			goto errout;
-		}
+	err = mpc_ring_init();
+	if (ev(err)) {
+		errmsg = "ring init failed";
+		goto errout;
 	}
 
 	cdev_init(&ss->ss_cdev, &mpc_fops_default);
@@ -4145,12 +6402,14 @@ static const struct file_operations mpc_fops_default = {
 	.release	= mpc_release,
 	.unlocked_ioctl	= mpc_ioctl,
 	.mmap           = mpc_mmap,
+	.get_unmapped_area = mpc_get_unmapped_area,
 };
 
 static const struct vm_operations_struct mpc_vops_default = {
 	.open           = mpc_vm_open,
 	.close          = mpc_vm_close,
 	.fault          = mpc_vm_fault,
+	.map_pages      = filemap_map_pages,
 };
 
 static const struct address_space_operations mpc_aops_default = {
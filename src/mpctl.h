@@ -8,35 +8,103 @@
 
 #include <linux/rbtree.h>
 #include <linux/kref.h>
+#include <linux/spinlock.h>
 
 #include "mblock.h"
 
 struct mpc_unit;
 struct mpc_rgnmap;
+struct mlog_descriptor;
 
 extern uint mpc_chunker_size;
+extern uint mpc_pd_qdepth;
+extern uint mpc_pd_dax;
+extern uint mpc_rwsz_max;
 
 struct mpc_mbinfo {
-	struct mblock_descriptor   *mbdesc;
+	union {
+		struct mblock_descriptor   *mbdesc;
+		struct mlog_descriptor     *mldesc;
+	};
 	u32                         mblen;
 	u32                         mbmult;
 	atomic64_t                  mbatime;
+	unsigned long               mbrefs;     /* Ranges referenced, see mpctl_reap.c */
 } __aligned(32);
 
+/**
+ * struct mpc_xvm_ra - Fault pattern tracking for xvm readahead
+ * @ra_lock:   protects all of the below
+ * @ra_prev:   page index of the previous fault
+ * @ra_stride: distance from the fault before that, 1 if sequential
+ * @ra_next:   first page of the sequential stream not yet prefetched
+ * @ra_win:    readahead window in pages, zero while access is random
+ * @ra_hits:   number of consecutive faults which followed the pattern
+ */
+struct mpc_xvm_ra {
+	spinlock_t                  ra_lock;
+	pgoff_t                     ra_prev;
+	long                        ra_stride;
+	pgoff_t                     ra_next;
+	uint                        ra_win;
+	uint                        ra_hits;
+};
+
+/*
+ * Per-xvm and per-unit statistics, in the order of struct mpool_xvm_stats.
+ */
+enum mpc_xvm_stat {
+	MPC_XS_FAULTS,
+	MPC_XS_MAJFAULTS,
+	MPC_XS_REFAULTS,
+	MPC_XS_FA_PAGES,
+	MPC_XS_FA_USED,
+	MPC_XS_RA_PAGES,
+	MPC_XS_RA_USED,
+	MPC_XS_EVICT_REAP,
+	MPC_XS_EVICT_KERNEL,
+	MPC_XS_MAX
+};
+
+/**
+ * struct mpc_budget - Page cache budget of the xvms of an mpool unit
+ * @bg_list:  reaper's list of budgets
+ * @bg_pages: number of pages resident in the unit's xvms
+ * @bg_soft:  soft limit in pages, zero if none
+ * @bg_hard:  hard limit in pages, zero if none
+ * @bg_ttl:   reaper TTL (usecs) applied while over the hard limit
+ *
+ * While at or below its soft limit the reaper does not evict pages from
+ * the unit's xvms to relieve system memory pressure.  While above its
+ * hard limit the reaper evicts pages from the unit's xvms regardless of
+ * system memory pressure.
+ */
+struct mpc_budget {
+	struct list_head            bg_list;
+	atomic64_t                  bg_pages;
+	ulong                       bg_soft;
+	ulong                       bg_hard;
+	atomic_t                    bg_ttl;
+};
+
 struct mpc_xvm {
 	size_t                      xvm_bktsz;
 	uint                        xvm_mbinfoc;
+	u64                        *xvm_mbidv;     /* Lazy maps only, see mpc_xvm_resolve() */
 	uint                        xvm_rgn;
 	struct kref                 xvm_ref;
 	u32                         xvm_magic;
 	struct mpool_descriptor    *xvm_mpdesc;
 
 	atomic64_t                 *xvm_hcpagesp;
+	struct mpc_budget          *xvm_budget;
 	struct address_space       *xvm_mapping;
 	struct mpc_rgnmap          *xvm_rgnmap;
 	struct mpc_reap            *xvm_reap;
 
 	enum mpc_vma_advice         xvm_advice;
+	bool                        xvm_mlog;
+	bool                        xvm_huge;
 	atomic_t                    xvm_opened;
 	struct kmem_cache          *xvm_cache;
 	struct mpc_xvm             *xvm_next;
@@ -46,11 +114,19 @@ struct mpc_xvm {
 	atomic_t                    xvm_evicting;
 	atomic_t                    xvm_reapref;
 	atomic_t                   *xvm_freedp;
+	uint                        xvm_rngshift;
+	u64                         xvm_agetime;
 
 	____cacheline_aligned
 	atomic64_t                  xvm_nrpages;
 	atomic_t                    xvm_rabusy;
 	struct work_struct          xvm_work;
+	struct mpc_xvm_ra           xvm_ra;
+
+	____cacheline_aligned
+	atomic64_t                  xvm_stats[MPC_XS_MAX];
+	atomic64_t                 *xvm_ustats;
+	unsigned long              *xvm_evictmap;  /* Pages evicted, for refaults */
 
 	____cacheline_aligned
 	struct mpc_mbinfo           xvm_mbinfov[];
@@ -70,6 +146,14 @@ static inline size_t mpc_xvm_pglen(struct mpc_xvm *xvm)
 
 void mpc_xvm_free(struct mpc_xvm *xvm);
 
+static inline void mpc_xvm_nrpages_add(struct mpc_xvm *xvm, long pagec)
+{
+	if (xvm->xvm_hcpagesp)
+		atomic64_add(pagec, xvm->xvm_hcpagesp);
+	atomic64_add(pagec, &xvm->xvm_budget->bg_pages);
+	atomic64_add(pagec, &xvm->xvm_nrpages);
+}
+
 static inline struct mpc_unit *dev_to_unit(struct device *dev)
 {
 	return dev_get_drvdata(dev);
@@ -77,4 +161,19 @@ static inline struct mpc_unit *dev_to_unit(struct device *dev)
 
 struct mpc_reap *dev_to_reap(struct device *dev);
 
+merr_t
+mpc_physio_pin(
+	struct iovec       *uiov,
+	int                 uioc,
+	size_t              length,
+	int                 rw,
+	struct page       **pagesv,
+	struct kvec        *iov);
+
+void mpc_physio_unpin(struct page **pagesv, int pagesc);
+
+void *mpc_physio_alloc(size_t pagesvsz, void *stkbuf, size_t stkbufsz);
+
+void mpc_physio_free(void *pagesv, size_t pagesvsz, size_t stkbufsz);
+
 #endif /* MPOOL_MPCTL_H */
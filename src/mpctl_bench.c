@@ -0,0 +1,1008 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * In-kernel microbenchmarks, run via MPIOC_TEST.
+ *
+ * A benchmark runs one workload on N workers, each of which performs
+ * bn_ops operations on its own set of objects.  The objects are created
+ * before the measured phase starts and are deleted after it ends, so that
+ * only the operation under test is timed.  Latencies are accumulated in a
+ * per-worker log-linear histogram which is merged at the end to derive the
+ * percentiles reported to the caller.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/uio.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+
+#include "mpool_defs.h"
+
+#include "mpctl_bench.h"
+
+#define MPC_BENCH_THREADS_MAX   64
+#define MPC_BENCH_IOSZ_MAX      (1024 * 1024)
+#define MPC_BENCH_MLOG_CAP      (16 * 1024 * 1024)
+#define MPC_BENCH_RDCHUNKS_MAX  64
+#define MPC_BENCH_LOOKUP_OBJS   16
+#define MPC_BENCH_MDC_BATCH     8
+#define MPC_BENCH_MDC_CBG_OPS   256
+
+/*
+ * Latency histogram: values below 8ns have their own bucket, every power
+ * of two above that is split into 8 linear sub-buckets.
+ */
+#define MPC_BENCH_HSUB_SHIFT    3
+#define MPC_BENCH_HSUB          (1u << MPC_BENCH_HSUB_SHIFT)
+#define MPC_BENCH_HBKT          ((64 - MPC_BENCH_HSUB_SHIFT + 1) * MPC_BENCH_HSUB)
+
+/* p50, p90, p99 and p99.9 in tenths of a percent */
+static const u32 mpc_bench_pctv[MPIOC_BENCH_PCT_MAX] = { 500, 900, 990, 999 };
+
+struct mpc_bench;
+
+/**
+ * struct mpc_bench_thr - per-worker state
+ * @bt_work:    work item which runs the worker
+ * @bt_bench:   benchmark this worker belongs to
+ * @bt_err:     setup error
+ * @bt_end:     time at which the measured phase ended for this worker
+ * @bt_done:    operations completed
+ * @bt_errors:  operations which failed
+ * @bt_latsum:  sum of the latencies of completed operations
+ * @bt_latmin:  min latency
+ * @bt_latmax:  max latency
+ * @bt_buf:     page aligned I/O buffer of bt_bufsz bytes
+ * @bt_bufsz:
+ * @bt_mbh:     mblock read by MPIOC_BENCH_MB_READ
+ * @bt_chunks:  number of bn_iosz chunks written to bt_mbh
+ * @bt_mlh:     mlogs used by the mlog and MDC workloads
+ * @bt_mlrecs:  records in bt_mlh[0] after MPIOC_BENCH_MLOG_SEEK setup
+ * @bt_mdc:     MDC used by MPIOC_BENCH_MDC_APPEND
+ * @bt_cbgops:  appends since the background compaction of bt_mdc started,
+ *              0 if none is in progress
+ * @bt_pdh:     drive used by MPIOC_BENCH_SMAP
+ * @bt_mbhv:    mblocks looked up by MPIOC_BENCH_OBJ_LOOKUP
+ * @bt_objidv:  objids of bt_mbhv[]
+ * @bt_histv:   latency histogram
+ */
+struct mpc_bench_thr {
+	struct work_struct          bt_work;
+	struct mpc_bench           *bt_bench;
+	merr_t                      bt_err;
+	u64                         bt_end;
+	u64                         bt_done;
+	u64                         bt_errors;
+	u64                         bt_latsum;
+	u64                         bt_latmin;
+	u64                         bt_latmax;
+
+	char                       *bt_buf;
+	size_t                      bt_bufsz;
+	struct mblock_descriptor   *bt_mbh;
+	u32                         bt_chunks;
+	struct mlog_descriptor     *bt_mlh[2];
+	u64                         bt_mlrecs;
+	struct mp_mdc              *bt_mdc;
+	u32                         bt_cbgops;
+	u16                         bt_pdh;
+	struct mblock_descriptor   *bt_mbhv[MPC_BENCH_LOOKUP_OBJS];
+	u64                         bt_objidv[MPC_BENCH_LOOKUP_OBJS];
+
+	u32                         bt_histv[MPC_BENCH_HBKT];
+};
+
+/**
+ * struct mpc_bench_wl - workload operations
+ * @bw_setup:    create the worker's objects (optional)
+ * @bw_op:       perform operation i, may advance *t0 past untimed work
+ * @bw_teardown: delete the worker's objects (optional)
+ * @bw_buf:      the workload needs an I/O buffer
+ * @bw_pgalign:  bn_iosz must be page aligned
+ */
+struct mpc_bench_wl {
+	merr_t    (*bw_setup)(struct mpc_bench_thr *thr);
+	merr_t    (*bw_op)(struct mpc_bench_thr *thr, u64 i, u64 *t0);
+	void      (*bw_teardown)(struct mpc_bench_thr *thr);
+	bool        bw_buf;
+	bool        bw_pgalign;
+};
+
+/**
+ * struct mpc_bench - benchmark run
+ * @bc_mp:      mpool under test
+ * @bc_parms:   parameters
+ * @bc_wl:      workload
+ * @bc_setup:   workers which have not finished setup
+ * @bc_active:  workers which have not finished
+ * @bc_go:      set once all workers are ready to start the measured phase
+ * @bc_stop:    set to end the measured phase early
+ * @bc_wait:    waiters on the above
+ */
+struct mpc_bench {
+	struct mpool_descriptor    *bc_mp;
+	const struct mpioc_bench   *bc_parms;
+	const struct mpc_bench_wl  *bc_wl;
+	atomic_t                    bc_setup;
+	atomic_t                    bc_active;
+	atomic_t                    bc_go;
+	atomic_t                    bc_stop;
+	wait_queue_head_t           bc_wait;
+};
+
+static inline uint mpc_bench_bkt(u64 ns)
+{
+	uint msb;
+
+	if (ns < MPC_BENCH_HSUB)
+		return ns;
+
+	msb = fls64(ns) - 1;
+
+	return (msb - MPC_BENCH_HSUB_SHIFT + 1) * MPC_BENCH_HSUB +
+		((ns >> (msb - MPC_BENCH_HSUB_SHIFT)) & (MPC_BENCH_HSUB - 1));
+}
+
+/* Return the largest latency which falls into bucket bkt */
+static u64 mpc_bench_bkt2ns(uint bkt)
+{
+	uint shift;
+
+	if (bkt < MPC_BENCH_HSUB)
+		return bkt;
+
+	shift = bkt / MPC_BENCH_HSUB - 1;
+
+	return ((u64)(MPC_BENCH_HSUB + bkt % MPC_BENCH_HSUB + 1) << shift) - 1;
+}
+
+static void mpc_bench_mbh_discard(struct mpool_descriptor *mp, struct mblock_descriptor *mbh,
+				  bool committed)
+{
+	merr_t err;
+
+	err = committed ? mblock_delete(mp, mbh) : mblock_abort(mp, mbh);
+	if (err)
+		mblock_put(mp, mbh);
+}
+
+static void mpc_bench_mlh_discard(struct mpool_descriptor *mp, struct mlog_descriptor *mlh,
+				  bool committed)
+{
+	merr_t err;
+
+	err = committed ? mlog_delete(mp, mlh) : mlog_abort(mp, mlh);
+	if (err)
+		mlog_put(mp, mlh);
+}
+
+static merr_t mpc_bench_mb_alloc_op(struct mpc_bench_thr *thr, u64 i, u64 *t0)
+{
+	struct mpool_descriptor    *mp = thr->bt_bench->bc_mp;
+	struct mblock_descriptor   *mbh;
+	struct mblock_props         props;
+	merr_t                      err;
+
+	err = mblock_alloc(mp, thr->bt_bench->bc_parms->bn_mclassp, false, &mbh, &props);
+	if (err)
+		return err;
+
+	err = mblock_abort(mp, mbh);
+	if (err)
+		mblock_put(mp, mbh);
+
+	return err;
+}
+
+static merr_t mpc_bench_mb_write_op(struct mpc_bench_thr *thr, u64 i, u64 *t0)
+{
+	struct mpool_descriptor    *mp = thr->bt_bench->bc_mp;
+	struct mblock_descriptor   *mbh;
+	struct mblock_props         props;
+	struct kvec                 iov;
+	merr_t                      err;
+
+	err = mblock_alloc(mp, thr->bt_bench->bc_parms->bn_mclassp, false, &mbh, &props);
+	if (err)
+		return err;
+
+	iov.iov_base = thr->bt_buf;
+	iov.iov_len = thr->bt_bufsz;
+
+	err = mblock_write(mp, mbh, &iov, 1, iov.iov_len);
+	if (!err)
+		err = mblock_commit(mp, mbh);
+
+	if (err) {
+		mpc_bench_mbh_discard(mp, mbh, false);
+		return err;
+	}
+
+	err = mblock_delete(mp, mbh);
+	if (err)
+		mblock_put(mp, mbh);
+
+	return err;
+}
+
+static merr_t mpc_bench_mb_read_setup(struct mpc_bench_thr *thr)
+{
+	struct mpool_descriptor    *mp = thr->bt_bench->bc_mp;
+	struct mblock_props         props;
+	struct kvec                 iov;
+	merr_t                      err;
+	u32                         i;
+
+	err = mblock_alloc(mp, thr->bt_bench->bc_parms->bn_mclassp, false, &thr->bt_mbh, &props);
+	if (err)
+		return err;
+
+	/* All but the last write to an mblock must be optimal write size aligned */
+	thr->bt_chunks = 1;
+	if (props.mpr_optimal_wrsz && thr->bt_bufsz % props.mpr_optimal_wrsz == 0)
+		thr->bt_chunks = min_t(u64, props.mpr_alloc_cap / thr->bt_bufsz,
+				       MPC_BENCH_RDCHUNKS_MAX);
+
+	if (thr->bt_chunks == 0 || thr->bt_bufsz > props.mpr_alloc_cap) {
+		mpc_bench_mbh_discard(mp, thr->bt_mbh, false);
+		return merr(EINVAL);
+	}
+
+	iov.iov_base = thr->bt_buf;
+	iov.iov_len = thr->bt_bufsz;
+
+	for (i = 0; i < thr->bt_chunks && !err; ++i)
+		err = mblock_write(mp, thr->bt_mbh, &iov, 1, iov.iov_len);
+
+	if (!err)
+		err = mblock_commit(mp, thr->bt_mbh);
+
+	if (err)
+		mpc_bench_mbh_discard(mp, thr->bt_mbh, false);
+
+	return err;
+}
+
+static merr_t mpc_bench_mb_read_op(struct mpc_bench_thr *thr, u64 i, u64 *t0)
+{
+	struct kvec iov;
+	loff_t      boff;
+
+	iov.iov_base = thr->bt_buf;
+	iov.iov_len = thr->bt_bufsz;
+
+	boff = (loff_t)do_div(i, thr->bt_chunks) * thr->bt_bufsz;
+
+	return mblock_read(thr->bt_bench->bc_mp, thr->bt_mbh, &iov, 1, boff, iov.iov_len);
+}
+
+static void mpc_bench_mb_read_teardown(struct mpc_bench_thr *thr)
+{
+	mpc_bench_mbh_discard(thr->bt_bench->bc_mp, thr->bt_mbh, true);
+}
+
+/* Allocate and commit the worker's mlogs */
+static merr_t mpc_bench_mlog_create(struct mpc_bench_thr *thr, int mlc, u64 *objidv)
+{
+	struct mpool_descriptor    *mp = thr->bt_bench->bc_mp;
+	struct mlog_capacity        cap = { .lcp_captgt = MPC_BENCH_MLOG_CAP };
+	struct mlog_props           props;
+	merr_t                      err = 0;
+	int                         i;
+
+	for (i = 0; i < mlc; ++i) {
+		err = mlog_alloc(mp, &cap, thr->bt_bench->bc_parms->bn_mclassp, &props,
+				 &thr->bt_mlh[i]);
+		if (err)
+			break;
+
+		err = mlog_commit(mp, thr->bt_mlh[i]);
+		if (err) {
+			mpc_bench_mlh_discard(mp, thr->bt_mlh[i], false);
+			break;
+		}
+
+		objidv[i] = props.lpr_objid;
+	}
+
+	if (err) {
+		while (i-- > 0)
+			mpc_bench_mlh_discard(mp, thr->bt_mlh[i], true);
+	}
+
+	return err;
+}
+
+static merr_t mpc_bench_mlog_setup_flags(struct mpc_bench_thr *thr, u8 flags)
+{
+	struct mpool_descriptor    *mp = thr->bt_bench->bc_mp;
+	merr_t                      err;
+	u64                         objid, gen;
+
+	err = mpc_bench_mlog_create(thr, 1, &objid);
+	if (err)
+		return err;
+
+	err = mlog_open(mp, thr->bt_mlh[0], flags, &gen);
+	if (err)
+		mpc_bench_mlh_discard(mp, thr->bt_mlh[0], true);
+
+	return err;
+}
+
+static merr_t mpc_bench_mlog_setup(struct mpc_bench_thr *thr)
+{
+	return mpc_bench_mlog_setup_flags(thr, 0);
+}
+
+static merr_t mpc_bench_mlog_op(struct mpc_bench_thr *thr, u64 i, u64 *t0)
+{
+	struct mpool_descriptor    *mp = thr->bt_bench->bc_mp;
+	u32                         flags = thr->bt_bench->bc_parms->bn_flags;
+	struct kvec                 rec;
+	merr_t                      err;
+	int                         sync;
+
+	sync = MLOG_APPEND_NOSYNC;
+	if (flags & MPIOC_BENCH_F_SYNC)
+		sync = MLOG_APPEND_SYNC;
+	else if (flags & MPIOC_BENCH_F_ASYNC)
+		sync = MLOG_APPEND_ASYNC;
+
+	rec.iov_base = thr->bt_buf;
+	rec.iov_len = thr->bt_bufsz;
+
+	err = mlog_append_recv(mp, thr->bt_mlh[0], &rec, 1, sync, NULL);
+	if (merr_errno(err) != EFBIG)
+		return err;
+
+	/* Erasing the full mlog is not part of the append latency */
+	err = mlog_erase(mp, thr->bt_mlh[0], 0);
+	if (err)
+		return err;
+
+	*t0 = ktime_get_ns();
+
+	return mlog_append_recv(mp, thr->bt_mlh[0], &rec, 1, sync, NULL);
+}
+
+static void mpc_bench_mlog_teardown(struct mpc_bench_thr *thr)
+{
+	struct mpool_descriptor *mp = thr->bt_bench->bc_mp;
+
+	mlog_close(mp, thr->bt_mlh[0]);
+	mpc_bench_mlh_discard(mp, thr->bt_mlh[0], true);
+}
+
+/* Open an mlog with the given flags and fill half of it with bn_iosz records */
+static merr_t mpc_bench_mlog_fill(struct mpc_bench_thr *thr, u8 flags)
+{
+	struct mpool_descriptor    *mp = thr->bt_bench->bc_mp;
+	struct kvec                 rec;
+	merr_t                      err;
+	u64                         len;
+
+	err = mpc_bench_mlog_setup_flags(thr, flags);
+	if (err)
+		return err;
+
+	rec.iov_base = thr->bt_buf;
+	rec.iov_len = thr->bt_bufsz;
+	thr->bt_mlrecs = 0;
+
+	for (len = 0; len < MPC_BENCH_MLOG_CAP / 2 && !err; len += rec.iov_len) {
+		err = mlog_append_recv(mp, thr->bt_mlh[0], &rec, 1, MLOG_APPEND_NOSYNC, NULL);
+		if (!err)
+			thr->bt_mlrecs++;
+		cond_resched();
+	}
+
+	if (merr_errno(err) == EFBIG)
+		err = 0;
+
+	if (!err)
+		err = mlog_flush(mp, thr->bt_mlh[0]);
+
+	if (err)
+		mpc_bench_mlog_teardown(thr);
+
+	return err;
+}
+
+/*
+ * Fill half the mlog with bn_iosz records so that mlog_open() validates
+ * the written half, finds LEOL and then scans the erased sectors past it.
+ */
+static merr_t mpc_bench_mlog_open_setup(struct mpc_bench_thr *thr)
+{
+	return mpc_bench_mlog_fill(thr, 0);
+}
+
+/* Closing the mlog is not part of the open latency */
+static merr_t mpc_bench_mlog_open_op(struct mpc_bench_thr *thr, u64 i, u64 *t0)
+{
+	struct mpool_descriptor    *mp = thr->bt_bench->bc_mp;
+	merr_t                      err;
+	u64                         gen;
+
+	err = mlog_close(mp, thr->bt_mlh[0]);
+	if (err)
+		return err;
+
+	*t0 = ktime_get_ns();
+
+	return mlog_open(mp, thr->bt_mlh[0], 0, &gen);
+}
+
+static merr_t mpc_bench_mlog_seek_setup(struct mpc_bench_thr *thr)
+{
+	merr_t err;
+
+	err = mpc_bench_mlog_fill(thr, MLOG_OF_RECIDX);
+	if (!err && !thr->bt_mlrecs) {
+		mpc_bench_mlog_teardown(thr);
+		err = merr(EINVAL);
+	}
+
+	return err;
+}
+
+/*
+ * Seek to records spread over the whole log by a multiplicative hash of i,
+ * and read the record sought.
+ */
+static merr_t mpc_bench_mlog_seek_op(struct mpc_bench_thr *thr, u64 i, u64 *t0)
+{
+	struct mpool_descriptor    *mp = thr->bt_bench->bc_mp;
+	merr_t                      err;
+	u64                         recno, rdlen;
+
+	div64_u64_rem(i * 2654435761ull, thr->bt_mlrecs, &recno);
+
+	err = mlog_read_data_seek(mp, thr->bt_mlh[0], recno);
+	if (err)
+		return err;
+
+	err = mlog_read_data_next(mp, thr->bt_mlh[0], thr->bt_buf, thr->bt_bufsz, &rdlen);
+	if (err)
+		return err;
+
+	return (rdlen == thr->bt_bufsz) ? 0 : merr(EIO);
+}
+
+static merr_t mpc_bench_mdc_setup(struct mpc_bench_thr *thr)
+{
+	struct mpool_descriptor    *mp = thr->bt_bench->bc_mp;
+	merr_t                      err;
+	u64                         objidv[2];
+
+	err = mpc_bench_mlog_create(thr, 2, objidv);
+	if (err)
+		return err;
+
+	err = mp_mdc_open(mp, objidv[0], objidv[1], 0, &thr->bt_mdc);
+	if (err) {
+		mpc_bench_mlh_discard(mp, thr->bt_mlh[0], true);
+		mpc_bench_mlh_discard(mp, thr->bt_mlh[1], true);
+	}
+
+	return err;
+}
+
+/*
+ * Append the records of one MDC append operation, a single record or, with
+ * MPIOC_BENCH_F_BATCH, MPC_BENCH_MDC_BATCH records of which the first *recp
+ * have already been appended.
+ */
+static merr_t mpc_bench_mdc_append(struct mpc_bench_thr *thr, int *recp)
+{
+	u32         flags = thr->bt_bench->bc_parms->bn_flags;
+	struct kvec recv[MPC_BENCH_MDC_BATCH];
+	merr_t      err;
+	int         sync, appended, i;
+
+	if (!(flags & MPIOC_BENCH_F_BATCH))
+		return mp_mdc_append(thr->bt_mdc, thr->bt_buf, thr->bt_bufsz,
+				     flags & MPIOC_BENCH_F_SYNC);
+
+	sync = MLOG_APPEND_NOSYNC;
+	if (flags & MPIOC_BENCH_F_SYNC)
+		sync = MLOG_APPEND_SYNC;
+	else if (flags & MPIOC_BENCH_F_ASYNC)
+		sync = MLOG_APPEND_ASYNC;
+
+	for (i = 0; i < MPC_BENCH_MDC_BATCH - *recp; ++i) {
+		recv[i].iov_base = thr->bt_buf;
+		recv[i].iov_len = thr->bt_bufsz;
+	}
+
+	err = mp_mdc_appendv(thr->bt_mdc, recv, i, sync, &appended);
+	*recp += appended;
+
+	return err;
+}
+
+/*
+ * Start a background compaction of the MDC, whose compacted image is a
+ * single record.  Appends keep going to the active mlog until
+ * mpc_bench_mdc_cend().
+ */
+static merr_t mpc_bench_mdc_cstart_bg(struct mpc_bench_thr *thr)
+{
+	bool    sync = thr->bt_bench->bc_parms->bn_flags & MPIOC_BENCH_F_SYNC;
+	merr_t  err;
+
+	err = mp_mdc_cstart_bg(thr->bt_mdc);
+	if (err)
+		return err;
+
+	err = mp_mdc_append_compact(thr->bt_mdc, thr->bt_buf, thr->bt_bufsz, sync);
+	if (err) {
+		mp_mdc_close(thr->bt_mdc);
+		thr->bt_mdc = NULL;
+		return err;
+	}
+
+	thr->bt_cbgops = 1;
+
+	return 0;
+}
+
+/* mp_mdc_cend() closes the MDC on failure */
+static merr_t mpc_bench_mdc_cend(struct mpc_bench_thr *thr)
+{
+	merr_t err;
+
+	thr->bt_cbgops = 0;
+
+	err = mp_mdc_cend(thr->bt_mdc);
+	if (err)
+		thr->bt_mdc = NULL;
+
+	return err;
+}
+
+/*
+ * With MPIOC_BENCH_F_BGCOMPACT, a background compaction is started by the
+ * first append after the previous one ended, and is ended after
+ * MPC_BENCH_MDC_CBG_OPS appends, or early if the active mlog or the replay
+ * buffer fills up.  Starting and ending it is included in the latency of
+ * the append which triggered it, as in the foreground case.
+ */
+static merr_t mpc_bench_mdc_bg_op(struct mpc_bench_thr *thr)
+{
+	merr_t  err;
+	int     rec = 0;
+
+	if (!thr->bt_cbgops) {
+		err = mpc_bench_mdc_cstart_bg(thr);
+		if (err)
+			return err;
+	}
+
+	err = mpc_bench_mdc_append(thr, &rec);
+	if (merr_errno(err) == EFBIG || merr_errno(err) == EAGAIN) {
+		err = mpc_bench_mdc_cend(thr);
+		if (err)
+			return err;
+
+		return mpc_bench_mdc_append(thr, &rec);
+	}
+
+	if (!err && ++thr->bt_cbgops > MPC_BENCH_MDC_CBG_OPS)
+		err = mpc_bench_mdc_cend(thr);
+
+	return err;
+}
+
+/*
+ * A full MDC is compacted into its other mlog with the records which did
+ * not fit as its only content, the compaction is included in the latency of
+ * the append which triggered it in order to reflect the amortized cost of
+ * an append.
+ */
+static merr_t mpc_bench_mdc_op(struct mpc_bench_thr *thr, u64 i, u64 *t0)
+{
+	merr_t  err, err2;
+	int     rec = 0;
+
+	if (!thr->bt_mdc)
+		return merr(EBADF);
+
+	if (thr->bt_bench->bc_parms->bn_flags & MPIOC_BENCH_F_BGCOMPACT)
+		return mpc_bench_mdc_bg_op(thr);
+
+	err = mpc_bench_mdc_append(thr, &rec);
+	if (merr_errno(err) != EFBIG)
+		return err;
+
+	/* mp_mdc_cstart() and mp_mdc_cend() close the MDC on failure */
+	err = mp_mdc_cstart(thr->bt_mdc);
+	if (err) {
+		thr->bt_mdc = NULL;
+		return err;
+	}
+
+	err = mpc_bench_mdc_append(thr, &rec);
+
+	err2 = mp_mdc_cend(thr->bt_mdc);
+	if (err2)
+		thr->bt_mdc = NULL;
+
+	return err ?: err2;
+}
+
+static void mpc_bench_mdc_teardown(struct mpc_bench_thr *thr)
+{
+	struct mpool_descriptor *mp = thr->bt_bench->bc_mp;
+
+	if (thr->bt_mdc)
+		mp_mdc_close(thr->bt_mdc);
+
+	mpc_bench_mlh_discard(mp, thr->bt_mlh[0], true);
+	mpc_bench_mlh_discard(mp, thr->bt_mlh[1], true);
+}
+
+/*
+ * smap_alloc() is called directly, bypassing pmd_layout_provision(), so
+ * the space map must be complete before the first allocation.
+ */
+static merr_t mpc_bench_smap_setup(struct mpc_bench_thr *thr)
+{
+	struct mpool_descriptor    *mp = thr->bt_bench->bc_mp;
+	merr_t                      err;
+	s8                          pdh;
+
+	err = pmd_mdc_load_all(mp);
+	if (ev(err))
+		return err;
+
+	pdh = mp->pds_mc[thr->bt_bench->bc_parms->bn_mclassp].mc_pdmc;
+	if (pdh < 0)
+		return merr(ENOENT);
+
+	thr->bt_pdh = pdh;
+
+	return 0;
+}
+
+static merr_t mpc_bench_smap_op(struct mpc_bench_thr *thr, u64 i, u64 *t0)
+{
+	struct mpool_descriptor    *mp = thr->bt_bench->bc_mp;
+	merr_t                      err;
+	u64                         zaddr;
+
+	err = smap_alloc(mp, thr->bt_pdh, 1, SMAP_SPC_USABLE_ONLY, &zaddr, 1);
+	if (err)
+		return err;
+
+	return smap_free(mp, thr->bt_pdh, zaddr, 1);
+}
+
+static merr_t mpc_bench_lookup_setup(struct mpc_bench_thr *thr)
+{
+	struct mpool_descriptor    *mp = thr->bt_bench->bc_mp;
+	struct mblock_props         props;
+	merr_t                      err = 0;
+	int                         i;
+
+	for (i = 0; i < MPC_BENCH_LOOKUP_OBJS; ++i) {
+		err = mblock_alloc(mp, thr->bt_bench->bc_parms->bn_mclassp, false,
+				   &thr->bt_mbhv[i], &props);
+		if (err)
+			break;
+
+		err = mblock_commit(mp, thr->bt_mbhv[i]);
+		if (err) {
+			mpc_bench_mbh_discard(mp, thr->bt_mbhv[i], false);
+			break;
+		}
+
+		thr->bt_objidv[i] = props.mpr_objid;
+	}
+
+	if (err) {
+		while (i-- > 0)
+			mpc_bench_mbh_discard(mp, thr->bt_mbhv[i], true);
+	}
+
+	return err;
+}
+
+static merr_t mpc_bench_lookup_op(struct mpc_bench_thr *thr, u64 i, u64 *t0)
+{
+	struct mpool_descriptor    *mp = thr->bt_bench->bc_mp;
+	struct pmd_layout          *layout;
+
+	layout = pmd_obj_find_get(mp, thr->bt_objidv[i % MPC_BENCH_LOOKUP_OBJS], 1);
+	if (!layout)
+		return merr(ENOENT);
+
+	pmd_obj_put(mp, layout);
+
+	return 0;
+}
+
+static void mpc_bench_lookup_teardown(struct mpc_bench_thr *thr)
+{
+	int i;
+
+	for (i = 0; i < MPC_BENCH_LOOKUP_OBJS; ++i)
+		mpc_bench_mbh_discard(thr->bt_bench->bc_mp, thr->bt_mbhv[i], true);
+}
+
+static const struct mpc_bench_wl mpc_bench_wlv[] = {
+	[MPIOC_BENCH_MB_ALLOC] = {
+		.bw_op       = mpc_bench_mb_alloc_op,
+	},
+	[MPIOC_BENCH_MB_WRITE] = {
+		.bw_op       = mpc_bench_mb_write_op,
+		.bw_buf      = true,
+		.bw_pgalign  = true,
+	},
+	[MPIOC_BENCH_MB_READ] = {
+		.bw_setup    = mpc_bench_mb_read_setup,
+		.bw_op       = mpc_bench_mb_read_op,
+		.bw_teardown = mpc_bench_mb_read_teardown,
+		.bw_buf      = true,
+		.bw_pgalign  = true,
+	},
+	[MPIOC_BENCH_MLOG_APPEND] = {
+		.bw_setup    = mpc_bench_mlog_setup,
+		.bw_op       = mpc_bench_mlog_op,
+		.bw_teardown = mpc_bench_mlog_teardown,
+		.bw_buf      = true,
+	},
+	[MPIOC_BENCH_MDC_APPEND] = {
+		.bw_setup    = mpc_bench_mdc_setup,
+		.bw_op       = mpc_bench_mdc_op,
+		.bw_teardown = mpc_bench_mdc_teardown,
+		.bw_buf      = true,
+	},
+	[MPIOC_BENCH_SMAP] = {
+		.bw_setup    = mpc_bench_smap_setup,
+		.bw_op       = mpc_bench_smap_op,
+	},
+	[MPIOC_BENCH_OBJ_LOOKUP] = {
+		.bw_setup    = mpc_bench_lookup_setup,
+		.bw_op       = mpc_bench_lookup_op,
+		.bw_teardown = mpc_bench_lookup_teardown,
+	},
+	[MPIOC_BENCH_MLOG_OPEN] = {
+		.bw_setup    = mpc_bench_mlog_open_setup,
+		.bw_op       = mpc_bench_mlog_open_op,
+		.bw_teardown = mpc_bench_mlog_teardown,
+		.bw_buf      = true,
+	},
+	[MPIOC_BENCH_MLOG_SEEK] = {
+		.bw_setup    = mpc_bench_mlog_seek_setup,
+		.bw_op       = mpc_bench_mlog_seek_op,
+		.bw_teardown = mpc_bench_mlog_teardown,
+		.bw_buf      = true,
+	},
+};
+
+static void mpc_bench_worker(struct work_struct *work)
+{
+	const struct mpc_bench_wl  *wl;
+	struct mpc_bench_thr       *thr;
+	struct mpc_bench           *bench;
+	u64                         i, ops, t0, lat;
+	merr_t                      err;
+
+	thr = container_of(work, struct mpc_bench_thr, bt_work);
+	bench = thr->bt_bench;
+	wl = bench->bc_wl;
+	ops = bench->bc_parms->bn_ops;
+
+	thr->bt_latmin = U64_MAX;
+
+	if (wl->bw_buf) {
+		thr->bt_buf = alloc_pages_exact(thr->bt_bufsz, GFP_KERNEL);
+		if (thr->bt_buf)
+			memset(thr->bt_buf, 0xa5, thr->bt_bufsz);
+		else
+			thr->bt_err = merr(ENOMEM);
+	}
+
+	if (!thr->bt_err && wl->bw_setup)
+		thr->bt_err = wl->bw_setup(thr);
+
+	if (atomic_dec_and_test(&bench->bc_setup))
+		wake_up_all(&bench->bc_wait);
+
+	wait_event(bench->bc_wait, atomic_read(&bench->bc_go));
+
+	if (thr->bt_err)
+		goto out;
+
+	for (i = 0; i < ops && !atomic_read(&bench->bc_stop); ++i) {
+		t0 = ktime_get_ns();
+
+		err = wl->bw_op(thr, i, &t0);
+		if (err) {
+			++thr->bt_errors;
+			cond_resched();
+			continue;
+		}
+
+		lat = ktime_get_ns() - t0;
+
+		++thr->bt_done;
+		++thr->bt_histv[mpc_bench_bkt(lat)];
+		thr->bt_latsum += lat;
+		thr->bt_latmin = min(thr->bt_latmin, lat);
+		thr->bt_latmax = max(thr->bt_latmax, lat);
+
+		cond_resched();
+	}
+
+	thr->bt_end = ktime_get_ns();
+
+	if (wl->bw_teardown)
+		wl->bw_teardown(thr);
+
+out:
+	if (thr->bt_buf)
+		free_pages_exact(thr->bt_buf, thr->bt_bufsz);
+
+	if (atomic_dec_and_test(&bench->bc_active))
+		wake_up_all(&bench->bc_wait);
+}
+
+/* Merge the per-worker results into bn */
+static merr_t mpc_bench_merge(struct mpc_bench_thr *thrv, u32 thrc, u64 start,
+			      struct mpioc_bench *bn)
+{
+	u64    *histv, end, total, cum, latsum;
+	uint    b, p;
+	u32     i;
+
+	histv = kcalloc(MPC_BENCH_HBKT, sizeof(*histv), GFP_KERNEL);
+	if (!histv)
+		return merr(ENOMEM);
+
+	bn->bn_done = bn->bn_errors = 0;
+	bn->bn_lat_min = U64_MAX;
+	bn->bn_lat_max = 0;
+	latsum = 0;
+	end = start;
+
+	for (i = 0; i < thrc; ++i) {
+		struct mpc_bench_thr *thr = thrv + i;
+
+		bn->bn_done += thr->bt_done;
+		bn->bn_errors += thr->bt_errors;
+		latsum += thr->bt_latsum;
+		bn->bn_lat_min = min(bn->bn_lat_min, thr->bt_latmin);
+		bn->bn_lat_max = max(bn->bn_lat_max, thr->bt_latmax);
+		end = max(end, thr->bt_end);
+
+		for (b = 0; b < MPC_BENCH_HBKT; ++b)
+			histv[b] += thr->bt_histv[b];
+	}
+
+	bn->bn_usecs = div64_u64(end - start, NSEC_PER_USEC);
+	memset(bn->bn_lat_pct, 0, sizeof(bn->bn_lat_pct));
+
+	total = bn->bn_done;
+	if (total == 0) {
+		bn->bn_lat_min = bn->bn_lat_avg = 0;
+		kfree(histv);
+		return 0;
+	}
+
+	bn->bn_lat_avg = div64_u64(latsum, total);
+
+	cum = 0;
+	b = 0;
+
+	for (p = 0; p < MPIOC_BENCH_PCT_MAX; ++p) {
+		u64 target = div64_u64(total * mpc_bench_pctv[p] + 999, 1000);
+
+		while (b < MPC_BENCH_HBKT && cum + histv[b] < target)
+			cum += histv[b++];
+
+		bn->bn_lat_pct[p] = min(mpc_bench_bkt2ns(b), bn->bn_lat_max);
+	}
+
+	kfree(histv);
+
+	return 0;
+}
+
+merr_t mpc_bench_run(struct mpool_descriptor *mp, struct mpioc_bench *bn)
+{
+	const struct mpc_bench_wl  *wl;
+	struct workqueue_struct    *wq;
+	struct mpc_bench_thr       *thrv;
+	struct mpc_bench            bench;
+	merr_t                      err = 0;
+	u64                         start;
+	u32                         i;
+
+	if (!mp || !bn)
+		return merr(EINVAL);
+
+	if (bn->bn_workload >= ARRAY_SIZE(mpc_bench_wlv) || !mpc_bench_wlv[bn->bn_workload].bw_op)
+		return merr(EINVAL);
+
+	wl = &mpc_bench_wlv[bn->bn_workload];
+
+	if (bn->bn_iosz == 0)
+		bn->bn_iosz = PAGE_SIZE;
+
+	if (ev(bn->bn_threads == 0 || bn->bn_threads > MPC_BENCH_THREADS_MAX ||
+	       bn->bn_ops == 0 || bn->bn_iosz > MPC_BENCH_IOSZ_MAX ||
+	       bn->bn_mclassp >= MP_MED_NUMBER))
+		return merr(EINVAL);
+
+	if (ev(wl->bw_pgalign && !PAGE_ALIGNED(bn->bn_iosz)))
+		return merr(EINVAL);
+
+	if (ev((bn->bn_flags & MPIOC_BENCH_F_SYNC) && (bn->bn_flags & MPIOC_BENCH_F_ASYNC)))
+		return merr(EINVAL);
+
+	thrv = kvcalloc(bn->bn_threads, sizeof(*thrv), GFP_KERNEL);
+	if (!thrv)
+		return merr(ENOMEM);
+
+	wq = alloc_workqueue("mpc_bench", WQ_UNBOUND, bn->bn_threads);
+	if (!wq) {
+		kvfree(thrv);
+		return merr(ENOMEM);
+	}
+
+	bench.bc_mp = mp;
+	bench.bc_parms = bn;
+	bench.bc_wl = wl;
+	atomic_set(&bench.bc_setup, bn->bn_threads);
+	atomic_set(&bench.bc_active, bn->bn_threads);
+	atomic_set(&bench.bc_go, 0);
+	atomic_set(&bench.bc_stop, 0);
+	init_waitqueue_head(&bench.bc_wait);
+
+	for (i = 0; i < bn->bn_threads; ++i) {
+		struct mpc_bench_thr *thr = thrv + i;
+
+		INIT_WORK(&thr->bt_work, mpc_bench_worker);
+		thr->bt_bench = &bench;
+		thr->bt_bufsz = bn->bn_iosz;
+
+		queue_work(wq, &thr->bt_work);
+	}
+
+	/* Setup is bounded, start the measured phase only once all workers are ready */
+	wait_event(bench.bc_wait, atomic_read(&bench.bc_setup) == 0);
+
+	for (i = 0; i < bn->bn_threads && !err; ++i)
+		err = thrv[i].bt_err;
+
+	if (err)
+		atomic_set(&bench.bc_stop, 1);
+
+	start = ktime_get_ns();
+	atomic_set(&bench.bc_go, 1);
+	wake_up_all(&bench.bc_wait);
+
+	if (wait_event_interruptible(bench.bc_wait, atomic_read(&bench.bc_active) == 0))
+		atomic_set(&bench.bc_stop, 1);
+
+	destroy_workqueue(wq);
+
+	if (err)
+		mp_pr_err("mpool %s, benchmark %u setup failed", err, mp->pds_name, bn->bn_workload);
+	else
+		err = mpc_bench_merge(thrv, bn->bn_threads, start, bn);
+
+	kvfree(thrv);
+
+	return err;
+}
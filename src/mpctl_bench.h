@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_MPCTL_BENCH_H
+#define MPOOL_MPCTL_BENCH_H
+
+struct mpool_descriptor;
+struct mpioc_bench;
+
+/**
+ * mpc_bench_run() - Run an in-kernel benchmark against an mpool
+ * @mp: mpool descriptor
+ * @bn: benchmark parameters, receives the results
+ *
+ * Each of bn->bn_threads workers sets up its private objects, then all
+ * workers start the measured phase together.  A signal stops the run early.
+ *
+ * Return: EINVAL if the parameters are invalid, the first setup error
+ * otherwise.  Errors during the measured phase are counted, not returned.
+ */
+merr_t mpc_bench_run(struct mpool_descriptor *mp, struct mpioc_bench *bn);
+
+#endif /* MPOOL_MPCTL_BENCH_H */
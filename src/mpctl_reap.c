@@ -19,6 +19,19 @@
  * not to evict all the pages in the subrange based upon the current TTL,
  * where the current TTL grows shorter as the urgency to evict pages grows
  * stronger.
+ *
+ * Each mblock is further divided into BITS_PER_LONG equally sized ranges,
+ * each with a reference bit which is set on each page fault to any page in
+ * the range.  Once the whole cold mblocks of a VMA have been evicted, the
+ * reaper ages the remaining mblocks (at most once per TTL) and evicts only
+ * those ranges which have not been referenced since they were last aged.
+ * This keeps the hot ranges of a large, partially hot mblock resident.
+ *
+ * Each mpool unit has a page cache budget (see struct mpc_budget) which
+ * the reaper reevaluates on each prune cycle.  Pages of a unit within its
+ * soft limit are exempt from eviction due to system memory pressure, while
+ * a unit over its hard limit is reaped with a TTL which shrinks on each
+ * cycle until the unit is back within its hard limit.
  */
 
 #include <linux/kernel.h>
@@ -43,6 +56,7 @@
 #include "mpctl_reap.h"
 
 #define REAP_ELEM_MAX       3
+#define REAP_TTL_MIN        100
 
 /**
  * struct mpc_reap_elem -
@@ -76,6 +90,7 @@ struct mpc_reap_elem {
  * struct mpc_reap -
  * @reap_lwm:     Low water mark
  * @reap_ttl_cur: Current time-to-live
+ * @reap_hard:    Number of budgets over their hard limit
  * @reap_wq:
  *
  * @reap_hdr:     sysctl table header
@@ -87,11 +102,14 @@ struct mpc_reap_elem {
  * @reap_eidx:    Pruner element index
  * @reap_emit:    Pruner debug message control
  * @reap_dwork:
+ * @reap_budget_lock: Protects reap_budgetl
+ * @reap_budgetl: List of unit budgets
  * @reap_elem:    Array of reaper lists (reaper pool)
  */
 struct mpc_reap {
 	atomic_t                    reap_lwm;
 	atomic_t                    reap_ttl_cur;
+	atomic_t                    reap_hard;
 	struct workqueue_struct    *reap_wq;
 
 	____cacheline_aligned
@@ -103,6 +121,8 @@ struct mpc_reap {
 	atomic_t                    reap_eidx;
 	atomic_t                    reap_emit;
 	struct delayed_work         reap_dwork;
+	spinlock_t                  reap_budget_lock;
+	struct list_head            reap_budgetl;
 
 	struct mpc_reap_elem        reap_elem[REAP_ELEM_MAX];
 };
@@ -134,10 +154,89 @@ static void mpc_reap_meminfo(ulong *freep, ulong *availp, uint shift)
 		*availp = (si_mem_available() * si.mem_unit) >> shift;
 }
 
+/**
+ * mpc_reap_xvm_ttl() - Get the current TTL (in nsecs) of the given XVM
+ * @xvm:
+ *
+ * Return: U64_MAX if no pages of the XVM should be evicted.
+ */
+static u64 mpc_reap_xvm_ttl(struct mpc_xvm *xvm)
+{
+	struct mpc_budget  *bg = xvm->xvm_budget;
+	struct mpc_reap    *reap = xvm->xvm_reap;
+	ulong               pages, limit;
+	u64                 ttl = U64_MAX;
+
+	pages = atomic64_read(&bg->bg_pages);
+
+	limit = READ_ONCE(bg->bg_soft);
+	if (atomic_read(&reap->reap_lwm) && (!limit || pages > limit))
+		ttl = atomic_read(&reap->reap_ttl_cur) * 1000ul;
+
+	limit = READ_ONCE(bg->bg_hard);
+	if (limit && pages > limit)
+		ttl = min_t(u64, ttl, atomic_read(&bg->bg_ttl) * 1000ul);
+
+	return ttl;
+}
+
+/**
+ * mpc_reap_evict_ranges() - Evict unreferenced ranges of the given XVM
+ * @xvm:
+ *
+ * Clears the reference bits of each range as it goes, such that a range
+ * must be touched again within the next TTL to survive the next pass.
+ */
+static void mpc_reap_evict_ranges(struct mpc_xvm *xvm)
+{
+	struct address_space   *mapping = xvm->xvm_mapping;
+
+	pgoff_t off, bktsz, len, rngsz, rng;
+	u64     ttl, now;
+	int     i;
+
+	ttl = mpc_reap_xvm_ttl(xvm);
+	now = local_clock();
+
+	if (ttl == U64_MAX || xvm->xvm_agetime + ttl * xvm->xvm_mbinfov[0].mbmult > now)
+		return;
+
+	xvm->xvm_agetime = now;
+
+	bktsz = xvm->xvm_bktsz >> PAGE_SHIFT;
+	rngsz = 1ul << xvm->xvm_rngshift;
+	off = mpc_xvm_pgoff(xvm);
+
+	for (i = 0; i < xvm->xvm_mbinfoc; ++i, off += bktsz) {
+		struct mpc_mbinfo  *mbinfo = xvm->xvm_mbinfov + i;
+		unsigned long       refs;
+
+		/* Skip mblocks evicted in whole and not touched since. */
+		if (atomic64_read(&mbinfo->mbatime) == U64_MAX)
+			continue;
+
+		refs = xchg(&mbinfo->mbrefs, 0);
+		len = mbinfo->mblen >> PAGE_SHIFT;
+
+		for (rng = 0; rng * rngsz < len; ++rng) {
+			if (test_bit(rng, &refs))
+				continue;
+
+			invalidate_inode_pages2_range(mapping, off + rng * rngsz,
+						      off + min(rng * rngsz + rngsz, len) - 1);
+		}
+
+		if (atomic64_read(&xvm->xvm_nrpages) < 32 || mpc_reap_xvm_ttl(xvm) == U64_MAX)
+			break;
+
+		if (need_resched())
+			cond_resched();
+	}
+}
+
 static void mpc_reap_evict_vma(struct mpc_xvm *xvm)
 {
 	struct address_space   *mapping = xvm->xvm_mapping;
-	struct mpc_reap        *reap = xvm->xvm_reap;
 
 	pgoff_t off, bktsz, len;
 	u64     ttl, xtime, now;
@@ -146,12 +245,15 @@ static void mpc_reap_evict_vma(struct mpc_xvm *xvm)
 	bktsz = xvm->xvm_bktsz >> PAGE_SHIFT;
 	off = mpc_xvm_pgoff(xvm);
 
-	ttl = atomic_read(&reap->reap_ttl_cur) * 1000ul;
+	ttl = mpc_reap_xvm_ttl(xvm);
 	now = local_clock();
 
 	for (i = 0; i < xvm->xvm_mbinfoc; ++i, off += bktsz) {
 		struct mpc_mbinfo *mbinfo = xvm->xvm_mbinfov + i;
 
+		if (ttl == U64_MAX)
+			return;
+
 		xtime = now - (ttl * mbinfo->mbmult);
 		len = mbinfo->mblen >> PAGE_SHIFT;
 
@@ -159,18 +261,21 @@ static void mpc_reap_evict_vma(struct mpc_xvm *xvm)
 			continue;
 
 		atomic64_set(&mbinfo->mbatime, U64_MAX);
+		mbinfo->mbrefs = 0;
 
 		invalidate_inode_pages2_range(mapping, off, off + len);
 
 		if (atomic64_read(&xvm->xvm_nrpages) < 32)
-			break;
+			return;
 
 		if (need_resched())
 			cond_resched();
 
-		ttl = atomic_read(&reap->reap_ttl_cur) * 1000ul;
+		ttl = mpc_reap_xvm_ttl(xvm);
 		now = local_clock();
 	}
+
+	mpc_reap_evict_ranges(xvm);
 }
 
 /**
@@ -182,8 +287,7 @@ static void mpc_reap_evict(struct list_head *process)
 	struct mpc_xvm *xvm, *next;
 
 	list_for_each_entry_safe(xvm, next, process, xvm_list) {
-		if (atomic_read(&xvm->xvm_reap->reap_lwm))
-			mpc_reap_evict_vma(xvm);
+		mpc_reap_evict_vma(xvm);
 
 		atomic_cmpxchg(&xvm->xvm_evicting, 1, 0);
 	}
@@ -215,6 +319,9 @@ static void mpc_reap_scan(struct mpc_reap_elem *elem)
 		if (atomic_read(&xvm->xvm_reapref) == 1)
 			continue;
 
+		if (mpc_reap_xvm_ttl(xvm) == U64_MAX)
+			continue;
+
 		if (atomic_cmpxchg(&xvm->xvm_evicting, 0, 1))
 			continue;
 
@@ -243,7 +350,7 @@ static void mpc_reap_run(struct work_struct *work)
 	elem = container_of(work, struct mpc_reap_elem, reap_work);
 	reap = elem->reap_reap;
 
-	while (atomic_read(&reap->reap_lwm))
+	while (atomic_read(&reap->reap_lwm) || atomic_read(&reap->reap_hard))
 		mpc_reap_scan(elem);
 
 	atomic_cmpxchg(&elem->reap_running, 1, 0);
@@ -325,6 +432,37 @@ static void mpc_reap_tune(struct mpc_reap *reap)
 		atomic_read(&reap->reap_lwm), atomic_read(&reap->reap_ttl_cur) / 1000);
 }
 
+/**
+ * mpc_reap_budget_tune() - Dynamic tuning of per-unit budget TTLs
+ * @reap:
+ *
+ * Halves the TTL of each budget which remains over its hard limit until
+ * either it comes back under its limit or the TTL reaches REAP_TTL_MIN.
+ */
+static void mpc_reap_budget_tune(struct mpc_reap *reap)
+{
+	struct mpc_budget  *bg;
+	uint                nhard = 0;
+	uint                ttl;
+
+	spin_lock(&reap->reap_budget_lock);
+	list_for_each_entry(bg, &reap->reap_budgetl, bg_list) {
+		ulong limit = READ_ONCE(bg->bg_hard);
+
+		if (!limit || atomic64_read(&bg->bg_pages) <= limit) {
+			atomic_set(&bg->bg_ttl, reap->reap_ttl);
+			continue;
+		}
+
+		ttl = max_t(uint, atomic_read(&bg->bg_ttl) / 2, REAP_TTL_MIN);
+		atomic_set(&bg->bg_ttl, ttl);
+		++nhard;
+	}
+	spin_unlock(&reap->reap_budget_lock);
+
+	atomic_set(&reap->reap_hard, nhard);
+}
+
 static void mpc_reap_prune(struct work_struct *work)
 {
 	struct mpc_xvm         *xvm, *next;
@@ -343,8 +481,9 @@ static void mpc_reap_prune(struct work_struct *work)
 	 * reaper to evict some pages.
 	 */
 	mpc_reap_tune(reap);
+	mpc_reap_budget_tune(reap);
 
-	if (atomic_read(&reap->reap_lwm)) {
+	if (atomic_read(&reap->reap_lwm) || atomic_read(&reap->reap_hard)) {
 		eidx = atomic_read(&reap->reap_eidx) % REAP_ELEM_MAX;
 		elem = reap->reap_elem + eidx;
 
@@ -390,7 +529,6 @@ static void mpc_reap_prune(struct work_struct *work)
 
 #define REAP_MEMPCT_MIN    5
 #define REAP_MEMPCT_MAX    100
-#define REAP_TTL_MIN       100
 #define REAP_DEBUG_MAX     3
 
 static ssize_t mpc_reap_mempct_show(struct device *dev, struct device_attribute *da, char *buf)
@@ -514,8 +652,11 @@ merr_t mpc_reap_create(struct mpc_reap **reapp)
 
 	atomic_set(&reap->reap_lwm, 0);
 	atomic_set(&reap->reap_ttl_cur, 0);
+	atomic_set(&reap->reap_hard, 0);
 	atomic_set(&reap->reap_eidx, 0);
 	atomic_set(&reap->reap_emit, 0);
+	spin_lock_init(&reap->reap_budget_lock);
+	INIT_LIST_HEAD(&reap->reap_budgetl);
 
 	for (i = 0; i < REAP_ELEM_MAX; ++i) {
 		elem = &reap->reap_elem[i];
@@ -560,8 +701,11 @@ void mpc_reap_destroy(struct mpc_reap *reap)
 	 * but perform a flush/wait for good measure...
 	 */
 	atomic_set(&reap->reap_lwm, 0);
+	atomic_set(&reap->reap_hard, 0);
 	flush_workqueue(reap->reap_wq);
 
+	assert(list_empty(&reap->reap_budgetl));
+
 	for (i = 0; i < REAP_ELEM_MAX; ++i) {
 		elem = &reap->reap_elem[i];
 
@@ -578,6 +722,28 @@ void mpc_reap_destroy(struct mpc_reap *reap)
 	kfree(reap);
 }
 
+void mpc_reap_budget_add(struct mpc_reap *reap, struct mpc_budget *bg)
+{
+	if (!reap || !bg)
+		return;
+
+	atomic_set(&bg->bg_ttl, reap->reap_ttl);
+
+	spin_lock(&reap->reap_budget_lock);
+	list_add_tail(&bg->bg_list, &reap->reap_budgetl);
+	spin_unlock(&reap->reap_budget_lock);
+}
+
+void mpc_reap_budget_remove(struct mpc_reap *reap, struct mpc_budget *bg)
+{
+	if (!reap || !bg)
+		return;
+
+	spin_lock(&reap->reap_budget_lock);
+	list_del_init(&bg->bg_list);
+	spin_unlock(&reap->reap_budget_lock);
+}
+
 void mpc_reap_xvm_add(struct mpc_reap *reap, struct mpc_xvm *xvm)
 {
 	struct mpc_reap_elem   *elem;
@@ -596,6 +762,11 @@ void mpc_reap_xvm_add(struct mpc_reap *reap, struct mpc_xvm *xvm)
 	else if (xvm->xvm_advice == MPC_VMA_HOT)
 		mult = 30;
 
+	/* Size the ranges such that each mblock has one reference bit per range. */
+	xvm->xvm_rngshift = ilog2(xvm->xvm_bktsz >> PAGE_SHIFT);
+	xvm->xvm_rngshift -= min_t(uint, xvm->xvm_rngshift, ilog2(BITS_PER_LONG));
+	xvm->xvm_agetime = local_clock();
+
 	/* Acquire a reference on xvm for the reaper... */
 	atomic_inc(&xvm->xvm_reapref);
 	xvm->xvm_reap = reap;
@@ -643,9 +814,11 @@ void mpc_reap_xvm_touch(struct mpc_xvm *xvm, int index)
 {
 	struct mpc_reap    *reap;
 	atomic64_t         *atimep;
+	unsigned long      *refsp;
 	pgoff_t             offset;
 	ulong               delay;
 	uint                mbnum;
+	uint                rng;
 	uint                lwm;
 	u64                 now;
 
@@ -667,6 +840,13 @@ void mpc_reap_xvm_touch(struct mpc_xvm *xvm, int index)
 	if (atomic64_read(atimep) + (10 * USEC_PER_SEC) < now)
 		atomic64_set(atimep, now);
 
+	/* Avoid dirtying the cacheline when the range is already referenced. */
+	rng = (offset % xvm->xvm_bktsz) >> (PAGE_SHIFT + xvm->xvm_rngshift);
+	refsp = &xvm->xvm_mbinfov[mbnum].mbrefs;
+
+	if (!test_bit(rng, refsp))
+		set_bit(rng, refsp);
+
 	/* Sleep a bit if the reaper is having trouble meeting the free memory target. */
 	lwm = atomic_read(&reap->reap_lwm);
 	if (lwm < 3333)
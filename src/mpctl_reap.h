@@ -10,6 +10,7 @@
 
 struct mpc_reap;
 struct mpc_xvm;
+struct mpc_budget;
 
 /**
  * mpc_reap_create() - Allocate and initialize reap data strctures
@@ -25,6 +26,20 @@ merr_t mpc_reap_create(struct mpc_reap **reapp);
  */
 void mpc_reap_destroy(struct mpc_reap *reap);
 
+/**
+ * mpc_reap_budget_add() - Add an mpool unit's page cache budget to the reaper
+ * @reap:
+ * @bg:   budget, must remain valid until removed
+ */
+void mpc_reap_budget_add(struct mpc_reap *reap, struct mpc_budget *bg);
+
+/**
+ * mpc_reap_budget_remove() - Remove a budget added by mpc_reap_budget_add()
+ * @reap:
+ * @bg:
+ */
+void mpc_reap_budget_remove(struct mpc_reap *reap, struct mpc_budget *bg);
+
 /**
  * mpc_reap_xvm_add() - Add an extended VMA to the reap list
  * @xvm: extended VMA
@@ -43,7 +58,8 @@ void mpc_reap_xvm_evict(struct mpc_xvm *xvm);
  * @index:  valid page index within the extended VMA
  *
  * Update the access time stamp of the mblock given by the valid
- * page %index within the VMA.  Might sleep for some number of
+ * page %index within the VMA, and mark the range of the mblock
+ * which contains %index as referenced.  Might sleep for some number of
  * microseconds if the reaper is under duress (i.e., the more
  * urgent the duress the longer the sleep).
  *
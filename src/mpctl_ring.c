@@ -0,0 +1,569 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Submission/completion rings for the mpool character device.
+ *
+ * A ring is a single vmalloc'ed region shared with user space which holds
+ * a header, an array of submission queue entries (SQEs), and an array of
+ * completion queue entries (CQEs).  MPIOC_RING_ENTER consumes SQEs, pins
+ * the user buffers they reference, and hands each one off to a worker.
+ * The worker performs the operation and posts a CQE, so that the caller
+ * can keep many operations in flight with a single system call.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/uio.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/log2.h>
+
+#include "mpool_ioctl.h"
+
+#include "mpool.h"
+#include "mpool_printk.h"
+#include "assert.h"
+#include "evc.h"
+#include "mlog.h"
+
+#include "mpctl.h"
+#include "mpctl_ring.h"
+
+/**
+ * struct mpc_ring - submission/completion ring
+ * @rg_mp:       mpool on which ring operations are performed
+ * @rg_hdr:      shared header, start of the shared region
+ * @rg_sqv:      shared SQE array
+ * @rg_cqv:      shared CQE array
+ * @rg_size:     size of the shared region
+ * @rg_sqmask:   SQE array index mask
+ * @rg_cqmask:   CQE array index mask
+ * @rg_sqlock:   serializes SQE consumers
+ * @rg_sqhead:   private copy of rh_sq_head
+ * @rg_cqlock:   serializes CQE producers
+ * @rg_cqtail:   private copy of rh_cq_tail
+ * @rg_inflight: count of consumed SQEs with no CQE posted yet
+ * @rg_wait:     MPIOC_RING_ENTER and mpc_ring_destroy() completion waiters
+ *
+ * The kernel never trusts the shared copies of the indices it owns, and
+ * it re-validates the user owned indices each time it reads them.
+ */
+struct mpc_ring {
+	struct mpool_descriptor    *rg_mp;
+	struct mpc_ring_hdr        *rg_hdr;
+	struct mpc_ring_sqe        *rg_sqv;
+	struct mpc_ring_cqe        *rg_cqv;
+	size_t                      rg_size;
+	u32                         rg_sqmask;
+	u32                         rg_cqmask;
+
+	____cacheline_aligned
+	struct mutex                rg_sqlock;
+	u32                         rg_sqhead;
+
+	____cacheline_aligned
+	spinlock_t                  rg_cqlock;
+	u32                         rg_cqtail;
+	atomic_t                    rg_inflight;
+	wait_queue_head_t           rg_wait;
+};
+
+/**
+ * struct mpc_ring_req - a consumed SQE being processed by a ring worker
+ * @rq_work:    work struct for the ring workqueue
+ * @rq_ring:    ring from which the SQE was consumed
+ * @rq_sqe:     private copy of the SQE
+ * @rq_pagesv:  pinned user pages (read/write ops only)
+ * @rq_iov:     kernel mappings of rq_pagesv[]
+ * @rq_pagesc:  count of pinned pages
+ * @rq_pagesvsz: size of the rq_pagesv/rq_iov allocation
+ */
+struct mpc_ring_req {
+	struct work_struct      rq_work;
+	struct mpc_ring        *rq_ring;
+	struct mpc_ring_sqe     rq_sqe;
+	struct page           **rq_pagesv;
+	struct kvec            *rq_iov;
+	int                     rq_pagesc;
+	size_t                  rq_pagesvsz;
+};
+
+static struct workqueue_struct *mpc_wq_ring __read_mostly;
+
+static unsigned int mpc_ring_workers __read_mostly = 64;
+module_param(mpc_ring_workers, uint, 0444);
+MODULE_PARM_DESC(mpc_ring_workers, " max concurrent ring operations");
+
+/**
+ * mpc_ring_cq_space() - Return the number of SQEs that may be consumed
+ * @ring:
+ *
+ * Never consume an SQE unless there's guaranteed to be room for its CQE.
+ * rg_inflight must be read before rg_cqtail, as a worker increments the
+ * latter before it decrements the former.
+ */
+static u32 mpc_ring_cq_space(struct mpc_ring *ring)
+{
+	u32 inflight, used, cqentries;
+
+	cqentries = ring->rg_cqmask + 1;
+
+	inflight = atomic_read(&ring->rg_inflight);
+	smp_rmb();
+	used = READ_ONCE(ring->rg_cqtail) - READ_ONCE(ring->rg_hdr->rh_cq_head);
+
+	if (used > cqentries || used + inflight >= cqentries)
+		return 0;
+
+	return cqentries - used - inflight;
+}
+
+/**
+ * mpc_ring_cq_ready() - Return the number of unconsumed CQEs
+ * @ring:
+ */
+static u32 mpc_ring_cq_ready(struct mpc_ring *ring)
+{
+	u32 ready;
+
+	ready = READ_ONCE(ring->rg_cqtail) - READ_ONCE(ring->rg_hdr->rh_cq_head);
+
+	return min_t(u32, ready, ring->rg_cqmask + 1);
+}
+
+static void mpc_ring_complete(struct mpc_ring *ring, u64 udata, merr_t err)
+{
+	struct mpc_ring_cqe *cqe;
+
+	spin_lock(&ring->rg_cqlock);
+	cqe = ring->rg_cqv + (ring->rg_cqtail & ring->rg_cqmask);
+	cqe->cqe_udata = udata;
+	cqe->cqe_err = merr_to_user(err, NULL);
+
+	/* Publish the CQE before the new tail. */
+	smp_store_release(&ring->rg_hdr->rh_cq_tail, ring->rg_cqtail + 1);
+	WRITE_ONCE(ring->rg_cqtail, ring->rg_cqtail + 1);
+	spin_unlock(&ring->rg_cqlock);
+
+	smp_mb__before_atomic();
+	atomic_dec(&ring->rg_inflight);
+
+	wake_up_all(&ring->rg_wait);
+}
+
+static merr_t mpc_ring_mblock_op(struct mpool_descriptor *mp, struct mpc_ring_req *req)
+{
+	struct mblock_descriptor   *mbdesc;
+	struct mpc_ring_sqe        *sqe = &req->rq_sqe;
+
+	size_t  len = (size_t)req->rq_pagesc << PAGE_SHIFT;
+	bool    drop = true;
+	int     which;
+	merr_t  err;
+
+	if (!mblock_objid(sqe->sqe_objid))
+		return merr(EINVAL);
+
+	which = (sqe->sqe_op == MPC_RING_OP_MB_READ) ? 1 : -1;
+
+	err = mblock_find_get(mp, sqe->sqe_objid, which, NULL, &mbdesc);
+	if (ev(err))
+		return err;
+
+	switch (sqe->sqe_op) {
+	case MPC_RING_OP_MB_READ:
+		err = mblock_read(mp, mbdesc, req->rq_iov, req->rq_pagesc, sqe->sqe_offset, len);
+		break;
+
+	case MPC_RING_OP_MB_WRITE:
+		err = mblock_write(mp, mbdesc, req->rq_iov, req->rq_pagesc, len);
+		break;
+
+	case MPC_RING_OP_MB_COMMIT:
+		err = mblock_commit(mp, mbdesc);
+		break;
+
+	case MPC_RING_OP_MB_ABORT:
+		err = mblock_abort(mp, mbdesc);
+		drop = !!err;
+		break;
+
+	default:
+		err = merr(EINVAL);
+		break;
+	}
+
+	if (drop)
+		mblock_put(mp, mbdesc);
+
+	return err;
+}
+
+static merr_t mpc_ring_mlog_op(struct mpool_descriptor *mp, struct mpc_ring_req *req)
+{
+	struct mlog_descriptor *mlog;
+	struct mpc_ring_sqe    *sqe = &req->rq_sqe;
+
+	bool    drop = true;
+	int     which;
+	merr_t  err;
+
+	if (!mlog_objid(sqe->sqe_objid))
+		return merr(EINVAL);
+
+	which = (sqe->sqe_op == MPC_RING_OP_MLOG_READ ||
+		 sqe->sqe_op == MPC_RING_OP_MLOG_WRITE) ? 1 : -1;
+
+	err = mlog_find_get(mp, sqe->sqe_objid, which, NULL, &mlog);
+	if (ev(err))
+		return err;
+
+	switch (sqe->sqe_op) {
+	case MPC_RING_OP_MLOG_READ:
+		err = mlog_rw_raw(mp, mlog, req->rq_iov, req->rq_pagesc,
+				  sqe->sqe_offset, MPOOL_OP_READ);
+		break;
+
+	case MPC_RING_OP_MLOG_WRITE:
+		err = mlog_rw_raw(mp, mlog, req->rq_iov, req->rq_pagesc,
+				  sqe->sqe_offset, MPOOL_OP_WRITE);
+		break;
+
+	case MPC_RING_OP_MLOG_COMMIT:
+		err = mlog_commit(mp, mlog);
+		break;
+
+	case MPC_RING_OP_MLOG_ABORT:
+		err = mlog_abort(mp, mlog);
+		drop = !!err;
+		break;
+
+	default:
+		err = merr(EINVAL);
+		break;
+	}
+
+	if (drop)
+		mlog_put(mp, mlog);
+
+	return err;
+}
+
+static void mpc_ring_req_free(struct mpc_ring_req *req)
+{
+	if (req->rq_pagesc > 0)
+		mpc_physio_unpin(req->rq_pagesv, req->rq_pagesc);
+
+	if (req->rq_pagesv)
+		mpc_physio_free(req->rq_pagesv, req->rq_pagesvsz, 0);
+
+	kfree(req);
+}
+
+static void mpc_ring_worker(struct work_struct *work)
+{
+	struct mpc_ring_req    *req = container_of(work, struct mpc_ring_req, rq_work);
+	struct mpc_ring        *ring = req->rq_ring;
+	u64                     udata = req->rq_sqe.sqe_udata;
+	merr_t                  err;
+
+	switch (req->rq_sqe.sqe_op) {
+	case MPC_RING_OP_MB_READ:
+	case MPC_RING_OP_MB_WRITE:
+	case MPC_RING_OP_MB_COMMIT:
+	case MPC_RING_OP_MB_ABORT:
+		err = mpc_ring_mblock_op(ring->rg_mp, req);
+		break;
+
+	case MPC_RING_OP_MLOG_READ:
+	case MPC_RING_OP_MLOG_WRITE:
+	case MPC_RING_OP_MLOG_COMMIT:
+	case MPC_RING_OP_MLOG_ABORT:
+		err = mpc_ring_mlog_op(ring->rg_mp, req);
+		break;
+
+	default:
+		err = 0;
+		break;
+	}
+
+	mpc_ring_req_free(req);
+
+	mpc_ring_complete(ring, udata, err);
+}
+
+static bool mpc_ring_op_isrw(u8 op)
+{
+	switch (op) {
+	case MPC_RING_OP_MB_READ:
+	case MPC_RING_OP_MB_WRITE:
+	case MPC_RING_OP_MLOG_READ:
+	case MPC_RING_OP_MLOG_WRITE:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/**
+ * mpc_ring_submit() - Prepare the given SQE and queue it to a ring worker
+ * @ring:
+ * @sqe:   private copy of the SQE
+ *
+ * Buffers are pinned here in the context of the caller since the
+ * workers do not have access to the caller's address space.  On
+ * failure, the CQE is posted immediately.
+ */
+static void mpc_ring_submit(struct mpc_ring *ring, const struct mpc_ring_sqe *sqe)
+{
+	struct iovec            iovbuf[8];
+	struct iovec           *kiov = iovbuf;
+	struct mpc_ring_req    *req;
+
+	size_t  kiovsz, length;
+	merr_t  err;
+	int     rw;
+
+	if (sqe->sqe_op > MPC_RING_OP_LAST) {
+		err = merr(EINVAL);
+		goto errout;
+	}
+
+	req = kzalloc(sizeof(*req), GFP_KERNEL);
+	if (!req) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	INIT_WORK(&req->rq_work, mpc_ring_worker);
+	req->rq_ring = ring;
+	req->rq_sqe = *sqe;
+
+	if (!mpc_ring_op_isrw(sqe->sqe_op)) {
+		queue_work(mpc_wq_ring, &req->rq_work);
+		return;
+	}
+
+	if (sqe->sqe_iovc < 1 || sqe->sqe_iovc > MPIOC_KIOV_MAX) {
+		err = merr(EINVAL);
+		goto errout_free;
+	}
+
+	kiovsz = sqe->sqe_iovc * sizeof(*kiov);
+
+	if (kiovsz > sizeof(iovbuf)) {
+		kiov = kmalloc(kiovsz, GFP_KERNEL);
+		if (!kiov) {
+			err = merr(ENOMEM);
+			goto errout_free;
+		}
+	}
+
+	if (copy_from_user(kiov, sqe->sqe_iov, kiovsz)) {
+		err = merr(EFAULT);
+		goto errout_free;
+	}
+
+	length = iov_length(kiov, sqe->sqe_iovc);
+
+	if (length < PAGE_SIZE || !IS_ALIGNED(length, PAGE_SIZE) ||
+	    length > (mpc_rwsz_max << 20)) {
+		err = merr(EINVAL);
+		goto errout_free;
+	}
+
+	req->rq_pagesvsz = (sizeof(*req->rq_pagesv) + sizeof(*req->rq_iov)) * (length >> PAGE_SHIFT);
+
+	req->rq_pagesv = mpc_physio_alloc(req->rq_pagesvsz, NULL, 0);
+	if (!req->rq_pagesv) {
+		err = merr(ENOMEM);
+		goto errout_free;
+	}
+
+	req->rq_iov = (struct kvec *)(req->rq_pagesv + (length >> PAGE_SHIFT));
+
+	rw = (sqe->sqe_op == MPC_RING_OP_MB_READ ||
+	      sqe->sqe_op == MPC_RING_OP_MLOG_READ) ? READ : WRITE;
+
+	err = mpc_physio_pin(kiov, sqe->sqe_iovc, length, rw, req->rq_pagesv, req->rq_iov);
+	if (ev(err))
+		goto errout_free;
+
+	req->rq_pagesc = length >> PAGE_SHIFT;
+
+	if (kiov != iovbuf)
+		kfree(kiov);
+
+	queue_work(mpc_wq_ring, &req->rq_work);
+
+	return;
+
+errout_free:
+	if (kiov != iovbuf)
+		kfree(kiov);
+	mpc_ring_req_free(req);
+
+errout:
+	mpc_ring_complete(ring, sqe->sqe_udata, err);
+}
+
+merr_t mpc_ring_enter(struct mpc_ring *ring, u32 *submitp, u32 wait)
+{
+	struct mpc_ring_sqe     sqe;
+
+	u32     head, tail, n, i;
+	int     rc;
+
+	if (ev(!ring || !submitp))
+		return merr(EINVAL);
+
+	mutex_lock(&ring->rg_sqlock);
+	head = ring->rg_sqhead;
+	tail = smp_load_acquire(&ring->rg_hdr->rh_sq_tail);
+
+	if (tail - head > ring->rg_sqmask + 1) {
+		mutex_unlock(&ring->rg_sqlock);
+		*submitp = 0;
+		return merr(EINVAL);
+	}
+
+	n = min_t(u32, tail - head, *submitp);
+
+	for (i = 0; i < n; ++i) {
+		if (mpc_ring_cq_space(ring) == 0)
+			break;
+
+		/* Copy the SQE, user space may scribble on it at any time. */
+		memcpy(&sqe, ring->rg_sqv + (head & ring->rg_sqmask), sizeof(sqe));
+		++head;
+
+		atomic_inc(&ring->rg_inflight);
+
+		mpc_ring_submit(ring, &sqe);
+	}
+
+	ring->rg_sqhead = head;
+	smp_store_release(&ring->rg_hdr->rh_sq_head, head);
+	mutex_unlock(&ring->rg_sqlock);
+
+	*submitp = i;
+
+	if (wait == 0)
+		return 0;
+
+	wait = min_t(u32, wait, ring->rg_cqmask + 1);
+
+	rc = wait_event_interruptible(ring->rg_wait,
+				      mpc_ring_cq_ready(ring) >= wait ||
+				      atomic_read(&ring->rg_inflight) == 0);
+
+	return rc ? merr(EINTR) : 0;
+}
+
+int mpc_ring_mmap(struct mpc_ring *ring, struct vm_area_struct *vma)
+{
+	if (!ring)
+		return -EINVAL;
+
+	if (vma->vm_end - vma->vm_start > ring->rg_size)
+		return -EINVAL;
+
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+	vma->vm_flags &= ~VM_MAYEXEC;
+
+	return remap_vmalloc_range(vma, ring->rg_hdr, 0);
+}
+
+size_t mpc_ring_size(struct mpc_ring *ring)
+{
+	return ring ? ring->rg_size : 0;
+}
+
+merr_t mpc_ring_create(struct mpool_descriptor *mp, u32 entries, struct mpc_ring **ringp)
+{
+	struct mpc_ring_hdr    *hdr;
+	struct mpc_ring        *ring;
+	size_t                  sqoff, cqoff, sz;
+
+	if (ev(!mp || !ringp))
+		return merr(EINVAL);
+
+	if (entries < 1 || entries > MPC_RING_ENTRIES_MAX || !is_power_of_2(entries))
+		return merr(EINVAL);
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return merr(ENOMEM);
+
+	/* There are twice as many CQEs as SQEs so as to absorb bursts of completions. */
+	sqoff = ALIGN(sizeof(*hdr), SMP_CACHE_BYTES);
+	cqoff = ALIGN(sqoff + entries * sizeof(struct mpc_ring_sqe), SMP_CACHE_BYTES);
+	sz = PAGE_ALIGN(cqoff + entries * 2 * sizeof(struct mpc_ring_cqe));
+
+	hdr = vmalloc_user(sz);
+	if (!hdr) {
+		kfree(ring);
+		return merr(ENOMEM);
+	}
+
+	hdr->rh_sq_entries = entries;
+	hdr->rh_cq_entries = entries * 2;
+	hdr->rh_sqoff = sqoff;
+	hdr->rh_cqoff = cqoff;
+
+	ring->rg_mp = mp;
+	ring->rg_hdr = hdr;
+	ring->rg_sqv = (void *)hdr + sqoff;
+	ring->rg_cqv = (void *)hdr + cqoff;
+	ring->rg_size = sz;
+	ring->rg_sqmask = entries - 1;
+	ring->rg_cqmask = entries * 2 - 1;
+
+	mutex_init(&ring->rg_sqlock);
+	spin_lock_init(&ring->rg_cqlock);
+	atomic_set(&ring->rg_inflight, 0);
+	init_waitqueue_head(&ring->rg_wait);
+
+	*ringp = ring;
+
+	return 0;
+}
+
+void mpc_ring_destroy(struct mpc_ring *ring)
+{
+	if (!ring)
+		return;
+
+	wait_event(ring->rg_wait, atomic_read(&ring->rg_inflight) == 0);
+
+	/* Wait for the workers to exit mpc_ring_complete()... */
+	flush_workqueue(mpc_wq_ring);
+
+	vfree(ring->rg_hdr);
+	kfree(ring);
+}
+
+merr_t mpc_ring_init(void)
+{
+	mpc_ring_workers = clamp_t(uint, mpc_ring_workers, 1, WQ_MAX_ACTIVE);
+
+	mpc_wq_ring = alloc_workqueue("mpc_wq_ring", WQ_UNBOUND, mpc_ring_workers);
+	if (!mpc_wq_ring)
+		return merr(ENOMEM);
+
+	return 0;
+}
+
+void mpc_ring_fini(void)
+{
+	if (mpc_wq_ring)
+		destroy_workqueue(mpc_wq_ring);
+	mpc_wq_ring = NULL;
+}
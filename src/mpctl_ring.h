@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#ifndef MPOOL_MPCTL_RING_H
+#define MPOOL_MPCTL_RING_H
+
+struct mpc_ring;
+struct mpool_descriptor;
+struct vm_area_struct;
+
+/**
+ * mpc_ring_init() - Create the ring worker infrastructure
+ *
+ * Return: ENOMEM if the workqueue cannot be allocated.
+ */
+merr_t mpc_ring_init(void);
+
+/**
+ * mpc_ring_fini() - Destroy the ring worker infrastructure
+ */
+void mpc_ring_fini(void);
+
+/**
+ * mpc_ring_create() - Allocate a submission/completion ring
+ * @mp:      mpool descriptor on which ring operations are performed
+ * @entries: number of SQEs, must be a power of 2 <= MPC_RING_ENTRIES_MAX
+ * @ringp:   (output) ring ptr
+ */
+merr_t mpc_ring_create(struct mpool_descriptor *mp, u32 entries, struct mpc_ring **ringp);
+
+/**
+ * mpc_ring_destroy() - Wait for all in-flight operations, then free the ring
+ * @ring:
+ */
+void mpc_ring_destroy(struct mpc_ring *ring);
+
+/**
+ * mpc_ring_size() - Return the size in bytes of the ring mapping
+ * @ring:
+ */
+size_t mpc_ring_size(struct mpc_ring *ring);
+
+/**
+ * mpc_ring_mmap() - Map the ring into the given vma
+ * @ring:
+ * @vma:
+ *
+ * Return: -errno on failure.
+ */
+int mpc_ring_mmap(struct mpc_ring *ring, struct vm_area_struct *vma);
+
+/**
+ * mpc_ring_enter() - Consume SQEs and optionally wait for completions
+ * @ring:
+ * @submitp: max SQEs to consume, returns the number consumed
+ * @wait:    min number of unconsumed CQEs to wait for
+ *
+ * Must be called in the context of the process that owns the user
+ * buffers referenced by the SQEs, as they are pinned here before
+ * being handed off to the ring workers.
+ */
+merr_t mpc_ring_enter(struct mpc_ring *ring, u32 *submitp, u32 wait);
+
+#endif /* MPOOL_MPCTL_RING_H */
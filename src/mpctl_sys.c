@@ -48,3 +48,19 @@ void mpc_attr_group_destroy(struct mpc_attr *attr)
 {
 	sysfs_remove_group(attr->a_kobj, &attr->a_group);
 }
+
+ssize_t mpc_attr_hist_show(char *buf, const u64 *bktv, int bktc, uint shift)
+{
+	ssize_t cc = 0;
+	int     i;
+
+	for (i = 0; i < bktc; i++) {
+		if (!bktv[i])
+			continue;
+
+		cc += scnprintf(buf + cc, PAGE_SIZE - cc, "%llu %llu\n",
+				i ? 1ull << (shift + i - 1) : 0, bktv[i]);
+	}
+
+	return cc;
+}
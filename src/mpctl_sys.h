@@ -45,4 +45,15 @@ int mpc_attr_group_create(struct mpc_attr *attr);
 
 void mpc_attr_group_destroy(struct mpc_attr *attr);
 
+/**
+ * mpc_attr_hist_show() - Format a log2-bucketed histogram for a show method
+ * @buf:   sysfs page buffer
+ * @bktv:  bucket counts
+ * @bktc:  number of buckets
+ * @shift: log2 of the upper bound of bucket zero
+ *
+ * Emits one "<lower bound> <count>" line for each non-empty bucket.
+ */
+ssize_t mpc_attr_hist_show(char *buf, const u64 *bktv, int bktc, uint shift);
+
 #endif /* MPOOL_MPCTL_SYS_H */
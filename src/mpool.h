@@ -12,6 +12,9 @@
 #include "mpcore_params.h"
 
 struct mpool_descriptor;
+struct workqueue_struct;
+struct work_struct;
+struct delayed_work;
 
 #define MPOOL_OP_READ  0
 #define MPOOL_OP_WRITE 1
@@ -279,6 +282,76 @@ merr_t mpool_destroy(u64 dcnt, char **dpaths, struct pd_prop *pd_prop, u32 flags
 merr_t
 mpool_rename(u64 dcnt, char **dpaths, struct pd_prop *pd_prop, u32 flags, const char *mp_newname);
 
+/**
+ * enum mpool_wq_type - per-mpool workqueues, one per subsystem
+ * @MPOOL_WQ_LOAD:  MDC loading at activation
+ * @MPOOL_WQ_ERASE: object erase pipeline
+ * @MPOOL_WQ_PCO:   MDC pre-compaction and creation
+ * @MPOOL_WQ_MOVE:  mblock tiering, defrag and rebalance
+ * @MPOOL_WQ_FLUSH: objid checkpoints and mlog flushes
+ * @MPOOL_WQ_USAGE: space usage logging
+ * @MPOOL_WQ_RA:    xvm readahead
+ *
+ * Their priority, max_active and affinity are set by the mp_wq* params.
+ */
+enum mpool_wq_type {
+	MPOOL_WQ_LOAD   = 0,
+	MPOOL_WQ_ERASE  = 1,
+	MPOOL_WQ_PCO    = 2,
+	MPOOL_WQ_MOVE   = 3,
+	MPOOL_WQ_FLUSH  = 4,
+	MPOOL_WQ_USAGE  = 5,
+	MPOOL_WQ_RA     = 6,
+	MPOOL_WQ_MAX
+};
+
+/**
+ * mpool_wq() - Get a per-mpool workqueue
+ * @mp:
+ * @type:
+ *
+ * Return: the workqueue, NULL if it doesn't exist, e.g., while creating mp
+ */
+struct workqueue_struct *mpool_wq(struct mpool_descriptor *mp, enum mpool_wq_type type);
+
+/**
+ * mpool_queue_work() - Queue work on a per-mpool workqueue
+ * @mp:
+ * @type:
+ * @work:
+ *
+ * Work queued on an unbound workqueue runs on NUMA node mp_wqnode if set.
+ *
+ * Return: false if work was already queued, true otherwise
+ */
+bool mpool_queue_work(struct mpool_descriptor *mp, enum mpool_wq_type type,
+		      struct work_struct *work);
+
+/**
+ * mpool_queue_dwork() - Queue delayed work on a per-mpool workqueue
+ * @mp:
+ * @type:
+ * @dwork:
+ * @delay: in jiffies
+ *
+ * See mpool_queue_work().
+ */
+bool mpool_queue_dwork(struct mpool_descriptor *mp, enum mpool_wq_type type,
+		       struct delayed_work *dwork, unsigned long delay);
+
+/**
+ * mpool_queue_work_node() - Queue work on a per-mpool workqueue near a node
+ * @mp:
+ * @type:
+ * @node: NUMA node the work should preferably run on
+ * @work:
+ *
+ * Like mpool_queue_work() but overrides mp_wqnode with @node for unbound
+ * workqueues, e.g., to run readahead close to the pages it fills.
+ */
+bool mpool_queue_work_node(struct mpool_descriptor *mp, enum mpool_wq_type type,
+			   int node, struct work_struct *work);
+
 /**
  * mpool_drive_add() - Add new drive dpath to mpool.
  * @mp:
@@ -289,6 +362,31 @@ mpool_rename(u64 dcnt, char **dpaths, struct pd_prop *pd_prop, u32 flags, const
  */
 merr_t mpool_drive_add(struct mpool_descriptor *mp, char *dpath, struct pd_prop *pd_prop);
 
+/**
+ * struct mpool_rebal_stats - progress of the mblock rebalance after a drive add
+ * @mrs_active:  true while mblocks are being moved
+ * @mrs_pdname:  drive mblocks are moved to
+ * @mrs_target:  bytes to move for the media classes to be equally full
+ * @mrs_moved:   bytes moved so far
+ * @mrs_elapsed: in seconds, since the rebalance started
+ * @mrs_eta:     in seconds, estimated time left at the rate achieved so far
+ */
+struct mpool_rebal_stats {
+	bool    mrs_active;
+	char    mrs_pdname[PD_NAMESZ_MAX];
+	u64     mrs_target;
+	u64     mrs_moved;
+	u64     mrs_elapsed;
+	u64     mrs_eta;
+};
+
+/**
+ * mpool_rebal_stats_get() - Get the progress of the last mblock rebalance
+ * @mp:
+ * @stats: (output)
+ */
+void mpool_rebal_stats_get(struct mpool_descriptor *mp, struct mpool_rebal_stats *stats);
+
 /**
  * mpool_drive_spares() -
  * @mp:
@@ -63,11 +63,15 @@ typedef uuid_t uuid_le;
  *	mpool activate to write back the mpool metadata to the latest version
  *	used by the binary activating the mpool.
  * @MP_FLAGS_RESIZE: Resize mpool
+ * @MP_FLAGS_LAZY_LOAD: load the user MDCs in the background after activate
+ *	returns instead of before. Object lookups wait for the MDC holding
+ *	the object to be loaded, object allocations wait for all of them.
  */
 enum mp_mgmt_flags {
 	MP_FLAGS_FORCE,
 	MP_FLAGS_PERMIT_META_CONV,
 	MP_FLAGS_RESIZE,
+	MP_FLAGS_LAZY_LOAD,
 };
 
 /**
@@ -277,10 +281,33 @@ struct mblock_props {
 	uint64_t                mpr_rsvd2;
 };
 
+/*
+ * enum mblock_alloc_flags -
+ * @MBLOCK_AF_WCOMBINE: Buffer writes in the kernel and submit them to the
+ *                      device in optimal write size units, writes then need
+ *                      only be page aligned
+ * @MBLOCK_AF_COMPRESS: Compress the mblock data in the kernel, implies
+ *                      MBLOCK_AF_WCOMBINE.  Offsets and mpr_write_len are
+ *                      those of the uncompressed data.
+ */
+enum mblock_alloc_flags {
+	MBLOCK_AF_WCOMBINE = 0x1,
+	MBLOCK_AF_COMPRESS = 0x2,
+};
+
+/*
+ * struct mblock_props_ex -
+ * @mbx_props:      mblock properties
+ * @mbx_zonecnt:    zone count per strip
+ * @mbx_compressed: mblock allocated with MBLOCK_AF_COMPRESS
+ * @mbx_phys_len:   bytes written to media, mpr_write_len unless compressed
+ */
 struct mblock_props_ex {
 	struct mblock_props     mbx_props;
-	uint8_t                 mbx_zonecnt;      /* zone count per strip */
-	uint8_t                 mbx_rsvd1[7];
+	uint8_t                 mbx_zonecnt;
+	uint8_t                 mbx_compressed;
+	uint8_t                 mbx_rsvd1[2];
+	uint32_t                mbx_phys_len;
 	uint64_t                mbx_rsvd2;
 };
 
@@ -291,10 +318,16 @@ struct mblock_props_ex {
  * @MLOG_OF_COMPACT_SEM: Enforce compaction semantics
  * @MLOG_OF_SKIP_SER:    Appends and reads are guaranteed to be serialized
  *                       outside of the mlog API
+ * @MLOG_OF_GROUP_COMMIT: Sync appends from concurrent writers share flushes,
+ *                       incompatible with MLOG_OF_SKIP_SER
+ * @MLOG_OF_RECIDX:      Keep a sparse record number index while the mlog is
+ *                       open, see mlog_read_data_seek()
  */
 enum mlog_open_flags {
-	MLOG_OF_COMPACT_SEM = 0x1,
-	MLOG_OF_SKIP_SER    = 0x2,
+	MLOG_OF_COMPACT_SEM  = 0x1,
+	MLOG_OF_SKIP_SER     = 0x2,
+	MLOG_OF_GROUP_COMMIT = 0x4,
+	MLOG_OF_RECIDX       = 0x8,
 };
 
 /*
@@ -399,6 +432,32 @@ enum mpc_vma_advice {
 	MPC_VMA_PINNED
 };
 
+/**
+ * mpc_vma_flags -
+ * @MPC_VMA_F_MLOG: im_mbidv[] holds mlog IDs rather than mblock IDs
+ * @MPC_VMA_F_HUGE: populate the map in PMD-sized, PMD-aligned extents
+ * @MPC_VMA_F_LAZY: look up each mblock at the first fault on its bucket
+ *
+ * An mlog map exposes the raw, framed log pages read-only, from offset
+ * zero through the allocated capacity of each mlog.  Pages are cached
+ * on first access and are not invalidated by subsequent appends or
+ * erasure, so it is intended only for mlogs that are no longer written.
+ *
+ * A huge map has its buckets (im_bktsz) rounded up to the PMD size and is
+ * placed at a PMD-aligned virtual address by mmap(), and a fault on a page
+ * that is not cached reads in the whole PMD-sized extent around it.
+ *
+ * A lazy map is created without looking up its mblocks, hence im_bktsz must
+ * be given and be no less than the write length of the largest mblock.  A
+ * fault on an mblock that doesn't exist or doesn't fit in its bucket fails.
+ * Lazy mlog maps are not supported.
+ */
+enum mpc_vma_flags {
+	MPC_VMA_F_MLOG = 0x1,
+	MPC_VMA_F_HUGE = 0x2,
+	MPC_VMA_F_LAZY = 0x4,
+};
+
 /*
  * Drive properties used by the ioctl commands.
  */
@@ -562,7 +621,7 @@ struct mpioc_mblock {
 
 	uint8_t                     mb_spare;
 	uint8_t                     mb_mclassp;
-	uint16_t                    mb_rsvd1;
+	uint16_t                    mb_flags;   /* enum mblock_alloc_flags */
 	uint32_t                    mb_rsvd2;
 	uint64_t                    mb_rsvd3;
 };
@@ -572,18 +631,108 @@ struct mpioc_mblock_id {
 	uint64_t            mi_objid;
 };
 
+#define MPIOC_MBIDV_MAX         (256)
+
+/**
+ * struct mpioc_mblock_idv - MPIOC_MB_COMMITV/MPIOC_MB_DELETEV parameter block
+ * @mv_cmn:
+ * @mv_idc:     count of elements in mv_idv[] and mv_errv[], at most MPIOC_MBIDV_MAX
+ * @mv_idv:     mblock unique IDs
+ * @mv_errv:    (output) per-mblock status (mpool_err_t)
+ */
+struct mpioc_mblock_idv {
+	struct mpioc_cmn            mv_cmn;     /* Must be first field! */
+	uint32_t                    mv_idc;
+	uint32_t                    mv_rsvd1;
+	const uint64_t __user      *mv_idv;
+	int64_t __user             *mv_errv;
+};
+
 #define MPIOC_KIOV_MAX          (1024)
 
+/*
+ * If mb_bufid is not 0, all of mb_iov[] must lie within that buffer
+ * registered with MPIOC_BUF_REG by the calling process.
+ */
 struct mpioc_mblock_rw {
 	struct mpioc_cmn            mb_cmn;     /* Must be first field! */
 	uint64_t                    mb_objid;
 	int64_t                     mb_offset;
-	uint32_t                    mb_rsvd2;
+	uint32_t                    mb_bufid;
 	uint16_t                    mb_rsvd3;
 	uint16_t                    mb_iov_cnt;
 	const struct iovec __user  *mb_iov;
 };
 
+#define MPIOC_MBRWV_MAX         (64)
+
+/**
+ * struct mpioc_mblock_rwv_ent - one element of an mblock read/write batch
+ * @me_objid:   mblock unique ID
+ * @me_offset:  mblock read offset (ignored for writes)
+ * @me_err:     (output) per-element status (mpool_err_t)
+ * @me_iov_cnt: count of elements in me_iov[]
+ * @me_iov:     page aligned user-space segments
+ */
+struct mpioc_mblock_rwv_ent {
+	uint64_t                    me_objid;
+	int64_t                     me_offset;
+	int64_t                     me_err;
+	uint32_t                    me_rsvd1;
+	uint16_t                    me_rsvd2;
+	uint16_t                    me_iov_cnt;
+	const struct iovec __user  *me_iov;
+};
+
+/**
+ * struct mpioc_mblock_rwv - MPIOC_MB_READV/MPIOC_MB_WRITEV parameter block
+ * @mv_cmn:
+ * @mv_entc:    count of elements in mv_entv[], at most MPIOC_MBRWV_MAX
+ * @mv_entv:    batch of mblock I/O requests
+ *
+ * The total number of iovecs in a batch may not exceed MPIOC_KIOV_MAX.
+ * Each element's status is returned in its me_err field.
+ */
+struct mpioc_mblock_rwv {
+	struct mpioc_cmn                     mv_cmn;     /* Must be first field! */
+	uint32_t                             mv_entc;
+	uint32_t                             mv_rsvd1;
+	struct mpioc_mblock_rwv_ent __user  *mv_entv;
+};
+
+#define MPIOC_MBCOPY_MAX        (64)
+
+/**
+ * struct mpioc_mblock_copy_ent - one source range of an mblock copy
+ * @mce_objid:  committed mblock unique ID
+ * @mce_offset: byte offset in the mblock, page aligned
+ * @mce_len:    bytes to copy, page aligned
+ */
+struct mpioc_mblock_copy_ent {
+	uint64_t                    mce_objid;
+	int64_t                     mce_offset;
+	uint64_t                    mce_len;
+};
+
+/**
+ * struct mpioc_mblock_copy - MPIOC_MB_COPY parameter block
+ * @mc_cmn:
+ * @mc_objid:   uncommitted mblock the ranges are appended to
+ * @mc_entc:    count of elements in mc_entv[], at most MPIOC_MBCOPY_MAX
+ * @mc_entv:    source ranges, copied in order
+ * @mc_len:     (output) bytes appended to mc_objid, also on failure
+ *
+ * The data is copied within the kernel, it is not read into user space.
+ */
+struct mpioc_mblock_copy {
+	struct mpioc_cmn                      mc_cmn;     /* Must be first field! */
+	uint64_t                              mc_objid;
+	uint32_t                              mc_entc;
+	uint32_t                              mc_rsvd1;
+	struct mpioc_mblock_copy_ent __user  *mc_entv;
+	uint64_t                              mc_len;
+};
+
 /*
  * Mlog ioctl args
  */
@@ -599,12 +748,52 @@ struct mpioc_mlog {
 	uint64_t                    ml_rsvd2;
 };
 
+/**
+ * mpc_mlog_id_flags -
+ * @MPC_MLOG_F_SPARE: MPIOC_MLOG_ERASE returns once the erase is queued,
+ *                    and the erased mlog is added to the spare pool
+ *
+ * MPIOC_MLOG_SPARE_GET takes an erased, open mlog of class mi_mclassp
+ * out of the spare pool and returns its objid, gen and state.  A pooled
+ * mlog cannot be deleted until it is taken out of the pool.  mi_sparec
+ * returns the number of spares of that class left in the pool, also when
+ * the pool was empty and the call failed with ENOENT.
+ */
+enum mpc_mlog_id_flags {
+	MPC_MLOG_F_SPARE = 0x1,
+};
+
 struct mpioc_mlog_id {
 	struct mpioc_cmn    mi_cmn;     /* Must be first field! */
 	uint64_t            mi_objid;
 	uint64_t            mi_gen;
 	uint8_t             mi_state;
-	uint8_t             mi_rsvd1[7];
+	uint8_t             mi_flags;   /* enum mpc_mlog_id_flags */
+	uint8_t             mi_mclassp; /* enum mp_media_classp */
+	uint8_t             mi_rsvd1;
+	uint32_t            mi_sparec;
+};
+
+/**
+ * struct mpioc_mlog_seek - look up a data record in the record index
+ * @mk_objid: mlog objid, the mlog must be open with MLOG_OF_RECIDX
+ * @mk_recno: data record number, counted from 0 at the start of the log
+ * @mk_lboff: (output) byte offset of the log block holding record mk_idxrec
+ * @mk_idxrec: (output) record number of the closest indexed record at or
+ *            before mk_recno
+ * @mk_roff:  (output) offset of record mk_idxrec in its log block
+ *
+ * A reader positioned at (mk_lboff, mk_roff) reaches record mk_recno after
+ * skipping (mk_recno - mk_idxrec) data records.
+ */
+struct mpioc_mlog_seek {
+	struct mpioc_cmn    mk_cmn;     /* Must be first field! */
+	uint64_t            mk_objid;
+	uint64_t            mk_recno;
+	uint64_t            mk_lboff;
+	uint64_t            mk_idxrec;
+	uint32_t            mk_roff;
+	uint32_t            mk_rsvd1;
 };
 
 struct mpioc_mlog_io {
@@ -632,13 +821,277 @@ struct mpioc_vma {
 	uint64_t            im_len;
 	uint64_t            im_vssp;
 	uint64_t            im_rssp;
-	uint64_t            im_rsvd;
+	uint32_t            im_flags;
+	uint32_t            im_rsvd;
+};
+
+/**
+ * struct mpool_xvm_stats - mcache map statistics
+ * @xs_faults:       page faults
+ * @xs_majfaults:    page faults which had to read the faulting page
+ * @xs_refaults:     major faults on pages which had been evicted
+ * @xs_fa_pages:     pages read around major faults
+ * @xs_fa_used:      pages read around major faults and later faulted on
+ * @xs_ra_pages:     pages read by readahead
+ * @xs_ra_used:      pages read by readahead and later faulted on
+ * @xs_evict_reap:   pages evicted by the reaper (or MPIOC_VMA_PURGE)
+ * @xs_evict_kernel: pages reclaimed or invalidated by the kernel
+ */
+struct mpool_xvm_stats {
+	uint64_t            xs_faults;
+	uint64_t            xs_majfaults;
+	uint64_t            xs_refaults;
+	uint64_t            xs_fa_pages;
+	uint64_t            xs_fa_used;
+	uint64_t            xs_ra_pages;
+	uint64_t            xs_ra_used;
+	uint64_t            xs_evict_reap;
+	uint64_t            xs_evict_kernel;
+};
+
+/**
+ * struct mpioc_vma_stats
+ * @is_offset: offset of the mcache map, as returned by MPIOC_VMA_CREATE
+ * @is_stats:  (output) statistics of the map
+ */
+struct mpioc_vma_stats {
+	struct mpioc_cmn        is_cmn;     /* Must be first field! */
+	int64_t                 is_offset;
+	struct mpool_xvm_stats  is_stats;
+};
+
+/*
+ * Submission/completion ring definitions.
+ *
+ * The ring is created by MPIOC_RING_SETUP and mapped into the caller's
+ * address space by mmap()ing rg_mmap_len bytes at offset rg_mmap_off
+ * of the mpool device.  The mapping begins with a struct mpc_ring_hdr,
+ * followed by the SQE and CQE arrays at offsets rh_sqoff and rh_cqoff.
+ *
+ * The user owns rh_sq_tail and rh_cq_head, the kernel owns rh_sq_head
+ * and rh_cq_tail.  All are free running counters, which must be masked
+ * by the array size minus one to index the SQE and CQE arrays.  Each
+ * consumed SQE produces exactly one CQE.  SQEs are processed in parallel,
+ * so there is no ordering between SQEs that are in flight at the same time.
+ */
+#define MPC_RING_ENTRIES_MAX    (4096)
+
+/**
+ * enum mpc_ring_op - ring operation codes
+ * @MPC_RING_OP_NOP:         no operation
+ * @MPC_RING_OP_MB_READ:     read a committed mblock (see MPIOC_MB_READ)
+ * @MPC_RING_OP_MB_WRITE:    write an uncommitted mblock (see MPIOC_MB_WRITE)
+ * @MPC_RING_OP_MB_COMMIT:   commit an mblock
+ * @MPC_RING_OP_MB_ABORT:    abort an mblock
+ * @MPC_RING_OP_MLOG_READ:   raw mlog read (see MPIOC_MLOG_READ)
+ * @MPC_RING_OP_MLOG_WRITE:  raw mlog write (see MPIOC_MLOG_WRITE)
+ * @MPC_RING_OP_MLOG_COMMIT: commit an mlog
+ * @MPC_RING_OP_MLOG_ABORT:  abort an mlog
+ */
+enum mpc_ring_op {
+	MPC_RING_OP_NOP         = 0,
+	MPC_RING_OP_MB_READ     = 1,
+	MPC_RING_OP_MB_WRITE    = 2,
+	MPC_RING_OP_MB_COMMIT   = 3,
+	MPC_RING_OP_MB_ABORT    = 4,
+	MPC_RING_OP_MLOG_READ   = 5,
+	MPC_RING_OP_MLOG_WRITE  = 6,
+	MPC_RING_OP_MLOG_COMMIT = 7,
+	MPC_RING_OP_MLOG_ABORT  = 8,
+	MPC_RING_OP_LAST        = MPC_RING_OP_MLOG_ABORT,
+};
+
+/**
+ * struct mpc_ring_sqe - submission queue entry
+ * @sqe_op:     enum mpc_ring_op
+ * @sqe_iovc:   count of elements in sqe_iov[] (read/write only)
+ * @sqe_objid:  mblock or mlog ID
+ * @sqe_offset: object offset (read and mlog write only)
+ * @sqe_udata:  opaque user data, returned in the CQE
+ * @sqe_iov:    page aligned user-space segments (read/write only)
+ */
+struct mpc_ring_sqe {
+	uint8_t                     sqe_op;
+	uint8_t                     sqe_rsvd1;
+	uint16_t                    sqe_iovc;
+	uint32_t                    sqe_rsvd2;
+	uint64_t                    sqe_objid;
+	int64_t                     sqe_offset;
+	uint64_t                    sqe_udata;
+	const struct iovec __user  *sqe_iov;
+};
+
+/**
+ * struct mpc_ring_cqe - completion queue entry
+ * @cqe_udata:  sqe_udata of the completed SQE
+ * @cqe_err:    completion status (mpool_err_t)
+ */
+struct mpc_ring_cqe {
+	uint64_t    cqe_udata;
+	int64_t     cqe_err;
+};
+
+/**
+ * struct mpc_ring_hdr - shared ring header
+ * @rh_sq_head:    next SQE to be consumed by the kernel
+ * @rh_sq_tail:    next SQE to be filled in by the user
+ * @rh_sq_entries: number of SQEs (power of 2)
+ * @rh_cq_head:    next CQE to be consumed by the user
+ * @rh_cq_tail:    next CQE to be filled in by the kernel
+ * @rh_cq_entries: number of CQEs (power of 2)
+ * @rh_sqoff:      offset of the SQE array from the start of the mapping
+ * @rh_cqoff:      offset of the CQE array from the start of the mapping
+ */
+struct mpc_ring_hdr {
+	uint32_t    rh_sq_head;
+	uint32_t    rh_sq_tail;
+	uint32_t    rh_sq_entries;
+	uint32_t    rh_rsvd1;
+	uint32_t    rh_cq_head;
+	uint32_t    rh_cq_tail;
+	uint32_t    rh_cq_entries;
+	uint32_t    rh_rsvd2;
+	uint64_t    rh_sqoff;
+	uint64_t    rh_cqoff;
+};
+
+/**
+ * struct mpioc_ring - MPIOC_RING_SETUP/MPIOC_RING_ENTER parameter block
+ * @rg_cmn:
+ * @rg_entries:  SETUP: requested number of SQEs (power of 2)
+ * @rg_submit:   ENTER: max SQEs to consume, returns number consumed
+ * @rg_wait:     ENTER: min CQEs to wait for before returning
+ * @rg_mmap_off: SETUP: (output) mmap offset of the ring
+ * @rg_mmap_len: SETUP: (output) mmap length of the ring
+ */
+struct mpioc_ring {
+	struct mpioc_cmn    rg_cmn;     /* Must be first field! */
+	uint32_t            rg_entries;
+	uint32_t            rg_submit;
+	uint32_t            rg_wait;
+	uint32_t            rg_rsvd1;
+	uint64_t            rg_mmap_off;
+	uint64_t            rg_mmap_len;
+};
+
+#define MPIOC_BUF_MAX           (64)
+
+/**
+ * struct mpioc_buf - MPIOC_BUF_REG/MPIOC_BUF_UNREG parameter block
+ * @bf_cmn:
+ * @bf_addr: REG: page aligned address of a writable user buffer
+ * @bf_len:  REG: buffer length, a multiple of the page size
+ * @bf_id:   REG: (output) buffer ID for mb_bufid, UNREG: buffer ID
+ *
+ * A registered buffer stays pinned until it is unregistered or the mpool
+ * device is closed, so that mblock reads and writes to it need not pin
+ * the user pages on each call.  At most MPIOC_BUF_MAX buffers can be
+ * registered per mpool.
+ */
+struct mpioc_buf {
+	struct mpioc_cmn    bf_cmn;     /* Must be first field! */
+	uint64_t            bf_addr;
+	uint64_t            bf_len;
+	uint32_t            bf_id;
+	uint32_t            bf_rsvd1;
+};
+
+/**
+ * enum mpioc_test_cmd - MPIOC_TEST subcommands
+ * @MPIOC_TEST_MERR:  return merr(mpt_sval[0]) in mpt_sval[1]
+ * @MPIOC_TEST_BENCH: run the benchmark described by the struct mpioc_bench
+ *                    at user address mpt_uval[0], requires a writable open
+ */
+enum mpioc_test_cmd {
+	MPIOC_TEST_MERR  = 0,
+	MPIOC_TEST_BENCH = 1,
+};
+
+/**
+ * enum mpioc_bench_wl - In-kernel benchmark workloads
+ * @MPIOC_BENCH_MB_ALLOC:    mblock alloc and abort
+ * @MPIOC_BENCH_MB_WRITE:    mblock alloc, write bn_iosz, commit and delete
+ * @MPIOC_BENCH_MB_READ:     bn_iosz reads of a committed mblock
+ * @MPIOC_BENCH_MLOG_APPEND: bn_iosz mlog appends, the mlog is erased when full
+ * @MPIOC_BENCH_MDC_APPEND:  bn_iosz MDC appends, the MDC is compacted when full
+ * @MPIOC_BENCH_SMAP:        single zone smap alloc and free
+ * @MPIOC_BENCH_OBJ_LOOKUP:  pmd_obj_find_get() and put of committed mblocks
+ * @MPIOC_BENCH_MLOG_OPEN:   mlog_open() of a half full mlog of bn_iosz records
+ * @MPIOC_BENCH_MLOG_SEEK:   mlog_read_data_seek() to a record of a half full
+ *                           mlog of bn_iosz records, and read of that record
+ */
+enum mpioc_bench_wl {
+	MPIOC_BENCH_MB_ALLOC     = 1,
+	MPIOC_BENCH_MB_WRITE     = 2,
+	MPIOC_BENCH_MB_READ      = 3,
+	MPIOC_BENCH_MLOG_APPEND  = 4,
+	MPIOC_BENCH_MDC_APPEND   = 5,
+	MPIOC_BENCH_SMAP         = 6,
+	MPIOC_BENCH_OBJ_LOOKUP   = 7,
+	MPIOC_BENCH_MLOG_OPEN    = 8,
+	MPIOC_BENCH_MLOG_SEEK    = 9,
+};
+
+/**
+ * enum mpioc_bench_flags -
+ * @MPIOC_BENCH_F_SYNC:      mlog and MDC appends are synchronous
+ * @MPIOC_BENCH_F_ASYNC:     mlog and batched MDC appends are started but not
+ *                           waited for
+ * @MPIOC_BENCH_F_BATCH:     each MDC append is a batch of records appended by
+ *                           mp_mdc_appendv()
+ * @MPIOC_BENCH_F_BGCOMPACT: MDC appends run alongside background compactions,
+ *                           each spanning a fixed number of appends
+ */
+enum mpioc_bench_flags {
+	MPIOC_BENCH_F_SYNC      = 0x1,
+	MPIOC_BENCH_F_ASYNC     = 0x2,
+	MPIOC_BENCH_F_BATCH     = 0x4,
+	MPIOC_BENCH_F_BGCOMPACT = 0x8,
+};
+
+#define MPIOC_BENCH_PCT_MAX     4
+
+/**
+ * struct mpioc_bench - MPIOC_TEST_BENCH parameters and results
+ * @bn_workload: enum mpioc_bench_wl
+ * @bn_threads:  number of worker threads
+ * @bn_ops:      operations per thread
+ * @bn_iosz:     bytes per mblock read/write or mlog/MDC record
+ * @bn_flags:    enum mpioc_bench_flags
+ * @bn_mclassp:  media class on which objects are allocated
+ * @bn_usecs:    (output) elapsed time of the measured phase
+ * @bn_done:     (output) operations completed
+ * @bn_errors:   (output) operations which failed
+ * @bn_lat_min:  (output) min operation latency in nsecs
+ * @bn_lat_avg:  (output) average operation latency in nsecs
+ * @bn_lat_max:  (output) max operation latency in nsecs
+ * @bn_lat_pct:  (output) p50, p90, p99 and p99.9 latency in nsecs
+ *
+ * Percentiles are derived from a log-linear histogram and are accurate to
+ * within 12.5%.  A signal stops the run early, the results then cover the
+ * operations completed so far and bn_done is less than bn_threads * bn_ops.
+ */
+struct mpioc_bench {
+	uint32_t    bn_workload;
+	uint32_t    bn_threads;
+	uint64_t    bn_ops;
+	uint32_t    bn_iosz;
+	uint32_t    bn_flags;
+	uint8_t     bn_mclassp;
+	uint8_t     bn_rsvd1[7];
+	uint64_t    bn_usecs;
+	uint64_t    bn_done;
+	uint64_t    bn_errors;
+	uint64_t    bn_lat_min;
+	uint64_t    bn_lat_avg;
+	uint64_t    bn_lat_max;
+	uint64_t    bn_lat_pct[MPIOC_BENCH_PCT_MAX];
 };
 
 /**
  * struct mpioc_test - Used for testing
  * @mpt_cmn:
- * @mpt_cmd:    subcommand
+ * @mpt_cmd:    subcommand (enum mpioc_test_cmd)
  * @mpt_sval:   in/out data for subcommand
  * @mpt_uval:   in/out data for subcommand
  */
@@ -650,6 +1103,24 @@ struct mpioc_test {
 	uint64_t            mpt_uval[3];
 };
 
+/**
+ * struct mpool_evc_rec - Event counter record
+ * @er_count: number of times the ev() call site saw an error
+ * @er_line:  source line of the call site
+ * @er_file:  basename of the source file, NUL terminated
+ * @er_func:  function name, NUL terminated
+ *
+ * Reading debugfs "mpool/events.bin" returns an array of these, one for
+ * each call site that has seen at least one error since module load.
+ */
+struct mpool_evc_rec {
+	uint64_t            er_count;
+	uint32_t            er_line;
+	uint32_t            er_rsvd;
+	char                er_file[32];
+	char                er_func[48];
+};
+
 /*
  * mpioc_union is used by mpc_ioctl() to reserve enough storage
  * on the stack to contain any mpioc_* object (so as to avoid
@@ -668,10 +1139,17 @@ union mpioc_union {
 	struct mpioc_mlog           mpu_mlog;
 	struct mpioc_mlog_id        mpu_mlog_id;
 	struct mpioc_mlog_io        mpu_mlog_io;
+	struct mpioc_mlog_seek      mpu_mlog_seek;
 	struct mpioc_mblock         mpu_mblock;
 	struct mpioc_mblock_id      mpu_mblock_id;
+	struct mpioc_mblock_idv     mpu_mblock_idv;
 	struct mpioc_mblock_rw      mpu_mblock_rw;
+	struct mpioc_mblock_rwv     mpu_mblock_rwv;
+	struct mpioc_mblock_copy    mpu_mblock_copy;
 	struct mpioc_vma            mpu_vma;
+	struct mpioc_vma_stats      mpu_vma_stats;
+	struct mpioc_ring           mpu_ring;
+	struct mpioc_buf            mpu_buf;
 	struct mpioc_test           mpu_test;
 };
 
@@ -703,19 +1181,33 @@ union mpioc_union {
 #define MPIOC_MLOG_WRITE        _IOWR(MPIOC_MAGIC, 41, struct mpioc_mlog_io)
 #define MPIOC_MLOG_PROPS        _IOWR(MPIOC_MAGIC, 42, struct mpioc_mlog)
 #define MPIOC_MLOG_ERASE        _IOWR(MPIOC_MAGIC, 43, struct mpioc_mlog_id)
+#define MPIOC_MLOG_SPARE_GET    _IOWR(MPIOC_MAGIC, 44, struct mpioc_mlog_id)
+#define MPIOC_MLOG_SEEK         _IOWR(MPIOC_MAGIC, 45, struct mpioc_mlog_seek)
 
 #define MPIOC_MB_ALLOC          _IOWR(MPIOC_MAGIC, 50, struct mpioc_mblock)
 #define MPIOC_MB_ABORT          _IOWR(MPIOC_MAGIC, 52, struct mpioc_mblock_id)
 #define MPIOC_MB_COMMIT         _IOWR(MPIOC_MAGIC, 53, struct mpioc_mblock_id)
 #define MPIOC_MB_DELETE         _IOWR(MPIOC_MAGIC, 54, struct mpioc_mblock_id)
 #define MPIOC_MB_FIND           _IOWR(MPIOC_MAGIC, 56, struct mpioc_mblock)
+#define MPIOC_MB_COMMITV        _IOWR(MPIOC_MAGIC, 57, struct mpioc_mblock_idv)
+#define MPIOC_MB_DELETEV        _IOWR(MPIOC_MAGIC, 58, struct mpioc_mblock_idv)
 #define MPIOC_MB_READ           _IOWR(MPIOC_MAGIC, 60, struct mpioc_mblock_rw)
 #define MPIOC_MB_WRITE          _IOWR(MPIOC_MAGIC, 61, struct mpioc_mblock_rw)
+#define MPIOC_MB_READV          _IOWR(MPIOC_MAGIC, 62, struct mpioc_mblock_rwv)
+#define MPIOC_MB_WRITEV         _IOWR(MPIOC_MAGIC, 63, struct mpioc_mblock_rwv)
+#define MPIOC_MB_COPY           _IOWR(MPIOC_MAGIC, 64, struct mpioc_mblock_copy)
 
 #define MPIOC_VMA_CREATE        _IOWR(MPIOC_MAGIC, 70, struct mpioc_vma)
 #define MPIOC_VMA_DESTROY       _IOWR(MPIOC_MAGIC, 71, struct mpioc_vma)
 #define MPIOC_VMA_PURGE         _IOWR(MPIOC_MAGIC, 72, struct mpioc_vma)
 #define MPIOC_VMA_VRSS          _IOWR(MPIOC_MAGIC, 73, struct mpioc_vma)
+#define MPIOC_VMA_STATS         _IOWR(MPIOC_MAGIC, 74, struct mpioc_vma_stats)
+
+#define MPIOC_RING_SETUP        _IOWR(MPIOC_MAGIC, 80, struct mpioc_ring)
+#define MPIOC_RING_ENTER        _IOWR(MPIOC_MAGIC, 81, struct mpioc_ring)
+
+#define MPIOC_BUF_REG           _IOWR(MPIOC_MAGIC, 85, struct mpioc_buf)
+#define MPIOC_BUF_UNREG         _IOWR(MPIOC_MAGIC, 86, struct mpioc_buf)
 
 #define MPIOC_TEST              _IOWR(MPIOC_MAGIC, 99, struct mpioc_test)
 
@@ -0,0 +1,265 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Tracepoints on the mpool data and metadata paths.
+ *
+ * Latencies are in nanoseconds and are only measured while the event is
+ * enabled, events which fire while tracing is being enabled may report a
+ * latency of zero.  Errors are reported as -errno.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mpool
+
+#if !defined(MPOOL_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define MPOOL_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(mpool_mblock_io,
+
+	TP_PROTO(struct mpool_descriptor *mp, u64 objid, u16 pdh, loff_t off, size_t len,
+		 u64 lat, merr_t err),
+
+	TP_ARGS(mp, objid, pdh, off, len, lat, err),
+
+	TP_STRUCT__entry(
+		__array(char,   mpname, MPOOL_NAMESZ_MAX)
+		__field(u64,    objid)
+		__field(u16,    pdh)
+		__field(loff_t, off)
+		__field(size_t, len)
+		__field(u64,    lat)
+		__field(int,    err)
+	),
+
+	TP_fast_assign(
+		strlcpy(__entry->mpname, mp->pds_name, sizeof(__entry->mpname));
+		__entry->objid = objid;
+		__entry->pdh   = pdh;
+		__entry->off   = off;
+		__entry->len   = len;
+		__entry->lat   = lat;
+		__entry->err   = -merr_errno(err);
+	),
+
+	TP_printk("mpool %s objid 0x%llx pdh %u off %lld len %zu lat %llu err %d",
+		  __entry->mpname, __entry->objid, __entry->pdh, __entry->off,
+		  __entry->len, __entry->lat, __entry->err)
+);
+
+DEFINE_EVENT(mpool_mblock_io, mpool_mblock_write,
+	TP_PROTO(struct mpool_descriptor *mp, u64 objid, u16 pdh, loff_t off, size_t len,
+		 u64 lat, merr_t err),
+	TP_ARGS(mp, objid, pdh, off, len, lat, err)
+);
+
+DEFINE_EVENT(mpool_mblock_io, mpool_mblock_read,
+	TP_PROTO(struct mpool_descriptor *mp, u64 objid, u16 pdh, loff_t off, size_t len,
+		 u64 lat, merr_t err),
+	TP_ARGS(mp, objid, pdh, off, len, lat, err)
+);
+
+TRACE_EVENT(mpool_mlog_append,
+
+	TP_PROTO(struct mpool_descriptor *mp, u64 objid, u16 pdh, u64 len, int sync,
+		 u64 lat, merr_t err),
+
+	TP_ARGS(mp, objid, pdh, len, sync, lat, err),
+
+	TP_STRUCT__entry(
+		__array(char,   mpname, MPOOL_NAMESZ_MAX)
+		__field(u64,    objid)
+		__field(u16,    pdh)
+		__field(u64,    len)
+		__field(int,    sync)
+		__field(u64,    lat)
+		__field(int,    err)
+	),
+
+	TP_fast_assign(
+		strlcpy(__entry->mpname, mp->pds_name, sizeof(__entry->mpname));
+		__entry->objid = objid;
+		__entry->pdh   = pdh;
+		__entry->len   = len;
+		__entry->sync  = sync;
+		__entry->lat   = lat;
+		__entry->err   = -merr_errno(err);
+	),
+
+	TP_printk("mpool %s objid 0x%llx pdh %u len %llu sync %d lat %llu err %d",
+		  __entry->mpname, __entry->objid, __entry->pdh, __entry->len,
+		  __entry->sync, __entry->lat, __entry->err)
+);
+
+TRACE_EVENT(mpool_mlog_flush,
+
+	TP_PROTO(struct mpool_descriptor *mp, u64 objid, u16 pdh, loff_t off, size_t len,
+		 bool async, u64 lat, merr_t err),
+
+	TP_ARGS(mp, objid, pdh, off, len, async, lat, err),
+
+	TP_STRUCT__entry(
+		__array(char,   mpname, MPOOL_NAMESZ_MAX)
+		__field(u64,    objid)
+		__field(u16,    pdh)
+		__field(loff_t, off)
+		__field(size_t, len)
+		__field(bool,   async)
+		__field(u64,    lat)
+		__field(int,    err)
+	),
+
+	TP_fast_assign(
+		strlcpy(__entry->mpname, mp->pds_name, sizeof(__entry->mpname));
+		__entry->objid = objid;
+		__entry->pdh   = pdh;
+		__entry->off   = off;
+		__entry->len   = len;
+		__entry->async = async;
+		__entry->lat   = lat;
+		__entry->err   = -merr_errno(err);
+	),
+
+	TP_printk("mpool %s objid 0x%llx pdh %u off %lld len %zu async %d lat %llu err %d",
+		  __entry->mpname, __entry->objid, __entry->pdh, __entry->off,
+		  __entry->len, __entry->async, __entry->lat, __entry->err)
+);
+
+TRACE_EVENT(mpool_mdc_compact,
+
+	TP_PROTO(struct mpool_descriptor *mp, u8 cslot, u32 compacted, u32 total, int retries,
+		 u64 lat, merr_t err),
+
+	TP_ARGS(mp, cslot, compacted, total, retries, lat, err),
+
+	TP_STRUCT__entry(
+		__array(char,   mpname, MPOOL_NAMESZ_MAX)
+		__field(u8,     cslot)
+		__field(u32,    compacted)
+		__field(u32,    total)
+		__field(int,    retries)
+		__field(u64,    lat)
+		__field(int,    err)
+	),
+
+	TP_fast_assign(
+		strlcpy(__entry->mpname, mp->pds_name, sizeof(__entry->mpname));
+		__entry->cslot     = cslot;
+		__entry->compacted = compacted;
+		__entry->total     = total;
+		__entry->retries   = retries;
+		__entry->lat       = lat;
+		__entry->err       = -merr_errno(err);
+	),
+
+	TP_printk("mpool %s mdc %u compacted %u of %u retries %d lat %llu err %d",
+		  __entry->mpname, __entry->cslot, __entry->compacted, __entry->total,
+		  __entry->retries, __entry->lat, __entry->err)
+);
+
+DECLARE_EVENT_CLASS(mpool_smap,
+
+	TP_PROTO(struct mpool_descriptor *mp, u16 pdh, u64 zoneaddr, u64 zonecnt,
+		 u64 lat, merr_t err),
+
+	TP_ARGS(mp, pdh, zoneaddr, zonecnt, lat, err),
+
+	TP_STRUCT__entry(
+		__array(char,   mpname, MPOOL_NAMESZ_MAX)
+		__field(u16,    pdh)
+		__field(u64,    zoneaddr)
+		__field(u64,    zonecnt)
+		__field(u64,    lat)
+		__field(int,    err)
+	),
+
+	TP_fast_assign(
+		strlcpy(__entry->mpname, mp->pds_name, sizeof(__entry->mpname));
+		__entry->pdh      = pdh;
+		__entry->zoneaddr = zoneaddr;
+		__entry->zonecnt  = zonecnt;
+		__entry->lat      = lat;
+		__entry->err      = -merr_errno(err);
+	),
+
+	TP_printk("mpool %s pdh %u zoneaddr %llu zonecnt %llu lat %llu err %d",
+		  __entry->mpname, __entry->pdh, __entry->zoneaddr, __entry->zonecnt,
+		  __entry->lat, __entry->err)
+);
+
+DEFINE_EVENT(mpool_smap, mpool_smap_alloc,
+	TP_PROTO(struct mpool_descriptor *mp, u16 pdh, u64 zoneaddr, u64 zonecnt,
+		 u64 lat, merr_t err),
+	TP_ARGS(mp, pdh, zoneaddr, zonecnt, lat, err)
+);
+
+DEFINE_EVENT(mpool_smap, mpool_smap_free,
+	TP_PROTO(struct mpool_descriptor *mp, u16 pdh, u64 zoneaddr, u64 zonecnt,
+		 u64 lat, merr_t err),
+	TP_ARGS(mp, pdh, zoneaddr, zonecnt, lat, err)
+);
+
+TRACE_EVENT(mpool_xvm_fault,
+
+	TP_PROTO(uint rgn, pgoff_t pgoff, bool major, u64 lat, uint vmfrc),
+
+	TP_ARGS(rgn, pgoff, major, lat, vmfrc),
+
+	TP_STRUCT__entry(
+		__field(uint,    rgn)
+		__field(pgoff_t, pgoff)
+		__field(bool,    major)
+		__field(u64,     lat)
+		__field(uint,    vmfrc)
+	),
+
+	TP_fast_assign(
+		__entry->rgn   = rgn;
+		__entry->pgoff = pgoff;
+		__entry->major = major;
+		__entry->lat   = lat;
+		__entry->vmfrc = vmfrc;
+	),
+
+	TP_printk("rgn %u pgoff %lu major %d lat %llu vmfrc 0x%x",
+		  __entry->rgn, __entry->pgoff, __entry->major, __entry->lat, __entry->vmfrc)
+);
+
+TRACE_EVENT(mpool_xvm_readahead,
+
+	TP_PROTO(uint rgn, uint mbnum, pgoff_t pgoff, uint nr_pages, uint queued),
+
+	TP_ARGS(rgn, mbnum, pgoff, nr_pages, queued),
+
+	TP_STRUCT__entry(
+		__field(uint,    rgn)
+		__field(uint,    mbnum)
+		__field(pgoff_t, pgoff)
+		__field(uint,    nr_pages)
+		__field(uint,    queued)
+	),
+
+	TP_fast_assign(
+		__entry->rgn      = rgn;
+		__entry->mbnum    = mbnum;
+		__entry->pgoff    = pgoff;
+		__entry->nr_pages = nr_pages;
+		__entry->queued   = queued;
+	),
+
+	TP_printk("rgn %u mbnum %u pgoff %lu nr_pages %u queued %u",
+		  __entry->rgn, __entry->mbnum, __entry->pgoff, __entry->nr_pages,
+		  __entry->queued)
+);
+
+#endif /* MPOOL_TRACE_H */
+
+/* This part must be outside the multi-read protection. */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mpool_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/math64.h>
+#include <linux/percpu.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "mpool_printk.h"
+#include "evc.h"
+#include "objcache.h"
+
+static LIST_HEAD(objcache_list);
+static DEFINE_MUTEX(objcache_lock);
+static struct dentry *objcache_dentry;
+
+static const char * const objcache_stat_names[OCS_MAX] = {
+	[OCS_HIT]    = "hit",
+	[OCS_MISS]   = "miss",
+	[OCS_FREE]   = "free",
+	[OCS_SPILL]  = "spill",
+	[OCS_REMOTE] = "remote",
+};
+
+merr_t objcache_init(struct objcache *oc, struct kmem_cache *cache, size_t size, const char *name)
+{
+	oc->oc_mag = alloc_percpu(struct objcache_mag);
+	if (ev(!oc->oc_mag))
+		return merr(ENOMEM);
+
+	oc->oc_cache = cache;
+	oc->oc_size = size;
+	oc->oc_name = name;
+
+	mutex_lock(&objcache_lock);
+	list_add_tail(&oc->oc_entry, &objcache_list);
+	mutex_unlock(&objcache_lock);
+
+	return 0;
+}
+
+void objcache_fini(struct objcache *oc)
+{
+	int cpu;
+
+	if (!oc->oc_mag)
+		return;
+
+	mutex_lock(&objcache_lock);
+	list_del(&oc->oc_entry);
+	mutex_unlock(&objcache_lock);
+
+	for_each_possible_cpu(cpu) {
+		struct objcache_mag *mag = per_cpu_ptr(oc->oc_mag, cpu);
+
+		while (mag->ocm_cnt > 0)
+			kmem_cache_free(oc->oc_cache, mag->ocm_objv[--mag->ocm_cnt]);
+	}
+
+	free_percpu(oc->oc_mag);
+	oc->oc_mag = NULL;
+	oc->oc_cache = NULL;
+}
+
+void *objcache_alloc(struct objcache *oc, gfp_t flags, bool zero)
+{
+	struct objcache_mag    *mag;
+	unsigned long           iflags;
+	void                   *obj = NULL;
+
+	local_irq_save(iflags);
+	mag = this_cpu_ptr(oc->oc_mag);
+	if (mag->ocm_cnt > 0) {
+		obj = mag->ocm_objv[--mag->ocm_cnt];
+		mag->ocm_statv[OCS_HIT]++;
+	} else {
+		mag->ocm_statv[OCS_MISS]++;
+	}
+	local_irq_restore(iflags);
+
+	if (!obj)
+		return kmem_cache_alloc_node(oc->oc_cache, zero ? flags | __GFP_ZERO : flags,
+					     numa_node_id());
+
+	if (zero)
+		memset(obj, 0, oc->oc_size);
+
+	return obj;
+}
+
+void objcache_free(struct objcache *oc, void *obj)
+{
+	struct objcache_mag    *mag;
+	unsigned long           iflags;
+	int                     nid;
+
+	if (!obj)
+		return;
+
+	/*
+	 * Keep the magazines node-local: an object freed on a cpu of
+	 * another node goes straight back to the slab.
+	 */
+	nid = page_to_nid(virt_to_page(obj));
+
+	local_irq_save(iflags);
+	mag = this_cpu_ptr(oc->oc_mag);
+	if (nid != numa_node_id()) {
+		mag->ocm_statv[OCS_REMOTE]++;
+	} else if (mag->ocm_cnt < OBJCACHE_MAG_MAX) {
+		mag->ocm_objv[mag->ocm_cnt++] = obj;
+		mag->ocm_statv[OCS_FREE]++;
+		obj = NULL;
+	} else {
+		mag->ocm_statv[OCS_SPILL]++;
+	}
+	local_irq_restore(iflags);
+
+	if (obj)
+		kmem_cache_free(oc->oc_cache, obj);
+}
+
+void objcache_stats_get(struct objcache *oc, u64 *statv)
+{
+	int cpu, i;
+
+	memset(statv, 0, OCS_MAX * sizeof(*statv));
+
+	for_each_possible_cpu(cpu) {
+		struct objcache_mag *mag = per_cpu_ptr(oc->oc_mag, cpu);
+
+		for (i = 0; i < OCS_MAX; ++i)
+			statv[i] += READ_ONCE(mag->ocm_statv[i]);
+	}
+}
+
+static int objcache_show(struct seq_file *s, void *v)
+{
+	struct objcache    *oc;
+	u64                 statv[OCS_MAX];
+	int                 i;
+
+	seq_printf(s, "%-24s %6s", "NAME", "SIZE");
+	for (i = 0; i < OCS_MAX; ++i)
+		seq_printf(s, " %12s", objcache_stat_names[i]);
+	seq_printf(s, " %6s\n", "HIT%");
+
+	mutex_lock(&objcache_lock);
+	list_for_each_entry(oc, &objcache_list, oc_entry) {
+		u64 allocs;
+
+		objcache_stats_get(oc, statv);
+		allocs = statv[OCS_HIT] + statv[OCS_MISS];
+
+		seq_printf(s, "%-24s %6zu", oc->oc_name, oc->oc_size);
+		for (i = 0; i < OCS_MAX; ++i)
+			seq_printf(s, " %12llu", statv[i]);
+		seq_printf(s, " %6llu\n", allocs ? div64_u64(statv[OCS_HIT] * 100, allocs) : 0);
+	}
+	mutex_unlock(&objcache_lock);
+
+	return 0;
+}
+
+static int objcache_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, objcache_show, NULL);
+}
+
+static const struct file_operations objcache_fops = {
+	.owner   = THIS_MODULE,
+	.open    = objcache_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+void objcache_debugfs_init(struct dentry *parent)
+{
+	struct dentry *d;
+
+	if (!parent)
+		return;
+
+	d = debugfs_create_file("objcache", 0444, parent, NULL, &objcache_fops);
+	if (!IS_ERR_OR_NULL(d))
+		objcache_dentry = d;
+}
+
+void objcache_debugfs_fini(void)
+{
+	debugfs_remove(objcache_dentry);
+	objcache_dentry = NULL;
+}
@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
+ */
+/*
+ * Per-CPU object magazines layered over a slab cache.
+ *
+ * Hot object types (layouts, space map zones) are allocated and freed on
+ * every object alloc/commit/delete and every free extent split or merge.
+ * An objcache keeps a small per-CPU stack of free objects in front of the
+ * slab so that such churn is satisfied without entering the slab allocator.
+ */
+
+#ifndef MPOOL_OBJCACHE_H
+#define MPOOL_OBJCACHE_H
+
+#include <linux/list.h>
+#include <linux/slab.h>
+
+#include "merr.h"
+
+struct dentry;
+
+/*
+ * OBJCACHE_MAG_MAX: max free objects held in a per-cpu magazine
+ */
+#define OBJCACHE_MAG_MAX    32
+
+/**
+ * enum objcache_stat - objcache event counters
+ * @OCS_HIT:    alloc satisfied from the magazine
+ * @OCS_MISS:   alloc satisfied from the slab
+ * @OCS_FREE:   free absorbed by the magazine
+ * @OCS_SPILL:  free returned to the slab because the magazine was full
+ * @OCS_REMOTE: free returned to the slab because the object is node-remote
+ */
+enum objcache_stat {
+	OCS_HIT,
+	OCS_MISS,
+	OCS_FREE,
+	OCS_SPILL,
+	OCS_REMOTE,
+	OCS_MAX,
+};
+
+/**
+ * struct objcache_mag - per-cpu magazine of free objects
+ * @ocm_cnt:   number of valid entries in ocm_objv
+ * @ocm_objv:  free objects, consumed LIFO
+ * @ocm_statv: enum objcache_stat counters for this cpu
+ *
+ * A magazine is only ever accessed by its own cpu with interrupts
+ * disabled, as objects are freed from RCU callbacks.
+ */
+struct objcache_mag {
+	u32     ocm_cnt;
+	void   *ocm_objv[OBJCACHE_MAG_MAX];
+	u64     ocm_statv[OCS_MAX];
+} ____cacheline_aligned;
+
+/**
+ * struct objcache - slab cache with per-cpu magazines
+ * @oc_cache: backing slab cache, owned by the caller
+ * @oc_mag:   per-cpu magazines
+ * @oc_size:  object size
+ * @oc_name:  name shown in the objcache stats
+ * @oc_entry: objcache_list linkage
+ */
+struct objcache {
+	struct kmem_cache              *oc_cache;
+	struct objcache_mag __percpu   *oc_mag;
+	size_t                          oc_size;
+	const char                     *oc_name;
+	struct list_head                oc_entry;
+};
+
+/**
+ * objcache_init() - Put per-cpu magazines in front of a slab cache
+ * @oc:    objcache to initialize
+ * @cache: backing slab cache
+ * @size:  object size
+ * @name:  name shown in the objcache stats
+ */
+merr_t objcache_init(struct objcache *oc, struct kmem_cache *cache, size_t size, const char *name);
+
+/**
+ * objcache_fini() - Return all magazine objects to the slab and free the magazines
+ * @oc:
+ *
+ * The caller must ensure that no alloc or free is in progress, and remains
+ * responsible for destroying the backing slab cache.
+ */
+void objcache_fini(struct objcache *oc);
+
+/**
+ * objcache_alloc() - Allocate an object, preferably from this cpu's magazine
+ * @oc:
+ * @flags: GFP flags for the slab allocation on a magazine miss
+ * @zero:  true to zero the object
+ */
+void *objcache_alloc(struct objcache *oc, gfp_t flags, bool zero);
+
+/**
+ * objcache_free() - Free an object, preferably into this cpu's magazine
+ * @oc:
+ * @obj: object allocated from @oc, may be NULL
+ *
+ * May be called from softirq context.
+ */
+void objcache_free(struct objcache *oc, void *obj);
+
+/**
+ * objcache_stats_get() - Sum the per-cpu counters of an objcache
+ * @oc:
+ * @statv: receives OCS_MAX counters
+ */
+void objcache_stats_get(struct objcache *oc, u64 *statv);
+
+/**
+ * objcache_debugfs_init() - Create the "objcache" stats file
+ * @parent: debugfs directory, may be NULL
+ */
+void objcache_debugfs_init(struct dentry *parent);
+
+void objcache_debugfs_fini(void);
+
+#endif /* MPOOL_OBJCACHE_H */
@@ -13,6 +13,7 @@
  * All mpool metadata is versioned and stored on media in little-endian format.
  */
 
+#include <linux/string.h>
 #include <crypto/hash.h>
 
 #include "mpool_config.h"
@@ -35,6 +36,7 @@ static merr_t omf_dparm_unpack_letoh_v1(void *out, const char *inbuf);
 static merr_t omf_mdcrec_mcspare_unpack_letoh_v1(void *out, const char *inbuf);
 static merr_t omf_sb_unpack_letoh_v1(void *out, const char *inbuf);
 static merr_t omf_pmd_layout_unpack_letoh_v1(void *out, const char *inbuf);
+static merr_t omf_pmd_layout_unpack_letoh_v2(void *out, const char *inbuf);
 
 /*
  * layout_descriptor_table: track changes in OMF and in-memory layout descriptor
@@ -101,6 +103,13 @@ static struct upgrade_history mdcrec_data_ocreate_table[]
 		OMF_SB_DESC_UNDEF,
 		{ {1, 0, 0, 0} }
 	},
+	{
+		sizeof(struct omf_mdcrec_data),
+		omf_pmd_layout_unpack_letoh_v2,
+		NULL,
+		OMF_SB_DESC_UNDEF,
+		{ {1, 0, 0, 2} }
+	},
 };
 
 
@@ -505,9 +514,241 @@ omf_layout_unpack_letoh(
 	return ev(err);
 }
 
+/*
+ * varint
+ */
+
+/**
+ * omf_mdcver_varint() - Are object records varint encoded in this MDC content version
+ * @mdcver: NULL means latest MDC content version known by this binary
+ */
+static inline bool omf_mdcver_varint(struct omf_mdcver *mdcver)
+{
+	return omfu_mdcver_cmp2(mdcver ?: omfu_mdcver_cur(), ">=", 1, 0, 0, 2);
+}
+
+/**
+ * omf_mdcver_zip() - Can OCREATE/OUPDATE records flag compressed mblocks in
+ *	this MDC content version
+ * @mdcver: NULL means latest MDC content version known by this binary
+ */
+static inline bool omf_mdcver_zip(struct omf_mdcver *mdcver)
+{
+	return omfu_mdcver_cmp2(mdcver ?: omfu_mdcver_cur(), ">=", 1, 0, 0, 3);
+}
+
+/**
+ * omf_varint_pack() - pack val as an unsigned LEB128 varint into outbuf
+ * @val:
+ * @outbuf: must have room for OMF_VARINT_MAXLEN bytes
+ *
+ * Return: bytes packed
+ */
+static __always_inline int omf_varint_pack(u64 val, u8 *outbuf)
+{
+	int n = 0;
+
+	while (val >= 0x80) {
+		outbuf[n++] = (u8)val | 0x80;
+		val >>= 7;
+	}
+	outbuf[n++] = (u8)val;
+
+	return n;
+}
+
+/**
+ * omf_varint_unpack() - unpack an unsigned LEB128 varint from inbuf
+ * @inbuf:
+ * @end:   first byte past the end of the buffer holding inbuf
+ * @valp:  (output)
+ *
+ * Return: bytes unpacked, -EINVAL if the varint is longer than OMF_VARINT_MAXLEN
+ *	or runs past end
+ */
+static __always_inline int omf_varint_unpack(const u8 *inbuf, const u8 *end, u64 *valp)
+{
+	u64 val;
+	int n;
+
+	if (unlikely(inbuf >= end))
+		return -EINVAL;
+
+	/* Fast path for counts, deltas and small zone addresses. */
+	if (likely(inbuf[0] < 0x80)) {
+		*valp = inbuf[0];
+		return 1;
+	}
+
+	val = 0;
+
+	for (n = 0; n < OMF_VARINT_MAXLEN && inbuf + n < end; n++) {
+		val |= (u64)(inbuf[n] & 0x7f) << (7 * n);
+		if (!(inbuf[n] & 0x80)) {
+			*valp = val;
+			return n + 1;
+		}
+	}
+
+	return -EINVAL;
+}
+
+
 /*
  * pmd_layout
  */
+
+/**
+ * omf_pmd_layout_pack_htole_v2() - pack a varint-encoded OCREATE/OUPDATE record
+ * @mp:
+ * @rtype:
+ * @ecl:
+ * @base:   objid is packed as a delta from base, 0 outside of OCKPT records
+ * @outbuf:
+ *
+ * Return: bytes packed
+ */
+static int
+omf_pmd_layout_pack_htole_v2(
+	const struct mpool_descriptor  *mp,
+	u8                              rtype,
+	struct pmd_layout              *ecl,
+	u64                             base,
+	char                           *outbuf)
+{
+	u8 *data = (u8 *)outbuf;
+
+	*data++ = rtype;
+	*data++ = mp->pds_pdv[ecl->eld_ld.ol_pdh].pdi_mclass;
+
+	data += omf_varint_pack(ecl->eld_objid - base, data);
+	data += omf_varint_pack(ecl->eld_gen, data);
+
+	if (pmd_layout_zip(ecl)) {
+		data += omf_varint_pack(ecl->eld_mblen | OMF_MBLEN_ZIP, data);
+		data += omf_varint_pack(ecl->eld_zlen, data);
+	} else {
+		data += omf_varint_pack(ecl->eld_mblen, data);
+	}
+
+	data += omf_varint_pack(ecl->eld_ld.ol_zcnt, data);
+	data += omf_varint_pack(ecl->eld_ld.ol_zaddr, data);
+
+	if (objid_type(ecl->eld_objid) == OMF_OBJ_MLOG) {
+		memcpy(data, ecl->eld_uuid.uuid, OMF_UUID_PACKLEN);
+		data += OMF_UUID_PACKLEN;
+	}
+
+	return data - (u8 *)outbuf;
+}
+
+/**
+ * omf_pmd_layout_unpack_letoh_v2_base() - unpack a varint-encoded OCREATE/OUPDATE record
+ * @cdr:   output
+ * @inbuf:
+ * @inend: first byte past the end of the record buffer holding inbuf
+ * @base:  see omf_pmd_layout_pack_htole_v2()
+ *
+ * Return: bytes unpacked, -EINVAL if the record is malformed or truncated
+ */
+static int
+omf_pmd_layout_unpack_letoh_v2_base(
+	struct omf_mdcrec_data *cdr,
+	const char             *inbuf,
+	const char             *inend,
+	u64                     base)
+{
+	const u8 *data = (const u8 *)inbuf;
+	const u8 *end = (const u8 *)inend;
+	u64       objid, gen, mblen, zlen, zcnt, zaddr;
+	int       n;
+
+	if (end - data < 2)
+		return -EINVAL;
+
+	cdr->omd_rtype = *data++;
+	if (cdr->omd_rtype != OMF_MDR_OCREATE && cdr->omd_rtype != OMF_MDR_OUPDATE)
+		return -EINVAL;
+
+	cdr->u.obj.omd_mclass = *data++;
+
+	n = omf_varint_unpack(data, end, &objid);
+	if (n < 0)
+		return n;
+	data += n;
+
+	n = omf_varint_unpack(data, end, &gen);
+	if (n < 0)
+		return n;
+	data += n;
+
+	n = omf_varint_unpack(data, end, &mblen);
+	if (n < 0)
+		return n;
+	data += n;
+
+	zlen = 0;
+	if (mblen & OMF_MBLEN_ZIP) {
+		n = omf_varint_unpack(data, end, &zlen);
+		if (n < 0 || zlen > U32_MAX || objid_type(objid) != OMF_OBJ_MBLOCK)
+			return -EINVAL;
+		data += n;
+	}
+
+	n = omf_varint_unpack(data, end, &zcnt);
+	if (n < 0 || zcnt > U32_MAX)
+		return -EINVAL;
+	data += n;
+
+	n = omf_varint_unpack(data, end, &zaddr);
+	if (n < 0)
+		return n;
+	data += n;
+
+	cdr->u.obj.omd_objid = objid + base;
+	cdr->u.obj.omd_gen   = gen;
+	cdr->u.obj.omd_mblen = mblen;
+	cdr->u.obj.omd_zlen  = zlen;
+	cdr->u.obj.omd_old.ol_zcnt  = zcnt;
+	cdr->u.obj.omd_old.ol_zaddr = zaddr;
+
+	if (objid_type(cdr->u.obj.omd_objid) == OMF_OBJ_MLOG) {
+		if (end - data < OMF_UUID_PACKLEN)
+			return -EINVAL;
+
+		memcpy(cdr->u.obj.omd_uuid.uuid, data, OMF_UUID_PACKLEN);
+		data += OMF_UUID_PACKLEN;
+	}
+
+	return data - (const u8 *)inbuf;
+}
+
+/**
+ * omf_pmd_layout_unpack_letoh_v2() - Unpack little-endian mdc obj record and
+ *	optional obj layout from inbuf.
+ * For version 2 of OMF_MDR_OCREATE record (varint encoded)
+ * @out:
+ * @inbuf: start of an MDC record buffer of OMF_MDCREC_PACKLEN_MAX bytes
+ *
+ * Return:
+ *   0 if successful
+ *   merr_t(EINVAL) if invalid record type or format
+ */
+static merr_t omf_pmd_layout_unpack_letoh_v2(void *out, const char *inbuf)
+{
+	struct omf_mdcrec_data *cdr = out;
+
+	merr_t err;
+
+	if (omf_pmd_layout_unpack_letoh_v2_base(cdr, inbuf, inbuf + OMF_MDCREC_PACKLEN_MAX, 0) < 0) {
+		err = merr(EINVAL);
+		mp_pr_err("Unpacking layout failed, malformed record type %d", err, (u8)*inbuf);
+		return err;
+	}
+
+	return 0;
+}
+
 static int
 omf_pmd_layout_pack_htole(
 	const struct mpool_descriptor  *mp,
@@ -524,6 +765,12 @@ omf_pmd_layout_pack_htole(
 		return -EINVAL;
 	}
 
+	if (pmd_layout_zip(ecl)) {
+		mp_pr_warn("mpool %s, compressed mblock 0x%lx in old MDC content version",
+			   mp->pds_name, (ulong)ecl->eld_objid);
+		return -EINVAL;
+	}
+
 	data_rec_sz = sizeof(*ocre_omf);
 
 	ocre_omf = (struct mdcrec_data_ocreate_omf *)outbuf;
@@ -576,6 +823,7 @@ static merr_t omf_pmd_layout_unpack_letoh_v1(void *out, const char *inbuf)
 	cdr->u.obj.omd_objid = omf_pdrc_objid(ocre_omf);
 	cdr->u.obj.omd_gen   = omf_pdrc_gen(ocre_omf);
 	cdr->u.obj.omd_mblen = omf_pdrc_mblen(ocre_omf);
+	cdr->u.obj.omd_zlen  = 0;
 
 	if (objid_type(cdr->u.obj.omd_objid) == OMF_OBJ_MLOG)
 		memcpy(cdr->u.obj.omd_uuid.uuid, ocre_omf->pdrc_uuid, OMF_UUID_PACKLEN);
@@ -590,50 +838,26 @@ static merr_t omf_pmd_layout_unpack_letoh_v1(void *out, const char *inbuf)
 
 
 /**
- * omf_pmd_layout_unpack_letoh() - Unpack little-endian mdc obj record and
- *	optional obj layout from inbuf.
- *	Allocate object layout.
- * For version 1 of OMF_MDR_OCREATE record (strut layout_descriptor_omf)
+ * omf_pmd_layout_make() - Allocate the object layout of an unpacked
+ *	OCREATE/OUPDATE record.
  * @mp:
- * @mdcver: version of the mpool MDC content being unpacked.
- * @rtype:
- * @cdr: output
- * @inbuf:
+ * @cdr: cdr->u.obj.omd_layout is set on success
  *
  * Return:
  *   0 if successful
  *   merr_t with one of the following errno values upon failure:
- *   EINVAL if invalid record type or format
  *   ENOMEM if cannot alloc memory to return an object layout
  *   ENOENT if cannot convert a devid to a device handle (pdh)
  */
-static merr_t
-omf_pmd_layout_unpack_letoh(
-	struct mpool_descriptor    *mp,
-	struct omf_mdcver          *mdcver,
-	enum mdcrec_type_omf        rtype,
-	struct omf_mdcrec_data     *cdr,
-	const char                 *inbuf)
+static merr_t omf_pmd_layout_make(struct mpool_descriptor *mp, struct omf_mdcrec_data *cdr)
 {
 	struct pmd_layout *ecl;
 
 	merr_t err;
 	int    i;
 
-	err = omf_unpack_letoh_and_convert(cdr, sizeof(*cdr), inbuf, mdcrec_data_ocreate_table,
-					   ARRAY_SIZE(mdcrec_data_ocreate_table),
-					   OMF_SB_DESC_UNDEF, mdcver);
-	if (ev(err)) {
-		char buf[MAX_MDCVERSTR];
-
-		omfu_mdcver_to_str(mdcver, buf, sizeof(buf));
-		mp_pr_err("mpool %s, unpacking layout failed for mdc content version %s",
-			  err, mp->pds_name, buf);
-		return err;
-	}
-
 	ecl = pmd_layout_alloc(mp, &cdr->u.obj.omd_uuid, cdr->u.obj.omd_objid, cdr->u.obj.omd_gen,
-			       cdr->u.obj.omd_mblen, cdr->u.obj.omd_old.ol_zcnt);
+			       cdr->u.obj.omd_mblen & ~OMF_MBLEN_ZIP, cdr->u.obj.omd_old.ol_zcnt);
 	if (!ecl) {
 		err = merr(ENOMEM);
 		mp_pr_err("mpool %s, unpacking layout failed, could not allocate layout structure",
@@ -643,6 +867,11 @@ omf_pmd_layout_unpack_letoh(
 
 	ecl->eld_ld.ol_zaddr = cdr->u.obj.omd_old.ol_zaddr;
 
+	if (cdr->u.obj.omd_mblen & OMF_MBLEN_ZIP) {
+		ecl->eld_flags |= PMD_MB_ZIP;
+		ecl->eld_zlen = cdr->u.obj.omd_zlen;
+	}
+
 	for (i = 0; i < mp->pds_pdvcnt; i++) {
 		if (mp->pds_pdv[i].pdi_mclass == cdr->u.obj.omd_mclass) {
 			ecl->eld_ld.ol_pdh = i;
@@ -661,7 +890,49 @@ omf_pmd_layout_unpack_letoh(
 
 	cdr->u.obj.omd_layout = ecl;
 
-	return err;
+	return 0;
+}
+
+/**
+ * omf_pmd_layout_unpack_letoh() - Unpack little-endian mdc obj record and
+ *	optional obj layout from inbuf.
+ *	Allocate object layout.
+ * @mp:
+ * @mdcver: version of the mpool MDC content being unpacked.
+ * @rtype:
+ * @cdr: output
+ * @inbuf:
+ *
+ * Return:
+ *   0 if successful
+ *   merr_t with one of the following errno values upon failure:
+ *   EINVAL if invalid record type or format
+ *   ENOMEM if cannot alloc memory to return an object layout
+ *   ENOENT if cannot convert a devid to a device handle (pdh)
+ */
+static merr_t
+omf_pmd_layout_unpack_letoh(
+	struct mpool_descriptor    *mp,
+	struct omf_mdcver          *mdcver,
+	enum mdcrec_type_omf        rtype,
+	struct omf_mdcrec_data     *cdr,
+	const char                 *inbuf)
+{
+	merr_t err;
+
+	err = omf_unpack_letoh_and_convert(cdr, sizeof(*cdr), inbuf, mdcrec_data_ocreate_table,
+					   ARRAY_SIZE(mdcrec_data_ocreate_table),
+					   OMF_SB_DESC_UNDEF, mdcver);
+	if (ev(err)) {
+		char buf[MAX_MDCVERSTR];
+
+		omfu_mdcver_to_str(mdcver, buf, sizeof(buf));
+		mp_pr_err("mpool %s, unpacking layout failed for mdc content version %s",
+			  err, mp->pds_name, buf);
+		return err;
+	}
+
+	return omf_pmd_layout_make(mp, cdr);
 }
 
 
@@ -703,6 +974,93 @@ static merr_t omf_cksum_crc32c_le(const char *dbuf, u64 dlen, u8 *obuf)
 	return merr(rc);
 }
 
+/*
+ * Compressed mblock trailer
+ */
+
+merr_t
+omf_mblock_ztrail_pack_htole(
+	char       *outbuf,
+	u32         chunksz,
+	u32         zlen,
+	const u32  *clenv,
+	u32         chunkc)
+{
+	struct mblock_zfoot_omf *zf;
+	__le32                  *idx;
+	size_t                   len;
+	u32                      i;
+
+	len = OMF_MBLOCK_ZTRAIL_LEN(chunkc);
+	zf = (struct mblock_zfoot_omf *)(outbuf + len - sizeof(*zf));
+	idx = (__le32 *)zf - chunkc;
+
+	memset(outbuf, 0, (char *)idx - outbuf);
+
+	for (i = 0; i < chunkc; i++)
+		idx[i] = cpu_to_le32(clenv[i]);
+
+	omf_set_pdzf_magic(zf, OMF_MBLOCK_ZMAGIC);
+	omf_set_pdzf_chunksz(zf, chunksz);
+	omf_set_pdzf_chunkc(zf, chunkc);
+	omf_set_pdzf_zlen(zf, zlen);
+
+	return omf_cksum_crc32c_le((char *)idx, (char *)&zf->pdzf_cksum - (char *)idx,
+				   (u8 *)&zf->pdzf_cksum);
+}
+
+merr_t omf_mblock_zfoot_unpack_letoh(const char *inbuf, u32 *chunkszp, u32 *zlenp, u32 *chunkcp)
+{
+	const struct mblock_zfoot_omf *zf;
+	u32                            chunksz, zlen, chunkc;
+
+	zf = (const struct mblock_zfoot_omf *)(inbuf + PAGE_SIZE - sizeof(*zf));
+
+	if (omf_pdzf_magic(zf) != OMF_MBLOCK_ZMAGIC)
+		return merr(EINVAL);
+
+	chunksz = omf_pdzf_chunksz(zf);
+	zlen = omf_pdzf_zlen(zf);
+	chunkc = omf_pdzf_chunkc(zf);
+
+	if (!is_power_of_2(chunksz) || chunksz < PAGE_SIZE || chunksz > OMF_MBLOCK_ZCHUNK_MAX ||
+	    !PAGE_ALIGNED(zlen) || chunkc != DIV_ROUND_UP(zlen, chunksz))
+		return merr(EINVAL);
+
+	*chunkszp = chunksz;
+	*zlenp = zlen;
+	*chunkcp = chunkc;
+
+	return 0;
+}
+
+merr_t omf_mblock_ztrail_unpack_letoh(const char *inbuf, u32 chunkc, u32 *clenv)
+{
+	const struct mblock_zfoot_omf *zf;
+	const __le32                  *idx;
+	size_t                         len;
+	merr_t                         err;
+	u8                             cksum[4];
+	u32                            i;
+
+	len = OMF_MBLOCK_ZTRAIL_LEN(chunkc);
+	zf = (const struct mblock_zfoot_omf *)(inbuf + len - sizeof(*zf));
+	idx = (const __le32 *)zf - chunkc;
+
+	err = omf_cksum_crc32c_le((const char *)idx,
+				  (const char *)&zf->pdzf_cksum - (const char *)idx, cksum);
+	if (ev(err))
+		return err;
+
+	if (memcmp(cksum, &zf->pdzf_cksum, sizeof(cksum)))
+		return merr(EINVAL);
+
+	for (i = 0; i < chunkc; i++)
+		clenv[i] = le32_to_cpu(idx[i]);
+
+	return 0;
+}
+
 struct omf_mdcver *omf_sbver_to_mdcver(enum sb_descriptor_ver_omf sbver)
 {
 	struct upgrade_history *uhtab;
@@ -890,9 +1248,61 @@ bool omf_sb_has_magic_le(const char *inbuf)
  * mdcrec_objcmn
  */
 
+/**
+ * omf_mdcrec_objcmn_pack_htole_v2() - pack varint-encoded ODELETE, OIDCKPT
+ *	or OERASE mdc obj record
+ * @cdr:
+ * @outbuf:
+ *
+ * Return: bytes packed
+ */
+static int omf_mdcrec_objcmn_pack_htole_v2(struct omf_mdcrec_data *cdr, char *outbuf)
+{
+	u8 *data = (u8 *)outbuf;
+
+	*data++ = cdr->omd_rtype;
+	data += omf_varint_pack(cdr->u.obj.omd_objid, data);
+
+	if (cdr->omd_rtype == OMF_MDR_OERASE)
+		data += omf_varint_pack(cdr->u.obj.omd_gen, data);
+
+	return data - (u8 *)outbuf;
+}
+
+/**
+ * omf_mdcrec_objcmn_unpack_letoh_v2() - unpack varint-encoded ODELETE,
+ *	OIDCKPT or OERASE mdc obj record
+ * @cdr:
+ * @inbuf: start of an MDC record buffer of OMF_MDCREC_PACKLEN_MAX bytes
+ *
+ * Return: 0 if successful, merr_t(EINVAL) if the record is malformed
+ */
+static merr_t omf_mdcrec_objcmn_unpack_letoh_v2(struct omf_mdcrec_data *cdr, const char *inbuf)
+{
+	const u8 *data = (const u8 *)inbuf;
+	const u8 *end = data + OMF_MDCREC_PACKLEN_MAX;
+	int       n;
+
+	cdr->omd_rtype = *data++;
+
+	n = omf_varint_unpack(data, end, &cdr->u.obj.omd_objid);
+	if (n < 0)
+		return merr(EINVAL);
+	data += n;
+
+	if (cdr->omd_rtype == OMF_MDR_OERASE) {
+		n = omf_varint_unpack(data, end, &cdr->u.obj.omd_gen);
+		if (n < 0)
+			return merr(EINVAL);
+	}
+
+	return 0;
+}
+
 /**
  * omf_mdcrec_objcmn_pack_htole() - pack mdc obj record
  * @mp:
+ * @mdcver: version of the mpool MDC content being packed.
  * @cdr:
  * @outbuf:
  *
@@ -901,13 +1311,23 @@ bool omf_sb_has_magic_le(const char *inbuf)
  * Return: bytes packed if successful, -EINVAL otherwise
  */
 static u64
-omf_mdcrec_objcmn_pack_htole(struct mpool_descriptor *mp, struct omf_mdcrec_data *cdr, char *outbuf)
+omf_mdcrec_objcmn_pack_htole(
+	struct mpool_descriptor    *mp,
+	struct omf_mdcver          *mdcver,
+	struct omf_mdcrec_data     *cdr,
+	char                       *outbuf)
 {
 	struct pmd_layout *layout = cdr->u.obj.omd_layout;
 	struct mdcrec_data_odelete_omf *odel_omf;
 	struct mdcrec_data_oerase_omf  *oera_omf;
 
 	s64    bytes = 0;
+	bool   varint;
+
+	varint = omf_mdcver_varint(mdcver);
+
+	if (varint && cdr->omd_rtype != OMF_MDR_OCREATE && cdr->omd_rtype != OMF_MDR_OUPDATE)
+		return omf_mdcrec_objcmn_pack_htole_v2(cdr, outbuf);
 
 	switch (cdr->omd_rtype) {
 	case OMF_MDR_ODELETE:
@@ -940,6 +1360,15 @@ omf_mdcrec_objcmn_pack_htole(struct mpool_descriptor *mp, struct omf_mdcrec_data
 		return ev(-EINVAL);
 	}
 
+	if (pmd_layout_zip(layout) && !omf_mdcver_zip(mdcver)) {
+		mp_pr_warn("mpool %s, compressed mblock 0x%lx in old MDC content version",
+			   mp->pds_name, (ulong)layout->eld_objid);
+		return ev(-EINVAL);
+	}
+
+	if (varint)
+		return omf_pmd_layout_pack_htole_v2(mp, cdr->omd_rtype, layout, 0, outbuf);
+
 	bytes = omf_pmd_layout_pack_htole(mp, cdr->omd_rtype, layout, outbuf);
 	if (bytes < 0)
 		return ev(-EINVAL);
@@ -981,6 +1410,14 @@ omf_mdcrec_objcmn_unpack_letoh(
 	 */
 	rtype = omf_pdro_rtype((struct mdcrec_data_odelete_omf *)inbuf);
 
+	if (omf_mdcver_varint(mdcver) && rtype != OMF_MDR_OCREATE && rtype != OMF_MDR_OUPDATE) {
+		err = omf_mdcrec_objcmn_unpack_letoh_v2(cdr, inbuf);
+		if (err)
+			mp_pr_err("mpool %s, malformed object record type %d",
+				  err, mp->pds_name, rtype);
+		return err;
+	}
+
 	switch (rtype) {
 	case OMF_MDR_ODELETE:
 	case OMF_MDR_OIDCKPT:
@@ -1247,19 +1684,180 @@ int omf_mdcrec_isobj_le(const char *inbuf)
 	/* rtype is byte so no endian conversion */
 	const u8 rtype = inbuf[0];
 
-	return mdcrec_type_objcmn(rtype);
+	return mdcrec_type_objcmn(rtype) || rtype == OMF_MDR_OCKPT;
+}
+
+
+/*
+ * mdcrec_ockpt
+ */
+
+/**
+ * omf_mdcrec_ockpt_pack_htole() - pack a batch of committed objects
+ * @mp:
+ * @mdcver: version of the mpool MDC content being packed.
+ * @cdr:
+ * @outbuf:
+ *
+ * From MDC content version 1.0.0.2 the objids of the batch are packed as
+ * the delta from the previous entry, which being in objid order, mostly
+ * fit in one or two bytes.
+ *
+ * Return: bytes packed if successful, -EINVAL otherwise
+ */
+static int
+omf_mdcrec_ockpt_pack_htole(
+	struct mpool_descriptor    *mp,
+	struct omf_mdcver          *mdcver,
+	struct omf_mdcrec_data     *cdr,
+	char                       *outbuf)
+{
+	struct mdcrec_data_ockpt_omf   *ckpt_omf;
+	struct pmd_layout              *layout;
+
+	int    bytes, i;
+	char  *data;
+	u64    base = 0;
+	bool   varint;
+
+	if (cdr->u.ckpt.omd_layoutc > OMF_MDCREC_CKPT_MAX)
+		return ev(-EINVAL);
+
+	ckpt_omf = (struct mdcrec_data_ockpt_omf *)outbuf;
+	omf_set_pdck_rtype(ckpt_omf, OMF_MDR_OCKPT);
+	omf_set_pdck_cnt(ckpt_omf, cdr->u.ckpt.omd_layoutc);
+	ckpt_omf->pdck_pad[0] = 0;
+
+	data = ckpt_omf->pdck_data;
+	varint = omf_mdcver_varint(mdcver);
+
+	for (i = 0; i < cdr->u.ckpt.omd_layoutc; i++) {
+		layout = cdr->u.ckpt.omd_layoutv[i];
+
+		if (pmd_layout_zip(layout) && !omf_mdcver_zip(mdcver))
+			return ev(-EINVAL);
+
+		if (varint) {
+			data += omf_pmd_layout_pack_htole_v2(mp, OMF_MDR_OCREATE, layout, base, data);
+			base = layout->eld_objid;
+			continue;
+		}
+
+		bytes = omf_pmd_layout_pack_htole(mp, OMF_MDR_OCREATE, layout, data);
+		if (bytes < 0)
+			return ev(-EINVAL);
+
+		data += bytes;
+	}
+
+	return data - outbuf;
+}
+
+/**
+ * omf_mdcrec_ockpt_unpack_letoh() - unpack a batch of committed objects
+ * @mp:
+ * @mdcver:
+ * @cdr:    cdr->u.ckpt.omd_layoutv must be supplied by the caller
+ * @inbuf:
+ *
+ * On failure, cdr->u.ckpt.omd_layoutc is the number of layouts that were
+ * allocated before the failure, which the caller must free.
+ */
+static merr_t
+omf_mdcrec_ockpt_unpack_letoh(
+	struct mpool_descriptor    *mp,
+	struct omf_mdcver          *mdcver,
+	struct omf_mdcrec_data     *cdr,
+	const char                 *inbuf)
+{
+	struct mdcrec_data_ockpt_omf   *ckpt_omf;
+	struct mdcrec_data_ocreate_omf *ocre_omf;
+	struct omf_mdcrec_data          ocdr;
+
+	const char *data;
+	merr_t      err;
+	u16         cnt, i;
+
+	ckpt_omf = (struct mdcrec_data_ockpt_omf *)inbuf;
+
+	cdr->omd_rtype = OMF_MDR_OCKPT;
+	cdr->u.ckpt.omd_layoutc = 0;
+
+	cnt = omf_pdck_cnt(ckpt_omf);
+	if (cnt > OMF_MDCREC_CKPT_MAX) {
+		err = merr(EINVAL);
+		mp_pr_err("mpool %s, invalid checkpoint record count %u", err, mp->pds_name, cnt);
+		return err;
+	}
+
+	data = ckpt_omf->pdck_data;
+
+	if (omf_mdcver_varint(mdcver)) {
+		const char *end = inbuf + OMF_MDCREC_PACKLEN_MAX;
+		u64         base = 0;
+		int         bytes;
+
+		for (i = 0; i < cnt; i++) {
+			bytes = omf_pmd_layout_unpack_letoh_v2_base(&ocdr, data, end, base);
+			if (bytes < 0 || ocdr.omd_rtype != OMF_MDR_OCREATE) {
+				err = merr(EINVAL);
+				mp_pr_err("mpool %s, malformed checkpoint record entry %u",
+					  err, mp->pds_name, i);
+				return err;
+			}
+
+			err = omf_pmd_layout_make(mp, &ocdr);
+			if (ev(err))
+				return err;
+
+			cdr->u.ckpt.omd_layoutv[cdr->u.ckpt.omd_layoutc++] = ocdr.u.obj.omd_layout;
+
+			base = ocdr.u.obj.omd_objid;
+			data += bytes;
+		}
+
+		return 0;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		ocre_omf = (struct mdcrec_data_ocreate_omf *)data;
+
+		if (omf_pdrc_rtype(ocre_omf) != OMF_MDR_OCREATE) {
+			err = merr(EINVAL);
+			mp_pr_err("mpool %s, invalid checkpoint record entry type %u",
+				  err, mp->pds_name, omf_pdrc_rtype(ocre_omf));
+			return err;
+		}
+
+		err = omf_pmd_layout_unpack_letoh(mp, mdcver, OMF_MDR_OCREATE, &ocdr, data);
+		if (ev(err))
+			return err;
+
+		cdr->u.ckpt.omd_layoutv[cdr->u.ckpt.omd_layoutc++] = ocdr.u.obj.omd_layout;
+
+		data += sizeof(*ocre_omf);
+		if (objid_type(omf_pdrc_objid(ocre_omf)) == OMF_OBJ_MLOG)
+			data += OMF_UUID_PACKLEN;
+	}
+
+	return 0;
 }
 
 
 /*
  * mdcrec
  */
-int omf_mdcrec_pack_htole(struct mpool_descriptor *mp, struct omf_mdcrec_data *cdr, char *outbuf)
+int
+omf_mdcrec_pack_htole(
+	struct mpool_descriptor    *mp,
+	struct omf_mdcver          *mdcver,
+	struct omf_mdcrec_data     *cdr,
+	char                       *outbuf)
 {
 	u8 rtype = (char)cdr->omd_rtype;
 
 	if (mdcrec_type_objcmn(rtype))
-		return omf_mdcrec_objcmn_pack_htole(mp, cdr, outbuf);
+		return omf_mdcrec_objcmn_pack_htole(mp, mdcver, cdr, outbuf);
 	else if (rtype == OMF_MDR_VERSION)
 		return omf_mdcver_pack_htole(cdr, outbuf);
 	else if (rtype == OMF_MDR_MCCONFIG)
@@ -1268,6 +1866,8 @@ int omf_mdcrec_pack_htole(struct mpool_descriptor *mp, struct omf_mdcrec_data *c
 		return omf_mdcrec_mcspare_pack_htole(cdr, outbuf);
 	else if (rtype == OMF_MDR_MPCONFIG)
 		return omf_mdcrec_mpconfig_pack_htole(cdr, outbuf);
+	else if (rtype == OMF_MDR_OCKPT)
+		return omf_mdcrec_ockpt_pack_htole(mp, mdcver, cdr, outbuf);
 
 	mp_pr_warn("mpool %s, invalid record type %u in mdc log", mp->pds_name, rtype);
 
@@ -1295,6 +1895,8 @@ omf_mdcrec_unpack_letoh(
 		omf_mdcrec_mcspare_unpack_letoh(cdr, inbuf, OMF_SB_DESC_UNDEF, mdcver);
 	else if (rtype == OMF_MDR_MPCONFIG)
 		omf_mdcrec_mpconfig_unpack_letoh(cdr, inbuf);
+	else if (rtype == OMF_MDR_OCKPT)
+		return omf_mdcrec_ockpt_unpack_letoh(mp, mdcver, cdr, inbuf);
 	else {
 		mp_pr_warn("mpool %s, unknown record type %u in mdc log", mp->pds_name, rtype);
 		return merr(EINVAL);
@@ -1315,17 +1917,18 @@ u8 omf_mdcrec_unpack_type_letoh(const char *inbuf)
  */
 bool omf_logblock_empty_le(char *lbuf)
 {
-	bool   ret_val = true;
-	int    i       = 0;
+	return !memchr_inv(lbuf, 0, OMF_LOGBLOCK_HDR_PACKLEN);
+}
+
+bool omf_logblock_erased_le(const char *lbuf, size_t len)
+{
+	u8 c = (u8)lbuf[0];
 
-	for (i = 0; i < OMF_LOGBLOCK_HDR_PACKLEN; i++) {
-		if (0 != (u8)lbuf[i]) {
-			ret_val = false;
-			break;
-		}
-	}
+	/* Most written log blocks are rejected on their first byte */
+	if (c != 0 && c != 0xff)
+		return false;
 
-	return ret_val;
+	return !memchr_inv(lbuf, c, len);
 }
 
 merr_t omf_logblock_header_pack_htole(struct omf_logblock_header *lbh, char *outbuf)
@@ -1339,6 +1942,8 @@ merr_t omf_logblock_header_pack_htole(struct omf_logblock_header *lbh, char *out
 
 	omf_set_polh_vers(lbh_omf, lbh->olh_vers);
 	omf_set_polh_magic(lbh_omf, lbh->olh_magic.uuid, MPOOL_UUID_SIZE);
+	omf_set_polh_flags(lbh_omf, 0);
+	omf_set_polh_cksum(lbh_omf, 0);
 	omf_set_polh_gen(lbh_omf, lbh->olh_gen);
 	omf_set_polh_pfsetid(lbh_omf, lbh->olh_pfsetid);
 	omf_set_polh_cfsetid(lbh_omf, lbh->olh_cfsetid);
@@ -1346,6 +1951,88 @@ merr_t omf_logblock_header_pack_htole(struct omf_logblock_header *lbh, char *out
 	return 0;
 }
 
+/*
+ * omf_logblock_cksum_le() -
+ *
+ * Compute the CRC32C of log block lbuf as if polh_cksum were zero, so that
+ * the checksum can be recomputed in place on the read side. The descriptor
+ * lives on the stack as this runs once per sector on every mlog flush.
+ */
+static merr_t omf_logblock_cksum_le(const char *lbuf, u16 lbsz, u32 *cksum)
+{
+	SHASH_DESC_ON_STACK(desc, mpool_tfm);
+	const size_t    off = offsetof(struct logblock_header_omf, polh_cksum);
+	const size_t    len = sizeof(((struct logblock_header_omf *)0)->polh_cksum);
+	static const u8 zero[4];
+	__le32          crc;
+	int             rc;
+
+	BUILD_BUG_ON(sizeof(zero) != len);
+
+	if (lbsz < OMF_LOGBLOCK_HDR_PACKLEN)
+		return merr(EINVAL);
+
+	desc->tfm = mpool_tfm;
+
+	rc = crypto_shash_init(desc);
+	if (!rc)
+		rc = crypto_shash_update(desc, (const u8 *)lbuf, off);
+	if (!rc)
+		rc = crypto_shash_update(desc, zero, len);
+	if (!rc)
+		rc = crypto_shash_finup(desc, (const u8 *)lbuf + off + len, lbsz - off - len,
+					(u8 *)&crc);
+
+	shash_desc_zero(desc);
+
+	if (rc)
+		return merr(rc);
+
+	*cksum = le32_to_cpu(crc);
+
+	return 0;
+}
+
+merr_t omf_logblock_cksum_set_le(char *lbuf, u16 lbsz)
+{
+	struct logblock_header_omf *lbh_omf;
+	merr_t                      err;
+	u32                         cksum;
+
+	lbh_omf = (struct logblock_header_omf *)lbuf;
+
+	omf_set_polh_flags(lbh_omf, omf_polh_flags(lbh_omf) | OMF_LOGBLOCK_F_CRC32C);
+
+	err = omf_logblock_cksum_le(lbuf, lbsz, &cksum);
+	if (ev(err))
+		return err;
+
+	omf_set_polh_cksum(lbh_omf, cksum);
+
+	return 0;
+}
+
+merr_t omf_logblock_cksum_check_le(const char *lbuf, u16 lbsz)
+{
+	const struct logblock_header_omf *lbh_omf;
+	merr_t                            err;
+	u32                               cksum;
+
+	lbh_omf = (const struct logblock_header_omf *)lbuf;
+
+	if (!(omf_polh_flags(lbh_omf) & OMF_LOGBLOCK_F_CRC32C))
+		return 0;
+
+	err = omf_logblock_cksum_le(lbuf, lbsz, &cksum);
+	if (ev(err))
+		return err;
+
+	if (cksum != omf_polh_cksum(lbh_omf))
+		return merr(EBADMSG);
+
+	return 0;
+}
+
 merr_t omf_logblock_header_unpack_letoh(struct omf_logblock_header *lbh, const char *inbuf)
 {
 	struct logblock_header_omf *lbh_omf;
@@ -250,6 +250,9 @@ OMF_SETGET(struct logrec_descriptor_omf, polr_rtype, 8)
  *
  * @polh_vers:    log block hdr version, offset 0 in all vers
  * @polh_magic:   unique magic per mlog
+ * @polh_flags:   enum logblock_flags_omf
+ * @polh_cksum:   CRC32C of the log block with this field zeroed, if
+ *                OMF_LOGBLOCK_F_CRC32C is set
  * @polh_pfsetid: flush set ID of the previous log block
  * @polh_cfsetid: flush set ID this log block belongs to
  * @polh_gen:     generation number
@@ -257,7 +260,8 @@ OMF_SETGET(struct logrec_descriptor_omf, polr_rtype, 8)
 struct logblock_header_omf {
 	__le16 polh_vers;
 	u8     polh_magic[OMF_UUID_PACKLEN];
-	u8     polh_pad[6];
+	__le16 polh_flags;
+	__le32 polh_cksum;
 	__le32 polh_pfsetid;
 	__le32 polh_cfsetid;
 	__le64 polh_gen;
@@ -266,12 +270,25 @@ struct logblock_header_omf {
 /* Define set/get methods for logblock_header_omf */
 OMF_SETGET(struct logblock_header_omf, polh_vers, 16)
 OMF_SETGET_CHBUF(struct logblock_header_omf, polh_magic)
+OMF_SETGET(struct logblock_header_omf, polh_flags, 16)
+OMF_SETGET(struct logblock_header_omf, polh_cksum, 32)
 OMF_SETGET(struct logblock_header_omf, polh_pfsetid, 32)
 OMF_SETGET(struct logblock_header_omf, polh_cfsetid, 32)
 OMF_SETGET(struct logblock_header_omf, polh_gen, 64)
 /* On-media log block header length */
 #define OMF_LOGBLOCK_HDR_PACKLEN (sizeof(struct logblock_header_omf))
 
+/**
+ * enum logblock_flags_omf -
+ * @OMF_LOGBLOCK_F_CRC32C: polh_cksum holds a CRC32C of the log block
+ *
+ * Log blocks written before checksums were introduced have zero flags,
+ * so they are still readable and are simply not verified.
+ */
+enum logblock_flags_omf {
+	OMF_LOGBLOCK_F_CRC32C = 0x1,
+};
+
 
 /*
  * Metadata container (mdc) mlog data record formats.
@@ -292,6 +309,7 @@ OMF_SETGET(struct logblock_header_omf, polh_gen, 64)
  * @OMF_MDR_MCSPARE:  media class spare zones set
  * @OMF_MDR_VERSION:  MDC content version.
  * @OMF_MDR_MPCONFIG:  mpool config record
+ * @OMF_MDR_OCKPT:    batch of committed objects, written by MDC compaction
  */
 enum mdcrec_type_omf {
 	OMF_MDR_UNDEF       = 0,
@@ -304,7 +322,8 @@ enum mdcrec_type_omf {
 	OMF_MDR_MCSPARE     = 7,
 	OMF_MDR_VERSION     = 8,
 	OMF_MDR_MPCONFIG    = 9,
-	OMF_MDR_MAX         = 10,
+	OMF_MDR_OCKPT       = 10,
+	OMF_MDR_MAX         = 11,
 };
 
 /**
@@ -451,6 +470,98 @@ OMF_SETGET(struct mdcrec_data_ocreate_omf, pdrc_mblen, 64)
 #define OMF_MDCREC_OBJCMN_PACKLEN (sizeof(struct mdcrec_data_ocreate_omf) + \
 				   OMF_UUID_PACKLEN)
 
+/*
+ * From MDC content version 1.0.0.2 the object records are no longer packed
+ * as the fixed width structures above but as a sequence of unsigned LEB128
+ * varints, preceded by the record type:
+ *
+ * OMF_MDR_OCREATE, OMF_MDR_OUPDATE:
+ *	u8 rtype, u8 mclass, objid, gen, mblen, zcnt, zaddr, [uuid]
+ *	uuid is the raw OMF_UUID_PACKLEN bytes, present only for mlogs
+ * OMF_MDR_ODELETE, OMF_MDR_OIDCKPT:
+ *	u8 rtype, objid
+ * OMF_MDR_OERASE:
+ *	u8 rtype, objid, gen
+ *
+ * OMF_MDR_OCKPT keeps struct mdcrec_data_ockpt_omf, with pdck_data[] holding
+ * varint OCREATE records whose objid is the delta from the previous entry.
+ *
+ * From MDC content version 1.0.0.3 OMF_MBLEN_ZIP set in the mblen of an mblock
+ * flags a compressed mblock, and mblen is then followed by zlen, the length of
+ * the uncompressed data:
+ *	u8 rtype, u8 mclass, objid, gen, mblen | OMF_MBLEN_ZIP, zlen, zcnt, zaddr
+ * Mblock lengths fit in 32 bits, so the flag can't be mistaken for a length.
+ */
+#define OMF_VARINT_MAXLEN        10
+#define OMF_MBLEN_ZIP            (1ull << 32)
+#define OMF_MDCREC_OBJCMN_VARINT_PACKLEN \
+	((size_t)(2 + 4 * OMF_VARINT_MAXLEN + 5 + OMF_UUID_PACKLEN))
+
+/**
+ * struct mblock_zfoot_omf - footer of a compressed mblock
+ * "pdzf_" = packed data compressed mblock footer
+ *
+ * @pdzf_magic:   OMF_MBLOCK_ZMAGIC
+ * @pdzf_chunksz: uncompressed bytes per chunk, a power of 2 multiple of PAGE_SIZE
+ * @pdzf_chunkc:  number of chunks
+ * @pdzf_zlen:    length of the uncompressed data
+ * @pdzf_cksum:   CRC32C of the chunk index and of the footer up to pdzf_cksum
+ *
+ * A compressed mblock holds its data as pdzf_chunkc chunks, each compressed
+ * on its own and padded to a PAGE_SIZE boundary.  The chunks are followed by the
+ * chunk index, an array of pdzf_chunkc __le32 stored chunk lengths that
+ * ends where the footer begins, and the footer ends the last page of the
+ * mblock.  A chunk whose stored length equals its uncompressed length is
+ * stored uncompressed.  The chunks are compressed with LZ4.
+ */
+struct mblock_zfoot_omf {
+	__le32 pdzf_magic;
+	__le32 pdzf_chunksz;
+	__le32 pdzf_chunkc;
+	__le32 pdzf_zlen;
+	__le32 pdzf_cksum;
+} __packed;
+
+/* Define set/get methods for mblock_zfoot_omf */
+OMF_SETGET(struct mblock_zfoot_omf, pdzf_magic, 32)
+OMF_SETGET(struct mblock_zfoot_omf, pdzf_chunksz, 32)
+OMF_SETGET(struct mblock_zfoot_omf, pdzf_chunkc, 32)
+OMF_SETGET(struct mblock_zfoot_omf, pdzf_zlen, 32)
+OMF_SETGET(struct mblock_zfoot_omf, pdzf_cksum, 32)
+
+#define OMF_MBLOCK_ZMAGIC       (0x7a6d6231) /* ascii zmb1 */
+#define OMF_MBLOCK_ZCHUNK_MAX   (1u << 20)
+#define OMF_MBLOCK_ZTRAIL_LEN(_chunkc) \
+	ALIGN((_chunkc) * sizeof(__le32) + sizeof(struct mblock_zfoot_omf), PAGE_SIZE)
+
+/**
+ * struct mdcrec_data_ockpt_omf -
+ * "pdck_" = packed data record object checkpoint
+ *
+ * @pdck_rtype: mdrec_type_omf: OMF_MDR_OCKPT
+ * @pdck_cnt:   number of objects in pdck_data[]
+ * @pdck_data:  pdck_cnt packed OMF_MDR_OCREATE records, in objid order
+ *
+ * MDC compaction checkpoints the committed objects of an MDC in batches of
+ * up to OMF_MDCREC_CKPT_MAX objects per record, which is much cheaper to read
+ * back at activation than one OMF_MDR_OCREATE record per object.  Introduced
+ * in MDC content version 1.0.0.1.
+ */
+struct mdcrec_data_ockpt_omf {
+	u8     pdck_rtype;
+	u8     pdck_pad[1];
+	__le16 pdck_cnt;
+	u8     pdck_data[];
+} __packed;
+
+/* Define set/get methods for mdcrec_data_ockpt_omf */
+OMF_SETGET(struct mdcrec_data_ockpt_omf, pdck_rtype, 8)
+OMF_SETGET(struct mdcrec_data_ockpt_omf, pdck_cnt, 16)
+#define OMF_MDCREC_CKPT_MAX     (64)
+#define OMF_MDCREC_CKPT_PACKLEN (sizeof(struct mdcrec_data_ockpt_omf) + \
+				 OMF_MDCREC_CKPT_MAX *                  \
+				 max(OMF_MDCREC_OBJCMN_PACKLEN, OMF_MDCREC_OBJCMN_VARINT_PACKLEN))
+
 
 /**
  * struct mdcrec_data_mpconfig_omf -
@@ -610,12 +721,12 @@ OMF_SETGET_CHBUF(struct sb_descriptor_omf, psb_mdc02devid)
 #define OMF_SB_DESC_PACKLEN (sizeof(struct sb_descriptor_omf))
 
 /*
- * For object-related records OCREATE/OUPDATE is max so compute that here as:
- * rtype + objid + gen + layout desc
+ * For object-related records OCKPT is max, followed by OCREATE/OUPDATE which
+ * are rtype + objid + gen + layout desc
  */
-#define OMF_MDCREC_PACKLEN_MAX max(OMF_MDCREC_OBJCMN_PACKLEN,            \
-				   max(OMF_MDCREC_MCCONFIG_PACKLEN,      \
-				       max(OMF_MDCREC_CLS_SPARE_PACKLEN, \
+#define OMF_MDCREC_PACKLEN_MAX max(OMF_MDCREC_CKPT_PACKLEN,              \
+				   max(OMF_MDCREC_MCCONFIG_PACKLEN,        \
+				       max(OMF_MDCREC_CLS_SPARE_PACKLEN,   \
 					   OMF_MDCREC_MPCONFIG_PACKLEN)))
 
 #endif /* MPOOL_OMF_PRIV_H */
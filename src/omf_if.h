@@ -165,10 +165,12 @@ struct omf_mdcver {
  * ODELETE, OIDCKPT: objid field only; others ignored
  * OERASE: objid and gen fields only; others ignored
  * OCREATE, OUPDATE: layout field only; others ignored
+ * OCKPT: ckpt fields only
  * @omd_objid:  object identifier
  * @omd_gen:    object generation number
  * @omd_layout:
  * @omd_mblen:  Length of written data in object
+ * @omd_zlen:   Length of the uncompressed data of a compressed mblock, else 0
  * @omd_old:
  * @omd_uuid:
  *
@@ -181,6 +183,10 @@ struct omf_mdcver {
  *
  * @omd_cfg:
  *
+ * object_ckpt-
+ * @omd_layoutv: array of OMF_MDCREC_CKPT_MAX layouts, supplied by the caller
+ * @omd_layoutc: number of valid elements in omd_layoutv[]
+ *
  * @omd_rtype: enum mdcrec_type_omf value
  */
 struct omf_mdcrec_data {
@@ -192,6 +198,7 @@ struct omf_mdcrec_data {
 			u64                             omd_gen;
 			struct pmd_layout              *omd_layout;
 			u64                             omd_mblen;
+			u32                             omd_zlen;
 			struct omf_layout_descriptor    omd_old;
 			struct mpool_uuid               omd_uuid;
 			u8                              omd_mclass;
@@ -207,6 +214,11 @@ struct omf_mdcrec_data {
 		} mcs;
 
 		struct mpool_config    omd_cfg;
+
+		struct object_ckpt {
+			struct pmd_layout     **omd_layoutv;
+			u16                     omd_layoutc;
+		} ckpt;
 	} u;
 
 	u8             omd_rtype;
@@ -276,6 +288,18 @@ bool omf_sb_has_magic_le(const char *inbuf);
  */
 bool omf_logblock_empty_le(char *lbuf);
 
+/**
+ * omf_logblock_erased_le() - Determine if a run of log blocks is erased
+ * @lbuf: char *
+ * @len:  bytes to check, starting at a log block boundary
+ *
+ * Data read from discarded blocks may be all 0s or all 1s.  The check is
+ * done a word at a time by memchr_inv().
+ *
+ * Return: true if lbuf[0..len) is all 0x00 or all 0xff; false otherwise
+ */
+bool omf_logblock_erased_le(const char *lbuf, size_t len);
+
 /**
  * omf_logblock_header_pack_htole() - pack log block header
  * @lbh: struct omf_logblock_header *
@@ -287,6 +311,29 @@ bool omf_logblock_empty_le(char *lbuf);
  */
 merr_t omf_logblock_header_pack_htole(struct omf_logblock_header *lbh, char *lbuf);
 
+/**
+ * omf_logblock_cksum_set_le() - checksum a packed log block
+ * @lbuf:  char *, log block with its header already packed
+ * @lbsz:  log block size in bytes
+ *
+ * Compute the CRC32C of the little-endian log block in lbuf, store it in the
+ * header and flag the log block as checksummed.
+ *
+ * Return: 0 if successful, merr_t otherwise
+ */
+merr_t omf_logblock_cksum_set_le(char *lbuf, u16 lbsz);
+
+/**
+ * omf_logblock_cksum_check_le() - verify a log block checksum
+ * @lbuf:  char *, little-endian log block
+ * @lbsz:  log block size in bytes
+ *
+ * Log blocks that aren't flagged as checksummed always pass.
+ *
+ * Return: 0 if successful, merr_t (EBADMSG) on a checksum mismatch
+ */
+merr_t omf_logblock_cksum_check_le(const char *lbuf, u16 lbsz);
+
 /**
  * omf_logblock_header_len_le() - Determine header length of log block
  * @lbuf: char *
@@ -331,8 +378,10 @@ void omf_logrec_desc_unpack_letoh(struct omf_logrec_descriptor *lrd, const char
 
 /**
  * omf_mdcrec_pack_htole() - pack mdc record
- * @mp: struct mpool_descriptor *
- * @cdr: struct omf_mdcrec_data *
+ * @mp:     struct mpool_descriptor *
+ * @mdcver: mdc content version of the mdc to which this data goes.
+ *          NULL means latest MDC content version known by this binary.
+ * @cdr:    struct omf_mdcrec_data *
  * @outbuf: char *
  *
  * Pack mdc record into outbuf little-endian.
@@ -340,7 +389,12 @@ void omf_logrec_desc_unpack_letoh(struct omf_logrec_descriptor *lrd, const char
  *
  * Return: bytes packed if successful, -EINVAL otherwise
  */
-int omf_mdcrec_pack_htole(struct mpool_descriptor *mp, struct omf_mdcrec_data *cdr, char *outbuf);
+int
+omf_mdcrec_pack_htole(
+	struct mpool_descriptor    *mp,
+	struct omf_mdcver          *mdcver,
+	struct omf_mdcrec_data     *cdr,
+	char                       *outbuf);
 
 /**
  * omf_mdcrec_unpack_letoh() - unpack mdc record
@@ -398,4 +452,47 @@ bool logrec_type_datarec(enum logrec_type_omf rtype);
  */
 struct omf_mdcver *omf_sbver_to_mdcver(enum sb_descriptor_ver_omf sbver);
 
+/**
+ * omf_mblock_ztrail_pack_htole() - Pack the chunk index and footer of a
+ *	compressed mblock into outbuf
+ * @outbuf:  OMF_MBLOCK_ZTRAIL_LEN(chunkc) bytes
+ * @chunksz: uncompressed bytes per chunk
+ * @zlen:    length of the uncompressed data
+ * @clenv:   stored length of each chunk
+ * @chunkc:
+ *
+ * Return: 0 if successful, merr_t otherwise
+ */
+merr_t
+omf_mblock_ztrail_pack_htole(
+	char       *outbuf,
+	u32         chunksz,
+	u32         zlen,
+	const u32  *clenv,
+	u32         chunkc);
+
+/**
+ * omf_mblock_zfoot_unpack_letoh() - Unpack the footer of a compressed mblock
+ * @inbuf:    last page of the mblock
+ * @chunkszp:
+ * @zlenp:
+ * @chunkcp:
+ *
+ * Only the footer is validated, the checksum is verified by
+ * omf_mblock_ztrail_unpack_letoh().
+ *
+ * Return: 0 if successful, merr_t(EINVAL) if inbuf holds no valid footer
+ */
+merr_t omf_mblock_zfoot_unpack_letoh(const char *inbuf, u32 *chunkszp, u32 *zlenp, u32 *chunkcp);
+
+/**
+ * omf_mblock_ztrail_unpack_letoh() - Unpack the chunk index of a compressed mblock
+ * @inbuf:  OMF_MBLOCK_ZTRAIL_LEN(chunkc) bytes, read from the end of the mblock
+ * @chunkc: from omf_mblock_zfoot_unpack_letoh()
+ * @clenv:  output, stored length of each chunk
+ *
+ * Return: 0 if successful, merr_t(EINVAL) if the checksum doesn't match
+ */
+merr_t omf_mblock_ztrail_unpack_letoh(const char *inbuf, u32 chunkc, u32 *clenv);
+
 #endif /* MPOOL_OMF_IF_PRIV_H */
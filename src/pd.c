@@ -14,6 +14,10 @@
 #include <linux/fs.h>
 #include <linux/blkdev.h>
 #include <linux/blk_types.h>
+#include <linux/sched.h>
+#include <linux/bitmap.h>
+#include <linux/dax.h>
+#include <linux/pfn_t.h>
 
 #include "mpool_config.h"
 #include "mpool_defs.h"
@@ -26,6 +30,514 @@
 static const fmode_t    pd_bio_fmode = FMODE_READ | FMODE_WRITE | FMODE_EXCL;
 static char            *pd_bio_holder = "mpool";
 
+/*
+ * Per-class depth limits and weights. The block layer is also told about
+ * the class via the bio flags, so that its own scheduler can act on it.
+ */
+static const struct {
+	u32     ioc_depth;
+	u32     ioc_weight;
+	int     ioc_opflags;
+} pd_ioc_tab[PD_IOC_MAX] = {
+	[PD_IOC_LOGSYNC] = { 32, 8, REQ_SYNC },
+	[PD_IOC_META]    = { 32, 4, REQ_SYNC | REQ_META | REQ_PRIO },
+	[PD_IOC_READ]    = { 64, 4, 0 },
+	[PD_IOC_BULK]    = { 32, 2, 0 },
+#ifdef REQ_BACKGROUND
+	[PD_IOC_BG]      = {  8, 1, REQ_BACKGROUND },
+#else
+	[PD_IOC_BG]      = {  8, 1, 0 },
+#endif
+};
+
+/**
+ * struct pd_ioq_waiter - task waiting for admission to a pd dispatch queue
+ * @pqw_link:    pqc_waitq linkage
+ * @pqw_task:
+ * @pqw_granted: set under pq_lock once the I/O has been admitted
+ */
+struct pd_ioq_waiter {
+	struct list_head    pqw_link;
+	struct task_struct *pqw_task;
+	bool                pqw_granted;
+};
+
+static void pd_ioq_init(struct pd_ioq *pq)
+{
+	int i;
+
+	spin_lock_init(&pq->pq_lock);
+	pq->pq_inflight = 0;
+	pq->pq_depth = mpc_pd_qdepth;
+	pq->pq_cursor = 0;
+	pq->pq_pollmask = 0;
+
+	for (i = 0; i < PD_IOC_MAX; i++) {
+		struct pd_ioq_class *pqc = &pq->pq_classv[i];
+
+		INIT_LIST_HEAD(&pqc->pqc_waitq);
+		pqc->pqc_inflight = 0;
+		pqc->pqc_depth = min_t(u32, pd_ioc_tab[i].ioc_depth, pq->pq_depth);
+		pqc->pqc_weight = pd_ioc_tab[i].ioc_weight;
+		pqc->pqc_credit = pqc->pqc_weight;
+	}
+}
+
+static inline void pd_ioq_admit(struct pd_ioq *pq, struct pd_ioq_class *pqc)
+{
+	pqc->pqc_inflight++;
+	pq->pq_inflight++;
+}
+
+/**
+ * pd_ioq_next() - pick the class to receive the next free slot
+ * @pq:
+ *
+ * Classes with waiters and below their depth limit are served in
+ * round-robin order, each receiving up to pqc_weight grants per round.
+ */
+static struct pd_ioq_class *pd_ioq_next(struct pd_ioq *pq)
+{
+	struct pd_ioq_class    *pqc;
+	bool                    eligible = false;
+	int                     pass, n;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (n = 0; n < PD_IOC_MAX; n++) {
+			pqc = &pq->pq_classv[pq->pq_cursor];
+
+			if (!list_empty(&pqc->pqc_waitq) && pqc->pqc_inflight < pqc->pqc_depth) {
+				if (pqc->pqc_credit > 0)
+					return pqc;
+				eligible = true;
+			}
+
+			pq->pq_cursor = (pq->pq_cursor + 1) % PD_IOC_MAX;
+		}
+
+		if (!eligible)
+			break;
+
+		/* Start a new round */
+		for (n = 0; n < PD_IOC_MAX; n++)
+			pq->pq_classv[n].pqc_credit = pq->pq_classv[n].pqc_weight;
+	}
+
+	return NULL;
+}
+
+/**
+ * pd_ioq_dispatch() - hand free slots to waiters
+ * @pq: pq_lock held
+ */
+static void pd_ioq_dispatch(struct pd_ioq *pq)
+{
+	struct pd_ioq_waiter   *pqw;
+	struct pd_ioq_class    *pqc;
+
+	while (pq->pq_inflight < pq->pq_depth) {
+		pqc = pd_ioq_next(pq);
+		if (!pqc)
+			break;
+
+		pqw = list_first_entry(&pqc->pqc_waitq, typeof(*pqw), pqw_link);
+		list_del(&pqw->pqw_link);
+
+		pqc->pqc_credit--;
+		pd_ioq_admit(pq, pqc);
+
+		pqw->pqw_granted = true;
+		wake_up_process(pqw->pqw_task);
+	}
+}
+
+/**
+ * pd_ioq_enter() - wait for the pd to admit one I/O of the given class
+ * @pq:
+ * @ioc:
+ */
+static void pd_ioq_enter(struct pd_ioq *pq, enum pd_ioclass ioc)
+{
+	struct pd_ioq_class    *pqc = &pq->pq_classv[ioc];
+	struct pd_ioq_waiter    pqw;
+
+	if (!pq->pq_depth)
+		return;
+
+	spin_lock_irq(&pq->pq_lock);
+	if (list_empty(&pqc->pqc_waitq) && pqc->pqc_inflight < pqc->pqc_depth &&
+	    pq->pq_inflight < pq->pq_depth) {
+		pd_ioq_admit(pq, pqc);
+		spin_unlock_irq(&pq->pq_lock);
+		return;
+	}
+
+	pqw.pqw_task = current;
+	pqw.pqw_granted = false;
+	list_add_tail(&pqw.pqw_link, &pqc->pqc_waitq);
+
+	while (1) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (pqw.pqw_granted)
+			break;
+
+		spin_unlock_irq(&pq->pq_lock);
+		io_schedule();
+		spin_lock_irq(&pq->pq_lock);
+	}
+
+	__set_current_state(TASK_RUNNING);
+	spin_unlock_irq(&pq->pq_lock);
+}
+
+/**
+ * pd_ioq_exit() - release the slot of a completed I/O
+ * @pq:
+ * @ioc:
+ *
+ * May be called from bio completion context.
+ */
+static void pd_ioq_exit(struct pd_ioq *pq, enum pd_ioclass ioc)
+{
+	unsigned long flags;
+
+	if (!pq->pq_depth)
+		return;
+
+	spin_lock_irqsave(&pq->pq_lock, flags);
+	pq->pq_classv[ioc].pqc_inflight--;
+	pq->pq_inflight--;
+	pd_ioq_dispatch(pq);
+	spin_unlock_irqrestore(&pq->pq_lock, flags);
+}
+
+#if HAVE_BLK_ZONE_APPEND
+/**
+ * struct pd_zone_report - pd_zoned_init() zone report state
+ * @pzr_zoned:
+ * @pzr_zonetot: mpool zones on the device
+ * @pzr_err:     first unsupported zone found
+ */
+struct pd_zone_report {
+	struct pd_zoned    *pzr_zoned;
+	u64                 pzr_zonetot;
+	merr_t              pzr_err;
+};
+
+static int pd_zone_report_cb(struct blk_zone *zone, unsigned int idx, void *data)
+{
+	struct pd_zone_report  *pzr = data;
+	struct pd_zoned        *pz = pzr->pzr_zoned;
+	u64                     zaddr;
+
+	zaddr = div64_u64(zone->start, pz->pz_zonesect);
+	if (zaddr >= pzr->pzr_zonetot)
+		return 0;
+
+	if (zone->type == BLK_ZONE_TYPE_CONVENTIONAL) {
+		set_bit(zaddr, pz->pz_convmap);
+		return 0;
+	}
+
+	if (zone->cond == BLK_ZONE_COND_OFFLINE || zone->cond == BLK_ZONE_COND_READONLY) {
+		set_bit(zaddr, pz->pz_badmap);
+		return 0;
+	}
+
+	/* An mblock is addressed contiguously across its zones */
+	if (zone->capacity != zone->len) {
+		pzr->pzr_err = merr(EINVAL);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * pd_zoned_init() - set up the zoned state of a zoned block device
+ * @bdev:
+ * @dparm:
+ *
+ * The device zone size must be the mpool zone size, sequential zones must
+ * have their full size as capacity, and the superblock zones, which are
+ * rewritten in place, must be conventional zones.
+ */
+static merr_t pd_zoned_init(struct block_device *bdev, struct pd_dev_parm *dparm)
+{
+	struct pd_zone_report   pzr = { };
+	struct request_queue   *q;
+	struct pd_zoned        *pz;
+	merr_t                  err;
+	u64                     zonesect, zonetot, appendmax;
+	u32                     sbzones, i;
+	int                     rc;
+
+	if (!bdev_is_zoned(bdev))
+		return merr(ENODEV);
+
+	zonesect = bdev_zone_sectors(bdev);
+	if ((zonesect << SECTOR_SHIFT) != ((u64)dparm->dpr_zonepg << PAGE_SHIFT)) {
+		err = merr(EINVAL);
+		mp_pr_err("device zone size 0x%lx differs from mpool zone size 0x%lx", err,
+			  (ulong)(zonesect << SECTOR_SHIFT), (ulong)dparm->dpr_zonepg << PAGE_SHIFT);
+		return err;
+	}
+
+	q = bdev_get_queue(bdev);
+	appendmax = (u64)queue_max_zone_append_sectors(q) << SECTOR_SHIFT;
+	appendmax = min_t(u64, appendmax, (u64)queue_max_segments(q) << PAGE_SHIFT);
+	appendmax = round_down(appendmax, PAGE_SIZE);
+	if (!appendmax)
+		return merr(EINVAL);
+
+	zonetot = dparm->dpr_zonetot;
+
+	pz = kzalloc(sizeof(*pz), GFP_KERNEL);
+	if (!pz)
+		return merr(ENOMEM);
+
+	pz->pz_zonesect = zonesect;
+	pz->pz_appendmax = min_t(u64, appendmax, U32_MAX & PAGE_MASK);
+
+	pz->pz_convmap = bitmap_zalloc(zonetot, GFP_KERNEL);
+	pz->pz_badmap = bitmap_zalloc(zonetot, GFP_KERNEL);
+	if (!pz->pz_convmap || !pz->pz_badmap) {
+		err = merr(ENOMEM);
+		goto errout;
+	}
+
+	pzr.pzr_zoned = pz;
+	pzr.pzr_zonetot = zonetot;
+
+	rc = blkdev_report_zones(bdev, 0, zonetot, pd_zone_report_cb, &pzr);
+	if (rc < 0) {
+		err = pzr.pzr_err ?: merr(rc);
+		mp_pr_err("zone report failed, zones with a capacity below their size unsupported",
+			  err);
+		goto errout;
+	}
+
+	sbzones = sb_zones_for_sbs(&dparm->dpr_prop);
+	for (i = 0; i < sbzones; i++) {
+		if (!test_bit(i, pz->pz_convmap)) {
+			err = merr(EINVAL);
+			mp_pr_err("superblock zone %u is not a conventional zone", err, i);
+			goto errout;
+		}
+	}
+
+	pz->pz_badcnt = bitmap_weight(pz->pz_badmap, zonetot);
+	dparm->dpr_zoned = pz;
+
+	return 0;
+
+errout:
+	bitmap_free(pz->pz_badmap);
+	bitmap_free(pz->pz_convmap);
+	kfree(pz);
+
+	return err;
+}
+
+static void pd_zoned_fini(struct pd_dev_parm *dparm)
+{
+	struct pd_zoned *pz = dparm->dpr_zoned;
+
+	if (!pz)
+		return;
+
+	dparm->dpr_zoned = NULL;
+
+	bitmap_free(pz->pz_badmap);
+	bitmap_free(pz->pz_convmap);
+	kfree(pz);
+}
+
+static inline bool pd_zone_seq(struct pd_zoned *pz, u64 zaddr)
+{
+	return !test_bit(zaddr, pz->pz_convmap) && !test_bit(zaddr, pz->pz_badmap);
+}
+
+/**
+ * pd_zone_reset() - reset the sequential zones in a range of zones
+ * @pd:
+ * @zaddr:
+ * @zonecnt:
+ *
+ * Each run of adjacent sequential zones is reset by one command.
+ * Conventional and bad zones are skipped.
+ */
+static merr_t pd_zone_reset(struct mpool_dev_info *pd, u64 zaddr, u32 zonecnt)
+{
+	struct pd_zoned        *pz = pd->pdi_parm.dpr_zoned;
+	struct block_device    *bdev = pd->pdi_parm.dpr_dev_private;
+	merr_t                  err = 0;
+	u64                     zend, run;
+	int                     rc = 0;
+
+	pd_ioq_enter(&pd->pdi_parm.dpr_ioq, PD_IOC_BG);
+
+	for (zend = zaddr + zonecnt; zaddr < zend && !rc; zaddr = run) {
+		if (!pd_zone_seq(pz, zaddr)) {
+			run = zaddr + 1;
+			continue;
+		}
+
+		for (run = zaddr + 1; run < zend && pd_zone_seq(pz, run); run++)
+			;
+
+		rc = blkdev_zone_mgmt(bdev, REQ_OP_ZONE_RESET, zaddr * pz->pz_zonesect,
+				      (run - zaddr) * pz->pz_zonesect, GFP_NOIO);
+	}
+
+	pd_ioq_exit(&pd->pdi_parm.dpr_ioq, PD_IOC_BG);
+
+	if (rc) {
+		err = merr(rc);
+		mp_pr_err("bdev %s, zone %lu reset failed", err, pd->pdi_name, (ulong)zaddr);
+	}
+
+	return err;
+}
+#else
+static merr_t pd_zoned_init(struct block_device *bdev, struct pd_dev_parm *dparm)
+{
+	return merr(EOPNOTSUPP);
+}
+
+static void pd_zoned_fini(struct pd_dev_parm *dparm)
+{
+}
+
+static merr_t pd_zone_reset(struct mpool_dev_info *pd, u64 zaddr, u32 zonecnt)
+{
+	return merr(EOPNOTSUPP);
+}
+#endif /* HAVE_BLK_ZONE_APPEND */
+
+#if HAVE_DAX_DIRECT_ACCESS
+/**
+ * pd_dax_init() - set up CPU store writes to a DAX capable NVDIMM
+ * @bdev:
+ * @dparm:
+ *
+ * A device without DAX support is written through the block path.
+ */
+static void pd_dax_init(struct block_device *bdev, struct pd_dev_parm *dparm)
+{
+	if (!mpc_pd_dax || dparm->dpr_prop.pdp_devtype != PD_DEV_TYPE_BLOCK_NVDIMM)
+		return;
+
+	dparm->dpr_dax = fs_dax_get_by_bdev(bdev);
+}
+
+static void pd_dax_fini(struct pd_dev_parm *dparm)
+{
+	if (dparm->dpr_dax) {
+		put_dax(dparm->dpr_dax);
+		dparm->dpr_dax = NULL;
+	}
+}
+
+/**
+ * pd_dax_write() - store data to a DAX device
+ * @pd:
+ * @iov:
+ * @iovcnt:
+ * @off:    offset in bytes on disk
+ *
+ * The bytes stored are the same a bio would write, hence the on-media
+ * format is unchanged.  memcpy_flushcache() bypasses or writes back the
+ * CPU caches and the closing fence orders those stores ahead of any later
+ * one, so the data is durable on return on platforms with ADR.
+ */
+static merr_t pd_dax_write(struct mpool_dev_info *pd, const struct kvec *iov, int iovcnt, loff_t off)
+{
+	struct block_device    *bdev = pd->pdi_parm.dpr_dev_private;
+	struct dax_device      *dax = pd->pdi_parm.dpr_dax;
+	merr_t                  err = 0;
+	pgoff_t                 pgoff;
+	size_t                  tot, ioff, len, n;
+	long                    avail;
+	void                   *kaddr;
+	pfn_t                   pfn;
+	int                     i, id, rc;
+
+	for (i = 0, tot = 0; i < iovcnt; i++)
+		tot += iov[i].iov_len;
+
+	if (ev((off & PD_SECTORMASK(&pd->pdi_prop)) || (tot & PD_SECTORMASK(&pd->pdi_prop)) ||
+	       off + tot > PD_LEN(&pd->pdi_prop)))
+		return merr(EINVAL);
+
+	id = dax_read_lock();
+
+	for (i = 0, ioff = 0; i < iovcnt && !err; ) {
+		if (ioff == iov[i].iov_len) {
+			ioff = 0;
+			i++;
+			continue;
+		}
+
+		rc = bdev_dax_pgoff(bdev, round_down(off, PAGE_SIZE) >> SECTOR_SHIFT, PAGE_SIZE,
+				    &pgoff);
+		if (rc) {
+			err = merr(rc);
+			break;
+		}
+
+		avail = dax_direct_access(dax, pgoff, PHYS_PFN(PAGE_ALIGN(offset_in_page(off) + tot)),
+					  &kaddr, &pfn);
+		if (avail <= 0) {
+			err = merr(avail ? avail : EIO);
+			break;
+		}
+
+		len = min_t(size_t, tot, ((size_t)avail << PAGE_SHIFT) - offset_in_page(off));
+		kaddr += offset_in_page(off);
+		off += len;
+		tot -= len;
+
+		while (len > 0) {
+			if (ioff == iov[i].iov_len) {
+				ioff = 0;
+				i++;
+				continue;
+			}
+
+			n = min_t(size_t, len, iov[i].iov_len - ioff);
+			memcpy_flushcache(kaddr, iov[i].iov_base + ioff, n);
+
+			kaddr += n;
+			ioff += n;
+			len -= n;
+		}
+	}
+
+	dax_read_unlock(id);
+
+	wmb();
+
+	if (err)
+		mp_pr_err("bdev %s, dax write off 0x%lx failed", err, pd->pdi_name, (ulong)off);
+
+	return err;
+}
+#else
+static void pd_dax_init(struct block_device *bdev, struct pd_dev_parm *dparm)
+{
+}
+
+static void pd_dax_fini(struct pd_dev_parm *dparm)
+{
+}
+
+static merr_t pd_dax_write(struct mpool_dev_info *pd, const struct kvec *iov, int iovcnt, loff_t off)
+{
+	return merr(EOPNOTSUPP);
+}
+#endif /* HAVE_DAX_DIRECT_ACCESS */
+
 merr_t pd_dev_open(const char *path, struct pd_dev_parm *dparm, struct pd_prop *pd_prop)
 {
 	struct block_device *bdev;
@@ -36,15 +548,29 @@ merr_t pd_dev_open(const char *path, struct pd_dev_parm *dparm, struct pd_prop *
 
 	dparm->dpr_dev_private = bdev;
 	dparm->dpr_prop = *pd_prop;
+	dparm->dpr_zoned = NULL;
+	dparm->dpr_dax = NULL;
+	pd_ioq_init(&dparm->dpr_ioq);
 
-	if ((pd_prop->pdp_devtype != PD_DEV_TYPE_BLOCK_STD) &&
-	    (pd_prop->pdp_devtype != PD_DEV_TYPE_BLOCK_NVDIMM)) {
+	if (pd_prop->pdp_devtype == PD_DEV_TYPE_ZONE) {
+		merr_t err = pd_zoned_init(bdev, dparm);
+
+		if (err) {
+			mp_pr_err("%s: zoned device setup failed", err, path);
+			dparm->dpr_dev_private = NULL;
+			blkdev_put(bdev, pd_bio_fmode);
+			return err;
+		}
+	} else if ((pd_prop->pdp_devtype != PD_DEV_TYPE_BLOCK_STD) &&
+		   (pd_prop->pdp_devtype != PD_DEV_TYPE_BLOCK_NVDIMM)) {
 		merr_t err = merr(EINVAL);
 
 		mp_pr_err("unsupported PD type %d", err, pd_prop->pdp_devtype);
 		return err;
 	}
 
+	pd_dax_init(bdev, dparm);
+
 	return 0;
 }
 
@@ -52,6 +578,9 @@ merr_t pd_dev_close(struct pd_dev_parm *dparm)
 {
 	struct block_device *bdev = dparm->dpr_dev_private;
 
+	pd_zoned_fini(dparm);
+	pd_dax_fini(dparm);
+
 	if (bdev) {
 		dparm->dpr_dev_private = NULL;
 		sync_blockdev(bdev);
@@ -87,6 +616,20 @@ merr_t pd_dev_flush(struct mpool_dev_info *pd)
 	return err;
 }
 
+void pd_dev_poll_set(struct pd_dev_parm *dparm, u32 iocmask)
+{
+#if HAVE_BLK_POLL
+	struct block_device    *bdev = dparm->dpr_dev_private;
+	struct request_queue   *q;
+
+	q = bdev ? bdev_get_queue(bdev) : NULL;
+	if (!q || !test_bit(QUEUE_FLAG_POLL, &q->queue_flags))
+		iocmask = 0;
+
+	dparm->dpr_ioq.pq_pollmask = iocmask & PD_IOC_POLLMASK;
+#endif
+}
+
 /**
  * pd_bio_discard_() - issue discard command to erase a byte-aligned region
  * @pd:
@@ -121,7 +664,9 @@ static merr_t pd_bio_discard(struct mpool_dev_info *pd, u64 off, size_t len)
 		return err;
 	}
 
+	pd_ioq_enter(&pd->pdi_parm.dpr_ioq, PD_IOC_BG);
 	rc = blkdev_issue_discard(bdev, off >> SECTOR_SHIFT, len >> SECTOR_SHIFT, GFP_NOIO, 0);
+	pd_ioq_exit(&pd->pdi_parm.dpr_ioq, PD_IOC_BG);
 	if (rc) {
 		err = merr(rc);
 		mp_pr_err("bdev %s, offset 0x%lx len 0x%lx, discard faiure",
@@ -157,6 +702,9 @@ merr_t pd_zone_erase(struct mpool_dev_info *pd, u64 zaddr, u32 zonecnt, bool rea
 	if (zonecnt == 0)
 		return 0;
 
+	if (pd->pdi_parm.dpr_zoned)
+		return ev(pd_zone_reset(pd, zaddr, zonecnt));
+
 	/*
 	 * When both DIF and SED are enabled, read from a discared block
 	 * would fail, so we can't discard blocks if both DIF and SED are
@@ -227,12 +775,74 @@ pd_bio_chain(struct bio *target, int op, unsigned int nr_pages, gfp_t gfp)
 	return new;
 }
 
+#if HAVE_BIO_STATUS
+#define PD_BIO_ERRNO(bio)              blk_status_to_errno((bio)->bi_status)
+#else
+#define PD_BIO_ERRNO(bio)              ((bio)->bi_error)
+#endif
+
+/*
+ * PD_POLL_IOSZ_MAX: largest I/O completed by polling, the wakeup cost of a
+ * bigger one is small wrt its transfer time
+ */
+#define PD_POLL_IOSZ_MAX               (64u << 10)
+
+#if HAVE_BLK_POLL
+static void pd_bio_poll_endio(struct bio *bio)
+{
+	struct task_struct *waiter = bio->bi_private;
+
+	WRITE_ONCE(bio->bi_private, NULL);
+	wake_up_process(waiter);
+}
+
+/**
+ * pd_bio_submit_poll() - submit a bio and poll for its completion
+ * @q:
+ * @bio: unchained bio
+ *
+ * Falls back to sleeping if the bio was not queued to a poll queue.
+ */
+static int pd_bio_submit_poll(struct request_queue *q, struct bio *bio)
+{
+	blk_qc_t qc;
+
+	bio->bi_opf |= REQ_HIPRI;
+	bio->bi_private = current;
+	bio->bi_end_io = pd_bio_poll_endio;
+
+	qc = submit_bio(bio);
+
+	while (1) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (!READ_ONCE(bio->bi_private))
+			break;
+
+		if (!blk_poll(q, qc, true))
+			io_schedule();
+	}
+
+	__set_current_state(TASK_RUNNING);
+
+	return PD_BIO_ERRNO(bio);
+}
+
+static inline bool pd_bio_pollable(struct pd_ioq *pq, enum pd_ioclass ioc, struct bio *bio)
+{
+	return (pq->pq_pollmask & (1u << ioc)) && !bio_flagged(bio, BIO_CHAIN) &&
+		bio->bi_iter.bi_size <= PD_POLL_IOSZ_MAX;
+}
+#endif /* HAVE_BLK_POLL */
+
 /*
- * pd_bio_rw() expects a list of kvecs wherein each base ptr is sector
+ * pd_bio_build() expects a list of kvecs wherein each base ptr is sector
  * aligned and each length is multiple of sectors.
  *
  * If the IO is bigger than 1MiB (BIO_MAX_PAGES pages),
  * it is split in several IOs smaller that BIO_MAX_PAGES.
+ * All but the last bio are chained to their successor and submitted,
+ * the last bio is returned via biop for the caller to submit.  It
+ * completes only after all the bios chained to it have completed.
  *
  * @pd:
  * @iov:
@@ -240,6 +850,7 @@ pd_bio_chain(struct bio *target, int op, unsigned int nr_pages, gfp_t gfp)
  * @off: offset in bytes on disk
  * @rw:
  * @opflags:
+ * @biop: (output) unsubmitted tail bio, NULL if there is nothing to do
  *
  * NOTE:
  * If the size of an I/O is bigger than "Max data transfer size(MDTS),
@@ -252,13 +863,14 @@ pd_bio_chain(struct bio *target, int op, unsigned int nr_pages, gfp_t gfp)
  * In order to use DIF with stock linux kernel, do not IOs larger than MDTS.
  */
 static merr_t
-pd_bio_rw(
+pd_bio_build(
 	struct mpool_dev_info  *pd,
 	const struct kvec      *iov,
 	int                     iovcnt,
 	loff_t                  off,
 	int                     rw,
-	int                     opflags)
+	int                     opflags,
+	struct bio            **biop)
 {
 	struct block_device    *bdev;
 	struct bio             *bio;
@@ -268,7 +880,9 @@ pd_bio_rw(
 	u64                     iov_base, sector_mask;
 	u32                     tot_pages, tot_len, len, iov_len, left;
 	u32                     iolimit;
-	int                     i, cc, op, rc;
+	int                     i, cc, op;
+
+	*biop = NULL;
 
 	if (iovcnt < 1)
 		return 0;
@@ -388,13 +1002,242 @@ pd_bio_rw(
 	assert(bio);
 	assert(tot_pages == 0);
 
-	rc = SUBMIT_BIO_WAIT(op, bio);
+	*biop = bio;
+
+	return 0;
+}
+
+static merr_t
+pd_bio_rw(
+	struct mpool_dev_info  *pd,
+	const struct kvec      *iov,
+	int                     iovcnt,
+	loff_t                  off,
+	int                     rw,
+	int                     opflags,
+	enum pd_ioclass         ioc)
+{
+	struct pd_ioq  *pq = &pd->pdi_parm.dpr_ioq;
+	struct bio     *bio;
+	merr_t          err;
+	int             rc;
+
+	opflags |= pd_ioc_tab[ioc].ioc_opflags;
+
+	pd_ioq_enter(pq, ioc);
+
+	err = pd_bio_build(pd, iov, iovcnt, off, rw, opflags, &bio);
+	if (err || !bio) {
+		pd_ioq_exit(pq, ioc);
+		return err;
+	}
+
+#if HAVE_BLK_POLL
+	if (pd_bio_pollable(pq, ioc, bio))
+		rc = pd_bio_submit_poll(bdev_get_queue(pd->pdi_parm.dpr_dev_private), bio);
+	else
+#endif
+		rc = SUBMIT_BIO_WAIT((rw == REQ_OP_READ) ? READ : WRITE, bio);
 	if (rc)
 		err = merr(rc);
 	bio_put(bio);
 
+	pd_ioq_exit(pq, ioc);
+
+	return err;
+}
+
+static void pd_bio_endio(struct bio *bio)
+{
+	struct pd_io_ctx   *ctx = bio->bi_private;
+	int                 rc;
+
+	rc = PD_BIO_ERRNO(bio);
+	bio_put(bio);
+
+	pd_ioq_exit(ctx->pic_ioq, ctx->pic_ioc);
+
+	ctx->pic_done(ctx, rc ? merr(rc) : 0);
+}
+
+/*
+ * pd_bio_rw_async() - submit the I/O and return without waiting for it
+ *
+ * On success, ctx->pic_done() is called exactly once when the last bio
+ * in the chain completes.  On failure, ctx->pic_done() is not called.
+ */
+static merr_t
+pd_bio_rw_async(
+	struct mpool_dev_info  *pd,
+	const struct kvec      *iov,
+	int                     iovcnt,
+	loff_t                  off,
+	int                     rw,
+	int                     opflags,
+	enum pd_ioclass         ioc,
+	struct pd_io_ctx       *ctx)
+{
+	struct pd_ioq  *pq = &pd->pdi_parm.dpr_ioq;
+	struct bio     *bio;
+	merr_t          err;
+
+	if (ev(!ctx || !ctx->pic_done))
+		return merr(EINVAL);
+
+	opflags |= pd_ioc_tab[ioc].ioc_opflags;
+
+	pd_ioq_enter(pq, ioc);
+
+	err = pd_bio_build(pd, iov, iovcnt, off, rw, opflags, &bio);
+	if (err || !bio) {
+		pd_ioq_exit(pq, ioc);
+		if (!err)
+			ctx->pic_done(ctx, 0);
+		return err;
+	}
+
+	ctx->pic_ioq = pq;
+	ctx->pic_ioc = ioc;
+
+	bio->bi_private = ctx;
+	bio->bi_end_io = pd_bio_endio;
+
+	SUBMIT_BIO((rw == REQ_OP_READ) ? READ : WRITE, bio);
+
+	return 0;
+}
+
+#if HAVE_BLK_ZONE_APPEND
+/**
+ * pd_bio_zone_write() - write to a zoned device
+ * @pd:
+ * @iov:
+ * @iovcnt:
+ * @off:     offset in bytes on disk
+ * @opflags:
+ * @ioc:
+ *
+ * The I/O is split at zone boundaries.  Conventional zones are written in
+ * place.  Sequential zones are written by zone append, one bio at a time,
+ * and each bio is checked to have landed at its offset.  Sequential zones
+ * are reset when allocated, see pmd_layout_provision(), a write to a zone
+ * that is not empty fails rather than resetting it.
+ */
+static merr_t
+pd_bio_zone_write(
+	struct mpool_dev_info  *pd,
+	const struct kvec      *iov,
+	int                     iovcnt,
+	loff_t                  off,
+	int                     opflags,
+	enum pd_ioclass         ioc)
+{
+	struct pd_zoned        *pz = pd->pdi_parm.dpr_zoned;
+	struct pd_ioq          *pq = &pd->pdi_parm.dpr_ioq;
+	struct block_device    *bdev = pd->pdi_parm.dpr_dev_private;
+	struct bio             *bio;
+	merr_t                  err = 0;
+	u64                     zonesz, zaddr, zoff, len, done, plen;
+	size_t                  ioff = 0;
+	void                   *base;
+	bool                    seq;
+	int                     i, rc;
+
+	if (ev(off & PD_SECTORMASK(&pd->pdi_prop)))
+		return merr(EINVAL);
+
+	for (i = 0; i < iovcnt; i++) {
+		if (ev(!PAGE_ALIGNED((uintptr_t)iov[i].iov_base) ||
+		       (iov[i].iov_len & PD_SECTORMASK(&pd->pdi_prop))))
+			return merr(EINVAL);
+	}
+
+	opflags |= pd_ioc_tab[ioc].ioc_opflags;
+	zonesz = pz->pz_zonesect << SECTOR_SHIFT;
+	i = 0;
+
+	while (i < iovcnt && !err) {
+		if (ioff == iov[i].iov_len) {
+			ioff = 0;
+			i++;
+			continue;
+		}
+
+		zaddr = div64_u64_rem(off, zonesz, &zoff);
+		if (ev(zaddr >= pd->pdi_parm.dpr_zonetot || test_bit(zaddr, pz->pz_badmap)))
+			return merr(EINVAL);
+
+		seq = !test_bit(zaddr, pz->pz_convmap);
+		len = min_t(u64, zonesz - zoff, pz->pz_appendmax);
+
+#if HAVE_BIOSET_INIT
+		bio = bio_alloc_bioset(GFP_NOIO, DIV_ROUND_UP(len, PAGE_SIZE), &mpool_bioset);
+#else
+		bio = bio_alloc_bioset(GFP_NOIO, DIV_ROUND_UP(len, PAGE_SIZE), mpool_bioset);
+#endif
+		if (!bio)
+			return merr(ENOMEM);
+
+		/* A zone append bio addresses the start of its zone */
+		pd_bio_init(bio, bdev, seq ? REQ_OP_ZONE_APPEND : REQ_OP_WRITE,
+			    seq ? off - zoff : off, opflags);
+
+		for (done = 0; done < len && i < iovcnt; ) {
+			if (ioff == iov[i].iov_len) {
+				ioff = 0;
+				i++;
+				continue;
+			}
+
+			base = iov[i].iov_base + ioff;
+			plen = min_t(u64, iov[i].iov_len - ioff, PAGE_SIZE - offset_in_page(base));
+			plen = min_t(u64, plen, len - done);
+
+			if (bio_add_page(bio, virt_to_page(base), plen, offset_in_page(base)) != plen)
+				break;
+
+			ioff += plen;
+			done += plen;
+		}
+
+		if (ev(done == 0)) {
+			bio_put(bio);
+			return merr(EBUG);
+		}
+
+		pd_ioq_enter(pq, ioc);
+		rc = SUBMIT_BIO_WAIT(WRITE, bio);
+		pd_ioq_exit(pq, ioc);
+
+		if (rc) {
+			err = merr(rc);
+		} else if (seq && ((u64)bio->bi_iter.bi_sector << SECTOR_SHIFT) != off) {
+			err = merr(EIO);
+			mp_pr_err("bdev %s, zone %lu append landed at 0x%lx instead of 0x%lx",
+				  err, pd->pdi_name, (ulong)zaddr,
+				  (ulong)bio->bi_iter.bi_sector << SECTOR_SHIFT, (ulong)off);
+		}
+		bio_put(bio);
+
+		off += done;
+	}
+
 	return err;
 }
+#else
+static merr_t
+pd_bio_zone_write(
+	struct mpool_dev_info  *pd,
+	const struct kvec      *iov,
+	int                     iovcnt,
+	loff_t                  off,
+	int                     opflags,
+	enum pd_ioclass         ioc)
+{
+	return merr(EOPNOTSUPP);
+}
+#endif /* HAVE_BLK_ZONE_APPEND */
+
 
 merr_t
 pd_zone_pwritev(
@@ -403,7 +1246,8 @@ pd_zone_pwritev(
 	int                     iovcnt,
 	u64                     zaddr,
 	loff_t                  boff,
-	int                     opflags)
+	int                     opflags,
+	enum pd_ioclass         ioc)
 {
 	loff_t woff;
 
@@ -412,7 +1256,13 @@ pd_zone_pwritev(
 
 	woff = ((u64)pd->pdi_zonepg << PAGE_SHIFT) * zaddr + boff;
 
-	return pd_bio_rw(pd, iov, iovcnt, woff, REQ_OP_WRITE, opflags);
+	if (pd->pdi_parm.dpr_zoned)
+		return pd_bio_zone_write(pd, iov, iovcnt, woff, opflags, ioc);
+
+	if (pd->pdi_parm.dpr_dax)
+		return pd_dax_write(pd, iov, iovcnt, woff);
+
+	return pd_bio_rw(pd, iov, iovcnt, woff, REQ_OP_WRITE, opflags, ioc);
 }
 
 merr_t
@@ -426,7 +1276,7 @@ pd_zone_pwritev_sync(
 	merr_t		        err;
 	struct block_device    *bdev;
 
-	err = pd_zone_pwritev(pd, iov, iovcnt, zaddr, boff, REQ_FUA);
+	err = pd_zone_pwritev(pd, iov, iovcnt, zaddr, boff, REQ_FUA, PD_IOC_META);
 	if (ev(err))
 		return err;
 
@@ -449,7 +1299,60 @@ pd_zone_preadv(
 	const struct kvec      *iov,
 	int                     iovcnt,
 	u64                     zaddr,
-	loff_t                  boff)
+	loff_t                  boff,
+	enum pd_ioclass         ioc)
+{
+	loff_t roff;
+
+	if (mpool_pd_status_get(pd) == PD_STAT_UNAVAIL)
+		return merr(ev(EIO));
+
+	roff = ((u64)pd->pdi_zonepg << PAGE_SHIFT) * zaddr + boff;
+
+	return pd_bio_rw(pd, iov, iovcnt, roff, REQ_OP_READ, 0, ioc);
+}
+
+merr_t
+pd_zone_pwritev_async(
+	struct mpool_dev_info  *pd,
+	const struct kvec      *iov,
+	int                     iovcnt,
+	u64                     zaddr,
+	loff_t                  boff,
+	int                     opflags,
+	enum pd_ioclass         ioc,
+	struct pd_io_ctx       *ctx)
+{
+	loff_t woff;
+
+	if (mpool_pd_status_get(pd) == PD_STAT_UNAVAIL)
+		return merr(ev(EIO));
+
+	if (ev(pd->pdi_parm.dpr_zoned))
+		return merr(EOPNOTSUPP);
+
+	woff = ((u64)pd->pdi_zonepg << PAGE_SHIFT) * zaddr + boff;
+
+	if (pd->pdi_parm.dpr_dax) {
+		if (ev(!ctx || !ctx->pic_done))
+			return merr(EINVAL);
+
+		ctx->pic_done(ctx, pd_dax_write(pd, iov, iovcnt, woff));
+		return 0;
+	}
+
+	return pd_bio_rw_async(pd, iov, iovcnt, woff, REQ_OP_WRITE, opflags, ioc, ctx);
+}
+
+merr_t
+pd_zone_preadv_async(
+	struct mpool_dev_info  *pd,
+	const struct kvec      *iov,
+	int                     iovcnt,
+	u64                     zaddr,
+	loff_t                  boff,
+	enum pd_ioclass         ioc,
+	struct pd_io_ctx       *ctx)
 {
 	loff_t roff;
 
@@ -458,7 +1361,7 @@ pd_zone_preadv(
 
 	roff = ((u64)pd->pdi_zonepg << PAGE_SHIFT) * zaddr + boff;
 
-	return pd_bio_rw(pd, iov, iovcnt, roff, REQ_OP_READ, 0);
+	return pd_bio_rw_async(pd, iov, iovcnt, roff, REQ_OP_READ, 0, ioc, ctx);
 }
 
 void pd_dev_set_unavail(struct pd_dev_parm *dparm, struct omf_devparm_descriptor *omf_devparm)
@@ -6,17 +6,108 @@
 #ifndef MPOOL_PD_PRIV_H
 #define MPOOL_PD_PRIV_H
 
+#include <linux/spinlock.h>
+#include <linux/list.h>
+
 struct mpool_dev_info;
+struct omf_devparm_descriptor;
+struct dax_device;
+struct pmd_tier_ctrl;
+
+/**
+ * enum pd_ioclass - pd I/O classes, in decreasing order of priority
+ * @PD_IOC_LOGSYNC: mlog flushes a caller is waiting on (FUA)
+ * @PD_IOC_META:    MDC and superblock I/O
+ * @PD_IOC_READ:    foreground mblock and mlog reads
+ * @PD_IOC_BULK:    mblock writes and buffered mlog writes
+ * @PD_IOC_BG:      background work such as zone erase
+ */
+enum pd_ioclass {
+	PD_IOC_LOGSYNC,
+	PD_IOC_META,
+	PD_IOC_READ,
+	PD_IOC_BULK,
+	PD_IOC_BG,
+	PD_IOC_MAX
+};
+
+/* I/O classes which may be completed by polling, see pd_dev_poll_set() */
+#define PD_IOC_POLLMASK \
+	((1u << PD_IOC_LOGSYNC) | (1u << PD_IOC_META) | (1u << PD_IOC_READ))
+
+/**
+ * struct pd_ioq_class - per-class state of a pd dispatch queue
+ * @pqc_waitq:    waiters blocked on admission, in arrival order
+ * @pqc_inflight: class I/Os admitted and not yet completed
+ * @pqc_depth:    max class I/Os in flight
+ * @pqc_weight:   grants per round when the device queue is full
+ * @pqc_credit:   grants left in the current round
+ */
+struct pd_ioq_class {
+	struct list_head    pqc_waitq;
+	u32                 pqc_inflight;
+	u32                 pqc_depth;
+	u32                 pqc_weight;
+	u32                 pqc_credit;
+};
+
+/**
+ * struct pd_ioq - per-pd I/O dispatch queue
+ * @pq_lock:     protects all fields, taken from bio completion context
+ * @pq_inflight: I/Os admitted and not yet completed, all classes
+ * @pq_depth:    max I/Os in flight, 0 if dispatch control is disabled
+ * @pq_cursor:   class considered first by the next grant
+ * @pq_pollmask: classes whose synchronous I/Os are completed by polling
+ * @pq_classv:   per-class state
+ *
+ * An I/O is admitted right away if its class is below its depth limit,
+ * no I/O of its class is waiting, and the device is below pq_depth.
+ * Otherwise it waits, and completions hand freed slots to waiting
+ * classes in weighted round-robin order, see pd_ioq_dispatch().
+ */
+struct pd_ioq {
+	spinlock_t              pq_lock;
+	u32                     pq_inflight;
+	u32                     pq_depth;
+	u8                      pq_cursor;
+	u8                      pq_pollmask;
+	struct pd_ioq_class     pq_classv[PD_IOC_MAX];
+};
+
+/**
+ * struct pd_zoned - zoned block device state
+ * @pz_zonesect:  device zone size in sectors, equal to the mpool zone size
+ * @pz_appendmax: max bytes per zone append bio
+ * @pz_badcnt:    number of zones set in pz_badmap
+ * @pz_convmap:   conventional zones, which are written in place
+ * @pz_badmap:    offline and read-only zones, never allocated by smap
+ *
+ * Each mpool zone maps onto one device zone.  Sequential zones are written
+ * with zone append and erased by a zone reset.
+ */
+struct pd_zoned {
+	u64                 pz_zonesect;
+	u32                 pz_appendmax;
+	u32                 pz_badcnt;
+	unsigned long      *pz_convmap;
+	unsigned long      *pz_badmap;
+};
 
 /**
  * struct pd_dev_parm -
  * @dpr_prop:		drive properties including zone parameters
  * @dpr_dev_private:    private info for implementation
+ * @dpr_ioq:            I/O dispatch queue
+ * @dpr_zoned:          zoned device state, NULL for a conventional device
+ * @dpr_dax:            DAX device written with CPU stores, see pd_dax_write()
  *
  */
 struct pd_dev_parm {
 	struct pd_prop	         dpr_prop;
 	void		        *dpr_dev_private;
+	struct pd_ioq            dpr_ioq;
+	struct pd_zoned         *dpr_zoned;
+	struct dax_device       *dpr_dax;
 };
 
 /* Shortcuts */
@@ -28,6 +119,29 @@ struct pd_dev_parm {
 #define dpr_cmdopt        dpr_prop.pdp_cmdopt
 #define dpr_optiosz       dpr_prop.pdp_optiosz
 
+/**
+ * struct pd_io_ctx - completion context for asynchronous pd I/O
+ * @pic_done: completion callback, called once when the entire I/O completes
+ * @pic_arg:  caller private data
+ *
+ * The context is owned by the caller and must remain valid until
+ * pic_done() is called.  pic_ioq and pic_ioc are set by pd.  pic_done() is called from bio completion
+ * context and therefore must not sleep.
+ */
+struct pd_io_ctx {
+	void  (*pic_done)(struct pd_io_ctx *ctx, merr_t err);
+	void   *pic_arg;
+
+	/* Private to pd */
+	struct pd_ioq      *pic_ioq;
+	enum pd_ioclass     pic_ioc;
+
+	/* Private to pmd, see pmd_layout_rw_async() */
+	void  (*pic_tierdone)(struct pd_io_ctx *ctx, merr_t err);
+	struct pmd_tier_ctrl   *pic_tier;
+	u32                     pic_tieridx;
+};
+
 /*
  * pd API functions -- device-type independent dparm ops
  */
@@ -61,6 +175,17 @@ merr_t pd_dev_close(struct pd_dev_parm *dparm);
  */
 merr_t pd_dev_flush(struct mpool_dev_info *pd);
 
+/**
+ * pd_dev_poll_set() - select the I/O classes completed by polling
+ * @dparm:
+ * @iocmask: bitmask of (1 << enum pd_ioclass), within PD_IOC_POLLMASK
+ *
+ * Synchronous I/Os of the selected classes which fit in one bio of at most
+ * PD_POLL_IOSZ_MAX bytes are submitted with REQ_HIPRI and their completion
+ * is polled for.  Ignored if the device has no poll queues.
+ */
+void pd_dev_poll_set(struct pd_dev_parm *dparm, u32 iocmask);
+
 /**
  * pd_bio_erase() -
  * @pd:
@@ -68,6 +193,8 @@ merr_t pd_dev_flush(struct mpool_dev_info *pd);
  * @zonecnt:
  * @reads_erased: whether the data can be read post DISCARD
  *
+ * The sequential zones of a zoned device are reset rather than discarded.
+ *
  * Return:
  */
 merr_t pd_zone_erase(struct mpool_dev_info *pd, u64 zaddr, u32 zonecnt, bool reads_erased);
@@ -84,6 +211,11 @@ merr_t pd_zone_erase(struct mpool_dev_info *pd, u64 zaddr, u32 zonecnt, bool rea
  * @zaddr:
  * @boff: offset in bytes from the start of "zaddr".
  * @opflags:
+ * @ioc:  I/O class
+ *
+ * On a zoned device writes to a sequential zone must be sequential, starting
+ * from an empty zone, or fail with EIO.  On a DAX device the
+ * data is stored to persistent memory, and is durable on return.
  *
  * Return:
  */
@@ -94,7 +226,8 @@ pd_zone_pwritev(
 	int                     iovcnt,
 	u64                     zaddr,
 	loff_t                  boff,
-	int                     opflags);
+	int                     opflags,
+	enum pd_ioclass         ioc);
 
 /**
  * pd_zone_pwritev_sync() -
@@ -121,6 +254,7 @@ pd_zone_pwritev_sync(
  * @iovcnt:
  * @zaddr: target zone for this I/O
  * @boff:    byte offset into the target zone
+ * @ioc:     I/O class
  *
  * Return:
  */
@@ -130,7 +264,63 @@ pd_zone_preadv(
 	const struct kvec      *iov,
 	int                     iovcnt,
 	u64                     zaddr,
-	loff_t                  boff);
+	loff_t                  boff,
+	enum pd_ioclass         ioc);
+
+/**
+ * pd_zone_pwritev_async() - asynchronous variant of pd_zone_pwritev()
+ * @pd:
+ * @iov:
+ * @iovcnt:
+ * @zaddr:
+ * @boff: offset in bytes from the start of "zaddr".
+ * @opflags:
+ * @ioc:  I/O class
+ * @ctx:  completion context
+ *
+ * Returns once all bios have been submitted.  The iovec array may be
+ * released on return, but the buffers it describes must remain valid
+ * until ctx->pic_done() is called.
+ *
+ * Not supported on zoned devices.  On a DAX device the write completes,
+ * and ctx->pic_done() is called, before returning.
+ *
+ * Return: 0 if the I/O was submitted, in which case ctx->pic_done() will
+ * be called with the I/O status.  Otherwise merr_t and ctx->pic_done()
+ * is not called.
+ */
+merr_t
+pd_zone_pwritev_async(
+	struct mpool_dev_info  *pd,
+	const struct kvec      *iov,
+	int                     iovcnt,
+	u64                     zaddr,
+	loff_t                  boff,
+	int                     opflags,
+	enum pd_ioclass         ioc,
+	struct pd_io_ctx       *ctx);
+
+/**
+ * pd_zone_preadv_async() - asynchronous variant of pd_zone_preadv()
+ * @pd:
+ * @iov:
+ * @iovcnt:
+ * @zaddr: target zone for this I/O
+ * @boff:  byte offset into the target zone
+ * @ioc:   I/O class
+ * @ctx:   completion context
+ *
+ * See pd_zone_pwritev_async() for the completion semantics.
+ */
+merr_t
+pd_zone_preadv_async(
+	struct mpool_dev_info  *pd,
+	const struct kvec      *iov,
+	int                     iovcnt,
+	u64                     zaddr,
+	loff_t                  boff,
+	enum pd_ioclass         ioc,
+	struct pd_io_ctx       *ctx);
 
 /**
  * pd_dev_set_unavail() -
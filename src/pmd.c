@@ -18,15 +18,26 @@
 #include <linux/atomic.h>
 #include <linux/rwsem.h>
 #include <linux/mutex.h>
+#include <linux/ktime.h>
 #include <linux/sort.h>
 #include <linux/delay.h>
+#include <linux/hash.h>
 
 #include "mpool_defs.h"
+#include "mpool_trace.h"
 
 static merr_t pmd_write_meta_to_latest_version(struct mpool_descriptor *mp, bool permitted);
 
+static merr_t pmd_mdc_upgrade(struct mpool_descriptor *mp, u8 cslot, bool permitted);
+
+static merr_t pmd_mdc_load(struct mpool_descriptor *mp, u8 cslot, bool wait);
+
 static void pmd_layout_unprovision(struct mpool_descriptor *mp, struct pmd_layout *layout);
 
+static void pmd_idckpt_work(struct work_struct *work);
+
+static void pmd_rebal(struct work_struct *work);
+
 static merr_t
 pmd_obj_alloc_cmn(
 	struct mpool_descriptor    *mp,
@@ -38,6 +49,16 @@ pmd_obj_alloc_cmn(
 	bool                        needref,
 	struct pmd_layout         **layoutp);
 
+/*
+ * Highest uniquifier covered by the last objid checkpoint of an MDC.  After
+ * a crash the MDC resumes allocation past this limit, hence objids up to it
+ * may be handed out without further logging.
+ */
+static inline u64 pmd_idckpt_limit(struct pmd_mdc_info *cinfo)
+{
+	return objid_uniq(READ_ONCE(cinfo->mmi_lckpt)) + OBJID_UNIQ_DELTA - 1;
+}
+
 /*
  * lock for serializing certain pmd ops where required/desirable; could be per
  * mpool but no meaningful performance benefit in doing so for these rare ops
@@ -60,13 +81,13 @@ pmd_layout_alloc(
 	u64                         mblen,
 	u32                         zcnt)
 {
-	struct kmem_cache *cache = pmd_layout_cache;
+	struct objcache   *oc = &pmd_layout_oc;
 	struct pmd_layout *layout;
 
 	if (pmd_objid_type(objid) == OMF_OBJ_MLOG)
-		cache = pmd_layout_priv_cache;
+		oc = &pmd_layout_priv_oc;
 
-	layout = kmem_cache_zalloc(cache, GFP_KERNEL);
+	layout = objcache_alloc(oc, GFP_KERNEL, true);
 	if (ev(!layout))
 		return NULL;
 
@@ -75,20 +96,37 @@ pmd_layout_alloc(
 	layout->eld_mblen     = mblen;
 	layout->eld_ld.ol_zcnt = zcnt;
 	kref_init(&layout->eld_ref);
-	init_rwsem(&layout->eld_rwlock);
 
-	if (pmd_objid_type(objid) == OMF_OBJ_MLOG)
+	if (pmd_objid_type(objid) == OMF_OBJ_MLOG) {
+		init_rwsem(&layout->eld_mlpriv.mlp_rwlock);
 		mpool_uuid_copy(&layout->eld_uuid, uuid);
+	}
 
 	return layout;
 }
 
+static void pmd_layout_free_rcu(struct rcu_head *rh)
+{
+	struct objcache   *oc = &pmd_layout_oc;
+	struct pmd_layout *layout;
+
+	layout = container_of(rh, typeof(*layout), eld_rcu);
+
+	if (pmd_objid_type(layout->eld_objid) == OMF_OBJ_MLOG)
+		oc = &pmd_layout_priv_oc;
+
+	layout->eld_objid = 0;
+
+	objcache_free(oc, layout);
+}
+
 /*
- * Deallocate all memory associated with object layout.
+ * Deallocate all memory associated with object layout.  The free is
+ * deferred for an RCU grace period as committed object lookups may
+ * still be examining the layout (see pmd_co_find_get()).
  */
 void pmd_layout_release(struct kref *refp)
 {
-	struct kmem_cache *cache = pmd_layout_cache;
 	struct pmd_layout *layout;
 
 	layout = container_of(refp, typeof(*layout), eld_ref);
@@ -98,12 +136,9 @@ void pmd_layout_release(struct kref *refp)
 		  __func__, layout, (ulong)layout->eld_objid,
 		  layout->eld_state, (long)kref_read(&layout->eld_ref));
 
-	if (pmd_objid_type(layout->eld_objid) == OMF_OBJ_MLOG)
-		cache = pmd_layout_priv_cache;
-
-	layout->eld_objid = 0;
+	mblock_layout_release(layout);
 
-	kmem_cache_free(cache, layout);
+	call_rcu(&layout->eld_rcu, pmd_layout_free_rcu);
 }
 
 static struct pmd_layout *pmd_layout_find(struct rb_root *root, u64 key)
@@ -177,15 +212,59 @@ static inline void pmd_co_wunlock(struct pmd_mdc_info *cinfo)
 	up_write(&cinfo->mmi_co_lock);
 }
 
+static const struct rhashtable_params pmd_co_htab_params = {
+	.key_len             = sizeof(u64),
+	.key_offset          = offsetof(struct pmd_layout, eld_objid),
+	.head_offset         = offsetof(struct pmd_layout, eld_hnode),
+	.automatic_shrinking = true,
+};
+
 static inline struct pmd_layout *pmd_co_find(struct pmd_mdc_info *cinfo, u64 objid)
 {
 	return pmd_layout_find(&cinfo->mmi_co_root, objid);
 }
 
+/*
+ * Look up a committed object and take a ref on it without holding
+ * mmi_co_lock.  Returns NULL if the object is not in the hash index,
+ * in which case the caller must fall back to a locked tree search.
+ */
+static struct pmd_layout *pmd_co_find_get(struct pmd_mdc_info *cinfo, u64 objid)
+{
+	struct pmd_layout *found;
+
+	rcu_read_lock();
+	found = rhashtable_lookup_fast(cinfo->mmi_co_htab, &objid, pmd_co_htab_params);
+	if (found && !kref_get_unless_zero(&found->eld_ref))
+		found = NULL;
+	rcu_read_unlock();
+
+	/*
+	 * A successful kref_get_unless_zero() is fully ordered, and pairs
+	 * with the smp_mb() in pmd_obj_delete(): either we see the object
+	 * being removed or the deleter sees our ref and backs off.
+	 */
+	if (found && (READ_ONCE(found->eld_state) & PMD_LYT_REMOVED)) {
+		kref_put(&found->eld_ref, pmd_layout_release);
+		found = NULL;
+	}
+
+	return found;
+}
+
 static inline struct pmd_layout *
 pmd_co_insert(struct pmd_mdc_info *cinfo, struct pmd_layout *layout)
 {
-	return pmd_layout_insert(&cinfo->mmi_co_root, layout);
+	struct pmd_layout *found;
+
+	found = pmd_layout_insert(&cinfo->mmi_co_root, layout);
+
+	/* The tree is authoritative; on failure lookups fall back to it. */
+	if (!found)
+		ev(rhashtable_insert_fast(cinfo->mmi_co_htab, &layout->eld_hnode,
+					  pmd_co_htab_params));
+
+	return found;
 }
 
 static inline struct pmd_layout *
@@ -194,8 +273,10 @@ pmd_co_remove(struct pmd_mdc_info *cinfo, struct pmd_layout *layout)
 	struct pmd_layout *found;
 
 	found = pmd_co_find(cinfo, layout->eld_objid);
-	if (found)
+	if (found) {
 		rb_erase(&found->eld_nodemdc, &cinfo->mmi_co_root);
+		rhashtable_remove_fast(cinfo->mmi_co_htab, &found->eld_hnode, pmd_co_htab_params);
+	}
 
 	return found;
 }
@@ -247,12 +328,22 @@ struct pmd_layout *pmd_obj_find_get(struct mpool_descriptor *mp, u64 objid, int
 	cinfo = &mp->pds_mda.mdi_slotv[cslot];
 	found = NULL;
 
+	/* An MDC that failed to load lazily is treated as empty */
+	if (pmd_mdc_load(mp, cslot, true))
+		return NULL;
+
 	/*
 	 * which < 0  - search uncommitted tree only
 	 * which > 0  - search tree only
 	 * which == 0 - search both trees
+	 *
+	 * The committed objects hash index is tried first as it requires
+	 * no locks; a miss there is confirmed by searching the trees.
 	 */
-	if (which <= 0) {
+	if (which >= 0)
+		found = pmd_co_find_get(cinfo, objid);
+
+	if (!found && which <= 0) {
 		pmd_uc_lock(cinfo, cslot);
 		found = pmd_uc_find(cinfo, objid);
 		if (found)
@@ -271,6 +362,115 @@ struct pmd_layout *pmd_obj_find_get(struct mpool_descriptor *mp, u64 objid, int
 	return found;
 }
 
+/*
+ * PMD_FINDV_BATCH: committed object lookups per rcu_read_lock() section of
+ *                  pmd_obj_find_getv()
+ */
+#define PMD_FINDV_BATCH         256
+
+merr_t
+pmd_obj_find_getv(
+	struct mpool_descriptor    *mp,
+	const u64                  *objidv,
+	u32                         objidc,
+	struct pmd_layout         **layoutv)
+{
+	DECLARE_BITMAP(slots, MDC_SLOTS);
+	struct pmd_mdc_info    *cinfo;
+	struct pmd_layout      *found;
+	u32                     i, j, end, missc;
+	u8                      cslot;
+
+	bitmap_zero(slots, MDC_SLOTS);
+
+	/* Wait once per MDC for it to be loaded; a failed MDC is treated as empty */
+	for (i = 0; i < objidc; i++) {
+		layoutv[i] = NULL;
+
+		if (!objtype_user(objid_type(objidv[i])))
+			return merr(ENOENT);
+
+		cslot = objid_slot(objidv[i]);
+		if (test_and_set_bit(cslot, slots))
+			continue;
+
+		if (pmd_mdc_load(mp, cslot, true))
+			return merr(ENOENT);
+	}
+
+	/* The committed objects of all the MDCs share one hash index */
+	for (i = 0, missc = 0; i < objidc; i = end) {
+		end = min_t(u32, objidc, i + PMD_FINDV_BATCH);
+
+		rcu_read_lock();
+		for (j = i; j < end; j++) {
+			found = rhashtable_lookup_fast(&mp->pds_mda.mdi_co_htab, &objidv[j],
+						       pmd_co_htab_params);
+			if (found && kref_get_unless_zero(&found->eld_ref))
+				layoutv[j] = found;
+		}
+		rcu_read_unlock();
+
+		/* See pmd_co_find_get() */
+		for (j = i; j < end; j++) {
+			found = layoutv[j];
+			if (found && (READ_ONCE(found->eld_state) & PMD_LYT_REMOVED)) {
+				kref_put(&found->eld_ref, pmd_layout_release);
+				layoutv[j] = NULL;
+			}
+			missc += !layoutv[j];
+		}
+
+		cond_resched();
+	}
+
+	if (missc == 0)
+		return 0;
+
+	/*
+	 * Confirm the misses in the trees, taking each MDC's mmi_co_lock once.
+	 * A slot's bit is cleared once its tree has been searched, hence any
+	 * object still missing from a cleared slot does not exist.
+	 */
+	for (i = 0; i < objidc; i++) {
+		if (layoutv[i])
+			continue;
+
+		cslot = objid_slot(objidv[i]);
+		if (!test_and_clear_bit(cslot, slots))
+			goto errout;
+
+		cinfo = &mp->pds_mda.mdi_slotv[cslot];
+
+		pmd_co_rlock(cinfo, cslot);
+		for (j = i; j < objidc; j++) {
+			if (layoutv[j] || objid_slot(objidv[j]) != cslot)
+				continue;
+
+			found = pmd_co_find(cinfo, objidv[j]);
+			if (found) {
+				kref_get(&found->eld_ref);
+				layoutv[j] = found;
+			}
+		}
+		pmd_co_runlock(cinfo);
+
+		if (!layoutv[i])
+			goto errout;
+	}
+
+	return 0;
+
+errout:
+	for (i = 0; i < objidc; i++) {
+		if (layoutv[i])
+			pmd_obj_put(mp, layoutv[i]);
+		layoutv[i] = NULL;
+	}
+
+	return merr(ENOENT);
+}
+
 void pmd_obj_put(struct mpool_descriptor *mp, struct pmd_layout *layout)
 {
 	kref_put(&layout->eld_ref, pmd_layout_release);
@@ -287,9 +487,23 @@ void pmd_mdc_unlock(struct mutex *lock)
 	mutex_unlock(lock);
 }
 
-static void pmd_mda_init(struct mpool_descriptor *mp)
+static merr_t pmd_mda_init(struct mpool_descriptor *mp)
 {
-	int i;
+	int rc, i;
+
+	rc = rhashtable_init(&mp->pds_mda.mdi_co_htab, &pmd_co_htab_params);
+	if (rc)
+		return merr(rc);
+
+	for (i = 0; i < PMD_USAGE_MAX; ++i) {
+		rc = percpu_counter_init(&mp->pds_mda.mdi_usage[i], 0, GFP_KERNEL);
+		if (rc) {
+			while (i-- > 0)
+				percpu_counter_destroy(&mp->pds_mda.mdi_usage[i]);
+			rhashtable_destroy(&mp->pds_mda.mdi_co_htab);
+			return merr(rc);
+		}
+	}
 
 	spin_lock_init(&mp->pds_mda.mdi_slotvlock);
 	mp->pds_mda.mdi_slotvcnt = 0;
@@ -298,15 +512,19 @@ static void pmd_mda_init(struct mpool_descriptor *mp)
 		struct pmd_mdc_info *pmi = mp->pds_mda.mdi_slotv + i;
 
 		mutex_init(&pmi->mmi_compactlock);
+		mutex_init(&pmi->mmi_gclock);
+		INIT_LIST_HEAD(&pmi->mmi_gcwq);
 		mutex_init(&pmi->mmi_uc_lock);
 		pmi->mmi_uc_root = RB_ROOT;
 		init_rwsem(&pmi->mmi_co_lock);
 		pmi->mmi_co_root = RB_ROOT;
+		pmi->mmi_co_htab = &mp->pds_mda.mdi_co_htab;
 		mutex_init(&pmi->mmi_uqlock);
-		pmi->mmi_luniq = 0;
+		atomic64_set(&pmi->mmi_luniq, 0);
+		INIT_WORK(&pmi->mmi_ckptwork, pmd_idckpt_work);
+		pmi->mmi_mp = mp;
 		pmi->mmi_recbuf = NULL;
 		pmi->mmi_lckpt = objid_make(0, OMF_OBJ_UNDEF, i);
-		memset(&pmi->mmi_stats, 0, sizeof(pmi->mmi_stats));
 
 		/*
 		 * Initial mpool metadata content version.
@@ -317,12 +535,39 @@ static void pmd_mda_init(struct mpool_descriptor *mp)
 		pmi->mmi_mdcver.mdcv_dev   = 0;
 
 		pmi->mmi_credit.ci_slot = i;
+		atomic_set(&pmi->mmi_pcoactive, 0);
 
-		mutex_init(&pmi->mmi_stats_lock);
+		atomic_set(&pmi->mmi_loadstate, PMD_MDC_LOADED);
+		pmi->mmi_loaderr = 0;
+		init_completion(&pmi->mmi_loaded);
 	}
 
-	mp->pds_mda.mdi_slotv[1].mmi_luniq = UROOT_OBJID_MAX;
+	mp->pds_tier.ptc_rdepoch = 0;
+	atomic_set(&mp->pds_tier.ptc_rdcnt[0], 0);
+	atomic_set(&mp->pds_tier.ptc_rdcnt[1], 0);
+	init_waitqueue_head(&mp->pds_tier.ptc_rdwq);
+	mutex_init(&mp->pds_tier.ptc_movelock);
+
+	mp->pds_rebal.prc_mp = mp;
+	mp->pds_rebal.prc_pass = NULL;
+	mp->pds_rebal.prc_active = false;
+	mp->pds_rebal.prc_start = 0;
+	spin_lock_init(&mp->pds_rebal.prc_lock);
+	INIT_DELAYED_WORK(&mp->pds_rebal.prc_dwork, pmd_rebal);
+
+	mp->pds_mda.mdi_lazyv = NULL;
+	mp->pds_mda.mdi_lazyend = 0;
+	mp->pds_mda.mdi_lazystop = false;
+	atomic_set(&mp->pds_mda.mdi_lazyprog, 0);
+	atomic_set(&mp->pds_mda.mdi_lazycnt, 0);
+	atomic64_set(&mp->pds_mda.mdi_lazyerr, 0);
+	init_completion(&mp->pds_mda.mdi_lazydone);
+	complete_all(&mp->pds_mda.mdi_lazydone);
+
+	atomic64_set(&mp->pds_mda.mdi_slotv[1].mmi_luniq, UROOT_OBJID_MAX);
 	mp->pds_mda.mdi_sel.mds_tbl_idx.counter = 0;
+
+	return 0;
 }
 
 static merr_t
@@ -761,10 +1006,10 @@ static merr_t pmd_mdc0_validate(struct mpool_descriptor *mp, int activation)
 			 * failures; single-threaded; don't need slotvlock
 			 * or uqlock to adjust mda
 			 */
-			cinfo->mmi_luniq = mdcmax - 1;
+			atomic64_set(&cinfo->mmi_luniq, mdcmax - 1);
 			mp->pds_mda.mdi_slotvcnt = mdcmax;
 			mp_pr_warn("mpool %s, MDC0 alloc recovery: uniq %llu slotvcnt %d",
-				   mp->pds_name, (unsigned long long)cinfo->mmi_luniq,
+				   mp->pds_name, (unsigned long long)atomic64_read(&cinfo->mmi_luniq),
 				   mp->pds_mda.mdi_slotvcnt);
 		} else {
 			/* MDC alloc cannot tolerate clean-up failures */
@@ -786,11 +1031,29 @@ static merr_t pmd_mdc0_validate(struct mpool_descriptor *mp, int activation)
 }
 
 /**
- * pmd_update_mdc_stats() - update per-MDC space usage
+ * pmd_usage_add() - fold a delta into one of the mpool's usage counters
+ * @mp:
+ * @idx:   enum pmd_usage
+ * @delta:
+ */
+static inline void pmd_usage_add(struct mpool_descriptor *mp, enum pmd_usage idx, s64 delta)
+{
+	s32 batch = PMD_USAGE_BATCH_LEN;
+
+	if (idx == PMD_USAGE_MBLOCK_CNT || idx == PMD_USAGE_MLOG_CNT)
+		batch = PMD_USAGE_BATCH_CNT;
+
+	percpu_counter_add_batch(&mp->pds_mda.mdi_usage[idx], delta, batch);
+}
+
+/**
+ * pmd_update_mdc_stats() - update the mpool space usage
  * @mp:
  * @layout:
- * @cinfo:
+ * @cinfo: MDC containing the object
  * @op: object opcode
+ *
+ * Updates are per-cpu deltas, so no lock is taken here or by pmd_mpool_usage().
  */
 static void
 pmd_update_mdc_stats(
@@ -799,51 +1062,51 @@ pmd_update_mdc_stats(
 	struct pmd_mdc_info        *cinfo,
 	enum pmd_obj_op             op)
 {
-	struct pmd_mdc_stats   *pms;
 	enum obj_type_omf       otype;
 	u64                     cap;
 
-	otype = pmd_objid_type(layout->eld_objid);
+	/* MDC0 holds the MDCN mlogs, which are not reported as usage */
+	if (cinfo == &mp->pds_mda.mdi_slotv[0])
+		return;
 
-	mutex_lock(&cinfo->mmi_stats_lock);
-	pms = &cinfo->mmi_stats;
+	otype = pmd_objid_type(layout->eld_objid);
 
 	/* Update space usage and mblock/mlog count */
 	switch (op) {
 	case PMD_OBJ_LOAD:
 		if (otype == OMF_OBJ_MBLOCK)
-			pms->pms_mblock_wlen += layout->eld_mblen;
+			pmd_usage_add(mp, PMD_USAGE_MBLOCK_WLEN, layout->eld_mblen);
 		/* Fall through */
 
 	case PMD_OBJ_ALLOC:
 		cap = pmd_layout_cap_get(mp, layout);
 		if (otype == OMF_OBJ_MLOG) {
-			pms->pms_mlog_cnt++;
-			pms->pms_mlog_alen += cap;
+			pmd_usage_add(mp, PMD_USAGE_MLOG_CNT, 1);
+			pmd_usage_add(mp, PMD_USAGE_MLOG_ALEN, cap);
 		} else if (otype == OMF_OBJ_MBLOCK) {
-			pms->pms_mblock_cnt++;
-			pms->pms_mblock_alen += cap;
+			pmd_usage_add(mp, PMD_USAGE_MBLOCK_CNT, 1);
+			pmd_usage_add(mp, PMD_USAGE_MBLOCK_ALEN, cap);
 		}
 		break;
 
 	case PMD_OBJ_COMMIT:
 		if (otype == OMF_OBJ_MBLOCK)
-			pms->pms_mblock_wlen += layout->eld_mblen;
+			pmd_usage_add(mp, PMD_USAGE_MBLOCK_WLEN, layout->eld_mblen);
 		break;
 
 	case PMD_OBJ_DELETE:
 		if (otype == OMF_OBJ_MBLOCK)
-			pms->pms_mblock_wlen -= layout->eld_mblen;
+			pmd_usage_add(mp, PMD_USAGE_MBLOCK_WLEN, -(s64)layout->eld_mblen);
 		/* Fall through */
 
 	case PMD_OBJ_ABORT:
 		cap = pmd_layout_cap_get(mp, layout);
 		if (otype == OMF_OBJ_MLOG) {
-			pms->pms_mlog_cnt--;
-			pms->pms_mlog_alen -= cap;
+			pmd_usage_add(mp, PMD_USAGE_MLOG_CNT, -1);
+			pmd_usage_add(mp, PMD_USAGE_MLOG_ALEN, -(s64)cap);
 		} else if (otype == OMF_OBJ_MBLOCK) {
-			pms->pms_mblock_cnt--;
-			pms->pms_mblock_alen -= cap;
+			pmd_usage_add(mp, PMD_USAGE_MBLOCK_CNT, -1);
+			pmd_usage_add(mp, PMD_USAGE_MBLOCK_ALEN, -(s64)cap);
 		}
 		break;
 
@@ -851,8 +1114,70 @@ pmd_update_mdc_stats(
 		assert(0);
 		break;
 	}
+}
+
+/**
+ * pmd_objs_load_ckpt() - bulk load a checkpoint record written by compaction
+ * @mp:
+ * @cslot:
+ * @recbuf: packed OMF_MDR_OCKPT record
+ * @msg:    (output) error detail
+ */
+static merr_t
+pmd_objs_load_ckpt(struct mpool_descriptor *mp, u8 cslot, const char *recbuf, const char **msg)
+{
+	struct pmd_layout      *layoutv[OMF_MDCREC_CKPT_MAX];
+	struct pmd_mdc_info    *cinfo;
+	struct pmd_layout      *layout;
+	struct omf_mdcrec_data  cdr;
+	merr_t                  err;
+	int                     i;
+
+	cinfo = &mp->pds_mda.mdi_slotv[cslot];
+
+	if (omfu_mdcver_cmp2(&cinfo->mmi_mdcver, "<", 1, 0, 0, 1)) {
+		*msg = "OCKPT record in MDC content version < 1.0.0.1";
+		return merr(EINVAL);
+	}
+
+	cdr.u.ckpt.omd_layoutv = layoutv;
+
+	err = omf_mdcrec_unpack_letoh(&cinfo->mmi_mdcver, mp, &cdr, recbuf);
+	if (ev(err)) {
+		*msg = "mlog checkpoint record unpack failed";
+		i = 0;
+		goto errout;
+	}
+
+	for (i = 0; i < cdr.u.ckpt.omd_layoutc; i++) {
+		layout = layoutv[i];
+
+		if (objid_slot(layout->eld_objid) != cslot) {
+			*msg = "mlog checkpoint record wrong slot";
+			err = merr(EBADSLT);
+			goto errout;
+		}
+
+		layout->eld_state = PMD_LYT_COMMITTED;
+
+		if (pmd_co_insert(cinfo, layout)) {
+			*msg = "OCKPT duplicate object ID";
+			err = merr(EEXIST);
+			goto errout;
+		}
+
+		atomic_inc(&cinfo->mmi_pco_cnt.pcc_cr);
+		atomic_inc(&cinfo->mmi_pco_cnt.pcc_cobj);
+	}
+
+	return 0;
 
-	mutex_unlock(&cinfo->mmi_stats_lock);
+errout:
+	/* Free the layouts not inserted in the committed objects tree */
+	for (; i < cdr.u.ckpt.omd_layoutc; i++)
+		pmd_obj_put(mp, layoutv[i]);
+
+	return err;
 }
 
 static merr_t pmd_objs_load(struct mpool_descriptor *mp, u8 cslot)
@@ -949,6 +1274,13 @@ static merr_t pmd_objs_load(struct mpool_descriptor *mp, u8 cslot)
 		if (!cslot && !omf_mdcrec_isobj_le(recbuf))
 			continue;
 
+		if (omf_mdcrec_unpack_type_letoh(recbuf) == OMF_MDR_OCKPT) {
+			err = pmd_objs_load_ckpt(mp, cslot, recbuf, &msg);
+			if (ev(err))
+				break;
+			continue;
+		}
+
 		err = omf_mdcrec_unpack_letoh(&cinfo->mmi_mdcver, mp, &cdr, recbuf);
 		if (ev(err)) {
 			msg = "mlog record unpack failed";
@@ -1106,7 +1438,7 @@ static merr_t pmd_objs_load(struct mpool_descriptor *mp, u8 cslot)
 
 	if (!cslot) {
 		/* MDC0: finish initializing mda */
-		cinfo->mmi_luniq = mdcmax;
+		atomic64_set(&cinfo->mmi_luniq, mdcmax);
 		mp->pds_mda.mdi_slotvcnt = mdcmax + 1;
 
 		/* MDC0 only: validate other mdc metadata; may make adjustments to mp.mda. */
@@ -1120,7 +1452,7 @@ static merr_t pmd_objs_load(struct mpool_descriptor *mp, u8 cslot)
 		 * will be checkpointed; supports realloc of
 		 * uncommitted objects after a crash
 		 */
-		cinfo->mmi_luniq = objid_uniq(cinfo->mmi_lckpt) + OBJID_UNIQ_DELTA - 1;
+		atomic64_set(&cinfo->mmi_luniq, pmd_idckpt_limit(cinfo));
 	}
 
 errout:
@@ -1169,6 +1501,14 @@ static void pmd_mda_free(struct mpool_descriptor *mp)
 			pmd_obj_put(mp, layout);
 		}
 	}
+
+	rhashtable_destroy(&mp->pds_mda.mdi_co_htab);
+
+	for (sidx = 0; sidx < PMD_USAGE_MAX; sidx++)
+		percpu_counter_destroy(&mp->pds_mda.mdi_usage[sidx]);
+
+	kfree(mp->pds_mda.mdi_lazyv);
+	mp->pds_mda.mdi_lazyv = NULL;
 }
 
 /**
@@ -1202,22 +1542,124 @@ static void pmd_objs_load_worker(struct work_struct *ws)
 	}
 }
 
+/**
+ * pmd_mdc_load() - load the object layouts of an MDC unless already done
+ * @mp:
+ * @cslot:
+ * @wait:  wait for the MDC if another thread is loading it
+ *
+ * MDCs are only ever in the PMD_MDC_UNLOADED state after a lazy activation.
+ * Whoever claims an unloaded MDC loads it, brings its metadata to the latest
+ * version, and wakes up anyone waiting on it. The last MDC loaded refreshes
+ * the MDC allocation credits, which can't be computed before all of them
+ * are known.
+ *
+ * Return: the outcome of loading the MDC, 0 if it is being loaded by another
+ * thread and wait is false.
+ */
+static merr_t pmd_mdc_load(struct mpool_descriptor *mp, u8 cslot, bool wait)
+{
+	struct pmd_mda_info    *mda = &mp->pds_mda;
+	struct pmd_mdc_info    *cinfo = &mda->mdi_slotv[cslot];
+	merr_t                  err;
+	int                     state;
+
+	if (atomic_read_acquire(&cinfo->mmi_loadstate) == PMD_MDC_LOADED)
+		return cinfo->mmi_loaderr;
+
+	state = atomic_cmpxchg(&cinfo->mmi_loadstate, PMD_MDC_UNLOADED, PMD_MDC_LOADING);
+	if (state != PMD_MDC_UNLOADED) {
+		if (!wait)
+			return 0;
+
+		wait_for_completion(&cinfo->mmi_loaded);
+		return cinfo->mmi_loaderr;
+	}
+
+	err = pmd_objs_load(mp, cslot);
+	if (!err)
+		err = pmd_mdc_upgrade(mp, cslot, true);
+	if (err) {
+		mp_pr_err("mpool %s, failed to load MDC%u", err, mp->pds_name, cslot);
+		atomic64_cmpxchg(&mda->mdi_lazyerr, 0, err);
+	}
+
+	cinfo->mmi_loaderr = err;
+	atomic_set_release(&cinfo->mmi_loadstate, PMD_MDC_LOADED);
+	complete_all(&cinfo->mmi_loaded);
+
+	if (atomic_dec_and_test(&mda->mdi_lazycnt)) {
+		pmd_update_credit(mp);
+		complete_all(&mda->mdi_lazydone);
+	}
+
+	return err;
+}
+
+merr_t pmd_mdc_load_all(struct mpool_descriptor *mp)
+{
+	struct pmd_mda_info    *mda = &mp->pds_mda;
+	u16                     cslot;
+
+	if (!completion_done(&mda->mdi_lazydone)) {
+		for (cslot = 1; cslot < mda->mdi_lazyend; cslot++)
+			pmd_mdc_load(mp, cslot, false);
+
+		wait_for_completion(&mda->mdi_lazydone);
+	}
+
+	return atomic64_read(&mda->mdi_lazyerr);
+}
+
+/**
+ * pmd_objs_load_lazy_worker() -
+ * @ws:
+ *
+ * worker thread for loading user MDC 1~N after a lazy activation.
+ * Same as pmd_objs_load_worker() except that an MDC that fails to load
+ * doesn't prevent the others from loading, and that MDCs already claimed
+ * by an object lookup are skipped.
+ */
+static void pmd_objs_load_lazy_worker(struct work_struct *ws)
+{
+	struct pmd_obj_load_work       *olw;
+	struct pmd_mda_info            *mda;
+	int                             sidx;
+
+	olw = container_of(ws, struct pmd_obj_load_work, olw_work);
+	mda = &olw->olw_mp->pds_mda;
+
+	while (!READ_ONCE(mda->mdi_lazystop)) {
+		sidx = atomic_fetch_add(1, olw->olw_progress);
+		if (sidx >= mda->mdi_lazyend)
+			break; /* No more MDCs to load */
+
+		pmd_mdc_load(olw->olw_mp, sidx, false);
+	}
+}
+
 /**
  * pmd_objs_load_parallel() - load MDC 1~N in parallel
  * @mp:
+ * @lazy: return right after starting the jobs
  *
  * By loading user MDCs in parallel, we can reduce the mpool activate
  * time, since the jobs of loading MDC 1~N are independent.
  * On the other hand, we don't want to start all the jobs at once.
  * If any one fails, we don't have to start others.
+ *
+ * If lazy is set, the jobs are left running and MDCs are loaded on demand
+ * by pmd_mdc_load() until they are done.
  */
-static merr_t pmd_objs_load_parallel(struct mpool_descriptor *mp)
+static merr_t pmd_objs_load_parallel(struct mpool_descriptor *mp, bool lazy)
 {
+	struct pmd_mda_info        *mda = &mp->pds_mda;
 	struct pmd_obj_load_work   *olwv;
 
 	atomic64_t  err = ATOMIC64_INIT(0);
 	atomic_t    progress = ATOMIC_INIT(1);
 	uint        njobs, inc, cpu, i;
+	u16         cslot;
 
 	if (mp->pds_mda.mdi_slotvcnt < 2)
 		return 0; /* No user MDCs allocated */
@@ -1235,14 +1677,31 @@ static merr_t pmd_objs_load_parallel(struct mpool_descriptor *mp)
 	inc = (num_online_cpus() / njobs) & ~1u;
 	cpu = raw_smp_processor_id();
 
+	if (lazy) {
+		mda->mdi_lazyv = olwv;
+		mda->mdi_lazyend = mda->mdi_slotvcnt;
+		atomic_set(&mda->mdi_lazyprog, 1);
+		atomic_set(&mda->mdi_lazycnt, mda->mdi_lazyend - 1);
+		reinit_completion(&mda->mdi_lazydone);
+
+		for (cslot = 1; cslot < mda->mdi_lazyend; cslot++)
+			atomic_set(&mda->mdi_slotv[cslot].mmi_loadstate, PMD_MDC_UNLOADED);
+	}
+
 	/*
 	 * Each of njobs workers will atomically grab MDC numbers from &progress
 	 * and load them, until all valid user MDCs have been loaded.
 	 */
 	for (i = 0; i < njobs; ++i) {
-		INIT_WORK(&olwv[i].olw_work, pmd_objs_load_worker);
-		olwv[i].olw_progress = &progress;
-		olwv[i].olw_err = &err;
+		if (lazy) {
+			INIT_WORK(&olwv[i].olw_work, pmd_objs_load_lazy_worker);
+			olwv[i].olw_progress = &mda->mdi_lazyprog;
+			olwv[i].olw_err = &mda->mdi_lazyerr;
+		} else {
+			INIT_WORK(&olwv[i].olw_work, pmd_objs_load_worker);
+			olwv[i].olw_progress = &progress;
+			olwv[i].olw_err = &err;
+		}
 		olwv[i].olw_mp = mp;
 
 		/*
@@ -1252,11 +1711,15 @@ static merr_t pmd_objs_load_parallel(struct mpool_descriptor *mp)
 		 */
 		cpu = (cpu + inc) % nr_cpumask_bits;
 		cpu = cpumask_next_wrap(cpu, cpu_online_mask, nr_cpumask_bits, false);
-		queue_work_on(cpu, mp->pds_workq, &olwv[i].olw_work);
+		queue_work_on(cpu, mpool_wq(mp, MPOOL_WQ_LOAD), &olwv[i].olw_work);
 	}
 
+	/* olwv is freed by pmd_mda_free() */
+	if (lazy)
+		return 0;
+
 	/* Wait for all worker threads to complete */
-	flush_workqueue(mp->pds_workq);
+	flush_workqueue(mpool_wq(mp, MPOOL_WQ_LOAD));
 
 	kfree(olwv);
 
@@ -1272,14 +1735,23 @@ pmd_mpool_activate(
 	u32                         flags)
 {
 	merr_t  err;
+	bool    lazy;
 
 	mp_pr_debug("mdc01: %lu mdc02: %lu", 0, (ulong)mdc01->eld_objid, (ulong)mdc02->eld_objid);
 
+	lazy = !create && (flags & (1 << MP_FLAGS_LAZY_LOAD));
+
 	/* Activation is intense; serialize it when have multiple mpools */
 	mutex_lock(&pmd_s_lock);
 
 	/* Init metadata array for mpool */
-	pmd_mda_init(mp);
+	err = pmd_mda_init(mp);
+	if (ev(err)) {
+		pmd_obj_put(mp, mdc01);
+		pmd_obj_put(mp, mdc02);
+		mutex_unlock(&pmd_s_lock);
+		return err;
+	}
 
 	/* Initialize mdc0 for mpool */
 	err = pmd_mdc0_init(mp, mdc01, mdc02);
@@ -1313,8 +1785,24 @@ pmd_mpool_activate(
 	if (ev(err))
 		goto exit;
 
+	/*
+	 * Lazily loaded user MDCs are brought to the latest version as they
+	 * are loaded, MDC0 must be converted before any of them.
+	 */
+	if (lazy) {
+		err = pmd_mdc_upgrade(mp, 0, true);
+		if (ev(err))
+			goto exit;
+
+		err = pmd_objs_load_parallel(mp, true);
+		if (ev(err))
+			mp_pr_err("mpool %s, failed to start loading user MDCs",
+				  err, mp->pds_name);
+		goto exit;
+	}
+
 	/* Load user object layouts from all other mdc */
-	err = pmd_objs_load_parallel(mp);
+	err = pmd_objs_load_parallel(mp, false);
 	if (ev(err)) {
 		mp_pr_err("mpool %s, failed to load user MDCs", err, mp->pds_name);
 		goto exit;
@@ -1344,6 +1832,11 @@ exit:
 	return err;
 }
 
+void pmd_mpool_load_stop(struct mpool_descriptor *mp)
+{
+	WRITE_ONCE(mp->pds_mda.mdi_lazystop, true);
+}
+
 void pmd_mpool_deactivate(struct mpool_descriptor *mp)
 {
 	/* Deactivation is intense; serialize it when have multiple mpools */
@@ -1365,7 +1858,7 @@ pmd_mdc_append(struct mpool_descriptor *mp, u8 cslot, struct omf_mdcrec_data *cd
 	struct pmd_mdc_info    *cinfo = &mp->pds_mda.mdi_slotv[cslot];
 	s64                     plen;
 
-	plen = omf_mdcrec_pack_htole(mp, cdr, cinfo->mmi_recbuf);
+	plen = omf_mdcrec_pack_htole(mp, &cinfo->mmi_mdcver, cdr, cinfo->mmi_recbuf);
 	if (plen < 0) {
 		mp_pr_warn("mpool %s, MDC%u append failed", mp->pds_name, cslot);
 		return plen;
@@ -1378,39 +1871,70 @@ pmd_mdc_append(struct mpool_descriptor *mp, u8 cslot, struct omf_mdcrec_data *cd
 }
 
 /**
- * pmd_log_all_mdc_cobjs() - write in the new active mlog the object records.
+ * pmd_log_ckpt() - append a checkpoint record for a batch of committed objects
  * @mp:
  * @cslot:
- * @compacted: output
- * @total: output
+ * @layoutv:
+ * @layoutc: at most OMF_MDCREC_CKPT_MAX
  */
 static merr_t
-pmd_log_all_mdc_cobjs(struct mpool_descriptor *mp, u8 cslot, u32 *compacted, u32 *total)
+pmd_log_ckpt(struct mpool_descriptor *mp, u8 cslot, struct pmd_layout **layoutv, int layoutc)
 {
-	struct pmd_mdc_info    *cinfo;
-	struct pmd_layout      *layout;
-	struct rb_node         *node;
+	struct omf_mdcrec_data  cdr;
 	merr_t                  err;
 
-	cinfo = &mp->pds_mda.mdi_slotv[cslot];
-	err = 0;
+	cdr.omd_rtype = OMF_MDR_OCKPT;
+	cdr.u.ckpt.omd_layoutv = layoutv;
+	cdr.u.ckpt.omd_layoutc = layoutc;
 
-	pmd_co_foreach(cinfo, node) {
+	err = pmd_mdc_append(mp, cslot, &cdr, 0);
+	if (err)
+		mp_pr_err("mpool %s, MDC%u log committed objs failed, objid 0x%lx-0x%lx",
+			  err, mp->pds_name, cslot, (ulong)layoutv[0]->eld_objid,
+			  (ulong)layoutv[layoutc - 1]->eld_objid);
+
+	return err;
+}
+
+/**
+ * pmd_log_all_mdc_cobjs() - write in the new active mlog the object records.
+ * @mp:
+ * @cslot:
+ * @compacted: output
+ * @total: output
+ */
+static merr_t
+pmd_log_all_mdc_cobjs(struct mpool_descriptor *mp, u8 cslot, u32 *compacted, u32 *total)
+{
+	struct pmd_layout      *layoutv[OMF_MDCREC_CKPT_MAX];
+	struct pmd_mdc_info    *cinfo;
+	struct pmd_layout      *layout;
+	struct rb_node         *node;
+	merr_t                  err;
+	int                     layoutc;
+
+	cinfo = &mp->pds_mda.mdi_slotv[cslot];
+	layoutc = 0;
+	err = 0;
+
+	/*
+	 * Checkpoint the committed objects in batches, in objid order, so that
+	 * activation can bulk load them.
+	 */
+	pmd_co_foreach(cinfo, node) {
 		layout = rb_entry(node, typeof(*layout), eld_nodemdc);
 
 		if (!objid_mdc0log(layout->eld_objid)) {
-			struct omf_mdcrec_data cdr;
-
-			cdr.omd_rtype = OMF_MDR_OCREATE;
-			cdr.u.obj.omd_layout = layout;
-			err = pmd_mdc_append(mp, cslot, &cdr, 0);
-			if (err) {
-				mp_pr_err("mpool %s, MDC%u log committed obj failed, objid 0x%lx",
-					  err, mp->pds_name, cslot, (ulong)layout->eld_objid);
-				break;
-			}
+			layoutv[layoutc++] = layout;
+
+			if (layoutc == OMF_MDCREC_CKPT_MAX) {
+				err = pmd_log_ckpt(mp, cslot, layoutv, layoutc);
+				if (err)
+					break;
 
-			++(*compacted);
+				*compacted += layoutc;
+				layoutc = 0;
+			}
 		}
 		++(*total);
 	}
@@ -1418,6 +1942,12 @@ pmd_log_all_mdc_cobjs(struct mpool_descriptor *mp, u8 cslot, u32 *compacted, u32
 	for (; node; node = rb_next(node))
 		++(*total);
 
+	if (!err && layoutc > 0) {
+		err = pmd_log_ckpt(mp, cslot, layoutv, layoutc);
+		if (!err)
+			*compacted += layoutc;
+	}
+
 	return err;
 }
 
@@ -1539,10 +2069,15 @@ static merr_t pmd_mdc_compact(struct mpool_descriptor *mp, u8 cslot)
 	struct pmd_mdc_info    *cinfo = &mp->pds_mda.mdi_slotv[cslot];
 	int                     retry = 0;
 	merr_t                  err = 0;
+	u32                     compacted = 0;
+	u32                     total = 0;
+	u64                     tstart;
+
+	tstart = trace_mpool_mdc_compact_enabled() ? ktime_get_ns() : 0;
 
 	for (retry = 0; retry < MPOOL_MDC_COMPACT_RETRY_DEFAULT; retry++) {
-		u32 compacted = 0;
-		u32 total = 0;
+		compacted = 0;
+		total = 0;
 
 		if (err) {
 			err = mp_mdc_open(mp, logid1, logid2, MDC_OF_SKIP_SER, &cinfo->mmi_mdc);
@@ -1607,6 +2142,10 @@ static merr_t pmd_mdc_compact(struct mpool_descriptor *mp, u8 cslot)
 	if (err)
 		mp_pr_crit("mpool %s, MDC%u compaction failed", err, mp->pds_name, cslot);
 
+	if (tstart)
+		trace_mpool_mdc_compact(mp, cslot, compacted, total, retry,
+					ktime_get_ns() - tstart, err);
+
 	return err;
 }
 
@@ -1629,22 +2168,135 @@ static merr_t pmd_mdc_addrec(struct mpool_descriptor *mp, u8 cslot, struct omf_m
 	return err;
 }
 
-static merr_t pmd_log_delete(struct mpool_descriptor *mp, u64 objid)
+/**
+ * pmd_mdc_addrec_gc() - append a record to be made durable by group commit
+ * @mp:
+ * @cslot:
+ * @cdr:
+ * @gcw:   waiter, queued on success; caller must then call pmd_mdc_gcsync()
+ *
+ * Caller must hold the MDC compactlock.
+ */
+static merr_t
+pmd_mdc_addrec_gc(
+	struct mpool_descriptor    *mp,
+	u8                          cslot,
+	struct omf_mdcrec_data     *cdr,
+	struct pmd_gc_waiter       *gcw)
+{
+	struct pmd_mdc_info    *cinfo = &mp->pds_mda.mdi_slotv[cslot];
+	merr_t                  err;
+
+	err = pmd_mdc_append(mp, cslot, cdr, 0);
+
+	if (merr_errno(err) == EFBIG) {
+		err = pmd_mdc_compact(mp, cslot);
+		if (!ev(err))
+			err = pmd_mdc_append(mp, cslot, cdr, 0);
+	}
+
+	if (err) {
+		mp_pr_rl("mpool %s, MDC%u append failed%s", err, mp->pds_name, cslot,
+			 (merr_errno(err) == EFBIG) ? " post compaction" : "");
+		return err;
+	}
+
+	gcw->gcw_err = 0;
+	gcw->gcw_done = false;
+	gcw->gcw_queued = true;
+	list_add_tail(&gcw->gcw_entry, &cinfo->mmi_gcwq);
+
+	return 0;
+}
+
+/**
+ * pmd_mdc_gcsync() - wait for a record appended by pmd_mdc_addrec_gc() to be durable
+ * @mp:
+ * @cslot:
+ * @gcw:
+ *
+ * The first waiter to acquire mmi_gclock flushes the MDC on behalf of all
+ * the records appended so far and releases their waiters; waiters queued
+ * behind it typically find their record already flushed.  Records appended
+ * while a flush is in progress are batched into the next flush.
+ *
+ * Caller must not hold the MDC compactlock.
+ */
+static merr_t pmd_mdc_gcsync(struct mpool_descriptor *mp, u8 cslot, struct pmd_gc_waiter *gcw)
+{
+	struct pmd_mdc_info    *cinfo = &mp->pds_mda.mdi_slotv[cslot];
+	struct pmd_gc_waiter   *w, *next;
+	merr_t                  err;
+
+	pmd_mdc_lock(&cinfo->mmi_gclock, cslot);
+	if (!gcw->gcw_done) {
+		pmd_mdc_lock(&cinfo->mmi_compactlock, cslot);
+
+		err = mp_mdc_sync(cinfo->mmi_mdc);
+		if (err)
+			mp_pr_rl("mpool %s, MDC%u group commit sync failed",
+				 err, mp->pds_name, cslot);
+
+		list_for_each_entry_safe(w, next, &cinfo->mmi_gcwq, gcw_entry) {
+			list_del(&w->gcw_entry);
+			w->gcw_err = err;
+			w->gcw_done = true;
+		}
+
+		pmd_mdc_unlock(&cinfo->mmi_compactlock);
+	}
+	pmd_mdc_unlock(&cinfo->mmi_gclock);
+
+	return gcw->gcw_err;
+}
+
+static merr_t pmd_log_delete(struct mpool_descriptor *mp, u64 objid, struct pmd_gc_waiter *gcw)
 {
 	struct omf_mdcrec_data  cdr;
 
 	cdr.omd_rtype = OMF_MDR_ODELETE;
 	cdr.u.obj.omd_objid = objid;
-	return pmd_mdc_addrec(mp, objid_slot(objid), &cdr);
+	return pmd_mdc_addrec_gc(mp, objid_slot(objid), &cdr, gcw);
 }
 
-static merr_t pmd_log_create(struct mpool_descriptor *mp, struct pmd_layout *layout)
+static merr_t
+pmd_log_create(struct mpool_descriptor *mp, struct pmd_layout *layout, struct pmd_gc_waiter *gcw)
 {
 	struct omf_mdcrec_data  cdr;
 
 	cdr.omd_rtype = OMF_MDR_OCREATE;
 	cdr.u.obj.omd_layout = layout;
-	return pmd_mdc_addrec(mp, objid_slot(layout->eld_objid), &cdr);
+	return pmd_mdc_addrec_gc(mp, objid_slot(layout->eld_objid), &cdr, gcw);
+}
+
+/*
+ * Mblock layouts have no lock of their own, pmd_obj_*lock() of an mblock
+ * acquires one of the PMD_OBJ_LOCKS rwsems below instead.  Each is padded
+ * to a cache line so that unrelated mblocks do not share one.
+ */
+#define PMD_OBJ_LOCKS_SHIFT     11
+#define PMD_OBJ_LOCKS           (1u << PMD_OBJ_LOCKS_SHIFT)
+
+struct pmd_obj_lock {
+	struct rw_semaphore     ol_rwlock;
+} ____cacheline_aligned_in_smp;
+
+static struct pmd_obj_lock pmd_obj_lockv[PMD_OBJ_LOCKS];
+
+void pmd_obj_locks_init(void)
+{
+	int i;
+
+	for (i = 0; i < PMD_OBJ_LOCKS; ++i)
+		init_rwsem(&pmd_obj_lockv[i].ol_rwlock);
+}
+
+static inline struct rw_semaphore *pmd_obj_lockp(struct pmd_layout *layout)
+{
+	if (pmd_objid_type(layout->eld_objid) == OMF_OBJ_MLOG)
+		return &layout->eld_mlpriv.mlp_rwlock;
+
+	return &pmd_obj_lockv[hash_64(layout->eld_objid, PMD_OBJ_LOCKS_SHIFT)].ol_rwlock;
 }
 
 /*
@@ -1663,12 +2315,12 @@ void pmd_obj_rdlock(struct pmd_layout *layout)
 		lc = PMD_MDC_ZERO;
 #endif
 
-	down_read_nested(&layout->eld_rwlock, lc);
+	down_read_nested(pmd_obj_lockp(layout), lc);
 }
 
 void pmd_obj_rdunlock(struct pmd_layout *layout)
 {
-	up_read(&layout->eld_rwlock);
+	up_read(pmd_obj_lockp(layout));
 }
 
 void pmd_obj_wrlock(struct pmd_layout *layout)
@@ -1682,12 +2334,12 @@ void pmd_obj_wrlock(struct pmd_layout *layout)
 		lc = PMD_MDC_ZERO;
 #endif
 
-	down_write_nested(&layout->eld_rwlock, lc);
+	down_write_nested(pmd_obj_lockp(layout), lc);
 }
 
 void pmd_obj_wrunlock(struct pmd_layout *layout)
 {
-	up_write(&layout->eld_rwlock);
+	up_write(pmd_obj_lockp(layout));
 }
 
 merr_t
@@ -1717,13 +2369,26 @@ pmd_obj_realloc(
 	return pmd_obj_alloc_cmn(mp, objid, objid_type(objid), ocap, mclassp, 1, true, layoutp);
 }
 
-merr_t pmd_obj_commit(struct mpool_descriptor *mp, struct pmd_layout *layout)
+/**
+ * pmd_obj_commit_rec() - log an object's create record and mark it committed
+ * @mp:
+ * @layout:
+ * @gcw:    (output) queued group commit waiter, iff gcw->gcw_queued is set
+ *
+ * The create record is not durable until pmd_obj_commit_fin() returns, which
+ * undoes the commit if it fails to sync.
+ */
+static merr_t
+pmd_obj_commit_rec(struct mpool_descriptor *mp, struct pmd_layout *layout,
+		   struct pmd_gc_waiter *gcw)
 {
 	struct pmd_mdc_info    *cinfo;
 	struct pmd_layout      *found;
 	merr_t                  err;
 	u8                      cslot;
 
+	gcw->gcw_queued = false;
+
 	if (!objtype_user(objid_type(layout->eld_objid)))
 		return merr(EINVAL);
 
@@ -1744,7 +2409,7 @@ merr_t pmd_obj_commit(struct mpool_descriptor *mp, struct pmd_layout *layout)
 
 	pmd_mdc_lock(&cinfo->mmi_compactlock, cslot);
 
-	err = pmd_log_create(mp, layout);
+	err = pmd_log_create(mp, layout, gcw);
 	if (!ev(err)) {
 		pmd_uc_lock(cinfo, cslot);
 		found = pmd_uc_remove(cinfo, layout);
@@ -1790,51 +2455,317 @@ merr_t pmd_obj_commit(struct mpool_descriptor *mp, struct pmd_layout *layout)
 	pmd_mdc_unlock(&cinfo->mmi_compactlock);
 	pmd_obj_wrunlock(layout);
 
+	return err;
+}
+
+/**
+ * pmd_obj_commit_undo() - put back an object whose create record didn't sync
+ * @mp:
+ * @layout:
+ *
+ * pmd_obj_commit_rec() publishes the object as committed before its create
+ * record is durable.  If that record then fails to sync, move the object
+ * back to the uncommitted objects tree so that the caller can retry the
+ * commit or abort it, unless it has been deleted in the meantime.
+ */
+static void pmd_obj_commit_undo(struct mpool_descriptor *mp, struct pmd_layout *layout)
+{
+	struct pmd_mdc_info    *cinfo;
+	struct pmd_layout      *found = NULL;
+	u8                      cslot;
+
+	cslot = objid_slot(layout->eld_objid);
+	cinfo = &mp->pds_mda.mdi_slotv[cslot];
+
+	pmd_obj_wrlock(layout);
+	pmd_mdc_lock(&cinfo->mmi_compactlock, cslot);
+
+	pmd_co_wlock(cinfo, cslot);
+	if ((layout->eld_state & PMD_LYT_COMMITTED) && !(layout->eld_state & PMD_LYT_REMOVED))
+		found = pmd_co_remove(cinfo, layout);
+	if (found)
+		layout->eld_state &= ~PMD_LYT_COMMITTED;
+	pmd_co_wunlock(cinfo);
+
+	if (found) {
+		pmd_uc_lock(cinfo, cslot);
+		pmd_uc_insert(cinfo, layout);
+		pmd_uc_unlock(cinfo);
+
+		atomic_dec(&cinfo->mmi_pco_cnt.pcc_cobj);
+	}
+
+	pmd_mdc_unlock(&cinfo->mmi_compactlock);
+	pmd_obj_wrunlock(layout);
+}
+
+/**
+ * pmd_obj_commit_fin() - wait for the create record logged by pmd_obj_commit_rec()
+ * @mp:
+ * @layout:
+ * @gcw:
+ * @err:    status returned by pmd_obj_commit_rec()
+ */
+static merr_t
+pmd_obj_commit_fin(struct mpool_descriptor *mp, struct pmd_layout *layout,
+		   struct pmd_gc_waiter *gcw, merr_t err)
+{
+	u8      cslot = objid_slot(layout->eld_objid);
+	merr_t  err2;
+
+	/* If the create record was queued we must wait for it regardless */
+	if (gcw->gcw_queued) {
+		err2 = pmd_mdc_gcsync(mp, cslot, gcw);
+		if (!err && err2) {
+			pmd_obj_commit_undo(mp, layout);
+			err = err2;
+		}
+	}
+
 	if (!err)
-		pmd_update_mdc_stats(mp, layout, cinfo, PMD_OBJ_COMMIT);
+		pmd_update_mdc_stats(mp, layout, &mp->pds_mda.mdi_slotv[cslot], PMD_OBJ_COMMIT);
 
 	return err;
 }
 
-static void pmd_obj_erase_cb(struct work_struct *work)
+merr_t pmd_obj_commit(struct mpool_descriptor *mp, struct pmd_layout *layout)
+{
+	struct pmd_gc_waiter    gcw;
+	merr_t                  err;
+
+	err = pmd_obj_commit_rec(mp, layout, &gcw);
+
+	return pmd_obj_commit_fin(mp, layout, &gcw, err);
+}
+
+merr_t
+pmd_obj_commitv(
+	struct mpool_descriptor    *mp,
+	struct pmd_layout         **layoutv,
+	int                         layoutc,
+	merr_t                     *errv)
+{
+	struct pmd_gc_waiter   *gcwv;
+	int                     i;
+
+	gcwv = kmalloc_array(layoutc, sizeof(*gcwv), GFP_KERNEL);
+	if (!gcwv)
+		return merr(ENOMEM);
+
+	/*
+	 * Log all the create records before waiting on any of them so that
+	 * they are flushed by as few group commits as possible.
+	 */
+	for (i = 0; i < layoutc; ++i) {
+		gcwv[i].gcw_queued = false;
+		if (!errv[i])
+			errv[i] = pmd_obj_commit_rec(mp, layoutv[i], &gcwv[i]);
+	}
+
+	for (i = 0; i < layoutc; ++i) {
+		if (layoutv[i])
+			errv[i] = pmd_obj_commit_fin(mp, layoutv[i], &gcwv[i], errv[i]);
+	}
+
+	kfree(gcwv);
+
+	return 0;
+}
+
+static int pmd_erase_cmp(const void *a, const void *b)
+{
+	const struct pmd_layout *la = (*(struct pmd_obj_erase_work * const *)a)->oef_layout;
+	const struct pmd_layout *lb = (*(struct pmd_obj_erase_work * const *)b)->oef_layout;
+	bool                     ma, mb;
+
+	if (la->eld_ld.ol_pdh != lb->eld_ld.ol_pdh)
+		return la->eld_ld.ol_pdh < lb->eld_ld.ol_pdh ? -1 : 1;
+
+	ma = pmd_objid_type(la->eld_objid) == OMF_OBJ_MLOG;
+	mb = pmd_objid_type(lb->eld_objid) == OMF_OBJ_MLOG;
+	if (ma != mb)
+		return ma ? 1 : -1;
+
+	if (la->eld_ld.ol_zaddr != lb->eld_ld.ol_zaddr)
+		return la->eld_ld.ol_zaddr < lb->eld_ld.ol_zaddr ? -1 : 1;
+
+	return 0;
+}
+
+/**
+ * pmd_erase_run() - erase a run of layouts with adjacent zone ranges
+ * @mp:
+ * @oefv: oef array, sorted by pmd_erase_cmp()
+ * @oefc: number of entries in oefv
+ *
+ * @bytesp: (output) bytes erased
+ *
+ * Return: number of leading oefv entries erased by a single discard
+ */
+static int
+pmd_erase_run(struct mpool_descriptor *mp, struct pmd_obj_erase_work **oefv, int oefc, u64 *bytesp)
+{
+	struct pmd_layout      *first, *layout;
+	struct mpool_dev_info  *pd;
+	merr_t                  err;
+	u64                     zaddr, zend, zmax;
+	bool                    mlog;
+	int                     n;
+
+	first = oefv[0]->oef_layout;
+	pd = &mp->pds_pdv[first->eld_ld.ol_pdh];
+	mlog = pmd_objid_type(first->eld_objid) == OMF_OBJ_MLOG;
+
+	zaddr = first->eld_ld.ol_zaddr;
+	zend = zaddr + first->eld_ld.ol_zcnt;
+	zmax = max_t(u64, PMD_ERASE_DISCARD_MAX / (pd->pdi_zonepg << PAGE_SHIFT), 1);
+
+	for (n = 1; n < oefc; n++) {
+		layout = oefv[n]->oef_layout;
+
+		if (layout->eld_ld.ol_pdh != first->eld_ld.ol_pdh ||
+		    (pmd_objid_type(layout->eld_objid) == OMF_OBJ_MLOG) != mlog ||
+		    layout->eld_ld.ol_zaddr != zend ||
+		    zend + layout->eld_ld.ol_zcnt - zaddr > zmax)
+			break;
+
+		zend += layout->eld_ld.ol_zcnt;
+	}
+
+	*bytesp = 0;
+
+	if (mpool_pd_status_get(pd) != PD_STAT_UNAVAIL) {
+		err = pd_zone_erase(pd, zaddr, zend - zaddr, mlog);
+		if (ev(err))
+			mpool_pd_status_set(pd, PD_STAT_OFFLINE);
+		*bytesp = (zend - zaddr) * pd->pdi_zonepg << PAGE_SHIFT;
+	}
+
+	return n;
+}
+
+/**
+ * pmd_erase_throttle() - hold the erase pipeline to mp_eraserate MiB/s
+ * @mp:
+ * @pec:
+ * @bytes: bytes just erased
+ *
+ * Sleeps until the bytes erased since the start of the current
+ * PMD_ERASE_PERIOD_MS period are within the rate.  A new period starts
+ * with the first erase after the previous one ended.
+ */
+static void pmd_erase_throttle(struct mpool_descriptor *mp, struct pmd_erase_ctrl *pec, u64 bytes)
+{
+	u64     rate = mp->pds_params.mp_eraserate << 20;
+	u64     elapsed, due;
+
+	if (!rate || !bytes)
+		return;
+
+	elapsed = jiffies_to_msecs(jiffies - pec->pec_tstart);
+	if (elapsed >= PMD_ERASE_PERIOD_MS) {
+		pec->pec_tstart = jiffies;
+		pec->pec_tbytes = 0;
+		elapsed = 0;
+	}
+
+	pec->pec_tbytes += bytes;
+
+	due = div64_u64(pec->pec_tbytes * MSEC_PER_SEC, rate);
+	if (due > elapsed)
+		msleep(due - elapsed);
+}
+
+/**
+ * pmd_erase_worker() - erase and free a batch of deleted/aborted layouts
+ * @work:
+ *
+ * Layouts are sorted by drive, erase type and zone address, and each
+ * run of adjacent zone ranges is erased by one discard of at most
+ * PMD_ERASE_DISCARD_MAX bytes.  A layout's space is released back to
+ * the smap only after the discard covering it completes.  At most
+ * PMD_ERASE_BATCH_MAX layouts are handled per run, after which the
+ * work is requeued if more are pending.  Discards are throttled to
+ * mp_eraserate MiB/s, after the space they cover is released.
+ */
+static void pmd_erase_worker(struct work_struct *work)
 {
+	struct pmd_obj_erase_work **oefv;
 	struct pmd_obj_erase_work  *oef;
 	struct mpool_descriptor    *mp;
-	struct pmd_layout          *layout;
+	struct pmd_erase_ctrl      *pec;
+	bool                        more;
+	int                         oefc, i, n;
+
+	pec = container_of(work, struct pmd_erase_ctrl, pec_work);
+	mp = pec->pec_mp;
+	oefv = pec->pec_batch;
+	oefc = 0;
+
+	spin_lock(&pec->pec_lock);
+	while (oefc < PMD_ERASE_BATCH_MAX && !list_empty(&pec->pec_list)) {
+		oef = list_first_entry(&pec->pec_list, typeof(*oef), oef_entry);
+		list_del(&oef->oef_entry);
+		oefv[oefc++] = oef;
+	}
+	more = !list_empty(&pec->pec_list);
+	spin_unlock(&pec->pec_lock);
 
-	oef = container_of(work, struct pmd_obj_erase_work, oef_wqstruct);
-	mp = oef->oef_mp;
-	layout = oef->oef_layout;
+	sort(oefv, oefc, sizeof(*oefv), pmd_erase_cmp, NULL);
 
-	pmd_layout_erase(mp, layout);
+	for (i = 0; i < oefc; i += n) {
+		u64 bytes;
+		int j;
 
-	if (oef->oef_cache)
-		kmem_cache_free(oef->oef_cache, oef);
+		n = pmd_erase_run(mp, oefv + i, oefc - i, &bytes);
 
-	pmd_layout_unprovision(mp, layout);
+		for (j = i; j < i + n; j++) {
+			pmd_layout_unprovision(mp, oefv[j]->oef_layout);
+			kmem_cache_free(pmd_obj_erase_work_cache, oefv[j]);
+		}
+
+		pmd_erase_throttle(mp, pec, bytes);
+		cond_resched();
+	}
+
+	if (more)
+		mpool_queue_work(mp, MPOOL_WQ_ERASE, &pec->pec_work);
+}
+
+void pmd_erase_init(struct mpool_descriptor *mp)
+{
+	struct pmd_erase_ctrl *pec = &mp->pds_erase;
+
+	spin_lock_init(&pec->pec_lock);
+	INIT_LIST_HEAD(&pec->pec_list);
+	INIT_WORK(&pec->pec_work, pmd_erase_worker);
+	pec->pec_mp = mp;
+	pec->pec_tstart = jiffies;
+	pec->pec_tbytes = 0;
 }
 
 static void pmd_obj_erase_start(struct mpool_descriptor *mp, struct pmd_layout *layout)
 {
-	struct pmd_obj_erase_work   oefbuf, *oef;
-	bool                        async = true;
+	struct pmd_erase_ctrl      *pec = &mp->pds_erase;
+	struct pmd_obj_erase_work  *oef;
 
 	oef = kmem_cache_zalloc(pmd_obj_erase_work_cache, GFP_KERNEL);
 	if (!oef) {
-		oef = &oefbuf;
-		async = false;
+		/* Erase and free synchronously */
+		pmd_layout_erase(mp, layout);
+		pmd_layout_unprovision(mp, layout);
+		return;
 	}
 
-	/* If async oef will be freed in pmd_obj_erase_and_free() */
+	/* oef will be freed by pmd_erase_worker() */
 	oef->oef_mp = mp;
 	oef->oef_layout = layout;
-	oef->oef_cache = async ? pmd_obj_erase_work_cache : NULL;
-	INIT_WORK(&oef->oef_wqstruct, pmd_obj_erase_cb);
 
-	queue_work(mp->pds_erase_wq, &oef->oef_wqstruct);
+	spin_lock(&pec->pec_lock);
+	list_add_tail(&oef->oef_entry, &pec->pec_list);
+	spin_unlock(&pec->pec_lock);
 
-	if (!async)
-		flush_work(&oef->oef_wqstruct);
+	mpool_queue_work(mp, MPOOL_WQ_ERASE, &pec->pec_work);
 }
 
 merr_t pmd_obj_abort(struct mpool_descriptor *mp, struct pmd_layout *layout)
@@ -1876,16 +2807,30 @@ merr_t pmd_obj_abort(struct mpool_descriptor *mp, struct pmd_layout *layout)
 	return 0;
 }
 
-merr_t pmd_obj_delete(struct mpool_descriptor *mp, struct pmd_layout *layout)
+/**
+ * pmd_obj_delete_rec() - log an object's delete record and remove it
+ * @mp:
+ * @layout:
+ * @gcw:    (output) queued group commit waiter, on success
+ *
+ * On success the object can no longer be found, but its delete record is
+ * not durable until pmd_obj_delete_fin() returns.
+ */
+static merr_t
+pmd_obj_delete_rec(struct mpool_descriptor *mp, struct pmd_layout *layout,
+		   struct pmd_gc_waiter *gcw)
 {
 	struct pmd_mdc_info    *cinfo;
 	struct pmd_layout      *found;
 
 	long    refcnt;
+	bool    removed;
 	u64     objid;
 	u8      cslot;
 	merr_t  err;
 
+	gcw->gcw_queued = false;
+
 	if (!objtype_user(objid_type(layout->eld_objid)))
 		return merr(EINVAL);
 
@@ -1904,12 +2849,21 @@ merr_t pmd_obj_delete(struct mpool_descriptor *mp, struct pmd_layout *layout)
 	pmd_mdc_lock(&cinfo->mmi_compactlock, cslot);
 
 	pmd_co_wlock(cinfo, cslot);
+	removed = layout->eld_state & PMD_LYT_REMOVED;
+
+	/*
+	 * pmd_co_find_get() takes refs without mmi_co_lock, so publish the
+	 * removal before sampling the refcnt.
+	 */
+	WRITE_ONCE(layout->eld_state, layout->eld_state | PMD_LYT_REMOVED);
+	smp_mb();
+
 	refcnt = kref_read(&layout->eld_ref);
-	if (refcnt == 2) {
+	if (refcnt == 2)
 		found = pmd_co_remove(cinfo, layout);
-		if (found)
-			found->eld_state |= PMD_LYT_REMOVED;
-	}
+
+	if (!found && !removed)
+		WRITE_ONCE(layout->eld_state, layout->eld_state & ~PMD_LYT_REMOVED);
 	pmd_co_wunlock(cinfo);
 
 	if (!found) {
@@ -1919,27 +2873,65 @@ merr_t pmd_obj_delete(struct mpool_descriptor *mp, struct pmd_layout *layout)
 		return merr(refcnt > 2 ? EBUSY : EINVAL);
 	}
 
-	err = pmd_log_delete(mp, objid);
+	err = pmd_log_delete(mp, objid, gcw);
 	if (err) {
 		pmd_co_wlock(cinfo, cslot);
 		pmd_co_insert(cinfo, found);
 		found->eld_state &= ~PMD_LYT_REMOVED;
-		found = NULL;
 		pmd_co_wunlock(cinfo);
 	}
 
 	pmd_mdc_unlock(&cinfo->mmi_compactlock);
 	pmd_obj_wrunlock(layout);
 
-	if (!found) {
+	if (err)
 		mp_pr_rl("mpool %s, objid 0x%lx, pmd_log_del failed",
 			 err, mp->pds_name, (ulong)objid);
-		return err;
-	}
+
+	return err;
+}
+
+/**
+ * pmd_obj_delete_fin() - wait for the delete record logged by pmd_obj_delete_rec()
+ * @mp:
+ * @layout:
+ * @gcw:
+ *
+ * Drops the birth and caller's references on success.  On failure the
+ * caller retains its reference, but the object is gone nonetheless.
+ */
+static merr_t
+pmd_obj_delete_fin(struct mpool_descriptor *mp, struct pmd_layout *layout,
+		   struct pmd_gc_waiter *gcw)
+{
+	struct pmd_mdc_info    *cinfo;
+	merr_t                  err;
+	u8                      cslot;
+
+	cslot = objid_slot(layout->eld_objid);
+	cinfo = &mp->pds_mda.mdi_slotv[cslot];
+
+	err = pmd_mdc_gcsync(mp, cslot, gcw);
 
 	atomic_inc(&cinfo->mmi_pco_cnt.pcc_del);
 	atomic_dec(&cinfo->mmi_pco_cnt.pcc_cobj);
 	pmd_update_mdc_stats(mp, layout, cinfo, PMD_OBJ_DELETE);
+
+	if (err) {
+		/*
+		 * The object may reappear after a restart if its delete record
+		 * did not make it to media, so don't erase it.  Its space is
+		 * leaked until the mpool is next activated.
+		 */
+		mp_pr_rl("mpool %s, objid 0x%lx, delete sync failed",
+			 err, mp->pds_name, (ulong)layout->eld_objid);
+
+		/* Drop birth reference, caller drops its own on error... */
+		pmd_obj_put(mp, layout);
+
+		return err;
+	}
+
 	pmd_obj_erase_start(mp, layout);
 
 	/* Drop caller's reference... */
@@ -1948,6 +2940,48 @@ merr_t pmd_obj_delete(struct mpool_descriptor *mp, struct pmd_layout *layout)
 	return 0;
 }
 
+merr_t pmd_obj_delete(struct mpool_descriptor *mp, struct pmd_layout *layout)
+{
+	struct pmd_gc_waiter    gcw;
+	merr_t                  err;
+
+	err = pmd_obj_delete_rec(mp, layout, &gcw);
+	if (err)
+		return err;
+
+	return pmd_obj_delete_fin(mp, layout, &gcw);
+}
+
+merr_t
+pmd_obj_deletev(
+	struct mpool_descriptor    *mp,
+	struct pmd_layout         **layoutv,
+	int                         layoutc,
+	merr_t                     *errv)
+{
+	struct pmd_gc_waiter   *gcwv;
+	int                     i;
+
+	gcwv = kmalloc_array(layoutc, sizeof(*gcwv), GFP_KERNEL);
+	if (!gcwv)
+		return merr(ENOMEM);
+
+	for (i = 0; i < layoutc; ++i) {
+		gcwv[i].gcw_queued = false;
+		if (!errv[i])
+			errv[i] = pmd_obj_delete_rec(mp, layoutv[i], &gcwv[i]);
+	}
+
+	for (i = 0; i < layoutc; ++i) {
+		if (gcwv[i].gcw_queued)
+			errv[i] = pmd_obj_delete_fin(mp, layoutv[i], &gcwv[i]);
+	}
+
+	kfree(gcwv);
+
+	return 0;
+}
+
 static merr_t pmd_log_erase(struct mpool_descriptor *mp, u64 objid, u64 gen)
 {
 	struct omf_mdcrec_data  cdr;
@@ -2108,6 +3142,10 @@ merr_t pmd_mdc_alloc(struct mpool_descriptor *mp, u64 mincap, u32 iter)
 	u32    pdcnt;
 	bool   reverse = false;
 
+	err = pmd_mdc_load_all(mp);
+	if (ev(err))
+		return err;
+
 	/*
 	 * serialize to prevent gap in mdc slot space in event of failure
 	 */
@@ -2133,7 +3171,7 @@ merr_t pmd_mdc_alloc(struct mpool_descriptor *mp, u64 mincap, u32 iter)
 	cinfo = &mp->pds_mda.mdi_slotv[0];
 
 	pmd_mdc_lock(&cinfo->mmi_uqlock, 0);
-	mdcslot = cinfo->mmi_luniq;
+	mdcslot = atomic64_read(&cinfo->mmi_luniq);
 	pmd_mdc_unlock(&cinfo->mmi_uqlock);
 
 	if (mdcslot >= MDC_SLOTS - 1) {
@@ -2297,7 +3335,7 @@ merr_t pmd_mdc_alloc(struct mpool_descriptor *mp, u64 mincap, u32 iter)
 	pmd_mdc_lock(&cinfo->mmi_uqlock, 0);
 
 	spin_lock(&mp->pds_mda.mdi_slotvlock);
-	cinfo->mmi_luniq = mdcslot;
+	atomic64_set(&cinfo->mmi_luniq, mdcslot);
 	mp->pds_mda.mdi_slotvcnt = mdcslot + 1;
 	spin_unlock(&mp->pds_mda.mdi_slotvlock);
 
@@ -2347,7 +3385,7 @@ void pmd_mdc_cap(struct mpool_descriptor *mp, u64 *mdcmax, u64 *mdccap, u64 *mdc
 	cinfo = &mp->pds_mda.mdi_slotv[0];
 
 	pmd_mdc_lock(&cinfo->mmi_uqlock, 0);
-	*mdcmax = cinfo->mmi_luniq;
+	*mdcmax = atomic64_read(&cinfo->mmi_luniq);
 	pmd_mdc_unlock(&cinfo->mmi_uqlock);
 
 	/*  Taking compactlock to freeze all object layout metadata in mdc0 */
@@ -2509,6 +3547,10 @@ pmd_layout_calculate(
  * @layoutp:
  * @mc:		media class
  * @zcnt:
+ *
+ * The sequential zones of a zoned drive are reset before being handed out,
+ * as zones released without an erase, e.g., by crash recovery, may still
+ * hold data and can only be written from their start.
  */
 static merr_t
 pmd_layout_provision(
@@ -2542,12 +3584,42 @@ pmd_layout_provision(
 	if (ev(err))
 		return err;
 
+	if (mp->pds_pdv[pdh].pdi_parm.dpr_zoned) {
+		err = pd_zone_erase(&mp->pds_pdv[pdh], zoneaddr, zcnt, false);
+		if (ev(err)) {
+			smap_free(mp, pdh, zoneaddr, zcnt);
+			return err;
+		}
+	}
+
 	layout->eld_ld.ol_pdh = pdh;
 	layout->eld_ld.ol_zaddr = zoneaddr;
 
 	return 0;
 }
 
+/**
+ * pmd_layout_ioclass() - I/O class of an object read or write
+ * @layout:
+ * @flags:  REQ_* flags of the I/O
+ * @rw:
+ */
+static enum pd_ioclass pmd_layout_ioclass(struct pmd_layout *layout, int flags, u8 rw)
+{
+	u64 objid = layout->eld_objid;
+
+	if (pmd_objid_type(objid) == OMF_OBJ_MLOG) {
+		/* MDC 0~N mlogs */
+		if (!objid_slot(objid) && objid_uniq(objid) < 2 * MDC_SLOTS)
+			return PD_IOC_META;
+
+		if (rw == MPOOL_OP_WRITE && (flags & REQ_FUA))
+			return PD_IOC_LOGSYNC;
+	}
+
+	return (rw == MPOOL_OP_READ) ? PD_IOC_READ : PD_IOC_BULK;
+}
+
 merr_t
 pmd_layout_rw(
 	struct mpool_descriptor    *mp,
@@ -2559,6 +3631,7 @@ pmd_layout_rw(
 	u8                          rw)
 {
 	struct mpool_dev_info  *pd;
+	enum pd_ioclass         ioc;
 	u64                     zaddr;
 	merr_t                  err;
 
@@ -2575,11 +3648,94 @@ pmd_layout_rw(
 	if (iovcnt == 0)
 		return 0;
 
+	ioc = pmd_layout_ioclass(layout, flags, rw);
+
 	zaddr = layout->eld_ld.ol_zaddr;
 	if (rw == MPOOL_OP_READ)
-		err = pd_zone_preadv(pd, iov, iovcnt, zaddr, boff);
+		err = pd_zone_preadv(pd, iov, iovcnt, zaddr, boff, ioc);
 	else
-		err = pd_zone_pwritev(pd, iov, iovcnt, zaddr, boff, flags);
+		err = pd_zone_pwritev(pd, iov, iovcnt, zaddr, boff, flags, ioc);
+
+	if (ev(err))
+		mpool_pd_status_set(pd, PD_STAT_OFFLINE);
+
+	return err;
+}
+
+/*
+ * An async mblock read is charged to the current tiering read epoch until
+ * it completes, see pmd_tier_rdsync().  The caller's completion callback is
+ * stashed in the context while the read is in flight.
+ */
+static void pmd_tier_rdput(struct pd_io_ctx *ctx)
+{
+	struct pmd_tier_ctrl *ptc = ctx->pic_tier;
+
+	ctx->pic_done = ctx->pic_tierdone;
+
+	if (atomic_dec_and_test(&ptc->ptc_rdcnt[ctx->pic_tieridx]))
+		wake_up(&ptc->ptc_rdwq);
+}
+
+static void pmd_tier_rddone(struct pd_io_ctx *ctx, merr_t err)
+{
+	pmd_tier_rdput(ctx);
+
+	ctx->pic_done(ctx, err);
+}
+
+static void pmd_tier_rdget(struct mpool_descriptor *mp, struct pd_io_ctx *ctx)
+{
+	struct pmd_tier_ctrl *ptc = &mp->pds_tier;
+
+	ctx->pic_tier = ptc;
+	ctx->pic_tieridx = READ_ONCE(ptc->ptc_rdepoch) & 1;
+	ctx->pic_tierdone = ctx->pic_done;
+	ctx->pic_done = pmd_tier_rddone;
+
+	atomic_inc(&ptc->ptc_rdcnt[ctx->pic_tieridx]);
+}
+
+merr_t
+pmd_layout_rw_async(
+	struct mpool_descriptor    *mp,
+	struct pmd_layout          *layout,
+	const struct kvec          *iov,
+	int                         iovcnt,
+	u64                         boff,
+	int                         flags,
+	u8                          rw,
+	struct pd_io_ctx           *ctx)
+{
+	struct mpool_dev_info  *pd;
+	enum pd_ioclass         ioc;
+	u64                     zaddr;
+	merr_t                  err;
+
+	if (!mp || !layout || !iov || !ctx)
+		return merr(EINVAL);
+
+	if (rw != MPOOL_OP_READ && rw != MPOOL_OP_WRITE)
+		return merr(EINVAL);
+
+	pd = &mp->pds_pdv[layout->eld_ld.ol_pdh];
+	if (mpool_pd_status_get(pd) == PD_STAT_UNAVAIL)
+		return merr(EIO);
+
+	ioc = pmd_layout_ioclass(layout, flags, rw);
+
+	zaddr = layout->eld_ld.ol_zaddr;
+	if (rw == MPOOL_OP_READ && pmd_objid_type(layout->eld_objid) == OMF_OBJ_MBLOCK) {
+		pmd_tier_rdget(mp, ctx);
+
+		err = pd_zone_preadv_async(pd, iov, iovcnt, zaddr, boff, ioc, ctx);
+		if (err)
+			pmd_tier_rdput(ctx);
+	} else if (rw == MPOOL_OP_READ) {
+		err = pd_zone_preadv_async(pd, iov, iovcnt, zaddr, boff, ioc, ctx);
+	} else {
+		err = pd_zone_pwritev_async(pd, iov, iovcnt, zaddr, boff, flags, ioc, ctx);
+	}
 
 	if (ev(err))
 		mpool_pd_status_set(pd, PD_STAT_OFFLINE);
@@ -2643,6 +3799,86 @@ static merr_t pmd_log_idckpt(struct mpool_descriptor *mp, u64 objid)
 	return pmd_mdc_addrec(mp, objid_slot(objid), &cdr);
 }
 
+/**
+ * pmd_idckpt_advance() - Extend the objid checkpoint of an MDC by one interval
+ * @mp:
+ * @cinfo:
+ * @cslot:
+ *
+ * Caller must hold cinfo->mmi_uqlock, which serializes checkpoints so that
+ * they are logged in increasing order.  Must hold cinfo.compactlock while
+ * logging the checkpoint to the mdc to prevent a race with mdc compaction.
+ */
+static merr_t pmd_idckpt_advance(struct mpool_descriptor *mp, struct pmd_mdc_info *cinfo, u8 cslot)
+{
+	merr_t  err;
+	u64     objid;
+
+	objid = objid_make(objid_uniq(cinfo->mmi_lckpt) + OBJID_UNIQ_DELTA, OMF_OBJ_UNDEF, cslot);
+
+	pmd_mdc_lock(&cinfo->mmi_compactlock, cslot);
+	err = pmd_log_idckpt(mp, objid);
+	if (!err)
+		WRITE_ONCE(cinfo->mmi_lckpt, objid);
+	pmd_mdc_unlock(&cinfo->mmi_compactlock);
+
+	return err;
+}
+
+/*
+ * Log the next objid checkpoint of an MDC once half of the objids covered
+ * by its current checkpoint have been handed out.
+ */
+static void pmd_idckpt_work(struct work_struct *work)
+{
+	struct pmd_mdc_info        *cinfo;
+	struct mpool_descriptor    *mp;
+
+	merr_t  err = 0;
+	u8      cslot;
+
+	cinfo = container_of(work, typeof(*cinfo), mmi_ckptwork);
+	mp = cinfo->mmi_mp;
+	cslot = cinfo - mp->pds_mda.mdi_slotv;
+
+	pmd_mdc_lock(&cinfo->mmi_uqlock, cslot);
+	if (atomic64_read(&cinfo->mmi_luniq) + OBJID_UNIQ_DELTA / 2 > pmd_idckpt_limit(cinfo))
+		err = pmd_idckpt_advance(mp, cinfo, cslot);
+	pmd_mdc_unlock(&cinfo->mmi_uqlock);
+
+	/* pmd_alloc_idgen() will retry synchronously */
+	if (ev(err))
+		mp_pr_rl("mpool %s, MDC%u objid checkpoint failed", err, mp->pds_name, cslot);
+}
+
+void pmd_mdc_flushall(struct mpool_descriptor *mp)
+{
+	struct pmd_mdc_info    *cinfo;
+	merr_t                  err;
+	u8                      cslot;
+
+	/*
+	 * The MDC mlogs are opened with MDC_OF_SKIP_SER, so an MDC may be
+	 * flushed only under its compactlock, and mmi_ckptwork appending a
+	 * checkpoint under it must be done before we flush.
+	 */
+	for (cslot = 0; cslot < mp->pds_mda.mdi_slotvcnt; cslot++) {
+		cinfo = &mp->pds_mda.mdi_slotv[cslot];
+
+		cancel_work_sync(&cinfo->mmi_ckptwork);
+
+		if (!cinfo->mmi_mdc)
+			continue;
+
+		pmd_mdc_lock(&cinfo->mmi_compactlock, cslot);
+		err = mp_mdc_sync(cinfo->mmi_mdc);
+		pmd_mdc_unlock(&cinfo->mmi_compactlock);
+
+		if (err)
+			mp_pr_err("mpool %s, MDC%u flush failed", err, mp->pds_name, cslot);
+	}
+}
+
 /**
  * pmd_alloc_idgen() - generate an id for an allocated object.
  * @mp:
@@ -2661,12 +3897,20 @@ static merr_t pmd_log_idckpt(struct mpool_descriptor *mp, u64 objid)
  * deficit in objects of the MDCs avoided during the burst, is never recovered.
  * The bias in the round robin allows to recover. After a while all MDCs ends
  * up again with about the same number of objects.
+ *
+ * An objid must be checkpointed before it is assigned to an object, to
+ * guarantee that it is not reissued after a crash.  The uniquifier is taken
+ * from mmi_luniq without locking, and the next checkpoint is logged by
+ * mmi_ckptwork once half of the current checkpoint interval is used up.
+ * Only when that falls behind (or fails) does the allocation itself log a
+ * checkpoint, under mmi_uqlock.
  */
 static merr_t pmd_alloc_idgen(struct mpool_descriptor *mp, enum obj_type_omf otype, u64 *objid)
 {
 	struct pmd_mdc_info    *cinfo = NULL;
 
 	merr_t  err = 0;
+	u64     uniq, limit;
 	u8      cslot;
 	u32     tidx;
 
@@ -2685,26 +3929,19 @@ static merr_t pmd_alloc_idgen(struct mpool_descriptor *mp, enum obj_type_omf oty
 	cslot = mp->pds_mda.mdi_sel.mds_tbl[tidx];
 	cinfo = &mp->pds_mda.mdi_slotv[cslot];
 
-	pmd_mdc_lock(&cinfo->mmi_uqlock, cslot);
-	*objid = objid_make(cinfo->mmi_luniq + 1, otype, cslot);
-	if (objid_ckpt(*objid)) {
+	uniq = atomic64_inc_return(&cinfo->mmi_luniq);
+	limit = pmd_idckpt_limit(cinfo);
 
-		/*
-		 * Must checkpoint objid before assigning it to an object
-		 * to guarantee it will not reissue objid after a crash.
-		 * Must hold cinfo.compactlock while log checkpoint to mdc
-		 * to prevent a race with mdc compaction.
-		 */
-		pmd_mdc_lock(&cinfo->mmi_compactlock, cslot);
-		err = pmd_log_idckpt(mp, *objid);
-		if (!err)
-			cinfo->mmi_lckpt = *objid;
-		pmd_mdc_unlock(&cinfo->mmi_compactlock);
+	if (unlikely(uniq > limit)) {
+		pmd_mdc_lock(&cinfo->mmi_uqlock, cslot);
+		while (!err && uniq > pmd_idckpt_limit(cinfo))
+			err = pmd_idckpt_advance(mp, cinfo, cslot);
+		pmd_mdc_unlock(&cinfo->mmi_uqlock);
+	} else if (uniq + OBJID_UNIQ_DELTA / 2 > limit && mpool_wq(mp, MPOOL_WQ_FLUSH)) {
+		mpool_queue_work(mp, MPOOL_WQ_FLUSH, &cinfo->mmi_ckptwork);
 	}
 
-	if (!err)
-		cinfo->mmi_luniq = cinfo->mmi_luniq + 1;
-	pmd_mdc_unlock(&cinfo->mmi_uqlock);
+	*objid = objid_make(uniq, otype, cslot);
 
 	if (ev(err)) {
 		mp_pr_rl("mpool %s, checkpoint append for objid 0x%lx failed",
@@ -2741,15 +3978,13 @@ static merr_t pmd_realloc_idvalidate(struct mpool_descriptor *mp, u64 objid)
 			  err, mp->pds_name, cslot, mp->pds_mda.mdi_slotvcnt, (ulong)objid);
 	} else {
 		cinfo = &mp->pds_mda.mdi_slotv[cslot];
-		pmd_mdc_lock(&cinfo->mmi_uqlock, cslot);
-		if (uniq > cinfo->mmi_luniq)
+		if (uniq > atomic64_read(&cinfo->mmi_luniq))
 			err = merr(EINVAL);
-		pmd_mdc_unlock(&cinfo->mmi_uqlock);
 
 		if (err) {
 			mp_pr_err("mpool %s, realloc failed, unique id %lu too big %lu 0x%lx",
 				  err, mp->pds_name, (ulong)uniq,
-				  (ulong)cinfo->mmi_luniq, (ulong)objid);
+				  (ulong)atomic64_read(&cinfo->mmi_luniq), (ulong)objid);
 		}
 	}
 	return err;
@@ -2820,6 +4055,10 @@ pmd_obj_alloc_cmn(
 	if (ev(err))
 		return err;
 
+	err = pmd_mdc_load_all(mp);
+	if (ev(err))
+		return err;
+
 	if (!objid) {
 		/*
 		 * alloc: generate objid, checkpoint as needed to
@@ -2853,6 +4092,12 @@ retry:
 		return merr(ENOENT);
 	}
 
+	/* Mlogs rewrite sectors in place, e.g. no mlog on a zoned device */
+	if (otype == OMF_OBJ_MLOG && !(mc->mc_parms.mcp_features & OMF_MC_FEAT_MLOG_TGT)) {
+		up_read(&mp->pds_pdvlock);
+		return merr(EOPNOTSUPP);
+	}
+
 	/* Calculate the height (zcnt) of layout. */
 	pmd_layout_calculate(mp, ocap, mc, &zcnt, otype);
 
@@ -2874,7 +4119,7 @@ retry:
 			usleep_range(128, 256);
 
 			if (flush && (retries % flush == 0))
-				flush_workqueue(mp->pds_erase_wq);
+				flush_workqueue(mpool_wq(mp, MPOOL_WQ_ERASE));
 
 			goto retry;
 		}
@@ -2945,7 +4190,12 @@ retry:
  * is above a threshold value and the garbage to reclaim space
  * is below a garbage threshold.
  *
- * Locking: no lock needs to be held when calling this function.
+ * The used space checked against the threshold is a forecast: the growth
+ * observed at the previous runs is extrapolated mp_crtmdcahead runs ahead,
+ * so that the new MDCs exist before the current ones fill up.
+ *
+ * Locking: no lock needs to be held when calling this function. It must
+ * only be called from pmd_precompact(), which owns the forecast state.
  *
  * NOTES:
  * - Skip non-active MDC
@@ -2957,10 +4207,11 @@ retry:
  */
 static bool pmd_mdc_needed(struct mpool_descriptor *mp)
 {
+	struct pre_compact_ctrl    *pco = &mp->pds_pco;
 	struct pmd_mdc_info        *cinfo;
 	struct pre_compact_ctrs    *pco_cnt;
 
-	u64    cap, tcap, used, garbage, record, rec, cobj;
+	u64    cap, tcap, used, garbage, record, rec, cobj, grow, ahead;
 	u32    pct, pctg, mdccnt;
 	u16    cslot;
 
@@ -3005,8 +4256,21 @@ static bool pmd_mdc_needed(struct mpool_descriptor *mp)
 		return false;
 	}
 
-	/* Percentage capacity used across all MDCs */
-	pct  = (used  * 100) / cap;
+	/*
+	 * Average the growth of the used space over the last few runs. A
+	 * compaction shrinks the used space, that counts as no growth, and so
+	 * does the first run, which has nothing to compare with.
+	 */
+	grow = 0;
+	if (pco->pco_mdcused && used > pco->pco_mdcused)
+		grow = used - pco->pco_mdcused;
+	pco->pco_mdcrate = (pco->pco_mdcrate * 3 + grow) / 4;
+	pco->pco_mdcused = used;
+
+	ahead = min_t(u64, pco->pco_mdcrate * mp->pds_params.mp_crtmdcahead, cap);
+
+	/* Percentage capacity used across all MDCs, forecast */
+	pct  = ((used + ahead) * 100) / cap;
 
 	/* Percentage garbage available across all MDCs */
 	if (garbage)
@@ -3015,8 +4279,9 @@ static bool pmd_mdc_needed(struct mpool_descriptor *mp)
 	if (pct > mp->pds_params.mp_crtmdcpctfull && pctg < mp->pds_params.mp_crtmdcpctgrbg) {
 		merr_t err = 0;
 
-		mp_pr_debug("MDCn %u cap %u used %u rec %u grbg %u pct used %u grbg %u Thres %u-%u",
-			    err, mdccnt, (u32)cap, (u32)used, (u32)record, (u32)garbage, pct, pctg,
+		mp_pr_debug("MDCn %u cap %u used %u ahead %u rec %u grbg %u pct used %u grbg %u Thres %u-%u",
+			    err, mdccnt, (u32)cap, (u32)used, (u32)ahead, (u32)record, (u32)garbage,
+			    pct, pctg,
 			    (u32)mp->pds_params.mp_crtmdcpctfull,
 			    (u32)mp->pds_params.mp_crtmdcpctgrbg);
 		return true;
@@ -3171,55 +4436,36 @@ void pmd_update_credit(struct mpool_descriptor *mp)
 	struct pmd_mdc_info        *cinfo;
 	struct pre_compact_ctrs    *pco_cnt;
 
-	u64      cap, used, free, nmtoc;
+	u64      cap, used, free;
 	u16      credit, cslot;
-	u8       sidx, nidx, num_mdc;
+	u8       sidx, num_mdc;
 	u8       slotnum[MDC_SLOTS] = { 0 };
 	void   **sarray = mp->pds_mda.mdi_sel.mds_smdc;
-	u32      nbnoalloc = (u32)mp->pds_params.mp_pconbnoalloc;
+	bool     skipactive = true;
+
+	/* Done by the last lazily loaded MDC, see pmd_mdc_load() */
+	if (atomic_read(&mp->pds_mda.mdi_lazycnt) > 0)
+		return;
 
 	if (mp->pds_mda.mdi_slotvcnt < 2) {
 		mp_pr_warn("Not enough MDCn %u", mp->pds_mda.mdi_slotvcnt - 1);
 		return;
 	}
 
-	nmtoc = atomic_read(&mp->pds_pco.pco_nmtoc);
-	nmtoc = nmtoc % (mp->pds_mda.mdi_slotvcnt - 1) + 1;
-
 	/*
-	 * slotvcnt includes MDC 0 and MDCn that are in precompaction
-	 * list and should be excluded. If there are less than (nbnoalloc
-	 * +2) MDCs exclusion is not possible. 2 is added to account for
-	 * MDC0 and the MDC pointed to by pco_nmtoc.
-	 *
-	 * MDC that is in pre-compacting state and two MDCs that follows
-	 * are excluded from allocation. This is done to prevent stall/
-	 * delays for a sync that follows an allocation as both take
-	 * take a compaction lock.
+	 * MDCs being pre-compacted are excluded from allocation. This is done
+	 * to prevent stall/delays for a sync that follows an allocation as
+	 * both take a compaction lock. If that leaves no MDC to allocate
+	 * from, compacting MDCs are included after all.
 	 */
-	if (mp->pds_mda.mdi_slotvcnt < (nbnoalloc + 2)) {
-		merr_t err = 0;
-
-		num_mdc = mp->pds_mda.mdi_slotvcnt - 1;
-		cslot  = 1;
-		mp_pr_debug("MDCn cnt %u, cannot skip %u num_mdc %u",
-			    err, mp->pds_mda.mdi_slotvcnt - 1, (u32)nmtoc, num_mdc);
-	} else {
-		num_mdc = mp->pds_mda.mdi_slotvcnt - (nbnoalloc + 2);
-		cslot = (nmtoc + nbnoalloc) % (mp->pds_mda.mdi_slotvcnt - 1);
-	}
-
-
-	/* Walkthrough all MDCs and exclude MDCs that are almost full */
-	for (nidx = 0, sidx = 0; nidx < num_mdc; nidx++) {
-		cslot = cslot % (mp->pds_mda.mdi_slotvcnt - 1) + 1;
-
-		if (cslot == 0)
-			cslot = 1;
-
+retry:
+	for (cslot = 1, sidx = 0; cslot < mp->pds_mda.mdi_slotvcnt; cslot++) {
 		cinfo = &mp->pds_mda.mdi_slotv[cslot];
 		pco_cnt = &(cinfo->mmi_pco_cnt);
 
+		if (skipactive && atomic_read(&cinfo->mmi_pcoactive))
+			continue;
+
 		cap  = atomic64_read(&pco_cnt->pcc_cap);
 		used = atomic64_read(&pco_cnt->pcc_len);
 
@@ -3232,6 +4478,14 @@ void pmd_update_credit(struct mpool_descriptor *mp)
 		cinfo->mmi_credit.ci_free = cap - used;
 	}
 
+	if (sidx == 0) {
+		if (!skipactive)
+			return; /* Keep the current table */
+
+		skipactive = false;
+		goto retry;
+	}
+
 	/* Sort the array with decreasing order of space */
 	sort((void *)sarray, sidx, sizeof(sarray[0]), pmd_compare_free_space, NULL);
 	num_mdc = sidx;
@@ -3317,12 +4571,34 @@ static void pmd_mdc_alloc_set(struct mpool_descriptor *mp)
 	}
 }
 
+/**
+ * pmd_mdc_provision() - create a set of MDCs in the background
+ * @work: pds_pco.pco_mdcwork
+ *
+ * Runs apart from pmd_precompact() so that pre-compaction and the credit
+ * updates don't stall while MDC0 is logging the new MDCs. The new MDCs
+ * receive their allocation credit at the next run of pmd_precompact(),
+ * which alone updates the credit.
+ */
+static void pmd_mdc_provision(struct work_struct *work)
+{
+	struct pre_compact_ctrl    *pco;
+
+	pco = container_of(work, typeof(*pco), pco_mdcwork);
+
+	pmd_mdc_alloc_set(pco->pco_mp);
+
+	atomic_set(&pco->pco_mdcbusy, 0);
+}
 
 /**
  * pmd_need_compact() - determine if MDCi corresponding to cslot
  *	need compaction of not.
  * @mp:
  * @cslot:
+ * @msgbuf:
+ * @msgsz:
+ * @cand:   (optional output) ranking of the MDC, set if compaction is needed
  *
  * The MDCi needs compaction if the active mlog is above some threshold and
  * if there is enough garbage (that can be eliminated by the compaction).
@@ -3331,7 +4607,13 @@ static void pmd_mdc_alloc_set(struct mpool_descriptor *mp)
  *	as a result of not holding lock the result may be off if a compaction
  *	of MDCi (with i = cslot) is taking place at the same time.
  */
-static bool pmd_need_compact(struct mpool_descriptor *mp, u8 cslot, char *msgbuf, size_t msgsz)
+static bool
+pmd_need_compact(
+	struct mpool_descriptor    *mp,
+	u8                          cslot,
+	char                       *msgbuf,
+	size_t                      msgsz,
+	struct pmd_pco_cand        *cand)
 {
 	struct pre_compact_ctrs    *pco_cnt;
 	struct pmd_mdc_info        *cinfo;
@@ -3374,6 +4656,12 @@ static bool pmd_need_compact(struct mpool_descriptor *mp, u8 cslot, char *msgbuf
 	if (garbage < mp->pds_params.mp_pcopctgarbage)
 		return false;
 
+	if (cand) {
+		cand->pc_slot = cslot;
+		cand->pc_rank = garbage * pct;
+		cand->pc_live = (len * (100 - garbage)) / 100;
+	}
+
 	if (msgbuf)
 		snprintf(msgbuf, msgsz,
 			 "bytes used %lu, total %lu, pct %u, records %lu, objects %lu, garbage %u",
@@ -3383,84 +4671,1294 @@ static bool pmd_need_compact(struct mpool_descriptor *mp, u8 cslot, char *msgbuf
 }
 
 /**
- * pmd_precompact() - precompact an mpool MDC
- * @work:
- *
- * The goal of this thread is to minimize the application objects commit time.
- * This thread pre compacts the MDC1/255. As a consequence MDC1/255 compaction
- * does not occurs in the context of an application object commit.
+ * pmd_pco_cmp() - sort pre-compaction candidates by decreasing rank
  */
-static void pmd_precompact(struct work_struct *work)
+static int pmd_pco_cmp(const void *first, const void *second)
 {
-	struct pre_compact_ctrl    *pco;
-	struct mpool_descriptor    *mp;
-	struct pmd_mdc_info        *cinfo;
+	const struct pmd_pco_cand *f = first;
+	const struct pmd_pco_cand *s = second;
 
-	char    msgbuf[128];
-	uint    nmtoc, delay;
-	bool    compact;
-	u8      cslot;
+	if (f->pc_rank != s->pc_rank)
+		return f->pc_rank > s->pc_rank ? -1 : 1;
 
-	pco = container_of(work, typeof(*pco), pco_dwork.work);
-	mp = pco->pco_mp;
+	/* Same rank, rewrite the smaller live set first */
+	if (f->pc_live != s->pc_live)
+		return f->pc_live < s->pc_live ? -1 : 1;
 
-	nmtoc = atomic_fetch_add(1, &pco->pco_nmtoc);
+	return 0;
+}
 
-	/* Only compact MDC1/255 not MDC0. */
-	cslot = (nmtoc % (mp->pds_mda.mdi_slotvcnt - 1)) + 1;
+/**
+ * pmd_pco_compact() - pre-compact one MDC selected by the scheduler
+ * @mp:
+ * @cslot:
+ */
+static void pmd_pco_compact(struct mpool_descriptor *mp, u8 cslot)
+{
+	struct pmd_mdc_info    *cinfo = &mp->pds_mda.mdi_slotv[cslot];
+	char                    msgbuf[128];
+	bool                    compact;
 
 	/*
-	 * Check if the next mpool mdc to compact needs compaction.
-	 *
-	 * Note that this check is done without taking any lock.
-	 * This is safe because the mpool MDCs don't go away as long as
-	 * the mpool is activated. The mpool can't deactivate before
-	 * this thread exit.
+	 * Check a second time while we hold the compact lock
+	 * to avoid doing a useless compaction.
 	 */
-	compact = pmd_need_compact(mp, cslot, NULL, 0);
-	if (compact) {
-		cinfo = &mp->pds_mda.mdi_slotv[cslot];
+	pmd_mdc_lock(&cinfo->mmi_compactlock, cslot);
+	compact = pmd_need_compact(mp, cslot, msgbuf, sizeof(msgbuf), NULL);
+	if (compact)
+		pmd_mdc_compact(mp, cslot);
+	pmd_mdc_unlock(&cinfo->mmi_compactlock);
 
-		/*
-		 * Check a second time while we hold the compact lock
-		 * to avoid doing a useless compaction.
-		 */
+	atomic_set(&cinfo->mmi_pcoactive, 0);
+
+	if (compact)
+		mp_pr_info("mpool %s, MDC%u %s", mp->pds_name, cslot, msgbuf);
+}
+
+/**
+ * pmd_pco_worker() - compact MDCs from a scheduled set until none are left
+ * @ws:
+ */
+static void pmd_pco_worker(struct work_struct *ws)
+{
+	struct pmd_pco_work    *pcw;
+	int                     idx;
+
+	pcw = container_of(ws, struct pmd_pco_work, pcw_work);
+
+	while ((idx = atomic_fetch_add(1, pcw->pcw_progress)) < pcw->pcw_slotc)
+		pmd_pco_compact(pcw->pcw_mp, pcw->pcw_slotv[idx]);
+}
+
+/**
+ * pmd_pco_schedule() - rank the MDCs that need compaction and compact them
+ * @mp:
+ *
+ * All MDC1/255 that pass pmd_need_compact() are ranked by garbage ratio
+ * times fill ratio of their active mlog.  MDCs are picked in rank order
+ * until the estimated live metadata to rewrite exceeds mp_pcobudget, up
+ * to mp_pconbnoalloc MDCs.  The picked MDCs are excluded from allocation
+ * and compacted by as many concurrent jobs, the caller being one of them.
+ * Allocations keep flowing to the other MDCs.
+ *
+ * Note that the ranking is done without taking any lock.
+ * This is safe because the mpool MDCs don't go away as long as
+ * the mpool is activated. The mpool can't deactivate before
+ * this thread exit.
+ */
+static void pmd_pco_schedule(struct mpool_descriptor *mp)
+{
+	struct pmd_pco_work     pcwv[MPOOL_PCO_JOBS_MAX];
+	struct pmd_pco_cand    *candv;
+
+	u8          slotv[MPOOL_PCO_JOBS_MAX];
+	atomic_t    progress = ATOMIC_INIT(0);
+	u64         budget, live;
+	uint        maxc, candc, slotc, i;
+	u16         slotvcnt;
+	u8          cslot;
+
+	maxc = min_t(u64, mp->pds_params.mp_pconbnoalloc, MPOOL_PCO_JOBS_MAX);
+	slotvcnt = mp->pds_mda.mdi_slotvcnt;
+
+	if (maxc == 0 || slotvcnt < 2)
+		return;
+
+	candv = kmalloc_array(slotvcnt - 1, sizeof(*candv), GFP_KERNEL);
+	if (!candv)
+		return;
+
+	for (cslot = 1, candc = 0; cslot < slotvcnt; cslot++) {
+		if (pmd_need_compact(mp, cslot, NULL, 0, &candv[candc]))
+			++candc;
+	}
+
+	sort(candv, candc, sizeof(*candv), pmd_pco_cmp, NULL);
+
+	budget = mp->pds_params.mp_pcobudget << 20;
+
+	for (i = 0, slotc = 0, live = 0; i < candc && slotc < maxc; i++) {
+		if (slotc > 0 && live + candv[i].pc_live > budget)
+			continue;
+
+		live += candv[i].pc_live;
+		slotv[slotc++] = candv[i].pc_slot;
+	}
+
+	kfree(candv);
+
+	if (slotc == 0)
+		return;
+
+	for (i = 0; i < slotc; i++)
+		atomic_set(&mp->pds_mda.mdi_slotv[slotv[i]].mmi_pcoactive, 1);
+
+	/* Steer allocations away from the MDCs about to be compacted */
+	pmd_update_credit(mp);
+
+	for (i = 0; i < slotc; i++) {
+		INIT_WORK(&pcwv[i].pcw_work, pmd_pco_worker);
+		pcwv[i].pcw_mp = mp;
+		pcwv[i].pcw_progress = &progress;
+		pcwv[i].pcw_slotv = slotv;
+		pcwv[i].pcw_slotc = slotc;
+
+		if (i > 0)
+			mpool_queue_work(mp, MPOOL_WQ_PCO, &pcwv[i].pcw_work);
+	}
+
+	pmd_pco_worker(&pcwv[0].pcw_work);
+
+	for (i = 1; i < slotc; i++)
+		flush_work(&pcwv[i].pcw_work);
+}
+
+/**
+ * pmd_precompact() - precompact mpool MDCs
+ * @work:
+ *
+ * The goal of this thread is to minimize the application objects commit time.
+ * This thread pre compacts the MDC1/255. As a consequence MDC1/255 compaction
+ * does not occurs in the context of an application object commit.
+ */
+static void pmd_precompact(struct work_struct *work)
+{
+	struct pre_compact_ctrl    *pco;
+	struct mpool_descriptor    *mp;
+	uint                        delay;
+
+	pco = container_of(work, typeof(*pco), pco_dwork.work);
+	mp = pco->pco_mp;
+
+	/* Nothing to do until all MDCs are loaded */
+	if (!completion_done(&mp->pds_mda.mdi_lazydone))
+		goto requeue;
+
+	pmd_pco_schedule(mp);
+
+	/* If about to run low on MDC space create new MDCs */
+	if (pmd_mdc_needed(mp) && !atomic_xchg(&pco->pco_mdcbusy, 1))
+		mpool_queue_work(mp, MPOOL_WQ_PCO, &pco->pco_mdcwork);
+
+	pmd_update_credit(mp);
+
+requeue:
+	delay = clamp_t(uint, mp->pds_params.mp_pcoperiod, 1, 3600);
+
+	mpool_queue_dwork(mp, MPOOL_WQ_PCO, &pco->pco_dwork, msecs_to_jiffies(delay * 1000));
+}
+
+void pmd_precompact_start(struct mpool_descriptor *mp)
+{
+	struct pre_compact_ctrl *pco;
+
+	pco = &mp->pds_pco;
+	pco->pco_mp = mp;
+	pco->pco_mdcused = 0;
+	pco->pco_mdcrate = 0;
+	atomic_set(&pco->pco_mdcbusy, 0);
+
+	INIT_WORK(&pco->pco_mdcwork, pmd_mdc_provision);
+	INIT_DELAYED_WORK(&pco->pco_dwork, pmd_precompact);
+	mpool_queue_dwork(mp, MPOOL_WQ_PCO, &pco->pco_dwork, 1);
+}
+
+void pmd_precompact_stop(struct mpool_descriptor *mp)
+{
+	cancel_delayed_work_sync(&mp->pds_pco.pco_dwork);
+	cancel_work_sync(&mp->pds_pco.pco_mdcwork);
+}
+
+/*
+ * Mblock tiering.
+ *
+ * PMD_TIER_CANDMAX:   max promotion and demotion candidates of a pass
+ * PMD_TIER_SCANBATCH: committed objects examined per mmi_co_lock hold
+ * PMD_TIER_IOSZ:      size of the buffer data is copied through
+ */
+#define PMD_TIER_CANDMAX        256
+#define PMD_TIER_SCANBATCH      1024
+#define PMD_TIER_IOSZ           (256u << 10)
+
+/**
+ * struct pmd_tier_cand - mblock picked by a tiering pass
+ * @tc_objid:
+ * @tc_heat:  heat before the decay applied by this pass
+ */
+struct pmd_tier_cand {
+	u64     tc_objid;
+	u32     tc_heat;
+};
+
+/**
+ * struct pmd_tier_pass - state of a tiering pass
+ * @tp_hotv:   capacity class mblocks to promote, the hottest ones seen
+ * @tp_coldv:  staging class mblocks to demote
+ * @tp_hotc:
+ * @tp_coldc:
+ * @tp_heat:   min heat for promotion
+ * @tp_demote: true if the staging class is full enough to demote
+ * @tp_iov:    pages of tp_buf
+ * @tp_buf:    copy buffer, of PMD_TIER_IOSZ bytes
+ */
+struct pmd_tier_pass {
+	struct pmd_tier_cand    tp_hotv[PMD_TIER_CANDMAX];
+	struct pmd_tier_cand    tp_coldv[PMD_TIER_CANDMAX];
+	uint                    tp_hotc;
+	uint                    tp_coldc;
+	u32                     tp_heat;
+	bool                    tp_demote;
+	struct kvec             tp_iov[PMD_TIER_IOSZ >> PAGE_SHIFT];
+	void                   *tp_buf;
+};
+
+/*
+ * Wait for every async mblock read charged to the current epoch to
+ * complete.  Reads which captured a layout before it was switched to new
+ * zones did so under the layout lock, before the switch released it, and
+ * hence are charged to the epoch this returns after.
+ */
+static void pmd_tier_rdsync(struct mpool_descriptor *mp)
+{
+	struct pmd_tier_ctrl   *ptc = &mp->pds_tier;
+	u32                     idx;
+
+	idx = ptc->ptc_rdepoch & 1;
+	WRITE_ONCE(ptc->ptc_rdepoch, ptc->ptc_rdepoch + 1);
+
+	wait_event(ptc->ptc_rdwq, atomic_read(&ptc->ptc_rdcnt[idx]) == 0);
+}
+
+static merr_t pmd_log_update(struct mpool_descriptor *mp, struct pmd_layout *layout)
+{
+	struct omf_mdcrec_data  cdr;
+
+	cdr.omd_rtype = OMF_MDR_OUPDATE;
+	cdr.u.obj.omd_layout = layout;
+	return pmd_mdc_addrec(mp, objid_slot(layout->eld_objid), &cdr);
+}
+
+/*
+ * Return the committed object with the smallest objid >= objid, NULL if none.
+ * Caller must hold mmi_co_lock.
+ */
+static struct pmd_layout *pmd_co_find_ge(struct pmd_mdc_info *cinfo, u64 objid)
+{
+	struct rb_node     *node = cinfo->mmi_co_root.rb_node;
+	struct pmd_layout  *this, *found = NULL;
+
+	while (node) {
+		this = rb_entry(node, typeof(*this), eld_nodemdc);
+
+		if (this->eld_objid < objid) {
+			node = node->rb_right;
+		} else {
+			found = this;
+			node = node->rb_left;
+		}
+	}
+
+	return found;
+}
+
+/*
+ * Add a candidate, replacing the coldest one if the vector is full and
+ * the new candidate is hotter.
+ */
+static void pmd_tier_cand_add(struct pmd_tier_cand *candv, uint *candc, u64 objid, u32 heat)
+{
+	uint    i, min;
+
+	if (*candc < PMD_TIER_CANDMAX) {
+		min = (*candc)++;
+	} else {
+		for (i = 1, min = 0; i < PMD_TIER_CANDMAX; i++) {
+			if (candv[i].tc_heat < candv[min].tc_heat)
+				min = i;
+		}
+
+		if (heat <= candv[min].tc_heat)
+			return;
+	}
+
+	candv[min].tc_objid = objid;
+	candv[min].tc_heat = heat;
+}
+
+static int pmd_tier_cmp(const void *a, const void *b)
+{
+	const struct pmd_tier_cand *ca = a;
+	const struct pmd_tier_cand *cb = b;
+
+	if (ca->tc_heat != cb->tc_heat)
+		return ca->tc_heat > cb->tc_heat ? -1 : 1;
+
+	return 0;
+}
+
+/**
+ * pmd_tier_scan() - decay the heat of an MDC's mblocks and pick candidates
+ * @mp:
+ * @tp:
+ * @cslot:
+ *
+ * The committed objects tree is walked in batches so as not to hold off
+ * object commits and deletes for long.  The layout fields examined are
+ * read without the layout lock, pmd_tier_move() validates them.
+ */
+static void pmd_tier_scan(struct mpool_descriptor *mp, struct pmd_tier_pass *tp, u8 cslot)
+{
+	struct pmd_mdc_info    *cinfo = &mp->pds_mda.mdi_slotv[cslot];
+	struct pmd_layout      *layout;
+	struct rb_node         *node;
+
+	u64     next = 0;
+	u16     heat;
+	u8      mclass;
+	int     n;
+
+	do {
+		pmd_co_rlock(cinfo, cslot);
+		layout = pmd_co_find_ge(cinfo, next);
+		node = layout ? &layout->eld_nodemdc : NULL;
+
+		for (n = 0; node && n < PMD_TIER_SCANBATCH; node = rb_next(node), n++) {
+			layout = rb_entry(node, typeof(*layout), eld_nodemdc);
+
+			if (pmd_objid_type(layout->eld_objid) != OMF_OBJ_MBLOCK ||
+			    layout->eld_mblen == 0)
+				continue;
+
+			heat = READ_ONCE(layout->eld_heat);
+			if (heat)
+				WRITE_ONCE(layout->eld_heat, heat >> 1);
+
+			mclass = mp->pds_pdv[layout->eld_ld.ol_pdh].pdi_mclass;
+
+			if (mclass == MP_MED_CAPACITY && heat >= tp->tp_heat)
+				pmd_tier_cand_add(tp->tp_hotv, &tp->tp_hotc, layout->eld_objid, heat);
+			else if (mclass == MP_MED_STAGING && heat == 0 && tp->tp_demote)
+				pmd_tier_cand_add(tp->tp_coldv, &tp->tp_coldc, layout->eld_objid, heat);
+		}
+
+		if (node)
+			next = rb_entry(node, typeof(*layout), eld_nodemdc)->eld_objid;
+		pmd_co_runlock(cinfo);
+
+		cond_resched();
+	} while (node);
+}
+
+/**
+ * pmd_tier_copy() - copy the data of an mblock to other zones
+ * @mp:
+ * @iov:   pages of a PMD_TIER_IOSZ bytes copy buffer
+ * @src:   source zones
+ * @dst:   destination zones
+ * @mblen: bytes to copy
+ *
+ * The copy is flushed to media before returning.
+ */
+static merr_t
+pmd_tier_copy(
+	struct mpool_descriptor        *mp,
+	struct kvec                    *iov,
+	struct omf_layout_descriptor   *src,
+	struct omf_layout_descriptor   *dst,
+	u64                             mblen)
+{
+	struct mpool_dev_info  *spd, *dpd;
+	merr_t                  err = 0;
+	u64                     off, len;
+	int                     iovcnt;
+
+	spd = &mp->pds_pdv[src->ol_pdh];
+	dpd = &mp->pds_pdv[dst->ol_pdh];
+
+	if (mpool_pd_status_get(spd) == PD_STAT_UNAVAIL ||
+	    mpool_pd_status_get(dpd) == PD_STAT_UNAVAIL)
+		return merr(EIO);
+
+	for (off = 0; off < mblen && !err; off += len) {
+		len = min_t(u64, mblen - off, PMD_TIER_IOSZ);
+		iovcnt = (len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+		err = pd_zone_preadv(spd, iov, iovcnt, src->ol_zaddr, off, PD_IOC_BG);
+		if (!err)
+			err = pd_zone_pwritev(dpd, iov, iovcnt, dst->ol_zaddr, off, 0,
+					      PD_IOC_BG);
+	}
+
+	if (!err)
+		err = pd_dev_flush(dpd);
+
+	return ev(err);
+}
+
+/**
+ * pmd_tier_move() - move a committed mblock to another media class
+ * @mp:
+ * @iov:    pages of a PMD_TIER_IOSZ bytes copy buffer
+ * @objid:
+ * @mclass: destination media class
+ * @avoid:  if not NULL, zone range the mblock is moved out of within its
+ *          media class, which the new zones must not overlap
+ * @movedp: (output) bytes moved
+ *
+ * The data is copied to new zones without holding a lock or reference on
+ * the mblock, so that it can be deleted meanwhile.  The layout is then
+ * switched to the new zones by logging an update record, provided the
+ * mblock still exists and still lives in the zones copied from.  The old
+ * zones are released once no async read can be targeting them anymore.
+ */
+static merr_t
+pmd_tier_move(
+	struct mpool_descriptor            *mp,
+	struct kvec                        *iov,
+	u64                                 objid,
+	enum mp_media_classp                mclass,
+	const struct omf_layout_descriptor *avoid,
+	u64                                *movedp)
+{
+	struct omf_layout_descriptor    old, new;
+	struct pmd_obj_capacity         ocap = { };
+	struct pmd_layout               shadow;
+	struct pmd_mdc_info            *cinfo;
+	struct pmd_layout              *layout;
+	struct media_class             *mc;
+	struct mpool_dev_info          *pd;
+
+	u64     mblen, cap, ncap, zonesz;
+	u8      cslot;
+	merr_t  err;
+
+	*movedp = 0;
+
+	cslot = objid_slot(objid);
+	cinfo = &mp->pds_mda.mdi_slotv[cslot];
+
+	layout = pmd_obj_find_get(mp, objid, 1);
+	if (!layout)
+		return merr(ENOENT);
+
+	pmd_obj_rdlock(layout);
+	old = layout->eld_ld;
+	mblen = layout->eld_mblen;
+	cap = pmd_layout_cap_get(mp, layout);
+	pmd_obj_rdunlock(layout);
+
+	pmd_obj_put(mp, layout);
+
+	if (!avoid && mp->pds_pdv[old.ol_pdh].pdi_mclass == mclass)
+		return merr(EALREADY);
+
+	down_read(&mp->pds_pdvlock);
+	mc = &mp->pds_mc[mclass];
+	if (mc->mc_pdmc < 0) {
+		up_read(&mp->pds_pdvlock);
+		return merr(ENOENT);
+	}
+
+	/* Keep at least the same capacity if the zone size differs */
+	pd = &mp->pds_pdv[mc->mc_pdmc];
+	zonesz = (u64)pd->pdi_zonepg << PAGE_SHIFT;
+	new.ol_zcnt = (cap + zonesz - 1) / zonesz;
+	ncap = new.ol_zcnt * zonesz;
+
+	err = pmd_layout_provision(mp, &ocap, &shadow, mc, new.ol_zcnt);
+	up_read(&mp->pds_pdvlock);
+	if (err)
+		return err;
+
+	new.ol_pdh = shadow.eld_ld.ol_pdh;
+	new.ol_zaddr = shadow.eld_ld.ol_zaddr;
+
+	/* Only the drained rgn had room left, moving would not help */
+	if (avoid && new.ol_pdh == avoid->ol_pdh &&
+	    new.ol_zaddr < avoid->ol_zaddr + avoid->ol_zcnt &&
+	    new.ol_zaddr + new.ol_zcnt > avoid->ol_zaddr)
+		err = merr(ENOSPC);
+
+	if (!err)
+		err = pmd_tier_copy(mp, iov, &old, &new, mblen);
+	if (!err) {
+		layout = pmd_obj_find_get(mp, objid, 1);
+		if (!layout)
+			err = merr(ENOENT);
+	}
+
+	if (!err) {
+		pmd_obj_wrlock(layout);
 		pmd_mdc_lock(&cinfo->mmi_compactlock, cslot);
-		compact = pmd_need_compact(mp, cslot, msgbuf, sizeof(msgbuf));
-		if (compact)
-			pmd_mdc_compact(mp, cslot);
+
+		if ((layout->eld_state & PMD_LYT_REMOVED) || layout->eld_mblen != mblen ||
+		    layout->eld_ld.ol_pdh != old.ol_pdh || layout->eld_ld.ol_zaddr != old.ol_zaddr ||
+		    layout->eld_ld.ol_zcnt != old.ol_zcnt)
+			err = merr(ESTALE);
+
+		if (!err) {
+			shadow = *layout;
+			shadow.eld_ld = new;
+			err = pmd_log_update(mp, &shadow);
+		}
+
+		if (!err) {
+			layout->eld_ld = new;
+			atomic_inc(&cinfo->mmi_pco_cnt.pcc_up);
+		}
+
 		pmd_mdc_unlock(&cinfo->mmi_compactlock);
+		pmd_obj_wrunlock(layout);
+
+		pmd_obj_put(mp, layout);
+	}
+
+	if (err) {
+		smap_free(mp, new.ol_pdh, new.ol_zaddr, new.ol_zcnt);
+		return err;
+	}
+
+	pmd_usage_add(mp, PMD_USAGE_MBLOCK_ALEN, (s64)ncap - (s64)cap);
+
+	pmd_tier_rdsync(mp);
+
+	pd = &mp->pds_pdv[old.ol_pdh];
+	if (mpool_pd_status_get(pd) != PD_STAT_UNAVAIL)
+		ev(pd_zone_erase(pd, old.ol_zaddr, old.ol_zcnt, false));
+
+	err = smap_free(mp, old.ol_pdh, old.ol_zaddr, old.ol_zcnt);
+	if (err)
+		mp_pr_err("mpool %s, objid 0x%lx, releasing moved out zones failed",
+			  err, mp->pds_name, (ulong)objid);
+
+	*movedp = mblen;
+
+	return 0;
+}
+
+/*
+ * Allocate a PMD_TIER_IOSZ bytes copy buffer and fill iov with its pages.
+ */
+static void *pmd_tier_buf_alloc(struct kvec *iov)
+{
+	void   *buf;
+	int     i;
+
+	buf = alloc_pages_exact(PMD_TIER_IOSZ, GFP_KERNEL);
+	if (!buf)
+		return NULL;
+
+	for (i = 0; i < PMD_TIER_IOSZ >> PAGE_SHIFT; i++) {
+		iov[i].iov_base = buf + (i << PAGE_SHIFT);
+		iov[i].iov_len = PAGE_SIZE;
+	}
+
+	return buf;
+}
+
+/* Staging class used space in % of its usable space. */
+static u64 pmd_tier_fill(struct mpool_descriptor *mp)
+{
+	struct mpool_usage usage = { };
+
+	down_read(&mp->pds_pdvlock);
+	smap_mclass_usage(mp, MP_MED_STAGING, &usage);
+	up_read(&mp->pds_pdvlock);
+
+	return usage.mpu_usable ? div64_u64(usage.mpu_used * 100, usage.mpu_usable) : 100;
+}
+
+/**
+ * pmd_tier_pass() - move mblocks between the staging and capacity classes
+ * @mp:
+ *
+ * Every pass halves the heat of all committed mblocks.  While the staging
+ * class is more than MPOOL_TIER_PCTFULL full, mblocks with no heat left are
+ * demoted out of it.  While it is less full, the hottest capacity class
+ * mblocks with a heat of at least mp_tierheat are promoted into it.  At most
+ * mp_tierbudget MiB of data are moved by a pass.  While a rebalance is
+ * running, mblocks are not moved out of its destination class, which would
+ * undo it.
+ */
+static void pmd_tier_pass(struct mpool_descriptor *mp)
+{
+	struct pmd_tier_pass   *tp;
+
+	u64     budget, total, moved;
+	uint    promoted, demoted, i;
+	u16     slotvcnt;
+	u8      cslot, rebaldst;
+
+	if (mp->pds_mc[MP_MED_STAGING].mc_pdmc < 0 || mp->pds_mc[MP_MED_CAPACITY].mc_pdmc < 0)
+		return;
+
+	tp = kzalloc(sizeof(*tp), GFP_KERNEL);
+	if (!tp)
+		return;
+
+	tp->tp_buf = pmd_tier_buf_alloc(tp->tp_iov);
+	if (!tp->tp_buf) {
+		kfree(tp);
+		return;
+	}
+
+	mutex_lock(&mp->pds_tier.ptc_movelock);
+
+	/* ptc_movelock keeps a rebalance from stepping meanwhile */
+	rebaldst = MP_MED_NUMBER;
+	spin_lock(&mp->pds_rebal.prc_lock);
+	if (mp->pds_rebal.prc_active)
+		rebaldst = mp->pds_pdv[mp->pds_rebal.prc_pdh].pdi_mclass;
+	spin_unlock(&mp->pds_rebal.prc_lock);
+
+	tp->tp_heat = mp->pds_params.mp_tierheat;
+	tp->tp_demote = pmd_tier_fill(mp) >= MPOOL_TIER_PCTFULL && rebaldst != MP_MED_STAGING;
+
+	slotvcnt = mp->pds_mda.mdi_slotvcnt;
+	for (cslot = 1; cslot < slotvcnt; cslot++)
+		pmd_tier_scan(mp, tp, cslot);
+
+	budget = mp->pds_params.mp_tierbudget << 20;
+	total = promoted = demoted = 0;
+
+	for (i = 0; i < tp->tp_coldc && total < budget; i++) {
+		if (!pmd_tier_move(mp, tp->tp_iov, tp->tp_coldv[i].tc_objid, MP_MED_CAPACITY, NULL,
+				   &moved))
+			demoted++;
+		total += moved;
+	}
+
+	sort(tp->tp_hotv, tp->tp_hotc, sizeof(tp->tp_hotv[0]), pmd_tier_cmp, NULL);
+
+	if (rebaldst == MP_MED_CAPACITY)
+		tp->tp_hotc = 0;
+
+	for (i = 0; i < tp->tp_hotc && total < budget; i++) {
+		if (pmd_tier_fill(mp) >= MPOOL_TIER_PCTFULL)
+			break;
+
+		if (!pmd_tier_move(mp, tp->tp_iov, tp->tp_hotv[i].tc_objid, MP_MED_STAGING, NULL,
+				   &moved))
+			promoted++;
+		total += moved;
+	}
+
+	mutex_unlock(&mp->pds_tier.ptc_movelock);
+
+	free_pages_exact(tp->tp_buf, PMD_TIER_IOSZ);
+	kfree(tp);
+
+	if (promoted || demoted)
+		mp_pr_debug("mpool %s, tiering promoted %u demoted %u mblocks, %llu KiB",
+			    0, mp->pds_name, promoted, demoted, total >> 10);
+}
+
+/**
+ * pmd_tier() - periodic mblock tiering
+ * @work:
+ */
+static void pmd_tier(struct work_struct *work)
+{
+	struct pmd_tier_ctrl       *ptc;
+	struct mpool_descriptor    *mp;
+	uint                        delay;
+
+	ptc = container_of(work, typeof(*ptc), ptc_dwork.work);
+	mp = ptc->ptc_mp;
+
+	/* Nothing to do until all MDCs are loaded */
+	if (completion_done(&mp->pds_mda.mdi_lazydone))
+		pmd_tier_pass(mp);
+
+	delay = clamp_t(uint, mp->pds_params.mp_tierperiod, 1, 3600);
+
+	mpool_queue_dwork(mp, MPOOL_WQ_MOVE, &ptc->ptc_dwork, msecs_to_jiffies(delay * 1000));
+}
+
+void pmd_tier_start(struct mpool_descriptor *mp)
+{
+	struct pmd_tier_ctrl   *ptc = &mp->pds_tier;
+	uint                    delay;
+
+	ptc->ptc_mp = mp;
+	INIT_DELAYED_WORK(&ptc->ptc_dwork, pmd_tier);
+
+	if (!mp->pds_params.mp_tierperiod)
+		return;
+
+	delay = clamp_t(uint, mp->pds_params.mp_tierperiod, 1, 3600);
+
+	mpool_queue_dwork(mp, MPOOL_WQ_MOVE, &ptc->ptc_dwork, msecs_to_jiffies(delay * 1000));
+}
+
+void pmd_tier_stop(struct mpool_descriptor *mp)
+{
+	cancel_delayed_work_sync(&mp->pds_tier.ptc_dwork);
+}
+
+/*
+ * Free space defragmentation.
+ *
+ * Churn leaves small mblocks scattered across the rgns of a drive, which
+ * splits their free space into extents too short for large allocations.
+ * A defrag pass picks the most fragmented rgn of each drive, keeps new
+ * allocations out of it, and moves its smallest mblocks elsewhere so that
+ * the zones they free coalesce with the free extents around them.
+ */
+
+/**
+ * struct pmd_defrag_cand - mblock picked by a defrag pass
+ * @dc_objid:
+ * @dc_zcnt:  zones of the mblock
+ */
+struct pmd_defrag_cand {
+	u64     dc_objid;
+	u32     dc_zcnt;
+};
+
+/**
+ * struct pmd_defrag_pass - state of a defrag pass
+ * @dp_candv: smallest mblocks of dp_rgn
+ * @dp_candc:
+ * @dp_rgn:   zone range of the rgn being drained
+ * @dp_iov:   pages of dp_buf
+ * @dp_buf:   copy buffer, of PMD_TIER_IOSZ bytes
+ */
+struct pmd_defrag_pass {
+	struct pmd_defrag_cand          dp_candv[PMD_TIER_CANDMAX];
+	uint                            dp_candc;
+	struct omf_layout_descriptor    dp_rgn;
+	struct kvec                     dp_iov[PMD_TIER_IOSZ >> PAGE_SHIFT];
+	void                           *dp_buf;
+};
+
+/*
+ * Add a candidate, replacing the largest one if the vector is full and
+ * the new candidate is smaller.
+ */
+static void pmd_defrag_cand_add(struct pmd_defrag_pass *dp, u64 objid, u32 zcnt)
+{
+	struct pmd_defrag_cand *candv = dp->dp_candv;
+	uint                    i, max;
+
+	if (dp->dp_candc < PMD_TIER_CANDMAX) {
+		max = dp->dp_candc++;
+	} else {
+		for (i = 1, max = 0; i < PMD_TIER_CANDMAX; i++) {
+			if (candv[i].dc_zcnt > candv[max].dc_zcnt)
+				max = i;
+		}
+
+		if (zcnt >= candv[max].dc_zcnt)
+			return;
+	}
+
+	candv[max].dc_objid = objid;
+	candv[max].dc_zcnt = zcnt;
+}
+
+static int pmd_defrag_cmp(const void *a, const void *b)
+{
+	const struct pmd_defrag_cand *ca = a;
+	const struct pmd_defrag_cand *cb = b;
+
+	if (ca->dc_zcnt != cb->dc_zcnt)
+		return ca->dc_zcnt < cb->dc_zcnt ? -1 : 1;
 
-		if (compact)
-			mp_pr_info("mpool %s, MDC%u %s", mp->pds_name, cslot, msgbuf);
+	return 0;
+}
+
+/**
+ * pmd_defrag_scan() - pick the smallest committed mblocks of an MDC in dp_rgn
+ * @mp:
+ * @dp:
+ * @cslot:
+ *
+ * Walks the committed objects tree in batches like pmd_tier_scan(), the
+ * layouts examined are validated by pmd_tier_move().
+ */
+static void pmd_defrag_scan(struct mpool_descriptor *mp, struct pmd_defrag_pass *dp, u8 cslot)
+{
+	struct pmd_mdc_info            *cinfo = &mp->pds_mda.mdi_slotv[cslot];
+	struct omf_layout_descriptor   *rgn = &dp->dp_rgn;
+	struct pmd_layout              *layout;
+	struct rb_node                 *node;
+
+	u64     next = 0, zaddr;
+	int     n;
+
+	do {
+		pmd_co_rlock(cinfo, cslot);
+		layout = pmd_co_find_ge(cinfo, next);
+		node = layout ? &layout->eld_nodemdc : NULL;
+
+		for (n = 0; node && n < PMD_TIER_SCANBATCH; node = rb_next(node), n++) {
+			layout = rb_entry(node, typeof(*layout), eld_nodemdc);
+
+			if (pmd_objid_type(layout->eld_objid) != OMF_OBJ_MBLOCK ||
+			    layout->eld_mblen == 0 || layout->eld_ld.ol_pdh != rgn->ol_pdh)
+				continue;
+
+			zaddr = layout->eld_ld.ol_zaddr;
+			if (zaddr >= rgn->ol_zaddr && zaddr < rgn->ol_zaddr + rgn->ol_zcnt)
+				pmd_defrag_cand_add(dp, layout->eld_objid, layout->eld_ld.ol_zcnt);
+		}
+
+		if (node)
+			next = rb_entry(node, typeof(*layout), eld_nodemdc)->eld_objid;
+		pmd_co_runlock(cinfo);
+
+		cond_resched();
+	} while (node);
+}
+
+/**
+ * pmd_defrag_pass() - move mblocks out of the most fragmented rgn of each drive
+ * @mp:
+ *
+ * Only rgns with at least mp_defragpct % of their free zones outside their
+ * largest free extent are defragmented.  Their mblocks are moved smallest
+ * first, within the same media class, and at most mp_defragbudget MiB of
+ * data are moved by a pass.
+ */
+static void pmd_defrag_pass(struct mpool_descriptor *mp)
+{
+	struct pmd_defrag_pass *dp;
+	struct omf_layout_descriptor *rgn;
+
+	u64     budget, total, moved, zaddr, zcnt;
+	uint    relocated, i;
+	u32     rgnidx;
+	u16     slotvcnt;
+	u8      cslot;
+	int     mclass, pdh;
+
+	dp = kzalloc(sizeof(*dp), GFP_KERNEL);
+	if (!dp)
+		return;
+
+	dp->dp_buf = pmd_tier_buf_alloc(dp->dp_iov);
+	if (!dp->dp_buf) {
+		kfree(dp);
+		return;
 	}
 
-	/* If running low on MDC space create new MDCs */
-	if (pmd_mdc_needed(mp))
-		pmd_mdc_alloc_set(mp);
+	mutex_lock(&mp->pds_tier.ptc_movelock);
 
-	pmd_update_credit(mp);
+	rgn = &dp->dp_rgn;
+	budget = mp->pds_params.mp_defragbudget << 20;
+	total = relocated = 0;
 
-	delay = clamp_t(uint, mp->pds_params.mp_pcoperiod, 1, 3600);
+	for (mclass = MP_MED_BASE; mclass < MP_MED_NUMBER && total < budget; mclass++) {
+		pdh = mp->pds_mc[mclass].mc_pdmc;
+		if (pdh < 0)
+			continue;
+
+		if (!smap_rgn_frag(mp, pdh, mp->pds_params.mp_defragpct, &rgnidx, &zaddr, &zcnt))
+			continue;
+
+		rgn->ol_pdh = pdh;
+		rgn->ol_zaddr = zaddr;
+		rgn->ol_zcnt = zcnt;
+		dp->dp_candc = 0;
+
+		smap_rgn_drain(mp, pdh, rgnidx);
+
+		slotvcnt = mp->pds_mda.mdi_slotvcnt;
+		for (cslot = 1; cslot < slotvcnt; cslot++)
+			pmd_defrag_scan(mp, dp, cslot);
+
+		sort(dp->dp_candv, dp->dp_candc, sizeof(dp->dp_candv[0]), pmd_defrag_cmp, NULL);
+
+		for (i = 0; i < dp->dp_candc && total < budget; i++) {
+			if (!pmd_tier_move(mp, dp->dp_iov, dp->dp_candv[i].dc_objid, mclass, rgn,
+					   &moved))
+				relocated++;
+			total += moved;
+		}
+
+		smap_rgn_drain(mp, pdh, SMAP_RGN_NONE);
+	}
+
+	mutex_unlock(&mp->pds_tier.ptc_movelock);
+
+	free_pages_exact(dp->dp_buf, PMD_TIER_IOSZ);
+	kfree(dp);
 
-	queue_delayed_work(mp->pds_workq, &pco->pco_dwork, msecs_to_jiffies(delay * 1000));
+	if (relocated)
+		mp_pr_debug("mpool %s, defrag moved %u mblocks, %llu KiB",
+			    0, mp->pds_name, relocated, total >> 10);
 }
 
-void pmd_precompact_start(struct mpool_descriptor *mp)
+/**
+ * pmd_defrag() - periodic free space defragmentation
+ * @work:
+ */
+static void pmd_defrag(struct work_struct *work)
 {
-	struct pre_compact_ctrl *pco;
+	struct pmd_defrag_ctrl     *pdc;
+	struct mpool_descriptor    *mp;
+	uint                        delay;
 
-	pco = &mp->pds_pco;
-	pco->pco_mp = mp;
-	atomic_set(&pco->pco_nmtoc, 0);
+	pdc = container_of(work, typeof(*pdc), pdc_dwork.work);
+	mp = pdc->pdc_mp;
 
-	INIT_DELAYED_WORK(&pco->pco_dwork, pmd_precompact);
-	queue_delayed_work(mp->pds_workq, &pco->pco_dwork, 1);
+	/* Nothing to do until all MDCs are loaded */
+	if (completion_done(&mp->pds_mda.mdi_lazydone))
+		pmd_defrag_pass(mp);
+
+	delay = clamp_t(uint, mp->pds_params.mp_defragperiod, 1, 3600);
+
+	mpool_queue_dwork(mp, MPOOL_WQ_MOVE, &pdc->pdc_dwork, msecs_to_jiffies(delay * 1000));
 }
 
-void pmd_precompact_stop(struct mpool_descriptor *mp)
+void pmd_defrag_start(struct mpool_descriptor *mp)
 {
-	cancel_delayed_work_sync(&mp->pds_pco.pco_dwork);
+	struct pmd_defrag_ctrl *pdc = &mp->pds_defrag;
+	uint                    delay;
+
+	pdc->pdc_mp = mp;
+	INIT_DELAYED_WORK(&pdc->pdc_dwork, pmd_defrag);
+
+	if (!mp->pds_params.mp_defragperiod)
+		return;
+
+	delay = clamp_t(uint, mp->pds_params.mp_defragperiod, 1, 3600);
+
+	mpool_queue_dwork(mp, MPOOL_WQ_MOVE, &pdc->pdc_dwork, msecs_to_jiffies(delay * 1000));
+}
+
+void pmd_defrag_stop(struct mpool_descriptor *mp)
+{
+	cancel_delayed_work_sync(&mp->pds_defrag.pdc_dwork);
+}
+
+/*
+ * Mblock rebalancing.
+ *
+ * A drive added to an mpool always starts a media class of its own, so
+ * the only way to put it to work on existing data is to move committed
+ * mblocks into its class.  They are moved from the other class until both
+ * are equally full, hottest first to a staging drive and coldest first to
+ * a capacity drive, at most mp_rebalrate MiB per PMD_REBAL_STEP_MS.
+ * Tiering does not move mblocks out of the destination class meanwhile.
+ *
+ * The rebalance state is not persisted: a rebalance still running when the
+ * mpool is deactivated is dropped and is not resumed on activation.
+ *
+ * PMD_REBAL_STEP_MS:  period of the rebalance steps
+ * PMD_REBAL_LOGPCT:   progress logged every this many % of the target
+ */
+#define PMD_REBAL_STEP_MS       1000
+#define PMD_REBAL_LOGPCT        10
+
+/**
+ * struct pmd_rebal_pass - state of a running rebalance
+ * @rp_candv:  mblocks of the current round, best first
+ * @rp_candc:
+ * @rp_next:   next rp_candv[] entry to move
+ * @rp_rmoved: bytes moved in the current round
+ * @rp_src:    media class mblocks are moved out of
+ * @rp_dst:    media class of the added drive
+ * @rp_iov:    pages of rp_buf
+ * @rp_buf:    copy buffer, of PMD_TIER_IOSZ bytes
+ */
+struct pmd_rebal_pass {
+	struct pmd_tier_cand    rp_candv[PMD_TIER_CANDMAX];
+	uint                    rp_candc;
+	uint                    rp_next;
+	u64                     rp_rmoved;
+	u8                      rp_src;
+	u8                      rp_dst;
+	struct kvec             rp_iov[PMD_TIER_IOSZ >> PAGE_SHIFT];
+	void                   *rp_buf;
+};
+
+/**
+ * pmd_rebal_scan() - pick the source class mblocks of an MDC to move first
+ * @mp:
+ * @rp:
+ * @cslot:
+ *
+ * Unlike pmd_tier_scan() the heat is left alone, the ranking key is the
+ * heat for a staging destination and its complement otherwise.
+ */
+static void pmd_rebal_scan(struct mpool_descriptor *mp, struct pmd_rebal_pass *rp, u8 cslot)
+{
+	struct pmd_mdc_info    *cinfo = &mp->pds_mda.mdi_slotv[cslot];
+	struct pmd_layout      *layout;
+	struct rb_node         *node;
+
+	u64     next = 0;
+	u16     heat;
+	int     n;
+
+	do {
+		pmd_co_rlock(cinfo, cslot);
+		layout = pmd_co_find_ge(cinfo, next);
+		node = layout ? &layout->eld_nodemdc : NULL;
+
+		for (n = 0; node && n < PMD_TIER_SCANBATCH; node = rb_next(node), n++) {
+			layout = rb_entry(node, typeof(*layout), eld_nodemdc);
+
+			if (pmd_objid_type(layout->eld_objid) != OMF_OBJ_MBLOCK ||
+			    layout->eld_mblen == 0 ||
+			    mp->pds_pdv[layout->eld_ld.ol_pdh].pdi_mclass != rp->rp_src)
+				continue;
+
+			heat = READ_ONCE(layout->eld_heat);
+			if (rp->rp_dst != MP_MED_STAGING)
+				heat = U16_MAX - heat;
+
+			pmd_tier_cand_add(rp->rp_candv, &rp->rp_candc, layout->eld_objid, heat);
+		}
+
+		if (node)
+			next = rb_entry(node, typeof(*layout), eld_nodemdc)->eld_objid;
+		pmd_co_runlock(cinfo);
+
+		cond_resched();
+	} while (node);
+}
+
+/*
+ * Bytes to move out of class src for src and dst to be equally full,
+ * computed in MiB so as not to overflow.
+ */
+static u64 pmd_rebal_target(struct mpool_descriptor *mp, u8 src, u8 dst)
+{
+	struct mpool_usage  su = { }, du = { };
+	u64                 used, usable, keep;
+
+	down_read(&mp->pds_pdvlock);
+	smap_mclass_usage(mp, src, &su);
+	smap_mclass_usage(mp, dst, &du);
+	up_read(&mp->pds_pdvlock);
+
+	used = (su.mpu_used + du.mpu_used) >> 20;
+	usable = (su.mpu_usable + du.mpu_usable) >> 20;
+	if (!usable)
+		return 0;
+
+	keep = div64_u64(used * (su.mpu_usable >> 20), usable) << 20;
+
+	return su.mpu_used > keep ? su.mpu_used - keep : 0;
+}
+
+/* Log the progress of the rebalance every PMD_REBAL_LOGPCT % */
+static void pmd_rebal_log(struct mpool_descriptor *mp, struct pmd_rebal_ctrl *prc)
+{
+	struct mpool_rebal_stats    stats;
+	uint                        pct;
+
+	pmd_rebal_stats_get(mp, &stats);
+
+	pct = stats.mrs_target ? div64_u64(stats.mrs_moved * 100, stats.mrs_target) : 100;
+	if (stats.mrs_active && pct < prc->prc_logpct + PMD_REBAL_LOGPCT)
+		return;
+
+	prc->prc_logpct = pct;
+
+	mp_pr_info("mpool %s, rebalance to pd %s %s, %llu of %llu MiB (%u%%), %llu s elapsed, eta %llu s",
+		   mp->pds_name, stats.mrs_pdname,
+		   stats.mrs_active ? "running" : (pct >= 100 ? "done" : "stopped"),
+		   stats.mrs_moved >> 20, stats.mrs_target >> 20, min_t(uint, pct, 100),
+		   stats.mrs_elapsed, stats.mrs_eta);
+}
+
+static void pmd_rebal_end(struct mpool_descriptor *mp, struct pmd_rebal_ctrl *prc)
+{
+	struct pmd_rebal_pass  *rp = prc->prc_pass;
+
+	if (!rp)
+		return;
+
+	spin_lock(&prc->prc_lock);
+	prc->prc_active = false;
+	prc->prc_end = ktime_get_ns();
+	prc->prc_pass = NULL;
+	spin_unlock(&prc->prc_lock);
+
+	pmd_rebal_log(mp, prc);
+
+	free_pages_exact(rp->rp_buf, PMD_TIER_IOSZ);
+	kfree(rp);
+}
+
+/**
+ * pmd_rebal() - move up to mp_rebalrate MiB of mblocks to the added drive
+ * @work:
+ *
+ * Candidates are picked by rounds of PMD_TIER_CANDMAX mblocks.  The
+ * rebalance ends once the target is reached, or when a round moved
+ * nothing, e.g., because the added drive is full.
+ */
+static void pmd_rebal(struct work_struct *work)
+{
+	struct pmd_rebal_ctrl      *prc;
+	struct pmd_rebal_pass      *rp;
+	struct mpool_descriptor    *mp;
+
+	u64     budget, total, moved, target, done;
+	bool    scanned = false, stop = false;
+	u16     slotvcnt;
+	u8      cslot;
+
+	prc = container_of(work, typeof(*prc), prc_dwork.work);
+	mp = prc->prc_mp;
+	rp = prc->prc_pass;
+
+	/* Nothing to do until all MDCs are loaded */
+	if (!completion_done(&mp->pds_mda.mdi_lazydone))
+		goto requeue;
+
+	budget = mp->pds_params.mp_rebalrate << 20;
+	target = prc->prc_target;
+	total = 0;
+
+	mutex_lock(&mp->pds_tier.ptc_movelock);
+
+	while (total < budget) {
+		done = READ_ONCE(prc->prc_moved);
+		if (done >= target) {
+			stop = true;
+			break;
+		}
+
+		if (rp->rp_next >= rp->rp_candc) {
+			if (scanned)
+				break;
+
+			if (rp->rp_candc && !rp->rp_rmoved) {
+				stop = true;
+				break;
+			}
+
+			rp->rp_candc = rp->rp_next = 0;
+			rp->rp_rmoved = 0;
+
+			slotvcnt = mp->pds_mda.mdi_slotvcnt;
+			for (cslot = 1; cslot < slotvcnt; cslot++)
+				pmd_rebal_scan(mp, rp, cslot);
+
+			sort(rp->rp_candv, rp->rp_candc, sizeof(rp->rp_candv[0]), pmd_tier_cmp, NULL);
+			scanned = true;
+
+			if (!rp->rp_candc) {
+				stop = true;
+				break;
+			}
+			continue;
+		}
+
+		pmd_tier_move(mp, rp->rp_iov, rp->rp_candv[rp->rp_next++].tc_objid, rp->rp_dst,
+			      NULL, &moved);
+
+		total += moved;
+		rp->rp_rmoved += moved;
+
+		spin_lock(&prc->prc_lock);
+		prc->prc_moved += moved;
+		spin_unlock(&prc->prc_lock);
+	}
+
+	mutex_unlock(&mp->pds_tier.ptc_movelock);
+
+	if (stop) {
+		pmd_rebal_end(mp, prc);
+		return;
+	}
+
+	pmd_rebal_log(mp, prc);
+
+requeue:
+	mpool_queue_dwork(mp, MPOOL_WQ_MOVE, &prc->prc_dwork, msecs_to_jiffies(PMD_REBAL_STEP_MS));
+}
+
+void pmd_rebal_start(struct mpool_descriptor *mp, u16 pdh)
+{
+	struct pmd_rebal_ctrl  *prc = &mp->pds_rebal;
+	struct pmd_rebal_pass  *rp;
+	u64                     target;
+	u8                      src, dst;
+
+	if (!mp->pds_params.mp_rebalrate)
+		return;
+
+	pmd_rebal_stop(mp);
+
+	dst = mp->pds_pdv[pdh].pdi_mclass;
+	src = (dst == MP_MED_STAGING) ? MP_MED_CAPACITY : MP_MED_STAGING;
+	if (mp->pds_mc[src].mc_pdmc < 0)
+		return;
+
+	target = pmd_rebal_target(mp, src, dst);
+	if (!target)
+		return;
+
+	rp = kzalloc(sizeof(*rp), GFP_KERNEL);
+	if (!rp)
+		return;
+
+	rp->rp_buf = pmd_tier_buf_alloc(rp->rp_iov);
+	if (!rp->rp_buf) {
+		kfree(rp);
+		return;
+	}
+
+	rp->rp_src = src;
+	rp->rp_dst = dst;
+
+	spin_lock(&prc->prc_lock);
+	prc->prc_pass = rp;
+	prc->prc_active = true;
+	prc->prc_pdh = pdh;
+	prc->prc_target = target;
+	prc->prc_moved = 0;
+	prc->prc_start = ktime_get_ns();
+	prc->prc_end = 0;
+	prc->prc_logpct = 0;
+	spin_unlock(&prc->prc_lock);
+
+	mp_pr_info("mpool %s, rebalancing %llu MiB of mblocks to pd %s at %llu MiB/s",
+		   mp->pds_name, target >> 20, mp->pds_pdv[pdh].pdi_name,
+		   (unsigned long long)mp->pds_params.mp_rebalrate);
+
+	mpool_queue_dwork(mp, MPOOL_WQ_MOVE, &prc->prc_dwork, 0);
+}
+
+void pmd_rebal_stop(struct mpool_descriptor *mp)
+{
+	cancel_delayed_work_sync(&mp->pds_rebal.prc_dwork);
+	pmd_rebal_end(mp, &mp->pds_rebal);
+}
+
+void pmd_rebal_stats_get(struct mpool_descriptor *mp, struct mpool_rebal_stats *stats)
+{
+	struct pmd_rebal_ctrl  *prc = &mp->pds_rebal;
+	u64                     start, end, left;
+
+	memset(stats, 0, sizeof(*stats));
+
+	spin_lock(&prc->prc_lock);
+	if (!prc->prc_start) {
+		spin_unlock(&prc->prc_lock);
+		return;
+	}
+
+	stats->mrs_active = prc->prc_active;
+	stats->mrs_target = prc->prc_target;
+	stats->mrs_moved = prc->prc_moved;
+	start = prc->prc_start;
+	end = prc->prc_end;
+	strlcpy(stats->mrs_pdname, mp->pds_pdv[prc->prc_pdh].pdi_name, sizeof(stats->mrs_pdname));
+	spin_unlock(&prc->prc_lock);
+
+	stats->mrs_elapsed = div_u64((end ?: ktime_get_ns()) - start, NSEC_PER_SEC);
+
+	left = stats->mrs_target > stats->mrs_moved ? stats->mrs_target - stats->mrs_moved : 0;
+	if (stats->mrs_active && left && stats->mrs_moved >> 20)
+		stats->mrs_eta = div64_u64((left >> 20) * stats->mrs_elapsed, stats->mrs_moved >> 20);
 }
 
 /*
@@ -3505,39 +6003,71 @@ void pmd_precompact_alsz(struct mpool_descriptor *mp, u64 objid, u64 len, u64 ca
 
 void pmd_mpool_usage(struct mpool_descriptor *mp, struct mpool_usage *usage)
 {
-	int    sidx;
-	u16    slotvcnt;
+	struct percpu_counter  *ctr = mp->pds_mda.mdi_usage;
 
 	/*
-	 * Get a local copy of MDC count (slotvcnt), and then drop the lock
-	 * It's okay another MDC is added concurrently, since pds_ds_info
-	 * is always stale by design
+	 * Read the approximate counter values without folding in the per-cpu
+	 * deltas; usage is always stale by design.
 	 */
-	spin_lock(&mp->pds_mda.mdi_slotvlock);
-	slotvcnt = mp->pds_mda.mdi_slotvcnt;
-	spin_unlock(&mp->pds_mda.mdi_slotvlock);
+	if (READ_ONCE(mp->pds_mda.mdi_slotvcnt) < 2)
+		return;
 
-	for (sidx = 1; sidx < slotvcnt; sidx++) {
-		struct pmd_mdc_stats   *pms;
-		struct pmd_mdc_info    *cinfo;
+	usage->mpu_mblock_alen += percpu_counter_read_positive(&ctr[PMD_USAGE_MBLOCK_ALEN]);
+	usage->mpu_mblock_wlen += percpu_counter_read_positive(&ctr[PMD_USAGE_MBLOCK_WLEN]);
+	usage->mpu_mlog_alen   += percpu_counter_read_positive(&ctr[PMD_USAGE_MLOG_ALEN]);
+	usage->mpu_mblock_cnt  += percpu_counter_read_positive(&ctr[PMD_USAGE_MBLOCK_CNT]);
+	usage->mpu_mlog_cnt    += percpu_counter_read_positive(&ctr[PMD_USAGE_MLOG_CNT]);
 
-		cinfo = &mp->pds_mda.mdi_slotv[sidx];
-		pms   = &cinfo->mmi_stats;
+	usage->mpu_alen = (usage->mpu_mblock_alen + usage->mpu_mlog_alen);
+	usage->mpu_wlen = (usage->mpu_mblock_wlen + usage->mpu_mlog_alen);
+}
+
+/**
+ * pmd_mdc_upgrade() - write an MDC's metadata with the latest format
+ * @mp:
+ * @cslot:
+ * @permitted: if not set, fail if the MDC needs to be upgraded
+ */
+static merr_t pmd_mdc_upgrade(struct mpool_descriptor *mp, u8 cslot, bool permitted)
+{
+	struct pmd_mdc_info *cinfo = &mp->pds_mda.mdi_slotv[cslot];
+
+	char   buf1[MAX_MDCVERSTR] __maybe_unused;
+	char   buf2[MAX_MDCVERSTR] __maybe_unused;
+	merr_t err;
+
+	/*
+	 * At that point the version on media should be smaller or
+	 * equal to the latest version supported by this binary.
+	 * If it is not the case, the activate fails earlier.
+	 */
+	if (omfu_mdcver_cmp(&cinfo->mmi_mdcver, "==", omfu_mdcver_cur()))
+		return 0;
+
+	omfu_mdcver_to_str(&cinfo->mmi_mdcver, buf1, sizeof(buf1));
+	omfu_mdcver_to_str(omfu_mdcver_cur(), buf2, sizeof(buf2));
 
-		mutex_lock(&cinfo->mmi_stats_lock);
-		usage->mpu_mblock_alen += pms->pms_mblock_alen;
-		usage->mpu_mblock_wlen += pms->pms_mblock_wlen;
-		usage->mpu_mlog_alen   += pms->pms_mlog_alen;
-		usage->mpu_mblock_cnt  += pms->pms_mblock_cnt;
-		usage->mpu_mlog_cnt    += pms->pms_mlog_cnt;
-		mutex_unlock(&cinfo->mmi_stats_lock);
+	if (!permitted) {
+		err = merr(EPERM);
+		mp_pr_err("mpool %s, MDC%u upgrade needed from version %s to %s",
+			  err, mp->pds_name, cslot, buf1, buf2);
+		return err;
 	}
 
-	if (slotvcnt < 2)
-		return;
+	mp_pr_info("mpool %s, MDC%u upgraded from version %s to %s",
+		   mp->pds_name, cslot, buf1, buf2);
 
-	usage->mpu_alen = (usage->mpu_mblock_alen + usage->mpu_mlog_alen);
-	usage->mpu_wlen = (usage->mpu_mblock_wlen + usage->mpu_mlog_alen);
+	pmd_mdc_lock(&cinfo->mmi_compactlock, cslot);
+	err = pmd_mdc_compact(mp, cslot);
+	pmd_mdc_unlock(&cinfo->mmi_compactlock);
+
+	if (ev(err)) {
+		mp_pr_err("mpool %s, failed to compact MDC %u post upgrade from %s to %s",
+			  err, mp->pds_name, cslot, buf1, buf2);
+		return err;
+	}
+
+	return 0;
 }
 
 static merr_t pmd_write_meta_to_latest_version(struct mpool_descriptor *mp, bool permitted)
@@ -3557,38 +6087,14 @@ static merr_t pmd_write_meta_to_latest_version(struct mpool_descriptor *mp, bool
 	for (cslot = 0; cslot < mp->pds_mda.mdi_slotvcnt; cslot++) {
 		cinfo = &mp->pds_mda.mdi_slotv[cslot];
 
-		/*
-		 * At that point the version on media should be smaller or
-		 * equal to the latest version supported by this binary.
-		 * If it is not the case, the activate fails earlier.
-		 */
 		if (omfu_mdcver_cmp(&cinfo->mmi_mdcver, "==", omfu_mdcver_cur()))
 			continue;
 
-		omfu_mdcver_to_str(&cinfo->mmi_mdcver, buf1, sizeof(buf1));
-		omfu_mdcver_to_str(omfu_mdcver_cur(), buf2, sizeof(buf2));
-
-		if (!permitted) {
-			err = merr(EPERM);
-			mp_pr_err("mpool %s, MDC%u upgrade needed from version %s to %s",
-				  err, mp->pds_name, cslot, buf1, buf2);
+		err = pmd_mdc_upgrade(mp, cslot, permitted);
+		if (err)
 			return err;
-		}
-
-		mp_pr_info("mpool %s, MDC%u upgraded from version %s to %s",
-			   mp->pds_name, cslot, buf1, buf2);
 
 		cinfo_converted = cinfo;
-
-		pmd_mdc_lock(&cinfo->mmi_compactlock, cslot);
-		err = pmd_mdc_compact(mp, cslot);
-		pmd_mdc_unlock(&cinfo->mmi_compactlock);
-
-		if (ev(err)) {
-			mp_pr_err("mpool %s, failed to compact MDC %u post upgrade from %s to %s",
-				  err, mp->pds_name, cslot, buf1, buf2);
-			return err;
-		}
 	}
 
 	if (cinfo_converted != NULL)
@@ -3603,11 +6109,22 @@ merr_t pmd_mdc_addrec_version(struct mpool_descriptor *mp, u8 cslot)
 {
 	struct omf_mdcrec_data  cdr;
 	struct omf_mdcver      *ver;
+	merr_t                  err;
 
 	cdr.omd_rtype = OMF_MDR_VERSION;
 
 	ver = omfu_mdcver_cur();
 	cdr.u.omd_version = *ver;
 
-	return pmd_mdc_addrec(mp, cslot, &cdr);
+	err = pmd_mdc_addrec(mp, cslot, &cdr);
+	if (err)
+		return err;
+
+	/*
+	 * The records that follow the version record must be packed in the
+	 * format of that version, e.g., an MDC being upgraded by compaction.
+	 */
+	mp->pds_mda.mdi_slotv[cslot].mmi_mdcver = *ver;
+
+	return 0;
 }
@@ -6,6 +6,10 @@
 #ifndef MPOOL_PMD_PRIV_H
 #define MPOOL_PMD_PRIV_H
 
+#include <linux/rhashtable.h>
+#include <linux/completion.h>
+#include <linux/percpu_counter.h>
+
 #include "mpcore_params.h"
 
 #include "mlog.h"
@@ -23,6 +27,10 @@
 enum obj_type_omf;
 struct mpool_descriptor;
 struct pmd_layout;
+struct pd_io_ctx;
+struct pmd_obj_load_work;
+struct mblock_wcbuf;
+struct mblock_zidx;
 
 /**
  * DOC: Object lifecycle
@@ -80,16 +88,30 @@ enum pmd_layout_state {
 	PMD_LYT_REMOVED    = 0x02,
 };
 
+/**
+ * enum pmd_mblock_flags - eld_flags of an mblock, persisted in its object record
+ *
+ * PMD_MB_ZIP: compressed mblock, see mblock_compress()
+ */
+enum pmd_mblock_flags {
+	PMD_MB_ZIP         = 0x01,
+};
+
 /**
  * struct pmd_layout_mlpriv - mlog private data for pmd_layout
+ * @mlp_rwlock:     implements pmd_obj_*lock() for this mlog
  * @mlp_uuid:       unique ID per mlog
  * @mlp_lstat:      mlog status
- * @mlp_nodeoml:    "open mlog" rbtree linkage
+ * @mlp_nodeoml:    "open mlog" hash table linkage
+ * @mlp_eraseq:     queued by mlog_erase_async() or in the spare pool,
+ *                  protected by pds_mlspares.msp_lock
  */
 struct pmd_layout_mlpriv {
+	struct rw_semaphore mlp_rwlock;
 	struct mpool_uuid   mlp_uuid;
-	struct rb_node      mlp_nodeoml;
+	struct rhash_head   mlp_nodeoml;
 	struct mlog_stat    mlp_lstat;
+	bool                mlp_eraseq;
 };
 
 /**
@@ -114,35 +136,57 @@ union pmd_layout_priv {
  *   compactlock for object's mdc; to read hold pmd_obj_*lock()
  *   See the comments associated with struct pmd_mdc_info for
  *   further details.
+ * + layouts are freed after an RCU grace period so that committed object
+ *   lookups via mdi_co_htab need not hold mmi_co_lock
+ * + pmd_obj_*lock() of an mlog uses the rwsem in its private data, mblocks
+ *   share a pool of rwsems hashed by objid (see pmd_obj_lockp()).  Hence a
+ *   thread may hold at most one mblock layout lock at a time.
+ *
+ * Mblock layouts are the bulk of the kernel memory used by a large mpool,
+ * so they carry neither a lock nor cache line alignment: on 64-bit kernels
+ * without lock debugging an mblock layout takes 88 bytes rather than 192
+ * bytes, which saves about 99 MiB per million mblocks.
  *
  * @eld_nodemdc: rbtree node for uncommitted and committed objects
+ * @eld_rcu:     RCU head used to free the layout, shares eld_nodemdc
+ * @eld_hnode:   mdi_co_htab linkage for committed objects
  * @eld_objid:   object ID associated with layout
- * @eld_mblen:   Amount of data written in the mblock in bytes (0 for mlogs)
- * @eld_state:   enum pmd_layout_state
- * @eld_flags:   enum mlog_open_flags for mlogs
  * @eld_gen:     object generation
  * @eld_ld:
+ * @eld_mblen:   Amount of data written in the mblock in bytes (0 for mlogs)
  * @eld_ref:     user ref count from alloc/get/put
- * @eld_rwlock:  implements pmd_obj_*lock() for this layout
+ * @eld_state:   enum pmd_layout_state
+ * @eld_flags:   enum mlog_open_flags for mlogs, enum pmd_mblock_flags for mblocks
+ * @eld_heat:    mblock reads, halved by every tiering pass (see pmd_obj_heat())
+ * @eld_zlen:    uncompressed length of a compressed mblock, eld_mblen is then
+ *               the length of the data on media
+ * @eld_wcbuf:   write-combining buffer for uncommitted mblocks, may be NULL
+ * @eld_zidx:    chunk index of a committed compressed mblock, loaded on the
+ *               first read, may be NULL
  * @dle_mlpriv:  mlog private data
  *
  * eld_priv[] contains exactly one element if the object type
  * is and mlog, otherwise it contains exactly zero element.
  */
 struct pmd_layout {
-	struct rb_node                  eld_nodemdc;
+	union {
+		struct rb_node          eld_nodemdc;
+		struct rcu_head         eld_rcu;
+	};
+	struct rhash_head               eld_hnode;
 	u64                             eld_objid;
-	u32                             eld_mblen;
-	u8                              eld_state;
-	u8                              eld_flags;
 	u64                             eld_gen;
 	struct omf_layout_descriptor    eld_ld;
-
-	/* The above fields are read-mostly, while the
-	 * following two fields mutate frequently.
-	 */
+	u32                             eld_mblen;
 	struct kref                     eld_ref;
-	struct rw_semaphore             eld_rwlock;
+	u8                              eld_state;
+	u8                              eld_flags;
+	u16                             eld_heat;
+	u32                             eld_zlen;
+	union {
+		struct mblock_wcbuf    *eld_wcbuf;
+		struct mblock_zidx     *eld_zidx;
+	};
 
 	union pmd_layout_priv           eld_priv[];
 };
@@ -285,49 +329,85 @@ struct mdc_credit_set {
 	struct mdc_csm_info   csm[MPOOL_MDC_SET_SZ];
 };
 
+/*
+ * enum pmd_usage - per-mpool object space usage counters
+ * @PMD_USAGE_MBLOCK_ALEN: mblock alloc len
+ * @PMD_USAGE_MBLOCK_WLEN: mblock write len
+ * @PMD_USAGE_MLOG_ALEN:   mlog alloc len
+ * @PMD_USAGE_MBLOCK_CNT:  mblock count
+ * @PMD_USAGE_MLOG_CNT:    mlog count
+ *
+ * Objects in MDC0 (i.e., the MDCN mlogs) are not accounted.
+ */
+enum pmd_usage {
+	PMD_USAGE_MBLOCK_ALEN,
+	PMD_USAGE_MBLOCK_WLEN,
+	PMD_USAGE_MLOG_ALEN,
+	PMD_USAGE_MBLOCK_CNT,
+	PMD_USAGE_MLOG_CNT,
+	PMD_USAGE_MAX,
+};
+
+/*
+ * PMD_USAGE_BATCH_LEN: per-cpu delta folded into a byte usage counter
+ * PMD_USAGE_BATCH_CNT: per-cpu delta folded into an object count counter
+ *
+ * A usage query is stale by at most the batch size times the number of
+ * online cpus.
+ */
+#define PMD_USAGE_BATCH_LEN     (64ul << 20)
+#define PMD_USAGE_BATCH_CNT     64
+
 /**
- * struct pmd_mdc_stats - per MDC space usage stats
- * @pms_mblock_alen: mblock alloc len
- * @pms_mblock_wlen: mblock write len
- * @pms_mlog_alen: mlog alloc len
- * @pms_mblock_cnt: mblock count
- * @pms_mlog_cnt: mlog count
+ * struct pmd_gc_waiter - group commit waiter
+ * @gcw_entry:  mmi_gcwq linkage
+ * @gcw_err:    result of the flush that made the waiter's record durable
+ * @gcw_done:   set once the waiter's record has been flushed
+ * @gcw_queued: set once the waiter's record has been appended
  */
-struct pmd_mdc_stats {
-	u64    pms_mblock_alen;
-	u64    pms_mblock_wlen;
-	u64    pms_mlog_alen;
-	u32    pms_mblock_cnt;
-	u32    pms_mlog_cnt;
+struct pmd_gc_waiter {
+	struct list_head    gcw_entry;
+	merr_t              gcw_err;
+	bool                gcw_done;
+	bool                gcw_queued;
 };
 
 /**
  * struct pmd_mdc_info - Metadata container (mdc) info.
  * @mmi_compactlock: compaction lock
+ * @mmi_gclock:      group commit lock, held by the thread flushing the mdc
+ * @mmi_gcwq:        waiters whose records are appended but not yet flushed
  * @mmi_uc_lock:     uncommitted objects tree lock
  * @mmi_uc_root:     uncommitted objects tree root
  * @mmi_co_lock:     committed objects tree lock
  * @mmi_co_root:     committed objects tree root
- * @mmi_uqlock:      uniquifier lock
+ * @mmi_co_htab:     points to the mpool's mdi_co_htab
+ * @mmi_uqlock:      uniquifier lock, serializes objid checkpoints
  * @mmi_luniq:       uniquifier of last object assigned to container
+ * @mmi_ckptwork:    writes the next objid checkpoint ahead of need
+ * @mmi_mp:          mpool descriptor, for mmi_ckptwork
  * @mmi_mdc:         MDC implementing container
  * @mmi_recbuf:      buffer for (un)packing log records
  * @mmi_lckpt:       last objid checkpointed
- * @mmi_stats:       per-MDC usage stats
- * @mmi_stats_lock:  lock for protecting mmi_stats
  * @mmi_pco_cnt:     counters used by the pre compaction of MDC1/255.
  * @mmi_mdcver:      version of the mdc content on media when the mpool was
  *                   activated. That may not be the current version on media
  *                   if a MDC metadata conversion took place during activate.
  * @mmi_credit       MDC credit info
+ * @mmi_pcoactive:   set while the pre-compaction scheduler owns the MDC,
+ *                   which excludes it from object allocation
+ * @mmi_loadstate:   enum pmd_mdc_loadstate, see pmd_mdc_load()
+ * @mmi_loaderr:     result of loading the MDC, valid once mmi_loaded completes
+ * @mmi_loaded:      completed once the MDC is loaded (or failed to load)
  *
  * LOCKING:
- * + mmi_luniq: protected by uqlock
- * + mmi_mdc, recbuf, lckpt: protected by compactlock
+ * + mmi_luniq: atomic; for mdc0 updated under uqlock
+ * + mmi_mdc, recbuf, lckpt, gcwq: protected by compactlock
  * + mmi_co_root: protected by co_lock
  * + mmi_uc_root: protected by uc_lock
- * + mmi_stats: protected by mmi_stats_lock
  * + mmi_pco_counters: updates serialized by mmi_compactlock
+ * + mmi_loaderr: written once by the thread that claimed the load, before
+ *   mmi_loaded is completed
  *
  * NOTE:
  *  + for mdc0 mmi_luniq is the slot # of the last mdc created
@@ -352,6 +432,10 @@ struct pmd_mdc_info {
 	char                   *mmi_recbuf;
 	u64                     mmi_lckpt;
 	struct mp_mdc          *mmi_mdc;
+	struct list_head        mmi_gcwq;
+
+	____cacheline_aligned
+	struct mutex            mmi_gclock;
 
 	____cacheline_aligned
 	struct mutex            mmi_uc_lock;
@@ -360,20 +444,42 @@ struct pmd_mdc_info {
 	____cacheline_aligned
 	struct rw_semaphore     mmi_co_lock;
 	struct rb_root          mmi_co_root;
+	struct rhashtable      *mmi_co_htab;
 
 	____cacheline_aligned
+	atomic64_t              mmi_luniq;
 	struct mutex            mmi_uqlock;
-	u64                     mmi_luniq;
+	struct work_struct      mmi_ckptwork;
+	struct mpool_descriptor *mmi_mp;
 
 	____cacheline_aligned
 	struct credit_info      mmi_credit;
 	struct omf_mdcver       mmi_mdcver;
+	atomic_t                mmi_pcoactive;
 
 	____cacheline_aligned
-	struct mutex            mmi_stats_lock;
-	struct pmd_mdc_stats    mmi_stats;
-
 	struct pre_compact_ctrs mmi_pco_cnt;
+
+	____cacheline_aligned
+	atomic_t                mmi_loadstate;
+	merr_t                  mmi_loaderr;
+	struct completion       mmi_loaded;
+};
+
+/**
+ * enum pmd_mdc_loadstate - load state of an MDC's object layouts
+ * @PMD_MDC_UNLOADED: not loaded yet, first to claim it loads it
+ * @PMD_MDC_LOADING:  being loaded, wait on mmi_loaded
+ * @PMD_MDC_LOADED:   loaded, mmi_loaderr holds the outcome
+ *
+ * All MDCs are loaded at activation unless MP_FLAGS_LAZY_LOAD was given, in
+ * which case MDC 1~N start out unloaded and are loaded in the background or
+ * on first access, whichever comes first.
+ */
+enum pmd_mdc_loadstate {
+	PMD_MDC_UNLOADED,
+	PMD_MDC_LOADING,
+	PMD_MDC_LOADED,
 };
 
 /**
@@ -400,9 +506,21 @@ struct pmd_mdc_selector {
  * @mdi_slotvcnt:    number of active slotv entries
  * @mdi_slotv:       per mdc info
  * @mdi_sel:         MDC allocation selector
+ * @mdi_co_htab:     objid hash index of the committed objects of all mdcs
+ * @mdi_usage:       object space usage, indexed by enum pmd_usage
+ * @mdi_lazyv:       background load jobs, NULL unless lazily loading
+ * @mdi_lazyend:     one past the last MDC to load lazily
+ * @mdi_lazystop:    set to make the background load jobs exit early
+ * @mdi_lazyprog:    next MDC for the background load jobs to claim
+ * @mdi_lazycnt:     number of lazily loaded MDCs not yet loaded
+ * @mdi_lazyerr:     first error encountered loading an MDC lazily
+ * @mdi_lazydone:    completed once mdi_lazycnt drops to zero
  *
  * LOCKING:
  *  + mdi_slotvcnt: protected by mdi_slotvlock
+ *  + mdi_co_htab: updated along with mmi_co_root under mmi_co_lock,
+ *    looked up under rcu_read_lock()
+ *  + mdi_usage: per-cpu counters, updated and read without locking
  *
  * NOTE:
  *  + mdi_slotvcnt only ever increases so mdi_slotv[x], x < mdi_slotvcnt, is
@@ -416,20 +534,37 @@ struct pmd_mda_info {
 
 	struct pmd_mdc_info     mdi_slotv[MDC_SLOTS];
 	struct pmd_mdc_selector mdi_sel;
+	struct rhashtable       mdi_co_htab;
+	struct percpu_counter   mdi_usage[PMD_USAGE_MAX];
+
+	struct pmd_obj_load_work   *mdi_lazyv;
+	u16                     mdi_lazyend;
+	bool                    mdi_lazystop;
+	atomic_t                mdi_lazyprog;
+	atomic_t                mdi_lazycnt;
+	atomic64_t              mdi_lazyerr;
+	struct completion       mdi_lazydone;
 };
 
+/*
+ * PMD_ERASE_BATCH_MAX:   max layouts erased per run of the erase pipeline
+ * PMD_ERASE_DISCARD_MAX: max bytes erased by a single merged discard
+ * PMD_ERASE_PERIOD_MS:   period over which mp_eraserate is enforced
+ */
+#define PMD_ERASE_BATCH_MAX     256
+#define PMD_ERASE_DISCARD_MAX   (1ul << 30)
+#define PMD_ERASE_PERIOD_MS     100
+
 /**
- * struct pmd_obj_erase_work - workqueue job struct for object erase and free
+ * struct pmd_obj_erase_work - erase pipeline entry for object erase and free
  * @oef_mp:             mpool
  * @oef_layout:         object layout
- * @oef_cache:          kmem cache to free work (or NULL)
- * @oef_wqstruct:	workq struct
+ * @oef_entry:          pds_erase.pec_list linkage
  */
 struct pmd_obj_erase_work {
 	struct mpool_descriptor    *oef_mp;
 	struct pmd_layout          *oef_layout;
-	struct kmem_cache          *oef_cache;
-	struct work_struct          oef_wqstruct;
+	struct list_head            oef_entry;
 };
 
 /**
@@ -448,6 +583,35 @@ struct pmd_obj_load_work {
 	atomic64_t                 *olw_err;
 };
 
+/**
+ * struct pmd_pco_cand - MDC ranked by the pre-compaction scheduler
+ * @pc_live: In bytes, estimated live records in the active mlog
+ * @pc_rank: garbage % times fill % of the active mlog
+ * @pc_slot: MDC slot number
+ */
+struct pmd_pco_cand {
+	u64     pc_live;
+	u32     pc_rank;
+	u8      pc_slot;
+};
+
+/**
+ * struct pmd_pco_work - work struct for compacting MDC 1~N in parallel
+ * @pcw_work:     work struct
+ * @pcw_mp:
+ * @pcw_progress: index of the next entry of pcw_slotv to compact, shared
+ *                by all the jobs of a pre-compaction run
+ * @pcw_slotv:    MDC slots to compact, in decreasing order of priority
+ * @pcw_slotc:    number of entries in pcw_slotv
+ */
+struct pmd_pco_work {
+	struct work_struct          pcw_work;
+	struct mpool_descriptor    *pcw_mp;
+	atomic_t                   *pcw_progress;
+	const u8                   *pcw_slotv;
+	u16                         pcw_slotc;
+};
+
 /*
  * objid uniquifier checkpoint interval; used to avoid reissuing an outstanding
  * objid after a crash; supports pmd_{mblock|mlog}_realloc()
@@ -534,6 +698,8 @@ void pmd_mdc_unlock(struct mutex *lock);
  *
  * Load all metadata for mpool mp; create flag indicates if is a new pool;
  * caller must ensure no other thread accesses mp until activation is complete.
+ * With MP_FLAGS_LAZY_LOAD only MDC0 is loaded before returning, MDC 1~N are
+ * loaded by jobs queued on the MPOOL_WQ_LOAD workqueue.
  * note: pmd module owns mdc01/2 memory mgmt whether succeeds or fails
  *
  * Return: %0 if successful, merr_t otherwise
@@ -555,6 +721,37 @@ pmd_mpool_activate(
  */
 void pmd_mpool_deactivate(struct mpool_descriptor *mp);
 
+/**
+ * pmd_mdc_flushall() - Flush the append buffers of all MDCs
+ * @mp:
+ *
+ * Used on deactivation, once nothing else appends to the MDCs but the
+ * objid checkpoint work, which is cancelled first.
+ */
+void pmd_mdc_flushall(struct mpool_descriptor *mp);
+
+/**
+ * pmd_mpool_load_stop() - stop loading MDCs in the background
+ * @mp:
+ *
+ * Makes the background load jobs started by a lazy activation exit once
+ * done with the MDC they are loading. The jobs are drained by destroying
+ * the mpool workqueues, which must happen before pmd_mpool_deactivate().
+ */
+void pmd_mpool_load_stop(struct mpool_descriptor *mp);
+
+/**
+ * pmd_mdc_load_all() - wait for all MDCs to be loaded
+ * @mp:
+ *
+ * Anything allocating space must wait for all MDCs to be loaded, as the
+ * space map is incomplete until then. Rather than just waiting, help the
+ * background jobs by loading the MDCs they haven't got to yet.
+ *
+ * Return: the first error encountered loading an MDC, if any.
+ */
+merr_t pmd_mdc_load_all(struct mpool_descriptor *mp);
+
 /**
  * pmd_obj_alloc() - Allocate an object.
  * @mp:
@@ -619,6 +816,27 @@ pmd_obj_realloc(
  */
 merr_t pmd_obj_commit(struct mpool_descriptor *mp, struct pmd_layout *layout);
 
+/**
+ * pmd_obj_commitv() - Commit a batch of objects.
+ * @mp:
+ * @layoutv: objects to commit
+ * @layoutc: number of elements in layoutv[] and errv[]
+ * @errv:    (in/out) per-object status
+ *
+ * Same as pmd_obj_commit() for each object, except that all the create
+ * records are logged before waiting for any of them to become durable so
+ * that they are flushed by as few MDC group commits as possible.  Objects
+ * whose errv[] element is non-zero on entry are skipped.
+ *
+ * Return: %0 if the batch was processed, merr_t otherwise
+ */
+merr_t
+pmd_obj_commitv(
+	struct mpool_descriptor    *mp,
+	struct pmd_layout         **layoutv,
+	int                         layoutc,
+	merr_t                     *errv);
+
 /**
  * pmd_obj_abort() - Discard un-committed object.
  * @mp:
@@ -643,6 +861,25 @@ merr_t pmd_obj_abort(struct mpool_descriptor *mp, struct pmd_layout *layout);
  */
 merr_t pmd_obj_delete(struct mpool_descriptor *mp, struct pmd_layout *layout);
 
+/**
+ * pmd_obj_deletev() - Delete a batch of committed objects.
+ * @mp:
+ * @layoutv: objects to delete
+ * @layoutc: number of elements in layoutv[] and errv[]
+ * @errv:    (in/out) per-object status
+ *
+ * Batched pmd_obj_delete(), see pmd_obj_commitv().  Each layout whose
+ * errv[] element is zero on return is invalid.
+ *
+ * Return: %0 if the batch was processed, merr_t otherwise
+ */
+merr_t
+pmd_obj_deletev(
+	struct mpool_descriptor    *mp,
+	struct pmd_layout         **layoutv,
+	int                         layoutc,
+	merr_t                     *errv);
+
 /**
  * pmd_obj_erase() -
  * @mp:
@@ -670,6 +907,28 @@ merr_t pmd_obj_erase(struct mpool_descriptor *mp, struct pmd_layout *layout, u64
  */
 struct pmd_layout *pmd_obj_find_get(struct mpool_descriptor *mp, u64 objid, int which);
 
+/**
+ * pmd_obj_find_getv() - Get references for the layouts of committed objects.
+ * @mp:
+ * @objidv:  object IDs
+ * @objidc:  number of object IDs
+ * @layoutv: output, one layout per object ID
+ *
+ * Bulk version of pmd_obj_find_get(mp, objid, 1). All the objects are
+ * looked up in few RCU read-side sections, each MDC is waited for at most
+ * once, and the objects missing from the hash index are searched for
+ * taking each MDC's committed tree lock once, whatever the order of @objidv.
+ *
+ * Return: %0 if all the objects are found, else ENOENT and no reference is
+ * held
+ */
+merr_t
+pmd_obj_find_getv(
+	struct mpool_descriptor    *mp,
+	const u64                  *objidv,
+	u32                         objidc,
+	struct pmd_layout         **layoutv);
+
 /**
  * pmd_obj_put() - Put a reference for a layout for objid.
  * @mp:
@@ -681,6 +940,11 @@ struct pmd_layout *pmd_obj_find_get(struct mpool_descriptor *mp, u64 objid, int
  */
 void pmd_obj_put(struct mpool_descriptor *mp, struct pmd_layout *layout);
 
+/**
+ * pmd_obj_locks_init() - Initialize the mblock layout lock pool
+ */
+void pmd_obj_locks_init(void);
+
 /**
  * pmd_obj_rdlock() - Read-lock object layout with appropriate nesting level.
  * @layout:
@@ -789,6 +1053,14 @@ pmd_prop_mcspare(
 merr_t
 pmd_prop_mpconfig(struct mpool_descriptor *mp, const struct mpool_config *cfg, bool compacting);
 
+/**
+ * pmd_erase_init() - initialize the object erase pipeline
+ * @mp:
+ *
+ * Pending erases are drained by destroying the MPOOL_WQ_ERASE workqueue.
+ */
+void pmd_erase_init(struct mpool_descriptor *mp);
+
 /**
  * pmd_precompact_start() - start MDC1/255 precompaction
  * @mp:
@@ -801,6 +1073,81 @@ void pmd_precompact_start(struct mpool_descriptor *mp);
  */
 void pmd_precompact_stop(struct mpool_descriptor *mp);
 
+/**
+ * pmd_tier_start() - start moving mblocks between media classes by heat
+ * @mp:
+ *
+ * Does nothing unless mp_tierperiod is set.
+ */
+void pmd_tier_start(struct mpool_descriptor *mp);
+
+/**
+ * pmd_tier_stop() - stop mblock tiering
+ * @mp:
+ */
+void pmd_tier_stop(struct mpool_descriptor *mp);
+
+/**
+ * pmd_defrag_start() - start relocating mblocks out of fragmented drive rgns
+ * @mp:
+ *
+ * Does nothing unless mp_defragperiod is set.
+ */
+void pmd_defrag_start(struct mpool_descriptor *mp);
+
+/**
+ * pmd_defrag_stop() - stop free space defragmentation
+ * @mp:
+ */
+void pmd_defrag_stop(struct mpool_descriptor *mp);
+
+/**
+ * pmd_rebal_start() - start moving mblocks to a newly added drive
+ * @mp:
+ * @pdh: drive added
+ *
+ * Does nothing unless mp_rebalrate is set.  A rebalance already running
+ * is stopped and replaced.
+ */
+void pmd_rebal_start(struct mpool_descriptor *mp, u16 pdh);
+
+/**
+ * pmd_rebal_stop() - stop the running mblock rebalance, if any
+ * @mp:
+ */
+void pmd_rebal_stop(struct mpool_descriptor *mp);
+
+/**
+ * pmd_rebal_stats_get() - Get the progress of the last mblock rebalance
+ * @mp:
+ * @stats: (output)
+ */
+void pmd_rebal_stats_get(struct mpool_descriptor *mp, struct mpool_rebal_stats *stats);
+
+/**
+ * pmd_obj_heat() - Account a read of a committed mblock for tiering
+ * @layout:
+ *
+ * Racy updates may lose a count now and then, which is fine for a heat.
+ */
+static inline void pmd_obj_heat(struct pmd_layout *layout)
+{
+	u16 heat = READ_ONCE(layout->eld_heat);
+
+	if (heat < U16_MAX)
+		WRITE_ONCE(layout->eld_heat, heat + 1);
+}
+
+/**
+ * pmd_layout_zip() - Is this the layout of a compressed mblock
+ * @layout:
+ */
+static inline bool pmd_layout_zip(const struct pmd_layout *layout)
+{
+	return (layout->eld_flags & PMD_MB_ZIP) &&
+		pmd_objid_type(layout->eld_objid) == OMF_OBJ_MBLOCK;
+}
+
 /*
  * pmd_precompact_alsz() - Inform MDC1/255 pre-compacting about the active
  *	mlog of an mpool MDCi 0<i<=255.
@@ -869,6 +1216,33 @@ pmd_layout_rw(
 	int                         flags,
 	u8                          rw);
 
+/**
+ * pmd_layout_rw_async() - asynchronous variant of pmd_layout_rw()
+ * @mp:
+ * @layout:
+ * @iov:
+ * @iovcnt:
+ * @boff:
+ * @flags:
+ * @rw:
+ * @ctx:    pd I/O completion context
+ *
+ * ctx->pic_done() is called if and only if this function returns 0.
+ * Mblock reads must be issued under pmd_obj_rdlock(), which may be
+ * released on return, so that tiering can tell when they are done with
+ * the zones the mblock moved away from.
+ */
+merr_t
+pmd_layout_rw_async(
+	struct mpool_descriptor    *mp,
+	struct pmd_layout          *layout,
+	const struct kvec          *iov,
+	int                         iovcnt,
+	u64                         boff,
+	int                         flags,
+	u8                          rw,
+	struct pd_io_ctx           *ctx);
+
 merr_t pmd_layout_erase(struct mpool_descriptor *mp, struct pmd_layout *layout);
 
 u64 pmd_layout_cap_get(struct mpool_descriptor *mp, struct pmd_layout *layout);
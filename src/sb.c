@@ -47,6 +47,7 @@ static bool sb_prop_valid(struct mpool_dev_info *pd)
 
 	if ((pd_prop->pdp_devtype != PD_DEV_TYPE_BLOCK_STD) &&
 	    (pd_prop->pdp_devtype != PD_DEV_TYPE_BLOCK_NVDIMM) &&
+	    (pd_prop->pdp_devtype != PD_DEV_TYPE_ZONE) &&
 	    (pd_prop->pdp_devtype != PD_DEV_TYPE_FILE)) {
 		merr_t err = merr(EINVAL);
 
@@ -150,7 +151,7 @@ static merr_t sb_read_sbx(struct mpool_dev_info *pd, char *inbuf, u32 idx)
 
 	woff = sb_idx2woff(pd, idx);
 
-	err = pd_zone_preadv(pd, &iov, 1, 0, woff);
+	err = pd_zone_preadv(pd, &iov, 1, 0, woff, PD_IOC_META);
 	/* Reset rval as per api */
 	if (err >= 0)
 		err = 0;
@@ -201,7 +202,7 @@ int sb_magic_check(struct mpool_dev_info *pd)
 
 		memset(inbuf, 0, SB_AREA_SZ);
 
-		err = pd_zone_preadv(pd, &iov, 1, 0, woff);
+		err = pd_zone_preadv(pd, &iov, 1, 0, woff, PD_IOC_META);
 		if (err) {
 			rval = merr_errno(err);
 			mp_pr_err("sb(%s, %d) magic: read failed, woff %lu",
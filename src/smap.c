@@ -10,10 +10,17 @@
 
 #include <linux/log2.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+#include <linux/rbtree_augmented.h>
 
 #include "mpool_defs.h"
+#include "mpool_trace.h"
 
 static merr_t smap_drive_sballoc(struct mpool_descriptor *mp, u16 pdh);
+static merr_t smap_drive_zbadalloc(struct mpool_descriptor *mp, u16 pdh);
+static u32 smap_addr2rgn(struct mpool_descriptor *mp, struct mpool_dev_info *pd, u64 zoneaddr);
+static merr_t smap_free_byrgn(struct mpool_dev_info *pd, u32 rgn, u64 zoneaddr, u32 zonecnt, bool acct);
 
 /*
  * smap API functions
@@ -38,31 +45,151 @@ static struct smap_zone *smap_zone_find(struct rb_root *root, u64 key)
 	return NULL;
 }
 
+/*
+ * The rgn space maps are keyed by zone address and augmented with the
+ * largest extent length in each subtree (smz_maxlen), which lets
+ * smap_rmap_alloc() find the first fit in O(log n) regardless of how
+ * fragmented the map is.
+ */
+static inline u64 smap_zone_maxlen(struct rb_node *node)
+{
+	return node ? rb_entry(node, struct smap_zone, smz_node)->smz_maxlen : 0;
+}
+
+static u64 smap_zone_compute(struct smap_zone *zone)
+{
+	u64 maxlen = zone->smz_value;
+
+	maxlen = max(maxlen, smap_zone_maxlen(zone->smz_node.rb_left));
+	maxlen = max(maxlen, smap_zone_maxlen(zone->smz_node.rb_right));
+
+	return maxlen;
+}
+
+static void smap_zone_propagate(struct rb_node *node, struct rb_node *stop)
+{
+	while (node != stop) {
+		struct smap_zone *zone = rb_entry(node, struct smap_zone, smz_node);
+		u64               maxlen = smap_zone_compute(zone);
+
+		if (zone->smz_maxlen == maxlen)
+			break;
+
+		zone->smz_maxlen = maxlen;
+		node = rb_parent(&zone->smz_node);
+	}
+}
+
+static void smap_zone_copy(struct rb_node *rb_old, struct rb_node *rb_new)
+{
+	struct smap_zone *old = rb_entry(rb_old, struct smap_zone, smz_node);
+	struct smap_zone *new = rb_entry(rb_new, struct smap_zone, smz_node);
+
+	new->smz_maxlen = old->smz_maxlen;
+}
+
+static void smap_zone_rotate(struct rb_node *rb_old, struct rb_node *rb_new)
+{
+	struct smap_zone *old = rb_entry(rb_old, struct smap_zone, smz_node);
+	struct smap_zone *new = rb_entry(rb_new, struct smap_zone, smz_node);
+
+	new->smz_maxlen = old->smz_maxlen;
+	old->smz_maxlen = smap_zone_compute(old);
+}
+
+static const struct rb_augment_callbacks smap_zone_augment = {
+	.propagate = smap_zone_propagate,
+	.copy      = smap_zone_copy,
+	.rotate    = smap_zone_rotate,
+};
+
 static int smap_zone_insert(struct rb_root *root, struct smap_zone *item)
 {
 	struct rb_node **pos = &root->rb_node, *parent = NULL;
 	struct smap_zone *this;
 
-	/* Figure out where to put new node */
+	/* Figure out where to put new node, updating smz_maxlen on the way down */
 	while (*pos) {
 		this = rb_entry(*pos, typeof(*this), smz_node);
 		parent = *pos;
 
-		if (item->smz_key < this->smz_key)
+		if (item->smz_key < this->smz_key) {
 			pos = &(*pos)->rb_left;
-		else if (item->smz_key > this->smz_key)
+		} else if (item->smz_key > this->smz_key) {
 			pos = &(*pos)->rb_right;
-		else
+		} else {
+			/* Undo the smz_maxlen updates made on the way down */
+			for (parent = rb_parent(parent); parent; parent = rb_parent(parent)) {
+				this = rb_entry(parent, typeof(*this), smz_node);
+				this->smz_maxlen = smap_zone_compute(this);
+			}
 			return false;
+		}
+
+		if (this->smz_maxlen < item->smz_value)
+			this->smz_maxlen = item->smz_value;
 	}
 
 	/* Add new node and rebalance tree. */
+	item->smz_maxlen = item->smz_value;
 	rb_link_node(&item->smz_node, parent, pos);
-	rb_insert_color(&item->smz_node, root);
+	rb_insert_augmented(&item->smz_node, root, &smap_zone_augment);
 
 	return true;
 }
 
+static void smap_zone_erase(struct rb_root *root, struct smap_zone *item)
+{
+	rb_erase_augmented(&item->smz_node, root, &smap_zone_augment);
+}
+
+/*
+ * Return the lowest addressed zone in the subtree rooted at node whose
+ * length is at least minlen, or NULL if there is none.
+ */
+static struct smap_zone *smap_zone_first_fit(struct rb_node *node, u64 minlen)
+{
+	while (node && smap_zone_maxlen(node) >= minlen) {
+		struct smap_zone *zone = rb_entry(node, struct smap_zone, smz_node);
+
+		if (smap_zone_maxlen(node->rb_left) >= minlen)
+			node = node->rb_left;
+		else if (zone->smz_value >= minlen)
+			return zone;
+		else
+			node = node->rb_right;
+	}
+
+	return NULL;
+}
+
+/*
+ * Return the next zone in address order after zone whose length is at
+ * least minlen, or NULL if there is none.
+ */
+static struct smap_zone *smap_zone_next_fit(struct smap_zone *zone, u64 minlen)
+{
+	struct rb_node *node = &zone->smz_node;
+	struct rb_node *parent;
+
+	if (smap_zone_maxlen(node->rb_right) >= minlen)
+		return smap_zone_first_fit(node->rb_right, minlen);
+
+	while ((parent = rb_parent(node))) {
+		if (node == parent->rb_left) {
+			zone = rb_entry(parent, struct smap_zone, smz_node);
+			if (zone->smz_value >= minlen)
+				return zone;
+
+			if (smap_zone_maxlen(parent->rb_right) >= minlen)
+				return smap_zone_first_fit(parent->rb_right, minlen);
+		}
+		node = parent;
+	}
+
+	return NULL;
+}
+
 /**
  * See smap.h.
  */
@@ -161,21 +288,26 @@ merr_t smap_drive_spares(struct mpool_descriptor *mp, enum mp_media_classp mclas
 
 /*
  * Compute zone stats for drive pd per comments in smap_dev_alloc.
+ *
+ * Called without sda_dalock; each counter is read once so the result is
+ * self-consistent even if it races with an alloc or free.
  */
 static void smap_calc_znstats(struct mpool_dev_info *pd, struct smap_dev_znstats *zones)
 {
-	zones->sdv_total = pd->pdi_parm.dpr_zonetot;
-	zones->sdv_avail = pd->pdi_ds.sda_zoneeff;
-	zones->sdv_usable = pd->pdi_ds.sda_utgt;
+	u32 utgt, uact, stgt, sact;
 
-	if (pd->pdi_ds.sda_utgt > pd->pdi_ds.sda_uact)
-		zones->sdv_fusable = pd->pdi_ds.sda_utgt - pd->pdi_ds.sda_uact;
-	else
-		zones->sdv_fusable = 0;
+	utgt = READ_ONCE(pd->pdi_ds.sda_utgt);
+	uact = READ_ONCE(pd->pdi_ds.sda_uact);
+	stgt = READ_ONCE(pd->pdi_ds.sda_stgt);
+	sact = READ_ONCE(pd->pdi_ds.sda_sact);
 
-	zones->sdv_spare = pd->pdi_ds.sda_stgt;
-	zones->sdv_fspare = pd->pdi_ds.sda_stgt - pd->pdi_ds.sda_sact;
-	zones->sdv_used = pd->pdi_ds.sda_uact;
+	zones->sdv_total = pd->pdi_parm.dpr_zonetot;
+	zones->sdv_avail = READ_ONCE(pd->pdi_ds.sda_zoneeff);
+	zones->sdv_usable = utgt;
+	zones->sdv_fusable = (utgt > uact) ? utgt - uact : 0;
+	zones->sdv_spare = stgt;
+	zones->sdv_fspare = (stgt > sact) ? stgt - sact : 0;
+	zones->sdv_used = uact;
 }
 
 /**
@@ -189,9 +321,7 @@ merr_t smap_drive_usage(struct mpool_descriptor *mp, u16 pdh, struct mpool_devpr
 
 	zonepg = pd->pdi_parm.dpr_zonepg;
 
-	spin_lock(&pd->pdi_ds.sda_dalock);
 	smap_calc_znstats(pd, &zones);
-	spin_unlock(&pd->pdi_ds.sda_dalock);
 
 	dprop->pdp_total = (zones.sdv_total * zonepg) << PAGE_SHIFT;
 	dprop->pdp_avail = (zones.sdv_avail * zonepg) << PAGE_SHIFT;
@@ -226,6 +356,8 @@ merr_t smap_drive_init(struct mpool_descriptor *mp, struct mc_smap_parms *mcsp,
 		err = smap_drive_sballoc(mp, pdh);
 		if (err)
 			mp_pr_err("smap(%s, %s): sb alloc failed", err, mp->pds_name, pd->pdi_name);
+		else
+			err = smap_drive_zbadalloc(mp, pdh);
 	} else {
 		mp_pr_err("smap(%s, %s): drive alloc failed", err, mp->pds_name, pd->pdi_name);
 	}
@@ -258,7 +390,7 @@ void smap_drive_free(struct mpool_descriptor *mp, u16 pdh)
 			root = &pd->pdi_rmbktv[rgn].pdi_rmroot;
 
 			rbtree_postorder_for_each_entry_safe(zone, tmp, root, smz_node) {
-				kmem_cache_free(smap_zone_cache, zone);
+				objcache_free(&smap_zone_oc, zone);
 			}
 		}
 
@@ -266,9 +398,14 @@ void smap_drive_free(struct mpool_descriptor *mp, u16 pdh)
 		pd->pdi_rmbktv = NULL;
 	}
 
+	/* Cached zones are not in the rgn maps and need no other cleanup. */
+	free_percpu(pd->pdi_zcache);
+	pd->pdi_zcache = NULL;
+
 	pd->pdi_ds.sda_rgnsz = 0;
 	pd->pdi_ds.sda_rgnladdr = 0;
 	pd->pdi_ds.sda_rgnalloc = 0;
+	pd->pdi_ds.sda_rgndrain = SMAP_RGN_NONE;
 	pd->pdi_ds.sda_zoneeff = 0;
 	pd->pdi_ds.sda_utgt = 0;
 	pd->pdi_ds.sda_uact = 0;
@@ -341,47 +478,120 @@ static bool smap_alloccheck(struct mpool_dev_info *pd, u64 zonecnt, enum smap_sp
 }
 
 /**
- * See smap.h.
+ * smap_rgn_pick() - pick the rgn an allocation starts from per mp_smappolicy
+ * @mp:
+ * @pd:
+ * @zonecnt: number of zones to allocate
+ * @rgn:     next rgn in round-robin order, breaks ties
+ * @rgnc:    rgn count
+ *
+ * The rgn counters are read without the rgn locks, the pick is only a hint.
  */
-merr_t
-smap_alloc(
-	struct mpool_descriptor *mp,
-	u16                      pdh,
-	u64                      zonecnt,
-	enum smap_space_type     sapolicy,
-	u64                     *zoneaddr,
-	u64                      align)
+static u8 smap_rgn_pick(struct mpool_descriptor *mp, struct mpool_dev_info *pd, u64 zonecnt,
+			u8 rgn, u8 rgnc)
+{
+	struct rmbkt   *rb;
+	u64             free, wear, best = 0;
+	u8              pick = rgn;
+	bool            found = false;
+	int             i;
+
+	for (i = 0; i < rgnc; i++, rgn = (rgn + 1) % rgnc) {
+		rb = &pd->pdi_rmbktv[rgn];
+		free = READ_ONCE(rb->pdi_rmfree);
+
+		if (free < zonecnt)
+			continue;
+
+		if (mp->pds_params.mp_smappolicy == SMAP_RGN_WEAR) {
+			wear = READ_ONCE(rb->pdi_rmwear);
+			if (!found || wear < best) {
+				best = wear;
+				pick = rgn;
+			}
+		} else if (!found || free > best) {
+			best = free;
+			pick = rgn;
+		}
+
+		found = true;
+	}
+
+	return pick;
+}
+
+/**
+ * smap_rgn_fit() - find a free extent of a rgn able to hold an allocation
+ * @pd:
+ * @rgn:
+ * @zonecnt: number of zones
+ * @align:   no. of zones (must be a power-of-2)
+ * @ualen:   (output) zones skipped at the start of the extent for alignment
+ *
+ * Return: the extent with the rgn lock held, NULL with the lock released
+ * if the rgn has no room
+ */
+static struct smap_zone *
+smap_rgn_fit(struct mpool_dev_info *pd, u32 rgn, u64 zonecnt, u64 align, u64 *ualen)
+{
+	struct smap_zone   *elem;
+	struct rb_root     *rmap;
+
+	rmap = &pd->pdi_rmbktv[rgn].pdi_rmroot;
+
+	mutex_lock(&pd->pdi_rmbktv[rgn].pdi_rmlock);
+
+	/* Visit only the extents long enough to hold zonecnt, in address order. */
+	elem = smap_zone_first_fit(rmap->rb_node, zonecnt);
+	for (; elem; elem = smap_zone_next_fit(elem, zonecnt)) {
+		*ualen = 0;
+		if (IS_ALIGNED(elem->smz_key, align))
+			return elem;
+
+		*ualen = ALIGN(elem->smz_key, align) - elem->smz_key;
+		if (*ualen + zonecnt <= elem->smz_value)
+			return elem;
+	}
+
+	mutex_unlock(&pd->pdi_rmbktv[rgn].pdi_rmlock);
+
+	return NULL;
+}
+
+/**
+ * smap_rmap_alloc() - carve a contiguous zone range out of the rgn space maps
+ * @mp:
+ * @pd:
+ * @zonecnt:  number of zones
+ * @sapolicy: space policy charged for the range, or SMAP_SPC_UNDEF to leave
+ *            the range accounted as free (used to refill the zone caches)
+ * @zoneaddr: (output) first zone of the range
+ * @align:    no. of zones (must be a power-of-2)
+ * @rgnc:     rgn count
+ */
+static merr_t
+smap_rmap_alloc(
+	struct mpool_descriptor    *mp,
+	struct mpool_dev_info      *pd,
+	u64                         zonecnt,
+	enum smap_space_type        sapolicy,
+	u64                        *zoneaddr,
+	u64                         align,
+	u8                          rgnc)
 {
-	struct mpool_dev_info *pd;
 	struct smap_dev_alloc *ds;
 	struct mutex          *rmlock = NULL;
 	struct rb_root        *rmap = NULL;
 	struct smap_zone  *elem = NULL;
-	struct media_class    *mc;
-	struct mc_smap_parms   mcsp;
-	merr_t err;
 	u64    fsoff = 0;
 	u64    fslen = 0;
 	u64    ualen = 0;
-	s8     rgnleft;
+	u32    drain;
 	bool   res;
 	u8     rgn  = 0;
-	u8     rgnc;
-
-	*zoneaddr = 0;
-	pd = &mp->pds_pdv[pdh];
-
-	if (ev(!zonecnt || !saptype_valid(sapolicy)))
-		return merr(EINVAL);
-
-	assert(is_power_of_2(align));
+	int    i;
 
 	ds = &pd->pdi_ds;
-	mc = &mp->pds_mc[pd->pdi_mclass];
-	err = mc_smap_parms_get(mp, mc->mc_parms.mcp_classp, &mcsp);
-	if (ev(err))
-		return err;
-	rgnc = mcsp.mcsp_rgnc;
 
 	/*
 	 * We do not update the last rgn alloced beyond this point as it
@@ -393,60 +603,50 @@ smap_alloc(
 	rgn = ds->sda_rgnalloc;
 	spin_unlock(&ds->sda_dalock);
 
-	rgnleft = rgnc;
-
-	/* Search per-rgn space maps for contiguous region. */
-	while (rgnleft--) {
-		struct rb_node        *node;
-
-		rmlock = &pd->pdi_rmbktv[rgn].pdi_rmlock;
-		rmap = &pd->pdi_rmbktv[rgn].pdi_rmroot;
-
-		mutex_lock(rmlock);
-
-		for (node = rb_first(rmap); node; node = rb_next(node)) {
-			elem  = rb_entry(node, struct smap_zone, smz_node);
-			fsoff = elem->smz_key;
-			fslen = elem->smz_value;
+	if (mp->pds_params.mp_smappolicy != SMAP_RGN_RR)
+		rgn = smap_rgn_pick(mp, pd, zonecnt, rgn, rgnc);
 
-			if (zonecnt > fslen)
-				continue;
+	drain = READ_ONCE(ds->sda_rgndrain);
 
-			if (IS_ALIGNED(fsoff, align)) {
-				ualen = 0;
-				break;
-			}
-
-			ualen = ALIGN(fsoff, align) - fsoff;
-			if (ualen + zonecnt > fslen)
-				continue;
-
-			break;
-		}
+	/* Search per-rgn space maps for contiguous region. */
+	for (i = 0; i < rgnc; i++, rgn = (rgn + 1) % rgnc) {
+		if (rgn == drain)
+			continue;
 
-		if (node)
+		elem = smap_rgn_fit(pd, rgn, zonecnt, align, &ualen);
+		if (elem)
 			break;
+	}
 
-		mutex_unlock(rmlock);
-
-		rgn = (rgn + 1) % rgnc;
+	/* The rgn being defragmented is the last resort */
+	if (!elem && drain < rgnc) {
+		rgn = drain;
+		elem = smap_rgn_fit(pd, rgn, zonecnt, align, &ualen);
 	}
 
-	if (rgnleft < 0)
+	if (!elem)
 		return merr(ENOSPC);
 
+	rmlock = &pd->pdi_rmbktv[rgn].pdi_rmlock;
+	rmap = &pd->pdi_rmbktv[rgn].pdi_rmroot;
+	fsoff = elem->smz_key;
+	fslen = elem->smz_value;
+
 	/* Alloc from this free space if permitted. First fit. */
-	res = smap_alloccheck(pd, zonecnt, sapolicy);
-	if (!res) {
-		mutex_unlock(rmlock);
-		return merr(ENOSPC);
+	if (sapolicy != SMAP_SPC_UNDEF) {
+		res = smap_alloccheck(pd, zonecnt, sapolicy);
+		if (!res) {
+			mutex_unlock(rmlock);
+			return merr(ENOSPC);
+		}
 	}
 
 	fsoff = fsoff + ualen;
 	fslen = fslen - ualen;
 
 	*zoneaddr = fsoff;
-	rb_erase(&elem->smz_node, rmap);
+	smap_zone_erase(rmap, elem);
+	WRITE_ONCE(pd->pdi_rmbktv[rgn].pdi_rmfree, pd->pdi_rmbktv[rgn].pdi_rmfree - zonecnt);
 
 	if (zonecnt < fslen) {
 		/* Re-use elem */
@@ -458,7 +658,7 @@ smap_alloc(
 
 	if (ualen) {
 		if (!elem) {
-			elem = kmem_cache_alloc(smap_zone_cache, GFP_ATOMIC);
+			elem = objcache_alloc(&smap_zone_oc, GFP_ATOMIC, false);
 			if (ev(!elem)) {
 				mutex_unlock(rmlock);
 				return merr(ENOMEM);
@@ -474,14 +674,262 @@ smap_alloc(
 	mutex_unlock(rmlock);
 
 	if (elem)
-		kmem_cache_free(smap_zone_cache, elem);
+		objcache_free(&smap_zone_oc, elem);
 
 	return 0;
 }
 
+/*
+ * Pop a zone from this cpu's zone cache.
+ */
+static bool smap_zcache_get(struct mpool_dev_info *pd, u64 *zoneaddr)
+{
+	struct smap_zcache *zc;
+	bool                hit = false;
+
+	zc = get_cpu_ptr(pd->pdi_zcache);
+	spin_lock(&zc->szc_lock);
+	if (zc->szc_cnt > 0) {
+		*zoneaddr = zc->szc_zonev[--zc->szc_cnt];
+		hit = true;
+	}
+	spin_unlock(&zc->szc_lock);
+	put_cpu_ptr(pd->pdi_zcache);
+
+	return hit;
+}
+
+/*
+ * Push a zone onto this cpu's zone cache, fails if the cache is full.
+ */
+static bool smap_zcache_put(struct mpool_dev_info *pd, u64 zoneaddr)
+{
+	struct smap_zcache *zc;
+	bool                added = false;
+
+	zc = get_cpu_ptr(pd->pdi_zcache);
+	spin_lock(&zc->szc_lock);
+	if (zc->szc_cnt < SMAP_ZCACHE_MAX) {
+		zc->szc_zonev[zc->szc_cnt++] = zoneaddr;
+		added = true;
+	}
+	spin_unlock(&zc->szc_lock);
+	put_cpu_ptr(pd->pdi_zcache);
+
+	return added;
+}
+
+/**
+ * smap_zcache_drain() - return all cached zones of a drive to the rgn space maps
+ * @mp:
+ * @pd:
+ *
+ * Return: number of zones drained
+ */
+static u32 smap_zcache_drain(struct mpool_descriptor *mp, struct mpool_dev_info *pd)
+{
+	u64    zonev[SMAP_ZCACHE_MAX];
+	u32    drained = 0;
+	int    cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct smap_zcache *zc;
+		merr_t              err;
+		u32                 cnt, i;
+
+		zc = per_cpu_ptr(pd->pdi_zcache, cpu);
+
+		spin_lock(&zc->szc_lock);
+		cnt = zc->szc_cnt;
+		memcpy(zonev, zc->szc_zonev, cnt * sizeof(zonev[0]));
+		zc->szc_cnt = 0;
+		spin_unlock(&zc->szc_lock);
+
+		for (i = 0; i < cnt; i++) {
+			err = smap_free_byrgn(pd, smap_addr2rgn(mp, pd, zonev[i]), zonev[i], 1, false);
+			ev(err);
+		}
+
+		drained += cnt;
+	}
+
+	return drained;
+}
+
+/**
+ * smap_zcache_alloc() - allocate a single zone via this cpu's zone cache
+ * @mp:
+ * @pd:
+ * @sapolicy:
+ * @zoneaddr: (output)
+ * @rgnc:
+ *
+ * A cache miss carves SMAP_ZCACHE_BATCH contiguous zones out of the rgn
+ * space maps, returns the first one and caches the rest.
+ */
+static merr_t
+smap_zcache_alloc(
+	struct mpool_descriptor    *mp,
+	struct mpool_dev_info      *pd,
+	enum smap_space_type        sapolicy,
+	u64                        *zoneaddr,
+	u8                          rgnc)
+{
+	merr_t  err;
+	u64     zaddr;
+	int     i;
+
+	if (!smap_zcache_get(pd, &zaddr)) {
+		err = smap_rmap_alloc(mp, pd, SMAP_ZCACHE_BATCH, SMAP_SPC_UNDEF, &zaddr, 1, rgnc);
+		if (err)
+			return err;
+
+		/* Cache in reverse order so that the zones are handed out ascending. */
+		for (i = SMAP_ZCACHE_BATCH - 1; i > 0; i--) {
+			if (!smap_zcache_put(pd, zaddr + i))
+				break;
+		}
+
+		if (i > 0) {
+			err = smap_free_byrgn(pd, smap_addr2rgn(mp, pd, zaddr), zaddr + 1, i, false);
+			ev(err);
+		}
+	}
+
+	if (!smap_alloccheck(pd, 1, sapolicy)) {
+		if (!smap_zcache_put(pd, zaddr)) {
+			err = smap_free_byrgn(pd, smap_addr2rgn(mp, pd, zaddr), zaddr, 1, false);
+			ev(err);
+		}
+
+		return merr(ENOSPC);
+	}
+
+	*zoneaddr = zaddr;
+
+	return 0;
+}
+
+/**
+ * See smap.h.
+ */
+merr_t
+smap_alloc(
+	struct mpool_descriptor *mp,
+	u16                      pdh,
+	u64                      zonecnt,
+	enum smap_space_type     sapolicy,
+	u64                     *zoneaddr,
+	u64                      align)
+{
+	struct mpool_dev_info *pd;
+	struct media_class    *mc;
+	struct mc_smap_parms   mcsp;
+	merr_t err;
+	u64    tstart;
+	u8     rgnc;
+
+	*zoneaddr = 0;
+	pd = &mp->pds_pdv[pdh];
+
+	if (ev(!zonecnt || !saptype_valid(sapolicy)))
+		return merr(EINVAL);
+
+	assert(is_power_of_2(align));
+
+	mc = &mp->pds_mc[pd->pdi_mclass];
+	err = mc_smap_parms_get(mp, mc->mc_parms.mcp_classp, &mcsp);
+	if (ev(err))
+		return err;
+	rgnc = mcsp.mcsp_rgnc;
+
+	tstart = trace_mpool_smap_alloc_enabled() ? ktime_get_ns() : 0;
+
+	if (zonecnt == 1 && pd->pdi_zcache) {
+		err = smap_zcache_alloc(mp, pd, sapolicy, zoneaddr, rgnc);
+		if (merr_errno(err) != ENOSPC)
+			goto out;
+	}
+
+	err = smap_rmap_alloc(mp, pd, zonecnt, sapolicy, zoneaddr, align, rgnc);
+
+	/*
+	 * The zone caches may hold the space needed to satisfy this request,
+	 * or break up the contiguous range it requires.  Drain and retry.
+	 */
+	if (merr_errno(err) == ENOSPC && pd->pdi_zcache && smap_zcache_drain(mp, pd) > 0)
+		err = smap_rmap_alloc(mp, pd, zonecnt, sapolicy, zoneaddr, align, rgnc);
+
+out:
+	if (tstart)
+		trace_mpool_smap_alloc(mp, pdh, *zoneaddr, zonecnt, ktime_get_ns() - tstart, err);
+
+	return err;
+}
+
+/**
+ * See smap.h.
+ */
+bool smap_rgn_frag(struct mpool_descriptor *mp, u16 pdh, u32 pctfrag, u32 *rgn, u64 *zaddr,
+		   u64 *zcnt)
+{
+	struct mpool_dev_info *pd = &mp->pds_pdv[pdh];
+	struct mc_smap_parms   mcsp;
+	struct rmbkt          *rb;
+	u64    free, maxlen, frag, best = 0;
+	bool   found = false;
+	u32    i;
+
+	if (!pd->pdi_rmbktv || mc_smap_parms_get(mp, pd->pdi_mclass, &mcsp))
+		return false;
+
+	for (i = 0; i < mcsp.mcsp_rgnc; i++) {
+		rb = &pd->pdi_rmbktv[i];
+
+		mutex_lock(&rb->pdi_rmlock);
+		free = rb->pdi_rmfree;
+		maxlen = smap_zone_maxlen(rb->pdi_rmroot.rb_node);
+		mutex_unlock(&rb->pdi_rmlock);
+
+		if (maxlen >= free)
+			continue;
+
+		frag = div64_u64((free - maxlen) * 100, free);
+		if (frag < pctfrag || (found && frag <= best))
+			continue;
+
+		best = frag;
+		*rgn = i;
+		found = true;
+	}
+
+	if (!found)
+		return false;
+
+	*zaddr = (u64)*rgn * pd->pdi_ds.sda_rgnsz;
+	if (*rgn < mcsp.mcsp_rgnc - 1)
+		*zcnt = pd->pdi_ds.sda_rgnsz;
+	else
+		*zcnt = pd->pdi_parm.dpr_zonetot - *zaddr;
+
+	return true;
+}
+
 /**
  * See smap.h.
  */
+void smap_rgn_drain(struct mpool_descriptor *mp, u16 pdh, u32 rgn)
+{
+	struct mpool_dev_info *pd = &mp->pds_pdv[pdh];
+
+	spin_lock(&pd->pdi_ds.sda_dalock);
+	WRITE_ONCE(pd->pdi_ds.sda_rgndrain, rgn);
+	spin_unlock(&pd->pdi_ds.sda_dalock);
+
+	if (rgn != SMAP_RGN_NONE && pd->pdi_zcache)
+		smap_zcache_drain(mp, pd);
+}
+
 /*
  * smap internal functions
  */
@@ -500,6 +948,7 @@ merr_t smap_drive_alloc(struct mpool_descriptor *mp, struct mc_smap_parms *mcsp,
 	u32                    rgnsz = 0;
 	merr_t                 err;
 	u8                     rgnc;
+	int                    cpu;
 
 	rgnc  = mcsp->mcsp_rgnc;
 	rgnsz = pd->pdi_parm.dpr_zonetot / rgnc;
@@ -510,6 +959,16 @@ merr_t smap_drive_alloc(struct mpool_descriptor *mp, struct mc_smap_parms *mcsp,
 		return err;
 	}
 
+	pd->pdi_zcache = alloc_percpu(struct smap_zcache);
+	if (!pd->pdi_zcache) {
+		err = merr(ENOMEM);
+		mp_pr_err("smap(%s, %s): zcache alloc failed", err, mp->pds_name, pd->pdi_name);
+		return err;
+	}
+
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(pd->pdi_zcache, cpu)->szc_lock);
+
 	/* Allocate and init per channel space maps and associated locks */
 	pd->pdi_rmbktv = kcalloc(rgnc, sizeof(*pd->pdi_rmbktv), GFP_KERNEL);
 	if (!pd->pdi_rmbktv) {
@@ -522,7 +981,7 @@ merr_t smap_drive_alloc(struct mpool_descriptor *mp, struct mc_smap_parms *mcsp,
 	for (rgn = 0; rgn < rgnc; rgn++) {
 		mutex_init(&pd->pdi_rmbktv[rgn].pdi_rmlock);
 
-		urb_elem = kmem_cache_alloc(smap_zone_cache, GFP_KERNEL);
+		urb_elem = objcache_alloc(&smap_zone_oc, GFP_KERNEL, false);
 		if (!urb_elem) {
 			struct rb_root *rmroot;
 
@@ -531,8 +990,8 @@ merr_t smap_drive_alloc(struct mpool_descriptor *mp, struct mc_smap_parms *mcsp,
 
 				found_ue = smap_zone_find(rmroot, 0);
 				if (found_ue) {
-					rb_erase(&found_ue->smz_node, rmroot);
-					kmem_cache_free(smap_zone_cache, found_ue);
+					smap_zone_erase(rmroot, found_ue);
+					objcache_free(&smap_zone_oc, found_ue);
 				}
 			}
 
@@ -551,13 +1010,17 @@ merr_t smap_drive_alloc(struct mpool_descriptor *mp, struct mc_smap_parms *mcsp,
 		else
 			urb_elem->smz_value = pd->pdi_parm.dpr_zonetot - (rgn * rgnsz);
 		smap_zone_insert(&pd->pdi_rmbktv[rgn].pdi_rmroot, urb_elem);
+		pd->pdi_rmbktv[rgn].pdi_rmfree = urb_elem->smz_value;
 	}
 
 	spin_lock_init(&pd->pdi_ds.sda_dalock);
 	pd->pdi_ds.sda_rgnalloc = 0;
+	pd->pdi_ds.sda_rgndrain = SMAP_RGN_NONE;
 	pd->pdi_ds.sda_rgnsz = rgnsz;
 	pd->pdi_ds.sda_rgnladdr = (rgnc - 1) * rgnsz;
 	pd->pdi_ds.sda_zoneeff = pd->pdi_parm.dpr_zonetot;
+	if (pd->pdi_parm.dpr_zoned)
+		pd->pdi_ds.sda_zoneeff -= pd->pdi_parm.dpr_zoned->pz_badcnt;
 	pd->pdi_ds.sda_utgt = (pd->pdi_ds.sda_zoneeff * (100 - mcsp->mcsp_spzone)) / 100;
 	pd->pdi_ds.sda_uact = 0;
 	pd->pdi_ds.sda_stgt = pd->pdi_ds.sda_zoneeff - pd->pdi_ds.sda_utgt;
@@ -593,6 +1056,45 @@ static merr_t smap_drive_sballoc(struct mpool_descriptor *mp, u16 pdh)
 	return err;
 }
 
+/*
+ * Add entries to space map covering the offline and read-only zones of a
+ * zoned drive.  Those are not part of the drive's effective zones, hence
+ * not accounted as used.
+ * Returns: 0 if successful, merr_t otherwise
+ */
+static merr_t smap_drive_zbadalloc(struct mpool_descriptor *mp, u16 pdh)
+{
+	struct mpool_dev_info  *pd = &mp->pds_pdv[pdh];
+	struct pd_zoned        *pz = pd->pdi_parm.dpr_zoned;
+	merr_t                  err;
+	u32                     zonetot, zaddr, zend, cnt = 0;
+
+	if (!pz || !pz->pz_badcnt)
+		return 0;
+
+	zonetot = pd->pdi_parm.dpr_zonetot;
+
+	for (zaddr = find_first_bit(pz->pz_badmap, zonetot); zaddr < zonetot;
+	     zaddr = find_next_bit(pz->pz_badmap, zonetot, zend)) {
+		zend = find_next_zero_bit(pz->pz_badmap, zonetot, zaddr);
+
+		err = smap_insert(mp, pdh, zaddr, zend - zaddr);
+		if (err) {
+			mp_pr_err("smap(%s, %s): bad zones insert failed, zoneaddr %u cnt %u",
+				  err, mp->pds_name, pd->pdi_name, zaddr, zend - zaddr);
+			return err;
+		}
+
+		cnt += zend - zaddr;
+	}
+
+	spin_lock(&pd->pdi_ds.sda_dalock);
+	pd->pdi_ds.sda_uact -= cnt;
+	spin_unlock(&pd->pdi_ds.sda_dalock);
+
+	return 0;
+}
+
 void smap_mclass_usage(struct mpool_descriptor *mp, u8 mclass, struct mpool_usage *usage)
 {
 	struct media_class         *mc;
@@ -607,9 +1109,7 @@ void smap_mclass_usage(struct mpool_descriptor *mp, u8 mclass, struct mpool_usag
 	pd = &mp->pds_pdv[mc->mc_pdmc];
 	zonepg = pd->pdi_zonepg;
 
-	spin_lock(&pd->pdi_ds.sda_dalock);
 	smap_calc_znstats(pd, &zones);
-	spin_unlock(&pd->pdi_ds.sda_dalock);
 
 	usage->mpu_total  += ((zones.sdv_total * zonepg) << PAGE_SHIFT);
 	usage->mpu_usable += ((zones.sdv_usable * zonepg) << PAGE_SHIFT);
@@ -693,7 +1193,7 @@ static merr_t smap_insert_byrgn(struct mpool_dev_info *pd, u32 rgn, u64 zoneaddr
 		goto errout;
 	}
 
-	rb_erase(&elem->smz_node, rmap);
+	smap_zone_erase(rmap, elem);
 
 	if (zoneaddr > fsoff) {
 		elem->smz_key = fsoff;
@@ -703,7 +1203,7 @@ static merr_t smap_insert_byrgn(struct mpool_dev_info *pd, u32 rgn, u64 zoneaddr
 	}
 	if (zoneaddr + zonecnt < fsoff + fslen) {
 		if (!elem)
-			elem = kmem_cache_alloc(smap_zone_cache, GFP_KERNEL);
+			elem = objcache_alloc(&smap_zone_oc, GFP_KERNEL, false);
 		if (!elem) {
 			msg = "chunk alloc failed";
 			err = merr(ENOMEM);
@@ -716,6 +1216,8 @@ static merr_t smap_insert_byrgn(struct mpool_dev_info *pd, u32 rgn, u64 zoneaddr
 		elem = NULL;
 	}
 
+	WRITE_ONCE(pd->pdi_rmbktv[rgn].pdi_rmfree, pd->pdi_rmbktv[rgn].pdi_rmfree - zonecnt);
+
 	/* Insert consumes usable only; possible for uact > utgt.*/
 	spin_lock(&pd->pdi_ds.sda_dalock);
 	pd->pdi_ds.sda_uact = pd->pdi_ds.sda_uact + zonecnt;
@@ -727,7 +1229,7 @@ errout:
 	if (elem != NULL) {
 		/* Was an exact match */
 		assert((zoneaddr == fsoff) && (zonecnt == fslen));
-		kmem_cache_free(smap_zone_cache, elem);
+		objcache_free(&smap_zone_oc, elem);
 	}
 
 	if (err)
@@ -795,20 +1297,45 @@ merr_t smap_insert(struct mpool_descriptor *mp, u16 pdh, u64 zoneaddr, u32 zonec
 }
 
 
+/*
+ * Credit zonecnt freed zones back to the drive; freed space goes to
+ * spare first then usable.
+ */
+static void smap_freecheck(struct mpool_dev_info *pd, u64 zonecnt)
+{
+	spin_lock(&pd->pdi_ds.sda_dalock);
+	if (pd->pdi_ds.sda_sact > 0) {
+		if (pd->pdi_ds.sda_sact > zonecnt) {
+			pd->pdi_ds.sda_sact -= zonecnt;
+			zonecnt = 0;
+		} else {
+			zonecnt -= pd->pdi_ds.sda_sact;
+			pd->pdi_ds.sda_sact = 0;
+		}
+	}
+
+	pd->pdi_ds.sda_uact -= zonecnt;
+	spin_unlock(&pd->pdi_ds.sda_dalock);
+}
+
 /**
  * smap_free_byrgn() - free the specified range of zones
  * @pd:         physical device object
  * @rgn:       allocation rgn specifier
  * @zoneaddr:    offset into the space map
  * @zonecnt:     length of range to be freed
+ * @acct:        credit the range back to the drive's space accounting
  *
  * Free the given range of zone (i.e., [%zoneaddr, %zoneaddr + %zonecnt])
  * back to the indicated space map.  Always coalesces ranges in the space
  * map that abut the range to be freed so as to minimize fragmentation.
  *
+ * Ranges coming back from the zone caches were never charged, hence are
+ * returned with acct false.
+ *
  * Return: 0 if successful, merr_t otherwise
  */
-static merr_t smap_free_byrgn(struct mpool_dev_info *pd, u32 rgn, u64 zoneaddr, u32 zonecnt)
+static merr_t smap_free_byrgn(struct mpool_dev_info *pd, u32 rgn, u64 zoneaddr, u32 zonecnt, bool acct)
 {
 	const char             *msg __maybe_unused;
 	struct smap_zone   *left, *right;
@@ -850,7 +1377,7 @@ static merr_t smap_free_byrgn(struct mpool_dev_info *pd, u32 rgn, u64 zoneaddr,
 	if (right) {
 		if (zoneaddr + zonecnt == right->smz_key) {
 			zonecnt += right->smz_value;
-			rb_erase(&right->smz_node, rmap);
+			smap_zone_erase(rmap, right);
 
 			new = right;  /* re-use right node */
 		}
@@ -861,7 +1388,7 @@ static merr_t smap_free_byrgn(struct mpool_dev_info *pd, u32 rgn, u64 zoneaddr,
 		if (left->smz_key + left->smz_value == zoneaddr) {
 			zoneaddr = left->smz_key;
 			zonecnt += left->smz_value;
-			rb_erase(&left->smz_node, rmap);
+			smap_zone_erase(rmap, left);
 
 			old = new;  /* free new/left outside the critsec */
 			new = left; /* re-use left node */
@@ -879,7 +1406,7 @@ static merr_t smap_free_byrgn(struct mpool_dev_info *pd, u32 rgn, u64 zoneaddr,
 	 * be recovered once the mpool is closed and re-opened.
 	 */
 	if (!new) {
-		new = kmem_cache_alloc(smap_zone_cache, GFP_ATOMIC);
+		new = objcache_alloc(&smap_zone_oc, GFP_ATOMIC, false);
 		if (!new) {
 			msg = "chunk alloc failed";
 			err = merr(ENOMEM);
@@ -891,34 +1418,25 @@ static merr_t smap_free_byrgn(struct mpool_dev_info *pd, u32 rgn, u64 zoneaddr,
 	new->smz_value = zonecnt;
 
 	if (!smap_zone_insert(rmap, new)) {
-		kmem_cache_free(smap_zone_cache, new);
+		objcache_free(&smap_zone_oc, new);
 		msg = "chunk insert failed";
 		err = merr(EBUG);
 		goto unlock;
 	}
 
-	/* Freed space goes to spare first then usable. */
-	zonecnt = orig_zonecnt;
+	WRITE_ONCE(pd->pdi_rmbktv[rgn].pdi_rmfree, pd->pdi_rmbktv[rgn].pdi_rmfree + orig_zonecnt);
 
-	spin_lock(&pd->pdi_ds.sda_dalock);
-	if (pd->pdi_ds.sda_sact > 0) {
-		if (pd->pdi_ds.sda_sact > zonecnt) {
-			pd->pdi_ds.sda_sact -= zonecnt;
-			zonecnt = 0;
-		} else {
-			zonecnt -= pd->pdi_ds.sda_sact;
-			pd->pdi_ds.sda_sact = 0;
-		}
+	if (acct) {
+		WRITE_ONCE(pd->pdi_rmbktv[rgn].pdi_rmwear,
+			   pd->pdi_rmbktv[rgn].pdi_rmwear + orig_zonecnt);
+		smap_freecheck(pd, orig_zonecnt);
 	}
 
-	pd->pdi_ds.sda_uact -= zonecnt;
-	spin_unlock(&pd->pdi_ds.sda_dalock);
-
 unlock:
 	mutex_unlock(&pd->pdi_rmbktv[rgn].pdi_rmlock);
 
 	if (old)
-		kmem_cache_free(smap_zone_cache, old);
+		objcache_free(&smap_zone_oc, old);
 
 	if (err)
 		mp_pr_err("smap pd %s: %s, free byrgn failed, rgn %u zoneaddr %lu zonecnt %u",
@@ -938,6 +1456,7 @@ merr_t smap_free(struct mpool_descriptor *mp, u16 pdh, u64 zoneaddr, u16 zonecnt
 	u64                    zonefreed = 0;
 	u32                    raddr    = 0;
 	u64                    rcnt     = 0;
+	u64                    tstart;
 
 	pd = &mp->pds_pdv[pdh];
 
@@ -953,6 +1472,15 @@ merr_t smap_free(struct mpool_descriptor *mp, u16 pdh, u64 zoneaddr, u16 zonecnt
 		/* Nothing to be returned */
 		return 0;
 
+	tstart = trace_mpool_smap_free_enabled() ? ktime_get_ns() : 0;
+
+	if (zonecnt == 1 && pd->pdi_zcache &&
+	    smap_addr2rgn(mp, pd, zoneaddr) != READ_ONCE(pd->pdi_ds.sda_rgndrain) &&
+	    smap_zcache_put(pd, zoneaddr)) {
+		smap_freecheck(pd, zonecnt);
+		goto out;
+	}
+
 	/*
 	 * smap_alloc() never crosses regions. however a previous instantiation
 	 * of this mpool might have used a different value of rgn count
@@ -974,7 +1502,7 @@ merr_t smap_free(struct mpool_descriptor *mp, u16 pdh, u64 zoneaddr, u16 zonecnt
 		else
 			rcnt = zonecnt - zonefreed;
 
-		err = smap_free_byrgn(pd, rgn, raddr, rcnt);
+		err = smap_free_byrgn(pd, rgn, raddr, rcnt, true);
 		if (err) {
 			mp_pr_err("smap(%s, %s): free byrgn failed, rgn %d raddr %lu, rcnt %lu",
 				  err, mp->pds_name, pd->pdi_name, rgn, (ulong)raddr, (ulong)rcnt);
@@ -983,6 +1511,10 @@ merr_t smap_free(struct mpool_descriptor *mp, u16 pdh, u64 zoneaddr, u16 zonecnt
 		zonefreed = zonefreed + rcnt;
 	}
 
+out:
+	if (tstart)
+		trace_mpool_smap_free(mp, pdh, zoneaddr, zonecnt, ktime_get_ns() - tstart, err);
+
 	return err;
 }
 
@@ -1040,6 +1572,6 @@ void smap_log_mpool_usage(struct work_struct *ws)
 	}
 
 	/* Schedule the next run of smap_log_mpool_usage() */
-	queue_delayed_work(mp->pds_workq, &smapu->smapu_wstruct,
-			   msecs_to_jiffies(mp->pds_params.mp_mpusageperiod));
+	mpool_queue_dwork(mp, MPOOL_WQ_USAGE, &smapu->smapu_wstruct,
+			  msecs_to_jiffies(mp->pds_params.mp_mpusageperiod));
 }
@@ -17,17 +17,43 @@ struct mc_smap_parms;
  */
 
 /**
- * struct smap_zone -
- * @smz_node:
- * @smz_key:
- * @smz_value:
+ * struct smap_zone - free extent in a rgn space map
+ * @smz_node:   rgn space map linkage, keyed by smz_key
+ * @smz_key:    first zone of the extent
+ * @smz_value:  length of the extent in zones
+ * @smz_maxlen: max smz_value in the subtree rooted at this node
  */
 struct smap_zone {
 	struct rb_node  smz_node;
 	u64             smz_key;
 	u64             smz_value;
+	u64             smz_maxlen;
 };
 
+/*
+ * SMAP_ZCACHE_MAX:   max free zones held in a per-cpu zone cache
+ * SMAP_ZCACHE_BATCH: number of contiguous zones carved per cache refill
+ */
+#define SMAP_ZCACHE_MAX     32
+#define SMAP_ZCACHE_BATCH   16
+
+/**
+ * struct smap_zcache - per-cpu cache of free single zones
+ * @szc_lock:  protects szc_cnt and szc_zonev
+ * @szc_cnt:   number of valid entries in szc_zonev
+ * @szc_zonev: zone addresses, consumed LIFO
+ *
+ * Zones in a cache have been removed from their rgn space map but are
+ * still accounted as free in smap_dev_alloc; they are charged only when
+ * handed out by smap_alloc().  szc_lock is only ever contended when the
+ * caches are drained back to the space maps.
+ */
+struct smap_zcache {
+	spinlock_t  szc_lock;
+	u32         szc_cnt;
+	u64         szc_zonev[SMAP_ZCACHE_MAX];
+} ____cacheline_aligned;
+
 /*
  * enum smap_space_type - space allocation policy flag
  *
@@ -47,6 +73,22 @@ enum smap_space_type {
 	SMAP_SPC_SPARE_2_USABLE  = 4
 };
 
+/*
+ * enum smap_rgn_policy - selection of the rgn an allocation starts from
+ *
+ * @SMAP_RGN_RR:   round-robin across rgns
+ * @SMAP_RGN_FREE: rgn with the most free zones
+ * @SMAP_RGN_WEAR: least worn rgn that has enough free zones
+ *
+ * If the selected rgn can't satisfy the allocation, the following rgns
+ * are searched in order.
+ */
+enum smap_rgn_policy {
+	SMAP_RGN_RR    = 0,
+	SMAP_RGN_FREE  = 1,
+	SMAP_RGN_WEAR  = 2,
+};
+
 static inline int saptype_valid(enum smap_space_type saptype)
 {
 	return (saptype && saptype <= 4);
@@ -57,9 +99,14 @@ static inline int saptype_valid(enum smap_space_type saptype)
  *
  * LOCKING:
  * + rgnsz, rgnladdr: constants; no locking required
- * + all other fields: protected by dalock
+ * + all other fields: protected by dalock, except that the usage queries
+ *   read zoneeff, utgt, uact, stgt and sact without it, and allocations
+ *   read rgndrain without it
  */
 
+/* sda_rgndrain value when no rgn is being drained */
+#define SMAP_RGN_NONE       U32_MAX
+
 /*
  * struct smap_dev_alloc -
  *
@@ -67,6 +114,8 @@ static inline int saptype_valid(enum smap_space_type saptype)
  * @sda_rgnsz:    number of zones per rgn, excepting last
  * @sda_rgnladdr: address of first zone in last rgn
  * @sda_rgnalloc: rgn last alloced from
+ * @sda_rgndrain: rgn being defragmented, allocated from only as a last
+ *                resort, or SMAP_RGN_NONE
  * @sda_zoneeff:    total zones (zonetot) minus bad zones
  * @sda_utgt:      target max usable zones to allocate
  * @sda_uact:      actual usable zones allocated
@@ -94,6 +143,7 @@ struct smap_dev_alloc {
 	u32        sda_rgnsz;
 	u32        sda_rgnladdr;
 	u32        sda_rgnalloc;
+	u32        sda_rgndrain;
 	u32        sda_zoneeff;
 	u32        sda_utgt;
 	u32        sda_uact;
@@ -212,7 +262,8 @@ merr_t smap_drive_spares(struct mpool_descriptor *mp, enum mp_media_classp mclas
  * @pdh:   drive number within the mpool_descriptor
  * @dprop: struct mpool_devprops *, structure to fill in
  *
- * Fill in usage portion of dprop for drive pdh; caller must hold mp.pdvlock
+ * Fill in usage portion of dprop for drive pdh; caller must hold mp.pdvlock.
+ * The drive's allocation lock is not taken, so usage may be slightly stale.
  *
  * Return: 0 if successful, merr_t otherwise
  */
@@ -271,6 +322,9 @@ merr_t smap_insert(struct mpool_descriptor *mp, u16 pdh, u64 zoneaddr, u32 zonec
  * Attempt to allocate zonecnt contiguous virtual erase blocks on drive pdh
  * in accordance with space allocation policy sapolicy.
  *
+ * Single zone allocations are served from a per-cpu zone cache, which is
+ * refilled from the rgn space maps SMAP_ZCACHE_BATCH zones at a time.
+ *
  * Return: 0 if succcessful; merr_t otherwise
  */
 merr_t
@@ -290,12 +344,42 @@ smap_alloc(
  * @zonecnt: u16, the number of zones in the range
  *
  * Free currently allocated space starting at virtual erase block zoneaddr
- * and continuing for zonecnt blocks.
+ * and continuing for zonecnt blocks.  A single zone is returned to the
+ * per-cpu zone cache unless it is full.
  *
  * Return: 0 if successful, merr_t otherwise
  */
 merr_t smap_free(struct mpool_descriptor *mp, u16 pdh, u64 zoneaddr, u16 zonecnt);
 
+/**
+ * smap_rgn_frag() - find the most fragmented rgn of a drive
+ * @mp:
+ * @pdh:     drive number within the mpool_descriptor
+ * @pctfrag: min fragmentation, in % of the rgn free zones which are not
+ *           part of its largest free extent
+ * @rgn:     (output) rgn picked
+ * @zaddr:   (output) first zone of the rgn
+ * @zcnt:    (output) number of zones in the rgn
+ *
+ * Rgns with fewer than two free extents are never picked.
+ *
+ * Return: true if a rgn at least pctfrag % fragmented was found
+ */
+bool smap_rgn_frag(struct mpool_descriptor *mp, u16 pdh, u32 pctfrag, u32 *rgn, u64 *zaddr,
+		   u64 *zcnt);
+
+/**
+ * smap_rgn_drain() - set or clear the rgn of a drive being defragmented
+ * @mp:
+ * @pdh: drive number within the mpool_descriptor
+ * @rgn: rgn to drain, SMAP_RGN_NONE to clear
+ *
+ * Allocations on the drive fall back to the drained rgn only if no other
+ * rgn can satisfy them, so that the zones freed in it coalesce.  The zone
+ * caches are drained so that they don't hand out zones of the rgn.
+ */
+void smap_rgn_drain(struct mpool_descriptor *mp, u16 pdh, u32 rgn);
+
 /*
  * smap internal functions
  */
@@ -21,7 +21,7 @@
 #define MDCVER_MAJOR       1
 #define MDCVER_MINOR       0
 #define MDCVER_PATCH       0
-#define MDCVER_DEV         0
+#define MDCVER_DEV         3
 
 /**
  * struct mdcver_info - mpool MDC content version and its information.
@@ -51,6 +51,32 @@ static uint8_t mdcver_1_0_0_0_types[] = {
 	OMF_MDR_OERASE, OMF_MDR_MCCONFIG, OMF_MDR_MCSPARE, OMF_MDR_VERSION,
 	OMF_MDR_MPCONFIG};
 
+/*
+ * mpool MDC types used when MDC content is written at version 1.0.0.1.
+ * MDC compaction checkpoints committed objects in OCKPT records.
+ */
+static uint8_t mdcver_1_0_0_1_types[] = {
+	OMF_MDR_OCREATE, OMF_MDR_OUPDATE, OMF_MDR_ODELETE, OMF_MDR_OIDCKPT,
+	OMF_MDR_OERASE, OMF_MDR_MCCONFIG, OMF_MDR_MCSPARE, OMF_MDR_VERSION,
+	OMF_MDR_MPCONFIG, OMF_MDR_OCKPT};
+
+/*
+ * mpool MDC types used when MDC content is written at version 1.0.0.2.
+ * Same types as 1.0.0.1, object records are varint encoded.
+ */
+static uint8_t mdcver_1_0_0_2_types[] = {
+	OMF_MDR_OCREATE, OMF_MDR_OUPDATE, OMF_MDR_ODELETE, OMF_MDR_OIDCKPT,
+	OMF_MDR_OERASE, OMF_MDR_MCCONFIG, OMF_MDR_MCSPARE, OMF_MDR_VERSION,
+	OMF_MDR_MPCONFIG, OMF_MDR_OCKPT};
+
+/*
+ * mpool MDC types used when MDC content is written at version 1.0.0.3.
+ * Same types as 1.0.0.2, OCREATE/OUPDATE records may flag a compressed mblock.
+ */
+static uint8_t mdcver_1_0_0_3_types[] = {
+	OMF_MDR_OCREATE, OMF_MDR_OUPDATE, OMF_MDR_ODELETE, OMF_MDR_OIDCKPT,
+	OMF_MDR_OERASE, OMF_MDR_MCCONFIG, OMF_MDR_MCSPARE, OMF_MDR_VERSION,
+	OMF_MDR_MPCONFIG, OMF_MDR_OCKPT};
 
 /*
  * mdcver_info mdcvtab[] - table of versions of mpool MDCs content.
@@ -77,9 +103,18 @@ static uint8_t mdcver_1_0_0_0_types[] = {
  *   A third entry is added in the table with its mi_mdcver being 2.0.0.0.
  */
 static struct mdcver_info mdcvtab[] = {
-	{{ {MDCVER_MAJOR, MDCVER_MINOR, MDCVER_PATCH, MDCVER_DEV} },
+	{{ {1, 0, 0, 0} },
 	mdcver_1_0_0_0_types, sizeof(mdcver_1_0_0_0_types),
 	"Initial mpool MDCs content"},
+	{{ {1, 0, 0, 1} },
+	mdcver_1_0_0_1_types, sizeof(mdcver_1_0_0_1_types),
+	"Object checkpoint records"},
+	{{ {1, 0, 0, 2} },
+	mdcver_1_0_0_2_types, sizeof(mdcver_1_0_0_2_types),
+	"Varint encoded object records"},
+	{{ {MDCVER_MAJOR, MDCVER_MINOR, MDCVER_PATCH, MDCVER_DEV} },
+	mdcver_1_0_0_3_types, sizeof(mdcver_1_0_0_3_types),
+	"Compressed mblocks"},
 };
 
 struct omf_mdcver *omfu_mdcver_cur(void)